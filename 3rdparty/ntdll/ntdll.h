@@ -3526,6 +3526,31 @@ typedef struct _SYSTEM_EXTENDED_THREAD_INFORMATION
 	ULONG_PTR Reserved4;
 } SYSTEM_EXTENDED_THREAD_INFORMATION, *PSYSTEM_EXTENDED_THREAD_INFORMATION;
 
+typedef struct _PROCESS_DISK_COUNTERS
+{
+	ULONGLONG BytesRead;
+	ULONGLONG BytesWritten;
+	ULONGLONG ReadOperationCount;
+	ULONGLONG WriteOperationCount;
+	ULONGLONG FlushOperationCount;
+} PROCESS_DISK_COUNTERS, *PPROCESS_DISK_COUNTERS;
+
+// Only the fields common to all versions. Windows 10 appends energy values, AppIdOffset, SharedCommitCharge, JobObjectId and more
+typedef struct _SYSTEM_PROCESS_INFORMATION_EXTENSION
+{
+	PROCESS_DISK_COUNTERS DiskCounters;
+	ULONGLONG ContextSwitches;
+	ULONG Flags;
+	ULONG UserSidOffset;
+	ULONG PackageFullNameOffset; // Since Windows 8
+} SYSTEM_PROCESS_INFORMATION_EXTENSION, *PSYSTEM_PROCESS_INFORMATION_EXTENSION;
+
+typedef struct _SYSTEM_PROCESS_ID_INFORMATION
+{
+	HANDLE ProcessId;
+	UNICODE_STRING ImageName;
+} SYSTEM_PROCESS_ID_INFORMATION, *PSYSTEM_PROCESS_ID_INFORMATION;
+
 #define PTR_ADD_OFFSET(Pointer, Offset) ((PVOID)((ULONG_PTR)(Pointer) + (ULONG_PTR)(Offset)))
 #define PTR_SUB_OFFSET(Pointer, Offset) ((PVOID)((ULONG_PTR)(Pointer) - (ULONG_PTR)(Offset)))
 #define ALIGN_DOWN_BY(Address, Align) ((ULONG_PTR)(Address) & ~((Align) - 1))
@@ -4228,6 +4253,16 @@ NTSTATUS
 	_In_ HANDLE Handle
 	);
 
+typedef
+NTSTATUS
+(NTAPI
+*t_NtSetInformationObject)(
+	_In_ HANDLE Handle,
+	_In_ OBJECT_INFORMATION_CLASS ObjectInformationClass,
+	_In_reads_bytes_(ObjectInformationLength) PVOID ObjectInformation,
+	_In_ ULONG ObjectInformationLength
+	);
+
 typedef
 NTSTATUS
 (NTAPI
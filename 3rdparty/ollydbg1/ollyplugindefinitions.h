@@ -30,6 +30,7 @@ extern "C" int _Gettext(char *title,char *text, char letter,int type,int fontind
 extern "C" int _Attachtoactiveprocess(int newprocessid);
 extern "C" void _Infoline(char *format,...);
 extern "C" t_module* _Findmodule(unsigned long addr);
+extern "C" unsigned long _Readmemory(void *buf,unsigned long addr,unsigned long size,int mode);
 extern "C" unsigned long _Writememory(void *buf,unsigned long addr,unsigned long size,int mode);
 
 #define NBAR 17 // Max allowed number of segments in bar
@@ -0,0 +1,296 @@
+#include "BufferFilters.h"
+
+// Number of table entries of type TEntry that fit in a buffer of Length bytes after a header of HeaderSize bytes
+template<typename TEntry>
+static ULONG MaxEntriesInBuffer(ULONG Length, ULONG HeaderSize)
+{
+    return Length < HeaderSize ? 0 : (Length - HeaderSize) / sizeof(TEntry);
+}
+
+// Whether Name is one of the names in the semicolon separated List
+static bool IsNameInList(PCUNICODE_STRING Name, const WCHAR* List, BOOLEAN CaseInSensitive)
+{
+    while (*List != L'\0')
+    {
+        const WCHAR* End = List;
+        while (*End != L'\0' && *End != L';')
+            End++;
+
+        UNICODE_STRING ListName;
+        ListName.Length = ListName.MaximumLength = (USHORT)((End - List) * sizeof(WCHAR));
+        ListName.Buffer = const_cast<PWSTR>(List);
+        if (ListName.Length != 0 && RtlEqualUnicodeString(&ListName, Name, CaseInSensitive))
+            return true;
+
+        List = *End == L';' ? End + 1 : End;
+    }
+    return false;
+}
+
+bool ParseBadObjectTypes(const UCHAR* Buffer, ULONG BufferSize, const WCHAR* TypeNames, ULONG Bitmap[BAD_OBJECT_TYPE_BITMAP_ULONGS])
+{
+    RtlZeroMemory(Bitmap, BAD_OBJECT_TYPE_BITMAP_ULONGS * sizeof(ULONG));
+    if (Buffer == nullptr || BufferSize < FIELD_OFFSET(OBJECT_TYPES_INFORMATION, TypeInformation))
+        return false;
+
+    // Type names are read from the bytes following each entry rather than through TypeName.Buffer, so the buffer does
+    // not need to live at the address the kernel wrote it to
+    const ULONG NumberOfTypes = ((const OBJECT_TYPES_INFORMATION*)Buffer)->NumberOfTypes;
+    ULONG_PTR Offset = ALIGN_UP(FIELD_OFFSET(OBJECT_TYPES_INFORMATION, TypeInformation), ULONG_PTR);
+    ULONG i = 0;
+    for (; i < NumberOfTypes; ++i)
+    {
+        if (Offset > BufferSize || BufferSize - Offset < sizeof(OBJECT_TYPE_INFORMATION))
+            break;
+
+        const OBJECT_TYPE_INFORMATION* TypeInfo = (const OBJECT_TYPE_INFORMATION*)(Buffer + Offset);
+        const ULONG_PTR NameOffset = Offset + sizeof(OBJECT_TYPE_INFORMATION);
+        if (TypeInfo->TypeName.Length > TypeInfo->TypeName.MaximumLength || BufferSize - NameOffset < TypeInfo->TypeName.MaximumLength)
+            break;
+
+        // Windows 8.1+ report the type index directly. Before that the type table is dense and starts at 2
+        const ULONG TypeIndex = TypeInfo->TypeIndex != 0 ? TypeInfo->TypeIndex : i + 2;
+
+        UNICODE_STRING TypeName;
+        TypeName.Length = TypeInfo->TypeName.Length;
+        TypeName.MaximumLength = TypeInfo->TypeName.MaximumLength;
+        TypeName.Buffer = (PWSTR)(Buffer + NameOffset);
+        if (TypeIndex < BAD_OBJECT_TYPE_BITMAP_ULONGS * 32 && IsNameInList(&TypeName, TypeNames, FALSE))
+            Bitmap[TypeIndex / 32] |= 1UL << (TypeIndex % 32);
+
+        Offset = NameOffset + ALIGN_UP(TypeInfo->TypeName.MaximumLength, ULONG_PTR);
+    }
+
+    // A truncated buffer or a failed query would leave types out, and the caller would cache the incomplete bitmap
+    if (i != NumberOfTypes || NumberOfTypes == 0)
+    {
+        RtlZeroMemory(Bitmap, BAD_OBJECT_TYPE_BITMAP_ULONGS * sizeof(ULONG));
+        return false;
+    }
+    return true;
+}
+
+ULONG CollectProtectedProcessIds(const SYSTEM_PROCESS_INFORMATION* ProcessInfo, ULONG Length, ULONG ProtectedPid, const WCHAR* ProcessNames, PULONG Pids, ULONG MaxPids)
+{
+    ULONG Count = 0;
+    if (ProtectedPid != 0 && MaxPids != 0)
+        Pids[Count++] = ProtectedPid;
+
+    const UCHAR* Buffer = (const UCHAR*)ProcessInfo;
+    ULONG_PTR Offset = 0;
+    while (Count < MaxPids && Offset <= Length && Length - Offset >= sizeof(SYSTEM_PROCESS_INFORMATION))
+    {
+        const SYSTEM_PROCESS_INFORMATION* Process = (const SYSTEM_PROCESS_INFORMATION*)(Buffer + Offset);
+        const ULONG Pid = HandleToULong(Process->UniqueProcessId);
+
+        // The image name is stored in the snapshot after the entry. Ignore names that point anywhere else
+        const UCHAR* Name = (const UCHAR*)Process->ImageName.Buffer;
+        const bool NameInBuffer = Name >= Buffer && Name <= Buffer + Length && (ULONG_PTR)(Buffer + Length - Name) >= Process->ImageName.Length;
+        if (Pid != ProtectedPid && Process->ImageName.Length != 0 && NameInBuffer &&
+            IsNameInList(&Process->ImageName, ProcessNames, TRUE))
+        {
+            // Insertion sort, the set holds a handful of entries. PIDs in a snapshot are unique
+            ULONG i = Count;
+            while (i > 0 && Pids[i - 1] > Pid)
+            {
+                Pids[i] = Pids[i - 1];
+                i--;
+            }
+            Pids[i] = Pid;
+            Count++;
+        }
+
+        if (Process->NextEntryOffset == 0)
+            break;
+        Offset += Process->NextEntryOffset;
+    }
+    return Count;
+}
+
+bool IsProcessListValid(const SYSTEM_PROCESS_INFORMATION* ProcessInfo, ULONG Length, ULONG ThreadSize, ULONG ExtensionSize)
+{
+    if (ProcessInfo == nullptr)
+        return false;
+
+    const ULONG_PTR Start = (ULONG_PTR)ProcessInfo;
+    const ULONG HeaderSize = FIELD_OFFSET(SYSTEM_PROCESS_INFORMATION, Threads);
+    ULONG Offset = 0;
+    while (true)
+    {
+        if (Offset > Length || Length - Offset < HeaderSize)
+            return false;
+
+        const SYSTEM_PROCESS_INFORMATION* Process = (const SYSTEM_PROCESS_INFORMATION*)(Start + Offset);
+        const ULONG EntryLimit = Process->NextEntryOffset != 0 ? Process->NextEntryOffset : Length - Offset;
+        const ULONGLONG EntrySize = HeaderSize + (ULONGLONG)Process->NumberOfThreads * ThreadSize + ExtensionSize;
+        if (EntrySize > EntryLimit || EntryLimit > Length - Offset)
+            return false;
+
+        // The kernel stores the image name in the entry, after the fixed part. Anywhere else, zeroing the name of a
+        // hidden process could overwrite the NextEntryOffset of another entry
+        if (Process->ImageName.Buffer != nullptr)
+        {
+            const ULONG_PTR NameArea = Start + Offset + HeaderSize;
+            const ULONG_PTR Name = (ULONG_PTR)Process->ImageName.Buffer;
+            if (Name < NameArea || Name - NameArea > EntryLimit - HeaderSize || EntryLimit - HeaderSize - (Name - NameArea) < Process->ImageName.Length)
+                return false;
+        }
+
+        if (Process->NextEntryOffset == 0)
+            return true;
+        Offset += Process->NextEntryOffset;
+    }
+}
+
+void FilterProcess(PSYSTEM_PROCESS_INFORMATION pInfo, ULONG HiddenPid)
+{
+    // The first entry is the start of the caller's buffer and cannot be unlinked, only have its name cleared.
+    // It is the idle process, which has neither a name nor a PID that can be hidden
+    PSYSTEM_PROCESS_INFORMATION pPrev = nullptr;
+
+    while (true)
+    {
+        const ULONG NextEntryOffset = pInfo->NextEntryOffset;
+        const bool Hidden = IsProcessNameBad(&pInfo->ImageName) ||
+            (HiddenPid != 0 && HandleToULong(pInfo->UniqueProcessId) == HiddenPid);
+        if (Hidden && pInfo->ImageName.Buffer != nullptr)
+            RtlZeroMemory(pInfo->ImageName.Buffer, pInfo->ImageName.Length);
+
+        if (Hidden && pPrev != nullptr)
+            pPrev->NextEntryOffset = NextEntryOffset == 0 ? 0 : pPrev->NextEntryOffset + NextEntryOffset;
+        else
+            pPrev = pInfo;
+
+        if (NextEntryOffset == 0)
+            break;
+        pInfo = (PSYSTEM_PROCESS_INFORMATION)((ULONG_PTR)pInfo + NextEntryOffset);
+    }
+}
+
+void FilterHandleInfo(PSYSTEM_HANDLE_INFORMATION pHandleInfo, ULONG Length, PULONG pReturnLengthAdjust)
+{
+    *pReturnLengthAdjust = 0;
+    if (Length < FIELD_OFFSET(SYSTEM_HANDLE_INFORMATION, Handles))
+        return;
+
+    // Never trust the count to stay inside the buffer
+    const ULONG TrueCount = MIN(pHandleInfo->NumberOfHandles,
+        MaxEntriesInBuffer<SYSTEM_HANDLE_TABLE_ENTRY_INFO>(Length, FIELD_OFFSET(SYSTEM_HANDLE_INFORMATION, Handles)));
+    const ULONG* BadObjectTypes = GetBadObjectTypeBitmap();
+    ULONG ProtectedPids[MAX_PROTECTED_PROCESS_IDS];
+    const ULONG NumProtectedPids = GetProtectedProcessIds(ProtectedPids, _countof(ProtectedPids));
+
+    // Compact in place, so hiding handles stays linear in the size of the handle table
+    ULONG Kept = 0;
+    for (ULONG i = 0; i < TrueCount; ++i)
+    {
+        if (IsProcessIdInSet(ProtectedPids, NumProtectedPids, (ULONG)pHandleInfo->Handles[i].UniqueProcessId) &&
+            IsObjectTypeInBitmap(BadObjectTypes, pHandleInfo->Handles[i].ObjectTypeIndex))
+            continue;
+
+        if (Kept != i)
+            pHandleInfo->Handles[Kept] = pHandleInfo->Handles[i];
+        Kept++;
+    }
+
+    if (Kept != TrueCount)
+    {
+        RtlZeroMemory(&pHandleInfo->Handles[Kept], (TrueCount - Kept) * sizeof(SYSTEM_HANDLE_TABLE_ENTRY_INFO));
+        pHandleInfo->NumberOfHandles = Kept;
+        *pReturnLengthAdjust = (TrueCount - Kept) * sizeof(SYSTEM_HANDLE_TABLE_ENTRY_INFO);
+    }
+}
+
+void FilterHandleInfoEx(PSYSTEM_HANDLE_INFORMATION_EX pHandleInfoEx, ULONG Length, PULONG pReturnLengthAdjust)
+{
+    *pReturnLengthAdjust = 0;
+    if (Length < FIELD_OFFSET(SYSTEM_HANDLE_INFORMATION_EX, Handles))
+        return;
+
+    const ULONG TrueCount = (ULONG)MIN(pHandleInfoEx->NumberOfHandles,
+        MaxEntriesInBuffer<SYSTEM_HANDLE_TABLE_ENTRY_INFO_EX>(Length, FIELD_OFFSET(SYSTEM_HANDLE_INFORMATION_EX, Handles)));
+    const ULONG* BadObjectTypes = GetBadObjectTypeBitmap();
+    ULONG ProtectedPids[MAX_PROTECTED_PROCESS_IDS];
+    const ULONG NumProtectedPids = GetProtectedProcessIds(ProtectedPids, _countof(ProtectedPids));
+
+    ULONG Kept = 0;
+    for (ULONG i = 0; i < TrueCount; ++i)
+    {
+        if (IsProcessIdInSet(ProtectedPids, NumProtectedPids, (ULONG)pHandleInfoEx->Handles[i].UniqueProcessId) &&
+            IsObjectTypeInBitmap(BadObjectTypes, pHandleInfoEx->Handles[i].ObjectTypeIndex))
+            continue;
+
+        if (Kept != i)
+            pHandleInfoEx->Handles[Kept] = pHandleInfoEx->Handles[i];
+        Kept++;
+    }
+
+    if (Kept != TrueCount)
+    {
+        RtlZeroMemory(&pHandleInfoEx->Handles[Kept], (TrueCount - Kept) * sizeof(SYSTEM_HANDLE_TABLE_ENTRY_INFO_EX));
+        pHandleInfoEx->NumberOfHandles = Kept;
+        *pReturnLengthAdjust = (TrueCount - Kept) * sizeof(SYSTEM_HANDLE_TABLE_ENTRY_INFO_EX);
+    }
+}
+
+void FilterObjects(POBJECT_TYPES_INFORMATION pObjectTypes, ULONG Length)
+{
+    if (Length < FIELD_OFFSET(OBJECT_TYPES_INFORMATION, TypeInformation))
+        return;
+
+    // Same walk as ParseBadObjectTypes: stop at the first entry or name that would not fit in the buffer
+    ULONG_PTR Offset = ALIGN_UP(FIELD_OFFSET(OBJECT_TYPES_INFORMATION, TypeInformation), ULONG_PTR);
+    for (ULONG i = 0; i < pObjectTypes->NumberOfTypes; i++)
+    {
+        if (Offset > Length || Length - Offset < sizeof(OBJECT_TYPE_INFORMATION))
+            break;
+
+        const POBJECT_TYPE_INFORMATION pObject = (POBJECT_TYPE_INFORMATION)((PUCHAR)pObjectTypes + Offset);
+        const ULONG_PTR NameOffset = Offset + sizeof(OBJECT_TYPE_INFORMATION);
+        if (pObject->TypeName.Length > pObject->TypeName.MaximumLength || Length - NameOffset < pObject->TypeName.MaximumLength)
+            break;
+
+        FilterObject(pObject, Length - NameOffset, true);
+
+        Offset = NameOffset + ALIGN_UP(pObject->TypeName.MaximumLength, ULONG_PTR);
+    }
+}
+
+void FilterObject(POBJECT_TYPE_INFORMATION pObject, ULONG_PTR NameLength, bool zeroTotal)
+{
+    // Compare the name stored after the entry rather than trusting TypeName.Buffer to point there
+    if (pObject->TypeName.Length > pObject->TypeName.MaximumLength || pObject->TypeName.MaximumLength > NameLength)
+        return;
+
+    UNICODE_STRING typeName;
+    typeName.Length = pObject->TypeName.Length;
+    typeName.MaximumLength = pObject->TypeName.MaximumLength;
+    typeName.Buffer = (PWSTR)(pObject + 1);
+
+    UNICODE_STRING debugObjectName = RTL_CONSTANT_STRING(L"DebugObject");
+    if (RtlEqualUnicodeString(&debugObjectName, &typeName, FALSE))
+    {
+        // Subtract just one from both counts for our debugger, unless the query was a generic one for all object types
+        pObject->TotalNumberOfObjects = zeroTotal || pObject->TotalNumberOfObjects == 0 ? 0 : pObject->TotalNumberOfObjects - 1;
+        pObject->TotalNumberOfHandles = zeroTotal || pObject->TotalNumberOfHandles == 0 ? 0 : pObject->TotalNumberOfHandles - 1;
+    }
+}
+
+void FilterHwndList(HWND* phwndFirst, ULONG cHwndMax, PULONG pcHwndNeeded)
+{
+    const ULONG count = MIN(*pcHwndNeeded, cHwndMax);
+    ULONG kept = 0;
+    for (ULONG i = 0; i < count; ++i)
+    {
+        const HWND hwnd = phwndFirst[i];
+        if (hwnd != nullptr && IsWindowBad(hwnd))
+            continue;
+        phwndFirst[kept++] = hwnd;
+    }
+
+    if (kept != count)
+    {
+        RtlZeroMemory(&phwndFirst[kept], (count - kept) * sizeof(HWND));
+        *pcHwndNeeded -= count - kept;
+    }
+}
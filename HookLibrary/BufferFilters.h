@@ -0,0 +1,40 @@
+#pragma once
+
+#include <ntdll/ntdll.h>
+
+#include "HookHelper.h"
+
+// Filters that rewrite the output buffers of NtQuerySystemInformation, NtQueryObject and NtUserBuildHwndList in place.
+// They stay inside the Length bytes of the buffer whatever the counts and offsets in it say. Apart from ntdll they only
+// use the PID set, object type bitmap, process names and IsWindowBad of HookHelper, so UnitTests builds them against
+// stubs of those
+
+// Parses a raw OBJECT_TYPES_INFORMATION buffer into the type index bitmap of GetBadObjectTypeBitmap, setting the bit
+// of every type named in the semicolon separated TypeNames. Returns true only if all NumberOfTypes entries were parsed
+bool ParseBadObjectTypes(const UCHAR* Buffer, ULONG BufferSize, const WCHAR* TypeNames, ULONG Bitmap[BAD_OBJECT_TYPE_BITMAP_ULONGS]);
+
+// Collects the protected PID and the PIDs of the processes named in the semicolon separated ProcessNames from a
+// SystemProcessInformation snapshot of Length bytes. The result is sorted for IsProcessIdInSet. Returns the number of
+// PIDs written
+ULONG CollectProtectedProcessIds(const SYSTEM_PROCESS_INFORMATION* ProcessInfo, ULONG Length, ULONG ProtectedPid, const WCHAR* ProcessNames, PULONG Pids, ULONG MaxPids);
+
+// Checks that every entry of a process list, including its thread array, its process extension and its image name,
+// lies inside the Length bytes of the buffer and that the NextEntryOffset chain only moves forward. ThreadSize and
+// ExtensionSize depend on the information class the list was queried with
+bool IsProcessListValid(const SYSTEM_PROCESS_INFORMATION* ProcessInfo, ULONG Length, ULONG ThreadSize, ULONG ExtensionSize);
+
+// Unlinks the processes with a bad name or the PID HiddenPid (0 for none) from a list IsProcessListValid accepted,
+// and zeroes their names
+void FilterProcess(PSYSTEM_PROCESS_INFORMATION pInfo, ULONG HiddenPid);
+
+void FilterHandleInfo(PSYSTEM_HANDLE_INFORMATION pHandleInfo, ULONG Length, PULONG pReturnLengthAdjust);
+void FilterHandleInfoEx(PSYSTEM_HANDLE_INFORMATION_EX pHandleInfoEx, ULONG Length, PULONG pReturnLengthAdjust);
+void FilterObjects(POBJECT_TYPES_INFORMATION pObjectTypes, ULONG Length);
+
+// NameLength is the number of bytes after the entry, where NtQueryObject stores the type name
+void FilterObject(POBJECT_TYPE_INFORMATION pObject, ULONG_PTR NameLength, bool zeroTotal);
+
+// Removes the windows IsWindowBad reports from the first *pcHwndNeeded (at most cHwndMax) windows of a
+// NtUserBuildHwndList result, keeping the order of the others, and lowers *pcHwndNeeded by the number removed.
+// IsWindowBad costs a few win32k calls, so it is called once per window
+void FilterHwndList(HWND* phwndFirst, ULONG cHwndMax, PULONG pcHwndNeeded);
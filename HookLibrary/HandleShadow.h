@@ -0,0 +1,103 @@
+#pragma once
+
+#include <ntdll/ntdll.h>
+
+// Shadow copy of the ProtectFromClose flag of the handles of this process, so that NtClose on a protected handle (the
+// STATUS_HANDLE_NOT_CLOSABLE check of anti-debug code) does not need to query the flag first.
+//
+// Only Protected is recorded. A handle that was valid and closable can be closed outside the hooks (a direct syscall,
+// DUPLICATE_CLOSE_SOURCE from another process) and its value reused or left invalid, and closing an invalid handle
+// raises EXCEPTION_INVALID_HANDLE under a debugger. So every other handle is queried before it is closed, which also
+// validates it. A protected handle can only become closable through NtSetInformationObject, which is hooked; if that
+// is bypassed, the stale entry makes NtClose fail with STATUS_HANDLE_NOT_CLOSABLE rather than raise anything.
+//
+// The functions take the unhooked NtQueryObject and NtClose as callbacks, so UnitTests can run them on a fake handle table
+
+// One byte per handle value up to 0x10000 (handles are multiples of 4), nonzero if the handle is protected. Larger
+// values and pseudo handles are never recorded. Byte stores are atomic, so no locking is needed
+#define HANDLE_SHADOW_TABLE_SIZE (0x10000 / 4)
+
+typedef volatile UCHAR HANDLE_SHADOW_TABLE[HANDLE_SHADOW_TABLE_SIZE];
+
+// Reads the ProtectFromClose flag of a handle of this process, the status of NtQueryObject(ObjectHandleFlagInformation)
+typedef NTSTATUS (*t_HandleShadowQuery)(void* context, HANDLE handle, BOOLEAN* protectFromClose);
+typedef NTSTATUS (*t_HandleShadowClose)(void* context, HANDLE handle);
+
+FORCEINLINE bool HandleShadowIndex(HANDLE Handle, PULONG Index)
+{
+	const ULONG_PTR Value = (ULONG_PTR)Handle;
+	if ((Value & 3) != 0 || Value / 4 >= HANDLE_SHADOW_TABLE_SIZE)
+		return false;
+	*Index = (ULONG)(Value / 4);
+	return true;
+}
+
+FORCEINLINE bool HandleShadowIsProtected(const HANDLE_SHADOW_TABLE Table, HANDLE Handle)
+{
+	ULONG Index;
+	return HandleShadowIndex(Handle, &Index) && Table[Index] != 0;
+}
+
+FORCEINLINE void HandleShadowSetProtected(HANDLE_SHADOW_TABLE Table, HANDLE Handle, bool Protected)
+{
+	ULONG Index;
+	if (HandleShadowIndex(Handle, &Index))
+		Table[Index] = Protected ? 1 : 0;
+}
+
+// ProtectFromClose of a handle of this process, from the table if it is recorded as protected and queried otherwise.
+// Fails with the status of the query if the handle is invalid
+inline NTSTATUS HandleShadowQuery(HANDLE_SHADOW_TABLE Table, HANDLE Handle, t_HandleShadowQuery Query, void* Context, bool* Protected)
+{
+	if (HandleShadowIsProtected(Table, Handle))
+	{
+		*Protected = true;
+		return STATUS_SUCCESS;
+	}
+
+	BOOLEAN ProtectFromClose = FALSE;
+	const NTSTATUS Status = Query(Context, Handle, &ProtectFromClose);
+	if (!NT_SUCCESS(Status))
+		return Status;
+	*Protected = ProtectFromClose != FALSE;
+	if (*Protected)
+		HandleShadowSetProtected(Table, Handle, true);
+	return Status;
+}
+
+// NtClose that never raises: a protected handle returns STATUS_HANDLE_NOT_CLOSABLE and an invalid one
+// STATUS_INVALID_HANDLE, without calling Close
+inline NTSTATUS HandleShadowClose(HANDLE_SHADOW_TABLE Table, HANDLE Handle, t_HandleShadowQuery Query, t_HandleShadowClose Close, void* Context)
+{
+	bool Protected;
+	if (!NT_SUCCESS(HandleShadowQuery(Table, Handle, Query, Context, &Protected)))
+		return STATUS_INVALID_HANDLE;
+	if (Protected)
+		return STATUS_HANDLE_NOT_CLOSABLE;
+	return Close(Context, Handle);
+}
+
+// The options to duplicate a handle of this process with: DUPLICATE_CLOSE_SOURCE is dropped for a protected source,
+// because the kernel closes it with an exception under a debugger (and ignores the failure otherwise).
+// SourceProtected tells HandleShadowDuplicated what DUPLICATE_SAME_ATTRIBUTES copies
+inline ULONG HandleShadowDuplicateOptions(HANDLE_SHADOW_TABLE Table, HANDLE SourceHandle, ULONG Options, t_HandleShadowQuery Query, void* Context, bool* SourceProtected)
+{
+	*SourceProtected = false;
+	if ((Options & (DUPLICATE_CLOSE_SOURCE | DUPLICATE_SAME_ATTRIBUTES)) == 0)
+		return Options;
+
+	bool Protected;
+	if (NT_SUCCESS(HandleShadowQuery(Table, SourceHandle, Query, Context, &Protected)) && Protected)
+	{
+		*SourceProtected = true;
+		Options &= ~DUPLICATE_CLOSE_SOURCE;
+	}
+	return Options;
+}
+
+// Records the result of a successful duplication into this process. The new handle is protected if
+// DUPLICATE_SAME_ATTRIBUTES copied the flag from a protected local source; anything else is queried when it is closed
+inline void HandleShadowDuplicated(HANDLE_SHADOW_TABLE Table, HANDLE TargetHandle, ULONG Options, bool SourceProtected)
+{
+	HandleShadowSetProtected(Table, TargetHandle, (Options & DUPLICATE_SAME_ATTRIBUTES) != 0 && SourceProtected);
+}
@@ -2,8 +2,12 @@
 
 #include <ntdll/ntdll.h>
 
+#include "BufferFilters.h"
 #include "HookedFunctions.h"
 #include "HookMain.h"
+#include "ImageRealign.h"
+#include "ProcessIdCache.h"
+#include "Tls.h"
 
 const WCHAR * BadProcessnameList[] =
 {
@@ -75,14 +79,20 @@ const WCHAR * BadWindowClassList[] =
 	L"99929D61-1338-48B1-9433-D42A1D94F0D2" // API Monitor
 };
 
+// Object types whose handles are hidden from the protected process in the system handle table, unless the
+// HiddenObjectTypes setting names others
+static const WCHAR DefaultHiddenObjectTypes[] = L"DebugObject;Process;Thread";
+
 extern "C" void InstrumentationCallbackAsm();
 
+// Syscall return addresses the instrumentation callback is interested in, i.e. those inside the exe image.
+// InstrumentationCallbackAsm compares against these before saving any registers, so all other returns cost one range check
+extern "C" ULONG_PTR InstrumentationCallbackRangeStart = 0;
+extern "C" ULONG_PTR InstrumentationCallbackRangeEnd = 0;
+
 extern HOOK_DLL_DATA HookDllData;
 extern SAVE_DEBUG_REGISTERS ArrayDebugRegister[100];
 
-static USHORT DebugObjectTypeIndex = 0;
-static USHORT ProcessTypeIndex = 0;
-static USHORT ThreadTypeIndex = 0;
 
 bool IsProcessNameBad(PUNICODE_STRING processName)
 {
@@ -99,6 +109,85 @@ bool IsProcessNameBad(PUNICODE_STRING processName)
 	return false;
 }
 
+static ULONG QueryProtectedProcessIds(ULONG protectedPid, PULONG pids, ULONG maxPids)
+{
+	const ULONG fallbackCount = protectedPid != 0 && maxPids != 0 ? 1 : 0;
+	if (fallbackCount != 0)
+		pids[0] = protectedPid;
+
+	// The snapshot must come from the unhooked function, since the hook hides exactly the processes we are looking for
+	if (HookDllData.ProtectedProcessNames[0] == L'\0' || HookDllData.dNtQuerySystemInformation == nullptr)
+		return fallbackCount;
+
+	ULONG size;
+	if (HookDllData.dNtQuerySystemInformation(SystemProcessInformation, nullptr, 0, &size) != STATUS_INFO_LENGTH_MISMATCH)
+		return fallbackCount;
+	const PSYSTEM_PROCESS_INFORMATION systemProcessInfo =
+		static_cast<PSYSTEM_PROCESS_INFORMATION>(RtlAllocateHeap(RtlProcessHeap(), 0, 2 * size));
+	if (systemProcessInfo == nullptr)
+		return fallbackCount;
+
+	ULONG count = fallbackCount;
+	ULONG returnLength = 0;
+	if (NT_SUCCESS(HookDllData.dNtQuerySystemInformation(SystemProcessInformation, systemProcessInfo, 2 * size, &returnLength)))
+		count = CollectProtectedProcessIds(systemProcessInfo, returnLength, protectedPid, HookDllData.ProtectedProcessNames, pids, maxPids);
+
+	RtlFreeHeap(RtlProcessHeap(), 0, systemProcessInfo);
+	return count;
+}
+
+typedef struct _PROTECTED_PROCESS_ID_SET
+{
+	ULONG ProtectedPid; // The protected PID the set was built for
+	ULONG Count;
+	ULONG Pids[MAX_PROTECTED_PROCESS_IDS];
+} PROTECTED_PROCESS_ID_SET;
+
+// Two sets, so that a refresh never writes to the one readers are copying from
+static PROTECTED_PROCESS_ID_SET ProtectedProcessIdSets[2];
+static volatile LONG ProtectedProcessIdSetIndex = -1; // Published set, -1 = none yet
+static volatile LONG ProtectedProcessIdSetRefreshing = 0;
+static volatile ULONG ProtectedProcessIdSetTick = 0;
+
+#define PROTECTED_PROCESS_ID_SET_INTERVAL 1000 // ms
+
+ULONG GetProtectedProcessIds(PULONG pids, ULONG maxPids)
+{
+	// ProtectProcessId turns off hiding handles of the debugger and of the ProtectedProcessNames processes alike
+	if (HookDllData.EnableProtectProcessId != TRUE)
+		return 0;
+	const ULONG protectedPid = HookDllData.dwProtectedProcessId;
+
+	// Taking a process snapshot for every handle query is far too slow, so the set is only rebuilt after an interval
+	// or when the protected PID changes. Processes started in between are missed for at most one interval
+	const LONG index = ProtectedProcessIdSetIndex;
+	const bool valid = index >= 0 && ProtectedProcessIdSets[index].ProtectedPid == protectedPid;
+	if ((!valid || RtlGetTickCount() - ProtectedProcessIdSetTick >= PROTECTED_PROCESS_ID_SET_INTERVAL) &&
+		_InterlockedCompareExchange(&ProtectedProcessIdSetRefreshing, 1, 0) == 0)
+	{
+		const LONG newIndex = index == 0 ? 1 : 0;
+		PROTECTED_PROCESS_ID_SET* set = &ProtectedProcessIdSets[newIndex];
+		set->ProtectedPid = protectedPid;
+		set->Count = QueryProtectedProcessIds(protectedPid, set->Pids, _countof(set->Pids));
+		ProtectedProcessIdSetTick = RtlGetTickCount();
+		_InterlockedExchange(&ProtectedProcessIdSetIndex, newIndex);
+		_InterlockedExchange(&ProtectedProcessIdSetRefreshing, 0);
+	}
+	else if (!valid)
+	{
+		// Another thread is building the first set for this PID
+		if (protectedPid == 0 || maxPids == 0)
+			return 0;
+		pids[0] = protectedPid;
+		return 1;
+	}
+
+	const PROTECTED_PROCESS_ID_SET* set = &ProtectedProcessIdSets[ProtectedProcessIdSetIndex];
+	const ULONG count = set->Count < maxPids ? set->Count : maxPids;
+	RtlCopyMemory(pids, set->Pids, count * sizeof(ULONG));
+	return count;
+}
+
 bool IsWindowClassNameBad(PUNICODE_STRING className)
 {
 	if (className == nullptr || className->Length == 0 || className->Buffer == nullptr)
@@ -153,74 +242,63 @@ bool IsWindowBad(HWND hWnd)
 	return IsWindowNameBad(&WindowText);
 }
 
-static void GetBadObjectTypes()
+static ULONG BadObjectTypeBitmap[BAD_OBJECT_TYPE_BITMAP_ULONGS] = { 0 };
+static volatile LONG BadObjectTypeBitmapState = 0; // 0 = not built, 1 = building, 2 = ready
+static const ULONG EmptyObjectTypeBitmap[BAD_OBJECT_TYPE_BITMAP_ULONGS] = { 0 };
+
+const ULONG* GetBadObjectTypeBitmap()
 {
-	// If NtQSI is not hooked, this function is N/A
-	if (HookDllData.dNtQuerySystemInformation == nullptr)
-		return;
+	// The type table does not change at runtime, so a single ObjectTypesInformation query is enough. Concurrent
+	// callers wait for it: the query takes microseconds, and an empty bitmap would let a handle slip through
+	for (;;)
+	{
+		const LONG State = _InterlockedCompareExchange(&BadObjectTypeBitmapState, 1, 0);
+		if (State == 2)
+			return BadObjectTypeBitmap;
+		if (State == 0)
+			break;
+		YieldProcessor();
+	}
 
-	// Only get the object type indices once
-	if (DebugObjectTypeIndex != 0 || ProcessTypeIndex != 0 || ThreadTypeIndex != 0)
-		return;
+	const WCHAR* TypeNames = HookDllData.HiddenObjectTypes[0] != L'\0' ? HookDllData.HiddenObjectTypes : DefaultHiddenObjectTypes;
+	ULONG Size = 0x4000;
+	bool Parsed = false;
+	for (int Attempt = 0; Attempt < 4 && !Parsed; ++Attempt)
+	{
+		PUCHAR Buffer = (PUCHAR)RtlAllocateHeap(RtlProcessHeap(), 0, Size);
+		if (Buffer == nullptr)
+			break;
 
-	// Create handles to three bad object types: an empty debug object and our own process and thread
-	HANDLE DebugObjectHandle = nullptr, ProcessHandle = nullptr, ThreadHandle = nullptr;
-	OBJECT_ATTRIBUTES ObjectAttributes = { sizeof(OBJECT_ATTRIBUTES) };
-	CLIENT_ID ClientId = NtCurrentTeb()->ClientId;
-	NtCreateDebugObject(&DebugObjectHandle, DEBUG_ALL_ACCESS, &ObjectAttributes, 0);
-	NtOpenProcess(&ProcessHandle, PROCESS_ALL_ACCESS, &ObjectAttributes, &ClientId);
-	NtOpenThread(&ThreadHandle, THREAD_ALL_ACCESS, &ObjectAttributes, &ClientId);
-	
-	SYSTEM_HANDLE_INFORMATION_EX Dummy; // Prevent getting STATUS_INFO_LENGTH_MISMATCH twice
-	PSYSTEM_HANDLE_INFORMATION_EX HandleInfo = &Dummy;
-	ULONG Size;
-	NTSTATUS Status;
-	if ((Status = HookDllData.dNtQuerySystemInformation(SystemExtendedHandleInformation,
-														HandleInfo,
-														sizeof(Dummy),
-														&Size)) != STATUS_INFO_LENGTH_MISMATCH)
-		goto exit;
-
-	HandleInfo = (PSYSTEM_HANDLE_INFORMATION_EX)RtlAllocateHeap(RtlProcessHeap(), 0, 2 * Size);
-	Status = HookDllData.dNtQuerySystemInformation(SystemExtendedHandleInformation,
-													HandleInfo,
-													2 * Size,
-													nullptr);
-	if (!NT_SUCCESS(Status))
-		goto exit;
+		ULONG ReturnLength = 0;
+		const NTSTATUS Status = HookDllData.dNtQueryObject != nullptr
+			? HookDllData.dNtQueryObject(nullptr, ObjectTypesInformation, Buffer, Size, &ReturnLength)
+			: NtQueryObject(nullptr, ObjectTypesInformation, Buffer, Size, &ReturnLength);
+		if (NT_SUCCESS(Status))
+			Parsed = ParseBadObjectTypes(Buffer, Size, TypeNames, BadObjectTypeBitmap);
 
-	// Enumerate all handles
-	for (ULONG i = 0; i < HandleInfo->NumberOfHandles; ++i)
-	{
-		SYSTEM_HANDLE_TABLE_ENTRY_INFO_EX Entry = HandleInfo->Handles[i];
-		if (Entry.UniqueProcessId != (ULONG_PTR)NtCurrentTeb()->ClientId.UniqueProcess)
-			continue; // Not our process
+		RtlFreeHeap(RtlProcessHeap(), 0, Buffer);
+		if (Status != STATUS_INFO_LENGTH_MISMATCH)
+			break;
+
+		// Older versions do not always return the required length, so grow geometrically as well
+		Size = ReturnLength > 2 * Size ? (ULONG)ALIGN_UP(ReturnLength, ULONG_PTR) : 2 * Size;
+	}
 
-		if (Entry.HandleValue == (ULONG_PTR)DebugObjectHandle)
-			DebugObjectTypeIndex = Entry.ObjectTypeIndex;
-		else if (Entry.HandleValue == (ULONG_PTR)ProcessHandle)
-			ProcessTypeIndex = Entry.ObjectTypeIndex;
-		else if (Entry.HandleValue == (ULONG_PTR)ThreadHandle)
-			ThreadTypeIndex = Entry.ObjectTypeIndex;
+	// Only a complete type table is final. Otherwise the next caller queries again, and this one filters nothing
+	if (!Parsed)
+	{
+		RtlZeroMemory(BadObjectTypeBitmap, sizeof(BadObjectTypeBitmap));
+		_InterlockedExchange(&BadObjectTypeBitmapState, 0);
+		return EmptyObjectTypeBitmap;
 	}
 
-exit:
-	if (DebugObjectHandle != nullptr)
-		NtClose(DebugObjectHandle);
-	if (ProcessHandle != nullptr)
-		NtClose(ProcessHandle);
-	if (ThreadHandle != nullptr)
-		NtClose(ThreadHandle);
-	if (HandleInfo != &Dummy)
-		RtlFreeHeap(RtlProcessHeap(), 0, HandleInfo);
+	_InterlockedExchange(&BadObjectTypeBitmapState, 2);
+	return BadObjectTypeBitmap;
 }
 
 bool IsObjectTypeBad(USHORT objectTypeIndex)
 {
-	GetBadObjectTypes();
-	return objectTypeIndex == DebugObjectTypeIndex ||
-		objectTypeIndex == ProcessTypeIndex ||
-		objectTypeIndex == ThreadTypeIndex;
+	return IsObjectTypeInBitmap(GetBadObjectTypeBitmap(), objectTypeIndex);
 }
 
 static LUID ConvertLongToLuid(LONG value)
@@ -276,6 +354,16 @@ InstallInstrumentationCallbackHook(
 	const PVOID Callback = Remove ? nullptr : (PVOID)InstrumentationCallbackAsm;
 	NTSTATUS Status = STATUS_NOT_SUPPORTED;
 
+	if (!Remove && ProcessHandle == NtCurrentProcess && InstrumentationCallbackRangeEnd == 0)
+	{
+		const PVOID ImageBase = NtCurrentPeb()->ImageBaseAddress;
+		const PIMAGE_NT_HEADERS NtHeaders = RtlImageNtHeader(ImageBase);
+		if (NtHeaders == nullptr)
+			return STATUS_INVALID_IMAGE_FORMAT;
+		InstrumentationCallbackRangeStart = (ULONG_PTR)ImageBase;
+		InstrumentationCallbackRangeEnd = (ULONG_PTR)ImageBase + NtHeaders->OptionalHeader.SizeOfImage;
+	}
+
 	if (RtlNtMajorVersion() > 6)
 	{
 		// Windows 10
@@ -407,25 +495,15 @@ void TerminateProcessByProcessId(DWORD dwProcess)
 	}
 }
 
-static DWORD dwExplorerPid = 0;
-
-DWORD GetExplorerProcessId()
-{
-	if (dwExplorerPid == 0)
-	{
-		UNICODE_STRING explorerName = RTL_CONSTANT_STRING(L"explorer.exe");
-		dwExplorerPid = GetProcessIdByName(&explorerName);
-	}
-	return dwExplorerPid;
-}
-
-DWORD GetProcessIdByName(PUNICODE_STRING processName)
+static DWORD FindProcessByName(PUNICODE_STRING processName, PLARGE_INTEGER createTime)
 {
 	ULONG size;
 	if (NtQuerySystemInformation(SystemProcessInformation, nullptr, 0, &size) != STATUS_INFO_LENGTH_MISMATCH)
 		return 0;
 	const PSYSTEM_PROCESS_INFORMATION systemProcessInfo =
 		static_cast<PSYSTEM_PROCESS_INFORMATION>(RtlAllocateHeap(RtlProcessHeap(), 0, 2 * size));
+	if (systemProcessInfo == nullptr)
+		return 0;
 	NTSTATUS status;
 	if (HookDllData.dNtQuerySystemInformation != nullptr)
 	{
@@ -442,7 +520,10 @@ DWORD GetProcessIdByName(PUNICODE_STRING processName)
 											nullptr);
 	}
 	if (!NT_SUCCESS(status))
+	{
+		RtlFreeHeap(RtlProcessHeap(), 0, systemProcessInfo);
 		return 0;
+	}
 
 	DWORD pid = 0;
 	PSYSTEM_PROCESS_INFORMATION process = systemProcessInfo;
@@ -451,6 +532,8 @@ DWORD GetProcessIdByName(PUNICODE_STRING processName)
 		if (RtlEqualUnicodeString(&process->ImageName, processName, TRUE))
 		{
 			pid = HandleToULong(process->UniqueProcessId);
+			if (createTime != nullptr)
+				*createTime = process->CreateTime;
 			break;
 		}
 
@@ -463,6 +546,57 @@ DWORD GetProcessIdByName(PUNICODE_STRING processName)
 	return pid;
 }
 
+static void CloseProcessHandle(void*, HANDLE hProcess)
+{
+	// The hooked NtClose would query the handle flags first
+	if (HookDllData.dNtClose != nullptr)
+		HookDllData.dNtClose(hProcess);
+	else
+		NtClose(hProcess);
+}
+
+static NTSTATUS QueryProcessTimes(void*, HANDLE hProcess, PKERNEL_USER_TIMES times)
+{
+	if (HookDllData.dNtQueryInformationProcess != nullptr)
+		return HookDllData.dNtQueryInformationProcess(hProcess, ProcessTimes, times, sizeof(*times), nullptr);
+	return NtQueryInformationProcess(hProcess, ProcessTimes, times, sizeof(*times), nullptr);
+}
+
+static NTSTATUS OpenProcessForQuery(void*, DWORD pid, PHANDLE hProcess)
+{
+	OBJECT_ATTRIBUTES attributes = { sizeof(OBJECT_ATTRIBUTES) };
+	CLIENT_ID clientId = { ULongToHandle(pid) };
+	const NTSTATUS status = NtOpenProcess(hProcess, PROCESS_QUERY_LIMITED_INFORMATION, &attributes, &clientId);
+	if (NT_SUCCESS(status) || status == STATUS_INVALID_CID)
+		return status;
+	// XP does not know PROCESS_QUERY_LIMITED_INFORMATION
+	return NtOpenProcess(hProcess, PROCESS_QUERY_INFORMATION, &attributes, &clientId);
+}
+
+static DWORD FindExplorer(void*, PLARGE_INTEGER createTime)
+{
+	UNICODE_STRING explorerName = RTL_CONSTANT_STRING(L"explorer.exe");
+	return FindProcessByName(&explorerName, createTime);
+}
+
+static ULONG ExplorerLookupTickCount(void*)
+{
+	return RtlGetTickCount();
+}
+
+static const PROCESS_ID_CACHE_OPS ExplorerLookupOps = { FindExplorer, OpenProcessForQuery, QueryProcessTimes, CloseProcessHandle, ExplorerLookupTickCount };
+static PROCESS_ID_CACHE ExplorerPidCache = { nullptr, 0, 0, 0 };
+
+DWORD GetExplorerProcessId()
+{
+	return ProcessIdCacheLookup(&ExplorerPidCache, &ExplorerLookupOps, nullptr);
+}
+
+DWORD GetProcessIdByName(PUNICODE_STRING processName)
+{
+	return FindProcessByName(processName, nullptr);
+}
+
 bool RtlUnicodeStringContains(PUNICODE_STRING Str, PUNICODE_STRING SubStr, BOOLEAN CaseInsensitive)
 {
 	if (Str == nullptr || SubStr == nullptr || Str->Length < SubStr->Length)
@@ -480,8 +614,17 @@ bool RtlUnicodeStringContains(PUNICODE_STRING Str, PUNICODE_STRING SubStr, BOOLE
 	return false;
 }
 
+static volatile LONG TlsRegionState = 0;
+
+bool TlsIsRegionUsable()
+{
+	return TlsCheckRegion(&TlsRegionState, NtCurrentTeb(), NtCurrentPeb()->OSBuildNumber);
+}
+
 void ThreadDebugContextRemoveEntry(const int index)
 {
+	if (TlsIsRegionUsable() && *TlsGet<TlsVariable::DebugRegisters>() == &ArrayDebugRegister[index])
+		*TlsGet<TlsVariable::DebugRegisters>() = nullptr;
 	ArrayDebugRegister[index].dwThreadId = 0;
 }
 
@@ -494,10 +637,21 @@ void ThreadDebugContextSaveContext(const int index, const PCONTEXT ThreadContext
 	ArrayDebugRegister[index].Dr3 = ThreadContext->Dr3;
 	ArrayDebugRegister[index].Dr6 = ThreadContext->Dr6;
 	ArrayDebugRegister[index].Dr7 = ThreadContext->Dr7;
+
+	if (TlsIsRegionUsable())
+		*TlsGet<TlsVariable::DebugRegisters>() = &ArrayDebugRegister[index];
 }
 
 int ThreadDebugContextFindExistingSlotIndex()
 {
+	// The thread's most recent entry is remembered in the TEB. Older entries of nested exceptions are still found by the scan
+	if (TlsIsRegionUsable())
+	{
+		SAVE_DEBUG_REGISTERS* Entry = *TlsGet<TlsVariable::DebugRegisters>();
+		if (Entry != nullptr && Entry->dwThreadId == HandleToULong(NtCurrentTeb()->ClientId.UniqueThread))
+			return (int)(Entry - ArrayDebugRegister);
+	}
+
 	for (int i = 0; i < _countof(ArrayDebugRegister); i++)
 	{
 		if (ArrayDebugRegister[i].dwThreadId != 0)
@@ -667,44 +821,89 @@ bool WriteMalwareToDisk(LPCVOID buffer, DWORD bufferSize, DWORD_PTR imagebase)
 	return WriteMemoryToFile(MalwareFile, buffer,bufferSize, imagebase);
 }
 
+// Content hash of the last file written, so that dumping the same image twice does not rewrite it. The write is only
+// skipped while the file still has the size and last write time it had right after that write, so a file that was
+// deleted, truncated or replaced in the meantime is written again
+static ULONG LastDumpNameCrc = 0;
+static ULONG LastDumpCrc = 0;
+static ULONG LastDumpSize = 0;
+static LARGE_INTEGER LastDumpWriteTime = { 0 };
+
+static bool IsLastDumpOnDisk(POBJECT_ATTRIBUTES objectAttributes)
+{
+	FILE_NETWORK_OPEN_INFORMATION fileInformation;
+	return NT_SUCCESS(NtQueryFullAttributesFile(objectAttributes, &fileInformation)) &&
+		fileInformation.EndOfFile.QuadPart == LastDumpSize &&
+		fileInformation.LastWriteTime.QuadPart == LastDumpWriteTime.QuadPart;
+}
+
 bool WriteMemoryToFile(const WCHAR * filename, LPCVOID buffer, DWORD bufferSize, DWORD_PTR imagebase)
 {
-	PIMAGE_DOS_HEADER pDos = (PIMAGE_DOS_HEADER)buffer;
-	PIMAGE_NT_HEADERS pNt = (PIMAGE_NT_HEADERS)((DWORD_PTR)pDos + pDos->e_lfanew);
-	PIMAGE_SECTION_HEADER pSection = IMAGE_FIRST_SECTION(pNt);
+	const ULONG fileSize = RealignImageForFile((const BYTE *)buffer, bufferSize, nullptr, 0);
+	if (fileSize == 0)
+		return false;
 
 	UNICODE_STRING NtPath;
 	if (!RtlDosPathNameToNtPathName_U(filename, &NtPath, nullptr, nullptr))
 		return false;
 	OBJECT_ATTRIBUTES objectAttributes;
-	IO_STATUS_BLOCK ioStatusBlock;
 	InitializeObjectAttributes(&objectAttributes, &NtPath, OBJ_CASE_INSENSITIVE, nullptr, nullptr);
 
-	HANDLE hFile;
-	NTSTATUS status = NtCreateFile(&hFile,
-								FILE_GENERIC_WRITE,
-								&objectAttributes,
-								&ioStatusBlock,
-								nullptr,
-								FILE_ATTRIBUTE_NORMAL,
-								FILE_SHARE_READ,
-								FILE_OVERWRITE_IF,
-								FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT,
-								nullptr,
-								0);
+	// Lay the whole file out in memory first so that it can be written with a single NtWriteFile
+	PVOID fileBuffer = nullptr;
+	SIZE_T allocationSize = fileSize;
+	NTSTATUS status = NtAllocateVirtualMemory(NtCurrentProcess, &fileBuffer, 0, &allocationSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
 	if (!NT_SUCCESS(status))
+	{
+		RtlFreeUnicodeString(&NtPath);
 		return false;
+	}
+	RealignImageForFile((const BYTE *)buffer, bufferSize, (BYTE *)fileBuffer, fileSize);
 
-	status = NtWriteFile(hFile, nullptr, nullptr, nullptr, &ioStatusBlock, (PVOID)buffer,
-		pNt->OptionalHeader.SizeOfHeaders, nullptr, nullptr);
-
-	for (WORD i = 0; i < pNt->FileHeader.NumberOfSections; i++)
+	bool result = false;
+	const ULONG nameCrc = RtlComputeCrc32(0, (PVOID)filename, (ULONG)(wcslen(filename) * sizeof(WCHAR)));
+	const ULONG contentCrc = RtlComputeCrc32(0, fileBuffer, fileSize);
+	if (nameCrc == LastDumpNameCrc && contentCrc == LastDumpCrc && fileSize == LastDumpSize && IsLastDumpOnDisk(&objectAttributes))
 	{
-		status = NtWriteFile(hFile, nullptr, nullptr, nullptr, &ioStatusBlock, (BYTE *)buffer + pSection->VirtualAddress,
-			pSection->SizeOfRawData, nullptr, nullptr);
-		pSection++;
+		result = true;
+	}
+	else
+	{
+		IO_STATUS_BLOCK ioStatusBlock;
+		HANDLE hFile;
+		status = NtCreateFile(&hFile,
+							FILE_GENERIC_WRITE,
+							&objectAttributes,
+							&ioStatusBlock,
+							nullptr,
+							FILE_ATTRIBUTE_NORMAL,
+							FILE_SHARE_READ,
+							FILE_OVERWRITE_IF,
+							FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT,
+							nullptr,
+							0);
+		if (NT_SUCCESS(status))
+		{
+			status = NtWriteFile(hFile, nullptr, nullptr, nullptr, &ioStatusBlock, fileBuffer,
+				fileSize, nullptr, nullptr);
+			result = NT_SUCCESS(status) && ioStatusBlock.Information == fileSize;
+
+			// The last write time is only final once the handle is closed, so it is read back from the path after that
+			NtClose(hFile);
+			LastDumpNameCrc = 0;
+			FILE_NETWORK_OPEN_INFORMATION fileInformation;
+			if (result && NT_SUCCESS(NtQueryFullAttributesFile(&objectAttributes, &fileInformation)))
+			{
+				LastDumpNameCrc = nameCrc;
+				LastDumpCrc = contentCrc;
+				LastDumpSize = fileSize;
+				LastDumpWriteTime = fileInformation.LastWriteTime;
+			}
+		}
 	}
-	NtClose(hFile);
 
-	return NT_SUCCESS(status);
+	RtlFreeUnicodeString(&NtPath);
+	allocationSize = 0;
+	NtFreeVirtualMemory(NtCurrentProcess, &fileBuffer, &allocationSize, MEM_RELEASE);
+	return result;
 }
@@ -24,6 +24,26 @@ DWORD GetExplorerProcessId();
 DWORD GetProcessIdByName(PUNICODE_STRING processName);
 bool IsProcessNameBad(PUNICODE_STRING processName);
 
+#define MAX_PROTECTED_PROCESS_IDS 64
+
+ULONG GetProtectedProcessIds(PULONG pids, ULONG maxPids);
+
+// Binary search over a sorted PID array. The loop has a fixed trip count and compiles to conditional moves
+FORCEINLINE bool IsProcessIdInSet(const ULONG* pids, ULONG count, ULONG pid)
+{
+	if (count == 0)
+		return false;
+
+	const ULONG* base = pids;
+	while (count > 1)
+	{
+		const ULONG half = count / 2;
+		base = base[half] <= pid ? base + half : base;
+		count -= half;
+	}
+	return *base == pid;
+}
+
 DWORD GetProcessIdByProcessHandle(HANDLE hProcess);
 DWORD GetProcessIdByThreadHandle(HANDLE hThread);
 
@@ -34,6 +54,16 @@ bool IsWindowClassNameBad(PUNICODE_STRING className);
 bool IsWindowBad(HWND hWnd);
 bool IsObjectTypeBad(USHORT objectTypeIndex);
 
+#define BAD_OBJECT_TYPE_BITMAP_ULONGS (256 / 32)
+
+const ULONG* GetBadObjectTypeBitmap();
+
+FORCEINLINE bool IsObjectTypeInBitmap(const ULONG* bitmap, USHORT objectTypeIndex)
+{
+	return objectTypeIndex < BAD_OBJECT_TYPE_BITMAP_ULONGS * 32 &&
+		(bitmap[objectTypeIndex / 32] & (1UL << (objectTypeIndex % 32))) != 0;
+}
+
 int ThreadDebugContextFindFreeSlotIndex();
 int ThreadDebugContextFindExistingSlotIndex();
 void ThreadDebugContextRemoveEntry(const int index);
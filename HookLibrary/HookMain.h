@@ -17,6 +17,8 @@ typedef DWORD(WINAPI * t_OutputDebugStringW)(LPCWSTR lpOutputString); //Kernel32
 //WIN 7 X64: OutputDebugStringW -> OutputDebugStringA
 
 #define MAX_NATIVE_HOOKS 32
+#define HIDDEN_OBJECT_TYPES_LENGTH 128 // WCHARs, including the terminator
+#define PROTECTED_PROCESS_NAMES_LENGTH 256
 
 #pragma pack(push, 1)
 typedef struct _HOOK_NATIVE_CALL32 {
@@ -110,6 +112,8 @@ typedef struct _HOOK_DLL_DATA {
     DWORD NtCloseBackupSize;
     t_NtDuplicateObject dNtDuplicateObject;
     DWORD NtDuplicateObjectBackupSize;
+    t_NtSetInformationObject dNtSetInformationObject;
+    DWORD NtSetInformationObjectBackupSize;
 
     t_NtCreateThreadEx dNtCreateThreadEx; //only since vista
     DWORD NtCreateThreadExBackupSize;
@@ -164,6 +168,12 @@ typedef struct _HOOK_DLL_DATA {
     DWORD dwProtectedProcessId;
     BOOLEAN EnableProtectProcessId;
 
+    // Semicolon separated object type names whose handles the protected processes own are hidden. Empty = the default list
+    WCHAR HiddenObjectTypes[HIDDEN_OBJECT_TYPES_LENGTH];
+    // Semicolon separated image names of processes that are protected like dwProtectedProcessId, e.g. debugger helpers.
+    // Only used while EnableProtectProcessId is on
+    WCHAR ProtectedProcessNames[PROTECTED_PROCESS_NAMES_LENGTH];
+
 
     BOOLEAN isNtdllHooked;
     BOOLEAN isKernel32Hooked;
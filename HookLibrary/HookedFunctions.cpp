@@ -6,18 +6,15 @@ HOOK_DLL_DATA HookDllData = { 0 };
 
 #include "HookedFunctions.h"
 #include "HookHelper.h"
+#include "BufferFilters.h"
+#include "HandleShadow.h"
+#include "InfoClassDispatch.h"
 #include "Tls.h"
 
 #include "Scylla/VersionPatch.h"
 
 void FakeCurrentParentProcessId(PSYSTEM_PROCESS_INFORMATION pInfo);
 void FakeCurrentOtherOperationCount(PSYSTEM_PROCESS_INFORMATION pInfo);
-void FilterHandleInfo(PSYSTEM_HANDLE_INFORMATION pHandleInfo, PULONG pReturnLengthAdjust);
-void FilterHandleInfoEx(PSYSTEM_HANDLE_INFORMATION_EX pHandleInfoEx, PULONG pReturnLengthAdjust);
-void FilterProcess(PSYSTEM_PROCESS_INFORMATION pInfo);
-void FilterObjects(POBJECT_TYPES_INFORMATION pObjectTypes);
-void FilterObject(POBJECT_TYPE_INFORMATION pObject, bool zeroTotal);
-void FilterHwndList(HWND * phwndFirst, PUINT pcHwndNeeded);
 
 SAVE_DEBUG_REGISTERS ArrayDebugRegister[100] = { 0 }; //Max 100 threads
 
@@ -46,109 +43,171 @@ NTSTATUS NTAPI HookedNtSetInformationThread(HANDLE ThreadHandle, THREADINFOCLASS
     return HookDllData.dNtSetInformationThread(ThreadHandle, ThreadInformationClass, ThreadInformation, ThreadInformationLength);
 }
 
-NTSTATUS NTAPI HookedNtQuerySystemInformation(SYSTEM_INFORMATION_CLASS SystemInformationClass, PVOID SystemInformation, ULONG SystemInformationLength, PULONG ReturnLength)
+// Post handlers get the output of a successful call and return the final status. TempReturnLength may be adjusted if the output shrinks
+typedef NTSTATUS (*t_SystemInfoPostHandler)(SYSTEM_INFORMATION_CLASS SystemInformationClass, PVOID SystemInformation, ULONG SystemInformationLength, PULONG TempReturnLength, NTSTATUS Status);
+
+typedef struct _SYSTEM_INFO_HOOK
 {
-    if (SystemInformationClass == SystemKernelDebuggerInformation ||
-        SystemInformationClass == SystemProcessInformation ||
-        SystemInformationClass == SystemSessionProcessInformation ||
-        SystemInformationClass == SystemHandleInformation ||
-        SystemInformationClass == SystemExtendedHandleInformation ||
-        SystemInformationClass == SystemExtendedProcessInformation ||   // Vista+
-        SystemInformationClass == SystemCodeIntegrityInformation ||     // Vista+
-        SystemInformationClass == SystemKernelDebuggerInformationEx ||  // 8.1+
-        SystemInformationClass == SystemKernelDebuggerFlags ||          // 10+
-        SystemInformationClass == SystemCodeIntegrityUnlockInformation) // 10+
-    {
-        NTSTATUS ntStat = HookDllData.dNtQuerySystemInformation(SystemInformationClass, SystemInformation, SystemInformationLength, ReturnLength);
-        if (NT_SUCCESS(ntStat) && SystemInformation != nullptr && SystemInformationLength != 0)
-        {
-            if (SystemInformationClass == SystemKernelDebuggerInformation)
-            {
-                BACKUP_RETURNLENGTH();
+    SYSTEM_INFORMATION_CLASS InfoClass;
+    t_SystemInfoPostHandler Post;
+} SYSTEM_INFO_HOOK;
 
-                ((PSYSTEM_KERNEL_DEBUGGER_INFORMATION)SystemInformation)->KernelDebuggerEnabled = FALSE;
-                ((PSYSTEM_KERNEL_DEBUGGER_INFORMATION)SystemInformation)->KernelDebuggerNotPresent = TRUE;
+static NTSTATUS PostSystemKernelDebuggerInformation(SYSTEM_INFORMATION_CLASS, PVOID SystemInformation, ULONG, PULONG, NTSTATUS Status)
+{
+    ((PSYSTEM_KERNEL_DEBUGGER_INFORMATION)SystemInformation)->KernelDebuggerEnabled = FALSE;
+    ((PSYSTEM_KERNEL_DEBUGGER_INFORMATION)SystemInformation)->KernelDebuggerNotPresent = TRUE;
+    return Status;
+}
 
-                RESTORE_RETURNLENGTH();
-            }
-            else if (SystemInformationClass == SystemHandleInformation)
-            {
-                BACKUP_RETURNLENGTH();
-                ULONG ReturnLengthAdjust = 0;
+static NTSTATUS PostSystemHandleInformation(SYSTEM_INFORMATION_CLASS, PVOID SystemInformation, ULONG SystemInformationLength, PULONG TempReturnLength, NTSTATUS Status)
+{
+    ULONG ReturnLengthAdjust = 0;
 
-                FilterHandleInfo((PSYSTEM_HANDLE_INFORMATION)SystemInformation, &ReturnLengthAdjust);
+    FilterHandleInfo((PSYSTEM_HANDLE_INFORMATION)SystemInformation, SystemInformationLength, &ReturnLengthAdjust);
 
-                if (ReturnLengthAdjust <= TempReturnLength)
-				    TempReturnLength -= ReturnLengthAdjust;
-                RESTORE_RETURNLENGTH();
-            }
-            else if (SystemInformationClass == SystemExtendedHandleInformation)
-            {
-                BACKUP_RETURNLENGTH();
-                ULONG ReturnLengthAdjust = 0;
+    if (ReturnLengthAdjust <= *TempReturnLength)
+        *TempReturnLength -= ReturnLengthAdjust;
+    return Status;
+}
 
-                FilterHandleInfoEx((PSYSTEM_HANDLE_INFORMATION_EX)SystemInformation, &ReturnLengthAdjust);
+static NTSTATUS PostSystemExtendedHandleInformation(SYSTEM_INFORMATION_CLASS, PVOID SystemInformation, ULONG SystemInformationLength, PULONG TempReturnLength, NTSTATUS Status)
+{
+    ULONG ReturnLengthAdjust = 0;
 
-                if (ReturnLengthAdjust <= TempReturnLength)
-                    TempReturnLength -= ReturnLengthAdjust;
-                RESTORE_RETURNLENGTH();
-            }
-            else if (SystemInformationClass == SystemProcessInformation ||
-                    SystemInformationClass == SystemSessionProcessInformation ||
-                    SystemInformationClass == SystemExtendedProcessInformation)
-            {
-                BACKUP_RETURNLENGTH();
+    FilterHandleInfoEx((PSYSTEM_HANDLE_INFORMATION_EX)SystemInformation, SystemInformationLength, &ReturnLengthAdjust);
+
+    if (ReturnLengthAdjust <= *TempReturnLength)
+        *TempReturnLength -= ReturnLengthAdjust;
+    return Status;
+}
 
-                PSYSTEM_PROCESS_INFORMATION ProcessInfo = (PSYSTEM_PROCESS_INFORMATION)SystemInformation;
-                if (SystemInformationClass == SystemSessionProcessInformation)
-                    ProcessInfo = (PSYSTEM_PROCESS_INFORMATION)((PSYSTEM_SESSION_PROCESS_INFORMATION)SystemInformation)->Buffer;
+static NTSTATUS PostSystemProcessInformation(SYSTEM_INFORMATION_CLASS SystemInformationClass, PVOID SystemInformation, ULONG SystemInformationLength, PULONG, NTSTATUS Status)
+{
+    PVOID Buffer = SystemInformation;
+    ULONG BufferLength = SystemInformationLength;
+    if (SystemInformationClass == SystemSessionProcessInformation)
+    {
+        if (SystemInformationLength < sizeof(SYSTEM_SESSION_PROCESS_INFORMATION))
+            return Status;
+        Buffer = ((PSYSTEM_SESSION_PROCESS_INFORMATION)SystemInformation)->Buffer;
+        BufferLength = ((PSYSTEM_SESSION_PROCESS_INFORMATION)SystemInformation)->SizeOfBuf;
+    }
 
-                FilterProcess(ProcessInfo);
-                FakeCurrentParentProcessId(ProcessInfo);
-                FakeCurrentOtherOperationCount(ProcessInfo);
+    const ULONG ThreadSize = SystemInformationClass == SystemExtendedProcessInformation ||
+        SystemInformationClass == SystemFullProcessInformation
+        ? sizeof(SYSTEM_EXTENDED_THREAD_INFORMATION)
+        : sizeof(SYSTEM_THREAD_INFORMATION);
+    const ULONG ExtensionSize = SystemInformationClass == SystemFullProcessInformation
+        ? sizeof(SYSTEM_PROCESS_INFORMATION_EXTENSION)
+        : 0;
+
+    // Leave anything we cannot parse alone rather than follow offsets out of the buffer
+    const PSYSTEM_PROCESS_INFORMATION ProcessInfo = (PSYSTEM_PROCESS_INFORMATION)Buffer;
+    if (!IsProcessListValid(ProcessInfo, BufferLength, ThreadSize, ExtensionSize))
+        return Status;
 
-                RESTORE_RETURNLENGTH();
-            }
-            else if (SystemInformationClass == SystemCodeIntegrityInformation)
-            {
-                BACKUP_RETURNLENGTH();
+    FilterProcess(ProcessInfo, HookDllData.EnableProtectProcessId == TRUE ? HookDllData.dwProtectedProcessId : 0);
+    FakeCurrentParentProcessId(ProcessInfo);
+    FakeCurrentOtherOperationCount(ProcessInfo);
+    return Status;
+}
 
-                ((PSYSTEM_CODEINTEGRITY_INFORMATION)SystemInformation)->CodeIntegrityOptions = CODEINTEGRITY_OPTION_ENABLED;
+// Maps a PID to the NT path of its image. Pretend protected and bad processes do not exist
+static NTSTATUS PostSystemProcessIdInformation(SYSTEM_INFORMATION_CLASS, PVOID SystemInformation, ULONG SystemInformationLength, PULONG, NTSTATUS Status)
+{
+    if (SystemInformationLength < sizeof(SYSTEM_PROCESS_ID_INFORMATION))
+        return Status;
 
-                RESTORE_RETURNLENGTH();
-            }
-            else if (SystemInformationClass == SystemKernelDebuggerInformationEx)
+    const PSYSTEM_PROCESS_ID_INFORMATION ProcessIdInfo = (PSYSTEM_PROCESS_ID_INFORMATION)SystemInformation;
+    UNICODE_STRING FileName = ProcessIdInfo->ImageName;
+    if (FileName.Buffer != nullptr)
+    {
+        for (USHORT i = FileName.Length / sizeof(WCHAR); i > 0; --i)
+        {
+            if (FileName.Buffer[i - 1] == L'\\')
             {
-                BACKUP_RETURNLENGTH();
+                FileName.Buffer += i;
+                FileName.Length -= i * sizeof(WCHAR);
+                FileName.MaximumLength -= i * sizeof(WCHAR);
+                break;
+            }
+        }
+    }
+
+    if ((HookDllData.EnableProtectProcessId == TRUE && HandleToULong(ProcessIdInfo->ProcessId) == HookDllData.dwProtectedProcessId) ||
+        IsProcessNameBad(&FileName))
+    {
+        if (ProcessIdInfo->ImageName.Buffer != nullptr)
+            RtlZeroMemory(ProcessIdInfo->ImageName.Buffer, ProcessIdInfo->ImageName.Length);
+        ProcessIdInfo->ImageName.Length = 0;
+        return STATUS_INVALID_CID;
+    }
+    return Status;
+}
 
-                ((PSYSTEM_KERNEL_DEBUGGER_INFORMATION_EX)SystemInformation)->DebuggerAllowed = FALSE;
-                ((PSYSTEM_KERNEL_DEBUGGER_INFORMATION_EX)SystemInformation)->DebuggerEnabled = FALSE;
-                ((PSYSTEM_KERNEL_DEBUGGER_INFORMATION_EX)SystemInformation)->DebuggerPresent = FALSE;
+static NTSTATUS PostSystemCodeIntegrityInformation(SYSTEM_INFORMATION_CLASS, PVOID SystemInformation, ULONG, PULONG, NTSTATUS Status)
+{
+    ((PSYSTEM_CODEINTEGRITY_INFORMATION)SystemInformation)->CodeIntegrityOptions = CODEINTEGRITY_OPTION_ENABLED;
+    return Status;
+}
 
-                RESTORE_RETURNLENGTH();
-            }
-            else if (SystemInformationClass == SystemKernelDebuggerFlags)
-            {
-                BACKUP_RETURNLENGTH();
+static NTSTATUS PostSystemKernelDebuggerInformationEx(SYSTEM_INFORMATION_CLASS, PVOID SystemInformation, ULONG, PULONG, NTSTATUS Status)
+{
+    ((PSYSTEM_KERNEL_DEBUGGER_INFORMATION_EX)SystemInformation)->DebuggerAllowed = FALSE;
+    ((PSYSTEM_KERNEL_DEBUGGER_INFORMATION_EX)SystemInformation)->DebuggerEnabled = FALSE;
+    ((PSYSTEM_KERNEL_DEBUGGER_INFORMATION_EX)SystemInformation)->DebuggerPresent = FALSE;
+    return Status;
+}
 
-                *(PUCHAR)SystemInformation = 0;
+static NTSTATUS PostSystemKernelDebuggerFlags(SYSTEM_INFORMATION_CLASS, PVOID SystemInformation, ULONG, PULONG, NTSTATUS Status)
+{
+    *(PUCHAR)SystemInformation = 0;
+    return Status;
+}
 
-                RESTORE_RETURNLENGTH();
-            }
-            else if (SystemInformationClass == SystemCodeIntegrityUnlockInformation)
-            {
-                BACKUP_RETURNLENGTH();
+static NTSTATUS PostSystemCodeIntegrityUnlockInformation(SYSTEM_INFORMATION_CLASS, PVOID SystemInformation, ULONG SystemInformationLength, PULONG, NTSTATUS Status)
+{
+    // The size of the buffer for this class changed from 4 to 36, but the output should still be all zeroes
+    RtlZeroMemory(SystemInformation, SystemInformationLength);
+    return Status;
+}
 
-                // The size of the buffer for this class changed from 4 to 36, but the output should still be all zeroes
-                RtlZeroMemory(SystemInformation, SystemInformationLength);
+static constexpr SYSTEM_INFO_HOOK SystemInfoHooks[] =
+{
+    { SystemKernelDebuggerInformation, PostSystemKernelDebuggerInformation },
+    { SystemProcessInformation, PostSystemProcessInformation },
+    { SystemSessionProcessInformation, PostSystemProcessInformation },
+    { SystemHandleInformation, PostSystemHandleInformation },
+    { SystemExtendedHandleInformation, PostSystemExtendedHandleInformation },
+    { SystemExtendedProcessInformation, PostSystemProcessInformation },                 // Vista+
+    { SystemProcessIdInformation, PostSystemProcessIdInformation },                     // Vista+
+    { SystemFullProcessInformation, PostSystemProcessInformation },                     // 8+
+    { SystemCodeIntegrityInformation, PostSystemCodeIntegrityInformation },             // Vista+
+    { SystemKernelDebuggerInformationEx, PostSystemKernelDebuggerInformationEx },       // 8.1+
+    { SystemKernelDebuggerFlags, PostSystemKernelDebuggerFlags },                       // 10+
+    { SystemCodeIntegrityUnlockInformation, PostSystemCodeIntegrityUnlockInformation }, // 10+
+};
+static_assert(InfoClassTableIsValid(SystemInfoHooks), "SystemInfoHooks has a class past the index or listed twice");
+static UCHAR SystemInfoHookIndex[INFO_CLASS_INDEX_SIZE] = { 0 };
+static volatile LONG SystemInfoHookIndexBuilt = 0;
 
-                RESTORE_RETURNLENGTH();
-            }
-        }
+NTSTATUS NTAPI HookedNtQuerySystemInformation(SYSTEM_INFORMATION_CLASS SystemInformationClass, PVOID SystemInformation, ULONG SystemInformationLength, PULONG ReturnLength)
+{
+    const SYSTEM_INFO_HOOK* Hook = LookupInfoClass(SystemInfoHooks, SystemInfoHookIndex, SystemInfoHookIndexBuilt, (ULONG)SystemInformationClass);
+    if (Hook == nullptr)
+        return HookDllData.dNtQuerySystemInformation(SystemInformationClass, SystemInformation, SystemInformationLength, ReturnLength);
+
+    NTSTATUS ntStat = HookDllData.dNtQuerySystemInformation(SystemInformationClass, SystemInformation, SystemInformationLength, ReturnLength);
+    if (NT_SUCCESS(ntStat) && SystemInformation != nullptr && SystemInformationLength != 0)
+    {
+        BACKUP_RETURNLENGTH();
 
-        return ntStat;
+        ntStat = Hook->Post(SystemInformationClass, SystemInformation, SystemInformationLength, &TempReturnLength, ntStat);
+
+        RESTORE_RETURNLENGTH();
     }
-    return HookDllData.dNtQuerySystemInformation(SystemInformationClass, SystemInformation, SystemInformationLength, ReturnLength);
+
+    return ntStat;
 }
 
 static ULONG ValueProcessBreakOnTermination = FALSE;
@@ -161,6 +220,9 @@ static bool IsProcessHandleTracingEnabled = false;
 
 // Instrumentation callback
 
+extern "C" ULONG_PTR InstrumentationCallbackRangeStart;
+extern "C" ULONG_PTR InstrumentationCallbackRangeEnd;
+
 static LONG volatile InstrumentationCallbackHookInstalled = 0;
 static ULONG NumManualSyscalls = 0;
 
@@ -175,10 +237,8 @@ InstrumentationCallback(
     if (InterlockedOr(TlsGetInstrumentationCallbackDisabled(), 0x1) == 0x1)
         return ReturnVal; // Do not recurse
 
-    const PVOID ImageBase = NtCurrentPeb()->ImageBaseAddress;
-    const PIMAGE_NT_HEADERS NtHeaders = RtlImageNtHeader(ImageBase);
-    if (NtHeaders != nullptr && ReturnAddress >= (ULONG_PTR)ImageBase &&
-        ReturnAddress < (ULONG_PTR)ImageBase + NtHeaders->OptionalHeader.SizeOfImage)
+    // InstrumentationCallbackAsm has already filtered on this range. Check again in case the callback was installed by other means
+    if (ReturnAddress >= InstrumentationCallbackRangeStart && ReturnAddress < InstrumentationCallbackRangeEnd)
     {
         // Syscall return address within the exe file
         ReturnVal = (ULONG_PTR)(ULONG)STATUS_PORT_NOT_SET;
@@ -196,219 +256,288 @@ InstrumentationCallback(
     return ReturnVal;
 }
 
+static bool IsCurrentProcessHandle(HANDLE ProcessHandle)
+{
+    return ProcessHandle == NtCurrentProcess ||
+        HandleToULong(NtCurrentTeb()->ClientId.UniqueProcess) == GetProcessIdByProcessHandle(ProcessHandle);
+}
+
+// Pre handlers replace the call entirely if they return true. Post handlers get the output of a successful call and return the final status
+typedef bool (*t_ProcessInfoPreHandler)(HANDLE ProcessHandle, PVOID ProcessInformation, ULONG ProcessInformationLength, PULONG ReturnLength, NTSTATUS* Status);
+typedef NTSTATUS (*t_ProcessInfoPostHandler)(PVOID ProcessInformation, NTSTATUS Status);
+
+typedef struct _PROCESS_INFO_HOOK
+{
+    PROCESSINFOCLASS InfoClass;
+    t_ProcessInfoPreHandler Pre;
+    t_ProcessInfoPostHandler Post;
+    bool RestoreBeforePost; // Rewrite ReturnLength before Post, so that a faulting pointer raises before the status changes
+} PROCESS_INFO_HOOK;
+
+static bool PreProcessDebugObjectHandle(HANDLE ProcessHandle, PVOID ProcessInformation, ULONG ProcessInformationLength, PULONG ReturnLength, NTSTATUS* Status)
+{
+    if (ProcessInformation == nullptr || ProcessInformationLength != sizeof(HANDLE) || !IsCurrentProcessHandle(ProcessHandle))
+        return false;
+
+    // Verify (1) that the handle has PROCESS_QUERY_INFORMATION access, and (2) that writing
+    // to ProcessInformation and/or ReturnLength does not cause any access or alignment violations
+    *Status = HookDllData.dNtQueryInformationProcess(ProcessHandle,
+                                                    ProcessDebugPort, // Note: not ProcessDebugObjectHandle
+                                                    ProcessInformation,
+                                                    sizeof(HANDLE),
+                                                    ReturnLength);
+    if (!NT_SUCCESS(*Status))
+        return true;
+
+    // The kernel calls DbgkOpenProcessDebugPort here
+
+    // This should be done in a try/except block, but since we are a mapped DLL we cannot use SEH.
+    // Rely on the fact that the NtQIP call we just did wrote to the same buffers successfully
+    *(PHANDLE)ProcessInformation = nullptr;
+    if (ReturnLength != nullptr)
+        *ReturnLength = sizeof(HANDLE);
+
+    *Status = STATUS_PORT_NOT_SET;
+    return true;
+}
+
+static NTSTATUS PostProcessDebugFlags(PVOID ProcessInformation, NTSTATUS Status)
+{
+    *((ULONG *)ProcessInformation) = ((ValueProcessDebugFlags & PROCESS_NO_DEBUG_INHERIT) != 0) ? 0 : PROCESS_DEBUG_INHERIT;
+    return Status;
+}
+
+static NTSTATUS PostProcessDebugPort(PVOID ProcessInformation, NTSTATUS Status)
+{
+    *((HANDLE *)ProcessInformation) = nullptr;
+    return Status;
+}
+
+static NTSTATUS PostProcessBasicInformation(PVOID ProcessInformation, NTSTATUS Status) //Fake parent
+{
+    ((PPROCESS_BASIC_INFORMATION)ProcessInformation)->InheritedFromUniqueProcessId = ULongToHandle(GetExplorerProcessId());
+    return Status;
+}
+
+static NTSTATUS PostProcessBreakOnTermination(PVOID ProcessInformation, NTSTATUS Status)
+{
+    *((ULONG *)ProcessInformation) = ValueProcessBreakOnTermination;
+    return Status;
+}
+
+static NTSTATUS PostProcessHandleTracing(PVOID, NTSTATUS)
+{
+    return IsProcessHandleTracingEnabled ? STATUS_SUCCESS : STATUS_INVALID_PARAMETER;
+}
+
+static NTSTATUS PostProcessIoCounters(PVOID ProcessInformation, NTSTATUS Status)
+{
+    ((PIO_COUNTERS)ProcessInformation)->OtherOperationCount = 1;
+    return Status;
+}
+
+static constexpr PROCESS_INFO_HOOK QueryProcessInfoHooks[] =
+{
+    { ProcessDebugObjectHandle, PreProcessDebugObjectHandle, nullptr, false },
+    { ProcessDebugFlags, nullptr, PostProcessDebugFlags, false },
+    { ProcessDebugPort, nullptr, PostProcessDebugPort, false },
+    { ProcessBasicInformation, nullptr, PostProcessBasicInformation, false },
+    { ProcessBreakOnTermination, nullptr, PostProcessBreakOnTermination, false },
+    { ProcessHandleTracing, nullptr, PostProcessHandleTracing, true },
+    { ProcessIoCounters, nullptr, PostProcessIoCounters, false },
+};
+static_assert(InfoClassTableIsValid(QueryProcessInfoHooks), "QueryProcessInfoHooks has a class past the index or listed twice");
+static UCHAR QueryProcessInfoHookIndex[INFO_CLASS_INDEX_SIZE] = { 0 };
+static volatile LONG QueryProcessInfoHookIndexBuilt = 0;
+
 NTSTATUS NTAPI HookedNtQueryInformationProcess(HANDLE ProcessHandle, PROCESSINFOCLASS ProcessInformationClass, PVOID ProcessInformation, ULONG ProcessInformationLength, PULONG ReturnLength)
 {
-    if (NumManualSyscalls == 0 &&
+    if (NumManualSyscalls == 0 && TlsIsRegionUsable() &&
         InterlockedOr(&InstrumentationCallbackHookInstalled, 0x1) == 0)
     {
         InstallInstrumentationCallbackHook(NtCurrentProcess, FALSE);
     }
 
-    NTSTATUS Status;
-    if (ProcessInformationClass == ProcessDebugObjectHandle && // Handle ProcessDebugObjectHandle early
-        ProcessInformation != nullptr &&
-        ProcessInformationLength == sizeof(HANDLE) &&
-        (ProcessHandle == NtCurrentProcess || HandleToULong(NtCurrentTeb()->ClientId.UniqueProcess) == GetProcessIdByProcessHandle(ProcessHandle)))
-    {
-        // Verify (1) that the handle has PROCESS_QUERY_INFORMATION access, and (2) that writing
-        // to ProcessInformation and/or ReturnLength does not cause any access or alignment violations
-        Status = HookDllData.dNtQueryInformationProcess(ProcessHandle,
-                                                        ProcessDebugPort, // Note: not ProcessDebugObjectHandle
-                                                        ProcessInformation,
-                                                        sizeof(HANDLE),
-                                                        ReturnLength);
-        if (!NT_SUCCESS(Status))
-            return Status;
+    const PROCESS_INFO_HOOK* Hook = LookupInfoClass(QueryProcessInfoHooks, QueryProcessInfoHookIndex, QueryProcessInfoHookIndexBuilt, (ULONG)ProcessInformationClass);
+    if (Hook == nullptr)
+        return HookDllData.dNtQueryInformationProcess(ProcessHandle, ProcessInformationClass, ProcessInformation, ProcessInformationLength, ReturnLength);
 
-        // The kernel calls DbgkOpenProcessDebugPort here
-
-        // This should be done in a try/except block, but since we are a mapped DLL we cannot use SEH.
-        // Rely on the fact that the NtQIP call we just did wrote to the same buffers successfully
-        *(PHANDLE)ProcessInformation = nullptr;
-        if (ReturnLength != nullptr)
-            *ReturnLength = sizeof(HANDLE);
+    NTSTATUS Status;
+    if (Hook->Pre != nullptr && Hook->Pre(ProcessHandle, ProcessInformation, ProcessInformationLength, ReturnLength, &Status))
+        return Status;
 
-        return STATUS_PORT_NOT_SET;
-    }
+    if (Hook->Post == nullptr || !IsCurrentProcessHandle(ProcessHandle))
+        return HookDllData.dNtQueryInformationProcess(ProcessHandle, ProcessInformationClass, ProcessInformation, ProcessInformationLength, ReturnLength);
 
-    if ((ProcessInformationClass == ProcessDebugFlags ||
-        ProcessInformationClass == ProcessDebugPort ||
-        ProcessInformationClass == ProcessBasicInformation ||
-        ProcessInformationClass == ProcessBreakOnTermination ||
-        ProcessInformationClass == ProcessHandleTracing ||
-        ProcessInformationClass == ProcessIoCounters) &&
-        (ProcessHandle == NtCurrentProcess || HandleToULong(NtCurrentTeb()->ClientId.UniqueProcess) == GetProcessIdByProcessHandle(ProcessHandle)))
+    Status = HookDllData.dNtQueryInformationProcess(ProcessHandle, ProcessInformationClass, ProcessInformation, ProcessInformationLength, ReturnLength);
+    if (NT_SUCCESS(Status) && ProcessInformation != nullptr && ProcessInformationLength != 0)
     {
-        Status = HookDllData.dNtQueryInformationProcess(ProcessHandle, ProcessInformationClass, ProcessInformation, ProcessInformationLength, ReturnLength);
+        BACKUP_RETURNLENGTH();
 
-        if (NT_SUCCESS(Status) && ProcessInformation != nullptr && ProcessInformationLength != 0)
+        if (Hook->RestoreBeforePost)
         {
-            if (ProcessInformationClass == ProcessDebugFlags)
-            {
-                BACKUP_RETURNLENGTH();
-
-                *((ULONG *)ProcessInformation) = ((ValueProcessDebugFlags & PROCESS_NO_DEBUG_INHERIT) != 0) ? 0 : PROCESS_DEBUG_INHERIT;
+            RESTORE_RETURNLENGTH();
+            Status = Hook->Post(ProcessInformation, Status);
+        }
+        else
+        {
+            Status = Hook->Post(ProcessInformation, Status);
+            RESTORE_RETURNLENGTH();
+        }
+    }
 
-                RESTORE_RETURNLENGTH();
-            }
-            else if (ProcessInformationClass == ProcessDebugPort)
-            {
-                BACKUP_RETURNLENGTH();
+    return Status;
+}
 
-                *((HANDLE *)ProcessInformation) = nullptr;
+// Set handlers run instead of the real call, and only for the current process
+typedef NTSTATUS (*t_SetProcessInfoHandler)(PVOID ProcessInformation, ULONG ProcessInformationLength);
 
-                RESTORE_RETURNLENGTH();
-            }
-            else if (ProcessInformationClass == ProcessBasicInformation) //Fake parent
-            {
-                BACKUP_RETURNLENGTH();
+typedef struct _SET_PROCESS_INFO_HOOK
+{
+    PROCESSINFOCLASS InfoClass;
+    t_SetProcessInfoHandler Set;
+} SET_PROCESS_INFO_HOOK;
 
-                ((PPROCESS_BASIC_INFORMATION)ProcessInformation)->InheritedFromUniqueProcessId = ULongToHandle(GetExplorerProcessId());
+static NTSTATUS SetProcessBreakOnTermination(PVOID ProcessInformation, ULONG ProcessInformationLength)
+{
+    if (ProcessInformationLength != sizeof(ULONG))
+    {
+        return STATUS_INFO_LENGTH_MISMATCH;
+    }
 
-                RESTORE_RETURNLENGTH();
-            }
-            else if (ProcessInformationClass == ProcessBreakOnTermination)
-            {
-                BACKUP_RETURNLENGTH();
+    // NtSetInformationProcess will happily dereference this pointer
+    if (ProcessInformation == NULL)
+    {
+        return STATUS_ACCESS_VIOLATION;
+    }
 
-                *((ULONG *)ProcessInformation) = ValueProcessBreakOnTermination;
+    // A process must have debug privileges enabled to set the ProcessBreakOnTermination flag
+    if (!HasDebugPrivileges(NtCurrentProcess))
+    {
+        return STATUS_PRIVILEGE_NOT_HELD;
+    }
 
-                RESTORE_RETURNLENGTH();
-            }
-			else if (ProcessInformationClass == ProcessHandleTracing)
-			{
-                BACKUP_RETURNLENGTH();
-                RESTORE_RETURNLENGTH(); // Trigger any possible exceptions caused by messing with the output buffer before changing the final return status
+    ValueProcessBreakOnTermination = *((ULONG *)ProcessInformation);
+    return STATUS_SUCCESS;
+}
 
-                Status = IsProcessHandleTracingEnabled ? STATUS_SUCCESS : STATUS_INVALID_PARAMETER;
-			}
-            else if (ProcessInformationClass == ProcessIoCounters)
-            {
-                BACKUP_RETURNLENGTH();
+// Don't allow changing the debug inherit flag, and keep track of the new value to report in NtQIP
+static NTSTATUS SetProcessDebugFlags(PVOID ProcessInformation, ULONG ProcessInformationLength)
+{
+    if (ProcessInformationLength != sizeof(ULONG))
+    {
+        return STATUS_INFO_LENGTH_MISMATCH;
+    }
 
-                ((PIO_COUNTERS)ProcessInformation)->OtherOperationCount = 1;
+    if (ProcessInformation == NULL)
+    {
+        return STATUS_ACCESS_VIOLATION;
+    }
 
-                RESTORE_RETURNLENGTH();
-            }
-        }
+    ULONG Flags = *(ULONG*)ProcessInformation;
+    if ((Flags & ~PROCESS_DEBUG_INHERIT) != 0)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
 
-        return Status;
+    if ((Flags & PROCESS_DEBUG_INHERIT) != 0)
+    {
+        ValueProcessDebugFlags &= ~PROCESS_NO_DEBUG_INHERIT;
+    }
+    else
+    {
+        ValueProcessDebugFlags |= PROCESS_NO_DEBUG_INHERIT;
     }
-    return HookDllData.dNtQueryInformationProcess(ProcessHandle, ProcessInformationClass, ProcessInformation, ProcessInformationLength, ReturnLength);
+    return STATUS_SUCCESS;
 }
 
-NTSTATUS NTAPI HookedNtSetInformationProcess(HANDLE ProcessHandle, PROCESSINFOCLASS ProcessInformationClass, PVOID ProcessInformation, ULONG ProcessInformationLength)
+//PROCESS_HANDLE_TRACING_ENABLE -> ULONG, PROCESS_HANDLE_TRACING_ENABLE_EX -> ULONG,ULONG
+static NTSTATUS SetProcessHandleTracing(PVOID ProcessInformation, ULONG ProcessInformationLength)
 {
-	if (ProcessHandle == NtCurrentProcess || HandleToULong(NtCurrentTeb()->ClientId.UniqueProcess) == GetProcessIdByProcessHandle(ProcessHandle))
+    bool enable = ProcessInformationLength != 0; // A length of 0 is valid and indicates we should disable tracing
+    if (enable)
     {
-        if (ProcessInformationClass == ProcessBreakOnTermination)
+        if (ProcessInformationLength != sizeof(ULONG) && ProcessInformationLength != (sizeof(ULONG) * 2))
         {
-			if (ProcessInformationLength != sizeof(ULONG))
-			{
-				return STATUS_INFO_LENGTH_MISMATCH;
-			}
-
-			// NtSetInformationProcess will happily dereference this pointer
-			if (ProcessInformation == NULL)
-			{
-				return STATUS_ACCESS_VIOLATION;
-			}
+            return STATUS_INFO_LENGTH_MISMATCH;
+        }
 
-			// A process must have debug privileges enabled to set the ProcessBreakOnTermination flag
-			if (!HasDebugPrivileges(NtCurrentProcess))
-			{
-				return STATUS_PRIVILEGE_NOT_HELD;
-			}
+        // NtSetInformationProcess will happily dereference this pointer
+        if (ProcessInformation == NULL)
+        {
+            return STATUS_ACCESS_VIOLATION;
+        }
 
-            ValueProcessBreakOnTermination = *((ULONG *)ProcessInformation);
-            return STATUS_SUCCESS;
+        PPROCESS_HANDLE_TRACING_ENABLE_EX phtEx = (PPROCESS_HANDLE_TRACING_ENABLE_EX)ProcessInformation;
+        if (phtEx->Flags != 0)
+        {
+            return STATUS_INVALID_PARAMETER;
         }
+    }
 
-		// Don't allow changing the debug inherit flag, and keep track of the new value to report in NtQIP
-		if (ProcessInformationClass == ProcessDebugFlags)
-		{
-			if (ProcessInformationLength != sizeof(ULONG))
-			{
-				return STATUS_INFO_LENGTH_MISMATCH;
-			}
+    IsProcessHandleTracingEnabled = enable;
+    return STATUS_SUCCESS;
+}
 
-			if (ProcessInformation == NULL)
-			{
-				return STATUS_ACCESS_VIOLATION;
-			}
+static constexpr SET_PROCESS_INFO_HOOK SetProcessInfoHooks[] =
+{
+    { ProcessBreakOnTermination, SetProcessBreakOnTermination },
+    { ProcessDebugFlags, SetProcessDebugFlags },
+    { ProcessHandleTracing, SetProcessHandleTracing },
+};
+static_assert(InfoClassTableIsValid(SetProcessInfoHooks), "SetProcessInfoHooks has a class past the index or listed twice");
+static UCHAR SetProcessInfoHookIndex[INFO_CLASS_INDEX_SIZE] = { 0 };
+static volatile LONG SetProcessInfoHookIndexBuilt = 0;
 
-			ULONG Flags = *(ULONG*)ProcessInformation;
-			if ((Flags & ~PROCESS_DEBUG_INHERIT) != 0)
-			{
-				return STATUS_INVALID_PARAMETER;
-			}
+NTSTATUS NTAPI HookedNtSetInformationProcess(HANDLE ProcessHandle, PROCESSINFOCLASS ProcessInformationClass, PVOID ProcessInformation, ULONG ProcessInformationLength)
+{
+    const SET_PROCESS_INFO_HOOK* Hook = LookupInfoClass(SetProcessInfoHooks, SetProcessInfoHookIndex, SetProcessInfoHookIndexBuilt, (ULONG)ProcessInformationClass);
+    if (Hook != nullptr && IsCurrentProcessHandle(ProcessHandle))
+        return Hook->Set(ProcessInformation, ProcessInformationLength);
 
-			if ((Flags & PROCESS_DEBUG_INHERIT) != 0)
-			{
-				ValueProcessDebugFlags &= ~PROCESS_NO_DEBUG_INHERIT;
-			}
-			else
-			{
-				ValueProcessDebugFlags |= PROCESS_NO_DEBUG_INHERIT;
-			}
-			return STATUS_SUCCESS;
-		}
+    return HookDllData.dNtSetInformationProcess(ProcessHandle, ProcessInformationClass, ProcessInformation, ProcessInformationLength);
+}
 
-		//PROCESS_HANDLE_TRACING_ENABLE -> ULONG, PROCESS_HANDLE_TRACING_ENABLE_EX -> ULONG,ULONG
-		if (ProcessInformationClass == ProcessHandleTracing)
-		{
-			bool enable = ProcessInformationLength != 0; // A length of 0 is valid and indicates we should disable tracing
-			if (enable)
-			{
-				if (ProcessInformationLength != sizeof(ULONG) && ProcessInformationLength != (sizeof(ULONG) * 2))
-				{
-					return STATUS_INFO_LENGTH_MISMATCH;
-				}
-
-				// NtSetInformationProcess will happily dereference this pointer
-				if (ProcessInformation == NULL)
-				{
-					return STATUS_ACCESS_VIOLATION;
-				}
-
-				PPROCESS_HANDLE_TRACING_ENABLE_EX phtEx = (PPROCESS_HANDLE_TRACING_ENABLE_EX)ProcessInformation;
-				if (phtEx->Flags != 0)
-				{
-					return STATUS_INVALID_PARAMETER;
-				}
-			}
+typedef void (*t_ObjectInfoPostHandler)(PVOID ObjectInformation, ULONG ObjectInformationLength);
 
-			IsProcessHandleTracingEnabled = enable;
-			return STATUS_SUCCESS;
-		}
-    }
-    return HookDllData.dNtSetInformationProcess(ProcessHandle, ProcessInformationClass, ProcessInformation, ProcessInformationLength);
+typedef struct _OBJECT_INFO_HOOK
+{
+    OBJECT_INFORMATION_CLASS InfoClass;
+    t_ObjectInfoPostHandler Post;
+} OBJECT_INFO_HOOK;
+
+static void PostObjectTypesInformation(PVOID ObjectInformation, ULONG ObjectInformationLength)
+{
+    FilterObjects((POBJECT_TYPES_INFORMATION)ObjectInformation, ObjectInformationLength);
 }
 
+static void PostObjectTypeInformation(PVOID ObjectInformation, ULONG ObjectInformationLength)
+{
+    if (ObjectInformationLength >= sizeof(OBJECT_TYPE_INFORMATION))
+        FilterObject((POBJECT_TYPE_INFORMATION)ObjectInformation, ObjectInformationLength - sizeof(OBJECT_TYPE_INFORMATION), false);
+}
+
+static constexpr OBJECT_INFO_HOOK ObjectInfoHooks[] =
+{
+    { ObjectTypesInformation, PostObjectTypesInformation },
+    { ObjectTypeInformation, PostObjectTypeInformation },
+};
+static_assert(InfoClassTableIsValid(ObjectInfoHooks), "ObjectInfoHooks has a class past the index or listed twice");
+static UCHAR ObjectInfoHookIndex[INFO_CLASS_INDEX_SIZE] = { 0 };
+static volatile LONG ObjectInfoHookIndexBuilt = 0;
+
 NTSTATUS NTAPI HookedNtQueryObject(HANDLE Handle, OBJECT_INFORMATION_CLASS ObjectInformationClass, PVOID ObjectInformation, ULONG ObjectInformationLength, PULONG ReturnLength)
 {
     NTSTATUS ntStat = HookDllData.dNtQueryObject(Handle, ObjectInformationClass, ObjectInformation, ObjectInformationLength, ReturnLength);
 
-    if ((ObjectInformationClass == ObjectTypesInformation ||
-        ObjectInformationClass == ObjectTypeInformation) &&
-        (NT_SUCCESS(ntStat) && ObjectInformation))
+    const OBJECT_INFO_HOOK* Hook = LookupInfoClass(ObjectInfoHooks, ObjectInfoHookIndex, ObjectInfoHookIndexBuilt, (ULONG)ObjectInformationClass);
+    if (Hook != nullptr && NT_SUCCESS(ntStat) && ObjectInformation)
     {
-        if (ObjectInformationClass == ObjectTypesInformation)
-        {
-            BACKUP_RETURNLENGTH();
+        BACKUP_RETURNLENGTH();
 
-            FilterObjects((POBJECT_TYPES_INFORMATION)ObjectInformation);
+        Hook->Post(ObjectInformation, ObjectInformationLength);
 
-            RESTORE_RETURNLENGTH();
-        }
-        else if (ObjectInformationClass == ObjectTypeInformation)
-        {
-            BACKUP_RETURNLENGTH();
-
-            FilterObject((POBJECT_TYPE_INFORMATION)ObjectInformation, false);
-
-            RESTORE_RETURNLENGTH();
-        }
+        RESTORE_RETURNLENGTH();
     }
 
     return ntStat;
@@ -618,7 +747,9 @@ void NAKED NTAPI HookedNativeCallInternal()
 #endif
 }
 
-NTSTATUS NTAPI HookedNtClose(HANDLE Handle)
+static HANDLE_SHADOW_TABLE HandleShadowTable;
+
+static NTSTATUS QueryProtectFromClose(void*, HANDLE Handle, BOOLEAN* ProtectFromClose)
 {
     OBJECT_HANDLE_FLAG_INFORMATION flags;
     NTSTATUS Status;
@@ -628,40 +759,60 @@ NTSTATUS NTAPI HookedNtClose(HANDLE Handle)
         Status = NtQueryObject(Handle, ObjectHandleFlagInformation, &flags, sizeof(OBJECT_HANDLE_FLAG_INFORMATION), nullptr);
 
     if (NT_SUCCESS(Status))
-    {
-        if (flags.ProtectFromClose)
-        {
-            return STATUS_HANDLE_NOT_CLOSABLE;
-        }
+        *ProtectFromClose = flags.ProtectFromClose;
+    return Status;
+}
 
-        return HookDllData.dNtClose(Handle);
-    }
+static NTSTATUS CloseUnhooked(void*, HANDLE Handle)
+{
+    return HookDllData.dNtClose(Handle);
+}
 
-    return STATUS_INVALID_HANDLE;
+NTSTATUS NTAPI HookedNtClose(HANDLE Handle)
+{
+    // Closing an invalid or protected handle raises an exception under a debugger, so both are checked first
+    return HandleShadowClose(HandleShadowTable, Handle, QueryProtectFromClose, CloseUnhooked, nullptr);
 }
 
 NTSTATUS NTAPI HookedNtDuplicateObject(HANDLE SourceProcessHandle, HANDLE SourceHandle, HANDLE TargetProcessHandle, PHANDLE TargetHandle, ACCESS_MASK DesiredAccess, ULONG HandleAttributes, ULONG Options)
 {
-	if (Options & DUPLICATE_CLOSE_SOURCE)
+	// A real handle to our own process closes and copies local handles just like NtCurrentProcess does
+	const bool SourceIsLocal = IsCurrentProcessHandle(SourceProcessHandle);
+
+	// If a process is being debugged and duplicates a handle with DUPLICATE_CLOSE_SOURCE, *and* the handle has the ProtectFromClose bit set, a STATUS_HANDLE_NOT_CLOSABLE exception will occur.
+	// This is actually the exact same exception we already check for in NtClose, but the difference is that this NtClose call happens inside the kernel which we obviously can't hook.
+	// When a process is not being debugged, NtDuplicateObject will simply return success without closing the source. This is because ObDuplicateObject ignores NtClose return values
+	bool SourceProtected = false;
+	if (SourceIsLocal)
 	{
-		// If a process is being debugged and duplicates a handle with DUPLICATE_CLOSE_SOURCE, *and* the handle has the ProtectFromClose bit set, a STATUS_HANDLE_NOT_CLOSABLE exception will occur.
-		// This is actually the exact same exception we already check for in NtClose, but the difference is that this NtClose call happens inside the kernel which we obviously can't hook.
-		// When a process is not being debugged, NtDuplicateObject will simply return success without closing the source. This is because ObDuplicateObject ignores NtClose return values
-		OBJECT_HANDLE_FLAG_INFORMATION HandleFlags;
-		NTSTATUS Status;
-		if (HookDllData.dNtQueryObject != nullptr)
-			Status = HookDllData.dNtQueryObject(SourceHandle, ObjectHandleFlagInformation, &HandleFlags, sizeof(HandleFlags), nullptr);
-		else
-			Status = NtQueryObject(SourceHandle, ObjectHandleFlagInformation, &HandleFlags, sizeof(HandleFlags), nullptr);
-
-		if (NT_SUCCESS(Status) && HandleFlags.ProtectFromClose)
-		{
-			// Prevent the exception
-			Options &= ~DUPLICATE_CLOSE_SOURCE;
-		}
+		Options = HandleShadowDuplicateOptions(HandleShadowTable, SourceHandle, Options, QueryProtectFromClose, nullptr, &SourceProtected);
 	}
+	else if (Options & DUPLICATE_CLOSE_SOURCE)
+	{
+		BOOLEAN ProtectFromClose;
+		if (NT_SUCCESS(QueryProtectFromClose(nullptr, SourceHandle, &ProtectFromClose)) && ProtectFromClose)
+			Options &= ~DUPLICATE_CLOSE_SOURCE; // Prevent the exception
+	}
+
+	const NTSTATUS Status = HookDllData.dNtDuplicateObject(SourceProcessHandle, SourceHandle, TargetProcessHandle, TargetHandle, DesiredAccess, HandleAttributes, Options);
+
+	if (NT_SUCCESS(Status) && TargetHandle != nullptr && IsCurrentProcessHandle(TargetProcessHandle))
+		HandleShadowDuplicated(HandleShadowTable, *TargetHandle, Options, SourceProtected);
 
-	return HookDllData.dNtDuplicateObject(SourceProcessHandle, SourceHandle, TargetProcessHandle, TargetHandle, DesiredAccess, HandleAttributes, Options);
+	return Status;
+}
+
+NTSTATUS NTAPI HookedNtSetInformationObject(HANDLE Handle, OBJECT_INFORMATION_CLASS ObjectInformationClass, PVOID ObjectInformation, ULONG ObjectInformationLength)
+{
+    if (ObjectInformationClass != ObjectHandleFlagInformation)
+        return HookDllData.dNtSetInformationObject(Handle, ObjectInformationClass, ObjectInformation, ObjectInformationLength);
+
+    // Forget the handle while its flags change, then record the new flag if the call succeeded
+    HandleShadowSetProtected(HandleShadowTable, Handle, false);
+    const NTSTATUS Status = HookDllData.dNtSetInformationObject(Handle, ObjectInformationClass, ObjectInformation, ObjectInformationLength);
+    if (NT_SUCCESS(Status) && ObjectInformationLength >= sizeof(OBJECT_HANDLE_FLAG_INFORMATION))
+        HandleShadowSetProtected(HandleShadowTable, Handle, ((POBJECT_HANDLE_FLAG_INFORMATION)ObjectInformation)->ProtectFromClose != FALSE);
+    return Status;
 }
 
 //////////////////////////////////////////////////////////////
@@ -887,39 +1038,13 @@ NTSTATUS NTAPI HookedNtSetDebugFilterState(ULONG ComponentId, ULONG Level, BOOLE
     return HasDebugPrivileges(NtCurrentProcess) ? STATUS_SUCCESS : STATUS_ACCESS_DENIED;
 }
 
-void FilterHwndList(HWND * phwndFirst, PULONG pcHwndNeeded)
-{
-    for (UINT i = 0; i < *pcHwndNeeded; i++)
-    {
-        if (phwndFirst[i] != nullptr && IsWindowBad(phwndFirst[i]))
-        {
-            if (i == 0)
-            {
-                // Find the first HWND that belongs to a different process (i + 1, i + 2... may still be ours)
-                for (UINT j = i + 1; j < *pcHwndNeeded; j++)
-                {
-                    if (phwndFirst[j] != nullptr && !IsWindowBad(phwndFirst[j]))
-                    {
-                        phwndFirst[i] = phwndFirst[j];
-                        break;
-                    }
-                }
-            }
-            else
-            {
-                phwndFirst[i] = phwndFirst[i - 1]; //just override with previous
-            }
-        }
-    }
-}
-
 NTSTATUS NTAPI HookedNtUserBuildHwndList(HDESK hDesktop, HWND hwndParent, BOOLEAN bChildren, ULONG dwThreadId, ULONG lParam, HWND* pWnd, PULONG pBufSize)
 {
     NTSTATUS ntStat = HookDllData.dNtUserBuildHwndList(hDesktop, hwndParent, bChildren, dwThreadId, lParam, pWnd, pBufSize);
 
     if (NT_SUCCESS(ntStat) && pWnd != nullptr && pBufSize != nullptr)
     {
-        FilterHwndList(pWnd, pBufSize);
+        FilterHwndList(pWnd, lParam, pBufSize); // lParam is the capacity of pWnd
     }
 
     return ntStat;
@@ -931,7 +1056,7 @@ NTSTATUS NTAPI HookedNtUserBuildHwndList_Eight(HDESK hDesktop, HWND hwndParent,
 
     if (NT_SUCCESS(ntStat) && pWnd != nullptr && pBufSize != nullptr)
     {
-        FilterHwndList(pWnd, pBufSize);
+        FilterHwndList(pWnd, lParam, pBufSize); // lParam is the capacity of pWnd
     }
 
     return ntStat;
@@ -991,72 +1116,6 @@ NTSTATUS NTAPI HookedNtCreateThreadEx(PHANDLE ThreadHandle,ACCESS_MASK DesiredAc
     return HookDllData.dNtCreateThreadEx(ThreadHandle, DesiredAccess, ObjectAttributes, ProcessHandle, StartRoutine, Argument, CreateFlags, ZeroBits, StackSize, MaximumStackSize,AttributeList);
 }
 
-void FilterHandleInfo(PSYSTEM_HANDLE_INFORMATION pHandleInfo, PULONG pReturnLengthAdjust)
-{
-    *pReturnLengthAdjust = 0;
-    const ULONG TrueCount = pHandleInfo->NumberOfHandles;
-    for (ULONG i = 0; i < TrueCount; ++i)
-    {
-        // TODO: protect processes by name too
-        if ((HookDllData.EnableProtectProcessId == TRUE && (ULONG)(pHandleInfo->Handles[i].UniqueProcessId == HookDllData.dwProtectedProcessId)) &&
-            IsObjectTypeBad(pHandleInfo->Handles[i].ObjectTypeIndex))
-        {
-            pHandleInfo->NumberOfHandles--;
-            *pReturnLengthAdjust += sizeof(SYSTEM_HANDLE_TABLE_ENTRY_INFO);
-            for (ULONG j = i; j < TrueCount - 1; ++j)
-            {
-                pHandleInfo->Handles[j] = pHandleInfo->Handles[j + 1];
-                RtlZeroMemory(&pHandleInfo->Handles[j + 1], sizeof(pHandleInfo->Handles[j + 1]));
-            }
-            i--;
-        }
-    }
-}
-
-void FilterHandleInfoEx(PSYSTEM_HANDLE_INFORMATION_EX pHandleInfoEx, PULONG pReturnLengthAdjust)
-{
-    *pReturnLengthAdjust = 0;
-    const ULONG TrueCount = (ULONG)pHandleInfoEx->NumberOfHandles;
-    for (ULONG i = 0; i < TrueCount; ++i)
-    {
-        // TODO: protect processes by name too
-        if ((HookDllData.EnableProtectProcessId == TRUE && (ULONG)(pHandleInfoEx->Handles[i].UniqueProcessId == HookDllData.dwProtectedProcessId)) &&
-            IsObjectTypeBad(pHandleInfoEx->Handles[i].ObjectTypeIndex))
-        {
-            pHandleInfoEx->NumberOfHandles--;
-            *pReturnLengthAdjust += sizeof(SYSTEM_HANDLE_TABLE_ENTRY_INFO_EX);
-            for (ULONG j = i; j < TrueCount - 1; ++j)
-            {
-                pHandleInfoEx->Handles[j] = pHandleInfoEx->Handles[j + 1];
-                RtlZeroMemory(&pHandleInfoEx->Handles[j + 1], sizeof(pHandleInfoEx->Handles[j + 1]));
-            }
-            i--;
-        }
-    }
-}
-
-void FilterObjects(POBJECT_TYPES_INFORMATION pObjectTypes)
-{
-    POBJECT_TYPE_INFORMATION pObject = pObjectTypes->TypeInformation;
-    for (ULONG i = 0; i < pObjectTypes->NumberOfTypes; i++)
-    {
-        FilterObject(pObject, true);
-
-        pObject = (POBJECT_TYPE_INFORMATION)(((PCHAR)(pObject + 1) + ALIGN_UP(pObject->TypeName.MaximumLength, ULONG_PTR)));
-    }
-}
-
-void FilterObject(POBJECT_TYPE_INFORMATION pObject, bool zeroTotal)
-{
-    UNICODE_STRING debugObjectName = RTL_CONSTANT_STRING(L"DebugObject");
-    if (RtlEqualUnicodeString(&debugObjectName, &pObject->TypeName, FALSE))
-    {
-        // Subtract just one from both counts for our debugger, unless the query was a generic one for all object types
-        pObject->TotalNumberOfObjects = zeroTotal || pObject->TotalNumberOfObjects == 0 ? 0 : pObject->TotalNumberOfObjects - 1;
-        pObject->TotalNumberOfHandles = zeroTotal || pObject->TotalNumberOfHandles == 0 ? 0 : pObject->TotalNumberOfHandles - 1;
-    }
-}
-
 void FakeCurrentParentProcessId(PSYSTEM_PROCESS_INFORMATION pInfo)
 {
     while (true)
@@ -1093,42 +1152,6 @@ void FakeCurrentOtherOperationCount(PSYSTEM_PROCESS_INFORMATION pInfo)
     }
 }
 
-void FilterProcess(PSYSTEM_PROCESS_INFORMATION pInfo)
-{
-    PSYSTEM_PROCESS_INFORMATION pPrev = pInfo;
-
-    while (TRUE)
-    {
-        if (IsProcessNameBad(&pInfo->ImageName) || ((HookDllData.EnableProtectProcessId == TRUE) && (HandleToULong(pInfo->UniqueProcessId) == HookDllData.dwProtectedProcessId)))
-        {
-            if (pInfo->ImageName.Buffer)
-                ZeroMemory(pInfo->ImageName.Buffer, pInfo->ImageName.Length);
-
-            if (pInfo->NextEntryOffset == 0) //last element
-            {
-                pPrev->NextEntryOffset = 0;
-            }
-            else
-            {
-                pPrev->NextEntryOffset += pInfo->NextEntryOffset;
-            }
-        }
-        else
-        {
-            pPrev = pInfo;
-        }
-
-        if (pInfo->NextEntryOffset == 0)
-        {
-            break;
-        }
-        else
-        {
-            pInfo = (PSYSTEM_PROCESS_INFORMATION)((DWORD_PTR)pInfo + pInfo->NextEntryOffset);
-        }
-    }
-}
-
 NTSTATUS NTAPI HookedNtResumeThread(HANDLE ThreadHandle, PULONG PreviousSuspendCount)
 {
 	DWORD dwProcessId = GetProcessIdByThreadHandle(ThreadHandle);
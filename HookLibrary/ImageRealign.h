@@ -0,0 +1,80 @@
+#pragma once
+
+#include <ntdll/ntdll.h>
+
+// Lays a PE image as it is mapped in memory out as a file: the headers, then each section at the next FileAlignment
+// boundary with its raw size clamped to the image, and PointerToRawData and SizeOfRawData rewritten in the copied
+// section table. Returns the size of the file, 0 if the headers are not valid for imageSize bytes. Only writes to out
+// if outSize is at least that size, so it can be called with nullptr first to get the size.
+// Header only with no dependencies besides ntdll.h, so UnitTests can run it on sample images
+inline ULONG RealignImageForFile(const BYTE * image, DWORD imageSize, BYTE * out, ULONG outSize)
+{
+	// Validate everything up to and including the section table before touching it
+	if (imageSize < sizeof(IMAGE_DOS_HEADER))
+		return 0;
+	const PIMAGE_DOS_HEADER pDos = (PIMAGE_DOS_HEADER)image;
+	if (pDos->e_magic != IMAGE_DOS_SIGNATURE || pDos->e_lfanew < 0 ||
+		(DWORD)pDos->e_lfanew > imageSize - FIELD_OFFSET(IMAGE_NT_HEADERS, OptionalHeader))
+		return 0;
+	const PIMAGE_NT_HEADERS pNt = (PIMAGE_NT_HEADERS)(image + pDos->e_lfanew);
+	if (pNt->Signature != IMAGE_NT_SIGNATURE)
+		return 0;
+
+	// FileAlignment and SizeOfHeaders are at the same offsets in the 32 and 64 bit optional headers
+	const ULONGLONG SectionTableOffset = (ULONGLONG)pDos->e_lfanew + FIELD_OFFSET(IMAGE_NT_HEADERS, OptionalHeader) + pNt->FileHeader.SizeOfOptionalHeader;
+	const ULONGLONG SectionTableEnd = SectionTableOffset + (ULONGLONG)pNt->FileHeader.NumberOfSections * sizeof(IMAGE_SECTION_HEADER);
+	if (SectionTableOffset < FIELD_OFFSET(IMAGE_NT_HEADERS, OptionalHeader.SizeOfHeaders) + sizeof(DWORD) + (ULONGLONG)pDos->e_lfanew ||
+		SectionTableEnd > imageSize)
+		return 0;
+
+	DWORD FileAlignment = pNt->OptionalHeader.FileAlignment;
+	if (FileAlignment == 0 || (FileAlignment & (FileAlignment - 1)) != 0)
+		FileAlignment = 0x200;
+	const ULONG HeadersSize = (ULONG)MIN(MAX((ULONGLONG)pNt->OptionalHeader.SizeOfHeaders, SectionTableEnd), (ULONGLONG)imageSize);
+
+	// First pass computes the file size, the second (if there is room) copies headers and sections to their new raw offsets
+	const PIMAGE_SECTION_HEADER pSections = (PIMAGE_SECTION_HEADER)(image + SectionTableOffset);
+	ULONGLONG FileSize = HeadersSize;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		if (pass == 1)
+		{
+			if (out == nullptr || outSize < FileSize)
+				break;
+			RtlZeroMemory(out, (SIZE_T)FileSize);
+			RtlCopyMemory(out, image, HeadersSize);
+		}
+
+		ULONGLONG Offset = HeadersSize;
+		for (WORD i = 0; i < pNt->FileHeader.NumberOfSections; i++)
+		{
+			const DWORD VirtualAddress = pSections[i].VirtualAddress;
+			const DWORD RawSize = VirtualAddress >= imageSize ? 0 : MIN(pSections[i].SizeOfRawData, imageSize - VirtualAddress);
+			if (RawSize == 0)
+			{
+				// Nothing in the file, so no padding for it either, or a trailing empty section would grow the file
+				if (pass == 1)
+				{
+					const PIMAGE_SECTION_HEADER pOutSection = (PIMAGE_SECTION_HEADER)(out + SectionTableOffset) + i;
+					pOutSection->PointerToRawData = 0;
+					pOutSection->SizeOfRawData = 0;
+				}
+				continue;
+			}
+			Offset = (Offset + FileAlignment - 1) & ~(ULONGLONG)(FileAlignment - 1);
+			if (Offset + RawSize > MAXULONG)
+				return 0;
+
+			if (pass == 1)
+			{
+				RtlCopyMemory(out + Offset, image + VirtualAddress, RawSize);
+				const PIMAGE_SECTION_HEADER pOutSection = (PIMAGE_SECTION_HEADER)(out + SectionTableOffset) + i;
+				pOutSection->PointerToRawData = (DWORD)Offset;
+				pOutSection->SizeOfRawData = RawSize;
+			}
+			Offset += RawSize;
+		}
+		FileSize = Offset;
+	}
+	return (ULONG)FileSize;
+}
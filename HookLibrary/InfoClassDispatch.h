@@ -0,0 +1,47 @@
+#pragma once
+
+#include <ntdll/ntdll.h>
+
+// Sparse dispatch tables for the information class hooks. Each table is a short list of hooked classes,
+// indexed once by class value so that calls for classes we do not care about cost a single lookup.
+// The entries only need an InfoClass member; the hooks in HookedFunctions.cpp add their handlers to it
+#define INFO_CLASS_INDEX_SIZE 256
+
+// True if every class of the table fits the index and none is listed twice. A class that fails this would never be
+// dispatched, or shadow another entry, so the tables are checked with static_assert where they are defined
+template<typename TEntry, ULONG NumEntries>
+constexpr bool InfoClassTableIsValid(const TEntry (&Entries)[NumEntries])
+{
+    if (NumEntries >= 0xFF) // The index stores entry number + 1 in a UCHAR
+        return false;
+    for (ULONG i = 0; i < NumEntries; ++i)
+    {
+        if ((ULONG)Entries[i].InfoClass >= INFO_CLASS_INDEX_SIZE)
+            return false;
+        for (ULONG j = 0; j < i; ++j)
+        {
+            if (Entries[j].InfoClass == Entries[i].InfoClass)
+                return false;
+        }
+    }
+    return true;
+}
+
+template<typename TEntry, ULONG NumEntries>
+static const TEntry* LookupInfoClass(const TEntry (&Entries)[NumEntries], UCHAR (&Index)[INFO_CLASS_INDEX_SIZE], volatile LONG& IndexBuilt, ULONG InfoClass)
+{
+    static_assert(NumEntries < 0xFF, "Info class table too large for a UCHAR index");
+
+    if (IndexBuilt == 0)
+    {
+        // Racing threads write identical values, so this does not need a lock
+        for (ULONG i = 0; i < NumEntries; ++i)
+        {
+            if ((ULONG)Entries[i].InfoClass < INFO_CLASS_INDEX_SIZE)
+                Index[(ULONG)Entries[i].InfoClass] = (UCHAR)(i + 1);
+        }
+        IndexBuilt = 1;
+    }
+
+    return InfoClass < INFO_CLASS_INDEX_SIZE && Index[InfoClass] != 0 ? &Entries[Index[InfoClass] - 1] : nullptr;
+}
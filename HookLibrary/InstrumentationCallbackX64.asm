@@ -1,12 +1,18 @@
 include ksamd64.inc
 
 extern InstrumentationCallback:near
+extern InstrumentationCallbackRangeStart:qword
+extern InstrumentationCallbackRangeEnd:qword
 
 .code
 InstrumentationCallbackAsm proc
 
 	cmp eax, 0			; STATUS_SUCCESS
 	jne ReturnToCaller
+	cmp r10, InstrumentationCallbackRangeStart	; Only returns into the range of interest need the C callback
+	jb ReturnToCaller
+	cmp r10, InstrumentationCallbackRangeEnd
+	jae ReturnToCaller
 
 	push rax ; return value
 	push rcx
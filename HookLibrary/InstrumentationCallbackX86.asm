@@ -2,12 +2,18 @@ include CallConv.inc
 .model flat
 
 extern _InstrumentationCallback@8:near
+extern _InstrumentationCallbackRangeStart:dword
+extern _InstrumentationCallbackRangeEnd:dword
 
 .code
 _InstrumentationCallbackAsm proc
 
 	cmp eax, 0			; STATUS_SUCCESS
 	jne ReturnToCaller
+	cmp ecx, _InstrumentationCallbackRangeStart	; Only returns into the range of interest need the C callback
+	jb ReturnToCaller
+	cmp ecx, _InstrumentationCallbackRangeEnd
+	jae ReturnToCaller
 
 	pushad
 
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <ntdll/ntdll.h>
+
+// Caches the PID of a process found by name in a process snapshot, such as the explorer PID FakeCurrentParentProcessId
+// reports. The process found is kept open: that keeps its PID from being reused, so as long as the process has not
+// exited the PID is still the right one, and validating it costs a single ProcessTimes query.
+//
+// The process functions are callbacks, so UnitTests can run the cache on a fake process table
+
+typedef struct _PROCESS_ID_CACHE_OPS
+{
+	DWORD (*FindByName)(void* Context, PLARGE_INTEGER CreateTime);     // Takes a snapshot, 0 if the process is not running
+	NTSTATUS (*Open)(void* Context, DWORD Pid, PHANDLE Process);        // STATUS_INVALID_CID if the PID is not in use
+	NTSTATUS (*QueryTimes)(void* Context, HANDLE Process, PKERNEL_USER_TIMES Times);
+	void (*Close)(void* Context, HANDLE Process);
+	ULONG (*TickCount)(void* Context);
+} PROCESS_ID_CACHE_OPS;
+
+typedef struct _PROCESS_ID_CACHE
+{
+	HANDLE Process;
+	DWORD Pid;
+	ULONG LookupTick;   // Time of the last snapshot if it did not give us a handle, 0 if it did
+	volatile LONG Busy;
+} PROCESS_ID_CACHE;
+
+#define PROCESS_ID_CACHE_INTERVAL 1000 // ms
+
+// Opens the process with this PID if it is still the one that was created at CreateTime. Sets *Gone if it is not, and
+// leaves it false if the process exists but cannot be opened.
+// A PID can only be reused after its process has exited, and the new process always has a later creation time,
+// so matching the creation time also proves that the image is the same one we found by name
+inline HANDLE OpenProcessIfCurrent(const PROCESS_ID_CACHE_OPS* Ops, void* Context, DWORD Pid, const LARGE_INTEGER& CreateTime, bool* Gone)
+{
+	*Gone = false;
+	HANDLE Process = nullptr;
+	const NTSTATUS Status = Ops->Open(Context, Pid, &Process);
+	if (!NT_SUCCESS(Status))
+	{
+		*Gone = Status == STATUS_INVALID_CID;
+		return nullptr;
+	}
+
+	KERNEL_USER_TIMES Times;
+	if (NT_SUCCESS(Ops->QueryTimes(Context, Process, &Times)) && Times.ExitTime.QuadPart == 0 && Times.CreateTime.QuadPart == CreateTime.QuadPart)
+		return Process;
+
+	*Gone = true;
+	Ops->Close(Context, Process);
+	return nullptr;
+}
+
+inline DWORD ProcessIdCacheLookup(PROCESS_ID_CACHE* Cache, const PROCESS_ID_CACHE_OPS* Ops, void* Context)
+{
+	KERNEL_USER_TIMES Times;
+	const HANDLE Process = Cache->Process;
+	if (Process != nullptr)
+	{
+		if (NT_SUCCESS(Ops->QueryTimes(Context, Process, &Times)) && Times.ExitTime.QuadPart == 0)
+			return Cache->Pid;
+	}
+	else if (Cache->LookupTick != 0 && Ops->TickCount(Context) - Cache->LookupTick < PROCESS_ID_CACHE_INTERVAL)
+	{
+		// The process is not running or could not be opened. Reuse that result for a while instead of taking a
+		// process snapshot on every call
+		return Cache->Pid;
+	}
+
+	// The process exited, or the interval is over. Only one thread takes the new snapshot
+	if (_InterlockedCompareExchange(&Cache->Busy, 1, 0) != 0)
+		return Cache->Pid;
+
+	if (Cache->Process != nullptr)
+	{
+		Ops->Close(Context, Cache->Process);
+		Cache->Process = nullptr;
+	}
+
+	LARGE_INTEGER CreateTime = { 0 };
+	DWORD Pid = Ops->FindByName(Context, &CreateTime);
+	bool Gone = false;
+	const HANDLE NewProcess = Pid != 0 ? OpenProcessIfCurrent(Ops, Context, Pid, CreateTime, &Gone) : nullptr;
+
+	// A process that exited between the snapshot and the open is not reported, its PID may already be someone else's.
+	// One that cannot be opened (another session, a protected process) is reported unvalidated
+	if (Gone)
+		Pid = 0;
+
+	Cache->Pid = Pid;
+	Cache->Process = NewProcess;
+	Cache->LookupTick = NewProcess == nullptr ? Ops->TickCount(Context) | 1 : 0; // 0 means no negative cache entry
+	_InterlockedExchange(&Cache->Busy, 0);
+	return Pid;
+}
@@ -18,21 +18,65 @@ static constexpr LONG_PTR TebPadding = ((-1 * TebPaddingFromEnd) + static_cast<L
 static_assert(TebPadding == -3652, "You touched ntdll.h didn't you?");
 #endif
 
-// To create a TLS variable, declare it here
+// Start and size of the region reserved for TLS variables
+static constexpr ULONG_PTR TlsRegionOffset = static_cast<ULONG_PTR>(static_cast<LONG_PTR>(sizeof(TEB)) + TebPadding);
+#ifdef _WIN64
+static constexpr ULONG_PTR TlsRegionSize = TebAllocationSize - TlsRegionOffset;
+#else
+static constexpr ULONG_PTR TlsRegionSize = FIELD_OFFSET(TEB, TxFsContext) - TlsRegionOffset; // Whatever is left of SpareBytes after alignment
+static_assert(TlsRegionOffset >= FIELD_OFFSET(TEB, SpareBytes), "TLS region starts before TEB SpareBytes");
+#endif
+
+struct _SAVE_DEBUG_REGISTERS;
+
+// To create a TLS variable, declare it here and give it a type with DECLARE_TLS_VARIABLE below
 enum class TlsVariable : ULONG_PTR
 {
-	InstrumentationCallbackDisabled, // The only TLS variable we currently actually use...
+	InstrumentationCallbackDisabled, // Recursion guard of InstrumentationCallback
+	DebugRegisters, // This thread's most recent entry in ArrayDebugRegister, if any
 	MaxTlsVariable // Must be last
 };
 
+template<TlsVariable Variable>
+struct TlsVariableTraits; // Not defined for undeclared variables, so forgetting DECLARE_TLS_VARIABLE is a compile error
+
+#define DECLARE_TLS_VARIABLE(Variable, VariableType) \
+	template<> \
+	struct TlsVariableTraits<TlsVariable::Variable> \
+	{ \
+		typedef VariableType Type; \
+		constexpr static ULONG_PTR Size = ALIGN_UP(sizeof(VariableType), PVOID); \
+	}
+
+DECLARE_TLS_VARIABLE(InstrumentationCallbackDisabled, LONG);
+DECLARE_TLS_VARIABLE(DebugRegisters, _SAVE_DEBUG_REGISTERS*);
+
+// Variables are laid out in declaration order, each one pointer-aligned and taking as many pointer-sized slots as its type needs
 template<TlsVariable Variable>
 struct TebOffset
 {
-	constexpr static ULONG_PTR Value = (static_cast<LONG_PTR>(sizeof(TEB)) + TebPadding) + (static_cast<ULONG_PTR>(Variable) * alignof(PVOID));
+	constexpr static TlsVariable Previous = static_cast<TlsVariable>(static_cast<ULONG_PTR>(Variable) - 1);
+	constexpr static ULONG_PTR Value = TebOffset<Previous>::Value + TlsVariableTraits<Previous>::Size;
+};
+
+template<>
+struct TebOffset<static_cast<TlsVariable>(0)>
+{
+	constexpr static ULONG_PTR Value = TlsRegionOffset;
 };
 
-static_assert(TebOffset<TlsVariable::MaxTlsVariable>::Value <= TebAllocationSize - sizeof(PVOID), "TLS variable offsets exceed TEB allocation size");
-static_assert(static_cast<ULONG_PTR>(TlsVariable::MaxTlsVariable) - 1 <= 5, "All out of TEB SpareBytes, find some new field to abuse"); // Only really applies to x86, but check on both
+static_assert(TlsRegionOffset % alignof(PVOID) == 0, "TLS region is not pointer-aligned");
+static_assert(TebOffset<TlsVariable::MaxTlsVariable>::Value <= TebAllocationSize, "TLS variable offsets exceed TEB allocation size");
+static_assert(TebOffset<TlsVariable::MaxTlsVariable>::Value - TlsRegionOffset <= TlsRegionSize, "All out of TEB SpareBytes, find some new field to abuse"); // Only really applies to x86, but check on both
+
+template<TlsVariable Variable>
+FORCEINLINE
+volatile typename TlsVariableTraits<Variable>::Type*
+TlsGet(
+	)
+{
+	return reinterpret_cast<volatile typename TlsVariableTraits<Variable>::Type*>(reinterpret_cast<ULONG_PTR>(NtCurrentTeb()) + TebOffset<Variable>::Value);
+}
 
 FORCEINLINE
 volatile
@@ -40,5 +84,36 @@ LONG*
 TlsGetInstrumentationCallbackDisabled(
 	)
 {
-	return reinterpret_cast<volatile LONG*>(reinterpret_cast<ULONG_PTR>(NtCurrentTeb()) + TebOffset<TlsVariable::InstrumentationCallbackDisabled>::Value);
+	return TlsGet<TlsVariable::InstrumentationCallbackDisabled>();
+}
+
+// The part of the region taken by the variables
+static constexpr ULONG_PTR TlsRegionUsed = TebOffset<TlsVariable::MaxTlsVariable>::Value - TlsRegionOffset;
+
+// The layout above is only checked against the ntdll.h TEB at compile time. This checks once, on first use, that the
+// running OS build leaves the region alone: spare TEB memory is zeroed when a thread is created and never written by
+// the OS, so anything else means this build uses it. Callers must not touch TLS variables if it returns false
+bool TlsIsRegionUsable();
+
+// TlsIsRegionUsable with its state and the TEB passed in, so UnitTests can run it on fake TEBs.
+// State: 0 = not checked, 1 = checking, 2 = usable, 3 = not usable
+inline bool TlsCheckRegion(volatile LONG* State, const TEB* Teb, USHORT OSBuildNumber)
+{
+	const LONG Current = *State;
+	if (Current >= 2)
+		return Current == 2;
+	if (_InterlockedCompareExchange(State, 1, 0) != 0)
+		return false; // Another thread is checking, leave TLS alone until it is done
+
+	// The x86 region is part of SpareBytes (SpareBytes1 on XP) on every build from XP on. On x64 it is past the end of the TEB
+	bool Usable = OSBuildNumber >= 2600;
+	const UCHAR* Region = reinterpret_cast<const UCHAR*>(Teb) + TlsRegionOffset;
+	for (ULONG_PTR i = 0; Usable && i < TlsRegionUsed; ++i)
+	{
+		if (Region[i] != 0)
+			Usable = false;
+	}
+
+	_InterlockedExchange(State, Usable ? 2 : 3);
+	return Usable;
 }
@@ -1,3 +1,4 @@
+#include <Scylla/HookPlanCache.h>
 #include <Scylla/Logger.h>
 #include <Scylla/OsInfo.h>
 #include <Scylla/PebHider.h>
@@ -5,16 +6,18 @@
 
 #include "ApplyHooking.h"
 #include "DynamicMapping.h"
+#include "HookPlan.h"
 #include "RemoteHook.h"
 
 #define STR(x) #x
+#define PLAN(name) GetPlanEntry(plan, planModule, STR(name), (void*)_##name)
 #define HOOK(name) { \
-    hdd->d##name = (t_##name)DetourCreateRemote(hProcess, "" STR(name) "", (void*)_##name, Hooked##name, true, &hdd->name##BackupSize); \
+    hdd->d##name = (t_##name)DetourCreateRemote(hProcess, "" STR(name) "", (void*)_##name, Hooked##name, true, &hdd->name##BackupSize, PLAN(name)); \
     if (hdd->d##name == nullptr) { return false; } }
 #define HOOK_NATIVE(name) { \
-    hdd->d##name = (t_##name)DetourCreateRemoteNative(hProcess, "" STR(name) "", (void*)_##name, Hooked##name, true, &hdd->name##BackupSize); \
+    hdd->d##name = (t_##name)DetourCreateRemoteNative(hProcess, "" STR(name) "", (void*)_##name, Hooked##name, true, &hdd->name##BackupSize, PLAN(name)); \
     if (hdd->d##name == nullptr) { return false; } }
-#define HOOK_NATIVE_NOTRAMP(name) DetourCreateRemoteNative(hProcess, "" STR(name) "", (void*)_##name, Hooked##name, false, &hdd->name##BackupSize)
+#define HOOK_NATIVE_NOTRAMP(name) DetourCreateRemoteNative(hProcess, "" STR(name) "", (void*)_##name, Hooked##name, false, &hdd->name##BackupSize, PLAN(name))
 #define FREE_HOOK(name) FreeMemory(hProcess, (void*)hdd->d##name); hdd->d##name = 0
 #define RESTORE_JMP(name) RestoreJumper(hProcess, (void*)_##name, (void*)hdd->d##name, hdd->name##BackupSize)
 
@@ -64,6 +67,7 @@ t_NtSetContextThread _NtSetContextThread = 0;
 t_NtContinue _NtContinue = 0;
 t_NtClose _NtClose = 0;
 t_NtDuplicateObject _NtDuplicateObject = 0;
+t_NtSetInformationObject _NtSetInformationObject = 0;
 t_NtSetDebugFilterState _NtSetDebugFilterState = 0;
 t_NtCreateThread _NtCreateThread = 0;
 t_NtCreateThreadEx _NtCreateThreadEx = 0;
@@ -74,6 +78,132 @@ t_NtOpenFile _NtOpenFile = 0;
 t_NtCreateSection _NtCreateSection = 0;
 t_NtMapViewOfSection _NtMapViewOfSection = 0;
 
+// Plans for other combinations of settings are dropped once a DLL has this many
+const size_t maxHookPlansPerImage = 6;
+
+// The hook plan of requests in module: from scylla_hide_hooks.ini if it was compiled for this build of the DLL and these
+// settings before, otherwise compiled now from the image mapped in this process and stored. System DLLs are mapped at the
+// same address in every process, and DetourCreateRemote checks each entry against the debuggee's bytes anyway
+static void GetHookPlan(HMODULE module, const std::vector<HookPlanRequest>& requests, HookPlan& plan)
+{
+    plan.Entries.clear();
+
+    scl::HookPlanCache cache;
+    if (module == nullptr || requests.empty() || !cache.Open(module))
+        return;
+
+    const PIMAGE_NT_HEADERS ntHeaders = RtlImageNtHeader(module);
+    const BYTE * image = (const BYTE *)module;
+    const SIZE_T imageSize = ntHeaders->OptionalHeader.SizeOfImage;
+    const ULONGLONG settingsMask = GetHookPlanMask(requests);
+    const std::string key = GetHookPlanKey(settingsMask);
+
+    std::string text;
+    if (cache.Lookup(key, &text) && ParseHookPlan(text, plan) && plan.SettingsMask == settingsMask && CheckHookPlan(plan, image, imageSize))
+        return;
+
+    if (!CompileHookPlan(image, imageSize, requests, plan))
+    {
+        plan.Entries.clear();
+        return;
+    }
+
+    g_log.LogDebug(L"GetHookPlan -> Compiled %hs for %u of %u hooks", key.c_str(), (ULONG)plan.Entries.size(), (ULONG)requests.size());
+    cache.Trim("Plan_", maxHookPlansPerImage);
+    cache.Store(key, FormatHookPlan(plan));
+    cache.Save();
+}
+
+// The plan of a hook, if the function was planned at the address it is hooked at
+static const HookPlanEntry * GetPlanEntry(const HookPlan& plan, HMODULE module, const char* name, const void* address)
+{
+    const HookPlanEntry * entry = FindHookPlanEntry(plan, name);
+    return entry != nullptr && (ULONG_PTR)module + entry->Rva == (ULONG_PTR)address ? entry : nullptr;
+}
+
+// The functions ApplyNtdllHook hooks with the settings in hdd
+static std::vector<HookPlanRequest> GetNtdllHookRequests(const HOOK_DLL_DATA * hdd)
+{
+    std::vector<HookPlanRequest> requests;
+    const auto add = [&requests](bool enabled, const char* name)
+    {
+        if (enabled)
+            requests.push_back({ name, 0, false });
+    };
+
+    add(hdd->EnableNtSetInformationThreadHook == TRUE, "NtSetInformationThread");
+    add(hdd->EnableNtQuerySystemInformationHook == TRUE, "NtQuerySystemInformation");
+    add(hdd->EnableNtQueryInformationProcessHook == TRUE, "NtQueryInformationProcess");
+    add(hdd->EnableNtSetInformationProcessHook == TRUE, "NtSetInformationProcess");
+    add(hdd->EnableNtQueryObjectHook == TRUE, "NtQueryObject");
+    add(hdd->EnableNtYieldExecutionHook == TRUE, "NtYieldExecution");
+    add(hdd->EnableNtGetContextThreadHook == TRUE, "NtGetContextThread");
+    add(hdd->EnableNtSetContextThreadHook == TRUE, "NtSetContextThread");
+    add(hdd->EnableNtCloseHook == TRUE, "NtClose");
+    add(hdd->EnableNtCloseHook == TRUE, "NtDuplicateObject");
+    add(hdd->EnableNtCloseHook == TRUE, "NtSetInformationObject");
+    add(hdd->EnablePreventThreadCreation == TRUE, "NtCreateThread");
+    add(hdd->EnablePreventThreadCreation == TRUE || hdd->EnableNtCreateThreadExHook == TRUE, "NtCreateThreadEx");
+    add(hdd->EnableNtSetDebugFilterStateHook == TRUE, "NtSetDebugFilterState");
+#ifndef _WIN64
+    add(hdd->EnableKiUserExceptionDispatcherHook == TRUE, "KiUserExceptionDispatcher"); // Patched by hand on x64
+#endif
+    add(hdd->EnableNtContinueHook == TRUE, "NtContinue");
+    add(hdd->EnableNtQueryPerformanceCounterHook == TRUE, "NtQueryPerformanceCounter");
+    add(hdd->EnableMalwareRunPeUnpacker == TRUE, "NtResumeThread");
+    add(hdd->EnablePebOsBuildNumber == TRUE, "NtOpenFile");
+    add(hdd->EnablePebOsBuildNumber == TRUE, "NtCreateSection");
+    add(hdd->EnablePebOsBuildNumber == TRUE, "NtMapViewOfSection");
+
+#ifdef _WIN64
+    // NtQuerySystemTime is a jmp to RtlQuerySystemTime, which is hooked instead
+    const bool followJmp = true;
+#else
+    const bool followJmp = false;
+#endif
+    if (hdd->EnableNtQuerySystemTimeHook == TRUE)
+        requests.push_back({ "NtQuerySystemTime", 0, followJmp });
+
+    return requests;
+}
+
+// The functions ApplyKernel32Hook hooks with the settings in hdd
+static std::vector<HookPlanRequest> GetKernel32HookRequests(const HOOK_DLL_DATA * hdd)
+{
+    std::vector<HookPlanRequest> requests;
+    const auto add = [&requests](bool enabled, const char* name)
+    {
+        if (enabled)
+            requests.push_back({ name, 0, false });
+    };
+
+    add(hdd->EnableGetTickCountHook == TRUE, "GetTickCount");
+    add(hdd->EnableGetTickCount64Hook == TRUE, "GetTickCount64");
+    add(hdd->EnableGetLocalTimeHook == TRUE, "GetLocalTime");
+    add(hdd->EnableGetSystemTimeHook == TRUE, "GetSystemTime");
+    add(hdd->EnableOutputDebugStringHook == TRUE, "OutputDebugStringA");
+    return requests;
+}
+
+// The win32k stubs ApplyUserHook hooks with the settings in hdd, by their RVA in module. They are not all exported by
+// user32, User32Loader found them
+static std::vector<HookPlanRequest> GetUserHookRequests(const HOOK_DLL_DATA * hdd, HMODULE module)
+{
+    std::vector<HookPlanRequest> requests;
+    const auto add = [&requests, module](bool enabled, const char* name, ULONG_PTR va)
+    {
+        if (enabled && va > (ULONG_PTR)module)
+            requests.push_back({ name, (DWORD)(va - (ULONG_PTR)module), false });
+    };
+
+    add(hdd->EnableNtUserBlockInputHook != FALSE, "NtUserBlockInput", hdd->NtUserBlockInputVA);
+    add(hdd->EnableNtUserFindWindowExHook != FALSE, "NtUserFindWindowEx", hdd->NtUserFindWindowExVA);
+    add(hdd->EnableNtUserBuildHwndListHook != FALSE, "NtUserBuildHwndList", hdd->NtUserBuildHwndListVA);
+    add(hdd->EnableNtUserQueryWindowHook != FALSE, "NtUserQueryWindow", hdd->NtUserQueryWindowVA);
+    add(hdd->EnableNtUserGetForegroundWindowHook != FALSE, "NtUserGetForegroundWindow", hdd->NtUserGetForegroundWindowVA);
+    return requests;
+}
+
 bool ApplyNtdllHook(HOOK_DLL_DATA * hdd, HANDLE hProcess, BYTE * dllMemory, DWORD_PTR imageBase)
 {
     hNtdll = GetModuleHandleW(L"ntdll.dll");
@@ -96,6 +226,7 @@ bool ApplyNtdllHook(HOOK_DLL_DATA * hdd, HANDLE hProcess, BYTE * dllMemory, DWOR
     void * HookedNtContinue = (void *)(GetDllFunctionAddressRVA(dllMemory, "HookedNtContinue") + imageBase);
     void * HookedNtClose = (void *)(GetDllFunctionAddressRVA(dllMemory, "HookedNtClose") + imageBase);
     void * HookedNtDuplicateObject = (void *)(GetDllFunctionAddressRVA(dllMemory, "HookedNtDuplicateObject") + imageBase);
+    void * HookedNtSetInformationObject = (void *)(GetDllFunctionAddressRVA(dllMemory, "HookedNtSetInformationObject") + imageBase);
     void * HookedNtSetDebugFilterState = (void *)(GetDllFunctionAddressRVA(dllMemory, "HookedNtSetDebugFilterState") + imageBase);
     void * HookedNtCreateThread = (void *)(GetDllFunctionAddressRVA(dllMemory, "HookedNtCreateThread") + imageBase);
     void * HookedNtCreateThreadEx = (void *)(GetDllFunctionAddressRVA(dllMemory, "HookedNtCreateThreadEx") + imageBase);
@@ -120,6 +251,7 @@ bool ApplyNtdllHook(HOOK_DLL_DATA * hdd, HANDLE hProcess, BYTE * dllMemory, DWOR
     _NtContinue = (t_NtContinue)GetProcAddress(hNtdll, "NtContinue");
     _NtClose = (t_NtClose)GetProcAddress(hNtdll, "NtClose");
     _NtDuplicateObject = (t_NtDuplicateObject)GetProcAddress(hNtdll, "NtDuplicateObject");
+    _NtSetInformationObject = (t_NtSetInformationObject)GetProcAddress(hNtdll, "NtSetInformationObject");
     _NtSetDebugFilterState = (t_NtSetDebugFilterState)GetProcAddress(hNtdll, "NtSetDebugFilterState");
     _NtCreateThread = (t_NtCreateThread)GetProcAddress(hNtdll, "NtCreateThread");
     _NtCreateThreadEx = (t_NtCreateThreadEx)GetProcAddress(hNtdll, "NtCreateThreadEx");
@@ -142,9 +274,10 @@ bool ApplyNtdllHook(HOOK_DLL_DATA * hdd, HANDLE hProcess, BYTE * dllMemory, DWOR
         _NtSetContextThread,
         _KiUserExceptionDispatcher,
         _NtContinue);
-    g_log.LogDebug(L"ApplyNtdllHook -> _NtClose %p _NtDuplicateObject %p _NtSetDebugFilterState %p _NtCreateThread %p _NtCreateThreadEx %p _NtQuerySystemTime %p _NtQueryPerformanceCounter %p _NtResumeThread %p",
+    g_log.LogDebug(L"ApplyNtdllHook -> _NtClose %p _NtDuplicateObject %p _NtSetInformationObject %p _NtSetDebugFilterState %p _NtCreateThread %p _NtCreateThreadEx %p _NtQuerySystemTime %p _NtQueryPerformanceCounter %p _NtResumeThread %p",
         _NtClose,
         _NtDuplicateObject,
+        _NtSetInformationObject,
         _NtSetDebugFilterState,
         _NtCreateThread,
         _NtCreateThreadEx,
@@ -156,6 +289,10 @@ bool ApplyNtdllHook(HOOK_DLL_DATA * hdd, HANDLE hProcess, BYTE * dllMemory, DWOR
         _NtCreateSection,
         _NtMapViewOfSection);
 
+    const HMODULE planModule = hNtdll;
+    HookPlan plan;
+    GetHookPlan(planModule, GetNtdllHookRequests(hdd), plan);
+
     if (hdd->EnableNtSetInformationThreadHook == TRUE)
     {
         g_log.LogDebug(L"ApplyNtdllHook -> Hooking NtSetInformationThread");
@@ -204,6 +341,8 @@ bool ApplyNtdllHook(HOOK_DLL_DATA * hdd, HANDLE hProcess, BYTE * dllMemory, DWOR
         HOOK_NATIVE(NtClose);
         g_log.LogDebug(L"ApplyNtdllHook -> Hooking NtDuplicateObject");
         HOOK_NATIVE(NtDuplicateObject);
+        g_log.LogDebug(L"ApplyNtdllHook -> Hooking NtSetInformationObject");
+        HOOK_NATIVE(NtSetInformationObject);
     }
     if (hdd->EnablePreventThreadCreation == TRUE)
     {
@@ -387,6 +526,10 @@ bool ApplyKernel32Hook(HOOK_DLL_DATA * hdd, HANDLE hProcess, BYTE * dllMemory, D
         _GetSystemTime,
         _OutputDebugStringA);
 
+    const HMODULE planModule = hCurrent;
+    HookPlan plan;
+    GetHookPlan(planModule, GetKernel32HookRequests(hdd), plan);
+
     if (hdd->EnableGetTickCountHook == TRUE)
     {
         g_log.LogDebug(L"ApplyKernel32Hook -> Hooking GetTickCount");
@@ -459,6 +602,13 @@ bool ApplyUserHook(HOOK_DLL_DATA * hdd, HANDLE hProcess, BYTE * dllMemory, DWORD
         _NtUserQueryWindow,
         _NtUserGetForegroundWindow);
 
+    // Only if the DLL User32Loader found the stubs in is still loaded here, e.g. by the debugger's own GUI
+    HMODULE planModule = nullptr;
+    GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+        (LPCWSTR)hdd->NtUserBlockInputVA, &planModule);
+    HookPlan plan;
+    GetHookPlan(planModule, GetUserHookRequests(hdd, planModule), plan);
+
     if (hdd->EnableNtUserBlockInputHook)
     {
         g_log.LogDebug(L"ApplyUserHook -> Hooking NtUserBlockInput");
@@ -475,7 +625,7 @@ bool ApplyUserHook(HOOK_DLL_DATA * hdd, HANDLE hProcess, BYTE * dllMemory, DWORD
         //HOOK_NATIVE(NtUserBuildHwndList); // Not possible here because Windows >= 8 uses a different function export
         hdd->dNtUserBuildHwndList = (t_NtUserBuildHwndList)DetourCreateRemoteNative(hProcess, "NtUserBuildHwndList", (PVOID)_NtUserBuildHwndList,
             (scl::GetWindowsVersion() <= scl::OS_WIN_7 ? HookedNtUserBuildHwndList : HookedNtUserBuildHwndList_Eight),
-            true, &hdd->NtUserBuildHwndListBackupSize);
+            true, &hdd->NtUserBuildHwndListBackupSize, PLAN(NtUserBuildHwndList));
         if (hdd->dNtUserBuildHwndList == nullptr)
             return false;
     }
@@ -593,12 +743,21 @@ void RestoreJumper(HANDLE hProcess, void* address, void * backupAddress, DWORD b
 {
     if (address && backupAddress && backupSize)
     {
-        void * backup = malloc(backupSize);
-        if (backup)
+        // DetourCreateRemote keeps the original bytes at the start of the allocation, in front of the (relocated) trampoline
+        MEMORY_BASIC_INFORMATION mbi;
+        if (VirtualQueryEx(hProcess, backupAddress, &mbi, sizeof(mbi)) && mbi.AllocationBase != nullptr)
+            backupAddress = mbi.AllocationBase;
+
+        // A hot patch also has the padding in front of the function backed up. The entry goes first, after that the padding is unreachable
+        const DWORD size = BACKUP_SIZE_TOTAL(backupSize);
+        const DWORD preceding = BACKUP_SIZE_PRECEDING(backupSize);
+        BYTE * backup = (BYTE *)malloc(size);
+        if (backup && preceding < size)
         {
-            if (ReadProcessMemory(hProcess, backupAddress, backup, backupSize, 0))
+            if (ReadProcessMemory(hProcess, backupAddress, backup, size, 0))
             {
-                RestoreMemory(hProcess, (DWORD_PTR)address, backup, backupSize);
+                RestoreMemory(hProcess, (DWORD_PTR)address, backup + preceding, size - preceding);
+                RestoreMemory(hProcess, (DWORD_PTR)address - preceding, backup, preceding);
             }
 
             free(backup);
@@ -610,6 +769,11 @@ void FreeMemory(HANDLE hProcess, void * buffer)
 {
     if (hProcess && buffer)
     {
+        // Trampolines do not start at the beginning of their allocation
+        MEMORY_BASIC_INFORMATION mbi;
+        if (VirtualQueryEx(hProcess, buffer, &mbi, sizeof(mbi)) && mbi.AllocationBase != nullptr)
+            buffer = mbi.AllocationBase;
+
         VirtualFreeEx(hProcess, buffer, 0, MEM_RELEASE);
     }
 }
@@ -631,6 +795,7 @@ void RestoreNtdllHooks(HOOK_DLL_DATA * hdd, HANDLE hProcess)
         {
             RESTORE_JMP(NtClose);
             RESTORE_JMP(NtDuplicateObject);
+            RESTORE_JMP(NtSetInformationObject);
             RESTORE_JMP(NtContinue);
             RESTORE_JMP(NtCreateThreadEx);
             RESTORE_JMP(NtCreateThread);
@@ -650,6 +815,7 @@ void RestoreNtdllHooks(HOOK_DLL_DATA * hdd, HANDLE hProcess)
 #else
     RESTORE_JMP(NtClose);
     RESTORE_JMP(NtDuplicateObject);
+    RESTORE_JMP(NtSetInformationObject);
     RESTORE_JMP(NtContinue);
     RESTORE_JMP(NtCreateThreadEx);
     RESTORE_JMP(NtCreateThread);
@@ -668,6 +834,7 @@ void RestoreNtdllHooks(HOOK_DLL_DATA * hdd, HANDLE hProcess)
 
     FREE_HOOK(NtClose);
     FREE_HOOK(NtDuplicateObject);
+    FREE_HOOK(NtSetInformationObject);
     FREE_HOOK(NtContinue);
     FREE_HOOK(NtCreateThreadEx);
     FREE_HOOK(NtCreateThread);
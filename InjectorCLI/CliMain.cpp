@@ -316,6 +316,8 @@ void ReadSettings()
     g_hdd.EnablePebOsBuildNumber = g_settings.opts().fixPebOsBuildNumber;
     g_hdd.EnablePreventThreadCreation = g_settings.opts().preventThreadCreation;
     g_hdd.EnableProtectProcessId = g_settings.opts().protectProcessId;
+    wcsncpy_s(g_hdd.ProtectedProcessNames, g_settings.opts().protectedProcessNames.c_str(), _TRUNCATE);
+    wcsncpy_s(g_hdd.HiddenObjectTypes, g_settings.opts().hiddenObjectTypes.c_str(), _TRUNCATE);
 }
 
 bool convertNumber(const wchar_t* str, unsigned long & result, int radix)
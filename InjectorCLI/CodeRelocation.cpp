@@ -0,0 +1,268 @@
+#include "CodeRelocation.h"
+#include "LengthDisasm.h"
+#include <distorm/distorm.h>
+#include <string.h>
+
+bool IsRel32Reachable(ULONG_PTR from, ULONG_PTR to, bool x64)
+{
+    if (!x64)
+        return true;
+
+    const LONG_PTR delta = (LONG_PTR)(to - from);
+    return delta >= MINLONG && delta <= MAXLONG;
+}
+
+int WriteBranch(BYTE * buf, ULONG_PTR ip, ULONG_PTR target, RelocatedBranchType type, BYTE condition, bool x64)
+{
+    int len = 0;
+    const int rel32Len = type == BranchJcc ? 6 : 5;
+    if (IsRel32Reachable(ip + rel32Len, target, x64))
+    {
+        if (type == BranchJcc)
+        {
+            buf[len++] = 0x0F;
+            buf[len++] = (BYTE)(0x80 | condition);
+        }
+        else
+        {
+            buf[len++] = type == BranchCall ? 0xE8 : 0xE9;
+        }
+        *(LONG*)&buf[len] = (LONG)(target - (ip + rel32Len));
+        return len + sizeof(LONG);
+    }
+
+    if (type == BranchJcc)
+    {
+        // Inverted jcc over the absolute jmp
+        buf[len++] = (BYTE)(0x70 | (condition ^ 1));
+        buf[len++] = 6 + sizeof(DWORD64);
+    }
+
+    if (type == BranchCall)
+    {
+        // call [rip+2]; jmp over the address
+        buf[len++] = 0xFF; buf[len++] = 0x15;
+        *(DWORD*)&buf[len] = 2;
+        len += sizeof(DWORD);
+        buf[len++] = 0xEB; buf[len++] = sizeof(DWORD64);
+    }
+    else
+    {
+        // jmp [rip]
+        buf[len++] = 0xFF; buf[len++] = 0x25;
+        *(DWORD*)&buf[len] = 0;
+        len += sizeof(DWORD);
+    }
+    *(DWORD64*)&buf[len] = target;
+    return len + sizeof(DWORD64);
+}
+
+// Decodes the instruction at code with distorm, for what the length decoder does not know
+static bool DecomposeInstruction(const BYTE * code, int codeLen, bool x64, _DInst * result)
+{
+    unsigned int DecodedInstructionsCount = 0;
+    _CodeInfo decomposerCi = {};
+
+    decomposerCi.code = code;
+    decomposerCi.codeLen = codeLen;
+    decomposerCi.dt = x64 ? Decode64Bits : Decode32Bits;
+    decomposerCi.codeOffset = (LONG_PTR)code;
+
+    return distorm_decompose(&decomposerCi, result, 1, &DecodedInstructionsCount) != DECRES_INPUTERR &&
+        DecodedInstructionsCount != 0 && result->flags != FLAG_NOT_DECODABLE;
+}
+
+int GetCopyableInstructionLength(const BYTE * code, int codeLen, bool x64)
+{
+    _DInst decomposerResult = {};
+    if (!DecomposeInstruction(code, codeLen, x64, &decomposerResult) || (decomposerResult.flags & FLAG_RIP_RELATIVE) != 0)
+        return -1;
+
+    for (int i = 0; i < OPERANDS_NO; i++)
+    {
+        if (decomposerResult.ops[i].type == O_PC)
+            return -1;
+    }
+
+    return decomposerResult.size;
+}
+
+int RelocateCode(const BYTE * code, int codeLen, int length, ULONG_PTR oldAddress, ULONG_PTR newAddress, BYTE * out, int outSize, bool x64)
+{
+    int offset = 0;
+    int written = 0;
+    while (offset < length)
+    {
+        BYTE insnBytes[16];
+        int insnOut;
+        LDE_INSTRUCTION insn;
+        int len = LdeDecode(code + offset, codeLen - offset, x64, &insn);
+
+        if (len < 1)
+        {
+            len = GetCopyableInstructionLength(code + offset, codeLen - offset, x64);
+            if (len < 1 || offset + len > length)
+                return -1;
+
+            memcpy(insnBytes, code + offset, len);
+            insnOut = len;
+        }
+        else if (offset + len > length)
+        {
+            return -1;
+        }
+        else if (insn.Flags & LdeFlagRelative)
+        {
+            const BYTE * imm = code + offset + insn.ImmOffset;
+            const LONG_PTR rel = insn.ImmSize == 1 ? (LONG_PTR)*(const INT8*)imm : insn.ImmSize == 4 ? (LONG_PTR)*(const LONG*)imm : 0;
+            ULONG_PTR target = oldAddress + offset + len + rel;
+            if (!x64)
+                target = (DWORD)target;
+
+            // Branches into the copied bytes would need to be redirected into the trampoline
+            if (insn.ImmSize == 2 || (target >= oldAddress && target < oldAddress + length))
+                return -1;
+
+            if (insn.Map == LdeMap0F || (insn.Opcode >= 0x70 && insn.Opcode <= 0x7F))
+                insnOut = WriteBranch(insnBytes, newAddress + written, target, BranchJcc, insn.Opcode & 0x0F, x64);
+            else if (insn.Opcode == 0xE8)
+                insnOut = WriteBranch(insnBytes, newAddress + written, target, BranchCall, 0, x64);
+            else if (insn.Opcode == 0xE9 || insn.Opcode == 0xEB)
+                insnOut = WriteBranch(insnBytes, newAddress + written, target, BranchJmp, 0, x64);
+            else
+                return -1; // loop, jecxz
+        }
+        else
+        {
+            memcpy(insnBytes, code + offset, len);
+            insnOut = len;
+
+            if (insn.Flags & LdeFlagRipRelative)
+            {
+                const ULONG_PTR target = oldAddress + offset + len + *(const LONG*)(code + offset + insn.DispOffset);
+                const ULONG_PTR newNext = newAddress + written + len;
+                if (!IsRel32Reachable(newNext, target, x64))
+                    return -1;
+                *(LONG*)&insnBytes[insn.DispOffset] = (LONG)(target - newNext);
+            }
+        }
+
+        if (insnOut < 1 || written + insnOut > outSize)
+            return -1;
+
+        memcpy(out + written, insnBytes, insnOut);
+        written += insnOut;
+        offset += len;
+    }
+
+    return written;
+}
+
+bool IsPositionIndependentCode(const BYTE * code, int length, bool x64)
+{
+    for (int offset = 0; offset < length;)
+    {
+        LDE_INSTRUCTION insn;
+        int len = LdeDecode(code + offset, length - offset, x64, &insn);
+        if (len > 0 && (insn.Flags & (LdeFlagRelative | LdeFlagRipRelative)) != 0)
+            return false;
+        if (len < 1)
+            len = GetCopyableInstructionLength(code + offset, length - offset, x64);
+        if (len < 1)
+            return false;
+        offset += len;
+    }
+    return true;
+}
+
+int GetInstructionLength(const BYTE * code, int codeLen, bool x64)
+{
+    const int len = LdeDecode(code, codeLen, x64, nullptr);
+    if (len > 0)
+        return len;
+
+    _DInst decomposerResult = {};
+    return DecomposeInstruction(code, codeLen, x64, &decomposerResult) ? decomposerResult.size : -1;
+}
+
+// ret, retf, iret and the near and far jmps, after which the function does not go on
+static bool IsFunctionExit(const LDE_INSTRUCTION& insn)
+{
+    if (insn.Map != LdeMapOneByte)
+        return false;
+
+    switch (insn.Opcode)
+    {
+    case 0xC2: case 0xC3: case 0xCA: case 0xCB: case 0xCF:
+    case 0xE9: case 0xEA: case 0xEB:
+        return true;
+    case 0xFF:
+        return ((insn.ModRm >> 3) & 7) == 4 || ((insn.ModRm >> 3) & 7) == 5;
+    default:
+        return false;
+    }
+}
+
+HotPatchType ClassifyHotPatchPrologue(const BYTE * code, int precedingLen, int codeLen, bool x64, int jumpSize, HOT_PATCH_PROLOGUE * info)
+{
+    HOT_PATCH_PROLOGUE prologue = { HotPatchNone, 0, 0 };
+
+    // The short jmp must not cut an instruction in half, a thread could be suspended right behind it
+    const int len = LdeDecode(code, codeLen, x64, nullptr);
+    if (len < 2 || jumpSize < 2 || jumpSize + 2 > 0x80)
+        return HotPatchNone;
+
+    if (!x64)
+    {
+        // Functions built with /hotpatch, the padding is a run of the same int 3 or nop byte
+        const int padding = 5;
+        const BYTE fill = precedingLen >= padding ? code[-1] : 0;
+        if (len != 2 || code[0] != 0x8B || code[1] != 0xFF || (fill != 0xCC && fill != 0x90) || jumpSize > padding)
+            return HotPatchNone;
+        for (int i = 1; i <= padding; i++)
+        {
+            if (code[-i] != fill)
+                return HotPatchNone;
+        }
+
+        prologue.Type = HotPatchMovEdiEdi;
+        prologue.PaddingSize = (UCHAR)padding;
+    }
+    else
+    {
+        // The int 3 run in front of the entry, which can also hold the last bytes of an instruction
+        const BYTE * start = code - precedingLen;
+        int paddingStart = precedingLen;
+        while (paddingStart > 0 && start[paddingStart - 1] == 0xCC)
+            paddingStart--;
+        if (precedingLen - paddingStart < jumpSize)
+            return HotPatchNone;
+
+        // Walk the function in front up to the padding, the instruction that reaches it has to leave the function
+        int offset = 0;
+        bool exits = false;
+        while (offset < paddingStart)
+        {
+            LDE_INSTRUCTION insn;
+            int insnLen = LdeDecode(start + offset, precedingLen - offset, x64, &insn);
+            exits = insnLen > 0 && IsFunctionExit(insn);
+            if (insnLen < 1)
+                insnLen = GetInstructionLength(start + offset, precedingLen - offset, x64);
+            if (insnLen < 1)
+                return HotPatchNone;
+            offset += insnLen;
+        }
+
+        const int padding = precedingLen - offset;
+        if (!exits || padding < jumpSize)
+            return HotPatchNone;
+
+        prologue.Type = HotPatchPadding;
+        prologue.PaddingSize = (UCHAR)(padding < 0x7F ? padding : 0x7F);
+    }
+
+    prologue.EntrySize = (UCHAR)len;
+    if (info != nullptr)
+        *info = prologue;
+    return (HotPatchType)prologue.Type;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <windows.h>
+
+// Moving instructions to another address, for the trampolines of the detours. Nothing here touches memory other than
+// the buffers passed in, and the bitness is a parameter, so UnitTests can build trampolines for both x86 and x64 and
+// check them against the original code.
+
+enum RelocatedBranchType
+{
+    BranchJmp,
+    BranchCall,
+    BranchJcc
+};
+
+// Whether a rel32 at from (the address of the next instruction) reaches to. Always true on x86, where rel32 wraps around
+bool IsRel32Reachable(ULONG_PTR from, ULONG_PTR to, bool x64);
+
+// Writes a branch to target that will be executed at ip. Uses rel32 if possible and an absolute indirect form otherwise.
+// condition is the low nibble of the jcc opcode. Writes at most 16 bytes and returns the size
+int WriteBranch(BYTE * buf, ULONG_PTR ip, ULONG_PTR target, RelocatedBranchType type, BYTE condition, bool x64);
+
+// Returns the length of an instruction the length decoder does not know, or -1 if it can not be copied to another address as is
+int GetCopyableInstructionLength(const BYTE * code, int codeLen, bool x64);
+
+// Length of anything the length decoder or distorm decodes, for walking over code rather than copying it. -1 if neither does
+int GetInstructionLength(const BYTE * code, int codeLen, bool x64);
+
+// Copies the instructions in code[0, length), which are at oldAddress, to out so that they can be executed at newAddress.
+// RIP relative operands are adjusted and relative branches are rewritten to reach their original targets.
+// Returns the size written to out, or -1 if the code can not be relocated: branches back into the copied bytes,
+// loop/jecxz, rel16 branches and RIP relative operands out of range of newAddress.
+// codeLen is the size of the code buffer, length must end on an instruction
+int RelocateCode(const BYTE * code, int codeLen, int length, ULONG_PTR oldAddress, ULONG_PTR newAddress, BYTE * out, int outSize, bool x64);
+
+// True if code[0, length) can be copied to another address as is
+bool IsPositionIndependentCode(const BYTE * code, int length, bool x64);
+
+enum HotPatchType : UCHAR
+{
+    HotPatchNone,
+    HotPatchMovEdiEdi,      // mov edi, edi after 5 bytes of hot patch padding (/hotpatch, x86)
+    HotPatchPadding         // int 3 padding between the ret or jmp ending the function in front and the entry (x64)
+};
+
+typedef struct _HOT_PATCH_PROLOGUE
+{
+    UCHAR Type;             // HotPatchType
+    UCHAR PaddingSize;      // int 3 or nop bytes directly in front of the entry, at most 0x7F
+    UCHAR EntrySize;        // Length of the first instruction, which the 2 byte short jmp overwrites (part of)
+} HOT_PATCH_PROLOGUE;
+
+// Checks whether a function can be hooked with a 2 byte short jmp at its entry into a jmp of jumpSize bytes in the
+// padding in front of it. code points to the entry, with codeLen bytes from it.
+// x86: the entry must be mov edi, edi with 5 int 3 or nop bytes in front, precedingLen bytes in front are readable.
+// x64: code - precedingLen is the start of the function in front, from the unwind data. It is decoded up to the entry,
+// so that the int 3 padding is known to follow its ret or jmp and not to be the tail of another instruction
+HotPatchType ClassifyHotPatchPrologue(const BYTE * code, int precedingLen, int codeLen, bool x64, int jumpSize, HOT_PATCH_PROLOGUE * info);
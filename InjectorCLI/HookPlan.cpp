@@ -0,0 +1,608 @@
+#include "HookPlan.h"
+#include "LengthDisasm.h"
+#include <distorm/distorm.h>
+#include <distorm/mnemonics.h>
+#include <stdio.h>
+#include <string.h>
+
+// Every function ApplyNtdllHook, ApplyKernel32Hook and ApplyUserHook can hook, the index is its bit in the settings mask.
+// Plans on disk are keyed by the mask, so only ever append to this
+static const char* const HookedFunctions[] =
+{
+    "NtSetInformationThread",
+    "NtQuerySystemInformation",
+    "NtQueryInformationProcess",
+    "NtSetInformationProcess",
+    "NtQueryObject",
+    "NtYieldExecution",
+    "NtGetContextThread",
+    "NtSetContextThread",
+    "KiUserExceptionDispatcher",
+    "NtContinue",
+    "NtClose",
+    "NtDuplicateObject",
+    "NtSetInformationObject",
+    "NtSetDebugFilterState",
+    "NtCreateThread",
+    "NtCreateThreadEx",
+    "NtQuerySystemTime",
+    "NtQueryPerformanceCounter",
+    "NtResumeThread",
+    "NtOpenFile",
+    "NtCreateSection",
+    "NtMapViewOfSection",
+    "GetTickCount",
+    "GetTickCount64",
+    "GetLocalTime",
+    "GetSystemTime",
+    "OutputDebugStringA",
+    "NtUserBlockInput",
+    "NtUserFindWindowEx",
+    "NtUserBuildHwndList",
+    "NtUserQueryWindow",
+    "NtUserGetForegroundWindow",
+};
+
+static const char hookPlanVersion[] = "1";
+
+// What DetourCreateRemote reads of a function, and the jmps it writes (see RemoteHook.cpp)
+const int planCodeWindow = 60;
+const int relativeJumpLen = 5;
+const int absoluteJumpLenX64 = 2 + sizeof(DWORD) + sizeof(DWORD64) + 1;
+const int hotPatchMaxPrecedingX64 = 0x400;
+const int hotPatchPaddingX86 = 5;
+
+// Size of a RUNTIME_FUNCTION: BeginAddress, EndAddress, UnwindData
+const DWORD runtimeFunctionSize = 3 * sizeof(DWORD);
+
+struct ImageInfo
+{
+    bool X64;
+    DWORD SizeOfImage;
+    IMAGE_DATA_DIRECTORY Export;
+    IMAGE_DATA_DIRECTORY Exception;
+};
+
+static int FindHookedFunction(const char* name)
+{
+    for (int i = 0; i < (int)_countof(HookedFunctions); i++)
+    {
+        if (strcmp(HookedFunctions[i], name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+// The bytes at [rva, rva + size) of a mapped image, nullptr if they are not all inside it
+static const BYTE * AtRva(const BYTE * image, SIZE_T imageSize, DWORD rva, SIZE_T size)
+{
+    if ((ULONGLONG)rva + size > imageSize)
+        return nullptr;
+    return image + rva;
+}
+
+static bool ReadImageInfo(const BYTE * image, SIZE_T imageSize, ImageInfo& info)
+{
+    IMAGE_DOS_HEADER dos;
+    if (imageSize < sizeof(dos))
+        return false;
+    memcpy(&dos, image, sizeof(dos));
+    if (dos.e_magic != IMAGE_DOS_SIGNATURE || dos.e_lfanew < 0 || (SIZE_T)dos.e_lfanew + sizeof(IMAGE_NT_HEADERS32) > imageSize)
+        return false;
+
+    WORD magic;
+    memcpy(&magic, image + dos.e_lfanew + sizeof(DWORD) + sizeof(IMAGE_FILE_HEADER), sizeof(magic));
+    const IMAGE_DATA_DIRECTORY * directories;
+    DWORD numDirectories;
+    IMAGE_NT_HEADERS64 nt64;
+    IMAGE_NT_HEADERS32 nt32;
+    if (magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC)
+    {
+        if ((SIZE_T)dos.e_lfanew + sizeof(nt64) > imageSize)
+            return false;
+        memcpy(&nt64, image + dos.e_lfanew, sizeof(nt64));
+        if (nt64.Signature != IMAGE_NT_SIGNATURE)
+            return false;
+        info.X64 = true;
+        info.SizeOfImage = nt64.OptionalHeader.SizeOfImage;
+        directories = nt64.OptionalHeader.DataDirectory;
+        numDirectories = nt64.OptionalHeader.NumberOfRvaAndSizes;
+    }
+    else if (magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC)
+    {
+        memcpy(&nt32, image + dos.e_lfanew, sizeof(nt32));
+        if (nt32.Signature != IMAGE_NT_SIGNATURE)
+            return false;
+        info.X64 = false;
+        info.SizeOfImage = nt32.OptionalHeader.SizeOfImage;
+        directories = nt32.OptionalHeader.DataDirectory;
+        numDirectories = nt32.OptionalHeader.NumberOfRvaAndSizes;
+    }
+    else
+    {
+        return false;
+    }
+
+    if (info.SizeOfImage > imageSize)
+        return false;
+
+    const IMAGE_DATA_DIRECTORY empty = { 0, 0 };
+    info.Export = numDirectories > IMAGE_DIRECTORY_ENTRY_EXPORT ? directories[IMAGE_DIRECTORY_ENTRY_EXPORT] : empty;
+    info.Exception = numDirectories > IMAGE_DIRECTORY_ENTRY_EXCEPTION ? directories[IMAGE_DIRECTORY_ENTRY_EXCEPTION] : empty;
+    return true;
+}
+
+static DWORD ReadDword(const BYTE * p)
+{
+    DWORD value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static DWORD FindExportRva(const BYTE * image, const ImageInfo& info, const char* name)
+{
+    IMAGE_EXPORT_DIRECTORY exports;
+    const BYTE * p = AtRva(image, info.SizeOfImage, info.Export.VirtualAddress, sizeof(exports));
+    if (info.Export.VirtualAddress == 0 || p == nullptr)
+        return 0;
+    memcpy(&exports, p, sizeof(exports));
+
+    const BYTE * names = AtRva(image, info.SizeOfImage, exports.AddressOfNames, exports.NumberOfNames * sizeof(DWORD));
+    const BYTE * ordinals = AtRva(image, info.SizeOfImage, exports.AddressOfNameOrdinals, exports.NumberOfNames * sizeof(WORD));
+    const BYTE * functions = AtRva(image, info.SizeOfImage, exports.AddressOfFunctions, exports.NumberOfFunctions * sizeof(DWORD));
+    if (names == nullptr || ordinals == nullptr || functions == nullptr)
+        return 0;
+
+    const size_t nameLen = strlen(name) + 1;
+    for (DWORD i = 0; i < exports.NumberOfNames; i++)
+    {
+        const BYTE * exportName = AtRva(image, info.SizeOfImage, ReadDword(names + i * sizeof(DWORD)), nameLen);
+        if (exportName == nullptr || memcmp(exportName, name, nameLen) != 0)
+            continue;
+
+        WORD ordinal;
+        memcpy(&ordinal, ordinals + i * sizeof(WORD), sizeof(ordinal));
+        if (ordinal >= exports.NumberOfFunctions)
+            return 0;
+
+        // A forwarder is a string inside the export directory, the function is in another DLL
+        const DWORD rva = ReadDword(functions + ordinal * sizeof(DWORD));
+        if (rva >= info.Export.VirtualAddress && rva < info.Export.VirtualAddress + info.Export.Size)
+            return 0;
+        return rva < info.SizeOfImage ? rva : 0;
+    }
+    return 0;
+}
+
+DWORD FindExportRva(const BYTE * image, SIZE_T imageSize, const char* name)
+{
+    ImageInfo info;
+    return ReadImageInfo(image, imageSize, info) ? FindExportRva(image, info, name) : 0;
+}
+
+// Start of the last function in the unwind data of an x64 image that begins before rva, 0 if there is none
+static DWORD FindPrecedingFunction(const BYTE * image, const ImageInfo& info, DWORD rva)
+{
+    const DWORD count = info.Exception.Size / runtimeFunctionSize;
+    const BYTE * table = AtRva(image, info.SizeOfImage, info.Exception.VirtualAddress, count * runtimeFunctionSize);
+    if (info.Exception.VirtualAddress == 0 || table == nullptr)
+        return 0;
+
+    // The entries are sorted by BeginAddress
+    DWORD low = 0, high = count;
+    DWORD begin = 0;
+    while (low < high)
+    {
+        const DWORD mid = low + (high - low) / 2;
+        const DWORD beginAddress = ReadDword(table + mid * runtimeFunctionSize);
+        if (beginAddress < rva)
+        {
+            begin = beginAddress;
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return begin;
+}
+
+// Whole instructions from code covering at least minSize bytes, -1 if one of them is not known
+static int GetDetourLen(const BYTE * code, int codeLen, int minSize, bool x64)
+{
+    int totalLen = 0;
+    while (totalLen < minSize)
+    {
+        if (totalLen >= codeLen)
+            return -1;
+        const int len = GetInstructionLength(code + totalLen, codeLen - totalLen, x64);
+        if (len < 1)
+            return -1;
+        totalLen += len;
+    }
+    return totalLen;
+}
+
+static bool DecomposeStub(const BYTE * data, int dataSize, bool x64, _DInst * result, unsigned int maxInstructions, unsigned int * count)
+{
+    _CodeInfo decomposerCi = {};
+    decomposerCi.code = data;
+    decomposerCi.codeLen = dataSize;
+    decomposerCi.dt = x64 ? Decode64Bits : Decode32Bits;
+    decomposerCi.codeOffset = (LONG_PTR)data;
+
+    *count = 0;
+    return distorm_decompose(&decomposerCi, result, maxInstructions, count) != DECRES_INPUTERR;
+}
+
+DWORD GetStubEcxValue(const BYTE * data, int dataSize, bool x64)
+{
+    unsigned int DecodedInstructionsCount = 0;
+    _DInst decomposerResult[10] = {};
+
+    if (DecomposeStub(data, dataSize, x64, decomposerResult, _countof(decomposerResult), &DecodedInstructionsCount))
+    {
+        if (decomposerResult[0].flags != FLAG_NOT_DECODABLE && decomposerResult[1].flags != FLAG_NOT_DECODABLE)
+        {
+            if (decomposerResult[0].opcode == I_MOV && decomposerResult[1].opcode == I_MOV)
+            {
+                if (decomposerResult[1].ops[0].index == R_ECX)
+                {
+                    return decomposerResult[1].imm.dword;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+DWORD GetStubFunctionSize(const BYTE * data, int dataSize, bool x64)
+{
+    // Fast path, only fall back to distorm if the length decoder hits something it does not know
+    for (int offset = 0; offset < dataSize;)
+    {
+        LDE_INSTRUCTION insn;
+        const int len = LdeDecode(data + offset, dataSize - offset, x64, &insn);
+        if (len < 1)
+            break;
+
+        offset += len;
+        if (insn.Map == LdeMapOneByte && (insn.Opcode == 0xC3 || insn.Opcode == 0xC2))
+            return (DWORD)offset;
+    }
+
+    unsigned int DecodedInstructionsCount = 0;
+    _DInst decomposerResult[100] = {};
+
+    if (DecomposeStub(data, dataSize, x64, decomposerResult, _countof(decomposerResult), &DecodedInstructionsCount))
+    {
+        for (unsigned int i = 0; i < DecodedInstructionsCount; i++)
+        {
+            if (decomposerResult[i].flags != FLAG_NOT_DECODABLE && decomposerResult[i].opcode == I_RET)
+                return (DWORD)(((DWORD_PTR)decomposerResult[i].addr + (DWORD_PTR)decomposerResult[i].size) - (DWORD_PTR)data);
+        }
+    }
+
+    return 0;
+}
+
+DWORD GetStubCallOffset(const BYTE * data, int dataSize, bool x64, DWORD * callSize)
+{
+    unsigned int DecodedInstructionsCount = 0;
+    _DInst decomposerResult[100] = {};
+
+    if (DecomposeStub(data, dataSize, x64, decomposerResult, _countof(decomposerResult), &DecodedInstructionsCount))
+    {
+        for (unsigned int i = 0; i < DecodedInstructionsCount; i++)
+        {
+            if (decomposerResult[i].flags != FLAG_NOT_DECODABLE &&
+                (decomposerResult[i].opcode == I_CALL || decomposerResult[i].opcode == I_CALL_FAR))
+            {
+                *callSize = decomposerResult[i].size;
+                return (DWORD)((DWORD_PTR)decomposerResult[i].addr - (DWORD_PTR)data);
+            }
+        }
+    }
+
+    return 0;
+}
+
+ULONGLONG GetHookPlanMask(const std::vector<HookPlanRequest>& requests)
+{
+    ULONGLONG mask = 0;
+    for (const auto& request : requests)
+    {
+        const int index = FindHookedFunction(request.Name);
+        if (index >= 0)
+            mask |= 1ULL << index;
+    }
+    return mask;
+}
+
+std::string GetHookPlanKey(ULONGLONG settingsMask)
+{
+    char key[32];
+    snprintf(key, sizeof(key), "Plan_%llX", (unsigned long long)settingsMask);
+    return key;
+}
+
+static bool CompileHookPlanEntry(const BYTE * image, const ImageInfo& info, const HookPlanRequest& request, HookPlanEntry& entry)
+{
+    const bool x64 = info.X64;
+    DWORD rva = request.Rva != 0 ? request.Rva : FindExportRva(image, info, request.Name);
+    if (rva == 0 || rva >= info.SizeOfImage)
+        return false;
+
+    if (request.FollowJmp && image[rva] == 0xE9)
+    {
+        const BYTE * rel = AtRva(image, info.SizeOfImage, rva + 1, sizeof(LONG));
+        if (rel == nullptr)
+            return false;
+        rva += relativeJumpLen + (LONG)ReadDword(rel);
+        if (rva == 0 || rva >= info.SizeOfImage)
+            return false;
+    }
+
+    const BYTE * code = image + rva;
+    const int codeLen = info.SizeOfImage - rva < (DWORD)planCodeWindow ? (int)(info.SizeOfImage - rva) : planCodeWindow;
+
+    entry.Name = request.Name;
+    entry.Rva = rva;
+
+    const int detourLen = GetDetourLen(code, codeLen, relativeJumpLen, x64);
+    const int detourLenAbsolute = GetDetourLen(code, codeLen, x64 ? absoluteJumpLenX64 : relativeJumpLen, x64);
+    if (detourLen < 0 || detourLenAbsolute < 0)
+        return false;
+    entry.DetourLen = (BYTE)detourLen;
+    entry.DetourLenAbsolute = (BYTE)detourLenAbsolute;
+
+    // On x64 from the start of the function in front, like DetourCreateRemote
+    int precedingLen = rva < (DWORD)hotPatchPaddingX86 ? (int)rva : hotPatchPaddingX86;
+    if (x64)
+    {
+        const DWORD precedingFunction = FindPrecedingFunction(image, info, rva);
+        precedingLen = precedingFunction != 0 && rva - precedingFunction <= (DWORD)hotPatchMaxPrecedingX64 ? (int)(rva - precedingFunction) : 0;
+    }
+    entry.HotPatch = { HotPatchNone, 0, 0 };
+    ClassifyHotPatchPrologue(code, precedingLen, codeLen, x64, relativeJumpLen, &entry.HotPatch);
+
+    entry.SyscallIndex = -1;
+    if (x64 && codeLen >= 8 && code[0] == 0x4C && code[1] == 0x8B && code[2] == 0xD1 && code[3] == 0xB8)
+        entry.SyscallIndex = (LONG)ReadDword(code + 4);
+    else if (!x64 && codeLen >= 5 && code[0] == 0xB8)
+        entry.SyscallIndex = (LONG)ReadDword(code + 1);
+
+    // DetourCreateRemote32 builds its trampoline from the stub up to the ret, with the call to KiFastSystemCall or the
+    // Wow64 transition taken out
+    entry.EcxValue = 0;
+    entry.FunctionSize = 0;
+    entry.CallOffset = 0;
+    entry.CallSize = 0;
+    if (!x64 && entry.SyscallIndex != -1)
+    {
+        DWORD callSize = 0;
+        const DWORD callOffset = GetStubCallOffset(code, codeLen, x64, &callSize);
+        const DWORD functionSize = GetStubFunctionSize(code, codeLen, x64);
+        entry.EcxValue = GetStubEcxValue(code, codeLen, x64);
+        if (functionSize != 0 && functionSize <= HOOK_PLAN_MAX_CODE && callSize != 0 && callOffset + callSize <= functionSize)
+        {
+            entry.FunctionSize = (BYTE)functionSize;
+            entry.CallOffset = (BYTE)callOffset;
+            entry.CallSize = (BYTE)callSize;
+        }
+    }
+
+    int size = entry.DetourLen;
+    if (entry.DetourLenAbsolute > size)
+        size = entry.DetourLenAbsolute;
+    if (entry.HotPatch.EntrySize > size)
+        size = entry.HotPatch.EntrySize;
+    if (entry.FunctionSize > size)
+        size = entry.FunctionSize;
+    if (size > HOOK_PLAN_MAX_CODE)
+        return false;
+    entry.Code.assign(code, code + size);
+    return true;
+}
+
+bool CompileHookPlan(const BYTE * image, SIZE_T imageSize, const std::vector<HookPlanRequest>& requests, HookPlan& plan)
+{
+    ImageInfo info;
+    if (!ReadImageInfo(image, imageSize, info))
+        return false;
+
+    plan.SettingsMask = GetHookPlanMask(requests);
+    plan.X64 = info.X64;
+    plan.Entries.clear();
+    for (const auto& request : requests)
+    {
+        if (FindHookedFunction(request.Name) < 0)
+            return false;
+
+        HookPlanEntry entry;
+        if (FindHookPlanEntry(plan, request.Name) == nullptr && CompileHookPlanEntry(image, info, request, entry))
+            plan.Entries.push_back(entry);
+    }
+    return true;
+}
+
+bool CheckHookPlan(const HookPlan& plan, const BYTE * image, SIZE_T imageSize)
+{
+    ImageInfo info;
+    if (!ReadImageInfo(image, imageSize, info) || info.X64 != plan.X64)
+        return false;
+
+    for (const auto& entry : plan.Entries)
+    {
+        const BYTE * code = AtRva(image, info.SizeOfImage, entry.Rva, entry.Code.size());
+        if (code == nullptr || memcmp(code, entry.Code.data(), entry.Code.size()) != 0)
+            return false;
+    }
+    return true;
+}
+
+static void AppendHex(std::string& text, ULONGLONG value)
+{
+    char hex[20];
+    snprintf(hex, sizeof(hex), "%llX", (unsigned long long)value);
+    text += hex;
+}
+
+// version;mask;x64;entry;entry... with the entries as comma separated hex fields and the code as hex bytes
+std::string FormatHookPlan(const HookPlan& plan)
+{
+    std::string text = hookPlanVersion;
+    text += ';';
+    AppendHex(text, plan.SettingsMask);
+    text += plan.X64 ? ";1" : ";0";
+    for (const auto& entry : plan.Entries)
+    {
+        const ULONGLONG fields[] = { entry.Rva, entry.DetourLen, entry.DetourLenAbsolute, entry.HotPatch.Type,
+            entry.HotPatch.PaddingSize, entry.HotPatch.EntrySize, (DWORD)entry.SyscallIndex, entry.EcxValue,
+            entry.FunctionSize, entry.CallOffset, entry.CallSize };
+
+        text += ';';
+        text += entry.Name;
+        for (const ULONGLONG field : fields)
+        {
+            text += ',';
+            AppendHex(text, field);
+        }
+        text += ',';
+        for (const BYTE b : entry.Code)
+        {
+            char hex[3];
+            snprintf(hex, sizeof(hex), "%02X", b);
+            text += hex;
+        }
+    }
+    return text;
+}
+
+static std::vector<std::string> Split(const std::string& text, char separator)
+{
+    std::vector<std::string> parts;
+    size_t start = 0;
+    for (size_t end; (end = text.find(separator, start)) != std::string::npos; start = end + 1)
+        parts.push_back(text.substr(start, end - start));
+    parts.push_back(text.substr(start));
+    return parts;
+}
+
+static int HexDigit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+static bool ParseHex(const std::string& text, ULONGLONG maxValue, ULONGLONG& value)
+{
+    if (text.empty() || text.size() > 16)
+        return false;
+
+    value = 0;
+    for (const char c : text)
+    {
+        const int digit = HexDigit(c);
+        if (digit < 0)
+            return false;
+        value = value * 16 + digit;
+    }
+    return value <= maxValue;
+}
+
+static bool ParseHookPlanEntry(const std::string& text, bool x64, HookPlanEntry& entry)
+{
+    const auto fields = Split(text, ',');
+    if (fields.size() != 13 || FindHookedFunction(fields[0].c_str()) < 0)
+        return false;
+
+    // Rva, lengths, hot patch, syscall index, ecx, stub layout
+    const ULONGLONG maxValues[] = { MAXDWORD, HOOK_PLAN_MAX_CODE, HOOK_PLAN_MAX_CODE, HotPatchPadding, 0x7F, HOOK_PLAN_MAX_CODE,
+        MAXDWORD, MAXDWORD, HOOK_PLAN_MAX_CODE, HOOK_PLAN_MAX_CODE, HOOK_PLAN_MAX_CODE };
+    ULONGLONG values[_countof(maxValues)];
+    for (size_t i = 0; i < _countof(maxValues); i++)
+    {
+        if (!ParseHex(fields[i + 1], maxValues[i], values[i]))
+            return false;
+    }
+
+    const std::string& code = fields[12];
+    if (code.empty() || code.size() % 2 != 0 || code.size() / 2 > HOOK_PLAN_MAX_CODE)
+        return false;
+
+    entry.Name = fields[0];
+    entry.Rva = (DWORD)values[0];
+    entry.DetourLen = (BYTE)values[1];
+    entry.DetourLenAbsolute = (BYTE)values[2];
+    entry.HotPatch.Type = (UCHAR)values[3];
+    entry.HotPatch.PaddingSize = (UCHAR)values[4];
+    entry.HotPatch.EntrySize = (UCHAR)values[5];
+    entry.SyscallIndex = (LONG)(DWORD)values[6];
+    entry.EcxValue = (DWORD)values[7];
+    entry.FunctionSize = (BYTE)values[8];
+    entry.CallOffset = (BYTE)values[9];
+    entry.CallSize = (BYTE)values[10];
+    entry.Code.clear();
+    for (size_t i = 0; i < code.size(); i += 2)
+    {
+        ULONGLONG b;
+        if (!ParseHex(code.substr(i, 2), 0xFF, b))
+            return false;
+        entry.Code.push_back((BYTE)b);
+    }
+
+    // The lengths are used as they are to copy code to the trampoline, they have to make sense for the planned bytes
+    const size_t size = entry.Code.size();
+    const bool hotPatch = entry.HotPatch.Type != HotPatchNone;
+    return entry.DetourLen >= relativeJumpLen && entry.DetourLen <= size &&
+        entry.DetourLenAbsolute >= (x64 ? absoluteJumpLenX64 : relativeJumpLen) && entry.DetourLenAbsolute <= size &&
+        (!hotPatch || (entry.HotPatch.Type == (x64 ? HotPatchPadding : HotPatchMovEdiEdi) &&
+            entry.HotPatch.PaddingSize >= relativeJumpLen && entry.HotPatch.EntrySize >= 2 && entry.HotPatch.EntrySize <= size)) &&
+        (hotPatch || (entry.HotPatch.PaddingSize == 0 && entry.HotPatch.EntrySize == 0)) &&
+        entry.FunctionSize <= size && (entry.FunctionSize == 0 ? entry.CallOffset == 0 && entry.CallSize == 0 :
+            entry.CallSize != 0 && entry.CallOffset + entry.CallSize <= entry.FunctionSize);
+}
+
+bool ParseHookPlan(const std::string& text, HookPlan& plan)
+{
+    const auto parts = Split(text, ';');
+    ULONGLONG mask;
+    if (parts.size() < 3 || parts[0] != hookPlanVersion || !ParseHex(parts[1], ~0ULL, mask) || (parts[2] != "0" && parts[2] != "1"))
+        return false;
+
+    plan.SettingsMask = mask;
+    plan.X64 = parts[2] == "1";
+    plan.Entries.clear();
+    for (size_t i = 3; i < parts.size(); i++)
+    {
+        HookPlanEntry entry;
+        if (!ParseHookPlanEntry(parts[i], plan.X64, entry) || FindHookPlanEntry(plan, entry.Name.c_str()) != nullptr ||
+            (mask & (1ULL << FindHookedFunction(entry.Name.c_str()))) == 0)
+            return false;
+        plan.Entries.push_back(entry);
+    }
+    return true;
+}
+
+const HookPlanEntry * FindHookPlanEntry(const HookPlan& plan, const char* name)
+{
+    for (const auto& entry : plan.Entries)
+    {
+        if (entry.Name == name)
+            return &entry;
+    }
+    return nullptr;
+}
+
+bool MatchHookPlanEntry(const HookPlanEntry& entry, const BYTE * code, int codeLen)
+{
+    return entry.Code.size() <= (size_t)codeLen && memcmp(entry.Code.data(), code, entry.Code.size()) == 0;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include "CodeRelocation.h"
+
+// Everything DetourCreateRemote and DetourCreateRemote32 work out about a hooked function from its code alone: where it
+// is, how many bytes the jmp steals, whether it can be hot patched and what the syscall stub looks like. A plan is
+// compiled once per image and set of enabled hooks from the DLL mapped in the injector (or from a DLL file, see
+// UnitTests/HookPlanTool.cpp), kept in scylla_hide_hooks.ini, and checked against the debuggee's bytes when it is applied.
+// Nothing here touches memory other than the buffers passed in, and the bitness comes from the image.
+
+// Bytes of a function kept in a plan, at most what DetourCreateRemote reads of it
+#define HOOK_PLAN_MAX_CODE 48
+
+struct HookPlanRequest
+{
+    const char* Name;
+    DWORD Rva;              // 0 to look Name up in the exports
+    bool FollowJmp;         // Hook the target of a jmp rel32 at the export instead (NtQuerySystemTime on x64)
+};
+
+struct HookPlanEntry
+{
+    std::string Name;
+    DWORD Rva;
+    BYTE DetourLen;                 // Instructions the 5 byte jmp rel32 overwrites
+    BYTE DetourLenAbsolute;         // Instructions the jmp of WriteJumper overwrites (15 bytes on x64)
+    HOT_PATCH_PROLOGUE HotPatch;    // Classified for the 5 byte jmp, HotPatchNone if it can't be hot patched
+    LONG SyscallIndex;              // mov eax, <index> of a syscall stub, -1 if the function is not one
+    DWORD EcxValue;                 // mov ecx, <value> of an x86 Wow64 stub, as GetEcxSysCallIndex32
+    BYTE FunctionSize;              // x86 stubs: size up to and including the ret, 0 if not planned
+    BYTE CallOffset;
+    BYTE CallSize;
+    std::vector<BYTE> Code;         // The original bytes that all of the above was derived from
+};
+
+struct HookPlan
+{
+    ULONGLONG SettingsMask;
+    bool X64;
+    std::vector<HookPlanEntry> Entries;
+};
+
+// One bit for each function in the fixed table of hooked functions. Names that are not in it do not count, and
+// CompileHookPlan refuses them
+ULONGLONG GetHookPlanMask(const std::vector<HookPlanRequest>& requests);
+
+// Name of the value a plan is kept under in the section of its image, e.g. Plan_1F3
+std::string GetHookPlanKey(ULONGLONG settingsMask);
+
+// Compiles the plan of requests for image, a DLL in its mapped layout with imageSize bytes from its base.
+// Functions that can not be planned (not exported, forwarded, or with code the length decoder and distorm do not know)
+// are left out, DetourCreateRemote analyses those on every injection as before.
+// Returns false if image is not a PE image or a name is not one of the hooked functions
+bool CompileHookPlan(const BYTE * image, SIZE_T imageSize, const std::vector<HookPlanRequest>& requests, HookPlan& plan);
+
+// Checks a plan read from disk against the image it claims to be for: every entry must lie inside it, hold the image's
+// bytes and have lengths that fit in those bytes
+bool CheckHookPlan(const HookPlan& plan, const BYTE * image, SIZE_T imageSize);
+
+// A single line of text that can be kept as an ini value, and back. ParseHookPlan returns false on anything malformed
+std::string FormatHookPlan(const HookPlan& plan);
+bool ParseHookPlan(const std::string& text, HookPlan& plan);
+
+const HookPlanEntry * FindHookPlanEntry(const HookPlan& plan, const char* name);
+
+// Whether code, the codeLen bytes read at the function when it is hooked, still starts with the planned bytes
+bool MatchHookPlanEntry(const HookPlanEntry& entry, const BYTE * code, int codeLen);
+
+// Export RVA of name in a mapped image, 0 if it is not exported or forwarded to another DLL
+DWORD FindExportRva(const BYTE * image, SIZE_T imageSize, const char* name);
+
+// The syscall stub analysis of DetourCreateRemote32, on a copy of the stub
+DWORD GetStubEcxValue(const BYTE * data, int dataSize, bool x64);
+DWORD GetStubFunctionSize(const BYTE * data, int dataSize, bool x64);
+DWORD GetStubCallOffset(const BYTE * data, int dataSize, bool x64, DWORD * callSize);
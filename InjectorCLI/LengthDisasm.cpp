@@ -0,0 +1,255 @@
+#include "LengthDisasm.h"
+
+// Opcode table flags
+#define M   0x01    // ModRM
+#define I8  0x02    // imm8
+#define I16 0x04    // imm16
+#define IZ  0x08    // imm16/32, depending on the operand size
+#define IV  0x10    // imm16/32/64, depending on the operand size
+#define R   0x20    // The immediate is a relative branch target
+#define X   0x40    // Invalid in 64 bit mode
+#define U   0x80    // Unknown or not supported, let distorm handle it
+
+// Prefixes and the 0F escape are handled before the table lookup and are listed as 0
+static const UCHAR OneByteTable[256] =
+{
+    /*       0       1       2       3       4       5       6       7       8       9       A       B       C       D       E       F */
+    /* 0 */  M,      M,      M,      M,      I8,     IZ,     X,      X,      M,      M,      M,      M,      I8,     IZ,     X,      0,
+    /* 1 */  M,      M,      M,      M,      I8,     IZ,     X,      X,      M,      M,      M,      M,      I8,     IZ,     X,      X,
+    /* 2 */  M,      M,      M,      M,      I8,     IZ,     0,      X,      M,      M,      M,      M,      I8,     IZ,     0,      X,
+    /* 3 */  M,      M,      M,      M,      I8,     IZ,     0,      X,      M,      M,      M,      M,      I8,     IZ,     0,      X,
+    /* 4 */  0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,
+    /* 5 */  0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,
+    /* 6 */  X,      X,      M|X,    M,      0,      0,      0,      0,      IZ,     M|IZ,   I8,     M|I8,   0,      0,      0,      0,
+    /* 7 */  I8|R,   I8|R,   I8|R,   I8|R,   I8|R,   I8|R,   I8|R,   I8|R,   I8|R,   I8|R,   I8|R,   I8|R,   I8|R,   I8|R,   I8|R,   I8|R,
+    /* 8 */  M|I8,   M|IZ,   M|I8|X, M|I8,   M,      M,      M,      M,      M,      M,      M,      M,      U,      M,      U,      M,
+    /* 9 */  0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      IZ|I16|X, U,     0,      0,      0,      0,
+    /* A */  0,      0,      0,      0,      0,      0,      0,      0,      I8,     IZ,     0,      0,      0,      0,      0,      0,
+    /* B */  I8,     I8,     I8,     I8,     I8,     I8,     I8,     I8,     IV,     IV,     IV,     IV,     IV,     IV,     IV,     IV,
+    /* C */  M|I8,   M|I8,   I16,    0,      M|X,    M|X,    M|I8,   M|IZ,   I16|I8, 0,      I16,    0,      0,      I8,     X,      0,
+    /* D */  M,      M,      M,      M,      I8|X,   I8|X,   U,      0,      U,      U,      U,      U,      U,      U,      U,      U,
+    /* E */  I8|R,   I8|R,   I8|R,   I8|R,   I8,     I8,     I8,     I8,     IZ|R,   IZ|R,   IZ|I16|X, I8|R, 0,     0,      0,      0,
+    /* F */  0,      0,      0,      0,      0,      0,      M,      M,      0,      0,      0,      0,      0,      0,      M,      M,
+};
+
+// 0F 38 and 0F 3A (SSSE3 and later) are not used in anything we hook and are left to distorm
+static const UCHAR TwoByteTable[256] =
+{
+    /*       0       1       2       3       4       5       6       7       8       9       A       B       C       D       E       F */
+    /* 0 */  U,      U,      M,      M,      U,      0,      0,      0,      0,      0,      U,      0,      U,      U,      0,      U,
+    /* 1 */  M,      M,      M,      M,      M,      M,      M,      M,      U,      U,      U,      U,      U,      U,      U,      M,
+    /* 2 */  U,      U,      U,      U,      U,      U,      U,      U,      M,      M,      M,      M,      M,      M,      M,      M,
+    /* 3 */  0,      0,      0,      0,      0,      0,      U,      U,      U,      U,      U,      U,      U,      U,      U,      U,
+    /* 4 */  M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,
+    /* 5 */  U,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,
+    /* 6 */  M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      U,      U,      M,      M,
+    /* 7 */  M|I8,   U,      U,      U,      M,      M,      M,      0,      U,      U,      U,      U,      U,      U,      M,      M,
+    /* 8 */  IZ|R,   IZ|R,   IZ|R,   IZ|R,   IZ|R,   IZ|R,   IZ|R,   IZ|R,   IZ|R,   IZ|R,   IZ|R,   IZ|R,   IZ|R,   IZ|R,   IZ|R,   IZ|R,
+    /* 9 */  M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,
+    /* A */  0,      0,      0,      M,      M|I8,   M,      U,      U,      0,      0,      0,      M,      M|I8,   M,      U,      M,
+    /* B */  M,      M,      M,      M,      M,      M,      M,      M,      U,      U,      M|I8,   M,      M,      M,      M,      M,
+    /* C */  M,      M,      U,      M,      M|I8,   U,      M|I8,   U,      0,      0,      0,      0,      0,      0,      0,      0,
+    /* D */  U,      M,      M,      M,      M,      M,      U,      U,      M,      M,      M,      M,      M,      M,      M,      M,
+    /* E */  M,      M,      M,      M,      M,      M,      U,      M,      M,      M,      M,      M,      M,      M,      M,      M,
+    /* F */  U,      M,      M,      M,      M,      M,      M,      U,      M,      M,      M,      M,      M,      M,      M,      U,
+};
+
+static bool IsLegacyPrefix(BYTE b)
+{
+    switch (b)
+    {
+    case 0xF0: case 0xF2: case 0xF3:                        // LOCK, REPNE, REP
+    case 0x26: case 0x2E: case 0x36: case 0x3E:             // ES, CS, SS, DS
+    case 0x64: case 0x65:                                   // FS, GS
+    case 0x66: case 0x67:                                   // Operand size, address size
+        return true;
+    default:
+        return false;
+    }
+}
+
+int LdeDecode(const BYTE * code, int codeLen, bool x64, LDE_INSTRUCTION * info)
+{
+    LDE_INSTRUCTION insn = {};
+    const int maxLen = codeLen < LDE_MAX_INSTRUCTION_SIZE ? codeLen : LDE_MAX_INSTRUCTION_SIZE;
+    int pos = 0;
+
+    // Prefixes. REX only counts if it is directly in front of the opcode
+    for (;; pos++)
+    {
+        if (pos >= maxLen)
+            return -1;
+
+        const BYTE b = code[pos];
+        if (IsLegacyPrefix(b))
+        {
+            if (b == 0x66)
+                insn.Flags |= LdeFlagOperandSize;
+            else if (b == 0x67)
+                insn.Flags |= LdeFlagAddressSize;
+            insn.Rex = 0;
+        }
+        else if (x64 && (b & 0xF0) == 0x40)
+        {
+            insn.Rex = b;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    // Opcode
+    insn.OpcodeOffset = (UCHAR)pos;
+    UCHAR flags;
+    if (code[pos] == 0x0F)
+    {
+        if (++pos >= maxLen)
+            return -1;
+        insn.Map = LdeMap0F;
+        insn.Opcode = code[pos];
+        flags = TwoByteTable[insn.Opcode];
+    }
+    else
+    {
+        insn.Map = LdeMapOneByte;
+        insn.Opcode = code[pos];
+        flags = OneByteTable[insn.Opcode];
+    }
+    pos++;
+
+    if ((flags & U) || (x64 && (flags & X)))
+        return -1;
+
+    const bool rexW = (insn.Rex & 0x08) != 0;
+    const bool operandSize16 = (insn.Flags & LdeFlagOperandSize) != 0 && !rexW;
+    const bool addressSize16 = !x64 && (insn.Flags & LdeFlagAddressSize) != 0;
+
+    // ModRM, SIB and displacement
+    if (flags & M)
+    {
+        if (pos >= maxLen)
+            return -1;
+        const BYTE modRm = code[pos++];
+        const BYTE mod = modRm >> 6, reg = (modRm >> 3) & 7, rm = modRm & 7;
+
+        insn.Flags |= LdeFlagModRm;
+        insn.ModRm = modRm;
+
+        if (insn.Map == LdeMapOneByte)
+        {
+            // VEX (C4, C5), EVEX (62) and XOP (8F) share their opcodes with legacy instructions
+            if (((insn.Opcode == 0xC4 || insn.Opcode == 0xC5 || insn.Opcode == 0x62) && mod == 3) ||
+                (insn.Opcode == 0x8F && reg != 0))
+                return -1;
+
+            // Invalid group encodings, XABORT and XBEGIN
+            if ((insn.Opcode == 0x8D && mod == 3) ||
+                ((insn.Opcode == 0xC6 || insn.Opcode == 0xC7) && reg != 0) ||
+                ((insn.Opcode == 0xF6 || insn.Opcode == 0xF7) && reg == 1) ||
+                (insn.Opcode == 0xFE && reg > 1) ||
+                (insn.Opcode == 0xFF && (reg == 7 || ((reg == 3 || reg == 5) && mod == 3))))
+                return -1;
+
+            // TEST is the only instruction in group 3 with an immediate
+            if (insn.Opcode == 0xF6 && reg == 0)
+                flags |= I8;
+            else if (insn.Opcode == 0xF7 && reg == 0)
+                flags |= IZ;
+        }
+        else
+        {
+            switch (insn.Opcode)
+            {
+            case 0x13: case 0x17: case 0x2B: case 0xB2: case 0xB4: case 0xB5: case 0xC3: case 0xE7:
+                if (mod == 3) // Memory operand only
+                    return -1;
+                break;
+            case 0xBA:
+                if (reg < 4)
+                    return -1;
+                break;
+            }
+        }
+
+        if (mod != 3)
+        {
+            UCHAR dispSize;
+            if (addressSize16)
+            {
+                dispSize = mod == 1 ? 1 : (mod == 2 || (mod == 0 && rm == 6)) ? 2 : 0;
+            }
+            else
+            {
+                BYTE base = rm;
+                if (rm == 4)
+                {
+                    if (pos >= maxLen)
+                        return -1;
+                    base = code[pos++] & 7;
+                }
+
+                if (mod == 1)
+                    dispSize = 1;
+                else if (mod == 2 || (mod == 0 && base == 5))
+                    dispSize = 4;
+                else
+                    dispSize = 0;
+
+                if (x64 && mod == 0 && rm == 5)
+                    insn.Flags |= LdeFlagRipRelative;
+            }
+
+            if (dispSize != 0)
+            {
+                insn.DispOffset = (UCHAR)pos;
+                insn.DispSize = dispSize;
+                pos += dispSize;
+            }
+        }
+    }
+
+    // Immediates
+    UCHAR immSize = 0;
+    if (insn.Map == LdeMapOneByte && insn.Opcode >= 0xA0 && insn.Opcode <= 0xA3)
+    {
+        // MOV with a memory offset, the only immediate sized by the address size
+        if (x64)
+            immSize = (insn.Flags & LdeFlagAddressSize) ? 4 : 8;
+        else
+            immSize = addressSize16 ? 2 : 4;
+    }
+    else
+    {
+        if (flags & I8)
+            immSize += 1;
+        if (flags & I16)
+            immSize += 2;
+        if (flags & IZ)
+        {
+            // Whether 66 shortens a near branch in 64 bit mode depends on the CPU vendor
+            if (x64 && (flags & R) && operandSize16)
+                return -1;
+            immSize += operandSize16 ? 2 : 4;
+        }
+        if (flags & IV)
+            immSize += (x64 && rexW) ? 8 : operandSize16 ? 2 : 4;
+    }
+
+    if (immSize != 0)
+    {
+        insn.ImmOffset = (UCHAR)pos;
+        insn.ImmSize = immSize;
+        pos += immSize;
+        if (flags & R)
+            insn.Flags |= LdeFlagRelative;
+    }
+
+    if (pos > maxLen)
+        return -1;
+
+    insn.Length = (UCHAR)pos;
+    if (info != nullptr)
+        *info = insn;
+    return pos;
+}
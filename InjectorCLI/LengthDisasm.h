@@ -0,0 +1,43 @@
+#pragma once
+
+#include <windows.h>
+
+// Table driven instruction length decoder for the prologues we patch. It only looks at prefixes, opcode maps,
+// ModRM/SIB and immediates, so it is a lot cheaper than a full distorm decode. Anything it does not know (VEX/EVEX/XOP,
+// 3DNow!, the 0F 38 and 0F 3A maps, invalid opcodes) is reported as undecodable, and callers fall back to distorm.
+
+#define LDE_MAX_INSTRUCTION_SIZE 15
+
+enum LdeOpcodeMap : UCHAR
+{
+    LdeMapOneByte,
+    LdeMap0F
+};
+
+enum LdeFlags : UCHAR
+{
+    LdeFlagModRm = 1 << 0,
+    LdeFlagRelative = 1 << 1,       // The immediate is a branch displacement relative to the next instruction
+    LdeFlagRipRelative = 1 << 2,    // The displacement is relative to the next instruction (x64 only)
+    LdeFlagOperandSize = 1 << 3,    // 66 prefix
+    LdeFlagAddressSize = 1 << 4,    // 67 prefix
+};
+
+typedef struct _LDE_INSTRUCTION
+{
+    UCHAR Length;
+    UCHAR Flags;
+    UCHAR Map;              // LdeOpcodeMap
+    UCHAR Opcode;           // Last opcode byte, i.e. 0x85 for 0F 85
+    UCHAR OpcodeOffset;     // Offset of the first opcode byte (0F for the two and three byte maps), after all prefixes
+    UCHAR Rex;              // 0 if there is no REX prefix
+    UCHAR ModRm;
+    UCHAR DispOffset;
+    UCHAR DispSize;
+    UCHAR ImmOffset;
+    UCHAR ImmSize;          // Total size of all immediates, i.e. 3 for ENTER
+} LDE_INSTRUCTION;
+
+// Returns the length of the instruction at code, or -1 if it is unknown or does not fit in codeLen bytes.
+// info is optional
+int LdeDecode(const BYTE * code, int codeLen, bool x64, LDE_INSTRUCTION * info);
@@ -1,4 +1,7 @@
 #include "RemoteHook.h"
+#include "CodeRelocation.h"
+#include "HookPlan.h"
+#include "LengthDisasm.h"
 #include <distorm/distorm.h>
 #include <distorm/mnemonics.h>
 #include <Scylla/OsInfo.h>
@@ -16,8 +19,10 @@
 
 #if !defined(_WIN64)
 _DecodeType DecodingType = Decode32Bits;
+const bool LdeDecodeX64 = false;
 #else
 _DecodeType DecodingType = Decode64Bits;
+const bool LdeDecodeX64 = true;
 #endif
 
 #ifdef _WIN64
@@ -27,6 +32,20 @@ const int minDetourLen = sizeof(DWORD) + 1;
 const int detourLenWow64FarJmp = 1 + sizeof(DWORD) + sizeof(USHORT); // EA far jmp
 #endif
 
+// Layout of the memory DetourCreateRemote allocates for a trampoline. The original bytes are kept at the start
+// because the relocated copy in the trampoline can differ from them, the relay is the jmp to the detour used with 5 byte jmps
+const int trampolineRelayOffset = 32;
+const int trampolineCodeOffset = 48;
+const int trampolineAllocSize = 256;
+
+#ifdef _WIN64
+// How far back the function in front of a hot patch may start, it is decoded from there up to the padding
+const int hotPatchMaxPreceding = 0x400;
+#else
+// The padding in front of mov edi, edi
+const int hotPatchMaxPreceding = 5;
+#endif
+
 
 extern scl::Settings g_settings;
 extern void * HookedNativeCallInternal;
@@ -84,6 +103,119 @@ void WriteWow64Jumper(unsigned char * lpbTo, unsigned char * buf)
 }
 #endif
 
+#ifdef _WIN64
+// Looks for free memory within rel32 range of target, so that it can be reached with a 5 byte jmp
+static PBYTE AllocateRemoteNear(HANDLE hProcess, PBYTE target, SIZE_T size)
+{
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    const ULONG_PTR granularity = si.dwAllocationGranularity;
+    const ULONG_PTR range = MAXLONG - size - granularity;
+    ULONG_PTR low = (ULONG_PTR)target > range ? (ULONG_PTR)target - range : 0;
+    if (low < (ULONG_PTR)si.lpMinimumApplicationAddress)
+        low = (ULONG_PTR)si.lpMinimumApplicationAddress;
+    ULONG_PTR high = (ULONG_PTR)target + range;
+    if (high > (ULONG_PTR)si.lpMaximumApplicationAddress)
+        high = (ULONG_PTR)si.lpMaximumApplicationAddress;
+
+    // System DLLs are near the top of the address space, so search downwards first
+    MEMORY_BASIC_INFORMATION mbi;
+    for (ULONG_PTR address = (ULONG_PTR)target; address > low && VirtualQueryEx(hProcess, (PVOID)address, &mbi, sizeof(mbi)) != 0; address = (ULONG_PTR)mbi.BaseAddress - 1)
+    {
+        if (mbi.State != MEM_FREE || mbi.RegionSize < size)
+            continue;
+
+        const ULONG_PTR candidate = ((ULONG_PTR)mbi.BaseAddress + mbi.RegionSize - size) & ~(granularity - 1);
+        if (candidate >= (ULONG_PTR)mbi.BaseAddress && candidate >= low)
+        {
+            PVOID memory = VirtualAllocEx(hProcess, (PVOID)candidate, size, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+            if (memory != nullptr)
+                return (PBYTE)memory;
+        }
+    }
+
+    for (ULONG_PTR address = (ULONG_PTR)target; address < high && VirtualQueryEx(hProcess, (PVOID)address, &mbi, sizeof(mbi)) != 0; address = (ULONG_PTR)mbi.BaseAddress + mbi.RegionSize)
+    {
+        if (mbi.State != MEM_FREE)
+            continue;
+
+        const ULONG_PTR candidate = ((ULONG_PTR)mbi.BaseAddress + granularity - 1) & ~(granularity - 1);
+        if (candidate + size <= (ULONG_PTR)mbi.BaseAddress + mbi.RegionSize && candidate + size <= high)
+        {
+            PVOID memory = VirtualAllocEx(hProcess, (PVOID)candidate, size, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+            if (memory != nullptr)
+                return (PBYTE)memory;
+        }
+    }
+
+    return nullptr;
+}
+
+// Whether the rel32 jmp at address goes to the relay of one of our trampolines, i.e. the function has been hooked by us before
+static bool IsOwnRelayJump(HANDLE hProcess, ULONG_PTR address, const BYTE * code)
+{
+    const ULONG_PTR target = address + 5 + *(const LONG*)(code + 1);
+    MEMORY_BASIC_INFORMATION mbi;
+    BYTE relay[2];
+    return VirtualQueryEx(hProcess, (PVOID)target, &mbi, sizeof(mbi)) != 0 && mbi.Type == MEM_PRIVATE &&
+        (ULONG_PTR)mbi.AllocationBase + trampolineRelayOffset == target &&
+        ReadProcessMemory(hProcess, (PVOID)target, relay, sizeof(relay), nullptr) &&
+        (relay[0] == 0xE9 || (relay[0] == 0xFF && relay[1] == 0x25));
+}
+
+// Start of the code in front of address according to the unwind data of its module: the last function (or function
+// chunk) that begins before it. Leaf functions have no unwind data, so this can be several functions further back
+static ULONG_PTR FindPrecedingFunction(HANDLE hProcess, ULONG_PTR address)
+{
+    MEMORY_BASIC_INFORMATION mbi;
+    IMAGE_DOS_HEADER dos;
+    IMAGE_NT_HEADERS64 nt;
+    if (VirtualQueryEx(hProcess, (PVOID)address, &mbi, sizeof(mbi)) == 0 || mbi.Type != MEM_IMAGE)
+        return 0;
+    const ULONG_PTR imageBase = (ULONG_PTR)mbi.AllocationBase;
+    if (!ReadProcessMemory(hProcess, (PVOID)imageBase, &dos, sizeof(dos), nullptr) || dos.e_magic != IMAGE_DOS_SIGNATURE ||
+        !ReadProcessMemory(hProcess, (PVOID)(imageBase + dos.e_lfanew), &nt, sizeof(nt), nullptr) || nt.Signature != IMAGE_NT_SIGNATURE ||
+        nt.OptionalHeader.Magic != IMAGE_NT_OPTIONAL_HDR64_MAGIC || nt.OptionalHeader.NumberOfRvaAndSizes <= IMAGE_DIRECTORY_ENTRY_EXCEPTION)
+        return 0;
+
+    // The entries are sorted by BeginAddress
+    const IMAGE_DATA_DIRECTORY& exceptionDir = nt.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXCEPTION];
+    const DWORD rva = (DWORD)(address - imageBase);
+    DWORD low = 0, high = exceptionDir.Size / sizeof(RUNTIME_FUNCTION);
+    DWORD begin = 0;
+    while (low < high)
+    {
+        const DWORD mid = low + (high - low) / 2;
+        RUNTIME_FUNCTION entry;
+        if (!ReadProcessMemory(hProcess, (PVOID)(imageBase + exceptionDir.VirtualAddress + mid * sizeof(entry)), &entry, sizeof(entry), nullptr))
+            return 0;
+        if (entry.BeginAddress < rva)
+        {
+            begin = entry.BeginAddress;
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return begin != 0 ? imageBase + begin : 0;
+}
+#endif
+
+// Whether the planned hot patch padding in front of a function is still unused: all int 3, or on x86 all int 3 or all nop
+static bool IsHotPatchPadding(const BYTE * padding, int paddingLen)
+{
+    if (padding[0] != 0xCC && (LdeDecodeX64 || padding[0] != 0x90))
+        return false;
+    for (int i = 1; i < paddingLen; i++)
+    {
+        if (padding[i] != padding[0])
+            return false;
+    }
+    return true;
+}
+
 void ClearSyscallBreakpoint(const char* funcName, unsigned char* funcBytes)
 {
     // Do nothing if this is not a syscall stub
@@ -114,30 +246,7 @@ void ClearSyscallBreakpoint(const char* funcName, unsigned char* funcBytes)
 
 DWORD GetEcxSysCallIndex32(const BYTE * data, int dataSize)
 {
-    unsigned int DecodedInstructionsCount = 0;
-    _CodeInfo decomposerCi = { 0 };
-    _DInst decomposerResult[10] = { 0 };
-
-    decomposerCi.code = data;
-    decomposerCi.codeLen = dataSize;
-    decomposerCi.dt = DecodingType;
-    decomposerCi.codeOffset = (LONG_PTR)data;
-
-    if (distorm_decompose(&decomposerCi, decomposerResult, _countof(decomposerResult), &DecodedInstructionsCount) != DECRES_INPUTERR)
-    {
-        if (decomposerResult[0].flags != FLAG_NOT_DECODABLE && decomposerResult[1].flags != FLAG_NOT_DECODABLE)
-        {
-            if (decomposerResult[0].opcode == I_MOV && decomposerResult[1].opcode == I_MOV)
-            {
-                if (decomposerResult[1].ops[0].index == R_ECX)
-                {
-                    return decomposerResult[1].imm.dword;
-                }
-            }
-        }
-    }
-
-    return 0;
+    return GetStubEcxValue(data, dataSize, LdeDecodeX64);
 }
 
 DWORD GetSysCallIndex32(const BYTE * data)
@@ -234,61 +343,27 @@ DWORD GetCallDestination(HANDLE hProcess, const BYTE * data, int dataSize)
 
 DWORD GetFunctionSizeRETN(BYTE * data, int dataSize)
 {
-    unsigned int DecodedInstructionsCount = 0;
-    _CodeInfo decomposerCi = { 0 };
-    _DInst decomposerResult[100] = { 0 };
-
-    decomposerCi.code = data;
-    decomposerCi.codeLen = dataSize;
-    decomposerCi.dt = DecodingType;
-    decomposerCi.codeOffset = (LONG_PTR)data;
-
-    if (distorm_decompose(&decomposerCi, decomposerResult, _countof(decomposerResult), &DecodedInstructionsCount) != DECRES_INPUTERR)
-    {
-        for (unsigned int i = 0; i < DecodedInstructionsCount; i++)
-        {
-            if (decomposerResult[i].flags != FLAG_NOT_DECODABLE)
-            {
-                if (decomposerResult[i].opcode == I_RET)
-                {
-                    return (DWORD)(((DWORD_PTR)decomposerResult[i].addr + (DWORD_PTR)decomposerResult[i].size) - (DWORD_PTR)data);
-                }
-            }
-        }
-
-    }
-
-    return 0;
+    return GetStubFunctionSize(data, dataSize, LdeDecodeX64);
 }
 
 DWORD GetCallOffset(const BYTE * data, int dataSize, DWORD * callSize)
 {
-    unsigned int DecodedInstructionsCount = 0;
-    _CodeInfo decomposerCi = { 0 };
-    _DInst decomposerResult[100] = { 0 };
-
-    decomposerCi.code = data;
-    decomposerCi.codeLen = dataSize;
-    decomposerCi.dt = DecodingType;
-    decomposerCi.codeOffset = (LONG_PTR)data;
+    return GetStubCallOffset(data, dataSize, LdeDecodeX64, callSize);
+}
 
-    if (distorm_decompose(&decomposerCi, decomposerResult, _countof(decomposerResult), &DecodedInstructionsCount) != DECRES_INPUTERR)
+// Size of the stub in originalBytes up to its ret, and where the call to KiFastSystemCall or the Wow64 transition is in it
+static DWORD GetStubLayout(const HookPlanEntry * plan, DWORD * callOffset, DWORD * callSize)
+{
+    if (plan != nullptr && plan->FunctionSize != 0)
     {
-        for (unsigned int i = 0; i < DecodedInstructionsCount; i++)
-        {
-            if (decomposerResult[i].flags != FLAG_NOT_DECODABLE)
-            {
-                if (decomposerResult[i].opcode == I_CALL || decomposerResult[i].opcode == I_CALL_FAR)
-                {
-                    *callSize = decomposerResult[i].size;
-                    return (DWORD)((DWORD_PTR)decomposerResult[i].addr - (DWORD_PTR)data);
-                }
-            }
-        }
-
+        *callOffset = plan->CallOffset;
+        *callSize = plan->CallSize;
+        return plan->FunctionSize;
     }
 
-    return 0;
+    *callSize = 0;
+    *callOffset = GetCallOffset(originalBytes, sizeof(originalBytes), callSize);
+    return GetFunctionSizeRETN(originalBytes, sizeof(originalBytes));
 }
 
 ULONG_PTR FindPattern(ULONG_PTR base, ULONG size, const UCHAR* pattern, ULONG patternSize)
@@ -311,7 +386,7 @@ ULONG_PTR FindPattern(ULONG_PTR base, ULONG size, const UCHAR* pattern, ULONG pa
 BYTE KiFastSystemCallWow64Backup[7] = { 0 };
 DWORD KiFastSystemCallWow64Address = 0; // In wow64cpu.dll, named X86SwitchTo64BitMode prior to Windows 8
 
-void * DetourCreateRemoteWow64(void * hProcess, bool createTramp)
+void * DetourCreateRemoteWow64(void * hProcess, bool createTramp, const HookPlanEntry * plan)
 {
     PBYTE trampoline = nullptr;
     DWORD protect;
@@ -343,11 +418,14 @@ void * DetourCreateRemoteWow64(void * hProcess, bool createTramp)
 
         memcpy(originalBytes, syscallAddressBytes, sizeof(syscallAddressBytes));
         memcpy(changedBytes, syscallAddressBytes, sizeof(syscallAddressBytes));
+
+        // The plan is of the function itself, not of the template
+        plan = nullptr;
     }
 
-    DWORD funcSize = GetFunctionSizeRETN(originalBytes, sizeof(originalBytes));
-    DWORD callSize = 0;
-    DWORD callOffset = GetCallOffset(originalBytes, sizeof(originalBytes), &callSize);
+    DWORD callSize;
+    DWORD callOffset;
+    DWORD funcSize = GetStubLayout(plan, &callOffset, &callSize);
 
     if (!onceNativeCallContinueWasSet)
     {
@@ -436,6 +514,14 @@ void * DetourCreateRemoteWow64(void * hProcess, bool createTramp)
 
     if (funcSize != 0 && createTramp)
     {
+        // Everything but the call is copied to the trampoline as is
+        if (!IsPositionIndependentCode(originalBytes, callOffset, LdeDecodeX64) ||
+            !IsPositionIndependentCode(originalBytes + callOffset + callSize, funcSize - callOffset - callSize, LdeDecodeX64))
+        {
+            MessageBoxA(nullptr, "DetourCreateRemoteWow64 -> syscall stub can not be relocated", "ScyllaHide", MB_ICONERROR);
+            return nullptr;
+        }
+
         trampoline = (PBYTE)VirtualAllocEx(hProcess, nullptr, sizeof(changedBytes), MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
         if (trampoline == nullptr)
             return nullptr;
@@ -481,15 +567,14 @@ BYTE KiFastSystemCallBackup[20] = { 0 };
 DWORD KiFastSystemCallAddress = 0;
 DWORD KiFastSystemCallBackupSize = 0;
 
-void * DetourCreateRemoteX86(void * hProcess, bool createTramp)
+void * DetourCreateRemoteX86(void * hProcess, bool createTramp, const HookPlanEntry * plan)
 {
     PBYTE trampoline = 0;
     DWORD protect;
 
-    DWORD funcSize = GetFunctionSizeRETN(originalBytes, sizeof(originalBytes));
-
-    DWORD callSize = 0;
-    DWORD callOffset = GetCallOffset(originalBytes, sizeof(originalBytes), &callSize);
+    DWORD callSize;
+    DWORD callOffset;
+    DWORD funcSize = GetStubLayout(plan, &callOffset, &callSize);
     KiFastSystemCallAddress = GetCallDestination(hProcess, originalBytes, sizeof(originalBytes));
 
     if (!onceNativeCallContinue)
@@ -517,6 +602,14 @@ void * DetourCreateRemoteX86(void * hProcess, bool createTramp)
 
     if (funcSize && createTramp)
     {
+        // Everything but the call is copied to the trampoline as is
+        if (!IsPositionIndependentCode(originalBytes, callOffset, LdeDecodeX64) ||
+            !IsPositionIndependentCode(originalBytes + callOffset + callSize, funcSize - callOffset - callSize, LdeDecodeX64))
+        {
+            MessageBoxA(nullptr, "DetourCreateRemoteX86 -> syscall stub can not be relocated", "ScyllaHide", MB_ICONERROR);
+            return nullptr;
+        }
+
         trampoline = (PBYTE)VirtualAllocEx(hProcess, nullptr, sizeof(changedBytes), MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
         if (!trampoline)
             return nullptr;
@@ -548,7 +641,7 @@ void * DetourCreateRemoteX86(void * hProcess, bool createTramp)
     return trampoline;
 }
 
-void * DetourCreateRemote32(void * hProcess, const char* funcName, void * lpFuncOrig, void * lpFuncDetour, bool createTramp, unsigned long * backupSize)
+void * DetourCreateRemote32(void * hProcess, const char* funcName, void * lpFuncOrig, void * lpFuncDetour, bool createTramp, unsigned long * backupSize, const HookPlanEntry * plan)
 {
     if (!scl::IsWow64Process(hProcess))
     {
@@ -557,13 +650,13 @@ void * DetourCreateRemote32(void * hProcess, const char* funcName, void * lpFunc
         if (scl::GetWindowsVersion() >= scl::OS_WIN_8)
         {
             // The native x86 syscall structure was changed in Windows 8. https://github.com/x64dbg/ScyllaHide/issues/49
-            return DetourCreateRemote(hProcess, funcName, lpFuncOrig, lpFuncDetour, createTramp, backupSize);
+            return DetourCreateRemote(hProcess, funcName, lpFuncOrig, lpFuncDetour, createTramp, backupSize, plan);
         }
 
         if (g_settings.profile_name().find(L"Obsidium") != std::wstring::npos)
         {
             // This is an extremely lame hack because Obsidium doesn't like where we put our hooks
-            return DetourCreateRemote(hProcess, funcName, lpFuncOrig, lpFuncDetour, createTramp, backupSize);
+            return DetourCreateRemote(hProcess, funcName, lpFuncOrig, lpFuncDetour, createTramp, backupSize, plan);
         }
     }
 
@@ -580,10 +673,12 @@ void * DetourCreateRemote32(void * hProcess, const char* funcName, void * lpFunc
     }
 
     ClearSyscallBreakpoint(funcName, originalBytes);
+    if (plan != nullptr && !MatchHookPlanEntry(*plan, originalBytes, sizeof(originalBytes)))
+        plan = nullptr;
 
     memcpy(changedBytes, originalBytes, sizeof(originalBytes));
 
-    DWORD sysCallIndex = GetSysCallIndex32(originalBytes);
+    DWORD sysCallIndex = plan != nullptr && plan->SyscallIndex != -1 ? (DWORD)plan->SyscallIndex : GetSysCallIndex32(originalBytes);
 
     if (sysCallIndex == (DWORD)-1)
     {
@@ -602,12 +697,12 @@ void * DetourCreateRemote32(void * hProcess, const char* funcName, void * lpFunc
     PVOID result;
     if (!scl::IsWow64Process(hProcess))
     {
-        result = DetourCreateRemoteX86(hProcess, createTramp);
+        result = DetourCreateRemoteX86(hProcess, createTramp, plan);
     }
     else
     {
-        HookNative[countNativeHooks].ecxValue = GetEcxSysCallIndex32(originalBytes, sizeof(originalBytes));
-        result = DetourCreateRemoteWow64(hProcess, createTramp);
+        HookNative[countNativeHooks].ecxValue = plan != nullptr && plan->SyscallIndex != -1 ? plan->EcxValue : GetEcxSysCallIndex32(originalBytes, sizeof(originalBytes));
+        result = DetourCreateRemoteWow64(hProcess, createTramp, plan);
     }
 
     countNativeHooks++;
@@ -617,11 +712,18 @@ void * DetourCreateRemote32(void * hProcess, const char* funcName, void * lpFunc
 
 #endif
 
-void * DetourCreateRemote(void * hProcess, const char* funcName, void * lpFuncOrig, void * lpFuncDetour, bool createTramp, DWORD * backupSize)
+void * DetourCreateRemote(void * hProcess, const char* funcName, void * lpFuncOrig, void * lpFuncDetour, bool createTramp, DWORD * backupSize, const HookPlanEntry * plan)
 {
-    BYTE originalBytes[50] = { 0 };
+    BYTE precedingBytes[hotPatchMaxPreceding + 50] = { 0 };
+    BYTE * originalBytes = precedingBytes + hotPatchMaxPreceding;
+    const int originalBytesSize = sizeof(precedingBytes) - hotPatchMaxPreceding;
+    int precedingLen = hotPatchMaxPreceding;
     BYTE tempSpace[1000] = { 0 };
-    PBYTE trampoline = 0;
+    PBYTE allocation = nullptr;
+    PBYTE relay = nullptr;
+    PBYTE detourTarget = nullptr;
+    int paddingJumpLen = 0;
+    HOT_PATCH_PROLOGUE hotPatch = { HotPatchNone, 0, 0 };
     DWORD protect;
 
     bool success = false;
@@ -629,21 +731,43 @@ void * DetourCreateRemote(void * hProcess, const char* funcName, void * lpFuncOr
     if (fatalFindSyscallIndexFailure || fatalAlreadyHookedFailure)
         return nullptr; // Don't spam user with repeated error message boxes
 
-    if (!ReadProcessMemory(hProcess, lpFuncOrig, originalBytes, sizeof(originalBytes), nullptr))
+    if (!ReadProcessMemory(hProcess, lpFuncOrig, originalBytes, originalBytesSize, nullptr))
     {
         MessageBoxA(nullptr, "DetourCreateRemote->ReadProcessMemory failed.", "ScyllaHide", MB_ICONERROR);
         return nullptr;
     }
 
     ClearSyscallBreakpoint(funcName, originalBytes);
+    if (plan != nullptr && !MatchHookPlanEntry(*plan, originalBytes, originalBytesSize))
+        plan = nullptr;
+
+    // The code in front of the function, for a hot patch. A plan has already classified it, only the padding itself is
+    // read to see that it is still there. Otherwise on x64 from the start of the function in front
+    if (plan != nullptr)
+    {
+        precedingLen = plan->HotPatch.PaddingSize;
+    }
+    else
+    {
+#ifdef _WIN64
+        const ULONG_PTR precedingFunction = FindPrecedingFunction(hProcess, (ULONG_PTR)lpFuncOrig);
+        precedingLen = precedingFunction != 0 && (ULONG_PTR)lpFuncOrig - precedingFunction <= hotPatchMaxPreceding ? (int)((ULONG_PTR)lpFuncOrig - precedingFunction) : 0;
+#endif
+    }
+    if (precedingLen != 0 && !ReadProcessMemory(hProcess, (PBYTE)lpFuncOrig - precedingLen, originalBytes - precedingLen, precedingLen, nullptr))
+        precedingLen = 0;
 
     // Note that this check will give a false negative in the case that a function is hooked *and* has a breakpoint set on it (now cleared).
     // We can clear the breakpoint or detect the hook, not both. (If the hook is ours, this is actually a hack because we should be properly unhooking)
 #ifdef _WIN64
-    const bool isHooked = (originalBytes[0] == 0xFF && originalBytes[1] == 0x25) ||
-        (originalBytes[0] == 0x90 && originalBytes[1] == 0xFF && originalBytes[2] == 0x25);
+    // jmp [rip+0] is the absolute jmp written by WriteJumper. Stubs that jmp through an import pointer (jmp [rip+x]) or jmp rel32
+    // somewhere other than one of our relays are not hooks, they are relocated to the trampoline like any other code
+    const bool isHooked = (originalBytes[0] == 0xFF && originalBytes[1] == 0x25 && *(DWORD*)&originalBytes[2] == 0) ||
+        (originalBytes[0] == 0x90 && originalBytes[1] == 0xFF && originalBytes[2] == 0x25) ||
+        (originalBytes[0] == 0xE9 && IsOwnRelayJump(hProcess, (ULONG_PTR)lpFuncOrig, originalBytes)) ||
+        (originalBytes[0] == 0xEB && (INT8)originalBytes[1] < 0);
 #else
-    const bool isHooked = originalBytes[0] == 0xE9;
+    const bool isHooked = originalBytes[0] == 0xE9 || (originalBytes[0] == 0xEB && (INT8)originalBytes[1] < 0);
 #endif
     if (isHooked)
     {
@@ -655,29 +779,109 @@ void * DetourCreateRemote(void * hProcess, const char* funcName, void * lpFuncOr
         return nullptr;
     }
 
-    int detourLen = GetDetourLen(originalBytes, minDetourLen);
-
+    int jumpLen = minDetourLen;
     if (createTramp)
     {
-        *backupSize = detourLen;
-
-        trampoline = (PBYTE)VirtualAllocEx(hProcess, 0, detourLen + minDetourLen, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
-        if (!trampoline)
+#ifdef _WIN64
+        // If the trampoline is within rel32 range, patch a 5 byte jmp to a relay next to it instead of a 15 byte absolute jmp
+        allocation = AllocateRemoteNear(hProcess, (PBYTE)lpFuncOrig, trampolineAllocSize);
+        if (allocation != nullptr && IsRel32Reachable((ULONG_PTR)lpFuncOrig + 5, (ULONG_PTR)allocation + trampolineRelayOffset, LdeDecodeX64))
+        {
+            relay = allocation + trampolineRelayOffset;
+            jumpLen = 5;
+        }
+#endif
+        if (allocation == nullptr)
+            allocation = (PBYTE)VirtualAllocEx(hProcess, nullptr, trampolineAllocSize, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+        if (!allocation)
             return 0;
 
-        WriteProcessMemory(hProcess, trampoline, originalBytes, detourLen, 0);
+        // If there is enough padding in front of the function for the jmp, only a 2 byte short jmp into it has to be written to the entry
+        detourTarget = relay != nullptr ? relay : (PBYTE)lpFuncDetour;
+        paddingJumpLen = IsRel32Reachable((ULONG_PTR)lpFuncOrig, (ULONG_PTR)detourTarget, LdeDecodeX64) ? 5 : minDetourLen - 1;
+        if (plan != nullptr)
+        {
+            if (plan->HotPatch.Type != HotPatchNone && precedingLen >= paddingJumpLen && IsHotPatchPadding(originalBytes - precedingLen, precedingLen))
+            {
+                hotPatch = plan->HotPatch;
+                jumpLen = 2;
+            }
+        }
+        else if (ClassifyHotPatchPrologue(originalBytes, precedingLen, originalBytesSize, LdeDecodeX64, paddingJumpLen, &hotPatch) != HotPatchNone)
+        {
+            jumpLen = 2;
+        }
+    }
 
+    int detourLen;
+    if (hotPatch.Type != HotPatchNone)
+        detourLen = hotPatch.EntrySize;
+    else if (plan != nullptr)
+        detourLen = jumpLen == 5 ? plan->DetourLen : plan->DetourLenAbsolute;
+    else
+        detourLen = GetDetourLen(originalBytes, jumpLen);
+
+    if (createTramp)
+    {
+        // The copy of the original bytes goes first, see RestoreJumper. For a hot patch these are the padding and the
+        // bytes of the short jmp, so that the function can be hooked through its padding again after it has been restored
+        PBYTE trampoline = allocation + trampolineCodeOffset;
         ZeroMemory(tempSpace, sizeof(tempSpace));
-        WriteJumper(trampoline + detourLen, (PBYTE)lpFuncOrig + detourLen, tempSpace, false);
-        WriteProcessMemory(hProcess, trampoline + detourLen, tempSpace, minDetourLen, 0);
-        VirtualProtectEx(hProcess, trampoline, detourLen + minDetourLen, PAGE_EXECUTE_READ, &protect);
+        if (hotPatch.Type != HotPatchNone)
+        {
+            *backupSize = MAKE_BACKUP_SIZE(paddingJumpLen + jumpLen, paddingJumpLen);
+            memcpy(tempSpace, originalBytes - paddingJumpLen, paddingJumpLen + jumpLen);
+        }
+        else
+        {
+            *backupSize = MAKE_BACKUP_SIZE(detourLen, 0);
+            memcpy(tempSpace, originalBytes, detourLen);
+        }
+        if (relay != nullptr)
+            WriteBranch(tempSpace + trampolineRelayOffset, (ULONG_PTR)relay, (ULONG_PTR)lpFuncDetour, BranchJmp, 0, LdeDecodeX64);
+
+        int codeSize = RelocateCode(originalBytes, originalBytesSize, detourLen, (ULONG_PTR)lpFuncOrig, (ULONG_PTR)trampoline,
+            tempSpace + trampolineCodeOffset, trampolineAllocSize - trampolineCodeOffset - 16, LdeDecodeX64);
+        if (codeSize < 0)
+        {
+            VirtualFreeEx(hProcess, allocation, 0, MEM_RELEASE);
+            char errorMessage[256];
+            _snprintf_s(errorMessage, sizeof(errorMessage), sizeof(errorMessage) - sizeof(char),
+                "Error: the start of %hs can not be relocated to a trampoline.", funcName);
+            MessageBoxA(nullptr, errorMessage, "ScyllaHide", MB_ICONERROR);
+            return nullptr;
+        }
+        codeSize += WriteBranch(tempSpace + trampolineCodeOffset + codeSize, (ULONG_PTR)trampoline + codeSize, (ULONG_PTR)lpFuncOrig + detourLen, BranchJmp, 0, LdeDecodeX64);
+
+        WriteProcessMemory(hProcess, allocation, tempSpace, trampolineCodeOffset + codeSize, 0);
+        VirtualProtectEx(hProcess, allocation, trampolineAllocSize, PAGE_EXECUTE_READ, &protect);
     }
 
-    if (VirtualProtectEx(hProcess, lpFuncOrig, detourLen, PAGE_EXECUTE_READWRITE, &protect))
+    if (hotPatch.Type != HotPatchNone)
+    {
+        PBYTE paddingJump = (PBYTE)lpFuncOrig - paddingJumpLen;
+        if (VirtualProtectEx(hProcess, paddingJump, paddingJumpLen + jumpLen, PAGE_EXECUTE_READWRITE, &protect))
+        {
+            // The padding is never executed, so threads only see the hook once the short jmp is written
+            ZeroMemory(tempSpace, sizeof(tempSpace));
+            WriteBranch(tempSpace, (ULONG_PTR)paddingJump, (ULONG_PTR)detourTarget, BranchJmp, 0, LdeDecodeX64);
+            WriteProcessMemory(hProcess, paddingJump, tempSpace, paddingJumpLen, 0);
+
+            const BYTE shortJump[] = { 0xEB, (BYTE)-(paddingJumpLen + 2) };
+            WriteProcessMemory(hProcess, lpFuncOrig, shortJump, sizeof(shortJump), 0);
+
+            VirtualProtectEx(hProcess, paddingJump, paddingJumpLen + jumpLen, protect, &protect);
+            success = true;
+        }
+    }
+    else if (VirtualProtectEx(hProcess, lpFuncOrig, detourLen, PAGE_EXECUTE_READWRITE, &protect))
     {
         ZeroMemory(tempSpace, sizeof(tempSpace));
-        WriteJumper((PBYTE)lpFuncOrig, (PBYTE)lpFuncDetour, tempSpace, scl::IsWindows64() && !scl::IsWow64Process(NtCurrentProcess));
-        WriteProcessMemory(hProcess, lpFuncOrig, tempSpace, minDetourLen, 0);
+        if (relay != nullptr)
+            WriteBranch(tempSpace, (ULONG_PTR)lpFuncOrig, (ULONG_PTR)relay, BranchJmp, 0, LdeDecodeX64);
+        else
+            WriteJumper((PBYTE)lpFuncOrig, (PBYTE)lpFuncDetour, tempSpace, scl::IsWindows64() && !scl::IsWow64Process(NtCurrentProcess));
+        WriteProcessMemory(hProcess, lpFuncOrig, tempSpace, jumpLen, 0);
 
         VirtualProtectEx(hProcess, lpFuncOrig, detourLen, protect, &protect);
         success = true;
@@ -687,10 +891,10 @@ void * DetourCreateRemote(void * hProcess, const char* funcName, void * lpFuncOr
     {
         if (!success)
         {
-            VirtualFree(trampoline, 0, MEM_RELEASE);
-            trampoline = 0;
+            VirtualFreeEx(hProcess, allocation, 0, MEM_RELEASE);
+            return 0;
         }
-        return trampoline;
+        return allocation + trampolineCodeOffset;
     }
     else
     {
@@ -709,13 +913,19 @@ void * DetourCreate(void * lpFuncOrig, void * lpFuncDetour, bool createTramp)
 
     if (createTramp)
     {
-        trampoline = (PBYTE)VirtualAlloc(0, detourLen + minDetourLen, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+        trampoline = (PBYTE)VirtualAlloc(0, trampolineAllocSize, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
         if (!trampoline)
             return 0;
 
-        memcpy(trampoline, lpFuncOrig, detourLen);
-        WriteJumper(trampoline + detourLen, (PBYTE)lpFuncOrig + detourLen);
-        VirtualProtect(trampoline, detourLen + minDetourLen, PAGE_EXECUTE_READ, &protect);
+        int codeSize = RelocateCode((PBYTE)lpFuncOrig, detourLen + MAXIMUM_INSTRUCTION_SIZE, detourLen, (ULONG_PTR)lpFuncOrig, (ULONG_PTR)trampoline,
+            trampoline, trampolineAllocSize - 16, LdeDecodeX64);
+        if (codeSize < 0)
+        {
+            VirtualFree(trampoline, 0, MEM_RELEASE);
+            return 0;
+        }
+        WriteBranch(trampoline + codeSize, (ULONG_PTR)trampoline + codeSize, (ULONG_PTR)lpFuncOrig + detourLen, BranchJmp, 0, LdeDecodeX64);
+        VirtualProtect(trampoline, trampolineAllocSize, PAGE_EXECUTE_READ, &protect);
     }
 
 
@@ -761,6 +971,10 @@ int GetDetourLen(const void * lpStart, const int minSize)
 
 int LengthDisassemble(LPVOID DisassmAddress)
 {
+    const int len = LdeDecode((const BYTE *)DisassmAddress, MAXIMUM_INSTRUCTION_SIZE, LdeDecodeX64, nullptr);
+    if (len > 0)
+        return len;
+
     unsigned int DecodedInstructionsCount = 0;
     _CodeInfo decomposerCi = { 0 };
     _DInst decomposerResult[1] = { 0 };
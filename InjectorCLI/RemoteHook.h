@@ -3,16 +3,26 @@
 
 #define MAXIMUM_INSTRUCTION_SIZE (16) //maximum instruction size == 16
 
+// The backup size DetourCreateRemote returns. The low word is the number of original bytes kept at the start of the
+// trampoline allocation, the high word how many of them belong in front of the function (the padding of a hot patch)
+#define MAKE_BACKUP_SIZE(size, preceding) (((DWORD)(preceding) << 16) | (DWORD)(size))
+#define BACKUP_SIZE_TOTAL(backupSize) LOWORD(backupSize)
+#define BACKUP_SIZE_PRECEDING(backupSize) HIWORD(backupSize)
+
+struct HookPlanEntry;
+
 int GetDetourLen(const void * lpStart, const int minSize);
 void WriteJumper(unsigned char * lpbFrom, unsigned char * lpbTo);
 void * DetourCreate(void * lpFuncOrig, void * lpFuncDetour, bool createTramp);
-void * DetourCreateRemote(void * hProcess, const char* funcName, void * lpFuncOrig, void * lpFuncDetour, bool createTramp, unsigned long * backupSize);
+// plan is the function's entry in the hook plan of its DLL, if there is one. It is only used if the function still holds
+// the planned bytes, otherwise the function is analysed as if there was no plan
+void * DetourCreateRemote(void * hProcess, const char* funcName, void * lpFuncOrig, void * lpFuncDetour, bool createTramp, unsigned long * backupSize, const HookPlanEntry * plan = nullptr);
 
 #ifdef _WIN64
 #define DetourCreateRemoteNative DetourCreateRemote
 #else
-void * DetourCreateRemote32(void * hProcess, const char* funcName, void * lpFuncOrig, void * lpFuncDetour, bool createTramp, unsigned long * backupSize);
-void * DetourCreateRemoteWow64(void * hProcess, bool createTramp);
+void * DetourCreateRemote32(void * hProcess, const char* funcName, void * lpFuncOrig, void * lpFuncDetour, bool createTramp, unsigned long * backupSize, const HookPlanEntry * plan = nullptr);
+void * DetourCreateRemoteWow64(void * hProcess, bool createTramp, const HookPlanEntry * plan = nullptr);
 
 #define DetourCreateRemoteNative DetourCreateRemote32
 #endif
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <windows.h>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+// Logs the OUTPUT_DEBUG_STRING events that are hidden from the debugger. The process handle used to read the strings is
+// opened on the first string of a process and kept until the process exits or the log is reset, and identical strings
+// sent in a row by the same process are logged once, followed by a repeat count when a different string arrives.
+// Processes, memory and the logger are reached through DebugStringOps, so UnitTests can drive it with a fake reader.
+// Handles are only closed by OnProcessExit and Reset, not on destruction, which may come after the logger is gone
+
+struct DebugStringOps
+{
+    HANDLE (*Open)(void* context, DWORD processId);  // For PROCESS_VM_READ, null on failure
+    void (*Close)(void* context, HANDLE process);
+    // Returns the number of bytes read, which may be less than size if the string runs into an unreadable page
+    SIZE_T (*Read)(void* context, HANDLE process, ULONG_PTR address, void* buffer, SIZE_T size);
+    // Converts size bytes of ANSI text to at most maxChars UTF-16 characters. Returns the number of characters written
+    int (*AnsiToWide)(void* context, const char* text, int size, wchar_t* out, int maxChars);
+    // Called with a new string (null terminated, repeats = 0), or with text = null and the number of repeats of the
+    // previous string
+    void (*Log)(void* context, const wchar_t* text, ULONG repeats);
+};
+
+class DebugStringLog
+{
+public:
+    DebugStringLog(const DebugStringOps& ops, void* context)
+        : ops_(ops), context_(context), lastProcessId_(0), lastRepeats_(0)
+    {
+    }
+
+    // lengthInBytes is nDebugStringLength of the event, so the string can never be longer than 64K
+    void OnDebugString(DWORD processId, ULONG_PTR address, WORD lengthInBytes, bool unicode)
+    {
+        const HANDLE process = GetProcessHandle(processId);
+        if (process == nullptr)
+            return;
+
+        buffer_.resize((size_t)lengthInBytes + sizeof(wchar_t));
+        const SIZE_T bytesRead = ops_.Read(context_, process, address, buffer_.data(), lengthInBytes);
+        if (bytesRead == 0)
+            return;
+
+        // The string ends at its terminator or at the last character read, whichever comes first
+        if (unicode)
+        {
+            const size_t maxChars = (size_t)bytesRead / sizeof(wchar_t);
+            text_.resize(maxChars + 1);
+            memcpy(text_.data(), buffer_.data(), maxChars * sizeof(wchar_t));
+            size_t length = 0;
+            while (length < maxChars && text_[length] != 0)
+                length++;
+            text_.resize(length + 1);
+        }
+        else
+        {
+            const char* ansi = buffer_.data();
+            const char* end = (const char*)memchr(ansi, 0, (size_t)bytesRead);
+            const int size = (int)(end != nullptr ? end - ansi : (ptrdiff_t)bytesRead);
+            text_.resize((size_t)size + 1);
+            const int numChars = size != 0 ? ops_.AnsiToWide(context_, ansi, size, text_.data(), size) : 0;
+            text_.resize((size_t)(numChars > 0 ? numChars : 0) + 1);
+        }
+        text_.back() = 0;
+
+        Log(processId);
+    }
+
+    // Flushes the repeat count of the process and closes its handle
+    void OnProcessExit(DWORD processId)
+    {
+        if (processId == lastProcessId_)
+        {
+            FlushRepeats();
+            last_.clear();
+            lastProcessId_ = 0;
+        }
+
+        const auto it = processes_.find(processId);
+        if (it != processes_.end())
+        {
+            ops_.Close(context_, it->second);
+            processes_.erase(it);
+        }
+    }
+
+    // For a new target or a detach: flushes the repeat count and closes all handles
+    void Reset()
+    {
+        FlushRepeats();
+        last_.clear();
+        lastProcessId_ = 0;
+        for (const auto& process : processes_)
+            ops_.Close(context_, process.second);
+        processes_.clear();
+    }
+
+    size_t NumOpenProcesses() const
+    {
+        return processes_.size();
+    }
+
+private:
+    HANDLE GetProcessHandle(DWORD processId)
+    {
+        const auto it = processes_.find(processId);
+        if (it != processes_.end())
+            return it->second;
+
+        const HANDLE process = ops_.Open(context_, processId);
+        if (process != nullptr)
+            processes_[processId] = process;
+        return process;
+    }
+
+    void FlushRepeats()
+    {
+        if (lastRepeats_ != 0)
+        {
+            ops_.Log(context_, nullptr, lastRepeats_);
+            lastRepeats_ = 0;
+        }
+    }
+
+    // text_ holds the new string
+    void Log(DWORD processId)
+    {
+        if (processId == lastProcessId_ && text_.size() == last_.size() &&
+            memcmp(text_.data(), last_.data(), text_.size() * sizeof(wchar_t)) == 0)
+        {
+            lastRepeats_++;
+            return;
+        }
+
+        FlushRepeats();
+        ops_.Log(context_, text_.data(), 0);
+        last_.swap(text_);
+        lastProcessId_ = processId;
+    }
+
+    const DebugStringOps ops_;
+    void* const context_;
+    std::unordered_map<DWORD, HANDLE> processes_;
+    std::vector<char> buffer_;
+    std::vector<wchar_t> text_;
+    std::vector<wchar_t> last_;     // Terminated, empty if there is no previous string
+    DWORD lastProcessId_;
+    ULONG lastRepeats_;
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <ntdll/ntdll.h>
+#include <Scylla/Settings.h>
+
+// Decides which debug events HookedWaitForDebugEvent hides from the debugger. Exception storms go through here once
+// per exception, so the settings are read straight from the profile and the system image ranges are computed once.
+// No Windows calls, so UnitTests can replay debug events through it
+
+// [Start, End) of a mapped image
+struct ImageRange
+{
+    DWORD_PTR Start;
+    DWORD_PTR End;
+};
+
+// Reads SizeOfImage from the PE headers of a mapped image, which is at the same offset for PE32 and PE32+.
+// Returns an empty range for null
+inline ImageRange GetImageRange(const void* imageBase)
+{
+    ImageRange range = { 0, 0 };
+    if (imageBase != nullptr)
+    {
+        const IMAGE_DOS_HEADER* pDos = (const IMAGE_DOS_HEADER*)imageBase;
+        const IMAGE_NT_HEADERS* pNt = (const IMAGE_NT_HEADERS*)((const BYTE*)imageBase + pDos->e_lfanew);
+        range.Start = (DWORD_PTR)imageBase;
+        range.End = range.Start + pNt->OptionalHeader.SizeOfImage;
+    }
+    return range;
+}
+
+// The first byte of an image is its DOS header, never code, so it is not counted
+inline bool IsInsideImageRange(const ImageRange& range, DWORD_PTR address)
+{
+    return address > range.Start && address < range.End;
+}
+
+enum ExceptionAction
+{
+    ExceptionActionLog,             // Log and pass the exception to the debuggee
+    ExceptionActionCheckBreakpoint  // Same, but only if it is not a user or system breakpoint
+};
+
+struct ExceptionPolicy
+{
+    DWORD ExceptionCode;
+    BOOL scl::Settings::Profile::* Setting;
+    ExceptionAction Action;
+    const wchar_t* Name;
+};
+
+// Exceptions that are hidden from the debugger when their setting is enabled
+static const ExceptionPolicy ExceptionPolicies[] =
+{
+    { (DWORD)STATUS_ILLEGAL_INSTRUCTION, &scl::Settings::Profile::handleExceptionIllegalInstruction, ExceptionActionLog, L"Illegal Instruction" },
+    { (DWORD)STATUS_INVALID_LOCK_SEQUENCE, &scl::Settings::Profile::handleExceptionInvalidLockSequence, ExceptionActionLog, L"Invalid Lock Sequence" },
+    { (DWORD)STATUS_NONCONTINUABLE_EXCEPTION, &scl::Settings::Profile::handleExceptionNoncontinuableException, ExceptionActionLog, L"Non-continuable Exception" },
+    { (DWORD)STATUS_ASSERTION_FAILURE, &scl::Settings::Profile::handleExceptionAssertionFailure, ExceptionActionLog, L"Assertion Failure" },
+#ifdef OLLY1 // This may or may not be needed for Olly v2, but we don't have IsAddressBreakPoint() there
+    { (DWORD)STATUS_BREAKPOINT, &scl::Settings::Profile::handleExceptionBreakpoint, ExceptionActionCheckBreakpoint, L"Breakpoint" },
+    { (DWORD)STATUS_WX86_BREAKPOINT, &scl::Settings::Profile::handleExceptionWx86Breakpoint, ExceptionActionCheckBreakpoint, L"Wx86 Breakpoint" },
+#endif
+    { (DWORD)STATUS_GUARD_PAGE_VIOLATION, &scl::Settings::Profile::handleExceptionGuardPageViolation, ExceptionActionLog, L"Guard Page Violation" },
+};
+
+// With seven entries a linear scan costs the same as an open-addressed map (see UnitTests/ExceptionPolicyBench.cpp)
+inline const ExceptionPolicy* FindExceptionPolicy(DWORD exceptionCode)
+{
+    for (size_t i = 0; i < _countof(ExceptionPolicies); i++)
+    {
+        if (ExceptionPolicies[i].ExceptionCode == exceptionCode)
+            return &ExceptionPolicies[i];
+    }
+    return nullptr;
+}
+
+// Returns the policy of an exception the profile hides from the debugger, or null if the debugger gets it.
+// A breakpoint is left to the debugger if isAddressBreakpoint (the debugger's own, may be null) knows it or it is
+// inside one of the system images, where the loader raises the system breakpoint
+inline const ExceptionPolicy* GetHiddenExceptionPolicy(const scl::Settings::Profile& profile, DWORD exceptionCode, DWORD_PTR exceptionAddress,
+    bool (*isAddressBreakpoint)(DWORD_PTR address), const ImageRange* systemImages, size_t numSystemImages)
+{
+    const ExceptionPolicy* policy = FindExceptionPolicy(exceptionCode);
+    if (policy == nullptr || profile.*policy->Setting == 0)
+        return nullptr;
+
+    if (policy->Action == ExceptionActionCheckBreakpoint)
+    {
+        if (isAddressBreakpoint != nullptr && isAddressBreakpoint(exceptionAddress))
+            return nullptr;
+        for (size_t i = 0; i < numSystemImages; i++)
+        {
+            if (IsInsideImageRange(systemImages[i], exceptionAddress))
+                return nullptr;
+        }
+    }
+    return policy;
+}
@@ -662,6 +662,8 @@ void FillHookDllData(HANDLE hProcess, HOOK_DLL_DATA *hdd)
     hdd->EnableNtContinueHook = g_settings.opts().hookNtContinue | g_settings.opts().killAntiAttach;
     hdd->EnableKiUserExceptionDispatcherHook = g_settings.opts().hookKiUserExceptionDispatcher;
     hdd->EnableMalwareRunPeUnpacker = g_settings.opts().malwareRunpeUnpacker;
+    wcsncpy_s(hdd->ProtectedProcessNames, g_settings.opts().protectedProcessNames.c_str(), _TRUNCATE);
+    wcsncpy_s(hdd->HiddenObjectTypes, g_settings.opts().hiddenObjectTypes.c_str(), _TRUNCATE);
 
     hdd->isKernel32Hooked = FALSE;
     hdd->isNtdllHooked = FALSE;
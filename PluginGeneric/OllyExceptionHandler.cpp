@@ -2,6 +2,8 @@
 #include <Scylla/Logger.h>
 #include <Scylla/Settings.h>
 
+#include "DebugStringLog.h"
+#include "ExceptionPolicy.h"
 #include "Injector.h"
 #include "..\InjectorCLI\RemoteHook.h"
 
@@ -16,35 +18,55 @@ t_IsAddressBreakpoint _IsAddressBreakpoint = nullptr;
 extern scl::Settings g_settings;
 extern scl::Logger g_log;
 
-char OutputDebugStringBuffer[500] = {0};
+static HANDLE OpenDebugStringProcess(void*, DWORD processId)
+{
+	return OpenProcess(PROCESS_VM_READ, 0, processId);
+}
 
-void handleOutputDebugString( LPDEBUG_EVENT lpDebugEvent )
+static void CloseDebugStringProcess(void*, HANDLE process)
 {
-	if (lpDebugEvent->u.DebugString.nDebugStringLength > 0 && lpDebugEvent->u.DebugString.lpDebugStringData != 0)
-	{
-		HANDLE hProcess = OpenProcess(PROCESS_VM_READ, 0, lpDebugEvent->dwProcessId);
+	CloseHandle(process);
+}
 
-		if (hProcess)
-		{
-			if (lpDebugEvent->u.DebugString.nDebugStringLength < sizeof(OutputDebugStringBuffer))
-			{
-				ZeroMemory(OutputDebugStringBuffer, sizeof(OutputDebugStringBuffer));
-				if (ReadProcessMemory(hProcess, lpDebugEvent->u.DebugString.lpDebugStringData, OutputDebugStringBuffer, lpDebugEvent->u.DebugString.nDebugStringLength, NULL))
-				{
-					g_log.LogInfo(L"Debug String: %S", OutputDebugStringBuffer);
-				}
-			}
-			else
-			{
-                g_log.LogInfo(L"Debug String is too long: %d", lpDebugEvent->u.DebugString.nDebugStringLength);
-			}
-			CloseHandle(hProcess);
-		}
-	}
+static SIZE_T ReadDebugString(void*, HANDLE process, ULONG_PTR address, void* buffer, SIZE_T size)
+{
+	SIZE_T bytesRead = 0;
+	if (!ReadProcessMemory(process, (LPCVOID)address, buffer, size, &bytesRead) && bytesRead == 0)
+		return 0;
+	return bytesRead;
+}
+
+static int DebugStringAnsiToWide(void*, const char* text, int size, wchar_t* out, int maxChars)
+{
+	return MultiByteToWideChar(CP_ACP, 0, text, size, out, maxChars);
+}
+
+static void LogDebugString(void*, const wchar_t* text, ULONG repeats)
+{
+	if (text != nullptr)
+		g_log.LogInfo(L"Debug String: %s", text);
 	else
+		g_log.LogInfo(L"Debug String repeated x%u", repeats);
+}
+
+static const DebugStringOps DebugStringLogOps = { OpenDebugStringProcess, CloseDebugStringProcess, ReadDebugString, DebugStringAnsiToWide, LogDebugString };
+static DebugStringLog DebugStrings(DebugStringLogOps, nullptr);
+
+void ResetDebugStringLog()
+{
+	DebugStrings.Reset();
+}
+
+void handleOutputDebugString( LPDEBUG_EVENT lpDebugEvent )
+{
+	const OUTPUT_DEBUG_STRING_INFO& info = lpDebugEvent->u.DebugString;
+	if (info.nDebugStringLength == 0 || info.lpDebugStringData == nullptr)
 	{
-        g_log.LogInfo(L"Detected possible Anti-Debug method - OUTPUT_DEBUG_STRING");
+		g_log.LogInfo(L"Detected possible Anti-Debug method - OUTPUT_DEBUG_STRING");
+		return;
 	}
+
+	DebugStrings.OnDebugString(lpDebugEvent->dwProcessId, (ULONG_PTR)info.lpDebugStringData, info.nDebugStringLength, info.fUnicode != 0);
 }
 
 void handleRipEvent( LPDEBUG_EVENT lpDebugEvent )
@@ -74,95 +96,45 @@ void handleRipEvent( LPDEBUG_EVENT lpDebugEvent )
 
 }
 
-DWORD_PTR hNtdll = 0;
-DWORD_PTR hKernel = 0;
-
-bool IsInsideKernelOrNtdll( DWORD_PTR address )
-{
-	PIMAGE_DOS_HEADER pDos = (PIMAGE_DOS_HEADER)hNtdll;
-	PIMAGE_NT_HEADERS pNt = (PIMAGE_NT_HEADERS)((DWORD_PTR)pDos + pDos->e_lfanew);
-
-	DWORD imageSizeNtdll = pNt->OptionalHeader.SizeOfImage;
-
-	pDos = (PIMAGE_DOS_HEADER)hKernel;
-	pNt = (PIMAGE_NT_HEADERS)((DWORD_PTR)pDos + pDos->e_lfanew);
-
-	DWORD imageSizeKernel = pNt->OptionalHeader.SizeOfImage;
-
-	return (address > hNtdll && address < (hNtdll + imageSizeNtdll)) ||
-			(address > hKernel && address < (hKernel + imageSizeKernel));
-}
+// Image ranges of ntdll and kernel32, read once from their PE headers when the debug loop is hooked
+static ImageRange SystemImages[2] = {};
 
 bool AnalyzeDebugStructure( LPDEBUG_EVENT lpDebugEvent )
 {
-    if (g_settings.opts().handleExceptionPrint != 0 && lpDebugEvent->dwDebugEventCode == OUTPUT_DEBUG_STRING_EVENT)
+	switch (lpDebugEvent->dwDebugEventCode)
 	{
+	case OUTPUT_DEBUG_STRING_EVENT:
+		if (g_settings.opts().handleExceptionPrint == 0)
+			return false;
 		handleOutputDebugString(lpDebugEvent);
 		return true;
-	}
 
-    if (g_settings.opts().handleExceptionRip != 0 && lpDebugEvent->dwDebugEventCode == RIP_EVENT)
-	{
+	case RIP_EVENT:
+		if (g_settings.opts().handleExceptionRip == 0)
+			return false;
 		handleRipEvent(lpDebugEvent);
 		return true;
+
+	case EXCEPTION_DEBUG_EVENT:
+		break;
+
+	default:
+		return false;
 	}
 
-    if (lpDebugEvent->dwDebugEventCode == EXCEPTION_DEBUG_EVENT)
-	{
-        if (g_settings.opts().handleExceptionIllegalInstruction != 0 && lpDebugEvent->u.Exception.ExceptionRecord.ExceptionCode == STATUS_ILLEGAL_INSTRUCTION)
-		{
-            g_log.LogInfo(L"Illegal Instruction %p", lpDebugEvent->u.Exception.ExceptionRecord.ExceptionAddress);
-			return true;
-		}
-        if (g_settings.opts().handleExceptionInvalidLockSequence != 0 && lpDebugEvent->u.Exception.ExceptionRecord.ExceptionCode == STATUS_INVALID_LOCK_SEQUENCE)
-		{
-            g_log.LogInfo(L"Invalid Lock Sequence %p", lpDebugEvent->u.Exception.ExceptionRecord.ExceptionAddress);
-			return true;
-		}
-        if (g_settings.opts().handleExceptionNoncontinuableException != 0 && lpDebugEvent->u.Exception.ExceptionRecord.ExceptionCode == STATUS_NONCONTINUABLE_EXCEPTION)
-		{
-            g_log.LogInfo(L"Non-continuable Exception %p", lpDebugEvent->u.Exception.ExceptionRecord.ExceptionAddress);
-			return true;
-		}
-        if (g_settings.opts().handleExceptionAssertionFailure != 0 && lpDebugEvent->u.Exception.ExceptionRecord.ExceptionCode == STATUS_ASSERTION_FAILURE)
-		{
-            g_log.LogInfo(L"Assertion Failure %p", lpDebugEvent->u.Exception.ExceptionRecord.ExceptionAddress);
-			return true;
-		}
-#ifdef OLLY1 // This may or may not be needed for Olly v2, but we don't have IsAddressBreakPoint() there
-        if (g_settings.opts().handleExceptionBreakpoint != 0 && lpDebugEvent->u.Exception.ExceptionRecord.ExceptionCode == STATUS_BREAKPOINT)
-		{
-			if (_IsAddressBreakpoint((DWORD_PTR)lpDebugEvent->u.Exception.ExceptionRecord.ExceptionAddress) == false)
-			{
-				//system breakpoint?
-				if (!IsInsideKernelOrNtdll((DWORD_PTR)lpDebugEvent->u.Exception.ExceptionRecord.ExceptionAddress))
-				{
-                    g_log.LogInfo(L"Breakpoint %p", lpDebugEvent->u.Exception.ExceptionRecord.ExceptionAddress);
-					return true;
-				}
-			}
-		}
-        else if (g_settings.opts().handleExceptionWx86Breakpoint != 0 && lpDebugEvent->u.Exception.ExceptionRecord.ExceptionCode == STATUS_WX86_BREAKPOINT)
-		{
-			if (_IsAddressBreakpoint((DWORD_PTR)lpDebugEvent->u.Exception.ExceptionRecord.ExceptionAddress) == false)
-			{
-				//system breakpoint?
-				if (!IsInsideKernelOrNtdll((DWORD_PTR)lpDebugEvent->u.Exception.ExceptionRecord.ExceptionAddress))
-				{
-                    g_log.LogInfo(L"Wx86 Breakpoint %p", lpDebugEvent->u.Exception.ExceptionRecord.ExceptionAddress);
-					return true;
-				}
-			}
-		}
+	const EXCEPTION_RECORD& record = lpDebugEvent->u.Exception.ExceptionRecord;
+#ifdef OLLY1
+	bool (*isAddressBreakpoint)(DWORD_PTR address) = _IsAddressBreakpoint;
+#else
+	bool (*isAddressBreakpoint)(DWORD_PTR address) = nullptr;
 #endif
-        else if (g_settings.opts().handleExceptionGuardPageViolation != 0 && lpDebugEvent->u.Exception.ExceptionRecord.ExceptionCode == STATUS_GUARD_PAGE_VIOLATION)
-		{
-            g_log.LogInfo(L"Guard Page Violation %p", lpDebugEvent->u.Exception.ExceptionRecord.ExceptionAddress);
-			return true;
-		}
-	}
+	const ExceptionPolicy* policy = GetHiddenExceptionPolicy(g_settings.opts(), record.ExceptionCode, (DWORD_PTR)record.ExceptionAddress,
+		isAddressBreakpoint, SystemImages, _countof(SystemImages));
+	if (policy == nullptr)
+		return false;
 
-	return false;
+	g_log.LogInfo(L"%s %p", policy->Name, record.ExceptionAddress);
+	return true;
 }
 
 BOOL WINAPI HookedWaitForDebugEvent(LPDEBUG_EVENT lpDebugEvent, DWORD dwMilliseconds)
@@ -173,6 +145,9 @@ BOOL WINAPI HookedWaitForDebugEvent(LPDEBUG_EVENT lpDebugEvent, DWORD dwMillisec
 	{
 		while(1)
 		{
+			if (lpDebugEvent->dwDebugEventCode == EXIT_PROCESS_DEBUG_EVENT)
+				DebugStrings.OnProcessExit(lpDebugEvent->dwProcessId);
+
 			if (AnalyzeDebugStructure(lpDebugEvent))
 			{
 				ContinueDebugEvent(lpDebugEvent->dwProcessId, lpDebugEvent->dwThreadId, DBG_EXCEPTION_NOT_HANDLED);
@@ -195,8 +170,8 @@ BOOL WINAPI HookedWaitForDebugEvent(LPDEBUG_EVENT lpDebugEvent, DWORD dwMillisec
 
 void HookDebugLoop()
 {
-	hNtdll = (DWORD_PTR)GetModuleHandleW(L"ntdll.dll");
-	hKernel = (DWORD_PTR)GetModuleHandleW(L"kernel32.dll");
+	SystemImages[0] = GetImageRange(GetModuleHandleW(L"ntdll.dll"));
+	SystemImages[1] = GetImageRange(GetModuleHandleW(L"kernel32.dll"));
 
 	BYTE * WaitForIt = (BYTE *)GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "WaitForDebugEvent");
 
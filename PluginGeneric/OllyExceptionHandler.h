@@ -7,3 +7,6 @@ typedef BOOL (WINAPI *t_WaitForDebugEvent)(LPDEBUG_EVENT lpDebugEvent,DWORD dwMi
 BOOL WINAPI HookedWaitForDebugEvent(LPDEBUG_EVENT lpDebugEvent,DWORD dwMilliseconds);
 
 void HookDebugLoop();
+
+// Flushes the pending repeat count of the debug string log and closes its process handles, for a new target or a detach
+void ResetDebugStringLog();
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <windows.h>
+#include <unordered_map>
+
+// The per process hook state machine of ProcessHookTracker.h, without HookMain.h so that UnitTests can replay
+// debug event scripts through it.
+// OnDebugEvent() has no side effects: it advances the state of the event's process and returns the
+// actions the plugin has to carry out, so the same transitions serve the Generic and TitanEngine plugins.
+
+enum class ProcessHookState
+{
+    Created,        // CREATE_PROCESS_DEBUG_EVENT seen, nothing injected yet
+    NtdllLoaded,    // ntdll was mapped, waiting for the system breakpoint
+    Hooked,         // Hooks injected
+    RehookPending,  // A DLL was loaded after hooking, hooks must be applied to it
+    Exited          // EXIT_PROCESS_DEBUG_EVENT seen, the entry is removed after this event
+};
+
+enum ProcessHookAction : unsigned int
+{
+    ProcessHookActionNone = 0,
+    ProcessHookActionUndoPebFix = 1 << 0,       // StartFixBeingDebugged(pid, false)
+    ProcessHookActionApplyPebFix = 1 << 1,      // StartFixBeingDebugged(pid, true)
+    ProcessHookActionAntiAntiAttach = 1 << 2,   // ApplyAntiAntiAttach(pid)
+    ProcessHookActionInject = 1 << 3,           // ReadNtApiInformation + startInjection(..., true)
+    ProcessHookActionReinject = 1 << 4,         // startInjection(..., false)
+};
+
+// THookData is what the plugin keeps per process for the injection, HOOK_DLL_DATA in ProcessHookTracker.h
+template<typename THookData>
+struct BasicProcessHookStatus
+{
+    BasicProcessHookStatus()
+        : State(ProcessHookState::Created),
+        specialPebFix(false)
+    {
+        ZeroMemory(&hdd, sizeof(hdd));
+    }
+
+    ProcessHookState State;
+    bool specialPebFix;
+    THookData hdd;
+};
+
+template<typename THookData>
+class BasicProcessHookTracker
+{
+public:
+    // ntdllBase is the debugger's ntdll, which is mapped at the same address in every process.
+    // fixPebHeapFlags enables the PEB fix around the ntdll load event
+    unsigned int OnDebugEvent(const DEBUG_EVENT& debugEvent, const void* ntdllBase, bool fixPebHeapFlags)
+    {
+        BasicProcessHookStatus<THookData>& status = processes_[debugEvent.dwProcessId];
+        unsigned int actions = ProcessHookActionNone;
+
+        // The special PEB fix only needs to cover the ntdll load event, undo it on the next one
+        if (status.specialPebFix)
+        {
+            actions |= ProcessHookActionUndoPebFix;
+            status.specialPebFix = false;
+        }
+
+        switch (debugEvent.dwDebugEventCode)
+        {
+        case CREATE_PROCESS_DEBUG_EVENT:
+        {
+            status = BasicProcessHookStatus<THookData>();
+            if (debugEvent.u.CreateProcessInfo.lpStartAddress == nullptr) // Attach
+                actions |= ProcessHookActionAntiAntiAttach;
+            break;
+        }
+
+        case LOAD_DLL_DEBUG_EVENT:
+        {
+            if (debugEvent.u.LoadDll.lpBaseOfDll == ntdllBase)
+            {
+                if (fixPebHeapFlags)
+                {
+                    actions |= ProcessHookActionApplyPebFix;
+                    status.specialPebFix = true;
+                }
+                if (status.State == ProcessHookState::Created)
+                    status.State = ProcessHookState::NtdllLoaded;
+            }
+            else if (status.State == ProcessHookState::Hooked || status.State == ProcessHookState::RehookPending)
+            {
+                actions |= ProcessHookActionReinject;
+                status.State = ProcessHookState::RehookPending;
+            }
+            break;
+        }
+
+        case EXCEPTION_DEBUG_EVENT:
+        {
+            if (debugEvent.u.Exception.ExceptionRecord.ExceptionCode == (DWORD)STATUS_BREAKPOINT &&
+                (status.State == ProcessHookState::Created || status.State == ProcessHookState::NtdllLoaded))
+            {
+                actions |= ProcessHookActionInject;
+                status.State = ProcessHookState::Hooked;
+            }
+            break;
+        }
+
+        case EXIT_PROCESS_DEBUG_EVENT:
+        {
+            // Nothing left to fix in a process that is gone
+            actions = ProcessHookActionNone;
+            status.State = ProcessHookState::Exited;
+            break;
+        }
+        }
+
+        return actions;
+    }
+
+    // Call after the actions returned for an event have been carried out
+    void OnActionsDone(DWORD processId)
+    {
+        const auto it = processes_.find(processId);
+        if (it == processes_.end())
+            return;
+
+        if (it->second.State == ProcessHookState::RehookPending)
+            it->second.State = ProcessHookState::Hooked;
+        else if (it->second.State == ProcessHookState::Exited)
+            processes_.erase(it);
+    }
+
+    // Only valid until the next call to OnActionsDone() for the same process
+    BasicProcessHookStatus<THookData>* Find(DWORD processId)
+    {
+        const auto it = processes_.find(processId);
+        return it != processes_.end() ? &it->second : nullptr;
+    }
+
+    void Clear()
+    {
+        processes_.clear();
+    }
+
+private:
+    std::unordered_map<DWORD, BasicProcessHookStatus<THookData>> processes_;
+};
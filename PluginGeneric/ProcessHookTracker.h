@@ -0,0 +1,11 @@
+#pragma once
+
+#include <windows.h>
+#include "ProcessHookState.h"
+#include "..\HookLibrary\HookMain.h"
+
+// Tracks the hook state of every process being debugged, for plugins that only see raw debug events.
+// The state machine is in ProcessHookState.h, each process also gets the HOOK_DLL_DATA its injection uses.
+
+typedef BasicProcessHookStatus<HOOK_DLL_DATA> ProcessHookStatus;
+typedef BasicProcessHookTracker<HOOK_DLL_DATA> ProcessHookTracker;
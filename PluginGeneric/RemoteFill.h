@@ -0,0 +1,41 @@
+#pragma once
+
+#include <windows.h>
+#include <cstring>
+
+// Fills a range of debuggee memory with one byte value without allocating a buffer the size of the range.
+// The range is written in page-aligned chunks from a single pattern page, through whatever write (and optional read)
+// primitive the caller has: WriteProcessMemory, a debugger API, or a fake in a test.
+
+// Both return the number of bytes transferred
+typedef SIZE_T (*t_RemoteWriteMemory)(void* context, ULONG_PTR address, const void* buffer, SIZE_T size);
+typedef SIZE_T (*t_RemoteReadMemory)(void* context, ULONG_PTR address, void* buffer, SIZE_T size);
+
+#define REMOTE_FILL_CHUNK_SIZE 0x1000
+
+// Returns false if a chunk could not be written. If read is not null, chunks that already hold the value are skipped
+inline bool RemoteFillMemory(ULONG_PTR startAddress, SIZE_T size, BYTE value, t_RemoteWriteMemory write, t_RemoteReadMemory read, void* context)
+{
+    BYTE pattern[REMOTE_FILL_CHUNK_SIZE];
+    BYTE current[REMOTE_FILL_CHUNK_SIZE];
+    FillMemory(pattern, sizeof(pattern), value);
+
+    ULONG_PTR address = startAddress;
+    SIZE_T remaining = size;
+    while (remaining != 0)
+    {
+        // Stop at the next chunk boundary, so that no write straddles two pages
+        const SIZE_T toBoundary = REMOTE_FILL_CHUNK_SIZE - (address & (REMOTE_FILL_CHUNK_SIZE - 1));
+        const SIZE_T chunkSize = remaining < toBoundary ? remaining : toBoundary;
+
+        const bool alreadyFilled = read != nullptr &&
+            read(context, address, current, chunkSize) == chunkSize &&
+            memcmp(current, pattern, chunkSize) == 0;
+        if (!alreadyFilled && write(context, address, pattern, chunkSize) != chunkSize)
+            return false;
+
+        address += chunkSize;
+        remaining -= chunkSize;
+    }
+    return true;
+}
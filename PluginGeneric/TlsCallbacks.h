@@ -0,0 +1,112 @@
+#pragma once
+
+#include <windows.h>
+#include <vector>
+#include "RemoteFill.h"
+
+// Finds the TLS callbacks of an image mapped in the debuggee, for PE32 and PE32+ images. Memory is read through
+// whatever read primitive the caller has (see t_RemoteReadMemory in RemoteFill.h), so UnitTests can run it on
+// crafted images. Every header is read and validated separately, and nothing is trusted to lie inside the image.
+
+#define TLS_MAX_CALLBACKS 0x1000    // Stop following a callback array that is not terminated
+#define TLS_CALLBACK_CHUNK 64       // Entries read at a time
+
+inline bool ReadRemoteExact(t_RemoteReadMemory read, void* context, ULONGLONG address, void* buffer, SIZE_T size)
+{
+    // Addresses the reader cannot express, e.g. a PE32+ VA in a 32-bit debugger, are not readable
+    if (address > (ULONG_PTR)-1 || (size != 0 && (ULONG_PTR)-1 - (ULONG_PTR)address < size - 1))
+        return false;
+    return read(context, (ULONG_PTR)address, buffer, size) == size;
+}
+
+// Returns the VA of the TLS callback array of the image, or 0 if it has none. entrySize receives the size of the
+// callback pointers, 4 for PE32 and 8 for PE32+
+inline ULONGLONG ReadTlsCallbackArrayAddress(ULONG_PTR imageBase, t_RemoteReadMemory read, void* context, SIZE_T* entrySize)
+{
+    IMAGE_DOS_HEADER dos;
+    if (!ReadRemoteExact(read, context, imageBase, &dos, sizeof(dos)) || dos.e_magic != IMAGE_DOS_SIGNATURE || dos.e_lfanew <= 0)
+        return 0;
+
+    // Large enough for both, the magic decides which layout the rest is read with
+    IMAGE_NT_HEADERS64 nt64;
+    const ULONGLONG ntAddress = (ULONGLONG)imageBase + dos.e_lfanew;
+    if (!ReadRemoteExact(read, context, ntAddress, &nt64, sizeof(IMAGE_NT_HEADERS32)) || nt64.Signature != IMAGE_NT_SIGNATURE)
+        return 0;
+
+    DWORD sizeOfImage, numberOfRvaAndSizes;
+    IMAGE_DATA_DIRECTORY dir;
+    if (nt64.OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC)
+    {
+        if (!ReadRemoteExact(read, context, ntAddress, &nt64, sizeof(nt64)))
+            return 0;
+        sizeOfImage = nt64.OptionalHeader.SizeOfImage;
+        numberOfRvaAndSizes = nt64.OptionalHeader.NumberOfRvaAndSizes;
+        dir = nt64.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_TLS];
+    }
+    else if (nt64.OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC)
+    {
+        const IMAGE_NT_HEADERS32* nt32 = (const IMAGE_NT_HEADERS32*)&nt64;
+        sizeOfImage = nt32->OptionalHeader.SizeOfImage;
+        numberOfRvaAndSizes = nt32->OptionalHeader.NumberOfRvaAndSizes;
+        dir = nt32->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_TLS];
+    }
+    else
+        return 0;
+
+    if (numberOfRvaAndSizes <= IMAGE_DIRECTORY_ENTRY_TLS || dir.VirtualAddress == 0 || dir.VirtualAddress >= sizeOfImage)
+        return 0;
+
+    const ULONGLONG tlsAddress = (ULONGLONG)imageBase + dir.VirtualAddress;
+    if (nt64.OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC)
+    {
+        IMAGE_TLS_DIRECTORY64 tlsDir;
+        if (!ReadRemoteExact(read, context, tlsAddress, &tlsDir, sizeof(tlsDir)))
+            return 0;
+        *entrySize = sizeof(ULONGLONG);
+        return tlsDir.AddressOfCallBacks;
+    }
+
+    IMAGE_TLS_DIRECTORY32 tlsDir;
+    if (!ReadRemoteExact(read, context, tlsAddress, &tlsDir, sizeof(tlsDir)))
+        return 0;
+    *entrySize = sizeof(DWORD);
+    return tlsDir.AddressOfCallBacks;
+}
+
+// Reads the null terminated callback array of the image into callbacks, in order. Stops early at unreadable memory
+// and after TLS_MAX_CALLBACKS entries
+inline void ReadTlsCallbacks(ULONG_PTR imageBase, t_RemoteReadMemory read, void* context, std::vector<ULONGLONG>& callbacks)
+{
+    callbacks.clear();
+
+    SIZE_T entrySize = 0;
+    const ULONGLONG callbackArray = ReadTlsCallbackArrayAddress(imageBase, read, context, &entrySize);
+    if (callbackArray == 0)
+        return;
+
+    BYTE chunk[TLS_CALLBACK_CHUNK * sizeof(ULONGLONG)];
+    DWORD index = 0;
+    while (index < TLS_MAX_CALLBACKS)
+    {
+        // A chunk may cross into an unreadable page, so fall back to reading one entry at a time
+        const ULONGLONG address = callbackArray + (ULONGLONG)index * entrySize;
+        if (address < callbackArray)
+            return;
+        SIZE_T numRead = TLS_CALLBACK_CHUNK;
+        if (!ReadRemoteExact(read, context, address, chunk, TLS_CALLBACK_CHUNK * entrySize))
+        {
+            if (!ReadRemoteExact(read, context, address, chunk, entrySize))
+                return;
+            numRead = 1;
+        }
+
+        for (SIZE_T i = 0; i < numRead && index < TLS_MAX_CALLBACKS; i++, index++)
+        {
+            ULONGLONG callback = 0;
+            memcpy(&callback, chunk + i * entrySize, entrySize);
+            if (callback == 0)
+                return;
+            callbacks.push_back(callback);
+        }
+    }
+}
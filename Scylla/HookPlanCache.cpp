@@ -0,0 +1,167 @@
+#include "HookPlanCache.h"
+#include "Util.h"
+#include <cstdlib>
+
+const wchar_t scl::HookPlanCache::kFileName[] = L"scylla_hide_hooks.ini";
+
+std::wstring scl::HookPlanCache::GetFilePath()
+{
+    // Next to whichever module this is linked into (plugin DLL or InjectorCLI)
+    HMODULE self = nullptr;
+    GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+        (LPCWSTR)&kFileName, &self);
+
+    auto wstrPath = GetModuleFileNameW(self);
+    wstrPath.resize(wstrPath.find_last_of(L'\\') + 1);
+    return wstrPath + kFileName;
+}
+
+bool scl::HookPlanCache::Open(HMODULE module)
+{
+    static std::map<std::wstring, Section> sections;
+
+    section_ = nullptr;
+    const PIMAGE_NT_HEADERS ntHeaders = module != nullptr ? RtlImageNtHeader(module) : nullptr;
+    if (ntHeaders == nullptr)
+        return false;
+
+    auto moduleName = GetModuleFileNameW(module);
+    moduleName = moduleName.substr(moduleName.find_last_of(L'\\') + 1);
+    if (moduleName.empty())
+        return false;
+
+    // The optional header differs between PE32 and PE32+, but SizeOfHeaders is at the same offset in both
+    const ULONGLONG hash = HashImageHeaders((const BYTE*)module, ntHeaders->OptionalHeader.SizeOfHeaders);
+    if (hash == 0)
+        return false;
+
+    sectionPrefix_ = fmtw(L"%s_%04X_", moduleName.c_str(), ntHeaders->FileHeader.Machine);
+    sectionName_ = sectionPrefix_ + fmtw(L"%016llX", hash);
+
+    const auto it = sections.find(sectionName_);
+    if (it != sections.end())
+    {
+        section_ = &it->second;
+        return true;
+    }
+
+    section_ = &sections[sectionName_];
+
+    std::wstring buf;
+    DWORD ret = 0;
+    while (((DWORD)buf.size() - ret) < 3) {
+        buf.resize(buf.empty() ? MAX_PATH : buf.size() * 2); // Plans are a few KB
+        ret = ::GetPrivateProfileSectionW(sectionName_.c_str(), &buf[0], (DWORD)buf.size(), GetFilePath().c_str());
+    }
+
+    // key=value\0key=value\0\0, all ASCII
+    for (auto data = buf.c_str(); data[0]; data += lstrlenW(data) + 1)
+    {
+        const wchar_t* separator = wcschr(data, L'=');
+        if (separator == nullptr)
+            continue;
+
+        const std::wstring key(data, separator);
+        const std::wstring value(separator + 1);
+        section_->Values[std::string(key.begin(), key.end())] = std::string(value.begin(), value.end());
+    }
+
+    return true;
+}
+
+bool scl::HookPlanCache::Lookup(const std::string& name, std::string* value) const
+{
+    if (section_ == nullptr)
+        return false;
+
+    const auto it = section_->Values.find(name);
+    if (it == section_->Values.end())
+        return false;
+
+    *value = it->second;
+    return true;
+}
+
+void scl::HookPlanCache::Store(const std::string& name, const std::string& value)
+{
+    if (section_ == nullptr)
+        return;
+
+    const auto it = section_->Values.find(name);
+    if (it != section_->Values.end() && it->second == value)
+        return;
+
+    section_->Values[name] = value;
+    section_->Dirty = true;
+}
+
+bool scl::HookPlanCache::Lookup(const std::string& name, ULONG* value) const
+{
+    std::string text;
+    if (!Lookup(name, &text) || text.empty())
+        return false;
+
+    char* end;
+    *value = strtoul(text.c_str(), &end, 16);
+    return *end == '\0';
+}
+
+void scl::HookPlanCache::Store(const std::string& name, ULONG value)
+{
+    const auto text = fmtw(L"%lX", value);
+    Store(name, std::string(text.begin(), text.end()));
+}
+
+void scl::HookPlanCache::Trim(const std::string& prefix, size_t maxValues)
+{
+    if (section_ == nullptr)
+        return;
+
+    auto first = section_->Values.lower_bound(prefix);
+    auto last = first;
+    size_t count = 0;
+    while (last != section_->Values.end() && last->first.compare(0, prefix.size(), prefix) == 0)
+    {
+        ++last;
+        ++count;
+    }
+
+    if (count >= maxValues && count != 0)
+    {
+        section_->Values.erase(first, last);
+        section_->Dirty = true;
+    }
+}
+
+void scl::HookPlanCache::Save()
+{
+    if (section_ == nullptr || !section_->Dirty)
+        return;
+
+    // Only try once per session. If the file can't be written (e.g. a read-only plugin directory), every injection
+    // would otherwise redo the write, and the values are simply found by scanning again next session
+    section_->Dirty = false;
+
+    const auto path = GetFilePath();
+
+    // Other builds of the same DLL are gone once it has been updated
+    for (const auto& name : IniLoadSectionNames(path.c_str()))
+    {
+        if (name != sectionName_ && _wcsnicmp(name.c_str(), sectionPrefix_.c_str(), sectionPrefix_.size()) == 0)
+        {
+            WritePrivateProfileSectionW(name.c_str(), nullptr, path.c_str());
+        }
+    }
+
+    std::wstring data;
+    for (const auto& value : section_->Values)
+    {
+        data.append(value.first.begin(), value.first.end());
+        data.push_back(L'=');
+        data.append(value.second.begin(), value.second.end());
+        data.push_back(L'\0');
+    }
+    data.push_back(L'\0');
+
+    WritePrivateProfileSectionW(sectionName_.c_str(), data.c_str(), path.c_str());
+}
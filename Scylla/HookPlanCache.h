@@ -0,0 +1,82 @@
+#pragma once
+
+#include <windows.h>
+#include <map>
+#include <string>
+
+namespace scl
+{
+    // Values derived from a system DLL image (e.g. the RVAs of syscall stubs that had to be found by scanning its code,
+    // or the hook plans of InjectorCLI/HookPlan.h), kept in scylla_hide_hooks.ini next to the plugin so that they are only
+    // computed once per DLL version. Every image gets its own section, named after its file name, machine and a hash of
+    // its headers, so a Windows Update simply starts a new section. Sections are loaded from disk once per session and
+    // shared by all views
+    class HookPlanCache
+    {
+    public:
+        static const wchar_t kFileName[];
+
+        // FNV-1a of the SizeOfHeaders bytes at image, which differ between builds of a DLL (TimeDateStamp, CheckSum,
+        // section table, ...). ImageBase is left out, the loader writes the actual base into it. This only reads the
+        // headers, so image can be a loaded module or a DLL file. Returns 0 if image is not a PE image of size bytes
+        static ULONGLONG HashImageHeaders(const BYTE* image, SIZE_T size)
+        {
+            IMAGE_DOS_HEADER dos;
+            IMAGE_NT_HEADERS32 nt;
+            if (size < sizeof(dos))
+                return 0;
+            memcpy(&dos, image, sizeof(dos));
+            if (dos.e_magic != IMAGE_DOS_SIGNATURE || dos.e_lfanew < 0 || (SIZE_T)dos.e_lfanew + sizeof(nt) > size)
+                return 0;
+            memcpy(&nt, image + dos.e_lfanew, sizeof(nt));
+            if (nt.Signature != IMAGE_NT_SIGNATURE || nt.OptionalHeader.SizeOfHeaders > size)
+                return 0;
+
+            // ImageBase follows BaseOfData in PE32 and takes its place and its own in PE32+
+            const bool pe32Plus = nt.OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC;
+            const SIZE_T imageBase = dos.e_lfanew + offsetof(IMAGE_NT_HEADERS32, OptionalHeader.BaseOfData) + (pe32Plus ? 0 : sizeof(DWORD));
+            const SIZE_T imageBaseEnd = imageBase + (pe32Plus ? sizeof(ULONGLONG) : sizeof(DWORD));
+
+            ULONGLONG hash = 0xCBF29CE484222325ULL;
+            for (SIZE_T i = 0; i < nt.OptionalHeader.SizeOfHeaders; i++)
+            {
+                if (i >= imageBase && i < imageBaseEnd)
+                    continue;
+                hash = (hash ^ image[i]) * 0x100000001B3ULL;
+            }
+            return hash;
+        }
+
+        // Selects the section of the image of module. Returns false if module is not a valid image
+        bool Open(HMODULE module);
+
+        bool Lookup(const std::string& name, std::string* value) const;
+        void Store(const std::string& name, const std::string& value);
+
+        // Hex numbers
+        bool Lookup(const std::string& name, ULONG* value) const;
+        void Store(const std::string& name, ULONG value);
+
+        // Removes the values whose names start with prefix if there are maxValues or more of them, so that values that
+        // pile up (e.g. a plan for every combination of settings ever used) keep the section below the 32K characters
+        // GetPrivateProfileSection reads
+        void Trim(const std::string& prefix, size_t maxValues);
+
+        // Writes the section back to disk if anything was stored since the last attempt, and removes the sections of older
+        // builds of the same DLL. A failed write is not retried
+        void Save();
+
+    private:
+        struct Section
+        {
+            std::map<std::string, std::string> Values;
+            bool Dirty = false;
+        };
+
+        static std::wstring GetFilePath();
+
+        std::wstring sectionPrefix_; // Name and machine, shared by all builds of the DLL
+        std::wstring sectionName_;
+        Section* section_ = nullptr;
+    };
+}
@@ -97,6 +97,8 @@ void scl::Settings::LoadProfile(const wchar_t *file, const wchar_t *name, Profil
 
     profile->preventThreadCreation = IniLoadNum(file, name, L"PreventThreadCreation", 0);
     profile->protectProcessId = IniLoadNum(file, name, L"ProtectProcessId", 1);
+    profile->protectedProcessNames = IniLoadString(file, name, L"ProtectedProcessNames", L"x96dbg.exe;win32_remote.exe;win64_remote64.exe");
+    profile->hiddenObjectTypes = IniLoadString(file, name, L"HiddenObjectTypes", L"DebugObject;Process;Thread");
     profile->removeDebugPrivileges = IniLoadNum(file, name, L"RemoveDebugPrivileges", 1);
     profile->killAntiAttach = IniLoadNum(file, name, L"KillAntiAttach", 1);
     profile->malwareRunpeUnpacker = IniLoadNum(file, name, L"MalwareRunPeUnpacker", 0);
@@ -173,6 +175,8 @@ bool scl::Settings::SaveProfile(const wchar_t *file, const wchar_t *name, const
     success &= IniSaveNum(file, name, L"PebOsBuildNumber", profile->fixPebOsBuildNumber);
     success &= IniSaveNum(file, name, L"PreventThreadCreation", profile->preventThreadCreation);
     success &= IniSaveNum(file, name, L"ProtectProcessId", profile->protectProcessId);
+    success &= IniSaveString(file, name, L"ProtectedProcessNames", profile->protectedProcessNames.c_str());
+    success &= IniSaveString(file, name, L"HiddenObjectTypes", profile->hiddenObjectTypes.c_str());
     success &= IniSaveNum(file, name, L"RemoveDebugPrivileges", profile->removeDebugPrivileges);
     success &= IniSaveNum(file, name, L"KillAntiAttach", profile->killAntiAttach);
     success &= IniSaveNum(file, name, L"MalwareRunPeUnpacker", profile->malwareRunpeUnpacker);
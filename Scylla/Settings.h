@@ -46,6 +46,8 @@ namespace scl
             BOOL fixPebOsBuildNumber;
             BOOL preventThreadCreation;
             BOOL protectProcessId;
+            std::wstring protectedProcessNames;
+            std::wstring hiddenObjectTypes;
             BOOL removeDebugPrivileges;
             BOOL killAntiAttach;
             BOOL malwareRunpeUnpacker;
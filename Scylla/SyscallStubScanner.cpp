@@ -0,0 +1,96 @@
+#include "SyscallStubScanner.h"
+
+// Checks whether the 'mov eax, <num>' at code[offset] is part of a win32k syscall stub of the given type.
+// On success, stubOffset receives the offset of the first instruction of the stub
+static bool MatchSyscallStub(const UCHAR* code, SIZE_T codeSize, SIZE_T offset,
+	scl::SyscallStubType stubType, SIZE_T& stubOffset)
+{
+	const UCHAR* address = code + offset;
+	const SIZE_T available = codeSize - offset; // Number of bytes that can be read starting at address
+
+	switch (stubType)
+	{
+	case scl::SyscallStubType::X64:
+		// For native x64 syscalls 'mov eax, <num>' is always preceded by 'mov r10, rcx'
+		if (offset >= 3 && address[-3] == 0x4C && address[-2] == 0x8B && address[-1] == 0xD1)
+		{
+			stubOffset = offset - 3; // Backtrack to first mov
+			return true;
+		}
+		break;
+
+	case scl::SyscallStubType::NativeX86:
+		// Native x86, old style: mov edx, 7FFE0300h, call [edx]
+		if (available >= 12 && address[5] == 0xBA && address[6] == 0x00 && address[7] == 0x03 && address[8] == 0xFE &&
+			address[9] == 0x7F && address[10] == 0xFF && address[11] == 0x12)
+		{
+			stubOffset = offset;
+			return true;
+		}
+		// Win 8+ native x86: call leaf_sub, retn X. leaf_sub: mov edx, esp, sysenter, retn
+		if (available >= 11 && address[5] == 0xE8 && address[9] == 0x00 && (address[10] == 0xC2 || address[10] == 0xC3))
+		{
+			for (SIZE_T i = 11; i < 11 + 12 && i < available; ++i)
+			{
+				if (address[i] != 0x8B)
+					continue;
+				if (i + 5 <= available && address[i + 1] == 0xD4 && address[i + 2] == 0x0F &&
+					address[i + 3] == 0x34 && address[i + 4] == 0xC3)
+				{
+					stubOffset = offset;
+					return true;
+				}
+				break;
+			}
+		}
+		break;
+
+	case scl::SyscallStubType::Wow64:
+		if (
+			// Wow64, old style: lea edx, [esp+4] / mov ecx, XXXX, call fs:0C0h
+			(available >= 11 && (address[5] == 0x8D || address[10] == 0x8D) && (address[5] == 0xB9 || address[9] == 0xB9))
+			||
+			// Win 8/8.1 Wow64: call fs:0C0h
+			(available >= 12 && address[5] == 0x64 && address[6] == 0xFF && address[7] == 0x15 && address[8] == 0xC0 &&
+			address[9] == 0x00 && address[10] == 0x00 && address[11] == 0x00)
+			||
+			// Win 10 Wow64: mov edx, offset Wow64SystemServiceCall, call edx, retn
+			(available >= 13 && address[5] == 0xBA && address[10] == 0xFF && address[11] == 0xD2 && (address[12] == 0xC2 || address[12] == 0xC3))
+			)
+		{
+			stubOffset = offset;
+			return true;
+		}
+		break;
+	}
+	return false;
+}
+
+// Scans the code for syscall stubs of all requested indices at once. This only needs to decode the code section once
+// regardless of the number of syscalls, which matters because user32.dll's code section is several megabytes large
+size_t scl::FindSyscallStubs(const UCHAR* code, SIZE_T codeSize, SyscallStubType stubType,
+	std::unordered_map<LONG, SIZE_T>& syscallIndicesAndOffsets)
+{
+	const size_t numIndices = syscallIndicesAndOffsets.size();
+	size_t numFound = 0;
+
+	for (SIZE_T offset = 0; offset + 5 <= codeSize && numFound < numIndices; ++offset)
+	{
+		if (code[offset] != 0xB8) // mov eax, <syscall num>
+			continue;
+
+		// Only the low 16 bits of the immediate are the syscall index
+		const LONG syscallIndex = (LONG)(code[offset + 1] | (code[offset + 2] << 8));
+		const auto it = syscallIndicesAndOffsets.find(syscallIndex);
+		if (it == syscallIndicesAndOffsets.end() || it->second != StubNotFound)
+			continue;
+
+		SIZE_T stubOffset;
+		if (MatchSyscallStub(code, codeSize, offset, stubType, stubOffset))
+		{
+			it->second = stubOffset;
+			++numFound;
+		}
+	}
+	return numFound;
+}
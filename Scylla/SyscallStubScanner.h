@@ -0,0 +1,25 @@
+#pragma once
+
+#include <windows.h>
+#include <unordered_map>
+
+// Finds win32k syscall stubs in the raw code of user32.dll or win32u.dll. This has no dependencies on the running OS,
+// so the code can come from the loaded DLL or from a DLL file read from disk
+namespace scl
+{
+	// Calling convention of the win32k syscall stubs in the scanned code
+	enum class SyscallStubType
+	{
+		X64,		// mov r10, rcx / mov eax, <num> / syscall
+		NativeX86,	// mov eax, <num> / mov edx, 7FFE0300h / call [edx] or call leaf_sub (sysenter)
+		Wow64		// mov eax, <num> / ... / call fs:0C0h or call Wow64SystemServiceCall
+	};
+
+	constexpr SIZE_T StubNotFound = (SIZE_T)-1;
+
+	// Scans raw code bytes once for syscall stubs matching any of the keys in syscallIndicesAndOffsets.
+	// The value of each key that is found is set to the offset of its stub in the code; other values are left unchanged.
+	// Returns the number of indices that were found.
+	size_t FindSyscallStubs(const UCHAR* code, SIZE_T codeSize, SyscallStubType stubType,
+		std::unordered_map<LONG, SIZE_T>& syscallIndicesAndOffsets);
+}
@@ -1,5 +1,7 @@
 #include "User32Loader.h"
 #include "Win32kSyscalls.h"
+#include "HookPlanCache.h"
+#include "SyscallStubScanner.h"
 #include "Scylla/OsInfo.h"
 #include "Scylla/Logger.h"
 
@@ -41,41 +43,93 @@ bool scl::User32Loader::FindSyscalls(const std::vector<std::string>& syscallName
 		return true;
 	}
 
-	// OS is < 14393. Get the syscall indices of the functions that we want the VAs of
-	std::map<std::string, ULONG_PTR> functionNamesAndSyscallNums(FunctionNamesAndVas);
+	// OS is < 14393. The stubs have to be found by scanning the code, unless this build of the DLL was scanned before
+	// The file can be edited or damaged, so cached values must lie inside the image and pass the same check as a scan
+	const PIMAGE_NT_HEADERS NtHeaders = RtlImageNtHeader(Win32kUserDll);
+	const ULONG_PTR BlockInputVa = (ULONG_PTR)GetProcAddress((HMODULE)Win32kUserDll, "BlockInput");
+	if (BlockInputVa == 0)
+		return false;
+
+	HookPlanCache plan;
+	const bool planOpened = plan.Open((HMODULE)Win32kUserDll);
+	bool allCached = planOpened;
+	for (const auto& syscallName : syscallNames)
+	{
+		ULONG stubRva;
+		if (!allCached || !plan.Lookup(syscallName, &stubRva) || stubRva >= NtHeaders->OptionalHeader.SizeOfImage)
+		{
+			allCached = false;
+			break;
+		}
+		FunctionNamesAndVas[syscallName] = (ULONG_PTR)(Win32kUserDll + stubRva);
+	}
+	if (allCached && FunctionNamesAndVas.count("NtUserBlockInput") != 0 && GetUserSyscallVa("NtUserBlockInput") != BlockInputVa)
+	{
+		g_log.LogInfo(L"Cached syscall addresses in %s are stale, rescanning", HookPlanCache::kFileName);
+		allCached = false;
+	}
+	if (allCached)
+		return true;
+	FunctionNamesAndVas.clear();
+
+	// Get the syscall indices of the functions that we want the VAs of
+	std::vector<LONG> syscallIndices;
+	syscallIndices.reserve(syscallNames.size());
+	std::unordered_map<LONG, SIZE_T> syscallIndicesAndOffsets;
 	for (const auto& syscallName : syscallNames)
 	{
 		const LONG syscallNum = GetUserSyscallIndex(syscallName);
 		if (syscallNum == -1)
 			return false;
-		functionNamesAndSyscallNums[syscallName] = (ULONG_PTR)syscallNum;
+		syscallIndices.push_back(syscallNum);
+		syscallIndicesAndOffsets[syscallNum] = StubNotFound;
 	}
 
-	// Find the VAs of the functions we want
-	for (const auto& function : functionNamesAndSyscallNums)
+	// Find the code section. This is normally the first section, but don't rely on it
+	const PIMAGE_SECTION_HEADER sections = IMAGE_FIRST_SECTION(NtHeaders);
+	PIMAGE_SECTION_HEADER codeSection = sections;
+	for (WORD i = 0; i < NtHeaders->FileHeader.NumberOfSections; ++i)
 	{
-		const std::string syscallName = function.first;
-		const ULONG_PTR syscallAddress = FindSyscallByIndex((ULONG)function.second);
-		if (syscallAddress != 0)
+		if ((sections[i].Characteristics & IMAGE_SCN_CNT_CODE) != 0)
 		{
-			FunctionNamesAndVas[syscallName] = syscallAddress;
+			codeSection = &sections[i];
+			break;
 		}
-		else
+	}
+
+#ifdef _WIN64
+	const SyscallStubType stubType = SyscallStubType::X64;
+#else
+	const SyscallStubType stubType = NativeX86 ? SyscallStubType::NativeX86 : SyscallStubType::Wow64;
+#endif
+
+	// Find the VAs of all functions we want in a single pass over the code
+	const PUCHAR code = Win32kUserDll + codeSection->VirtualAddress;
+	FindSyscallStubs(code, codeSection->SizeOfRawData, stubType, syscallIndicesAndOffsets);
+
+	for (size_t i = 0; i < syscallNames.size(); ++i)
+	{
+		const SIZE_T stubOffset = syscallIndicesAndOffsets[syscallIndices[i]];
+		if (stubOffset == StubNotFound)
 		{
 			g_log.LogError(L"Address of syscall %hs with index %u not found",
-				syscallName.c_str(), (ULONG)functionNamesAndSyscallNums[syscallName]);
+				syscallNames[i].c_str(), (ULONG)syscallIndices[i]);
 			return false;
 		}
+		FunctionNamesAndVas[syscallNames[i]] = (ULONG_PTR)(code + stubOffset);
 	}
 
 	// Sanity check the NtUserBlockInput VA as this is an exported syscall
-	const ULONG_PTR BlockInputVa = (ULONG_PTR)GetProcAddress((HMODULE)Win32kUserDll, "BlockInput");
-	if (BlockInputVa == 0)
-		return false;
 	const bool check = GetUserSyscallVa("NtUserBlockInput") == BlockInputVa;
 	if (!check)
 		g_log.LogError(L"GetUserSyscallVa returned incorrect address 0x%p (expected 0x%p)!", GetUserSyscallVa("NtUserBlockInput"), BlockInputVa);
-	
+	else if (planOpened)
+	{
+		for (const auto& syscallName : syscallNames)
+			plan.Store(syscallName, (ULONG)(GetUserSyscallVa(syscallName) - (ULONG_PTR)Win32kUserDll));
+		plan.Save();
+	}
+
 	return check;
 }
 
@@ -106,70 +160,3 @@ LONG scl::User32Loader::GetUserSyscallIndex(const std::string& functionName) con
 	}
 	return -1;
 }
-
-// Scans user32.dll and returns the VA of the function that performs the syscall with the given index
-ULONG_PTR scl::User32Loader::FindSyscallByIndex(LONG win32kSyscallIndex) const
-{
-	const PIMAGE_NT_HEADERS NtHeaders = RtlImageNtHeader(Win32kUserDll);
-	const PIMAGE_SECTION_HEADER codeSection = IMAGE_FIRST_SECTION(NtHeaders);
-	const PUCHAR start = Win32kUserDll + codeSection->VirtualAddress;
-	const PUCHAR end = Win32kUserDll + codeSection->VirtualAddress + codeSection->SizeOfRawData - 16;
-
-	// Find the syscall pattern for this OS + architecture
-	for (PUCHAR address = start; address < end; ++address)
-	{
-		if (address[0] != 0xB8 || (*(PLONG)(address + 1) & 0xFFFF) != win32kSyscallIndex) // mov eax, <syscall num>
-			continue;
-
-		bool isSyscall = false;
-#ifdef _WIN64
-		// For native x64 syscalls 'mov eax, <num>' is always preceded by 'mov r10, rcx'
-		if (address[-3] == 0x4C && address[-2] == 0x8B && address[-1] == 0xD1)
-		{
-			isSyscall = true;
-			address -= 3; // Backtrack to first mov
-		}
-#else
-		if (NativeX86)
-		{
-			// Native x86, old style: mov edx, 7FFE0300h, call [edx]
-			if (address[5] == 0xBA && address[6] == 0x00 && address[7] == 0x03 && address[8] == 0xFE &&
-				address[9] == 0x7F && address[10] == 0xFF && address[11] == 0x12)
-				isSyscall = true;
-			// Win 8+ native x86: call leaf_sub, retn X. leaf_sub: mov edx, esp, sysenter, retn
-			else if (address[5] == 0xE8 && address[9] == 0x00 && (address[10] == 0xC2 || address[10] == 0xC3))
-			{
-				ULONG i = 0;
-				for ( ; i < 12; ++i)
-				{
-					if (address[11 + i] == 0x8B)
-						break;
-				}
-				if (address[11 + i] == 0x8B && address[11 + i + 1] == 0xD4 && address[11 + i + 2] == 0x0F &&
-					address[11 + i + 3] == 0x34 && address[11 + i + 4] == 0xC3)
-					isSyscall = true;
-			}
-		}
-		else
-		{
-			if (
-				// Wow64, old style: lea edx, [esp+4] / mov ecx, XXXX, call fs:0C0h
-				((address[5] == 0x8D || address[10] == 0x8D) && (address[5] == 0xB9 || address[9] == 0xB9))
-				||
-				// Win 8/8.1 Wow64: call fs:0C0h
-				(address[5] == 0x64 && address[6] == 0xFF && address[7] == 0x15 && address[8] == 0xC0 &&
-				address[9] == 0x00 && address[10] == 0x00 && address[11] == 0x00)
-				||
-				// Win 10 Wow64: mov edx, offset Wow64SystemServiceCall, call edx, retn
-				(address[5] == 0xBA && address[10] == 0xFF && address[11] == 0xD2 && (address[12] == 0xC2 || address[12] == 0xC3))
-				)
-			{
-				isSyscall = true;
-			}
-		}
-#endif
-		if (isSyscall)
-			return (ULONG_PTR)address;
-	}
-	return 0;
-}
@@ -19,8 +19,6 @@ namespace scl
 		LONG GetUserSyscallIndex(const std::string& functionName) const;
 
 	private:
-		ULONG_PTR FindSyscallByIndex(LONG win32kSyscallIndex) const;
-
 		const USHORT OsBuildNumber;
 		const bool NativeX86;
 		const PUCHAR Win32kUserDll; // win32u.dll if OsBuildNumber >= 14393, user32.dll otherwise
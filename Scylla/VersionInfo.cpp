@@ -0,0 +1,208 @@
+#include "VersionInfo.h"
+
+// VS_VERSIONINFO is a tree of variable size blocks, each of which looks like this:
+// WORD wLength; WORD wValueLength; WORD wType; WCHAR szKey[]; <pad to 32 bits>; Value; <pad to 32 bits>; Children[]
+// See: https://docs.microsoft.com/en-gb/windows/win32/menurc/vs-versioninfo
+// The root holds a VS_FIXEDFILEINFO, and the strings we want live in StringFileInfo -> StringTable[] -> String[]
+#define VERSION_BLOCK_HEADER_SIZE   (3 * sizeof(WORD))
+#define VERSION_BLOCK_MAX_DEPTH     3 // VS_VERSIONINFO (0) -> StringFileInfo (1) -> StringTable (2) -> String (3)
+#define VERSION_MAX_STRING_CHARS    128
+
+#define ALIGN_VERSION_OFFSET(Offset) (((Offset) + 3) & ~3UL)
+
+typedef struct _VERSION_BLOCK
+{
+    ULONG Offset;           // Offset of the block in the resource
+    ULONG End;              // Offset of the first byte past the block, clamped to the parent
+    WORD ValueLength;       // In bytes for binary values, in WCHARs for text values
+    WORD Type;              // 0 = binary, 1 = text
+    const WCHAR* Key;
+    ULONG KeyLength;        // In WCHARs, excluding the terminator
+    ULONG ValueOffset;
+    ULONG ChildrenOffset;
+} VERSION_BLOCK, *PVERSION_BLOCK;
+
+typedef struct _VERSION_PATCH_CONTEXT
+{
+    PUCHAR Data;
+    WORD BuildNumber;
+    WCHAR BuildNumberString[6]; // Decimal, not null terminated
+    ULONG BuildNumberLength;
+    const WCHAR* const* Properties;
+    ULONG NumProperties;
+    ULONG NumPatched;
+} VERSION_PATCH_CONTEXT, *PVERSION_PATCH_CONTEXT;
+
+static bool ParseVersionBlock(const UCHAR* Data, ULONG Offset, ULONG ParentEnd, PVERSION_BLOCK Block)
+{
+    if (Offset > ParentEnd || ParentEnd - Offset < VERSION_BLOCK_HEADER_SIZE)
+        return false;
+
+    WORD Header[3];
+    RtlCopyMemory(Header, Data + Offset, sizeof(Header));
+    const WORD Length = Header[0];
+    if (Length < VERSION_BLOCK_HEADER_SIZE + sizeof(WCHAR) || Length > ParentEnd - Offset)
+        return false;
+
+    Block->Offset = Offset;
+    Block->End = Offset + Length;
+    Block->ValueLength = Header[1];
+    Block->Type = Header[2];
+    Block->Key = (const WCHAR*)(Data + Offset + VERSION_BLOCK_HEADER_SIZE);
+
+    // The key must be null terminated inside the block
+    const ULONG MaxKeyLength = (Block->End - (Offset + VERSION_BLOCK_HEADER_SIZE)) / sizeof(WCHAR);
+    ULONG KeyLength = 0;
+    while (KeyLength < MaxKeyLength && Block->Key[KeyLength] != L'\0')
+        ++KeyLength;
+    if (KeyLength == MaxKeyLength)
+        return false;
+    Block->KeyLength = KeyLength;
+
+    Block->ValueOffset = ALIGN_VERSION_OFFSET(Offset + VERSION_BLOCK_HEADER_SIZE + (KeyLength + 1) * sizeof(WCHAR));
+    if (Block->ValueOffset > Block->End)
+        return false;
+
+    // Some resource compilers store the length of text values in bytes rather than WCHARs. Clamp it to the block
+    ULONG ValueSize = Block->Type == 1 ? Block->ValueLength * sizeof(WCHAR) : Block->ValueLength;
+    if (ValueSize > Block->End - Block->ValueOffset)
+    {
+        ValueSize = Block->End - Block->ValueOffset;
+        Block->ValueLength = (WORD)(Block->Type == 1 ? ValueSize / sizeof(WCHAR) : ValueSize);
+    }
+    Block->ChildrenOffset = ALIGN_VERSION_OFFSET(Block->ValueOffset + ValueSize);
+    if (Block->ChildrenOffset > Block->End)
+        Block->ChildrenOffset = Block->End;
+    return true;
+}
+
+static bool VersionKeyEquals(const VERSION_BLOCK* Block, const WCHAR* Key)
+{
+    ULONG i = 0;
+    for (; i < Block->KeyLength; ++i)
+    {
+        if (Key[i] == L'\0' || Key[i] != Block->Key[i])
+            return false;
+    }
+    return Key[i] == L'\0';
+}
+
+static void PatchFixedFileInfoVersion(PVERSION_PATCH_CONTEXT Context, const VERSION_BLOCK* Block)
+{
+    VS_FIXEDFILEINFO FixedFileInfo;
+    if (Block->ValueLength < sizeof(FixedFileInfo))
+        return;
+    RtlCopyMemory(&FixedFileInfo, Context->Data + Block->ValueOffset, sizeof(FixedFileInfo));
+    if (FixedFileInfo.dwSignature != 0xFEEF04BD) // VS_FIXEDFILEINFO signature
+        return;
+
+    // Replace the build numbers (high word of the LS DWORDs) of the file and product version
+    FixedFileInfo.dwFileVersionLS = MAKELONG(LOWORD(FixedFileInfo.dwFileVersionLS), Context->BuildNumber);
+    FixedFileInfo.dwProductVersionLS = MAKELONG(LOWORD(FixedFileInfo.dwProductVersionLS), Context->BuildNumber);
+    RtlCopyMemory(Context->Data + Block->ValueOffset, &FixedFileInfo, sizeof(FixedFileInfo));
+    Context->NumPatched++;
+}
+
+static void PatchVersionString(PVERSION_PATCH_CONTEXT Context, const VERSION_BLOCK* Block)
+{
+    if (Block->Type != 1 || Block->ValueLength == 0 || Block->ValueLength > VERSION_MAX_STRING_CHARS)
+        return;
+
+    const WCHAR* Value = (const WCHAR*)(Context->Data + Block->ValueOffset);
+    const ULONG ValueLength = Block->ValueLength;
+
+    // The value is e.g. 6.1.xxxx.yyyy or 10.0.xxxxx.yyyy (WinBuild.zzz). Find the build number xxxx after the second dot
+    ULONG BuildStart = 0, NumDots = 0;
+    while (BuildStart < ValueLength && Value[BuildStart] != L'\0' && NumDots < 2)
+    {
+        if (Value[BuildStart++] == L'.')
+            NumDots++;
+    }
+    ULONG BuildEnd = BuildStart;
+    while (BuildEnd < ValueLength && Value[BuildEnd] >= L'0' && Value[BuildEnd] <= L'9')
+        ++BuildEnd;
+    ULONG TailEnd = BuildEnd;
+    while (TailEnd < ValueLength && Value[TailEnd] != L'\0')
+        ++TailEnd;
+    if (NumDots != 2 || BuildEnd == BuildStart)
+        return;
+
+    // Rebuild the string with the fake build number. The new string must fit in the existing value
+    WCHAR NewValue[VERSION_MAX_STRING_CHARS];
+    const ULONG NewLength = BuildStart + Context->BuildNumberLength + (TailEnd - BuildEnd);
+    if (NewLength + 1 > ValueLength)
+        return;
+    RtlCopyMemory(NewValue, Value, BuildStart * sizeof(WCHAR));
+    RtlCopyMemory(NewValue + BuildStart, Context->BuildNumberString, Context->BuildNumberLength * sizeof(WCHAR));
+    RtlCopyMemory(NewValue + BuildStart + Context->BuildNumberLength, Value + BuildEnd, (TailEnd - BuildEnd) * sizeof(WCHAR));
+    RtlZeroMemory(NewValue + NewLength, (ValueLength - NewLength) * sizeof(WCHAR)); // Terminator + padding for shorter strings
+
+    // Overwrite the string in place. The block size stays the same, only the value length is adjusted
+    RtlCopyMemory(Context->Data + Block->ValueOffset, NewValue, ValueLength * sizeof(WCHAR));
+    const WORD NewValueLength = (WORD)(NewLength + 1);
+    RtlCopyMemory(Context->Data + Block->Offset + sizeof(WORD), &NewValueLength, sizeof(NewValueLength));
+    Context->NumPatched++;
+}
+
+static void WalkVersionBlock(PVERSION_PATCH_CONTEXT Context, ULONG Offset, ULONG ParentEnd, ULONG Depth)
+{
+    VERSION_BLOCK Block;
+    if (!ParseVersionBlock(Context->Data, Offset, ParentEnd, &Block))
+        return;
+
+    switch (Depth)
+    {
+    case 0: // VS_VERSIONINFO
+        if (!VersionKeyEquals(&Block, L"VS_VERSION_INFO"))
+            return;
+        PatchFixedFileInfoVersion(Context, &Block);
+        break;
+    case 1: // StringFileInfo or VarFileInfo. The latter contains only the translation table
+        if (!VersionKeyEquals(&Block, L"StringFileInfo"))
+            return;
+        break;
+    case 2: // StringTable
+        break;
+    case 3: // String
+        for (ULONG i = 0; i < Context->NumProperties; ++i)
+        {
+            if (VersionKeyEquals(&Block, Context->Properties[i]))
+            {
+                PatchVersionString(Context, &Block);
+                break;
+            }
+        }
+        return;
+    }
+
+    // Visit the children. Each child starts at a 32 bit aligned offset
+    ULONG ChildOffset = Block.ChildrenOffset;
+    while (ChildOffset < Block.End && Depth < VERSION_BLOCK_MAX_DEPTH)
+    {
+        WORD ChildLength = 0;
+        if (Block.End - ChildOffset >= sizeof(WORD))
+            RtlCopyMemory(&ChildLength, Context->Data + ChildOffset, sizeof(ChildLength));
+        if (ChildLength == 0)
+            break;
+        WalkVersionBlock(Context, ChildOffset, Block.End, Depth + 1);
+        ChildOffset = ALIGN_VERSION_OFFSET(ChildOffset + ChildLength);
+    }
+}
+
+ULONG PatchVersionInfoBuildNumber(PUCHAR Data, ULONG Size, WORD BuildNumber, const WCHAR* const* Properties, ULONG NumProperties)
+{
+    VERSION_PATCH_CONTEXT Context = { Data, BuildNumber, {}, 0, Properties, NumProperties, 0 };
+
+    WCHAR Digits[ARRAYSIZE(Context.BuildNumberString)];
+    ULONG NumDigits = 0;
+    do
+    {
+        Digits[NumDigits++] = (WCHAR)(L'0' + BuildNumber % 10);
+        BuildNumber /= 10;
+    } while (BuildNumber != 0);
+    while (NumDigits > 0)
+        Context.BuildNumberString[Context.BuildNumberLength++] = Digits[--NumDigits];
+
+    WalkVersionBlock(&Context, 0, Size, 0);
+    return Context.NumPatched;
+}
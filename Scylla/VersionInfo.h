@@ -0,0 +1,7 @@
+#pragma once
+#include <windows.h>
+
+// Replaces the build number in a raw VS_VERSIONINFO resource: in the VS_FIXEDFILEINFO file and product versions,
+// and after the second dot of the String values named in Properties (e.g. L"FileVersion"). The resource is patched
+// in place without changing its size. Returns the number of fields patched, counting the fixed file info as one
+ULONG PatchVersionInfoBuildNumber(PUCHAR Data, ULONG Size, WORD BuildNumber, const WCHAR* const* Properties, ULONG NumProperties);
@@ -1,8 +1,5 @@
 #include "VersionPatch.h"
-
-#define STR(x) #x
-#define VERSTR(x) STR(x)
-#define FAKE_VERSION_WCHAR L"" VERSTR(FAKE_VERSION)
+#include "VersionInfo.h"
 
 bool NtVirtualProtect(HANDLE hProcess, PVOID Address, SIZE_T Size, ULONG NewProtect, PULONG OldProtect)
 {
@@ -11,83 +8,6 @@ bool NtVirtualProtect(HANDLE hProcess, PVOID Address, SIZE_T Size, ULONG NewProt
     return NT_SUCCESS(NtProtectVirtualMemory(hProcess, &BaseAddress, &RegionSize, NewProtect, OldProtect));
 }
 
-void PatchFixedFileInfoVersion(HANDLE hProcess, PVOID Address, ULONG Size)
-{
-    BOOL found = FALSE;
-    PUCHAR P;
-    for (P = (PUCHAR)Address; P < (PUCHAR)Address + Size; ++P)
-    {
-        if (*(PDWORD)P == 0xFEEF04BD) // VS_FIXEDFILEINFO signature
-        {
-            found = TRUE;
-            break;
-        }
-    }
-    if (!found)
-    {
-        DbgPrint("Failed to find fixed version info signature in ntdll.dll VS_VERSION_INFO");
-        return;
-    }
-
-    P += 14; // Skip to FileVersion build number
-    ULONG OldProtect;
-    if (NtVirtualProtect(hProcess, P, 10, PAGE_READWRITE, &OldProtect))
-    {
-        WORD Version = FAKE_VERSION;
-        NtWriteVirtualMemory(hProcess, P, &Version, 2, nullptr); // FileVersion
-        NtWriteVirtualMemory(hProcess, P + 8, &Version, 2, nullptr); // ProductVersion
-        NtVirtualProtect(hProcess, P, 10, OldProtect, &OldProtect);
-    }
-    else
-    {
-        DbgPrint("VirtualProtectEx failed on ntdll");
-    }
-}
-
-void PatchVersionString(HANDLE hProcess, PVOID Address, ULONG Size, const WCHAR* Property)
-{
-    // VS_VERSIONINFO is a mess to navigate because it is a nested struct of variable size with (grand)children all of variable sizes
-    // See: https://docs.microsoft.com/en-gb/windows/win32/menurc/vs-versioninfo
-    // Instead of finding VS_VERSIONINFO -> StringFileInfo[] -> StringTable[] -> String (-> WCHAR[]) properly, just do it the memcmp way
-    size_t propertyLen = (wcslen(Property) + 1) * 2;
-    PUCHAR P = (PUCHAR)Address;
-    BOOL found = FALSE;
-    for (; P < (PUCHAR)Address + Size - propertyLen; ++P)
-    {
-        if (memcmp(P, Property, propertyLen) == 0)
-        {
-            found = TRUE;
-            break;
-        }
-    }
-    if (!found)
-    {
-        DbgPrint("Failed to find %ws in ntdll.dll VS_VERSION_INFO", Property);
-        return;
-    }
-
-    // Skip to the version number and discard extra nulls
-    P += propertyLen;
-    while (*(PWCHAR)P == L'\0')
-    {
-        P += sizeof(WCHAR);
-    }
-
-    // P now points at e.g. 6.1.xxxx.yyyy or 10.0.xxxxx.yyyy. Skip the major and minor version numbers to get to the build number xxxx
-    const ULONG Skip = NtCurrentPeb()->OSMajorVersion >= 10 ? 5 * sizeof(WCHAR) : 4 * sizeof(WCHAR);
-    P += Skip;
-
-    // Write a new bogus build number
-    WCHAR NewBuildNumber[] = FAKE_VERSION_WCHAR;
-    ULONG OldProtect;
-    if (NtVirtualProtect(hProcess, P, sizeof(NewBuildNumber) - sizeof(WCHAR), PAGE_READWRITE, &OldProtect))
-    {
-        SIZE_T NumWritten;
-        NtWriteVirtualMemory(hProcess, P, NewBuildNumber, sizeof(NewBuildNumber) - sizeof(WCHAR), &NumWritten);
-        NtVirtualProtect(hProcess, P, sizeof(NewBuildNumber) - sizeof(WCHAR), OldProtect, &OldProtect);
-    }
-}
-
 void ApplyNtdllVersionPatch(HANDLE hProcess, PVOID Ntdll)
 {
     // Get the resource data entry for VS_VERSION_INFO
@@ -118,7 +38,28 @@ void ApplyNtdllVersionPatch(HANDLE hProcess, PVOID Ntdll)
         return;
     }
 
-    PatchFixedFileInfoVersion(hProcess, Address, Size);
-    PatchVersionString(hProcess, Address, Size, L"FileVersion");
-    PatchVersionString(hProcess, Address, Size, L"ProductVersion");
+    // Patch a local copy of the resource in a single walk. ntdll is mapped at the same address in every process,
+    // so our own copy has the same layout as the target's. Then write the whole resource back at once
+    const PUCHAR Patched = (PUCHAR)RtlAllocateHeap(RtlProcessHeap(), 0, Size);
+    if (Patched == nullptr)
+        return;
+    RtlCopyMemory(Patched, Address, Size);
+    const WCHAR* const Properties[] = { L"FileVersion", L"ProductVersion" };
+    const ULONG NumPatched = PatchVersionInfoBuildNumber(Patched, Size, FAKE_VERSION, Properties, ARRAYSIZE(Properties));
+    if (NumPatched != 1 + ARRAYSIZE(Properties))
+        DbgPrint("Patched %u of %u version fields in ntdll.dll VS_VERSION_INFO", NumPatched, (ULONG)(1 + ARRAYSIZE(Properties)));
+
+    ULONG OldProtect;
+    if (NumPatched != 0)
+    {
+        if (NtVirtualProtect(hProcess, Address, Size, PAGE_READWRITE, &OldProtect))
+        {
+            NtWriteVirtualMemory(hProcess, Address, Patched, Size, nullptr);
+            NtVirtualProtect(hProcess, Address, Size, OldProtect, &OldProtect);
+        }
+        else
+            DbgPrint("VirtualProtectEx failed on ntdll");
+    }
+
+    RtlFreeHeap(RtlProcessHeap(), 0, Patched);
 }
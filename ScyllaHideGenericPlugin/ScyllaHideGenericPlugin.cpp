@@ -1,25 +1,11 @@
 #include "ScyllaHideGenericPlugin.h"
 #include <string>
-#include <unordered_map>
 #include <Scylla/Logger.h>
 #include <Scylla/Settings.h>
 #include <Scylla/Util.h>
 
 #include "..\PluginGeneric\Injector.h"
-
-struct HookStatus
-{
-    HookStatus()
-        : ProcessId(0),
-        bHooked(false),
-        specialPebFix(false)
-    {
-    }
-
-    DWORD ProcessId;
-    bool bHooked;
-    bool specialPebFix;
-};
+#include "..\PluginGeneric\ProcessHookTracker.h"
 
 typedef void(__cdecl * t_AttachProcess)(DWORD dwPID);
 
@@ -34,11 +20,9 @@ scl::Logger g_log;
 std::wstring g_scyllaHideDllPath;
 std::wstring g_scyllaHideIniPath;
 
-HOOK_DLL_DATA g_hdd;
-
 //globals
 static HMODULE hNtdllModule = 0;
-static std::unordered_map<DWORD, HookStatus> hookStatusMap;
+static ProcessHookTracker hookTracker;
 
 static void LogCallback(const wchar_t *msg)
 {
@@ -47,91 +31,39 @@ static void LogCallback(const wchar_t *msg)
 
 DLL_EXPORT void ScyllaHideDebugLoop(const DEBUG_EVENT* DebugEvent)
 {
-    auto pid = DebugEvent->dwProcessId;
-    auto status = HookStatus();
-    auto found = hookStatusMap.find(pid);
-    if (found == hookStatusMap.end())
-        hookStatusMap[pid] = status;
-    else
-        status = hookStatusMap[pid];
-
-    if (g_settings.opts().fixPebHeapFlags)
-    {
-        if (status.specialPebFix)
-        {
-            StartFixBeingDebugged(status.ProcessId, false);
-            status.specialPebFix = false;
-        }
+    const DWORD pid = DebugEvent->dwProcessId;
+    const unsigned int actions = hookTracker.OnDebugEvent(*DebugEvent, hNtdllModule, g_settings.opts().fixPebHeapFlags != FALSE);
+    ProcessHookStatus* status = hookTracker.Find(pid);
 
-        if (DebugEvent->u.LoadDll.lpBaseOfDll == hNtdllModule)
-        {
-            StartFixBeingDebugged(status.ProcessId, true);
-            status.specialPebFix = true;
-        }
-    }
+    if (actions & ProcessHookActionUndoPebFix)
+        StartFixBeingDebugged(pid, false);
+    if (actions & ProcessHookActionApplyPebFix)
+        StartFixBeingDebugged(pid, true);
 
-    switch (DebugEvent->dwDebugEventCode)
-    {
-    case CREATE_PROCESS_DEBUG_EVENT:
+    if ((actions & ProcessHookActionAntiAntiAttach) && g_settings.opts().killAntiAttach)
     {
-        status.ProcessId = DebugEvent->dwProcessId;
-        status.bHooked = false;
-        ZeroMemory(&g_hdd, sizeof(HOOK_DLL_DATA));
-
-        if (DebugEvent->u.CreateProcessInfo.lpStartAddress == NULL)
+        if (!ApplyAntiAntiAttach(pid))
         {
-            //ATTACH
-            if (g_settings.opts().killAntiAttach)
-            {
-                if (!ApplyAntiAntiAttach(status.ProcessId))
-                {
-                    g_log.LogError(L"Anti-Anti-Attach failed");
-                }
-            }
+            g_log.LogError(L"Anti-Anti-Attach failed");
         }
-
-        break;
     }
 
-    case LOAD_DLL_DEBUG_EVENT:
+    if (actions & ProcessHookActionInject)
     {
-        if (status.bHooked)
-        {
-            startInjection(status.ProcessId, &g_hdd, g_scyllaHideDllPath.c_str(), false);
-        }
-
-        break;
+        ReadNtApiInformation(&status->hdd);
+        startInjection(pid, &status->hdd, g_scyllaHideDllPath.c_str(), true);
     }
-
-    case EXCEPTION_DEBUG_EVENT:
+    else if (actions & ProcessHookActionReinject)
     {
-        switch (DebugEvent->u.Exception.ExceptionRecord.ExceptionCode)
-        {
-        case STATUS_BREAKPOINT:
-        {
-            if (!status.bHooked)
-            {
-                ReadNtApiInformation(&g_hdd);
-
-                status.bHooked = true;
-                startInjection(status.ProcessId, &g_hdd, g_scyllaHideDllPath.c_str(), true);
-            }
-
-            break;
-        }
-        }
-
-        break;
-    }
+        startInjection(pid, &status->hdd, g_scyllaHideDllPath.c_str(), false);
     }
 
-    hookStatusMap[pid] = status;
+    hookTracker.OnActionsDone(pid);
 }
 
 DLL_EXPORT void ScyllaHideReset()
 {
-    ZeroMemory(&g_hdd, sizeof(HOOK_DLL_DATA));
-    hookStatusMap.clear();
+    hookTracker.Clear();
 }
 
 DLL_EXPORT void ScyllaHideInit(const WCHAR* Directory, LOGWRAPPER Logger, LOGWRAPPER ErrorLogger)
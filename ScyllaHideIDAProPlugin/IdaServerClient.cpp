@@ -1,20 +1,20 @@
 #include "IdaServerClient.h"
-#include <winsock2.h>
-#include <ws2tcpip.h>
+#include "IdaServerSession.h"
+#include <Scylla/Logger.h>
 #include <Scylla/Settings.h>
 
-#include "..\ScyllaHideIDAServer\IdaServerExchange.h"
 #include "..\PluginGeneric\Injector.h"
 
 #pragma comment (lib, "Ws2_32.lib")
 
 extern scl::Settings g_settings;
+extern scl::Logger g_log;
 
 
 SOCKET serverSock = INVALID_SOCKET;
 WSADATA wsaData;
 
-IDA_SERVER_EXCHANGE idaExchange = {0};
+ServerSession serverSession;
 extern wchar_t DllPathForInjection[MAX_PATH];
 
 bool StartWinsock()
@@ -37,77 +37,18 @@ bool SendInjectToServer(unsigned long ProcessId)
 
 bool SendEventToServer(unsigned long notif_code, unsigned long ProcessId)
 {
-	idaExchange.notif_code = notif_code;
-	idaExchange.ProcessId = ProcessId;
-
-    idaExchange.EnablePebBeingDebugged = g_settings.opts().fixPebBeingDebugged;
-    idaExchange.EnablePebHeapFlags = g_settings.opts().fixPebHeapFlags;
-    idaExchange.EnablePebNtGlobalFlag = g_settings.opts().fixPebNtGlobalFlag;
-    idaExchange.EnablePebStartupInfo = g_settings.opts().fixPebStartupInfo;
-    idaExchange.EnablePebOsBuildNumber = g_settings.opts().fixPebOsBuildNumber;
-    idaExchange.EnableOutputDebugStringHook = g_settings.opts().hookOutputDebugStringA;
-    idaExchange.EnableNtSetInformationThreadHook = g_settings.opts().hookNtSetInformationThread;
-    idaExchange.EnableNtQueryInformationProcessHook = g_settings.opts().hookNtQueryInformationProcess;
-    idaExchange.EnableNtQuerySystemInformationHook = g_settings.opts().hookNtQuerySystemInformation;
-    idaExchange.EnableNtQueryObjectHook = g_settings.opts().hookNtQueryObject;
-    idaExchange.EnableNtYieldExecutionHook = g_settings.opts().hookNtYieldExecution;
-    idaExchange.EnableNtCloseHook = g_settings.opts().hookNtClose;
-    idaExchange.EnableNtCreateThreadExHook = g_settings.opts().hookNtCreateThreadEx;
-    idaExchange.EnablePreventThreadCreation = g_settings.opts().preventThreadCreation;
-
-    idaExchange.EnableNtGetContextThreadHook = g_settings.opts().hookNtGetContextThread;
-    idaExchange.EnableNtSetContextThreadHook = g_settings.opts().hookNtSetContextThread;
-    idaExchange.EnableNtContinueHook = g_settings.opts().hookNtContinue;
-    idaExchange.EnableKiUserExceptionDispatcherHook = g_settings.opts().hookKiUserExceptionDispatcher;
-    idaExchange.EnableNtSetInformationProcessHook = g_settings.opts().hookNtSetInformationProcess;
-    idaExchange.EnableMalwareRunPeUnpacker = g_settings.opts().malwareRunpeUnpacker;
-
-    idaExchange.EnableGetTickCountHook = g_settings.opts().hookGetTickCount;
-    idaExchange.EnableGetTickCount64Hook = g_settings.opts().hookGetTickCount64;
-    idaExchange.EnableGetLocalTimeHook = g_settings.opts().hookGetLocalTime;
-    idaExchange.EnableGetSystemTimeHook = g_settings.opts().hookGetSystemTime;
-    idaExchange.EnableNtQuerySystemTimeHook = g_settings.opts().hookNtQuerySystemTime;
-    idaExchange.EnableNtQueryPerformanceCounterHook = g_settings.opts().hookNtQueryPerformanceCounter;
-
-    idaExchange.EnableNtUserBlockInputHook = g_settings.opts().hookNtUserBlockInput;
-    idaExchange.EnableNtUserFindWindowExHook = g_settings.opts().hookNtUserFindWindowEx;
-    idaExchange.EnableNtUserBuildHwndListHook = g_settings.opts().hookNtUserBuildHwndList;
-    idaExchange.EnableNtUserQueryWindowHook = g_settings.opts().hookNtUserQueryWindow;
-    idaExchange.EnableNtUserGetForegroundWindowHook = g_settings.opts().hookNtUserGetForegroundWindow;
-    idaExchange.EnableNtSetDebugFilterStateHook = g_settings.opts().hookNtSetDebugFilterState;
-    idaExchange.DllInjectNormal = g_settings.opts().dllNormal;
-    idaExchange.DllInjectStealth = g_settings.opts().dllStealth;
-    idaExchange.UnloadDllAfterInjection = g_settings.opts().dllUnload;
-
-	wcscpy_s(idaExchange.DllPathForInjection, DllPathForInjection);
-
-
-	int iResult = send(serverSock, (char*)&idaExchange, (int)sizeof(IDA_SERVER_EXCHANGE), 0);
-	if (iResult == SOCKET_ERROR)
-	{
-		//printf("send failed with error: %d\n", WSAGetLastError());
-		return false;
-	}
+	const unsigned long asyncFailures = serverSession.TakeAsyncFailures();
+	if (asyncFailures != 0)
+		g_log.LogError(L"%lu asynchronous server requests failed", asyncFailures);
 
-	idaExchange.result = RESULT_FAILED;
-
-	iResult = recv(serverSock, (char*)&idaExchange, (int)sizeof(IDA_SERVER_EXCHANGE), 0);
-
-	if (iResult == sizeof(IDA_SERVER_EXCHANGE))
-	{
-		if (idaExchange.result == RESULT_SUCCESS)
-		{
-			return true;
-		}
-	}
-
-	return false;
+	return serverSession.SendEvent(notif_code, ProcessId, g_settings.opts(), notif_code == inject_dll ? DllPathForInjection : L"");
 }
 
-void CloseServerSocket()
+void CloseServerSocket(bool wait)
 {
-	closesocket(serverSock);
-	serverSock = INVALID_SOCKET;
+	serverSession.Finish();
+	if (wait)
+		serverSession.Join();
 }
 
 bool ConnectToServer(const char * host, const char * port)
@@ -117,6 +58,9 @@ bool ConnectToServer(const char * host, const char * port)
 		*ptr = NULL,
 		hints;
 
+	// Give the previous session a few seconds to deliver its last events before starting a new one
+	serverSession.Join();
+
 	ZeroMemory( &hints, sizeof(hints) );
 	hints.ai_family = AF_UNSPEC;
 	hints.ai_socktype = SOCK_STREAM;
@@ -165,6 +109,8 @@ bool ConnectToServer(const char * host, const char * port)
 	}
 	else
 	{
+		serverSession.Start(serverSock);
+		serverSock = INVALID_SOCKET; // Owned by the session now
 		return true;
 	}
 }
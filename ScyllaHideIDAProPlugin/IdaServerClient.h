@@ -3,6 +3,6 @@
 bool StartWinsock();
 bool ConnectToServer(const char * host, const char * port);
 bool SendEventToServer(unsigned long notif_code, unsigned long ProcessId);
-void CloseServerSocket();
+void CloseServerSocket(bool wait = false);
 bool GetHost(char * input, char * output);
 bool SendInjectToServer(unsigned long ProcessId);
@@ -0,0 +1,196 @@
+#include "IdaServerSession.h"
+
+void ServerSession::Start(SOCKET sock)
+{
+	sock_ = sock;
+	queue_.clear();
+	waiting_.clear();
+	asyncFailures_ = 0;
+	finishing_ = false;
+	broken_ = false;
+	sequence_ = 0;
+	settingsSent_ = false;
+	sender_ = std::thread(&ServerSession::SenderThread, this);
+	receiver_ = std::thread(&ServerSession::ReceiverThread, this);
+}
+
+bool ServerSession::SendEvent(unsigned long notifCode, unsigned long processId, const scl::Settings::Profile& settings, const std::wstring& dllPath)
+{
+	IdaMessageWriter writer;
+	writer.AddULong(IDA_TAG_NOTIF_CODE, notifCode);
+	writer.AddULong(IDA_TAG_PROCESS_ID, processId);
+
+	// The server remembers the settings of this connection, so only send what changed since the last request
+	writer.AddSettings(settings, settingsSent_ ? &sentSettings_ : nullptr);
+
+	if (notifCode == inject_dll)
+		writer.AddString(IDA_TAG_DLL_PATH, dllPath);
+
+	// Hooks must be in place before the debuggee runs, and the user waits for the result of a DLL injection.
+	// Everything else is acknowledged asynchronously
+	const bool wait = notifCode == dbg_process_start || notifCode == inject_dll;
+	const uint32_t sequence = ++sequence_;
+	if (!Submit(writer.Encode(IDA_SERVER_MSG_REQUEST, sequence), sequence, wait))
+		return false;
+
+	// Only now is the server going to see these settings
+	sentSettings_ = settings;
+	settingsSent_ = true;
+
+	return !wait || WaitForAck(sequence);
+}
+
+bool ServerSession::Submit(std::vector<uint8_t>&& frame, uint32_t sequence, bool wait)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (broken_ || finishing_ || sock_ == INVALID_SOCKET)
+		return false;
+	if (wait)
+		waiting_[sequence] = Ack{ false, RESULT_FAILED };
+	queue_.push_back(std::move(frame));
+	queueChanged_.notify_one();
+	return true;
+}
+
+bool ServerSession::WaitForAck(uint32_t sequence, std::chrono::milliseconds timeout)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	const auto it = waiting_.find(sequence);
+	if (it == waiting_.end())
+		return false;
+	if (!ackReceived_.wait_for(lock, timeout, [&] { return broken_ || it->second.received; }))
+	{
+		// The server hangs. Later requests would wait for it as well, so give up on the connection
+		waiting_.erase(it);
+		lock.unlock();
+		Break();
+		return false;
+	}
+	const bool success = it->second.received && it->second.result == RESULT_SUCCESS;
+	waiting_.erase(it);
+	return success;
+}
+
+unsigned long ServerSession::TakeAsyncFailures()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	const unsigned long failures = asyncFailures_;
+	asyncFailures_ = 0;
+	return failures;
+}
+
+void ServerSession::Finish()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	finishing_ = true;
+	queueChanged_.notify_one();
+}
+
+bool ServerSession::IsBroken()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return broken_;
+}
+
+// Marks the session as broken and unblocks the sender and receiver threads, also when they are stuck in send or recv
+void ServerSession::Break()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (!broken_ && sock_ != INVALID_SOCKET)
+		shutdown(sock_, SD_BOTH);
+	broken_ = true;
+	queueChanged_.notify_one();
+	ackReceived_.notify_all();
+}
+
+void ServerSession::Join(std::chrono::milliseconds timeout)
+{
+	if (sock_ == INVALID_SOCKET)
+		return;
+
+	// The server closes the connection after the sender has delivered everything and shut down its side.
+	// Don't wait for a server that doesn't read or doesn't close, the sender could be blocked in send forever
+	Finish();
+	bool closed;
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		closed = ackReceived_.wait_for(lock, timeout, [&] { return broken_; });
+	}
+	if (!closed)
+		Break();
+
+	if (sender_.joinable())
+		sender_.join();
+	if (receiver_.joinable())
+		receiver_.join();
+
+	closesocket(sock_);
+	sock_ = INVALID_SOCKET;
+}
+
+void ServerSession::SenderThread()
+{
+	while (true)
+	{
+		std::vector<uint8_t> frame;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			queueChanged_.wait(lock, [&] { return broken_ || finishing_ || !queue_.empty(); });
+			if (broken_)
+				return;
+			if (queue_.empty())
+			{
+				// Finishing and everything has been sent. Let the server know no more requests will follow
+				shutdown(sock_, SD_SEND);
+				return;
+			}
+			frame = std::move(queue_.front());
+			queue_.pop_front();
+		}
+
+		if (!IdaSendFrame(sock_, frame))
+		{
+			Break();
+			return;
+		}
+	}
+}
+
+void ServerSession::ReceiverThread()
+{
+	IdaFrameDecoder decoder;
+	IdaServerMessage response;
+	while (IdaRecvFrame(sock_, decoder, response) == IdaFrameComplete)
+	{
+		if (response.Type != IDA_SERVER_MSG_RESPONSE)
+			continue;
+
+		IdaMessageReader reader(response);
+		uint16_t tag, length;
+		const uint8_t* value;
+		uint32_t result = RESULT_FAILED;
+		while (reader.Next(tag, value, length))
+		{
+			if (tag == IDA_TAG_RESULT)
+				IdaMessageReader::ReadULong(value, length, result);
+		}
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		const auto it = waiting_.find(response.Sequence);
+		if (it != waiting_.end())
+		{
+			it->second = Ack{ true, result };
+			ackReceived_.notify_all();
+		}
+		else if (result != RESULT_SUCCESS)
+		{
+			asyncFailures_++;
+		}
+	}
+
+	// Connection closed, protocol version mismatch or garbage on the stream
+	std::lock_guard<std::mutex> lock(mutex_);
+	broken_ = true;
+	queueChanged_.notify_one();
+	ackReceived_.notify_all();
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "../ScyllaHideIDAServer/IdaServerSocket.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "../ScyllaHideIDAServer/IdaServerProtocol.h"
+
+// How long the debugger thread waits for a synchronous request. Injection takes a few seconds at most, a server
+// that takes longer is considered gone
+#define IDA_SERVER_ACK_TIMEOUT_MS 30000
+// How long a new connection waits for the previous session to deliver its last events
+#define IDA_SERVER_JOIN_TIMEOUT_MS 5000
+
+// Requests are queued by the IDA debugger thread and streamed to the server by a sender thread. A receiver
+// thread matches the acknowledgements to the sequence numbers, so only events that must finish before the
+// debuggee continues (dbg_process_start, inject_dll) wait for their acknowledgement
+class ServerSession
+{
+public:
+	void Start(SOCKET sock);
+
+	// Encodes and submits a debug event. Returns false if the session is broken or a synchronous request failed
+	bool SendEvent(unsigned long notifCode, unsigned long processId, const scl::Settings::Profile& settings, const std::wstring& dllPath);
+
+	bool Submit(std::vector<uint8_t>&& frame, uint32_t sequence, bool wait);
+
+	// A request that is not acknowledged within the timeout breaks the session
+	bool WaitForAck(uint32_t sequence, std::chrono::milliseconds timeout = std::chrono::milliseconds(IDA_SERVER_ACK_TIMEOUT_MS));
+
+	unsigned long TakeAsyncFailures();
+	void Finish();
+
+	// Waits up to timeout for the queued requests to be delivered and acknowledged, then drops the connection
+	void Join(std::chrono::milliseconds timeout = std::chrono::milliseconds(IDA_SERVER_JOIN_TIMEOUT_MS));
+
+	bool IsBroken();
+
+private:
+	struct Ack
+	{
+		bool received;
+		unsigned long result;
+	};
+
+	void SenderThread();
+	void ReceiverThread();
+	void Break();
+
+	SOCKET sock_ = INVALID_SOCKET;
+	std::thread sender_, receiver_;
+	std::mutex mutex_;
+	std::condition_variable queueChanged_, ackReceived_;
+	std::deque<std::vector<uint8_t>> queue_;
+	std::unordered_map<uint32_t, Ack> waiting_; // Requests that someone waits for, by sequence number
+	unsigned long asyncFailures_ = 0;
+	bool finishing_ = false;
+	bool broken_ = false;
+
+	// Only used by the thread that sends events
+	uint32_t sequence_ = 0;
+	bool settingsSent_ = false;
+	scl::Settings::Profile sentSettings_{};
+};
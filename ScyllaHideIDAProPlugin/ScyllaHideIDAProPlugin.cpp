@@ -292,6 +292,7 @@ static ssize_t idaapi debug_mainloop(void *user_data, int notif_code, va_list va
 static void idaapi IDAP_term(void)
 {
     unhook_from_notification_point(HT_DBG, debug_mainloop, NULL);
+    CloseServerSocket(true);
 }
 
 //called when user clicks in plugin menu or presses hotkey
@@ -85,55 +85,73 @@ enum server_dbg_notification_t
 
 #define RESULT_SUCCESS 1
 #define RESULT_FAILED 0
-
-typedef struct _IDA_SERVER_EXCHANGE
+#define RESULT_VERSION_MISMATCH 2
+
+/*
+ * Client and server exchange length-prefixed frames. All integers are little endian.
+ *
+ *   ULONG  Magic           IDA_SERVER_PROTOCOL_MAGIC
+ *   USHORT Version         IDA_SERVER_PROTOCOL_VERSION
+ *   USHORT Type            IDA_SERVER_MSG_*
+ *   ULONG  Sequence        Chosen by the client, echoed in the response
+ *   ULONG  PayloadLength   Number of payload bytes following the header
+ *   UCHAR  Payload[]       Sequence of TLVs: USHORT Tag, USHORT Length, UCHAR Value[Length]
+ *
+ * Settings are sent in full with the first request of a connection and as deltas afterwards.
+ * The server keeps the settings of each connection until it is closed. Unknown tags are skipped.
+ */
+#define IDA_SERVER_PROTOCOL_MAGIC 0x44494853 // 'SHID'
+#define IDA_SERVER_PROTOCOL_VERSION 2
+#define IDA_SERVER_FRAME_HEADER_SIZE 16
+#define IDA_SERVER_MAX_PAYLOAD_SIZE 0x10000
+
+#define IDA_SERVER_MSG_REQUEST 1 // Client -> server: debug event notification
+#define IDA_SERVER_MSG_RESPONSE 2 // Server -> client: result of the request with the same sequence number
+
+#define IDA_TAG_NOTIF_CODE 0x0001 // ULONG server_dbg_notification_t
+#define IDA_TAG_PROCESS_ID 0x0002 // ULONG
+#define IDA_TAG_RESULT 0x0003 // ULONG RESULT_*
+#define IDA_TAG_DLL_PATH 0x0004 // UTF-16LE string without terminator, only sent with inject_dll
+#define IDA_TAG_SETTING_BASE 0x0100 // IDA_TAG_SETTING_BASE + ida_server_setting_t, UCHAR boolean
+
+// The values of these must never change, only append new ones
+enum ida_server_setting_t
 {
-	unsigned long result;
-	unsigned long notif_code; //server_dbg_notification_t
-	unsigned long ProcessId;
-
-	unsigned char EnablePebBeingDebugged;
-	unsigned char EnablePebHeapFlags;
-	unsigned char EnablePebNtGlobalFlag;
-	unsigned char EnablePebStartupInfo;
-	unsigned char EnablePebOsBuildNumber;
-
-	unsigned char EnableOutputDebugStringHook;
-
-	unsigned char EnableNtSetInformationThreadHook;
-	unsigned char EnableNtQuerySystemInformationHook;
-	unsigned char EnableNtQueryInformationProcessHook;
-	unsigned char EnableNtSetInformationProcessHook;
-	unsigned char EnableNtQueryObjectHook;
-	unsigned char EnableNtYieldExecutionHook;
-	unsigned char EnableNtCloseHook;
-	unsigned char EnableMalwareRunPeUnpacker;
-
-	unsigned char EnablePreventThreadCreation;
-	unsigned char EnableNtCreateThreadExHook;
-
-	//Protect and Hide Hardware Breakpoints
-	unsigned char EnableNtGetContextThreadHook;
-	unsigned char EnableNtSetContextThreadHook;
-	unsigned char EnableNtContinueHook;
-	unsigned char EnableKiUserExceptionDispatcherHook;
-
-	unsigned char EnableNtUserBlockInputHook;
-	unsigned char EnableNtUserQueryWindowHook;
-	unsigned char EnableNtUserGetForegroundWindowHook;
-	unsigned char EnableNtUserBuildHwndListHook;
-	unsigned char EnableNtUserFindWindowExHook;
-	unsigned char EnableNtSetDebugFilterStateHook;
-
-	unsigned char EnableGetTickCountHook;
-	unsigned char EnableGetTickCount64Hook;
-	unsigned char EnableGetLocalTimeHook;
-	unsigned char EnableGetSystemTimeHook;
-	unsigned char EnableNtQuerySystemTimeHook;
-	unsigned char EnableNtQueryPerformanceCounterHook;
-
-	unsigned char DllInjectStealth;
-	unsigned char DllInjectNormal;
-	unsigned char UnloadDllAfterInjection;
-	wchar_t DllPathForInjection[300];
-} IDA_SERVER_EXCHANGE;
\ No newline at end of file
+	ida_setting_fix_peb_being_debugged = 0,
+	ida_setting_fix_peb_heap_flags,
+	ida_setting_fix_peb_nt_global_flag,
+	ida_setting_fix_peb_startup_info,
+	ida_setting_fix_peb_os_build_number,
+	ida_setting_hook_output_debug_string,
+	ida_setting_hook_nt_set_information_thread,
+	ida_setting_hook_nt_query_system_information,
+	ida_setting_hook_nt_query_information_process,
+	ida_setting_hook_nt_set_information_process,
+	ida_setting_hook_nt_query_object,
+	ida_setting_hook_nt_yield_execution,
+	ida_setting_hook_nt_close,
+	ida_setting_malware_runpe_unpacker,
+	ida_setting_prevent_thread_creation,
+	ida_setting_hook_nt_create_thread_ex,
+	ida_setting_hook_nt_get_context_thread,
+	ida_setting_hook_nt_set_context_thread,
+	ida_setting_hook_nt_continue,
+	ida_setting_hook_ki_user_exception_dispatcher,
+	ida_setting_hook_nt_user_block_input,
+	ida_setting_hook_nt_user_query_window,
+	ida_setting_hook_nt_user_get_foreground_window,
+	ida_setting_hook_nt_user_build_hwnd_list,
+	ida_setting_hook_nt_user_find_window_ex,
+	ida_setting_hook_nt_set_debug_filter_state,
+	ida_setting_hook_get_tick_count,
+	ida_setting_hook_get_tick_count64,
+	ida_setting_hook_get_local_time,
+	ida_setting_hook_get_system_time,
+	ida_setting_hook_nt_query_system_time,
+	ida_setting_hook_nt_query_performance_counter,
+	ida_setting_dll_stealth,
+	ida_setting_dll_normal,
+	ida_setting_dll_unload,
+
+	ida_setting_count
+};
@@ -0,0 +1,401 @@
+#include "IdaServerLoop.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+IdaServerLoop::~IdaServerLoop()
+{
+    for (auto& connection : connections_)
+    {
+        connection->Pending = false;
+        if (connection->Socket != INVALID_SOCKET)
+            Close(*connection);
+        else
+            handler_.OnDisconnect(*connection);
+    }
+    if (listenSocket_ != INVALID_SOCKET)
+        closesocket(listenSocket_);
+    if (wakeupRead_ != INVALID_SOCKET)
+        closesocket(wakeupRead_);
+    if (wakeupWrite_ != INVALID_SOCKET)
+        closesocket(wakeupWrite_);
+}
+
+bool IdaServerLoop::Listen(const char* port)
+{
+    struct addrinfo *result = NULL;
+    struct addrinfo hints;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    hints.ai_flags = AI_PASSIVE;
+
+    // Resolve the server address and port
+    int iResult = getaddrinfo(NULL, port, &hints, &result);
+    if (iResult != 0)
+    {
+        printf("getaddrinfo failed with error: %d\n", iResult);
+        return false;
+    }
+
+    // Create a SOCKET for connecting to server
+    listenSocket_ = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if (listenSocket_ == INVALID_SOCKET)
+    {
+        printf("socket failed with error: %d\n", IdaSocketLastError());
+        freeaddrinfo(result);
+        return false;
+    }
+
+    // Setup the TCP listening socket
+    iResult = bind(listenSocket_, result->ai_addr, (int)result->ai_addrlen);
+    freeaddrinfo(result);
+    if (iResult == SOCKET_ERROR)
+    {
+        printf("bind failed with error: %d\n", IdaSocketLastError());
+        closesocket(listenSocket_);
+        listenSocket_ = INVALID_SOCKET;
+        return false;
+    }
+
+    if (listen(listenSocket_, SOMAXCONN) == SOCKET_ERROR || !IdaSocketSetNonBlocking(listenSocket_))
+    {
+        printf("listen failed with error: %d\n", IdaSocketLastError());
+        closesocket(listenSocket_);
+        listenSocket_ = INVALID_SOCKET;
+        return false;
+    }
+
+    return CreateWakeup();
+}
+
+unsigned short IdaServerLoop::LocalPort() const
+{
+    struct sockaddr_in address;
+    socklen_t addressLength = sizeof(address);
+    if (getsockname(listenSocket_, (struct sockaddr*)&address, &addressLength) == SOCKET_ERROR)
+        return 0;
+    return ntohs(address.sin_port);
+}
+
+// Connects a socket pair over loopback for Complete to wake up the poll. Winsock has neither socketpair nor
+// pipes that WSAPoll can wait on
+bool IdaServerLoop::CreateWakeup()
+{
+    SOCKET listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listener == INVALID_SOCKET)
+    {
+        printf("socket failed with error: %d\n", IdaSocketLastError());
+        return false;
+    }
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addressLength = sizeof(address);
+    bool success = bind(listener, (struct sockaddr*)&address, sizeof(address)) != SOCKET_ERROR &&
+        listen(listener, 1) != SOCKET_ERROR &&
+        getsockname(listener, (struct sockaddr*)&address, &addressLength) != SOCKET_ERROR;
+    if (success)
+    {
+        wakeupWrite_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        success = wakeupWrite_ != INVALID_SOCKET && connect(wakeupWrite_, (struct sockaddr*)&address, sizeof(address)) != SOCKET_ERROR;
+    }
+    if (success)
+    {
+        wakeupRead_ = accept(listener, NULL, NULL);
+        success = wakeupRead_ != INVALID_SOCKET && IdaSocketSetNonBlocking(wakeupRead_) && IdaSocketSetNonBlocking(wakeupWrite_);
+    }
+    if (!success)
+        printf("Failed to create the wakeup socket pair: %d\n", IdaSocketLastError());
+    closesocket(listener);
+    return success;
+}
+
+bool IdaServerLoop::RunOnce(int timeoutMs)
+{
+    pollFds_.clear();
+    polledConnections_.clear();
+    pollfd wakeupFd = { wakeupRead_, POLLIN, 0 };
+    pollFds_.push_back(wakeupFd);
+
+    // Stop accepting when the connection limit is reached. Pending clients wait in the listen backlog
+    const bool accepting = connections_.size() < IDA_SERVER_MAX_CONNECTIONS;
+    if (accepting)
+    {
+        pollfd listenFd = { listenSocket_, POLLIN, 0 };
+        pollFds_.push_back(listenFd);
+    }
+    const size_t firstConnectionFd = pollFds_.size();
+
+    // Connections with a pending request are not read from until it completes, so that their requests are
+    // handled in order and a client can't pile up requests behind a slow one
+    for (const auto& connection : connections_)
+    {
+        short events = 0;
+        if (connection->Socket != INVALID_SOCKET && !connection->Pending && !connection->PeerClosed)
+            events |= POLLIN;
+        if (connection->Socket != INVALID_SOCKET && !connection->SendBuffer.empty())
+            events |= POLLOUT;
+        if (events == 0)
+            continue;
+        pollfd connectionFd = { connection->Socket, events, 0 };
+        pollFds_.push_back(connectionFd);
+        polledConnections_.push_back(connection.get());
+    }
+
+    const int numReady = IdaSocketPoll(pollFds_.data(), pollFds_.size(), timeoutMs);
+    if (numReady == SOCKET_ERROR)
+    {
+        const int error = IdaSocketLastError();
+#ifndef _WIN32
+        if (error == EINTR)
+            return true;
+#endif
+        printf("poll failed with error: %d\n", error);
+        return false;
+    }
+
+    if (pollFds_[0].revents != 0)
+    {
+        char buffer[64];
+        while (recv(wakeupRead_, buffer, sizeof(buffer), 0) > 0)
+        {
+        }
+    }
+    ApplyCompletions();
+
+    // New connections are appended, so accept after walking the ones that were part of this poll
+    for (size_t i = 0; i < polledConnections_.size(); i++)
+    {
+        IdaServerConnection& connection = *polledConnections_[i];
+        const short revents = pollFds_[firstConnectionFd + i].revents;
+        if (connection.Socket != INVALID_SOCKET && (revents & POLLNVAL) != 0)
+        {
+            Close(connection);
+            continue;
+        }
+        if (connection.Socket != INVALID_SOCKET && !connection.SendBuffer.empty() && (revents & (POLLOUT | POLLERR | POLLHUP)) != 0)
+            Flush(connection);
+        if (connection.Socket != INVALID_SOCKET && !connection.Pending && !connection.PeerClosed && (revents & (POLLIN | POLLERR | POLLHUP)) != 0)
+            Receive(connection);
+    }
+
+    if (accepting && pollFds_[1].revents != 0)
+        Accept();
+
+    // Connections whose socket is gone but that still have a request pending are removed after it completes
+    connections_.erase(std::remove_if(connections_.begin(), connections_.end(),
+        [](const std::unique_ptr<IdaServerConnection>& connection) { return connection->Socket == INVALID_SOCKET && !connection->Pending; }),
+        connections_.end());
+    return true;
+}
+
+void IdaServerLoop::Run()
+{
+    stop_ = false;
+    while (!stop_ && RunOnce(1000))
+    {
+    }
+}
+
+void IdaServerLoop::Complete(unsigned int connectionId, unsigned long result)
+{
+    {
+        std::lock_guard<std::mutex> lock(completionsMutex_);
+        completions_.push_back(std::make_pair(connectionId, result));
+    }
+
+    // If this would block, the loop has unread wakeups already
+    const char wakeup = 0;
+    send(wakeupWrite_, &wakeup, sizeof(wakeup), IDA_SOCKET_SEND_FLAGS);
+}
+
+void IdaServerLoop::ApplyCompletions()
+{
+    std::vector<std::pair<unsigned int, unsigned long>> completions;
+    {
+        std::lock_guard<std::mutex> lock(completionsMutex_);
+        completions.swap(completions_);
+    }
+
+    for (const auto& completion : completions)
+    {
+        auto it = std::find_if(connections_.begin(), connections_.end(),
+            [&](const std::unique_ptr<IdaServerConnection>& connection) { return connection->Id == completion.first; });
+        if (it == connections_.end() || !(*it)->Pending)
+            continue;
+
+        IdaServerConnection& connection = **it;
+        connection.Pending = false;
+        if (connection.Socket == INVALID_SOCKET)
+        {
+            // The client went away while the request was in progress
+            handler_.OnDisconnect(connection);
+            continue;
+        }
+        Respond(connection, connection.PendingSequence, completion.second);
+        if (connection.Socket != INVALID_SOCKET)
+            ProcessFrames(connection);
+    }
+}
+
+void IdaServerLoop::Accept()
+{
+    while (connections_.size() < IDA_SERVER_MAX_CONNECTIONS)
+    {
+        const SOCKET clientSocket = accept(listenSocket_, NULL, NULL);
+        if (clientSocket == INVALID_SOCKET)
+        {
+            const int error = IdaSocketLastError();
+            if (!IdaSocketWouldBlock(error))
+                printf("accept failed with error: %d\n", error);
+            return;
+        }
+        if (!IdaSocketSetNonBlocking(clientSocket))
+        {
+            printf("Failed to make client socket non-blocking: %d\n", IdaSocketLastError());
+            closesocket(clientSocket);
+            continue;
+        }
+
+        std::unique_ptr<IdaServerConnection> connection(new IdaServerConnection);
+        connection->Socket = clientSocket;
+        connection->Id = nextId_++;
+        printf("Accepted Client %u\n", connection->Id);
+        handler_.OnConnect(*connection);
+        connections_.push_back(std::move(connection));
+    }
+}
+
+void IdaServerLoop::Receive(IdaServerConnection& connection)
+{
+    char buffer[4096];
+    bool peerClosed = false;
+    size_t received = 0;
+
+    // Whatever is left after the cap is picked up in the next round, after the other clients had their turn
+    while (received < IDA_SERVER_MAX_RECV_PER_ROUND)
+    {
+        const int result = recv(connection.Socket, buffer, sizeof(buffer), 0);
+        if (result > 0)
+        {
+            connection.Decoder.Append(buffer, (size_t)result);
+            received += (size_t)result;
+            continue;
+        }
+        if (result == 0)
+        {
+            // Still handle whatever the client sent before closing, e.g. dbg_process_exit
+            printf("Client %u: connection closing...\n", connection.Id);
+            peerClosed = true;
+            break;
+        }
+        const int error = IdaSocketLastError();
+        if (IdaSocketWouldBlock(error))
+            break;
+        printf("Client %u: recv failed with error: %d\n", connection.Id, error);
+        Close(connection);
+        return;
+    }
+
+    connection.PeerClosed = peerClosed;
+    ProcessFrames(connection);
+}
+
+void IdaServerLoop::ProcessFrames(IdaServerConnection& connection)
+{
+    IdaServerMessage message;
+    while (!connection.Closing && !connection.Pending)
+    {
+        const IdaFrameStatus status = connection.Decoder.Decode(message);
+        if (status == IdaFrameIncomplete)
+            break;
+
+        if (status == IdaFrameComplete)
+        {
+            if (message.Type == IDA_SERVER_MSG_REQUEST)
+            {
+                const unsigned long result = handler_.OnRequest(connection, message);
+                if (result == IDA_SERVER_RESULT_PENDING)
+                {
+                    connection.Pending = true;
+                    connection.PendingSequence = message.Sequence;
+                }
+                else
+                    Respond(connection, message.Sequence, result);
+            }
+        }
+        else if (status == IdaFrameVersionMismatch)
+        {
+            printf("Client %u uses protocol version %u, expected %u\n", connection.Id, message.Version, IDA_SERVER_PROTOCOL_VERSION);
+            connection.Closing = true;
+            Respond(connection, message.Sequence, RESULT_VERSION_MISMATCH);
+        }
+        else
+        {
+            printf("Client %u: invalid frame received (%d), closing connection\n", connection.Id, status);
+            Close(connection);
+            return;
+        }
+        if (connection.Socket == INVALID_SOCKET)
+            return;
+    }
+
+    // Only partial frames or frames behind a pending request can be left at this point, but a client that does not
+    // read its responses piles them up
+    if (connection.Decoder.BufferedSize() > IDA_SERVER_MAX_BUFFERED || connection.SendBuffer.size() > IDA_SERVER_MAX_BUFFERED)
+    {
+        printf("Client %u: too much data buffered, closing connection\n", connection.Id);
+        Close(connection);
+        return;
+    }
+
+    if (connection.PeerClosed && !connection.Pending)
+        Close(connection);
+}
+
+void IdaServerLoop::Respond(IdaServerConnection& connection, uint32_t sequence, unsigned long result)
+{
+    IdaMessageWriter writer;
+    writer.AddULong(IDA_TAG_RESULT, result);
+    const std::vector<uint8_t> frame = writer.Encode(IDA_SERVER_MSG_RESPONSE, sequence);
+    connection.SendBuffer.insert(connection.SendBuffer.end(), frame.begin(), frame.end());
+    Flush(connection);
+}
+
+void IdaServerLoop::Flush(IdaServerConnection& connection)
+{
+    size_t sent = 0;
+    while (sent < connection.SendBuffer.size())
+    {
+        const int result = send(connection.Socket, (const char*)connection.SendBuffer.data() + sent,
+            (int)(connection.SendBuffer.size() - sent), IDA_SOCKET_SEND_FLAGS);
+        if (result == SOCKET_ERROR)
+        {
+            const int error = IdaSocketLastError();
+            if (IdaSocketWouldBlock(error))
+                break;
+            printf("Client %u: send failed with error: %d\n", connection.Id, error);
+            Close(connection);
+            return;
+        }
+        sent += (size_t)result;
+    }
+    connection.SendBuffer.erase(connection.SendBuffer.begin(), connection.SendBuffer.begin() + sent);
+
+    if (connection.Closing && connection.SendBuffer.empty())
+        Close(connection);
+}
+
+void IdaServerLoop::Close(IdaServerConnection& connection)
+{
+    // A pending request still uses the context. It is released when the request completes
+    if (!connection.Pending)
+        handler_.OnDisconnect(connection);
+    closesocket(connection.Socket);
+    connection.Socket = INVALID_SOCKET;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "IdaServerSocket.h"
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "IdaServerProtocol.h"
+
+// Bytes read from one client per select round, so that a client that floods the server cannot starve the others
+#define IDA_SERVER_MAX_RECV_PER_ROUND 0x10000
+// Clients with more than this waiting in their decoder or send buffer are dropped
+#define IDA_SERVER_MAX_BUFFERED (2 * (IDA_SERVER_FRAME_HEADER_SIZE + IDA_SERVER_MAX_PAYLOAD_SIZE))
+// Further clients wait in the listen backlog until a slot frees up
+#define IDA_SERVER_MAX_CONNECTIONS 1024
+
+// Returned by IdaServerHandler::OnRequest when the result is delivered later with IdaServerLoop::Complete
+#define IDA_SERVER_RESULT_PENDING 0xFFFFFFFFUL
+
+struct IdaServerConnection
+{
+    SOCKET Socket = INVALID_SOCKET;
+    unsigned int Id = 0;
+    IdaFrameDecoder Decoder;
+    std::vector<uint8_t> SendBuffer; // Responses that could not be sent without blocking yet
+    bool Closing = false; // Close as soon as SendBuffer has been flushed
+    bool PeerClosed = false; // The client shut down its side. Close once the frames it sent before have been handled
+    bool Pending = false; // A request is in progress outside the loop. Later requests wait in Decoder until it completes
+    uint32_t PendingSequence = 0;
+    void* Context = nullptr; // Owned by the handler
+};
+
+class IdaServerHandler
+{
+public:
+    virtual ~IdaServerHandler() {}
+
+    virtual void OnConnect(IdaServerConnection& connection) = 0;
+
+    // Returns the RESULT_* for the response. Set connection.Closing to end the session after the response.
+    // Slow requests can return IDA_SERVER_RESULT_PENDING and hand the work to another thread, which calls
+    // IdaServerLoop::Complete when it is done. Until then connection and its Context are left alone by the loop
+    virtual unsigned long OnRequest(IdaServerConnection& connection, const IdaServerMessage& message) = 0;
+
+    // Not called while a request of the connection is pending, even if its socket is gone already
+    virtual void OnDisconnect(IdaServerConnection& connection) = 0;
+};
+
+// Single-threaded, readiness based event loop that serves any number of clients at the same time.
+// All sockets are non-blocking, so a client that stops sending or reading cannot stall the others.
+// The destructor disconnects all connections including pending ones, so stop the handler's workers first.
+class IdaServerLoop
+{
+public:
+    explicit IdaServerLoop(IdaServerHandler& handler) : handler_(handler) {}
+    ~IdaServerLoop();
+
+    // port "0" picks a free port, see LocalPort
+    bool Listen(const char* port);
+    unsigned short LocalPort() const;
+
+    // Waits up to timeoutMs for socket activity and processes it. Returns false on a fatal error
+    bool RunOnce(int timeoutMs);
+
+    void Run();
+    void Stop() { stop_ = true; }
+
+    // Thread safe. Sends the result of the pending request of the connection and resumes its other requests
+    void Complete(unsigned int connectionId, unsigned long result);
+
+    size_t NumConnections() const { return connections_.size(); }
+
+private:
+    bool CreateWakeup();
+    void ApplyCompletions();
+    void Accept();
+    void Receive(IdaServerConnection& connection);
+    void ProcessFrames(IdaServerConnection& connection);
+    void Flush(IdaServerConnection& connection);
+    void Respond(IdaServerConnection& connection, uint32_t sequence, unsigned long result);
+    void Close(IdaServerConnection& connection);
+
+    IdaServerHandler& handler_;
+    SOCKET listenSocket_ = INVALID_SOCKET;
+    std::vector<std::unique_ptr<IdaServerConnection>> connections_;
+    unsigned int nextId_ = 1;
+    bool stop_ = false;
+
+    std::vector<pollfd> pollFds_;
+    std::vector<IdaServerConnection*> polledConnections_; // Of pollFds_[2...]
+
+    // Complete queues the result and writes a byte to wakeupWrite_, which makes the poll in RunOnce return
+    std::mutex completionsMutex_;
+    std::vector<std::pair<unsigned int, unsigned long>> completions_;
+    SOCKET wakeupRead_ = INVALID_SOCKET;
+    SOCKET wakeupWrite_ = INVALID_SOCKET;
+};
@@ -0,0 +1,227 @@
+#include "IdaServerProtocol.h"
+
+// Maps the protocol setting IDs to the profile members. Indexed by ida_server_setting_t
+static BOOL scl::Settings::Profile::* const kSettingMembers[ida_setting_count] =
+{
+    &scl::Settings::Profile::fixPebBeingDebugged,
+    &scl::Settings::Profile::fixPebHeapFlags,
+    &scl::Settings::Profile::fixPebNtGlobalFlag,
+    &scl::Settings::Profile::fixPebStartupInfo,
+    &scl::Settings::Profile::fixPebOsBuildNumber,
+    &scl::Settings::Profile::hookOutputDebugStringA,
+    &scl::Settings::Profile::hookNtSetInformationThread,
+    &scl::Settings::Profile::hookNtQuerySystemInformation,
+    &scl::Settings::Profile::hookNtQueryInformationProcess,
+    &scl::Settings::Profile::hookNtSetInformationProcess,
+    &scl::Settings::Profile::hookNtQueryObject,
+    &scl::Settings::Profile::hookNtYieldExecution,
+    &scl::Settings::Profile::hookNtClose,
+    &scl::Settings::Profile::malwareRunpeUnpacker,
+    &scl::Settings::Profile::preventThreadCreation,
+    &scl::Settings::Profile::hookNtCreateThreadEx,
+    &scl::Settings::Profile::hookNtGetContextThread,
+    &scl::Settings::Profile::hookNtSetContextThread,
+    &scl::Settings::Profile::hookNtContinue,
+    &scl::Settings::Profile::hookKiUserExceptionDispatcher,
+    &scl::Settings::Profile::hookNtUserBlockInput,
+    &scl::Settings::Profile::hookNtUserQueryWindow,
+    &scl::Settings::Profile::hookNtUserGetForegroundWindow,
+    &scl::Settings::Profile::hookNtUserBuildHwndList,
+    &scl::Settings::Profile::hookNtUserFindWindowEx,
+    &scl::Settings::Profile::hookNtSetDebugFilterState,
+    &scl::Settings::Profile::hookGetTickCount,
+    &scl::Settings::Profile::hookGetTickCount64,
+    &scl::Settings::Profile::hookGetLocalTime,
+    &scl::Settings::Profile::hookGetSystemTime,
+    &scl::Settings::Profile::hookNtQuerySystemTime,
+    &scl::Settings::Profile::hookNtQueryPerformanceCounter,
+    &scl::Settings::Profile::dllStealth,
+    &scl::Settings::Profile::dllNormal,
+    &scl::Settings::Profile::dllUnload,
+};
+
+static void PutU16(std::vector<uint8_t>& out, uint16_t value)
+{
+    out.push_back((uint8_t)value);
+    out.push_back((uint8_t)(value >> 8));
+}
+
+static void PutU32(std::vector<uint8_t>& out, uint32_t value)
+{
+    PutU16(out, (uint16_t)value);
+    PutU16(out, (uint16_t)(value >> 16));
+}
+
+static uint16_t GetU16(const uint8_t* p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t GetU32(const uint8_t* p)
+{
+    return (uint32_t)GetU16(p) | ((uint32_t)GetU16(p + 2) << 16);
+}
+
+void IdaMessageWriter::AddULong(uint16_t tag, uint32_t value)
+{
+    PutU16(payload_, tag);
+    PutU16(payload_, sizeof(uint32_t));
+    PutU32(payload_, value);
+}
+
+void IdaMessageWriter::AddUChar(uint16_t tag, uint8_t value)
+{
+    PutU16(payload_, tag);
+    PutU16(payload_, sizeof(uint8_t));
+    payload_.push_back(value);
+}
+
+void IdaMessageWriter::AddString(uint16_t tag, const std::wstring& value)
+{
+    const size_t maxChars = 0xFFFF / sizeof(uint16_t);
+    const size_t numChars = value.size() < maxChars ? value.size() : maxChars;
+    PutU16(payload_, tag);
+    PutU16(payload_, (uint16_t)(numChars * sizeof(uint16_t)));
+    for (size_t i = 0; i < numChars; i++)
+    {
+        PutU16(payload_, (uint16_t)value[i]);
+    }
+}
+
+void IdaMessageWriter::AddBytes(uint16_t tag, const void* data, size_t size)
+{
+    const uint16_t length = size < 0xFFFF ? (uint16_t)size : (uint16_t)0xFFFF;
+    PutU16(payload_, tag);
+    PutU16(payload_, length);
+    payload_.insert(payload_.end(), (const uint8_t*)data, (const uint8_t*)data + length);
+}
+
+void IdaMessageWriter::AddSettings(const scl::Settings::Profile& current, const scl::Settings::Profile* previous)
+{
+    for (uint16_t i = 0; i < ida_setting_count; i++)
+    {
+        const BOOL value = current.*kSettingMembers[i];
+        if (previous == nullptr || (previous->*kSettingMembers[i] != 0) != (value != 0))
+        {
+            AddUChar((uint16_t)(IDA_TAG_SETTING_BASE + i), value ? 1 : 0);
+        }
+    }
+}
+
+std::vector<uint8_t> IdaMessageWriter::Encode(uint16_t type, uint32_t sequence) const
+{
+    std::vector<uint8_t> frame;
+    frame.reserve(IDA_SERVER_FRAME_HEADER_SIZE + payload_.size());
+    PutU32(frame, IDA_SERVER_PROTOCOL_MAGIC);
+    PutU16(frame, IDA_SERVER_PROTOCOL_VERSION);
+    PutU16(frame, type);
+    PutU32(frame, sequence);
+    PutU32(frame, (uint32_t)payload_.size());
+    frame.insert(frame.end(), payload_.begin(), payload_.end());
+    return frame;
+}
+
+bool IdaMessageReader::Next(uint16_t& tag, const uint8_t*& value, uint16_t& length)
+{
+    if (size_ - offset_ < 2 * sizeof(uint16_t))
+        return false;
+
+    const uint16_t tlvLength = GetU16(data_ + offset_ + sizeof(uint16_t));
+    if (size_ - offset_ - 2 * sizeof(uint16_t) < tlvLength)
+        return false;
+
+    tag = GetU16(data_ + offset_);
+    length = tlvLength;
+    value = data_ + offset_ + 2 * sizeof(uint16_t);
+    offset_ += 2 * sizeof(uint16_t) + tlvLength;
+    return true;
+}
+
+bool IdaMessageReader::ReadULong(const uint8_t* value, uint16_t length, uint32_t& out)
+{
+    if (length != sizeof(uint32_t))
+        return false;
+    out = GetU32(value);
+    return true;
+}
+
+bool IdaMessageReader::ReadString(const uint8_t* value, uint16_t length, std::wstring& out)
+{
+    if (length % sizeof(uint16_t) != 0)
+        return false;
+    out.resize(length / sizeof(uint16_t));
+    for (size_t i = 0; i < out.size(); i++)
+    {
+        out[i] = (wchar_t)GetU16(value + i * sizeof(uint16_t));
+    }
+    return true;
+}
+
+bool IdaMessageReader::ApplySetting(scl::Settings::Profile& profile, uint16_t tag, const uint8_t* value, uint16_t length)
+{
+    if (tag < IDA_TAG_SETTING_BASE || tag >= IDA_TAG_SETTING_BASE + ida_setting_count || length != sizeof(uint8_t))
+        return false;
+    profile.*kSettingMembers[tag - IDA_TAG_SETTING_BASE] = value[0] != 0;
+    return true;
+}
+
+void IdaFrameDecoder::Append(const void* data, size_t size)
+{
+    buffer_.insert(buffer_.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+}
+
+IdaFrameStatus IdaFrameDecoder::Decode(IdaServerMessage& message)
+{
+    if (buffer_.size() < IDA_SERVER_FRAME_HEADER_SIZE)
+        return IdaFrameIncomplete;
+
+    const uint8_t* header = buffer_.data();
+    if (GetU32(header) != IDA_SERVER_PROTOCOL_MAGIC)
+        return IdaFrameBadMagic;
+
+    message.Version = GetU16(header + 4);
+    message.Type = GetU16(header + 6);
+    message.Sequence = GetU32(header + 8);
+    if (message.Version != IDA_SERVER_PROTOCOL_VERSION)
+        return IdaFrameVersionMismatch;
+
+    const uint32_t payloadLength = GetU32(header + 12);
+    if (payloadLength > IDA_SERVER_MAX_PAYLOAD_SIZE)
+        return IdaFrameTooLarge;
+    if (buffer_.size() - IDA_SERVER_FRAME_HEADER_SIZE < payloadLength)
+        return IdaFrameIncomplete;
+
+    message.Payload.assign(buffer_.begin() + IDA_SERVER_FRAME_HEADER_SIZE,
+        buffer_.begin() + IDA_SERVER_FRAME_HEADER_SIZE + payloadLength);
+    buffer_.erase(buffer_.begin(), buffer_.begin() + IDA_SERVER_FRAME_HEADER_SIZE + payloadLength);
+    return IdaFrameComplete;
+}
+
+bool IdaSendFrame(SOCKET socket, const std::vector<uint8_t>& frame)
+{
+    size_t sent = 0;
+    while (sent < frame.size())
+    {
+        const int result = send(socket, (const char*)frame.data() + sent, (int)(frame.size() - sent), IDA_SOCKET_SEND_FLAGS);
+        if (result == SOCKET_ERROR || result == 0)
+            return false;
+        sent += (size_t)result;
+    }
+    return true;
+}
+
+IdaFrameStatus IdaRecvFrame(SOCKET socket, IdaFrameDecoder& decoder, IdaServerMessage& message)
+{
+    char buffer[4096];
+    IdaFrameStatus status;
+    while ((status = decoder.Decode(message)) == IdaFrameIncomplete)
+    {
+        const int result = recv(socket, buffer, sizeof(buffer), 0);
+        if (result == 0)
+            return IdaFrameConnectionClosed;
+        if (result < 0)
+            return IdaFrameSocketError;
+        decoder.Append(buffer, (size_t)result);
+    }
+    return status;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "IdaServerSocket.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <Scylla/Settings.h>
+
+#include "IdaServerExchange.h"
+
+enum IdaFrameStatus
+{
+    IdaFrameIncomplete = 0,     // Need more bytes
+    IdaFrameComplete,           // A message was decoded
+    IdaFrameBadMagic,           // Not our protocol or the stream is out of sync
+    IdaFrameVersionMismatch,    // The peer speaks a different protocol version
+    IdaFrameTooLarge,           // Payload length exceeds IDA_SERVER_MAX_PAYLOAD_SIZE
+    IdaFrameConnectionClosed,   // recv returned 0
+    IdaFrameSocketError         // recv failed
+};
+
+struct IdaServerMessage
+{
+    uint16_t Version = 0;
+    uint16_t Type = 0;
+    uint32_t Sequence = 0;
+    std::vector<uint8_t> Payload;
+};
+
+// Builds the TLV payload of a message and encodes it into a frame
+class IdaMessageWriter
+{
+public:
+    void AddULong(uint16_t tag, uint32_t value);
+    void AddUChar(uint16_t tag, uint8_t value);
+    void AddString(uint16_t tag, const std::wstring& value);
+    void AddBytes(uint16_t tag, const void* data, size_t size);
+
+    // Appends settings TLVs. If previous is null all settings are written, otherwise only those that differ
+    void AddSettings(const scl::Settings::Profile& current, const scl::Settings::Profile* previous);
+
+    std::vector<uint8_t> Encode(uint16_t type, uint32_t sequence) const;
+
+private:
+    std::vector<uint8_t> payload_;
+};
+
+// Iterates over the TLVs of a decoded message. All reads are bounds checked
+class IdaMessageReader
+{
+public:
+    explicit IdaMessageReader(const IdaServerMessage& message) : data_(message.Payload.data()), size_(message.Payload.size()) {}
+
+    // Returns false at the end of the payload or if the next TLV is truncated
+    bool Next(uint16_t& tag, const uint8_t*& value, uint16_t& length);
+
+    static bool ReadULong(const uint8_t* value, uint16_t length, uint32_t& out);
+    static bool ReadString(const uint8_t* value, uint16_t length, std::wstring& out);
+
+    // Applies a settings TLV to the profile. Returns false if the tag is not a known setting
+    static bool ApplySetting(scl::Settings::Profile& profile, uint16_t tag, const uint8_t* value, uint16_t length);
+
+private:
+    const uint8_t* data_;
+    size_t size_;
+    size_t offset_ = 0;
+};
+
+// Reassembles frames from a byte stream that may arrive in arbitrary pieces
+class IdaFrameDecoder
+{
+public:
+    void Append(const void* data, size_t size);
+    IdaFrameStatus Decode(IdaServerMessage& message);
+    void Reset() { buffer_.clear(); }
+    size_t BufferedSize() const { return buffer_.size(); }
+
+private:
+    std::vector<uint8_t> buffer_;
+};
+
+bool IdaSendFrame(SOCKET socket, const std::vector<uint8_t>& frame);
+
+// Blocks until a complete frame has been received, the connection is closed or an error occurs
+IdaFrameStatus IdaRecvFrame(SOCKET socket, IdaFrameDecoder& decoder, IdaServerMessage& message);
@@ -0,0 +1,80 @@
+#pragma once
+
+// Thin portability layer over Winsock and BSD sockets for the IDA server and client.
+// Include this before any other header that pulls in WinSock2.h.
+
+#ifdef _WIN32
+
+#include <WinSock2.h>
+#include <ws2tcpip.h>
+
+#define IDA_SOCKET_SEND_FLAGS 0
+
+// WSAPoll, unlike select, has no limit on the number of sockets
+inline int IdaSocketPoll(pollfd* fds, size_t numFds, int timeoutMs)
+{
+    return WSAPoll(fds, (ULONG)numFds, timeoutMs);
+}
+
+inline int IdaSocketLastError()
+{
+    return WSAGetLastError();
+}
+
+inline bool IdaSocketWouldBlock(int error)
+{
+    return error == WSAEWOULDBLOCK;
+}
+
+inline bool IdaSocketSetNonBlocking(SOCKET socket)
+{
+    u_long nonBlocking = 1;
+    return ioctlsocket(socket, FIONBIO, &nonBlocking) == 0;
+}
+
+#else
+
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+#define SD_SEND SHUT_WR
+#define SD_BOTH SHUT_RDWR
+
+#define IDA_SOCKET_SEND_FLAGS MSG_NOSIGNAL // Report EPIPE instead of raising SIGPIPE
+
+inline int closesocket(SOCKET socket)
+{
+    return close(socket);
+}
+
+inline int IdaSocketLastError()
+{
+    return errno;
+}
+
+// select can't watch descriptors >= FD_SETSIZE, which a busy server process easily reaches
+inline int IdaSocketPoll(pollfd* fds, size_t numFds, int timeoutMs)
+{
+    return poll(fds, (nfds_t)numFds, timeoutMs);
+}
+
+inline bool IdaSocketWouldBlock(int error)
+{
+    return error == EWOULDBLOCK || error == EAGAIN;
+}
+
+inline bool IdaSocketSetNonBlocking(SOCKET socket)
+{
+    const int flags = fcntl(socket, F_GETFL, 0);
+    return flags != -1 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+#endif
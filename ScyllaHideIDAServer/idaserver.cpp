@@ -1,12 +1,17 @@
-#include <WinSock2.h>
+#include "IdaServerSocket.h"
 #include <Scylla/Logger.h>
 #include <Scylla/OsInfo.h>
 #include <Scylla/Settings.h>
 #include <Scylla/Util.h>
 #include <Scylla/Version.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 
 #include "idaserver.h"
 #include "IdaServerExchange.h"
+#include "IdaServerLoop.h"
 #include "..\PluginGeneric\Injector.h"
 
 #ifdef _WIN64
@@ -19,14 +24,19 @@ scl::Settings g_settings;
 scl::Logger g_log;
 std::wstring g_scyllaHideDllPath;
 
-HOOK_DLL_DATA g_hdd;
-
 WSADATA wsaData;
 char * ListenPortString = IDA_SERVER_DEFAULT_PORT_TEXT;
 unsigned short ListenPort = IDA_SERVER_DEFAULT_PORT;
-IDA_SERVER_EXCHANGE idaExchange = { 0 };
-DWORD ProcessId = 0;
-bool bHooked = false;
+
+// State of one IDA client. Every client debugs its own process with its own settings
+struct ClientSession
+{
+    scl::Settings::Profile settings{};
+    HOOK_DLL_DATA hdd{};
+    DWORD ProcessId = 0;
+    bool bHooked = false;
+    bool bitnessChecked = false;
+};
 
 static void LogCallback(const wchar_t * msg)
 {
@@ -58,132 +68,9 @@ static void checkPaths(const std::wstring & wstrPath)
     }
 }
 
-static void startListen()
-{
-    int iResult;
-
-    SOCKET ListenSocket = INVALID_SOCKET;
-    SOCKET ClientSocket = INVALID_SOCKET;
-
-    struct addrinfo *result = NULL;
-    struct addrinfo hints;
-
-    ZeroMemory(&hints, sizeof(hints));
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = IPPROTO_TCP;
-    hints.ai_flags = AI_PASSIVE;
-
-    // Resolve the server address and port
-    iResult = getaddrinfo(NULL, ListenPortString, &hints, &result);
-    if (iResult != 0)
-    {
-        printf("getaddrinfo failed with error: %d\n", iResult);
-        WSACleanup();
-        return;
-    }
-
-    // Create a SOCKET for connecting to server
-    ListenSocket = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
-    if (ListenSocket == INVALID_SOCKET)
-    {
-        printf("socket failed with error: %ld\n", WSAGetLastError());
-        freeaddrinfo(result);
-        WSACleanup();
-        return;
-    }
-
-    // Setup the TCP listening socket
-    iResult = bind(ListenSocket, result->ai_addr, (int)result->ai_addrlen);
-    if (iResult == SOCKET_ERROR)
-    {
-        printf("bind failed with error: %d\n", WSAGetLastError());
-        freeaddrinfo(result);
-        closesocket(ListenSocket);
-        WSACleanup();
-        return;
-    }
-
-    freeaddrinfo(result);
-
-    iResult = listen(ListenSocket, SOMAXCONN);
-    if (iResult == SOCKET_ERROR)
-    {
-        printf("listen failed with error: %d\n", WSAGetLastError());
-        closesocket(ListenSocket);
-        WSACleanup();
-        return;
-    }
-
-    printf("Listening on port %s...\n", ListenPortString);
-
-    int count = 0;
-
-    while (1)
-    {
-        ClientSocket = accept(ListenSocket, NULL, NULL);
-        if (ClientSocket == INVALID_SOCKET)
-        {
-            printf("accept failed with error: %d\n", WSAGetLastError());
-            break;
-        }
-        else
-        {
-            count++;
-
-            printf("Accepted Client %d\n", count);
-            handleClient(ClientSocket);
-            closesocket(ClientSocket);
-        }
-    }
-
-    closesocket(ListenSocket);
-
-    WSACleanup();
-}
-
-void MapSettings()
-{
-    g_settings.opts().dllUnload = idaExchange.UnloadDllAfterInjection;
-    g_settings.opts().dllNormal = idaExchange.DllInjectNormal;
-    g_settings.opts().dllStealth = idaExchange.DllInjectStealth;
-    g_settings.opts().hookKiUserExceptionDispatcher = idaExchange.EnableKiUserExceptionDispatcherHook;
-    g_settings.opts().hookNtClose = idaExchange.EnableNtCloseHook;
-    g_settings.opts().hookNtContinue = idaExchange.EnableNtCloseHook;
-    g_settings.opts().hookNtCreateThreadEx = idaExchange.EnableNtCreateThreadExHook;
-    g_settings.opts().hookNtGetContextThread = idaExchange.EnableNtGetContextThreadHook;
-    g_settings.opts().hookNtQueryInformationProcess = idaExchange.EnableNtQueryInformationProcessHook;
-    g_settings.opts().hookNtQueryObject = idaExchange.EnableNtQueryObjectHook;
-    g_settings.opts().hookNtQuerySystemInformation = idaExchange.EnableNtQuerySystemInformationHook;
-    g_settings.opts().hookNtSetContextThread = idaExchange.EnableNtSetContextThreadHook;
-    g_settings.opts().hookNtSetDebugFilterState = idaExchange.EnableNtSetDebugFilterStateHook;
-    g_settings.opts().hookNtSetInformationThread = idaExchange.EnableNtSetInformationThreadHook;
-    g_settings.opts().hookNtUserBlockInput = idaExchange.EnableNtUserBlockInputHook;
-    g_settings.opts().hookNtUserBuildHwndList = idaExchange.EnableNtUserBuildHwndListHook;
-    g_settings.opts().hookNtUserFindWindowEx = idaExchange.EnableNtUserFindWindowExHook;
-    g_settings.opts().hookNtUserQueryWindow = idaExchange.EnableNtUserQueryWindowHook;
-    g_settings.opts().hookNtYieldExecution = idaExchange.EnableNtYieldExecutionHook;
-    g_settings.opts().preventThreadCreation = idaExchange.EnablePreventThreadCreation;
-    g_settings.opts().hookOutputDebugStringA = idaExchange.EnableOutputDebugStringHook;
-    g_settings.opts().hookNtSetInformationProcess = idaExchange.EnableNtSetInformationProcessHook;
-
-    g_settings.opts().hookGetTickCount = idaExchange.EnableGetTickCountHook;
-    g_settings.opts().hookGetTickCount64 = idaExchange.EnableGetTickCount64Hook;
-    g_settings.opts().hookGetLocalTime = idaExchange.EnableGetLocalTimeHook;
-    g_settings.opts().hookGetSystemTime = idaExchange.EnableGetSystemTimeHook;
-    g_settings.opts().hookNtQuerySystemTime = idaExchange.EnableNtQuerySystemTimeHook;
-    g_settings.opts().hookNtQueryPerformanceCounter = idaExchange.EnableNtQueryPerformanceCounterHook;
-
-    g_settings.opts().fixPebBeingDebugged = idaExchange.EnablePebBeingDebugged;
-    g_settings.opts().fixPebHeapFlags = idaExchange.EnablePebHeapFlags;
-    g_settings.opts().fixPebNtGlobalFlag = idaExchange.EnablePebNtGlobalFlag;
-    g_settings.opts().fixPebStartupInfo = idaExchange.EnablePebStartupInfo;
-
-    g_settings.opts().malwareRunpeUnpacker = idaExchange.EnableMalwareRunPeUnpacker;
-}
-
-static void DoSomeBitCheck()
+static bool DoSomeBitCheck(DWORD ProcessId)
 {
+    bool bitnessMatches = true;
     if (scl::IsWindows64())
     {
         HANDLE hProcess = OpenProcess(PROCESS_QUERY_INFORMATION, 0, ProcessId);
@@ -193,109 +80,208 @@ static void DoSomeBitCheck()
 #ifdef _WIN64
             if (scl::IsWow64Process(hProcess))
             {
-                printf("WARNING: This is a 32bit process and I am 64bit!");
-                getchar();
-                ExitProcess(0);
+                printf("WARNING: Process %u is a 32bit process and I am 64bit!\n", ProcessId);
+                bitnessMatches = false;
             }
 #else
             if (!scl::IsWow64Process(hProcess))
             {
-                printf("WARNING: This is a 64bit process and I am 32bit!");
-                getchar();
-                ExitProcess(0);
+                printf("WARNING: Process %u is a 64bit process and I am 32bit!\n", ProcessId);
+                bitnessMatches = false;
             }
 #endif
             CloseHandle(hProcess);
         }
     }
+    return bitnessMatches;
 }
 
-static void handleClient(SOCKET ClientSocket)
+// Injection is slow and must not stall the other clients, so it runs on a worker thread. There is only one,
+// because the injector reads the global settings
+class ServerHandler : public IdaServerHandler
 {
-    int iResult;
-    bool once = false;
-
-    do
+public:
+    void Start(IdaServerLoop& loop)
     {
-        iResult = recv(ClientSocket, (char*)&idaExchange, sizeof(IDA_SERVER_EXCHANGE), 0);
+        loop_ = &loop;
+        worker_ = std::thread(&ServerHandler::WorkerThread, this);
+    }
 
-        if (iResult == sizeof(IDA_SERVER_EXCHANGE))
+    // Finishes the queued jobs. Their results are not sent anymore, as the loop has stopped
+    void Shutdown()
+    {
         {
-            MapSettings();
+            std::lock_guard<std::mutex> lock(jobsMutex_);
+            shutdown_ = true;
+        }
+        jobsChanged_.notify_one();
+        if (worker_.joinable())
+            worker_.join();
+    }
 
-            switch (idaExchange.notif_code)
-            {
-            case dbg_process_attach:
-            {
+    void OnConnect(IdaServerConnection& connection) override
+    {
+        connection.Context = new ClientSession;
+    }
+
+    void OnDisconnect(IdaServerConnection& connection) override
+    {
+        delete (ClientSession*)connection.Context;
+        connection.Context = nullptr;
+    }
 
+    unsigned long OnRequest(IdaServerConnection& connection, const IdaServerMessage& message) override
+    {
+        ClientSession& session = *(ClientSession*)connection.Context;
+
+        InjectionJob job;
+        job.ConnectionId = connection.Id;
+        job.Session = &session;
+        job.NotifCode = dbg_null;
+        IdaMessageReader reader(message);
+        uint16_t tag, length;
+        const uint8_t* value;
+        while (reader.Next(tag, value, length))
+        {
+            uint32_t number;
+            switch (tag)
+            {
+            case IDA_TAG_NOTIF_CODE:
+                if (IdaMessageReader::ReadULong(value, length, number))
+                    job.NotifCode = number;
+                break;
+            case IDA_TAG_PROCESS_ID:
+                if (IdaMessageReader::ReadULong(value, length, number))
+                    session.ProcessId = number;
+                break;
+            case IDA_TAG_DLL_PATH:
+                IdaMessageReader::ReadString(value, length, job.DllPath);
+                break;
+            default:
+                IdaMessageReader::ApplySetting(session.settings, tag, value, length);
                 break;
             }
-            case dbg_process_start:
-            {
+        }
 
-                ProcessId = idaExchange.ProcessId;
-                bHooked = false;
-                ZeroMemory(&g_hdd, sizeof(HOOK_DLL_DATA));
+        switch (job.NotifCode)
+        {
+        case dbg_process_exit:
+            connection.Closing = true; //terminate session
+            return RESULT_SUCCESS;
+        case dbg_library_load:
+            if (!session.bHooked)
+                return RESULT_SUCCESS;
+            break;
+        case dbg_process_start:
+        case inject_dll:
+            break;
+        default:
+            return RESULT_SUCCESS;
+        }
 
-                if (!once)
-                {
-                    DoSomeBitCheck();
-                    once = true;
-                }
+        // The loop does not touch the session until the job has completed
+        {
+            std::lock_guard<std::mutex> lock(jobsMutex_);
+            jobs_.push_back(std::move(job));
+        }
+        jobsChanged_.notify_one();
+        return IDA_SERVER_RESULT_PENDING;
+    }
 
-                if (!bHooked)
-                {
-                    bHooked = true;
-                    startInjection(ProcessId, &g_hdd, g_scyllaHideDllPath.c_str(), true);
-                }
+private:
+    struct InjectionJob
+    {
+        unsigned int ConnectionId;
+        ClientSession* Session;
+        unsigned long NotifCode;
+        std::wstring DllPath;
+    };
 
-                break;
-            }
-            case dbg_process_exit:
+    void WorkerThread()
+    {
+        for (;;)
+        {
+            InjectionJob job;
             {
-
-                iResult = -1; //terminate loop
-                break;
+                std::unique_lock<std::mutex> lock(jobsMutex_);
+                jobsChanged_.wait(lock, [this] { return shutdown_ || !jobs_.empty(); });
+                if (jobs_.empty())
+                    return;
+                job = std::move(jobs_.front());
+                jobs_.pop_front();
             }
-            case dbg_library_load:
-            {
+            loop_->Complete(job.ConnectionId, RunJob(job));
+        }
+    }
 
-                if (bHooked)
-                {
-                    startInjection(ProcessId, &g_hdd, g_scyllaHideDllPath.c_str(), false);
-                }
-                break;
-            }
+    static unsigned long RunJob(InjectionJob& job)
+    {
+        ClientSession& session = *job.Session;
 
-            case inject_dll:
-            {
-                if (!once)
-                {
-                    DoSomeBitCheck();
-                    once = true;
-                }
+        // Only this thread uses the injector
+        g_settings.opts() = session.settings;
 
-                injectDll(ProcessId, idaExchange.DllPathForInjection);
-                break;
-            }
+        switch (job.NotifCode)
+        {
+        case dbg_process_start:
+        {
+            session.bHooked = false;
+            ZeroMemory(&session.hdd, sizeof(HOOK_DLL_DATA));
+
+            if (!session.bitnessChecked)
+            {
+                if (!DoSomeBitCheck(session.ProcessId))
+                    return RESULT_FAILED;
+                session.bitnessChecked = true;
             }
 
-            idaExchange.result = RESULT_SUCCESS;
-            send(ClientSocket, (char*)&idaExchange, sizeof(IDA_SERVER_EXCHANGE), 0);
+            session.bHooked = true;
+            startInjection(session.ProcessId, &session.hdd, g_scyllaHideDllPath.c_str(), true);
+            break;
         }
-        else if (iResult == 0)
+        case dbg_library_load:
         {
-            printf("Connection closing...\n");
+            startInjection(session.ProcessId, &session.hdd, g_scyllaHideDllPath.c_str(), false);
+            break;
         }
-        else if (iResult < 0)
+        case inject_dll:
         {
-            printf("recv failed with error: %d\n", WSAGetLastError());
+            if (!session.bitnessChecked)
+            {
+                if (!DoSomeBitCheck(session.ProcessId))
+                    return RESULT_FAILED;
+                session.bitnessChecked = true;
+            }
+
+            injectDll(session.ProcessId, job.DllPath.c_str());
+            break;
         }
-        else
-        {
-            printf("Something is wrong, unknown struct size %zd\n", sizeof(IDA_SERVER_EXCHANGE));
         }
-    } while (iResult > 0);
+
+        return RESULT_SUCCESS;
+    }
+
+    IdaServerLoop* loop_ = nullptr;
+    std::thread worker_;
+    std::mutex jobsMutex_;
+    std::condition_variable jobsChanged_;
+    std::deque<InjectionJob> jobs_;
+    bool shutdown_ = false;
+};
+
+static void startListen()
+{
+    ServerHandler handler;
+    IdaServerLoop loop(handler);
+    if (loop.Listen(ListenPortString))
+    {
+        printf("Listening on port %s...\n", ListenPortString);
+        handler.Start(loop);
+        loop.Run();
+        handler.Shutdown();
+    }
+
+    WSACleanup();
 }
 
 
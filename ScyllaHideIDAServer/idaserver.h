@@ -1,7 +1,6 @@
 #pragma once
 
-#include <winsock2.h>
-#include <ws2tcpip.h>
+#include "IdaServerSocket.h"
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -11,6 +10,5 @@
 
 BOOL startWinsock();
 void startListen();
-void handleClient( SOCKET ClientSocket );
 
 
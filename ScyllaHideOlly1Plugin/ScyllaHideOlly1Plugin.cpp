@@ -192,6 +192,7 @@ static void HandleDetachProcess()
         }
     }
 
+    ResetDebugStringLog();
     DebugSetProcessKillOnExit(FALSE);
 
     //terminate olly
@@ -453,6 +454,7 @@ extern "C" void DLL_EXPORT _ODBG_Pluginmainloop(DEBUG_EVENT *debugevent)
         }
 
         ZeroMemory(&g_hdd, sizeof(HOOK_DLL_DATA));
+        ResetTlsCallbacks();
 
         //change olly caption again !
         SetWindowTextW(hwmain, g_settings.opts().ollyWindowTitle.c_str());
@@ -467,6 +469,11 @@ extern "C" void DLL_EXPORT _ODBG_Pluginmainloop(DEBUG_EVENT *debugevent)
 
     case LOAD_DLL_DEBUG_EVENT:
     {
+        if (g_settings.opts().ollyBreakOnTls)
+        {
+            RecheckTlsCallbacks(ProcessId, (LPVOID)ImageBase);
+        }
+
         if (bHooked)
         {
             if (g_settings.opts().ollyFixBugs && scl::IsWindows64()) {
@@ -515,6 +522,8 @@ extern "C" void DLL_EXPORT _ODBG_Pluginreset(void)
     bHooked = false;
     bEPBreakRemoved = false;
     ProcessId = 0;
+    ResetTlsCallbacks();
+    ResetDebugStringLog();
 }
 
 BOOL WINAPI DllMain(HINSTANCE hInstDll, DWORD dwReason, LPVOID lpReserved)
@@ -0,0 +1,261 @@
+#pragma once
+
+#include <windows.h>
+#include <cstring>
+#include <map>
+#include <vector>
+
+// File offset, RVA and VA conversions for the advanced Ctrl+G dialog, from the section table of the module on disk.
+// Parsing works on the bytes the caller read from the start of the file, and the cache is keyed by what the caller
+// knows of the file, so there is no file I/O here and UnitTests can run it over sample images.
+
+class SectionTable
+{
+public:
+    // Returned for file offsets, RVAs and VAs that do not map: the overlay, padding after a section's raw data, zero
+    // filled tails of sections and anything past the end of the file or the image. 0 is a valid offset and RVA
+    static const DWORD Invalid = 0xFFFFFFFF;
+    static const DWORD_PTR InvalidVa = (DWORD_PTR)-1;
+
+    SectionTable()
+        : fileSize_(0), sizeOfImage_(0), headerSize_(0)
+    {
+    }
+
+    // data holds the first size bytes of a file of fileSize bytes. Sections whose header is not in data are dropped,
+    // the headers fit in the first page of every file the dialog has to handle
+    bool Parse(const BYTE* data, size_t size, ULONGLONG fileSize)
+    {
+        sections_.clear();
+        fileSize_ = 0;
+        sizeOfImage_ = 0;
+        headerSize_ = 0;
+
+        if (size > fileSize || size < sizeof(IMAGE_DOS_HEADER))
+            return false;
+
+        IMAGE_DOS_HEADER dos;
+        memcpy(&dos, data, sizeof(dos));
+        if (dos.e_magic != IMAGE_DOS_SIGNATURE || dos.e_lfanew < 0 ||
+            (ULONGLONG)dos.e_lfanew + sizeof(DWORD) + sizeof(IMAGE_FILE_HEADER) + sizeof(WORD) > size)
+            return false;
+
+        const BYTE* nt = data + dos.e_lfanew;
+        DWORD signature;
+        IMAGE_FILE_HEADER fileHeader;
+        WORD magic;
+        memcpy(&signature, nt, sizeof(signature));
+        memcpy(&fileHeader, nt + sizeof(DWORD), sizeof(fileHeader));
+        memcpy(&magic, nt + sizeof(DWORD) + sizeof(IMAGE_FILE_HEADER), sizeof(magic));
+        if (signature != IMAGE_NT_SIGNATURE)
+            return false;
+
+        // SizeOfImage and SizeOfHeaders are at the same offsets in PE32 and PE32+
+        if ((magic != IMAGE_NT_OPTIONAL_HDR32_MAGIC && magic != IMAGE_NT_OPTIONAL_HDR64_MAGIC) ||
+            (ULONGLONG)dos.e_lfanew + sizeof(IMAGE_NT_HEADERS32) > size)
+            return false;
+        IMAGE_NT_HEADERS32 headers;
+        memcpy(&headers, nt, sizeof(headers));
+
+        const ULONGLONG sectionTableOffset = (ULONGLONG)dos.e_lfanew + sizeof(DWORD) + sizeof(IMAGE_FILE_HEADER) + fileHeader.SizeOfOptionalHeader;
+        if (sectionTableOffset > size)
+            return false;
+        size_t numSections = (size_t)((size - sectionTableOffset) / sizeof(IMAGE_SECTION_HEADER));
+        if (numSections > fileHeader.NumberOfSections)
+            numSections = fileHeader.NumberOfSections;
+        sections_.resize(numSections);
+        memcpy(sections_.data(), data + sectionTableOffset, numSections * sizeof(IMAGE_SECTION_HEADER));
+
+        fileSize_ = fileSize;
+        sizeOfImage_ = headers.OptionalHeader.SizeOfImage;
+
+        // Everything before the first raw section data is header, and maps 1:1
+        ULONGLONG headerSize = fileSize;
+        for (const IMAGE_SECTION_HEADER& section : sections_)
+        {
+            if (section.SizeOfRawData != 0 && section.PointerToRawData < headerSize)
+                headerSize = section.PointerToRawData;
+        }
+        if (headerSize > sizeOfImage_)
+            headerSize = sizeOfImage_;
+        headerSize_ = (DWORD)headerSize;
+        return true;
+    }
+
+    DWORD OffsetToRva(DWORD offset) const
+    {
+        if (offset < headerSize_)
+            return offset;
+        if (offset >= fileSize_)
+            return Invalid;
+
+        for (const IMAGE_SECTION_HEADER& section : sections_)
+        {
+            if (section.PointerToRawData <= offset && offset - section.PointerToRawData < MappedRawSize(section))
+            {
+                const ULONGLONG rva = (ULONGLONG)offset - section.PointerToRawData + section.VirtualAddress;
+                return rva < sizeOfImage_ ? (DWORD)rva : Invalid;
+            }
+        }
+        return Invalid;
+    }
+
+    DWORD RvaToOffset(DWORD rva) const
+    {
+        if (rva < headerSize_)
+            return rva;
+        if (rva >= sizeOfImage_)
+            return Invalid;
+
+        for (const IMAGE_SECTION_HEADER& section : sections_)
+        {
+            if (section.VirtualAddress <= rva && rva - section.VirtualAddress < MappedRawSize(section))
+            {
+                const ULONGLONG offset = (ULONGLONG)rva - section.VirtualAddress + section.PointerToRawData;
+                return offset < Invalid ? (DWORD)offset : Invalid;
+            }
+        }
+        return Invalid;
+    }
+
+    DWORD_PTR RvaToVa(DWORD rva, DWORD_PTR imageBase) const
+    {
+        return rva < sizeOfImage_ ? imageBase + rva : InvalidVa;
+    }
+
+    DWORD VaToRva(DWORD_PTR va, DWORD_PTR imageBase) const
+    {
+        return va >= imageBase && va - imageBase < sizeOfImage_ ? (DWORD)(va - imageBase) : Invalid;
+    }
+
+    DWORD_PTR OffsetToVa(DWORD offset, DWORD_PTR imageBase) const
+    {
+        const DWORD rva = OffsetToRva(offset);
+        return rva != Invalid ? RvaToVa(rva, imageBase) : InvalidVa;
+    }
+
+    DWORD VaToOffset(DWORD_PTR va, DWORD_PTR imageBase) const
+    {
+        const DWORD rva = VaToRva(va, imageBase);
+        return rva != Invalid ? RvaToOffset(rva) : Invalid;
+    }
+
+    size_t NumSections() const
+    {
+        return sections_.size();
+    }
+
+private:
+    // The part of a section's raw data the loader maps: not the file alignment padding after VirtualSize, and not
+    // what is missing from a truncated file
+    DWORD MappedRawSize(const IMAGE_SECTION_HEADER& section) const
+    {
+        ULONGLONG rawSize = section.SizeOfRawData;
+        if (section.Misc.VirtualSize != 0 && section.Misc.VirtualSize < rawSize)
+            rawSize = section.Misc.VirtualSize;
+        if (section.PointerToRawData >= fileSize_)
+            return 0;
+        if (section.PointerToRawData + rawSize > fileSize_)
+            rawSize = fileSize_ - section.PointerToRawData;
+        return (DWORD)rawSize;
+    }
+
+    std::vector<IMAGE_SECTION_HEADER> sections_;
+    ULONGLONG fileSize_;
+    DWORD sizeOfImage_;
+    DWORD headerSize_;
+};
+
+// Section tables of the last few files converted, so that scripted navigation across several modules does not reread
+// them. A file is known by its path, size and last write time, which the caller gets without opening it; a rebuilt
+// file has a new key and replaces the entry of its path
+class SectionTableCache
+{
+public:
+    explicit SectionTableCache(size_t capacity = 8)
+        : capacity_(capacity), useCount_(0)
+    {
+    }
+
+    const SectionTable* Find(const WCHAR* path, ULONGLONG fileSize, ULONGLONG lastWriteTime)
+    {
+        const auto it = entries_.find(MakeKey(path, fileSize, lastWriteTime));
+        if (it == entries_.end())
+            return nullptr;
+        it->second.LastUse = ++useCount_;
+        return &it->second.Table;
+    }
+
+    // Evicts older versions of the file, then the least recently used entry if the cache is full
+    const SectionTable* Insert(const WCHAR* path, ULONGLONG fileSize, ULONGLONG lastWriteTime, const SectionTable& table)
+    {
+        Key key = MakeKey(path, fileSize, lastWriteTime);
+
+        // Keys are ordered by path first, so all versions of the file are next to each other
+        auto it = entries_.lower_bound(Key{ key.Path, 0, 0 });
+        while (it != entries_.end() && it->first.Path == key.Path)
+            it = entries_.erase(it);
+
+        if (entries_.size() >= capacity_ && !entries_.empty())
+        {
+            auto oldest = entries_.begin();
+            for (auto entry = entries_.begin(); entry != entries_.end(); ++entry)
+            {
+                if (entry->second.LastUse < oldest->second.LastUse)
+                    oldest = entry;
+            }
+            entries_.erase(oldest);
+        }
+
+        Entry& entry = entries_[std::move(key)];
+        entry.Table = table;
+        entry.LastUse = ++useCount_;
+        return &entry.Table;
+    }
+
+    size_t Size() const
+    {
+        return entries_.size();
+    }
+
+    void Clear()
+    {
+        entries_.clear();
+    }
+
+private:
+    struct Key
+    {
+        std::vector<WCHAR> Path;    // Without the terminator
+        ULONGLONG FileSize;
+        ULONGLONG LastWriteTime;
+
+        bool operator<(const Key& other) const
+        {
+            if (Path != other.Path)
+                return Path < other.Path;
+            if (FileSize != other.FileSize)
+                return FileSize < other.FileSize;
+            return LastWriteTime < other.LastWriteTime;
+        }
+    };
+
+    struct Entry
+    {
+        SectionTable Table;
+        ULONGLONG LastUse;
+    };
+
+    // No wcslen, which does not know the size of WCHAR in UnitTests
+    static Key MakeKey(const WCHAR* path, ULONGLONG fileSize, ULONGLONG lastWriteTime)
+    {
+        size_t length = 0;
+        while (path[length] != 0)
+            length++;
+        return Key{ std::vector<WCHAR>(path, path + length), fileSize, lastWriteTime };
+    }
+
+    std::map<Key, Entry> entries_;
+    size_t capacity_;
+    ULONGLONG useCount_;
+};
@@ -1,11 +1,16 @@
 #include "olly1patches.h"
 #include <Windows.h>
 #include <TlHelp32.h>
+#include <algorithm>
 #include <string>
+#include <vector>
 #include <Scylla/Logger.h>
 #include <Scylla/Settings.h>
 
 #include "resource.h"
+#include "..\PluginGeneric\RemoteFill.h"
+#include "..\PluginGeneric\TlsCallbacks.h"
+#include "SectionTable.h"
 
 
 extern scl::Settings g_settings;
@@ -256,57 +261,65 @@ DWORD _stdcall removeEPBreak(LPVOID lpParam)
     return 0;
 }
 
+// TLS callbacks that already have a breakpoint, in the order they were found. Cleared for every new debuggee
+static std::vector<DWORD> tlsCallbacks;
+static bool tlsCallbacksScanned = false;
+
+static SIZE_T ReadTlsMemory(void * context, ULONG_PTR address, void * buffer, SIZE_T size)
+{
+    SIZE_T bytesRead = 0;
+    if (!ReadProcessMemory((HANDLE)context, (LPCVOID)address, buffer, size, &bytesRead))
+        return 0;
+    return bytesRead;
+}
+
 void ReadTlsAndSetBreakpoints(DWORD dwProcessId, LPVOID baseofImage)
 {
-    BYTE memory[0x1000] = {0};
-    IMAGE_TLS_DIRECTORY tlsDir = {0};
-    PVOID callbacks[64] = {0};
-	CHAR label[100] = {0};
+    CHAR label[100] = {0};
 
     HANDLE hProcess = OpenProcess(PROCESS_VM_READ, 0, dwProcessId);
 
     if (!hProcess)
         return;
 
-    ReadProcessMemory(hProcess, baseofImage, memory, sizeof(memory), 0);
+    tlsCallbacksScanned = true;
+
+    // Entries can be added at runtime, so the array is reread on every DLL load
+    std::vector<ULONGLONG> callbacks;
+    ReadTlsCallbacks((ULONG_PTR)baseofImage, ReadTlsMemory, hProcess, callbacks);
+    CloseHandle(hProcess);
 
-    PIMAGE_DOS_HEADER pDos = (PIMAGE_DOS_HEADER)memory;
-    PIMAGE_NT_HEADERS pNt = (PIMAGE_NT_HEADERS)((DWORD_PTR)pDos + pDos->e_lfanew);
-    if (pNt->Signature == IMAGE_NT_SIGNATURE)
+    for (size_t index = 0; index < callbacks.size(); index++)
     {
-        if (pNt->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_TLS].VirtualAddress)
-        {
-            //g_log.LogDebug("TLS directory %X found", pNt->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_TLS].VirtualAddress);
-
-            ReadProcessMemory(hProcess, (PVOID)((DWORD_PTR)baseofImage + pNt->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_TLS].VirtualAddress), &tlsDir, sizeof(IMAGE_TLS_DIRECTORY), 0);
-
-            if (tlsDir.AddressOfCallBacks)
-            {
-                //g_log.LogDebug("TLS AddressOfCallBacks %X found", tlsDir.AddressOfCallBacks);
-
-                ReadProcessMemory(hProcess, (PVOID)tlsDir.AddressOfCallBacks, callbacks, sizeof(callbacks), 0);
-
-                for (int i = 0; i < _countof(callbacks); i++)
-                {
-                    if (callbacks[i])
-                    {
-                        g_log.LogInfo(L"TLS callback found: Index %d Address %X", i, callbacks[i]);
-                        _Tempbreakpoint((DWORD)callbacks[i], TY_ONESHOT);
-
-						sprintf(label, "TLS_CALLBACK_%d", i+1);
-						_Insertname((DWORD)callbacks[i], NM_LABEL, label);
-						_Insertname((DWORD)callbacks[i], NM_COMMENT, label);
-                    }
-                    else
-                    {
-                        break;
-                    }
-                }
-            }
-        }
+        // OllyDbg 1 only debugs 32-bit processes
+        if (callbacks[index] > MAXDWORD)
+            continue;
+        const DWORD callback = (DWORD)callbacks[index];
+
+        if (std::find(tlsCallbacks.begin(), tlsCallbacks.end(), callback) != tlsCallbacks.end())
+            continue;
+        tlsCallbacks.push_back(callback);
+
+        g_log.LogInfo(L"TLS callback found: Index %d Address %X", (int)index, callback);
+        _Tempbreakpoint(callback, TY_ONESHOT);
+
+        sprintf(label, "TLS_CALLBACK_%d", (int)tlsCallbacks.size());
+        _Insertname(callback, NM_LABEL, label);
+        _Insertname(callback, NM_COMMENT, label);
     }
+}
 
-    CloseHandle(hProcess);
+void RecheckTlsCallbacks(DWORD dwProcessId, LPVOID baseofImage)
+{
+    // Only after the initial scan, before that Olly is not ready for breakpoints
+    if (tlsCallbacksScanned)
+        ReadTlsAndSetBreakpoints(dwProcessId, baseofImage);
+}
+
+void ResetTlsCallbacks()
+{
+    tlsCallbacks.clear();
+    tlsCallbacksScanned = false;
 }
 
 //NOTE: for this to work IDC_EXPRESSION _NEEDS_ to be 5101, same as equivalent control in orig Olly
@@ -452,53 +465,44 @@ void __declspec(naked) advancedCtrlG_WMCOMMAND()
 char expression[100] = {0};
 BYTE tempMemory[0x1000] = {0};
 
-DWORD ConvertOffsetToRVA( const WCHAR * szExePath, DWORD offset )
+static SectionTableCache sectionTables;
+
+static bool ReadSectionTable(const WCHAR * szExePath, ULONGLONG fileSize, SectionTable & table)
 {
-    DWORD result = 0;
-    PIMAGE_DOS_HEADER pDosHeader = (PIMAGE_DOS_HEADER)tempMemory;
-    PIMAGE_NT_HEADERS pNt = 0;
-    DWORD lpNumberOfBytesRead = 0;
-    LARGE_INTEGER lpFileSize = {0};
     HANDLE hFile = CreateFileW(szExePath, GENERIC_READ, FILE_SHARE_READ|FILE_SHARE_WRITE, 0, OPEN_EXISTING, 0, 0);
-    if (hFile != INVALID_HANDLE_VALUE)
-    {
-        GetFileSizeEx(hFile, &lpFileSize);
-        long filesize = (long)lpFileSize.QuadPart;
-
-        if (filesize > sizeof(tempMemory))
-        {
-            filesize = sizeof(tempMemory);
-        }
-
-        if (ReadFile(hFile, tempMemory, filesize, &lpNumberOfBytesRead, 0))
-        {
-            pNt = (PIMAGE_NT_HEADERS)((DWORD_PTR)pDosHeader + pDosHeader->e_lfanew);
-            PIMAGE_SECTION_HEADER pSection = IMAGE_FIRST_SECTION(pNt);
-
-            if (offset < pSection->PointerToRawData) //before the first section...
-            {
-                result = offset;
-            }
-            else
-            {
-                for (WORD i = 0; i < pNt->FileHeader.NumberOfSections; i++)
-                {
-                    if ((pSection->PointerToRawData <= offset) && ((pSection->PointerToRawData + pSection->SizeOfRawData) > offset))
-                    {
-                        result = ((offset - pSection->PointerToRawData) + pSection->VirtualAddress);
-                        break;
-                    }
-
-                    pSection++;
-                }
-            }
+    if (hFile == INVALID_HANDLE_VALUE)
+        return false;
 
-        }
+    // The headers are all we need, and they fit in the first page
+    DWORD bytesRead = 0;
+    const BOOL readOk = ReadFile(hFile, tempMemory, sizeof(tempMemory), &bytesRead, 0);
+    CloseHandle(hFile);
+    return readOk && table.Parse(tempMemory, bytesRead, fileSize);
+}
 
-        CloseHandle(hFile);
+// Returns SectionTable::Invalid for offsets that are not mapped, e.g. in the overlay
+DWORD ConvertOffsetToRVA( const WCHAR * szExePath, DWORD offset )
+{
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExW(szExePath, GetFileExInfoStandard, &attributes))
+        return SectionTable::Invalid;
+
+    ULARGE_INTEGER fileSize, lastWriteTime;
+    fileSize.HighPart = attributes.nFileSizeHigh;
+    fileSize.LowPart = attributes.nFileSizeLow;
+    lastWriteTime.HighPart = attributes.ftLastWriteTime.dwHighDateTime;
+    lastWriteTime.LowPart = attributes.ftLastWriteTime.dwLowDateTime;
+
+    const SectionTable * table = sectionTables.Find(szExePath, fileSize.QuadPart, lastWriteTime.QuadPart);
+    if (table == nullptr)
+    {
+        SectionTable parsed;
+        if (!ReadSectionTable(szExePath, fileSize.QuadPart, parsed))
+            return SectionTable::Invalid;
+        table = sectionTables.Insert(szExePath, fileSize.QuadPart, lastWriteTime.QuadPart, parsed);
     }
 
-    return result;
+    return table->OffsetToRva(offset);
 }
 
 bool advancedCtrlG_handleGotoExpression(int addrType)
@@ -557,7 +561,7 @@ bool advancedCtrlG_handleGotoExpression(int addrType)
     if(addrType == ADDR_TYPE_OFFSET)
     {
         addrToFind = ConvertOffsetToRVA(moduleinfo.szExePath, addrToFind);
-        if (addrToFind == 0)
+        if (addrToFind == SectionTable::Invalid)
         {
             SetDlgItemTextA(hGotoDialog, IDC_ERROR, "Invalid offset address!");
             return false;
@@ -706,18 +710,21 @@ void hookOllyWindowProcs()
     SetWindowLong(hDasm, GWL_USERDATA, hOllyDasmProc);
 }
 
+static SIZE_T OllyWriteMemory(void*, ULONG_PTR address, const void* buffer, SIZE_T size)
+{
+	return _Writememory(const_cast<void*>(buffer), (unsigned long)address, (unsigned long)size, MM_RESTORE | MM_DELANAL);
+}
+
+static SIZE_T OllyReadMemory(void*, ULONG_PTR address, void* buffer, SIZE_T size)
+{
+	return _Readmemory(buffer, (unsigned long)address, (unsigned long)size, MM_RESTORE | MM_SILENT);
+}
+
 void memsetRemoteMemory(DWORD startAddress, DWORD endAddress, BYTE byte)
 {
 	if (endAddress > startAddress)
 	{
-		DWORD len = endAddress - startAddress;
-		BYTE* tempmem = (BYTE*)malloc(len);
-		if (tempmem)
-		{
-			memset(tempmem,byte,len);
-			_Writememory(tempmem, startAddress, len, MM_RESTORE | MM_DELANAL);
-			free(tempmem);
-		}
+		RemoteFillMemory(startAddress, endAddress - startAddress, byte, OllyWriteMemory, OllyReadMemory, nullptr);
 	}
 }
 
@@ -17,6 +17,8 @@ void hookOllyBreakpoints();
 void fixSprintfBug();
 DWORD _stdcall removeEPBreak(LPVOID lpParam);
 void ReadTlsAndSetBreakpoints(DWORD dwProcessId, LPVOID baseofImage);
+void RecheckTlsCallbacks(DWORD dwProcessId, LPVOID baseofImage);
+void ResetTlsCallbacks();
 void advcancedCtrlG();
 bool advancedCtrlG_handleGotoExpression(int addrType);
 void fixBadPEImage();
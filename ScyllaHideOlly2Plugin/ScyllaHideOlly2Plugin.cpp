@@ -415,6 +415,7 @@ extc void ODBG2_Pluginreset(void)
 {
     bHooked = false;
     ProcessId = 0;
+    ResetDebugStringLog();
 }
 
 BOOL WINAPI DllMain(HINSTANCE hi, DWORD reason, LPVOID reserved)
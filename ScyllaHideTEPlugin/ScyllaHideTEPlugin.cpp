@@ -6,6 +6,7 @@
 #include <titan/TitanEngine.h>
 
 #include "..\PluginGeneric\Injector.h"
+#include "..\PluginGeneric\ProcessHookTracker.h"
 
 #ifndef DLL_EXPORT
 #define DLL_EXPORT __declspec(dllexport)
@@ -22,10 +23,7 @@ scl::Logger g_log;
 std::wstring g_scyllaHideDllPath;
 std::wstring g_scyllaHideIniPath;
 
-HOOK_DLL_DATA g_hdd;
-
-bool bHooked;
-DWORD ProcessId;
+static ProcessHookTracker hookTracker;
 
 static void LogCallback(const wchar_t *msg)
 {
@@ -55,53 +53,25 @@ static bool SetDebugPrivileges()
 
 extern "C" DLL_EXPORT void TitanDebuggingCallBack(LPDEBUG_EVENT debugEvent, int CallReason)
 {
-    switch(CallReason)
-    {
-    case UE_PLUGIN_CALL_REASON_EXCEPTION:
-    {
-        switch(debugEvent->dwDebugEventCode)
-        {
-        case CREATE_PROCESS_DEBUG_EVENT:
-        {
-            ProcessId=debugEvent->dwProcessId;
-            bHooked = false;
-            ZeroMemory(&g_hdd, sizeof(HOOK_DLL_DATA));
-            break;
-        }
+    if (CallReason != UE_PLUGIN_CALL_REASON_EXCEPTION)
+        return;
 
-        case LOAD_DLL_DEBUG_EVENT:
-        {
-            if (bHooked)
-            {
-                startInjection(ProcessId, &g_hdd, g_scyllaHideDllPath.c_str(), false);
-            }
-            break;
-        }
-        case EXCEPTION_DEBUG_EVENT:
-        {
-            switch(debugEvent->u.Exception.ExceptionRecord.ExceptionCode)
-            {
-            case STATUS_BREAKPOINT:
-            {
-                if (!bHooked)
-                {
-                    ReadNtApiInformation(&g_hdd);
-
-                    bHooked = true;
-                    startInjection(ProcessId, &g_hdd, g_scyllaHideDllPath.c_str(), true);
-                }
-                break;
-            }
-
-            }
-
-            break;
-        }
+    // Every debuggee gets its own state, so child processes are hooked too
+    const DWORD pid = debugEvent->dwProcessId;
+    const unsigned int actions = hookTracker.OnDebugEvent(*debugEvent, nullptr, false);
+    ProcessHookStatus* status = hookTracker.Find(pid);
 
-        }
+    if (actions & ProcessHookActionInject)
+    {
+        ReadNtApiInformation(&status->hdd);
+        startInjection(pid, &status->hdd, g_scyllaHideDllPath.c_str(), true);
     }
-    break;
+    else if (actions & ProcessHookActionReinject)
+    {
+        startInjection(pid, &status->hdd, g_scyllaHideDllPath.c_str(), false);
     }
+
+    hookTracker.OnActionsDone(pid);
 }
 
 extern "C" DLL_EXPORT bool TitanRegisterPlugin(char* szPluginName, DWORD* titanPluginMajorVersion, DWORD* titanPluginMinorVersion)
@@ -0,0 +1,68 @@
+#pragma once
+
+// The static libraries of the IDA SDK that were built with MSVC, for real x86 and x64 compiler output. The sample
+// images are PE32 built with gcc. The libraries are ar archives of COFF objects, one section per function
+
+#include "PeImage.h"
+#include <cstdlib>
+
+static const char* const CodeLibraries[] =
+{
+    IDASDK_LIB_DIR "/x86_win_vc_32_s/compress.lib",
+    IDASDK_LIB_DIR "/x64_win_vc_64_s/compress.lib",
+    IDASDK_LIB_DIR "/x64_win_vc_64_s/unicode.lib",
+};
+
+struct CodeSection
+{
+    bool x64;
+    size_t object;          // Index of the object in the archive
+    DWORD alignment;        // What the linker aligns the section to
+    std::vector<BYTE> code;
+};
+
+// Collects the code sections of the COFF objects in an ar archive (.lib), in the order of the archive and of the
+// section tables
+inline bool ReadLibraryCode(const char* path, std::vector<CodeSection>& sections)
+{
+    std::vector<BYTE> lib;
+    if (!ReadFileBytes(path, lib) || lib.size() < 8 || memcmp(lib.data(), "!<arch>\n", 8) != 0)
+        return false;
+
+    size_t pos = 8;
+    size_t object = 0;
+    while (pos + 60 <= lib.size())
+    {
+        const size_t size = strtoul((const char*)lib.data() + pos + 48, nullptr, 10);
+        const size_t body = pos + 60;
+        if (body + size > lib.size())
+            return false;
+
+        IMAGE_FILE_HEADER header;
+        if (size >= sizeof(header))
+        {
+            memcpy(&header, lib.data() + body, sizeof(header));
+            const bool isObject = header.Machine == IMAGE_FILE_MACHINE_I386 || header.Machine == IMAGE_FILE_MACHINE_AMD64;
+            for (WORD i = 0; isObject && i < header.NumberOfSections; ++i)
+            {
+                IMAGE_SECTION_HEADER section;
+                const size_t sectionOffset = body + sizeof(header) + header.SizeOfOptionalHeader + i * sizeof(section);
+                if (sectionOffset + sizeof(section) > body + size)
+                    break;
+                memcpy(&section, lib.data() + sectionOffset, sizeof(section));
+                if ((section.Characteristics & IMAGE_SCN_CNT_CODE) == 0 || section.SizeOfRawData == 0 ||
+                    (size_t)section.PointerToRawData + section.SizeOfRawData > size)
+                    continue;
+                // IMAGE_SCN_ALIGN_1BYTES (1) to IMAGE_SCN_ALIGN_8192BYTES (14), 16 bytes if not given
+                const DWORD align = (section.Characteristics >> 20) & 0xF;
+                const BYTE* code = lib.data() + body + section.PointerToRawData;
+                sections.push_back(CodeSection{ header.Machine == IMAGE_FILE_MACHINE_AMD64, object, align != 0 ? 1u << (align - 1) : 16,
+                    std::vector<BYTE>(code, code + section.SizeOfRawData) });
+            }
+            if (isObject)
+                object++;
+        }
+        pos = body + size + (size & 1);
+    }
+    return true;
+}
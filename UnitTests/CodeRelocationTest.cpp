@@ -0,0 +1,521 @@
+#include <windows.h>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include "CodeRelocation.h"
+#include "LengthDisasm.h"
+#include "RandomInstructions.h"
+
+extern "C" {
+#include "distorm.h"
+}
+
+// Builds trampolines the way DetourCreateRemote does, the relocated code followed by a jmp back, and runs them and the
+// original code in a small emulator on top of distorm: instructions are only decoded, branches are followed for a given
+// set of flags and calls are assumed to return. Both runs must execute the same instructions, with RIP relative
+// operands resolving to the same addresses, call the same targets and leave at the same address, for every flag state.
+// Crafted prologues first, then random streams biased towards branches and RIP relative operands, relocated near and
+// far. For those RelocateCode must refuse exactly the streams a model built on distorm says can not be relocated
+//
+//   CodeRelocationTest [streams] [seed]
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what, int line)
+{
+    if (!condition)
+    {
+        printf("FAIL line %d: %s\n", line, what);
+        ++failures;
+    }
+}
+#define CHECK(condition) Check(condition, #condition, __LINE__)
+
+static void PrintBytes(const BYTE * code, int len)
+{
+    for (int i = 0; i < len; ++i)
+        printf(" %02X", code[i]);
+    printf("\n");
+}
+
+static ULONGLONG AddressMask(bool x64)
+{
+    return x64 ? ~0ULL : 0xFFFFFFFFULL;
+}
+
+// Written from the encoding, not with IsRel32Reachable
+static bool InRel32Reach(ULONGLONG from, ULONGLONG to, bool x64)
+{
+    const LONGLONG delta = (LONGLONG)(to - from);
+    return !x64 || (delta >= INT32_MIN && delta <= INT32_MAX);
+}
+
+static bool Decode(const BYTE * code, int codeLen, ULONGLONG address, bool x64, _DInst& di)
+{
+    _CodeInfo ci = {};
+    ci.code = code;
+    ci.codeLen = codeLen;
+    ci.codeOffset = address;
+    ci.dt = x64 ? Decode64Bits : Decode32Bits;
+    unsigned int count = 0;
+    di = _DInst();
+    return codeLen > 0 && distorm_decompose(&ci, &di, 1, &count) != DECRES_INPUTERR && count == 1 && di.flags != FLAG_NOT_DECODABLE;
+}
+
+// The opcode byte in front of the branch displacement: 7x and 0F 8x for jcc, E0 to E3 for loop/jecxz
+static BYTE BranchOpcode(const BYTE * code, const _DInst& di)
+{
+    return code[di.size - 1 - di.ops[0].size / 8];
+}
+
+enum
+{
+    FlagCF = 1,
+    FlagZF = 2,
+    FlagSF = 4,
+    FlagOF = 8,
+    FlagPF = 16,
+    NumFlagStates = 32
+};
+
+static bool IsConditionTrue(BYTE condition, unsigned flags)
+{
+    const bool cf = (flags & FlagCF) != 0, zf = (flags & FlagZF) != 0, sf = (flags & FlagSF) != 0;
+    const bool of = (flags & FlagOF) != 0, pf = (flags & FlagPF) != 0;
+    bool result;
+    switch (condition >> 1)
+    {
+    case 0: result = of; break;
+    case 1: result = cf; break;
+    case 2: result = zf; break;
+    case 3: result = cf || zf; break;
+    case 4: result = sf; break;
+    case 5: result = pf; break;
+    case 6: result = sf != of; break;
+    default: result = zf || sf != of; break;
+    }
+    return (condition & 1) != 0 ? !result : result;
+}
+
+enum EventKind
+{
+    EventInstruction,
+    EventCall,
+    EventExit
+};
+
+struct Event
+{
+    EventKind Kind;
+    ULONGLONG Address;                  // Call target, or where execution left the code
+    std::vector<ULONGLONG> Instruction; // What distorm decoded, with a RIP relative operand resolved to its address
+
+    bool operator==(const Event& other) const
+    {
+        return Kind == other.Kind && Address == other.Address && Instruction == other.Instruction;
+    }
+};
+
+static std::vector<ULONGLONG> InstructionKey(const _DInst& di)
+{
+    const bool ripRelative = (di.flags & FLAG_RIP_RELATIVE) != 0;
+    std::vector<ULONGLONG> key = { di.opcode, di.size, di.flags, di.unusedPrefixesMask, di.segment, di.base, di.scale,
+        di.dispSize, di.imm.qword, ripRelative ? INSTRUCTION_GET_RIP_TARGET(&di) : di.disp };
+    for (const _Operand& op : di.ops)
+    {
+        key.push_back(op.type);
+        key.push_back(op.index);
+        key.push_back(op.size);
+    }
+    return key;
+}
+
+// Runs the code, which is at address, until it leaves [address, address + size) or returns. With literals, jmp and call
+// through a pointer inside the code itself go to that pointer, as the absolute forms written by WriteBranch do.
+// Returns false for what the emulator does not know: undecodable bytes, loop/jecxz and running for too long
+static bool Run(const BYTE * code, int size, ULONGLONG address, bool x64, unsigned flags, bool literals, std::vector<Event>& trace)
+{
+    trace.clear();
+    ULONGLONG ip = address;
+    for (int steps = 0; steps < 256; ++steps)
+    {
+        if (ip < address || ip >= address + size)
+        {
+            trace.push_back(Event{ EventExit, ip, {} });
+            return true;
+        }
+
+        const BYTE * insn = code + (ip - address);
+        _DInst di;
+        if (!Decode(insn, size - (int)(ip - address), ip, x64, di))
+            return false;
+        const ULONGLONG next = (ip + di.size) & AddressMask(x64);
+        const int fc = META_GET_FC(di.meta);
+
+        if (fc != FC_CALL && fc != FC_UNC_BRANCH && fc != FC_CND_BRANCH)
+        {
+            trace.push_back(Event{ EventInstruction, 0, InstructionKey(di) });
+            if (fc == FC_RET)
+                return true;
+            ip = next;
+            continue;
+        }
+
+        ULONGLONG target;
+        const ULONGLONG pointer = INSTRUCTION_GET_RIP_TARGET(&di);
+        if (di.ops[0].type == O_PC)
+        {
+            target = INSTRUCTION_GET_TARGET(&di) & AddressMask(x64);
+        }
+        else if (literals && (di.flags & FLAG_RIP_RELATIVE) != 0 && pointer >= address && pointer - address + sizeof(target) <= (ULONGLONG)size)
+        {
+            memcpy(&target, code + (pointer - address), sizeof(target));
+        }
+        else
+        {
+            // Indirect, e.g. jmp [rip+x] through an import pointer, jmp rax or a far jmp
+            trace.push_back(Event{ EventInstruction, 0, InstructionKey(di) });
+            if (fc == FC_UNC_BRANCH)
+                return true;
+            ip = next;
+            continue;
+        }
+
+        if (fc == FC_CALL)
+        {
+            trace.push_back(Event{ EventCall, target, {} });
+            ip = next;
+        }
+        else if (fc == FC_UNC_BRANCH)
+        {
+            ip = target;
+        }
+        else
+        {
+            const BYTE opcode = BranchOpcode(insn, di);
+            if (opcode >= 0xE0 && opcode <= 0xE3)
+                return false;
+            ip = IsConditionTrue(opcode & 0x0F, flags) ? target : next;
+        }
+    }
+    return false;
+}
+
+// What RelocateCode has to do with code[0, length), worked out with distorm: -1 if it can not be relocated, otherwise
+// the size of the relocated code, with every branch in its rel32 form if that reaches and in the absolute form if not.
+// Instructions the length decoder does not know can only be copied as is, so those with a RIP relative operand are
+// refused, and so are relative operands of anything other than jmp, call and jcc (xbegin)
+static int ExpectedRelocatedSize(const BYTE * code, int length, ULONGLONG oldAddress, ULONGLONG newAddress, bool x64)
+{
+    int size = 0;
+    for (int offset = 0; offset < length;)
+    {
+        _DInst di;
+        if (!Decode(code + offset, length - offset, oldAddress + offset, x64, di))
+            return -1;
+
+        const ULONGLONG ip = (newAddress + size) & AddressMask(x64);
+        if (di.ops[0].type == O_PC)
+        {
+            const ULONGLONG target = INSTRUCTION_GET_TARGET(&di) & AddressMask(x64);
+            const BYTE opcode = BranchOpcode(code + offset, di);
+            const int fc = META_GET_FC(di.meta);
+            if ((fc != FC_CALL && fc != FC_UNC_BRANCH && fc != FC_CND_BRANCH) || di.ops[0].size == 16 || (opcode >= 0xE0 && opcode <= 0xE3) || (target >= oldAddress && target < oldAddress + length))
+                return -1;
+
+            const int rel32Size = fc == FC_CND_BRANCH ? 6 : 5;
+            if (InRel32Reach(ip + rel32Size, target, x64))
+                size += rel32Size;
+            else
+                size += fc == FC_CND_BRANCH ? 2 + 14 : fc == FC_CALL ? 16 : 14;
+        }
+        else
+        {
+            if ((di.flags & FLAG_RIP_RELATIVE) != 0 &&
+                (!InRel32Reach(ip + di.size, INSTRUCTION_GET_RIP_TARGET(&di), x64) || LdeDecode(code + offset, length - offset, x64, nullptr) < 1))
+                return -1;
+            size += di.size;
+        }
+        offset += di.size;
+    }
+    return size;
+}
+
+static const int TrampolineSize = 256;
+
+// The relocated code and the jmp back to the rest of the function, as in DetourCreateRemote
+static int BuildTrampoline(const BYTE * code, int codeLen, int length, ULONGLONG oldAddress, ULONGLONG newAddress, bool x64, BYTE * out)
+{
+    const int size = RelocateCode(code, codeLen, length, (ULONG_PTR)oldAddress, (ULONG_PTR)newAddress, out, TrampolineSize - 16, x64);
+    if (size < 0)
+        return -1;
+    return size + WriteBranch(out + size, (ULONG_PTR)(newAddress + size), (ULONG_PTR)(oldAddress + length), BranchJmp, 0, x64);
+}
+
+// Relocates code[0, length) and compares the size with the model and the trampoline with the original in every flag state
+static bool CheckRelocation(const BYTE * code, int codeLen, int length, ULONGLONG oldAddress, ULONGLONG newAddress, bool x64, int* relocatedSize = nullptr)
+{
+    BYTE trampoline[TrampolineSize];
+    memset(trampoline, 0xCC, sizeof(trampoline));
+    const int expected = ExpectedRelocatedSize(code, length, oldAddress, newAddress, x64);
+    const int size = BuildTrampoline(code, codeLen, length, oldAddress, newAddress, x64, trampoline);
+    const int relocated = size < 0 ? -1 : RelocateCode(code, codeLen, length, (ULONG_PTR)oldAddress, (ULONG_PTR)newAddress, trampoline + TrampolineSize / 2, TrampolineSize / 2, x64);
+    if (relocatedSize != nullptr)
+        *relocatedSize = relocated;
+
+    bool ok = relocated == expected;
+    for (unsigned flags = 0; ok && size >= 0 && flags < NumFlagStates; ++flags)
+    {
+        std::vector<Event> original, relocatedTrace;
+        ok = Run(code, length, oldAddress, x64, flags, false, original) &&
+            Run(trampoline, size, newAddress, x64, flags, true, relocatedTrace) && original == relocatedTrace;
+    }
+
+    if (!ok)
+    {
+        printf("FAIL x64=%d %#llx -> %#llx: relocated to %d bytes, expected %d:", x64, (unsigned long long)oldAddress, (unsigned long long)newAddress, relocated, expected);
+        PrintBytes(code, length);
+        if (size >= 0)
+        {
+            printf("  trampoline:");
+            PrintBytes(trampoline, size);
+        }
+        ++failures;
+    }
+    return ok;
+}
+
+static const ULONGLONG X64Function = 0x7FFA12340000ULL;
+static const ULONGLONG X64Near = X64Function - 0x10000;
+static const ULONGLONG X64Far = X64Function + 0x500000000ULL;
+static const ULONGLONG X86Function = 0x77010000;
+static const ULONGLONG X86Trampoline = 0x00410000;
+
+static void TestPrologues()
+{
+    struct Prologue
+    {
+        const char* Name;
+        bool X64;
+        int Length;
+        int NearSize;       // Size of the relocated code near the function, -1 if it must be refused
+        int FarSize;        // x64 only, more than 2 GB away
+        BYTE Code[24];
+    };
+    static const Prologue prologues[] =
+    {
+        // x64 syscall stub with the int 2e check, the jne rel8 becomes a jne rel32 or jne over an absolute jmp
+        { "NtQueryInformationProcess", true, 18, 22, 32,
+          { 0x4C, 0x8B, 0xD1, 0xB8, 0x19, 0x00, 0x00, 0x00, 0xF6, 0x04, 0x25, 0x08, 0x03, 0xFE, 0x7F, 0x01, 0x75, 0x03, 0x0F, 0x05, 0xC3, 0xCD, 0x2E, 0xC3 } },
+        // Import stub, the pointer is out of reach of the far trampoline
+        { "jmp [rip+x] stub", true, 7, 7, -1, { 0x48, 0xFF, 0x25, 0x10, 0x20, 0x00, 0x00, 0xCC } },
+        // Hooks of other tools, which are chained
+        { "Foreign jmp rel32", true, 5, 5, 14, { 0xE9, 0x00, 0x10, 0x00, 0x00 } },
+        { "Foreign jmp [rip+8]", true, 6, 6, -1, { 0xFF, 0x25, 0x08, 0x00, 0x00, 0x00 } },
+        { "lea rax, [rip+x]; call rel32", true, 12, 12, -1, { 0x48, 0x8D, 0x05, 0x00, 0x01, 0x00, 0x00, 0xE8, 0xF0, 0xFF, 0x00, 0x00 } },
+        { "test rcx, rcx; je rel32", true, 9, 9, 19, { 0x48, 0x85, 0xC9, 0x0F, 0x84, 0x00, 0x02, 0x00, 0x00 } },
+        { "call rel32; mov rcx, rax", true, 8, 8, 19, { 0xE8, 0x00, 0x00, 0x01, 0x00, 0x48, 0x8B, 0xC8 } },
+        // The displacement is followed by an immediate
+        { "cmp byte [rip+x], 0; jne rel8", true, 9, 13, -1, { 0x80, 0x3D, 0x00, 0x10, 0x00, 0x00, 0x00, 0x75, 0x10 } },
+        { "je back into the copied bytes", true, 5, -1, -1, { 0x48, 0x85, 0xC9, 0x74, 0xFB } },
+        { "jrcxz", true, 5, -1, -1, { 0xE3, 0x10, 0x48, 0x8B, 0xC1 } },
+        { "loop", true, 5, -1, -1, { 0xE2, 0x10, 0x48, 0x8B, 0xC1 } },
+
+        { "mov edi, edi; push ebp; mov ebp, esp", false, 5, 5, 5, { 0x8B, 0xFF, 0x55, 0x8B, 0xEC } },
+        { "x86 call rel32", false, 5, 5, 5, { 0xE8, 0x00, 0x10, 0x00, 0x00 } },
+        { "je rel8; jmp rel8", false, 4, 11, 11, { 0x74, 0x10, 0xEB, 0x20 } },
+        { "jmp rel16", false, 4, -1, -1, { 0x66, 0xE9, 0x10, 0x00 } },
+        { "jecxz", false, 2, -1, -1, { 0xE3, 0x05 } },
+        { "x86 jmp back to the entry", false, 8, -1, -1, { 0x55, 0x8B, 0xEC, 0xE9, 0xF9, 0xFF, 0xFF, 0xFF } },
+    };
+
+    for (const Prologue& prologue : prologues)
+    {
+        BYTE code[sizeof(prologue.Code) + 16];
+        memset(code, 0xCC, sizeof(code));
+        memcpy(code, prologue.Code, sizeof(prologue.Code));
+
+        const ULONGLONG function = prologue.X64 ? X64Function : X86Function;
+        const ULONGLONG targets[2] = { prologue.X64 ? X64Near : X86Trampoline, prologue.X64 ? X64Far : 0xFFFF0000 };
+        const int sizes[2] = { prologue.NearSize, prologue.FarSize };
+        for (int i = 0; i < 2; ++i)
+        {
+            int size = 0;
+            CheckRelocation(code, sizeof(code), prologue.Length, function, targets[i], prologue.X64, &size);
+            if (size != sizes[i])
+            {
+                printf("FAIL %s: relocated to %d bytes, expected %d\n", prologue.Name, size, sizes[i]);
+                ++failures;
+            }
+        }
+
+        // Position independent code is what relocates to itself
+        BYTE relocated[TrampolineSize];
+        const bool copiedAsIs = RelocateCode(code, sizeof(code), prologue.Length, (ULONG_PTR)function, (ULONG_PTR)targets[1], relocated, sizeof(relocated), prologue.X64) == prologue.Length &&
+            memcmp(relocated, code, prologue.Length) == 0;
+        CHECK(IsPositionIndependentCode(code, prologue.Length, prologue.X64) == copiedAsIs);
+    }
+}
+
+static void TestWriteBranch()
+{
+    struct Branch
+    {
+        bool X64;
+        ULONGLONG Ip;
+        ULONGLONG Target;
+        RelocatedBranchType Type;
+        int Size;
+    };
+    const Branch branches[] =
+    {
+        { true, X64Near, X64Function, BranchJmp, 5 },
+        { true, X64Near, X64Function, BranchCall, 5 },
+        { true, X64Near, X64Function, BranchJcc, 6 },
+        { true, X64Far, X64Function, BranchJmp, 14 },
+        { true, X64Far, X64Function, BranchCall, 16 },
+        { true, X64Far, X64Function, BranchJcc, 16 },
+        // Last reachable and first unreachable target, the rel32 is relative to the end of the 5 byte jmp
+        { true, X64Function, X64Function + 5 + 0x7FFFFFFF, BranchJmp, 5 },
+        { true, X64Function, X64Function + 5 + 0x80000000ULL, BranchJmp, 14 },
+        { true, X64Function, X64Function + 5 - 0x80000000ULL, BranchJmp, 5 },
+        { true, X64Function, X64Function + 5 - 0x80000001ULL, BranchJmp, 14 },
+        // rel32 wraps around on x86
+        { false, 0xFFFF0000, 0x00001000, BranchJmp, 5 },
+        { false, 0x00001000, 0xFFFF0000, BranchCall, 5 },
+        { false, X86Trampoline, X86Function, BranchJcc, 6 },
+    };
+
+    for (const Branch& branch : branches)
+    {
+        for (BYTE condition = 0; condition < (branch.Type == BranchJcc ? 16 : 1); ++condition)
+        {
+            BYTE buf[16];
+            const int size = WriteBranch(buf, (ULONG_PTR)branch.Ip, (ULONG_PTR)branch.Target, branch.Type, condition, branch.X64);
+            CHECK(size == branch.Size);
+            CHECK(IsRel32Reachable((ULONG_PTR)(branch.Ip + 5), (ULONG_PTR)branch.Target, branch.X64) == (size == 5 || size == 6));
+            if (size != branch.Size)
+                continue;
+
+            for (unsigned flags = 0; flags < NumFlagStates; ++flags)
+            {
+                std::vector<Event> trace;
+                CHECK(Run(buf, size, branch.Ip, branch.X64, flags, true, trace));
+                const ULONGLONG next = (branch.Ip + size) & AddressMask(branch.X64);
+                if (branch.Type == BranchCall)
+                    CHECK(trace.size() == 2 && trace[0].Kind == EventCall && trace[0].Address == branch.Target && trace[1].Address == next);
+                else if (branch.Type == BranchJcc && !IsConditionTrue(condition, flags))
+                    CHECK(trace.size() == 1 && trace[0].Kind == EventExit && trace[0].Address == next);
+                else
+                    CHECK(trace.size() == 1 && trace[0].Kind == EventExit && trace[0].Address == branch.Target);
+            }
+        }
+    }
+}
+
+// Appends an instruction, a third of them branches and, on x64, a sixth RIP relative
+static void AppendInstruction(std::mt19937_64& rng, bool x64, std::vector<BYTE>& code)
+{
+    const auto rel32 = [&]() { return (DWORD)(rng() % 2 == 0 ? (int)(rng() % 0x2000) - 0x1000 : (int)(DWORD)rng()); };
+    const auto append32 = [&](DWORD value) { for (int i = 0; i < 4; ++i) code.push_back((BYTE)(value >> (8 * i))); };
+
+    switch (rng() % 12)
+    {
+    case 0:
+        code.push_back((BYTE)(0x70 | (rng() % 16)));
+        code.push_back((BYTE)rng());
+        return;
+    case 1:
+        code.push_back(0x0F);
+        code.push_back((BYTE)(0x80 | (rng() % 16)));
+        append32(rel32());
+        return;
+    case 2:
+        code.push_back(rng() % 2 == 0 ? 0xEB : 0xE9);
+        if (code.back() == 0xEB)
+            code.push_back((BYTE)rng());
+        else
+            append32(rel32());
+        return;
+    case 3:
+        code.push_back(0xE8);
+        append32(rel32());
+        return;
+    case 4:
+        if (x64)
+        {
+            // mov rax, [rip+x]; lea rcx, [rip+x]; jmp [rip+x]; call [rip+x]; cmp byte [rip+x], imm8
+            static const BYTE forms[][3] = { { 0x48, 0x8B, 0x05 }, { 0x48, 0x8D, 0x0D }, { 0xFF, 0x25 }, { 0xFF, 0x15 }, { 0x80, 0x3D } };
+            const BYTE* form = forms[rng() % _countof(forms)];
+            code.insert(code.end(), form, form + (form[0] == 0x48 ? 3 : 2));
+            append32(rel32());
+            if (form[0] == 0x80)
+                code.push_back((BYTE)rng());
+            return;
+        }
+        break;
+    }
+
+    // Anything distorm decodes
+    for (;;)
+    {
+        BYTE buf[16];
+        RandomInstruction(rng, buf);
+        _DInst di;
+        if (Decode(buf, sizeof(buf), 0, x64, di))
+        {
+            code.insert(code.end(), buf, buf + di.size);
+            return;
+        }
+    }
+}
+
+static void TestRandom(int numStreams, unsigned seed)
+{
+    for (int mode = 0; mode < 2; ++mode)
+    {
+        const bool x64 = mode != 0;
+        std::mt19937_64 rng(seed + mode);
+        int relocated = 0, refused = 0;
+        for (int stream = 0; stream < numStreams; ++stream)
+        {
+            std::vector<BYTE> code;
+            const int numInstructions = 1 + (int)(rng() % 6);
+            for (int i = 0; i < numInstructions; ++i)
+                AppendInstruction(rng, x64, code);
+            const int length = (int)code.size();
+            code.resize(code.size() + 16, 0xCC);
+
+            const ULONGLONG function = x64 ? X64Function + (rng() % 0x100000) : X86Function + (rng() % 0x100000);
+            ULONGLONG trampoline;
+            if (x64)
+                trampoline = rng() % 2 == 0 ? function - 0x10000 - (rng() % 0x40000000) : function + 0x100000000ULL * (1 + rng() % 0x100);
+            else
+                trampoline = rng() % 2 == 0 ? X86Trampoline + (rng() % 0x100000) : 0xF0000000 + (rng() % 0x1000000);
+
+            int size = 0;
+            if (!CheckRelocation(code.data(), (int)code.size(), length, function, trampoline, x64, &size))
+                continue;
+            if (size < 0)
+                ++refused;
+            else
+                ++relocated;
+        }
+        printf("%s: %d streams, %d relocated, %d refused\n", x64 ? "x64" : "x86", numStreams, relocated, refused);
+        CHECK(relocated > numStreams / 4 && refused > numStreams / 20);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const int numStreams = argc > 1 ? atoi(argv[1]) : 20000;
+    const unsigned seed = argc > 2 ? (unsigned)strtoul(argv[2], nullptr, 0) : 48;
+
+    TestPrologues();
+    TestWriteBranch();
+    TestRandom(numStreams, seed);
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
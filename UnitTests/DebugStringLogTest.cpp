@@ -0,0 +1,354 @@
+#include <ntdll/ntdll.h>
+#include "DebugStringLog.h"
+
+#include <cstdio>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+// The debug string log of HookedWaitForDebugEvent on fake processes: one handle per process, opened on its first string
+// and closed on exit or reset, repeats of the same string coalesced into a count that is flushed by a different string,
+// the exit of the process or a reset, and strings cut at their terminator or at the end of what could be read.
+// A random event sequence is checked against a model of the log
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what, int line)
+{
+    if (!condition)
+    {
+        printf("FAIL line %d: %s\n", line, what);
+        ++failures;
+    }
+}
+#define CHECK(condition) Check(condition, #condition, __LINE__)
+
+// The string memory of a few processes, each at its own address, and the handles open on them
+class FakeProcesses
+{
+public:
+    static const ULONG_PTR StringAddress = 0x10000;
+
+    struct Process
+    {
+        std::vector<char> Memory;   // At StringAddress
+        size_t Readable = ~(size_t)0; // Bytes readable from StringAddress
+        bool Openable = true;
+    };
+
+    std::map<DWORD, Process> Processes;
+    std::map<HANDLE, DWORD> OpenHandles;
+    int Opens = 0;
+    int Reads = 0;
+    std::vector<std::string> Logged;    // Strings, or "x<repeats>"
+
+    static DebugStringOps Ops()
+    {
+        return { Open, Close, Read, AnsiToWide, Log };
+    }
+
+    // Writes an ANSI or UTF-16 string with its terminator
+    void SetString(DWORD pid, const std::string& text, bool unicode)
+    {
+        std::vector<char>& memory = Processes[pid].Memory;
+        memory.clear();
+        for (char c : text)
+        {
+            memory.push_back(c);
+            if (unicode)
+                memory.push_back(0);
+        }
+        memory.insert(memory.end(), unicode ? 2 : 1, 0);
+    }
+
+    WORD Length(DWORD pid) const
+    {
+        return (WORD)Processes.at(pid).Memory.size();
+    }
+
+private:
+    static HANDLE Open(void* context, DWORD pid)
+    {
+        FakeProcesses* self = (FakeProcesses*)context;
+        const auto it = self->Processes.find(pid);
+        if (it == self->Processes.end() || !it->second.Openable)
+            return nullptr;
+        self->Opens++;
+        const HANDLE handle = (HANDLE)(ULONG_PTR)(0x1000 + 4 * self->Opens);
+        self->OpenHandles[handle] = pid;
+        return handle;
+    }
+
+    static void Close(void* context, HANDLE handle)
+    {
+        FakeProcesses* self = (FakeProcesses*)context;
+        if (self->OpenHandles.erase(handle) != 1)
+        {
+            printf("FAIL closed handle %p twice\n", handle);
+            ++failures;
+        }
+    }
+
+    static SIZE_T Read(void* context, HANDLE handle, ULONG_PTR address, void* buffer, SIZE_T size)
+    {
+        FakeProcesses* self = (FakeProcesses*)context;
+        self->Reads++;
+        const auto it = self->OpenHandles.find(handle);
+        if (it == self->OpenHandles.end())
+        {
+            printf("FAIL read through closed handle %p\n", handle);
+            ++failures;
+            return 0;
+        }
+        const Process& process = self->Processes[it->second];
+        if (address < StringAddress)
+            return 0;
+        const size_t offset = address - StringAddress;
+        const size_t available = std::min(process.Memory.size(), process.Readable);
+        if (offset >= available)
+            return 0;
+        const size_t count = std::min<size_t>(size, available - offset);
+        memcpy(buffer, process.Memory.data() + offset, count);
+        return count;
+    }
+
+    static int AnsiToWide(void*, const char* text, int size, wchar_t* out, int maxChars)
+    {
+        int i = 0;
+        for (; i < size && i < maxChars; ++i)
+            out[i] = (wchar_t)(unsigned char)text[i];
+        return i;
+    }
+
+    static void Log(void* context, const wchar_t* text, ULONG repeats)
+    {
+        FakeProcesses* self = (FakeProcesses*)context;
+        if (text == nullptr)
+        {
+            self->Logged.push_back("x" + std::to_string(repeats));
+            return;
+        }
+        std::string ascii;
+        for (const wchar_t* c = text; *c != 0; ++c)
+            ascii += (char)*c;
+        self->Logged.push_back(ascii);
+    }
+};
+
+static bool LoggedEquals(const FakeProcesses& fake, const std::vector<std::string>& expected)
+{
+    if (fake.Logged == expected)
+        return true;
+    printf("Logged:");
+    for (const std::string& line : fake.Logged)
+        printf(" [%s]", line.c_str());
+    printf("\n");
+    return false;
+}
+
+static void Send(DebugStringLog& log, FakeProcesses& fake, DWORD pid, const std::string& text, bool unicode = false)
+{
+    fake.SetString(pid, text, unicode);
+    log.OnDebugString(pid, FakeProcesses::StringAddress, fake.Length(pid), unicode);
+}
+
+static void TestCoalescing()
+{
+    FakeProcesses fake;
+    DebugStringLog log(FakeProcesses::Ops(), &fake);
+
+    Send(log, fake, 1, "a");
+    Send(log, fake, 1, "a");
+    Send(log, fake, 1, "a");
+    CHECK(LoggedEquals(fake, { "a" }));
+    Send(log, fake, 1, "b");
+    CHECK(LoggedEquals(fake, { "a", "x2", "b" }));
+
+    // The same text from another process is a different string
+    Send(log, fake, 2, "b");
+    Send(log, fake, 2, "b");
+    Send(log, fake, 1, "b");
+    CHECK(LoggedEquals(fake, { "a", "x2", "b", "b", "x1", "b" }));
+
+    // ANSI and UTF-16 strings with the same text are the same string
+    Send(log, fake, 1, "b", true);
+    Send(log, fake, 1, "", false);
+    CHECK(LoggedEquals(fake, { "a", "x2", "b", "b", "x1", "b", "x1", "" }));
+    CHECK(fake.Opens == 2);
+    log.Reset();
+}
+
+static void TestExitAndReset()
+{
+    FakeProcesses fake;
+    DebugStringLog log(FakeProcesses::Ops(), &fake);
+
+    // The exit of the process flushes its repeat count and closes its handle, but leaves the others alone
+    Send(log, fake, 2, "other");
+    Send(log, fake, 1, "a");
+    Send(log, fake, 1, "a");
+    CHECK(log.NumOpenProcesses() == 2 && fake.OpenHandles.size() == 2);
+    log.OnProcessExit(2);
+    CHECK(LoggedEquals(fake, { "other", "a" }));
+    log.OnProcessExit(1);
+    CHECK(LoggedEquals(fake, { "other", "a", "x1" }));
+    CHECK(log.NumOpenProcesses() == 0 && fake.OpenHandles.empty());
+
+    // A new process with the same PID opens a new handle, and its first string is logged even if it is the same
+    Send(log, fake, 1, "a");
+    CHECK(fake.Opens == 3);
+    CHECK(LoggedEquals(fake, { "other", "a", "x1", "a" }));
+
+    // Reset (a new target or a detach) flushes the count and closes every handle
+    Send(log, fake, 1, "a");
+    Send(log, fake, 3, "c");
+    Send(log, fake, 3, "c");
+    Send(log, fake, 3, "c");
+    CHECK(log.NumOpenProcesses() == 2);
+    log.Reset();
+    CHECK(LoggedEquals(fake, { "other", "a", "x1", "a", "x1", "c", "x2" }));
+    CHECK(log.NumOpenProcesses() == 0 && fake.OpenHandles.empty());
+
+    // Nothing is pending after a reset, so a second one logs nothing
+    log.Reset();
+    Send(log, fake, 3, "c");
+    CHECK(LoggedEquals(fake, { "other", "a", "x1", "a", "x1", "c", "x2", "c" }));
+    CHECK(fake.Opens == 5);
+
+    // An exit of a process that sent nothing changes nothing
+    log.OnProcessExit(7);
+    CHECK(log.NumOpenProcesses() == 1);
+    log.Reset();
+}
+
+static void TestReads()
+{
+    FakeProcesses fake;
+    DebugStringLog log(FakeProcesses::Ops(), &fake);
+
+    // Cut at the terminator, not at nDebugStringLength
+    fake.SetString(1, "first", false);
+    fake.Processes[1].Memory.insert(fake.Processes[1].Memory.end(), { 'j', 'u', 'n', 'k' });
+    log.OnDebugString(1, FakeProcesses::StringAddress, fake.Length(1), false);
+    fake.SetString(1, "second", true);
+    fake.Processes[1].Memory.insert(fake.Processes[1].Memory.end(), { 'x', 0, 'y', 0 });
+    log.OnDebugString(1, FakeProcesses::StringAddress, fake.Length(1), true);
+    CHECK(LoggedEquals(fake, { "first", "second" }));
+
+    // Without a terminator in what can be read, the string ends with the last whole character read
+    fake.SetString(1, "truncated string", false);
+    fake.Processes[1].Readable = 9;
+    log.OnDebugString(1, FakeProcesses::StringAddress, fake.Length(1), false);
+    fake.SetString(1, "unicode", true);
+    fake.Processes[1].Readable = 7;
+    log.OnDebugString(1, FakeProcesses::StringAddress, fake.Length(1), true);
+    CHECK(LoggedEquals(fake, { "first", "second", "truncated", "uni" }));
+
+    // A string that cannot be read at all is not logged and keeps the handle
+    fake.Processes[1].Readable = 0;
+    log.OnDebugString(1, FakeProcesses::StringAddress, fake.Length(1), true);
+    CHECK(fake.Logged.size() == 4 && log.NumOpenProcesses() == 1);
+
+    // A process that cannot be opened is retried on its next string
+    fake.SetString(2, "closed", false);
+    fake.Processes[2].Openable = false;
+    log.OnDebugString(2, FakeProcesses::StringAddress, fake.Length(2), false);
+    CHECK(log.NumOpenProcesses() == 1 && fake.Logged.size() == 4);
+    fake.Processes[2].Openable = true;
+    log.OnDebugString(2, FakeProcesses::StringAddress, fake.Length(2), false);
+    CHECK(log.NumOpenProcesses() == 2 && fake.Logged.back() == "closed");
+
+    // The longest string an event can describe
+    fake.SetString(3, std::string(0xFFFE, 'z'), false);
+    log.OnDebugString(3, FakeProcesses::StringAddress, 0xFFFF, false);
+    CHECK(fake.Logged.back() == std::string(0xFFFE, 'z'));
+    fake.SetString(3, std::string(0x7FFE, 'w'), true);
+    log.OnDebugString(3, FakeProcesses::StringAddress, 0xFFFF, true);
+    CHECK(fake.Logged.back() == std::string(0x7FFE, 'w'));
+    log.Reset();
+    CHECK(fake.OpenHandles.empty());
+}
+
+// Random strings, exits and resets against a model that keeps the last string and count
+static void TestRandomEvents()
+{
+    FakeProcesses fake;
+    DebugStringLog log(FakeProcesses::Ops(), &fake);
+    std::vector<std::string> expected;
+    std::string lastText;
+    DWORD lastPid = 0;
+    ULONG repeats = 0;
+    std::map<DWORD, bool> open;
+    auto flush = [&]
+    {
+        if (repeats != 0)
+            expected.push_back("x" + std::to_string(repeats));
+        repeats = 0;
+    };
+
+    std::mt19937 rng(42);
+    const char* const texts[] = { "a", "b", "hello", "" };
+    for (int i = 0; i < 100000; ++i)
+    {
+        // Storms of the same string from the same process, mixed with others
+        const bool repeat = lastPid != 0 && rng() % 4 != 0;
+        const DWORD pid = repeat ? lastPid : 1 + rng() % 3;
+        const unsigned kind = rng() % 100;
+        if (kind < 90)
+        {
+            const std::string text = repeat ? lastText : texts[rng() % 4];
+            Send(log, fake, pid, text, rng() % 2 == 0);
+            open[pid] = true;
+            if (pid == lastPid && text == lastText)
+                repeats++;
+            else
+            {
+                flush();
+                expected.push_back(text);
+                lastText = text;
+                lastPid = pid;
+            }
+        }
+        else if (kind < 98)
+        {
+            log.OnProcessExit(pid);
+            open.erase(pid);
+            if (pid == lastPid)
+            {
+                flush();
+                lastPid = 0;
+            }
+        }
+        else
+        {
+            log.Reset();
+            open.clear();
+            flush();
+            lastPid = 0;
+        }
+
+        if (log.NumOpenProcesses() != open.size() || fake.OpenHandles.size() != open.size())
+        {
+            printf("FAIL event %d: %zu processes open, %zu handles, expected %zu\n", i, log.NumOpenProcesses(), fake.OpenHandles.size(), open.size());
+            ++failures;
+            break;
+        }
+    }
+    log.Reset();
+    flush();
+    CHECK(fake.Logged == expected);
+    CHECK(fake.OpenHandles.empty());
+    printf("%zu lines logged for %d reads\n", fake.Logged.size(), fake.Reads);
+}
+
+int main()
+{
+    TestCoalescing();
+    TestExitAndReset();
+    TestReads();
+    TestRandomEvents();
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
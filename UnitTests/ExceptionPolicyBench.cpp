@@ -0,0 +1,221 @@
+#include <ntdll/ntdll.h>
+#include "ExceptionPolicy.h"
+#include "PeImage.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+// Replays a synthetic exception storm through the filter of HookedWaitForDebugEvent: guard page violations,
+// breakpoints in user code and in the system images, illegal instructions, access violations and single steps, with
+// every exception setting enabled. Compares the chain of setting and code comparisons with the PE header reads of
+// IsInsideKernelOrNtdll on every breakpoint, the policy table with the cached image ranges, and an open-addressed
+// map from code to policy compiled from the settings, which is what a table too long for a linear scan would need.
+// Built with OLLY1 so that the breakpoint policies are in the table
+//
+//   ExceptionPolicyBench [events]
+
+using Clock = std::chrono::steady_clock;
+
+template<typename TFunction>
+static double BestNs(TFunction function, int rounds)
+{
+    double best = 1e30;
+    for (int round = 0; round < rounds; ++round)
+    {
+        const auto start = Clock::now();
+        function();
+        const double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        if (ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+struct ExceptionEvent
+{
+    DWORD Code;
+    DWORD_PTR Address;
+};
+
+static DWORD_PTR UserBreakpoint = 0;
+
+static bool IsUserBreakpoint(DWORD_PTR address)
+{
+    return address == UserBreakpoint;
+}
+
+static DWORD_PTR hNtdll = 0;
+static DWORD_PTR hKernel = 0;
+
+static bool OldIsInsideKernelOrNtdll(DWORD_PTR address)
+{
+    PIMAGE_DOS_HEADER pDos = (PIMAGE_DOS_HEADER)hNtdll;
+    PIMAGE_NT_HEADERS pNt = (PIMAGE_NT_HEADERS)((DWORD_PTR)pDos + *(volatile LONG*)&pDos->e_lfanew);
+    DWORD imageSizeNtdll = *(volatile DWORD*)&pNt->OptionalHeader.SizeOfImage;
+    pDos = (PIMAGE_DOS_HEADER)hKernel;
+    pNt = (PIMAGE_NT_HEADERS)((DWORD_PTR)pDos + *(volatile LONG*)&pDos->e_lfanew);
+    DWORD imageSizeKernel = *(volatile DWORD*)&pNt->OptionalHeader.SizeOfImage;
+    return (address > hNtdll && address < (hNtdll + imageSizeNtdll)) ||
+        (address > hKernel && address < (hKernel + imageSizeKernel));
+}
+
+// The settings are reloaded on every event like g_settings.opts() is
+static bool OldIsHidden(const volatile scl::Settings::Profile& opts, DWORD code, DWORD_PTR address)
+{
+    if (opts.handleExceptionIllegalInstruction != 0 && code == (DWORD)STATUS_ILLEGAL_INSTRUCTION)
+        return true;
+    if (opts.handleExceptionInvalidLockSequence != 0 && code == (DWORD)STATUS_INVALID_LOCK_SEQUENCE)
+        return true;
+    if (opts.handleExceptionNoncontinuableException != 0 && code == (DWORD)STATUS_NONCONTINUABLE_EXCEPTION)
+        return true;
+    if (opts.handleExceptionAssertionFailure != 0 && code == (DWORD)STATUS_ASSERTION_FAILURE)
+        return true;
+    if (opts.handleExceptionBreakpoint != 0 && code == (DWORD)STATUS_BREAKPOINT)
+        return !IsUserBreakpoint(address) && !OldIsInsideKernelOrNtdll(address);
+    else if (opts.handleExceptionWx86Breakpoint != 0 && code == (DWORD)STATUS_WX86_BREAKPOINT)
+        return !IsUserBreakpoint(address) && !OldIsInsideKernelOrNtdll(address);
+    else if (opts.handleExceptionGuardPageViolation != 0 && code == (DWORD)STATUS_GUARD_PAGE_VIOLATION)
+        return true;
+    return false;
+}
+
+// Open addressing with linear probing, holding only the policies whose setting is enabled
+struct CompiledPolicies
+{
+    static const size_t Size = 16;
+    const ExceptionPolicy* Slots[Size] = {};
+
+    static size_t Hash(DWORD code) { return (size_t)((code * 0x9E3779B1u) >> 28); }
+
+    void Compile(const scl::Settings::Profile& profile)
+    {
+        for (const ExceptionPolicy*& slot : Slots)
+            slot = nullptr;
+        for (const ExceptionPolicy& policy : ExceptionPolicies)
+        {
+            if (profile.*policy.Setting == 0)
+                continue;
+            size_t i = Hash(policy.ExceptionCode);
+            while (Slots[i] != nullptr)
+                i = (i + 1) % Size;
+            Slots[i] = &policy;
+        }
+    }
+
+    const ExceptionPolicy* Find(DWORD code) const
+    {
+        for (size_t i = Hash(code); Slots[i] != nullptr; i = (i + 1) % Size)
+        {
+            if (Slots[i]->ExceptionCode == code)
+                return Slots[i];
+        }
+        return nullptr;
+    }
+};
+
+int main(int argc, char* argv[])
+{
+    const size_t numEvents = argc > 1 ? strtoul(argv[1], nullptr, 0) : 1000000;
+
+    PeImage ntdll, kernel32;
+    if (!ntdll.Load(SampleImages[1]) || !kernel32.Load(SampleImages[2]))
+    {
+        printf("Cannot load the sample images\n");
+        return 1;
+    }
+    hNtdll = (DWORD_PTR)ntdll.Mapped.data();
+    hKernel = (DWORD_PTR)kernel32.Mapped.data();
+    const ImageRange systemImages[2] = { GetImageRange(ntdll.Mapped.data()), GetImageRange(kernel32.Mapped.data()) };
+    std::vector<BYTE> userCode(0x10000);
+    const DWORD_PTR user = (DWORD_PTR)userCode.data();
+    UserBreakpoint = user + 0x100;
+
+    std::mt19937 rng(41);
+    std::vector<ExceptionEvent> events(numEvents);
+    for (ExceptionEvent& event : events)
+    {
+        const unsigned kind = rng() % 100;
+        event.Address = user + rng() % userCode.size();
+        if (kind < 50)
+            event.Code = (DWORD)STATUS_GUARD_PAGE_VIOLATION;
+        else if (kind < 75)
+        {
+            event.Code = (DWORD)STATUS_BREAKPOINT;
+            if (kind < 55)
+                event.Address = hNtdll + rng() % ntdll.SizeOfImage;
+            else if (kind < 57)
+                event.Address = UserBreakpoint;
+        }
+        else if (kind < 85)
+            event.Code = (DWORD)STATUS_ILLEGAL_INSTRUCTION;
+        else if (kind < 95)
+            event.Code = (DWORD)STATUS_ACCESS_VIOLATION;
+        else
+            event.Code = (DWORD)STATUS_SINGLE_STEP;
+    }
+
+    scl::Settings::Profile profile{};
+    profile.handleExceptionIllegalInstruction = TRUE;
+    profile.handleExceptionInvalidLockSequence = TRUE;
+    profile.handleExceptionNoncontinuableException = TRUE;
+    profile.handleExceptionAssertionFailure = TRUE;
+    profile.handleExceptionBreakpoint = TRUE;
+    profile.handleExceptionGuardPageViolation = TRUE;
+    profile.handleExceptionWx86Breakpoint = TRUE;
+    const volatile scl::Settings::Profile& volatileProfile = profile;
+
+    volatile size_t sink = 0;
+    size_t hiddenChain = 0, hiddenTable = 0, hiddenCompiled = 0;
+
+    const double chain = BestNs([&]
+    {
+        size_t hidden = 0;
+        for (const ExceptionEvent& event : events)
+            hidden += OldIsHidden(volatileProfile, event.Code, event.Address);
+        hiddenChain = hidden;
+        sink = sink + hidden;
+    }, 20);
+
+    const double table = BestNs([&]
+    {
+        size_t hidden = 0;
+        for (const ExceptionEvent& event : events)
+            hidden += GetHiddenExceptionPolicy(profile, event.Code, event.Address, IsUserBreakpoint, systemImages, 2) != nullptr;
+        hiddenTable = hidden;
+        sink = sink + hidden;
+    }, 20);
+
+    CompiledPolicies compiled;
+    compiled.Compile(profile);
+    const double map = BestNs([&]
+    {
+        size_t hidden = 0;
+        for (const ExceptionEvent& event : events)
+        {
+            const ExceptionPolicy* policy = compiled.Find(event.Code);
+            if (policy == nullptr)
+                continue;
+            if (policy->Action == ExceptionActionCheckBreakpoint &&
+                (IsUserBreakpoint(event.Address) || IsInsideImageRange(systemImages[0], event.Address) || IsInsideImageRange(systemImages[1], event.Address)))
+                continue;
+            hidden++;
+        }
+        hiddenCompiled = hidden;
+        sink = sink + hidden;
+    }, 20);
+
+    if (hiddenChain != hiddenTable || hiddenChain != hiddenCompiled)
+    {
+        printf("Filters disagree: %zu, %zu, %zu hidden\n", hiddenChain, hiddenTable, hiddenCompiled);
+        return 1;
+    }
+
+    printf("%zu events, %zu hidden\n", numEvents, hiddenChain);
+    printf("Comparison chain + PE header reads: %6.2f ns/event\n", chain / numEvents);
+    printf("Policy table + cached ranges:       %6.2f ns/event\n", table / numEvents);
+    printf("Compiled open-addressed map:        %6.2f ns/event\n", map / numEvents);
+    return 0;
+}
@@ -0,0 +1,233 @@
+#include <ntdll/ntdll.h>
+#include "ExceptionPolicy.h"
+#include "PeImage.h"
+
+#include <cstdio>
+#include <set>
+#include <vector>
+
+// The exception policy table of HookedWaitForDebugEvent against the chain of setting and exception code comparisons
+// it replaced, for every combination of the exception settings, on exception codes inside and outside the table and
+// on addresses around the system images, which are two of the mapped sample images. Built with and without OLLY1,
+// which adds the breakpoint policies
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what, int line)
+{
+    if (!condition)
+    {
+        printf("FAIL line %d: %s\n", line, what);
+        ++failures;
+    }
+}
+#define CHECK(condition) Check(condition, #condition, __LINE__)
+
+static std::set<DWORD_PTR> UserBreakpoints;
+
+static bool IsUserBreakpoint(DWORD_PTR address)
+{
+    return UserBreakpoints.count(address) != 0;
+}
+
+// The ntdll and kernel32 module handles the old IsInsideKernelOrNtdll read the PE headers of on every call
+static DWORD_PTR hNtdll = 0;
+static DWORD_PTR hKernel = 0;
+
+static bool OldIsInsideKernelOrNtdll(DWORD_PTR address)
+{
+    PIMAGE_DOS_HEADER pDos = (PIMAGE_DOS_HEADER)hNtdll;
+    PIMAGE_NT_HEADERS pNt = (PIMAGE_NT_HEADERS)((DWORD_PTR)pDos + pDos->e_lfanew);
+    DWORD imageSizeNtdll = pNt->OptionalHeader.SizeOfImage;
+    pDos = (PIMAGE_DOS_HEADER)hKernel;
+    pNt = (PIMAGE_NT_HEADERS)((DWORD_PTR)pDos + pDos->e_lfanew);
+    DWORD imageSizeKernel = pNt->OptionalHeader.SizeOfImage;
+    return (address > hNtdll && address < (hNtdll + imageSizeNtdll)) ||
+        (address > hKernel && address < (hKernel + imageSizeKernel));
+}
+
+// The exception part of AnalyzeDebugStructure before the policy table. Returns the name it logged, or null
+static const wchar_t* OldHiddenException(const scl::Settings::Profile& opts, DWORD code, DWORD_PTR address)
+{
+    if (opts.handleExceptionIllegalInstruction != 0 && code == (DWORD)STATUS_ILLEGAL_INSTRUCTION)
+        return L"Illegal Instruction";
+    if (opts.handleExceptionInvalidLockSequence != 0 && code == (DWORD)STATUS_INVALID_LOCK_SEQUENCE)
+        return L"Invalid Lock Sequence";
+    if (opts.handleExceptionNoncontinuableException != 0 && code == (DWORD)STATUS_NONCONTINUABLE_EXCEPTION)
+        return L"Non-continuable Exception";
+    if (opts.handleExceptionAssertionFailure != 0 && code == (DWORD)STATUS_ASSERTION_FAILURE)
+        return L"Assertion Failure";
+#ifdef OLLY1
+    if (opts.handleExceptionBreakpoint != 0 && code == (DWORD)STATUS_BREAKPOINT)
+    {
+        if (IsUserBreakpoint(address) == false && !OldIsInsideKernelOrNtdll(address))
+            return L"Breakpoint";
+    }
+    else if (opts.handleExceptionWx86Breakpoint != 0 && code == (DWORD)STATUS_WX86_BREAKPOINT)
+    {
+        if (IsUserBreakpoint(address) == false && !OldIsInsideKernelOrNtdll(address))
+            return L"Wx86 Breakpoint";
+    }
+#endif
+    else if (opts.handleExceptionGuardPageViolation != 0 && code == (DWORD)STATUS_GUARD_PAGE_VIOLATION)
+        return L"Guard Page Violation";
+    (void)address;
+    return nullptr;
+}
+
+// wcscmp assumes a 4 byte wchar_t, and the tests are built with -fshort-wchar
+static bool SameName(const wchar_t* a, const wchar_t* b)
+{
+    while (*a != 0 && *a == *b)
+        ++a, ++b;
+    return *a == *b;
+}
+
+static BOOL scl::Settings::Profile::* const ExceptionSettings[] =
+{
+    &scl::Settings::Profile::handleExceptionIllegalInstruction,
+    &scl::Settings::Profile::handleExceptionInvalidLockSequence,
+    &scl::Settings::Profile::handleExceptionNoncontinuableException,
+    &scl::Settings::Profile::handleExceptionAssertionFailure,
+    &scl::Settings::Profile::handleExceptionBreakpoint,
+    &scl::Settings::Profile::handleExceptionGuardPageViolation,
+    &scl::Settings::Profile::handleExceptionWx86Breakpoint,
+};
+
+static void TestTable()
+{
+    std::set<DWORD> codes;
+    for (const ExceptionPolicy& policy : ExceptionPolicies)
+    {
+        CHECK(codes.insert(policy.ExceptionCode).second);
+        CHECK(FindExceptionPolicy(policy.ExceptionCode) == &policy);
+        CHECK((policy.Action == ExceptionActionCheckBreakpoint) ==
+            (policy.ExceptionCode == (DWORD)STATUS_BREAKPOINT || policy.ExceptionCode == (DWORD)STATUS_WX86_BREAKPOINT));
+    }
+#ifdef OLLY1
+    CHECK(_countof(ExceptionPolicies) == 7);
+#else
+    CHECK(_countof(ExceptionPolicies) == 5);
+    CHECK(FindExceptionPolicy((DWORD)STATUS_BREAKPOINT) == nullptr);
+#endif
+    CHECK(FindExceptionPolicy((DWORD)STATUS_ACCESS_VIOLATION) == nullptr);
+    CHECK(FindExceptionPolicy(0) == nullptr);
+}
+
+static void TestImageRange()
+{
+    for (const char* path : SampleImages)
+    {
+        PeImage pe;
+        if (!pe.Load(path))
+        {
+            printf("FAIL cannot load %s\n", path);
+            ++failures;
+            continue;
+        }
+        const ImageRange range = GetImageRange(pe.Mapped.data());
+        CHECK(range.Start == (DWORD_PTR)pe.Mapped.data());
+        CHECK(range.End - range.Start == pe.SizeOfImage);
+        CHECK(!IsInsideImageRange(range, range.Start));
+        CHECK(IsInsideImageRange(range, range.Start + 1));
+        CHECK(IsInsideImageRange(range, range.End - 1));
+        CHECK(!IsInsideImageRange(range, range.End));
+    }
+
+    // PE32+ has SizeOfImage at the same offset
+    std::vector<BYTE> image64(0x1000, 0);
+    IMAGE_DOS_HEADER dos = {};
+    dos.e_magic = IMAGE_DOS_SIGNATURE;
+    dos.e_lfanew = 0x40;
+    memcpy(image64.data(), &dos, sizeof(dos));
+    IMAGE_NT_HEADERS64 nt = {};
+    nt.Signature = IMAGE_NT_SIGNATURE;
+    nt.OptionalHeader.Magic = IMAGE_NT_OPTIONAL_HDR64_MAGIC;
+    nt.OptionalHeader.SizeOfImage = 0x123000;
+    memcpy(image64.data() + 0x40, &nt, sizeof(nt));
+    const ImageRange range = GetImageRange(image64.data());
+    CHECK(range.End - range.Start == 0x123000);
+
+    const ImageRange empty = GetImageRange(nullptr);
+    CHECK(empty.Start == 0 && empty.End == 0);
+    CHECK(!IsInsideImageRange(empty, 0) && !IsInsideImageRange(empty, 1));
+}
+
+static void TestAgainstChain()
+{
+    PeImage ntdll, kernel32;
+    if (!ntdll.Load(SampleImages[1]) || !kernel32.Load(SampleImages[2]))
+    {
+        printf("FAIL cannot load the sample images\n");
+        ++failures;
+        return;
+    }
+    hNtdll = (DWORD_PTR)ntdll.Mapped.data();
+    hKernel = (DWORD_PTR)kernel32.Mapped.data();
+    const ImageRange systemImages[2] = { GetImageRange(ntdll.Mapped.data()), GetImageRange(kernel32.Mapped.data()) };
+
+    std::vector<BYTE> userCode(0x1000);
+    const DWORD_PTR user = (DWORD_PTR)userCode.data();
+    UserBreakpoints = { user + 0x10, hNtdll + 0x1000 };
+
+    const DWORD codes[] =
+    {
+        (DWORD)STATUS_ILLEGAL_INSTRUCTION, (DWORD)STATUS_INVALID_LOCK_SEQUENCE, (DWORD)STATUS_NONCONTINUABLE_EXCEPTION,
+        (DWORD)STATUS_ASSERTION_FAILURE, (DWORD)STATUS_BREAKPOINT, (DWORD)STATUS_WX86_BREAKPOINT,
+        (DWORD)STATUS_GUARD_PAGE_VIOLATION, (DWORD)STATUS_ACCESS_VIOLATION, (DWORD)STATUS_SINGLE_STEP, 0, 0xE06D7363,
+    };
+    const DWORD_PTR addresses[] =
+    {
+        0, user, user + 0x10, user + 0x11,
+        hNtdll, hNtdll + 1, hNtdll + 0x1000, hNtdll + ntdll.SizeOfImage - 1, hNtdll + ntdll.SizeOfImage,
+        hKernel, hKernel + 0x2345, hKernel + kernel32.SizeOfImage - 1, hKernel + kernel32.SizeOfImage,
+    };
+
+    int compared = 0, hidden = 0;
+    for (unsigned mask = 0; mask < 1u << _countof(ExceptionSettings); ++mask)
+    {
+        scl::Settings::Profile profile{};
+        for (size_t bit = 0; bit < _countof(ExceptionSettings); ++bit)
+            profile.*ExceptionSettings[bit] = (mask >> bit) & 1 ? TRUE : FALSE;
+
+        for (const DWORD code : codes)
+        {
+            for (const DWORD_PTR address : addresses)
+            {
+                const wchar_t* expected = OldHiddenException(profile, code, address);
+                const ExceptionPolicy* policy = GetHiddenExceptionPolicy(profile, code, address, IsUserBreakpoint, systemImages, _countof(systemImages));
+                const wchar_t* actual = policy != nullptr ? policy->Name : nullptr;
+                if ((expected == nullptr) != (actual == nullptr) || (expected != nullptr && !SameName(expected, actual)))
+                {
+                    printf("FAIL settings %#x, exception %#x at %#zx: %s, was %s\n", mask, code, (size_t)(address - user),
+                        actual != nullptr ? "hidden" : "passed", expected != nullptr ? "hidden" : "passed");
+                    ++failures;
+                }
+                ++compared;
+                hidden += actual != nullptr;
+            }
+        }
+    }
+    printf("%d events compared, %d hidden\n", compared, hidden);
+
+    // Without the debugger's breakpoint list only the system images keep breakpoints from being hidden
+    scl::Settings::Profile profile{};
+    profile.handleExceptionBreakpoint = TRUE;
+#ifdef OLLY1
+    CHECK(GetHiddenExceptionPolicy(profile, (DWORD)STATUS_BREAKPOINT, user + 0x10, nullptr, systemImages, 2) != nullptr);
+    CHECK(GetHiddenExceptionPolicy(profile, (DWORD)STATUS_BREAKPOINT, hKernel + 0x10, nullptr, systemImages, 2) == nullptr);
+    CHECK(GetHiddenExceptionPolicy(profile, (DWORD)STATUS_BREAKPOINT, hKernel + 0x10, nullptr, systemImages, 1) != nullptr);
+#else
+    CHECK(GetHiddenExceptionPolicy(profile, (DWORD)STATUS_BREAKPOINT, user + 0x10, nullptr, systemImages, 2) == nullptr);
+#endif
+}
+
+int main()
+{
+    TestTable();
+    TestImageRange();
+    TestAgainstChain();
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,41 @@
+#include "FilterHarness.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+// Fuzzer entry point for the buffer filters. Built with libFuzzer if SCYLLAHIDE_FUZZ is on:
+//
+//   FilterFuzz -max_len=200000 fuzz-corpus ../UnitTests/corpus
+//
+// otherwise with a main that runs the files named on the command line, which works with AFL:
+//
+//   afl-fuzz -i ../UnitTests/corpus -o findings -- ./FilterFuzz @@
+
+extern "C" int LLVMFuzzerTestOneInput(const UCHAR* data, size_t size)
+{
+    FilterStats stats;
+    std::string error;
+    if (!CheckFilter(data, size, &stats, &error))
+    {
+        fprintf(stderr, "%s\n", error.c_str());
+        abort();
+    }
+    return 0;
+}
+
+#ifndef SCYLLAHIDE_LIBFUZZER
+int main(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::vector<UCHAR> data;
+        if (!ReadFile(argv[i], &data))
+        {
+            fprintf(stderr, "Can't read %s\n", argv[i]);
+            return 1;
+        }
+        LLVMFuzzerTestOneInput(data.data(), data.size());
+    }
+    return 0;
+}
+#endif
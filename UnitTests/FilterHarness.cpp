@@ -0,0 +1,572 @@
+#include "FilterHarness.h"
+#include "BufferFilters.h"
+#include "HookHelper.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <dirent.h>
+
+// Bounds of the buffer being filtered, to check that names are only read from inside it
+static const UCHAR* CurrentBuffer = nullptr;
+static size_t CurrentLength = 0;
+static bool NameOutsideBuffer = false;
+
+ULONG GetProtectedProcessIds(PULONG pids, ULONG maxPids)
+{
+    const ULONG count = MIN((ULONG)_countof(FilterTestProtectedPids), maxPids);
+    memcpy(pids, FilterTestProtectedPids, count * sizeof(ULONG));
+    return count;
+}
+
+const ULONG* GetBadObjectTypeBitmap()
+{
+    static ULONG bitmap[BAD_OBJECT_TYPE_BITMAP_ULONGS];
+    for (const USHORT type : FilterTestBadObjectTypes)
+        bitmap[type / 32] |= 1UL << (type % 32);
+    return bitmap;
+}
+
+// Like the real one, which compares against a fixed list. The name from the buffer goes second, for the bounds check
+bool IsProcessNameBad(PUNICODE_STRING processName)
+{
+    if (processName == nullptr || processName->Length == 0 || processName->Buffer == nullptr)
+        return false;
+
+    for (const wchar_t* name : FilterTestBadProcessNames)
+    {
+        UNICODE_STRING badName;
+        badName.Length = 0;
+        while (name[badName.Length / sizeof(WCHAR)] != L'\0')
+            badName.Length += sizeof(WCHAR);
+        badName.MaximumLength = badName.Length + sizeof(WCHAR);
+        badName.Buffer = (PWSTR)name;
+        if (RtlEqualUnicodeString(&badName, processName, TRUE))
+            return true;
+    }
+    return false;
+}
+
+// The bad windows of the FilterKindHwndList input being filtered
+static const ULONGLONG* CurrentBadWindows = nullptr;
+static ULONG CurrentNumberOfBadWindows = 0;
+static ULONG WindowQueries = 0;
+
+bool IsWindowBad(HWND hWnd)
+{
+    WindowQueries++;
+    for (ULONG i = 0; i < CurrentNumberOfBadWindows; ++i)
+    {
+        if (CurrentBadWindows[i] == (ULONG_PTR)hWnd)
+            return true;
+    }
+    return false;
+}
+
+// FilterObject passes the name from the buffer second
+BOOLEAN NTAPI RtlEqualUnicodeString(PCUNICODE_STRING String1, PCUNICODE_STRING String2, BOOLEAN CaseInSensitive)
+{
+    const UCHAR* name = (const UCHAR*)String2->Buffer;
+    if (CurrentBuffer != nullptr && (name < CurrentBuffer || name > CurrentBuffer + CurrentLength || (size_t)(CurrentBuffer + CurrentLength - name) < String2->Length))
+    {
+        NameOutsideBuffer = true;
+        return FALSE;
+    }
+
+    if (String1->Length != String2->Length)
+        return FALSE;
+    for (USHORT i = 0; i < String1->Length / sizeof(WCHAR); ++i)
+    {
+        WCHAR c1 = String1->Buffer[i], c2 = String2->Buffer[i];
+        if (CaseInSensitive)
+        {
+            c1 = c1 >= L'a' && c1 <= L'z' ? c1 - (L'a' - L'A') : c1;
+            c2 = c2 >= L'a' && c2 <= L'z' ? c2 - (L'a' - L'A') : c2;
+        }
+        if (c1 != c2)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static bool IsHiddenHandle(ULONG pid, USHORT type)
+{
+    return std::find(std::begin(FilterTestProtectedPids), std::end(FilterTestProtectedPids), pid) != std::end(FilterTestProtectedPids) &&
+        std::find(std::begin(FilterTestBadObjectTypes), std::end(FilterTestBadObjectTypes), type) != std::end(FilterTestBadObjectTypes);
+}
+
+static bool IsDebugObjectEntry(const OBJECT_TYPE_INFORMATION* entry, size_t nameLength)
+{
+    static const WCHAR debugObject[] = L"DebugObject";
+    return entry->TypeName.Length <= entry->TypeName.MaximumLength && entry->TypeName.MaximumLength <= nameLength &&
+        entry->TypeName.Length == sizeof(debugObject) - sizeof(WCHAR) && memcmp(entry + 1, debugObject, entry->TypeName.Length) == 0;
+}
+
+// Expected result of the handle filters: the entries that fit in the buffer, without the hidden ones
+template<typename TInfo, typename TEntry>
+static void ExpectHandleFilter(UCHAR* expected, size_t length, ULONG* adjust, FilterStats* stats)
+{
+    const size_t header = offsetof(TInfo, Handles);
+    *adjust = 0;
+    if (length < header)
+        return;
+
+    TInfo* info = (TInfo*)expected;
+    const ULONG count = (ULONG)MIN((size_t)info->NumberOfHandles, (length - header) / sizeof(TEntry));
+    ULONG kept = 0;
+    for (ULONG i = 0; i < count; ++i)
+    {
+        TEntry entry;
+        memcpy(&entry, &info->Handles[i], sizeof(entry));
+        if (IsHiddenHandle((ULONG)entry.UniqueProcessId, entry.ObjectTypeIndex))
+            continue;
+        memcpy(&info->Handles[kept++], &entry, sizeof(entry));
+    }
+    stats->Entries = count;
+    stats->Hidden = count - kept;
+    if (kept != count)
+    {
+        memset(&info->Handles[kept], 0, (count - kept) * sizeof(TEntry));
+        info->NumberOfHandles = kept;
+        *adjust = (count - kept) * sizeof(TEntry);
+    }
+}
+
+// Expected result of FilterObjects: the same walk, with the counts of DebugObject zeroed
+static void ExpectObjectTypesFilter(UCHAR* expected, size_t length, FilterStats* stats)
+{
+    if (length < offsetof(OBJECT_TYPES_INFORMATION, TypeInformation))
+        return;
+
+    const ULONG numberOfTypes = ((OBJECT_TYPES_INFORMATION*)expected)->NumberOfTypes;
+    size_t offset = ALIGN_UP(offsetof(OBJECT_TYPES_INFORMATION, TypeInformation), ULONG_PTR);
+    for (ULONG i = 0; i < numberOfTypes && offset <= length && length - offset >= sizeof(OBJECT_TYPE_INFORMATION); ++i)
+    {
+        OBJECT_TYPE_INFORMATION* entry = (OBJECT_TYPE_INFORMATION*)(expected + offset);
+        const size_t nameOffset = offset + sizeof(OBJECT_TYPE_INFORMATION);
+        if (entry->TypeName.Length > entry->TypeName.MaximumLength || length - nameOffset < entry->TypeName.MaximumLength)
+            break;
+
+        stats->Entries++;
+        if (IsDebugObjectEntry(entry, length - nameOffset))
+        {
+            entry->TotalNumberOfObjects = 0;
+            entry->TotalNumberOfHandles = 0;
+            stats->Hidden++;
+        }
+        offset = nameOffset + ALIGN_UP(entry->TypeName.MaximumLength, ULONG_PTR);
+    }
+}
+
+static void ExpectObjectTypeFilter(UCHAR* expected, size_t length, FilterStats* stats)
+{
+    if (length < sizeof(OBJECT_TYPE_INFORMATION))
+        return;
+
+    OBJECT_TYPE_INFORMATION* entry = (OBJECT_TYPE_INFORMATION*)expected;
+    stats->Entries = 1;
+    if (IsDebugObjectEntry(entry, length - sizeof(OBJECT_TYPE_INFORMATION)))
+    {
+        entry->TotalNumberOfObjects = entry->TotalNumberOfObjects == 0 ? 0 : entry->TotalNumberOfObjects - 1;
+        entry->TotalNumberOfHandles = entry->TotalNumberOfHandles == 0 ? 0 : entry->TotalNumberOfHandles - 1;
+        stats->Hidden = 1;
+    }
+}
+
+static bool IsHiddenProcess(ULONG pid, const WCHAR* name, USHORT nameLength)
+{
+    if (pid == FilterTestHiddenPid)
+        return true;
+    if (name == nullptr || nameLength == 0)
+        return false;
+    for (const wchar_t* badName : FilterTestBadProcessNames)
+    {
+        size_t i = 0;
+        for (; i < nameLength / sizeof(WCHAR) && badName[i] != L'\0'; ++i)
+        {
+            const WCHAR c = name[i];
+            if ((c >= L'A' && c <= L'Z' ? c + (L'a' - L'A') : c) != badName[i])
+                break;
+        }
+        if (i == nameLength / sizeof(WCHAR) && badName[i] == L'\0')
+            return true;
+    }
+    return false;
+}
+
+// Expected result of FilterProcess: nothing if any entry, thread array or name is outside the list or a name is outside
+// its entry, otherwise the hidden entries after the first one unlinked and the names of all hidden entries zeroed.
+// The names point into the list at the address in the header, not into expected
+static void ExpectProcessFilter(UCHAR* expected, size_t length, FilterStats* stats)
+{
+    if (length < FILTER_PROCESS_LIST_HEADER)
+        return;
+    ULONGLONG base;
+    memcpy(&base, expected, sizeof(base));
+    UCHAR* list = expected + FILTER_PROCESS_LIST_HEADER;
+    const size_t listLength = length - FILTER_PROCESS_LIST_HEADER;
+    const size_t header = offsetof(SYSTEM_PROCESS_INFORMATION, Threads);
+
+    std::vector<size_t> offsets;
+    for (size_t offset = 0;;)
+    {
+        if (offset + header > listLength)
+            return;
+        SYSTEM_PROCESS_INFORMATION entry;
+        memcpy(&entry, list + offset, header);
+        const size_t end = entry.NextEntryOffset != 0 ? offset + entry.NextEntryOffset : listLength;
+        if (end > listLength || header + (size_t)entry.NumberOfThreads * sizeof(SYSTEM_THREAD_INFORMATION) > end - offset)
+            return;
+        const ULONGLONG name = (ULONG_PTR)entry.ImageName.Buffer;
+        if (name != 0 && (name < base + offset + header || name > base + end || base + end - name < entry.ImageName.Length))
+            return;
+        offsets.push_back(offset);
+        if (entry.NextEntryOffset == 0)
+            break;
+        offset = end;
+    }
+
+    stats->Entries = (ULONG)offsets.size();
+    size_t previous = 0;
+    for (size_t i = 0; i < offsets.size(); ++i)
+    {
+        SYSTEM_PROCESS_INFORMATION entry;
+        memcpy(&entry, list + offsets[i], header);
+        WCHAR* name = entry.ImageName.Buffer != nullptr ? (WCHAR*)(list + ((ULONG_PTR)entry.ImageName.Buffer - base)) : nullptr;
+        if (!IsHiddenProcess(HandleToULong(entry.UniqueProcessId), name, entry.ImageName.Length))
+        {
+            previous = i;
+            continue;
+        }
+        if (name != nullptr)
+            memset(name, 0, entry.ImageName.Length);
+        if (i == 0)
+            continue;
+
+        const ULONG next = i + 1 < offsets.size() ? (ULONG)(offsets[i + 1] - offsets[previous]) : 0;
+        memcpy(list + offsets[previous] + offsetof(SYSTEM_PROCESS_INFORMATION, NextEntryOffset), &next, sizeof(next));
+        stats->Hidden++;
+    }
+}
+
+// The window list of a FilterKindHwndList input, nullptr if the header does not fit
+static HWND* HwndListWindows(UCHAR* input, size_t length, ULONG* capacity)
+{
+    if (length < FILTER_HWND_LIST_HEADER_SIZE(0))
+        return nullptr;
+    const FILTER_HWND_LIST_HEADER* header = (const FILTER_HWND_LIST_HEADER*)input;
+    const size_t headerSize = FILTER_HWND_LIST_HEADER_SIZE(header->NumberOfBadWindows);
+    if (headerSize > length)
+        return nullptr;
+    *capacity = (ULONG)MIN((length - headerSize) / sizeof(HWND), (size_t)MAXULONG);
+    return (HWND*)(input + headerSize);
+}
+
+// Expected result of FilterHwndList: the windows within the count and the buffer, without the bad ones and with the
+// count lowered. Also returns the number of windows IsWindowBad should have been asked about
+static void ExpectHwndListFilter(UCHAR* expected, size_t length, FilterStats* stats, ULONG* queries)
+{
+    ULONG capacity;
+    HWND* windows = HwndListWindows(expected, length, &capacity);
+    if (windows == nullptr)
+        return;
+
+    FILTER_HWND_LIST_HEADER* header = (FILTER_HWND_LIST_HEADER*)expected;
+    const ULONG count = MIN(header->Count, capacity);
+    std::vector<HWND> kept;
+    for (ULONG i = 0; i < count; ++i)
+    {
+        const ULONGLONG* bad = header->BadWindows;
+        const bool hidden = windows[i] != nullptr && std::find(bad, bad + header->NumberOfBadWindows, (ULONG_PTR)windows[i]) != bad + header->NumberOfBadWindows;
+        *queries += windows[i] != nullptr;
+        if (!hidden)
+            kept.push_back(windows[i]);
+    }
+
+    stats->Entries = count;
+    stats->Hidden = count - (ULONG)kept.size();
+    memset(windows, 0, count * sizeof(HWND));
+    if (!kept.empty())
+        memcpy(windows, kept.data(), kept.size() * sizeof(HWND));
+    header->Count -= stats->Hidden;
+}
+
+std::vector<UCHAR> MakeHwndList(const std::vector<ULONGLONG>& windows, const std::vector<ULONGLONG>& badWindows, ULONG count)
+{
+    const size_t headerSize = FILTER_HWND_LIST_HEADER_SIZE(badWindows.size());
+    std::vector<UCHAR> input(headerSize + windows.size() * sizeof(ULONGLONG));
+    const ULONG numberOfBadWindows = (ULONG)badWindows.size();
+    memcpy(input.data() + offsetof(FILTER_HWND_LIST_HEADER, Count), &count, sizeof(count));
+    memcpy(input.data() + offsetof(FILTER_HWND_LIST_HEADER, NumberOfBadWindows), &numberOfBadWindows, sizeof(numberOfBadWindows));
+    if (!badWindows.empty())
+        memcpy(input.data() + offsetof(FILTER_HWND_LIST_HEADER, BadWindows), badWindows.data(), badWindows.size() * sizeof(ULONGLONG));
+    if (!windows.empty())
+        memcpy(input.data() + headerSize, windows.data(), windows.size() * sizeof(ULONGLONG));
+    return input;
+}
+
+void RebaseProcessList(UCHAR* input, size_t length, ULONG_PTR address)
+{
+    if (length < FILTER_PROCESS_LIST_HEADER)
+        return;
+    ULONGLONG base;
+    memcpy(&base, input, sizeof(base));
+    UCHAR* list = input + FILTER_PROCESS_LIST_HEADER;
+    const size_t listLength = length - FILTER_PROCESS_LIST_HEADER;
+
+    for (size_t offset = 0; offset + offsetof(SYSTEM_PROCESS_INFORMATION, Threads) <= listLength;)
+    {
+        SYSTEM_PROCESS_INFORMATION entry;
+        memcpy(&entry, list + offset, offsetof(SYSTEM_PROCESS_INFORMATION, Threads));
+        const ULONGLONG name = (ULONG_PTR)entry.ImageName.Buffer;
+        if (name >= base && name - base <= listLength)
+        {
+            entry.ImageName.Buffer = (PWSTR)(address + (ULONG_PTR)(name - base));
+            memcpy(list + offset + offsetof(SYSTEM_PROCESS_INFORMATION, ImageName), &entry.ImageName, sizeof(entry.ImageName));
+        }
+        if (entry.NextEntryOffset == 0)
+            break;
+        offset += entry.NextEntryOffset;
+    }
+
+    base = address;
+    memcpy(input, &base, sizeof(base));
+}
+
+std::vector<UCHAR> MakeProcessList(const std::vector<FilterTestProcess>& processes, ULONG_PTR address)
+{
+    std::vector<UCHAR> list;
+    std::vector<size_t> offsets, nameOffsets, nameLengths;
+    for (const auto& process : processes)
+    {
+        size_t nameLength = 0; // No wcslen, WCHAR is not the wchar_t of the C library with -fshort-wchar
+        while (process.Name[nameLength] != L'\0')
+            nameLength++;
+        offsets.push_back(list.size());
+        nameOffsets.push_back(list.size() + offsetof(SYSTEM_PROCESS_INFORMATION, Threads) + process.NumberOfThreads * sizeof(SYSTEM_THREAD_INFORMATION));
+        nameLengths.push_back(nameLength * sizeof(WCHAR));
+        list.resize(ALIGN_UP(nameOffsets.back() + (nameLength + 1) * sizeof(WCHAR), ULONGLONG));
+        memcpy(list.data() + nameOffsets.back(), process.Name, nameLength * sizeof(WCHAR));
+    }
+    for (size_t i = 0; i < processes.size(); ++i)
+    {
+        SYSTEM_PROCESS_INFORMATION entry = SYSTEM_PROCESS_INFORMATION();
+        entry.NextEntryOffset = i + 1 < processes.size() ? (ULONG)(offsets[i + 1] - offsets[i]) : 0;
+        entry.NumberOfThreads = processes[i].NumberOfThreads;
+        entry.UniqueProcessId = ULongToHandle(processes[i].Pid);
+        entry.InheritedFromUniqueProcessId = ULongToHandle(i == 0 ? 0 : 4);
+        entry.ImageName.Length = (USHORT)nameLengths[i];
+        entry.ImageName.MaximumLength = (USHORT)(nameLengths[i] + sizeof(WCHAR));
+        entry.ImageName.Buffer = nameLengths[i] != 0 ? (PWSTR)(address + nameOffsets[i]) : nullptr;
+        memcpy(list.data() + offsets[i], &entry, offsetof(SYSTEM_PROCESS_INFORMATION, Threads));
+        for (ULONG thread = 0; thread < processes[i].NumberOfThreads; ++thread)
+        {
+            SYSTEM_THREAD_INFORMATION info = SYSTEM_THREAD_INFORMATION();
+            info.ClientId.UniqueProcess = entry.UniqueProcessId;
+            info.ClientId.UniqueThread = ULongToHandle(processes[i].Pid + 4 * (thread + 1));
+            info.ThreadState = 5; // Waiting
+            memcpy(list.data() + offsets[i] + offsetof(SYSTEM_PROCESS_INFORMATION, Threads) + thread * sizeof(info), &info, sizeof(info));
+        }
+    }
+
+    std::vector<UCHAR> input(FILTER_PROCESS_LIST_HEADER + list.size());
+    const ULONGLONG base = address;
+    memcpy(input.data(), &base, sizeof(base));
+    if (!list.empty())
+        memcpy(input.data() + FILTER_PROCESS_LIST_HEADER, list.data(), list.size());
+    return input;
+}
+
+ULONG RunFilter(FilterKind kind, UCHAR* buffer, ULONG length)
+{
+    ULONG adjust = 0;
+    switch (kind)
+    {
+    case FilterKindHandleInfo:
+        FilterHandleInfo((PSYSTEM_HANDLE_INFORMATION)buffer, length, &adjust);
+        break;
+    case FilterKindHandleInfoEx:
+        FilterHandleInfoEx((PSYSTEM_HANDLE_INFORMATION_EX)buffer, length, &adjust);
+        break;
+    case FilterKindObjectTypes:
+        FilterObjects((POBJECT_TYPES_INFORMATION)buffer, length);
+        break;
+    case FilterKindObjectType:
+        if (length >= sizeof(OBJECT_TYPE_INFORMATION))
+            FilterObject((POBJECT_TYPE_INFORMATION)buffer, length - sizeof(OBJECT_TYPE_INFORMATION), false);
+        break;
+    case FilterKindHwndList:
+    {
+        ULONG capacity;
+        HWND* windows = HwndListWindows(buffer, length, &capacity);
+        if (windows != nullptr)
+        {
+            FILTER_HWND_LIST_HEADER* header = (FILTER_HWND_LIST_HEADER*)buffer;
+            CurrentBadWindows = header->BadWindows;
+            CurrentNumberOfBadWindows = header->NumberOfBadWindows;
+            FilterHwndList(windows, capacity, &header->Count);
+            CurrentBadWindows = nullptr;
+            CurrentNumberOfBadWindows = 0;
+        }
+        break;
+    }
+    default:
+    {
+        // What the SystemProcessInformation hook does
+        const PSYSTEM_PROCESS_INFORMATION list = (PSYSTEM_PROCESS_INFORMATION)(buffer + FILTER_PROCESS_LIST_HEADER);
+        if (length >= FILTER_PROCESS_LIST_HEADER && IsProcessListValid(list, length - FILTER_PROCESS_LIST_HEADER, sizeof(SYSTEM_THREAD_INFORMATION), 0))
+            FilterProcess(list, FilterTestHiddenPid);
+        break;
+    }
+    }
+    return adjust;
+}
+
+bool CheckFilter(const UCHAR* input, size_t size, FilterStats* stats, std::string* error)
+{
+    static const size_t GuardSize = 64;
+    static const UCHAR GuardByte = 0xA5;
+
+    *stats = FilterStats();
+    if (size == 0 || input[0] >= FilterKindCount)
+        return true;
+    const FilterKind kind = (FilterKind)input[0];
+    const size_t length = size - 1;
+    if (length > MAXULONG)
+        return true;
+
+    // The filters expect the pointer alignment NtQuerySystemInformation and NtQueryObject guarantee
+    std::vector<ULONGLONG> storage((length + GuardSize) / sizeof(ULONGLONG) + 1);
+    UCHAR* buffer = (UCHAR*)storage.data();
+    memcpy(buffer, input + 1, length);
+    memset(buffer + length, GuardByte, GuardSize);
+    if (kind == FilterKindProcessList)
+        RebaseProcessList(buffer, length, (ULONG_PTR)(buffer + FILTER_PROCESS_LIST_HEADER));
+    std::vector<UCHAR> expected(buffer, buffer + length);
+    expected.resize(length + 1); // So that the data pointer is valid for empty buffers
+
+    ULONG adjust, expectedAdjust = 0, expectedQueries = 0;
+    CurrentBuffer = buffer;
+    CurrentLength = length;
+    NameOutsideBuffer = false;
+    WindowQueries = 0;
+    adjust = RunFilter(kind, buffer, (ULONG)length);
+    CurrentBuffer = nullptr;
+
+    switch (kind)
+    {
+    case FilterKindHandleInfo:
+        ExpectHandleFilter<SYSTEM_HANDLE_INFORMATION, SYSTEM_HANDLE_TABLE_ENTRY_INFO>(expected.data(), length, &expectedAdjust, stats);
+        break;
+    case FilterKindHandleInfoEx:
+        ExpectHandleFilter<SYSTEM_HANDLE_INFORMATION_EX, SYSTEM_HANDLE_TABLE_ENTRY_INFO_EX>(expected.data(), length, &expectedAdjust, stats);
+        break;
+    case FilterKindObjectTypes:
+        ExpectObjectTypesFilter(expected.data(), length, stats);
+        break;
+    case FilterKindObjectType:
+        ExpectObjectTypeFilter(expected.data(), length, stats);
+        break;
+    case FilterKindHwndList:
+        ExpectHwndListFilter(expected.data(), length, stats, &expectedQueries);
+        break;
+    default:
+        ExpectProcessFilter(expected.data(), length, stats);
+        break;
+    }
+
+    char message[200];
+    for (size_t i = 0; i < GuardSize; ++i)
+    {
+        if (buffer[length + i] != GuardByte)
+        {
+            snprintf(message, sizeof(message), "kind %d, length %zu: wrote past the end of the buffer at +%zu", kind, length, i);
+            *error = message;
+            return false;
+        }
+    }
+    if (NameOutsideBuffer)
+    {
+        snprintf(message, sizeof(message), "kind %d, length %zu: read a type name outside the buffer", kind, length);
+        *error = message;
+        return false;
+    }
+    for (size_t i = 0; i < length; ++i)
+    {
+        if (buffer[i] != expected[i])
+        {
+            snprintf(message, sizeof(message), "kind %d, length %zu: byte %zu is %02X, expected %02X", kind, length, i, buffer[i], expected[i]);
+            *error = message;
+            return false;
+        }
+    }
+    if (WindowQueries != expectedQueries)
+    {
+        snprintf(message, sizeof(message), "kind %d, length %zu: IsWindowBad called %u times for %u windows", kind, length, WindowQueries, expectedQueries);
+        *error = message;
+        return false;
+    }
+    if (adjust != expectedAdjust)
+    {
+        snprintf(message, sizeof(message), "kind %d, length %zu: ReturnLength adjusted by %u, expected %u", kind, length, adjust, expectedAdjust);
+        *error = message;
+        return false;
+    }
+    return true;
+}
+
+void AppendObjectType(std::vector<UCHAR>& buffer, const wchar_t* name, UCHAR typeIndex, ULONG objects, ULONG handles)
+{
+    USHORT nameLength = 0; // No wcslen, WCHAR is not the wchar_t of the C library with -fshort-wchar
+    while (name[nameLength / sizeof(WCHAR)] != L'\0')
+        nameLength += sizeof(WCHAR);
+    OBJECT_TYPE_INFORMATION entry = OBJECT_TYPE_INFORMATION();
+    entry.TypeName.Length = nameLength;
+    entry.TypeName.MaximumLength = nameLength + sizeof(WCHAR);
+    entry.TypeName.Buffer = (PWSTR)(0x00000200000000ULL + buffer.size() + sizeof(entry)); // Where it was in the recording process
+    entry.TotalNumberOfObjects = objects;
+    entry.TotalNumberOfHandles = handles;
+    entry.HighWaterNumberOfObjects = objects * 2;
+    entry.HighWaterNumberOfHandles = handles * 2;
+    entry.ValidAccessMask = 0x1FFFFF;
+    entry.TypeIndex = typeIndex;
+
+    const size_t offset = buffer.size();
+    buffer.resize(offset + sizeof(entry) + ALIGN_UP(entry.TypeName.MaximumLength, ULONG_PTR));
+    memcpy(buffer.data() + offset, &entry, sizeof(entry));
+    memcpy(buffer.data() + offset + sizeof(entry), name, nameLength);
+}
+
+bool ReadFile(const std::string& path, std::vector<UCHAR>* data)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr)
+        return false;
+
+    data->clear();
+    UCHAR chunk[65536];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+        data->insert(data->end(), chunk, chunk + read);
+    fclose(file);
+    return true;
+}
+
+std::vector<CorpusFile> LoadCorpus(const std::string& directory)
+{
+    std::vector<CorpusFile> corpus;
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr)
+        return corpus;
+
+    while (const dirent* entry = readdir(dir))
+    {
+        CorpusFile file;
+        file.Name = entry->d_name;
+        if (file.Name[0] != '.' && ReadFile(directory + "/" + file.Name, &file.Data))
+            corpus.push_back(file);
+    }
+    closedir(dir);
+
+    std::sort(corpus.begin(), corpus.end(), [](const CorpusFile& a, const CorpusFile& b) { return a.Name < b.Name; });
+    return corpus;
+}
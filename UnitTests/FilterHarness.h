@@ -0,0 +1,83 @@
+#pragma once
+
+#include <ntdll/ntdll.h>
+#include <string>
+#include <vector>
+
+// Inputs of the buffer filter tests, fuzzer and benchmark are a FilterKind byte followed by the buffer exactly as
+// NtQuerySystemInformation, NtQueryObject or NtUserBuildHwndList returned it on x64 Windows. The corpus/ directory has
+// a file per input
+enum FilterKind : UCHAR
+{
+    FilterKindHandleInfo,       // SystemHandleInformation, FilterHandleInfo
+    FilterKindHandleInfoEx,     // SystemExtendedHandleInformation, FilterHandleInfoEx
+    FilterKindObjectTypes,      // ObjectTypesInformation, FilterObjects
+    FilterKindObjectType,       // ObjectTypeInformation, FilterObject
+    FilterKindProcessList,      // SystemProcessInformation, IsProcessListValid and FilterProcess
+    FilterKindHwndList,         // NtUserBuildHwndList, FilterHwndList
+    FilterKindCount
+};
+
+// The image names of a process list point into the buffer, so FilterKindProcessList inputs have the ULONGLONG address
+// the buffer was at between the FilterKind byte and the buffer. RebaseProcessList moves the names to a new address
+#define FILTER_PROCESS_LIST_HEADER sizeof(ULONGLONG)
+
+// Whether a window is bad depends on its class, title and process, which a window list does not have. So
+// FilterKindHwndList inputs start with the window count NtUserBuildHwndList returned, the number of bad windows and
+// that many window handles for the stubbed IsWindowBad to report. The window list follows, its size is cHwndMax
+struct FILTER_HWND_LIST_HEADER
+{
+    ULONG Count;
+    ULONG NumberOfBadWindows;
+    ULONGLONG BadWindows[1];
+};
+#define FILTER_HWND_LIST_HEADER_SIZE(NumberOfBadWindows) (offsetof(FILTER_HWND_LIST_HEADER, BadWindows) + (size_t)(NumberOfBadWindows) * sizeof(ULONGLONG))
+
+// What the stubbed HookHelper functions return
+const ULONG FilterTestProtectedPids[] = { 1234, 4242 };         // Sorted, like GetProtectedProcessIds
+const USHORT FilterTestBadObjectTypes[] = { 7, 8, 15 };         // Process, Thread and DebugObject on Windows 10
+const wchar_t* const FilterTestBadProcessNames[] = { L"x64dbg.exe", L"ida64.exe" }; // IsProcessNameBad, case insensitive
+const ULONG FilterTestHiddenPid = 4242;                         // The PID FilterProcess hides
+
+struct FilterStats
+{
+    ULONG Entries;          // Entries of the buffer the filter looked at
+    ULONG Hidden;           // Handles, processes or windows removed, or DebugObject entries whose counts were changed
+};
+
+// Runs the filter of the input on a copy of the buffer and checks that it only changed what it had to, and nothing
+// past the end of the buffer. Returns false with a description in error if not
+bool CheckFilter(const UCHAR* input, size_t size, FilterStats* stats, std::string* error);
+
+// Runs the filter of kind on buffer in place, for the benchmark. Returns the number of entries in the buffer
+ULONG RunFilter(FilterKind kind, UCHAR* buffer, ULONG length);
+
+// Rewrites the image names of a FilterKindProcessList input (without the FilterKind byte) of length bytes that point
+// into the list to point into the same place of a list at address, and stores address in the header
+void RebaseProcessList(UCHAR* input, size_t length, ULONG_PTR address);
+
+// A FilterKindHwndList input without the FilterKind byte
+std::vector<UCHAR> MakeHwndList(const std::vector<ULONGLONG>& windows, const std::vector<ULONGLONG>& badWindows, ULONG count);
+
+struct FilterTestProcess
+{
+    ULONG Pid;
+    const wchar_t* Name;
+    ULONG NumberOfThreads;
+};
+
+// A FilterKindProcessList input without the FilterKind byte: a SystemProcessInformation buffer at address, each entry
+// followed by its threads and image name
+std::vector<UCHAR> MakeProcessList(const std::vector<FilterTestProcess>& processes, ULONG_PTR address);
+
+// Appends an OBJECT_TYPE_INFORMATION entry and its name to an ObjectTypesInformation or ObjectTypeInformation buffer
+void AppendObjectType(std::vector<UCHAR>& buffer, const wchar_t* name, UCHAR typeIndex, ULONG objects, ULONG handles);
+
+struct CorpusFile
+{
+    std::string Name;
+    std::vector<UCHAR> Data;
+};
+
+std::vector<CorpusFile> LoadCorpus(const std::string& directory);
+bool ReadFile(const std::string& path, std::vector<UCHAR>* data);
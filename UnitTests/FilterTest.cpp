@@ -0,0 +1,80 @@
+#include "FilterHarness.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+// Checks the buffer filters on every corpus file, on every truncation of it, and on random mutations of it.
+// Truncations and mutations are what a too small buffer or a hostile process can make the filters see
+//
+//   FilterTest [corpus directory] [mutations] [seed]
+
+static int failures = 0;
+
+static void Check(const std::string& name, const std::vector<UCHAR>& input, FilterStats* stats)
+{
+    std::string error;
+    if (!CheckFilter(input.data(), input.size(), stats, &error))
+    {
+        if (failures < 25)
+            printf("FAIL %s: %s\n", name.c_str(), error.c_str());
+        ++failures;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const std::string directory = argc > 1 ? argv[1] : FILTER_CORPUS_DIR;
+    const long mutations = argc > 2 ? strtol(argv[2], nullptr, 0) : 200000;
+    const unsigned long seed = argc > 3 ? strtoul(argv[3], nullptr, 0) : 1;
+
+    const std::vector<CorpusFile> corpus = LoadCorpus(directory);
+    if (corpus.empty())
+    {
+        printf("FAIL: no corpus in %s\n", directory.c_str());
+        return 1;
+    }
+
+    ULONG hidden = 0;
+    for (const auto& file : corpus)
+    {
+        FilterStats stats;
+        Check(file.Name, file.Data, &stats);
+        printf("%s: %u entries, %u hidden\n", file.Name.c_str(), stats.Entries, stats.Hidden);
+        hidden += stats.Hidden;
+
+        for (size_t size = 1; size < file.Data.size(); ++size)
+            Check(file.Name + " (truncated)", std::vector<UCHAR>(file.Data.begin(), file.Data.begin() + size), &stats);
+    }
+
+    // The corpus must exercise hiding, or the checks above prove little
+    if (hidden == 0)
+    {
+        printf("FAIL: nothing in the corpus was hidden\n");
+        ++failures;
+    }
+
+    // Mutations favour the counts, lengths and indices at the start of the buffer and of entries
+    std::mt19937 rng(seed);
+    for (long i = 0; i < mutations; ++i)
+    {
+        const CorpusFile& file = corpus[rng() % corpus.size()];
+        std::vector<UCHAR> input = file.Data;
+        if (rng() % 2)
+            input.resize(1 + rng() % input.size());
+
+        const int numChanges = 1 + rng() % 8;
+        for (int change = 0; change < numChanges && input.size() > 1; ++change)
+        {
+            const size_t range = rng() % 4 == 0 ? MIN(input.size() - 1, (size_t)32) : input.size() - 1;
+            const size_t offset = 1 + rng() % range;
+            input[offset] = rng() % 3 == 0 ? 0xFF : (UCHAR)rng();
+        }
+
+        FilterStats stats;
+        Check(file.Name + " (mutated)", input, &stats);
+    }
+
+    printf("%zu corpus files, %ld mutations, %d failures\n", corpus.size(), mutations, failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,336 @@
+#include <ntdll/ntdll.h>
+#include "HandleShadow.h"
+
+#include <cstdio>
+#include <map>
+#include <random>
+#include <vector>
+
+// The handle shadow table of HookedNtClose, HookedNtDuplicateObject and HookedNtSetInformationObject on a fake
+// kernel handle table, against the hooks without a table: they query every handle before closing it. Handles are
+// created, closed and unprotected outside the hooks too, and handle values are reused like the kernel reuses them.
+// The shadowed hooks must never close an invalid or protected handle (both raise under a debugger), and must return
+// what the unshadowed hooks return unless a protected handle was made closable behind their back
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what, int line)
+{
+    if (!condition)
+    {
+        printf("FAIL line %d: %s\n", line, what);
+        ++failures;
+    }
+}
+#define CHECK(condition) Check(condition, #condition, __LINE__)
+
+// The handle table of a process: values are allocated lowest free first, so closed values come back quickly
+class FakeKernel
+{
+public:
+    explicit FakeKernel(ULONG firstHandle = 4) : firstHandle_(firstHandle) {}
+
+    HANDLE Create(bool protectFromClose)
+    {
+        ULONG value = firstHandle_;
+        while (handles_.count(value) != 0)
+            value += 4;
+        handles_[value] = protectFromClose;
+        return ULongToHandle(value);
+    }
+
+    bool IsValid(HANDLE handle) const { return handles_.count(HandleToULong(handle)) != 0; }
+    bool IsProtected(HANDLE handle) const { return IsValid(handle) && handles_.at(HandleToULong(handle)); }
+    size_t Count() const { return handles_.size(); }
+
+    std::vector<HANDLE> Handles() const
+    {
+        std::vector<HANDLE> handles;
+        for (const auto& entry : handles_)
+            handles.push_back(ULongToHandle(entry.first));
+        return handles;
+    }
+
+    NTSTATUS Query(HANDLE handle, BOOLEAN* protectFromClose)
+    {
+        Queries++;
+        if (!IsValid(handle))
+            return STATUS_INVALID_HANDLE;
+        *protectFromClose = handles_[HandleToULong(handle)];
+        return STATUS_SUCCESS;
+    }
+
+    // NtClose under a debugger: an invalid or protected handle raises an exception
+    NTSTATUS Close(HANDLE handle)
+    {
+        Closes++;
+        if (!IsValid(handle))
+        {
+            Exceptions++;
+            return STATUS_INVALID_HANDLE;
+        }
+        if (IsProtected(handle))
+        {
+            Exceptions++;
+            return STATUS_HANDLE_NOT_CLOSABLE;
+        }
+        handles_.erase(HandleToULong(handle));
+        return STATUS_SUCCESS;
+    }
+
+    NTSTATUS SetProtectFromClose(HANDLE handle, bool protectFromClose)
+    {
+        if (!IsValid(handle))
+            return STATUS_INVALID_HANDLE;
+        handles_[HandleToULong(handle)] = protectFromClose;
+        return STATUS_SUCCESS;
+    }
+
+    // NtDuplicateObject within the process. DUPLICATE_CLOSE_SOURCE closes the source like NtClose does
+    NTSTATUS Duplicate(HANDLE source, ULONG options, HANDLE* target)
+    {
+        if (!IsValid(source))
+            return STATUS_INVALID_HANDLE;
+        *target = Create((options & DUPLICATE_SAME_ATTRIBUTES) != 0 && IsProtected(source));
+        if (options & DUPLICATE_CLOSE_SOURCE)
+            Close(source);
+        return STATUS_SUCCESS;
+    }
+
+    static NTSTATUS QueryCallback(void* context, HANDLE handle, BOOLEAN* protectFromClose)
+    {
+        return ((FakeKernel*)context)->Query(handle, protectFromClose);
+    }
+
+    static NTSTATUS CloseCallback(void* context, HANDLE handle)
+    {
+        return ((FakeKernel*)context)->Close(handle);
+    }
+
+    int Queries = 0;
+    int Closes = 0;
+    int Exceptions = 0;
+
+private:
+    ULONG firstHandle_;
+    std::map<ULONG, bool> handles_;
+};
+
+// The three hooks as HookedFunctions.cpp has them, on a fake kernel
+class Hooks
+{
+public:
+    explicit Hooks(FakeKernel& kernel) : kernel_(kernel)
+    {
+        for (auto& entry : table_)
+            entry = 0;
+    }
+
+    NTSTATUS Close(HANDLE handle)
+    {
+        return HandleShadowClose(table_, handle, FakeKernel::QueryCallback, FakeKernel::CloseCallback, &kernel_);
+    }
+
+    NTSTATUS Duplicate(HANDLE source, ULONG options, HANDLE* target)
+    {
+        bool sourceProtected;
+        options = HandleShadowDuplicateOptions(table_, source, options, FakeKernel::QueryCallback, &kernel_, &sourceProtected);
+        const NTSTATUS status = kernel_.Duplicate(source, options, target);
+        if (NT_SUCCESS(status))
+            HandleShadowDuplicated(table_, *target, options, sourceProtected);
+        return status;
+    }
+
+    NTSTATUS SetProtectFromClose(HANDLE handle, bool protectFromClose)
+    {
+        HandleShadowSetProtected(table_, handle, false);
+        const NTSTATUS status = kernel_.SetProtectFromClose(handle, protectFromClose);
+        if (NT_SUCCESS(status))
+            HandleShadowSetProtected(table_, handle, protectFromClose);
+        return status;
+    }
+
+    bool IsRecorded(HANDLE handle) const { return HandleShadowIsProtected(table_, handle); }
+
+private:
+    FakeKernel& kernel_;
+    HANDLE_SHADOW_TABLE table_;
+};
+
+// What the hooks without a table return for NtClose: the query decides
+static NTSTATUS ReferenceClose(const FakeKernel& kernel, HANDLE handle)
+{
+    if (!kernel.IsValid(handle))
+        return STATUS_INVALID_HANDLE;
+    return kernel.IsProtected(handle) ? STATUS_HANDLE_NOT_CLOSABLE : STATUS_SUCCESS;
+}
+
+// A handle that was recorded as closable and then closed outside the hooks is invalid now, or reused
+static void TestClosedOutsideHooks()
+{
+    FakeKernel kernel;
+    Hooks hooks(kernel);
+
+    const HANDLE handle = kernel.Create(false);
+    CHECK(hooks.SetProtectFromClose(handle, false) == STATUS_SUCCESS);
+    CHECK(kernel.Close(handle) == STATUS_SUCCESS);
+    CHECK(hooks.Close(handle) == STATUS_INVALID_HANDLE);
+    CHECK(kernel.Exceptions == 0 && kernel.Closes == 1);
+
+    HANDLE duplicate;
+    const HANDLE source = kernel.Create(false);
+    CHECK(hooks.Duplicate(source, 0, &duplicate) == STATUS_SUCCESS);
+    CHECK(kernel.Close(duplicate) == STATUS_SUCCESS);
+    CHECK(hooks.Close(duplicate) == STATUS_INVALID_HANDLE);
+
+    // The value comes back as a protected handle created outside the hooks
+    const HANDLE reused = kernel.Create(true);
+    CHECK(reused == duplicate);
+    CHECK(hooks.Close(reused) == STATUS_HANDLE_NOT_CLOSABLE);
+    CHECK(kernel.Exceptions == 0);
+}
+
+// Protected handles are answered from the table, everything else costs a query
+static void TestSyscallCounts()
+{
+    FakeKernel kernel;
+    Hooks hooks(kernel);
+
+    const HANDLE locked = kernel.Create(false);
+    CHECK(hooks.SetProtectFromClose(locked, true) == STATUS_SUCCESS);
+    for (int i = 0; i < 100; ++i)
+        CHECK(hooks.Close(locked) == STATUS_HANDLE_NOT_CLOSABLE);
+    CHECK(kernel.Queries == 0 && kernel.Closes == 0);
+
+    // Protected outside the hooks: one query, then recorded
+    const HANDLE inherited = kernel.Create(true);
+    CHECK(hooks.Close(inherited) == STATUS_HANDLE_NOT_CLOSABLE);
+    CHECK(hooks.Close(inherited) == STATUS_HANDLE_NOT_CLOSABLE);
+    CHECK(kernel.Queries == 1 && hooks.IsRecorded(inherited));
+
+    // Unprotected through the hooks: the close goes through again
+    CHECK(hooks.SetProtectFromClose(locked, false) == STATUS_SUCCESS);
+    CHECK(!hooks.IsRecorded(locked));
+    CHECK(hooks.Close(locked) == STATUS_SUCCESS);
+    CHECK(kernel.Queries == 2 && kernel.Closes == 1 && !kernel.IsValid(locked));
+
+    // DUPLICATE_SAME_ATTRIBUTES copies the flag, DUPLICATE_CLOSE_SOURCE is dropped for a protected source
+    HANDLE copy;
+    CHECK(hooks.Duplicate(inherited, DUPLICATE_SAME_ATTRIBUTES | DUPLICATE_CLOSE_SOURCE, &copy) == STATUS_SUCCESS);
+    CHECK(kernel.IsValid(inherited) && kernel.IsProtected(copy) && hooks.IsRecorded(copy));
+    CHECK(kernel.Exceptions == 0);
+}
+
+// Values that are not multiples of 4, pseudo handles and values past the table are never recorded
+static void TestUnrecordedValues()
+{
+    FakeKernel kernel(0x10000);
+    Hooks hooks(kernel);
+
+    const HANDLE high = kernel.Create(true);
+    CHECK(hooks.Close(high) == STATUS_HANDLE_NOT_CLOSABLE);
+    CHECK(!hooks.IsRecorded(high) && kernel.Queries == 1);
+    CHECK(hooks.Close(high) == STATUS_HANDLE_NOT_CLOSABLE && kernel.Queries == 2);
+
+    CHECK(hooks.SetProtectFromClose((HANDLE)(LONG_PTR)-1, true) == STATUS_INVALID_HANDLE);
+    CHECK(!hooks.IsRecorded((HANDLE)(LONG_PTR)-1) && !hooks.IsRecorded((HANDLE)(LONG_PTR)-2) && !hooks.IsRecorded((HANDLE)6));
+    CHECK(hooks.Close((HANDLE)6) == STATUS_INVALID_HANDLE);
+    CHECK(kernel.Exceptions == 0);
+}
+
+// Random programs against the reference. With bypass set, protected handles are also made closable outside the hooks;
+// the hooks may then refuse to close a handle that is closable (or invalid), but still never raise
+static void TestRandomPrograms(bool bypass)
+{
+    std::mt19937 rng(bypass ? 2 : 1);
+    for (int program = 0; program < 500; ++program)
+    {
+        FakeKernel kernel;
+        Hooks hooks(kernel);
+        for (int step = 0; step < 400; ++step)
+        {
+            const std::vector<HANDLE> handles = kernel.Handles();
+            // Mostly live handles, sometimes a value that is closed or was never used
+            const HANDLE handle = !handles.empty() && rng() % 4 != 0 ? handles[rng() % handles.size()] : ULongToHandle(4 * (1 + rng() % 24));
+            const bool expectValid = kernel.IsValid(handle);
+            const bool expectProtected = kernel.IsProtected(handle);
+
+            switch (rng() % 8)
+            {
+            case 0:
+                if (kernel.Count() < 20)
+                    kernel.Create(rng() % 3 == 0);
+                break;
+            case 1:
+            case 2:
+            {
+                const NTSTATUS expected = ReferenceClose(kernel, handle);
+                const NTSTATUS status = hooks.Close(handle);
+                if (status != expected && !(bypass && status == STATUS_HANDLE_NOT_CLOSABLE))
+                {
+                    printf("FAIL program %d step %d: NtClose(%u) returned %08X, expected %08X\n", program, step, HandleToULong(handle), (ULONG)status, (ULONG)expected);
+                    ++failures;
+                }
+                if (NT_SUCCESS(status) && kernel.IsValid(handle))
+                {
+                    printf("FAIL program %d step %d: %u still open\n", program, step, HandleToULong(handle));
+                    ++failures;
+                }
+                break;
+            }
+            case 3:
+            {
+                const ULONG options = rng() % 4 == 0 ? 0 : (rng() % 2 ? DUPLICATE_CLOSE_SOURCE : 0) | (rng() % 2 ? DUPLICATE_SAME_ATTRIBUTES : 0);
+                HANDLE target = nullptr;
+                const NTSTATUS status = hooks.Duplicate(handle, options, &target);
+                if (NT_SUCCESS(status) != expectValid ||
+                    (NT_SUCCESS(status) && !bypass && (kernel.IsValid(handle) != (expectProtected || (options & DUPLICATE_CLOSE_SOURCE) == 0))))
+                {
+                    printf("FAIL program %d step %d: NtDuplicateObject(%u, %u) returned %08X\n", program, step, HandleToULong(handle), options, (ULONG)status);
+                    ++failures;
+                }
+                break;
+            }
+            case 4:
+                hooks.SetProtectFromClose(handle, rng() % 2 == 0);
+                break;
+            case 5:
+                // Closed outside the hooks, e.g. by a direct syscall or DUPLICATE_CLOSE_SOURCE from another process
+                if (expectValid && !expectProtected)
+                    kernel.Close(handle);
+                break;
+            case 6:
+                // Flags changed outside the hooks. Without bypass only protecting is, which the table never misses
+                if (bypass || rng() % 2 == 0)
+                    kernel.SetProtectFromClose(handle, bypass ? rng() % 2 == 0 : true);
+                break;
+            case 7:
+                if (!bypass && hooks.IsRecorded(handle) && !expectProtected)
+                {
+                    printf("FAIL program %d step %d: %u recorded as protected\n", program, step, HandleToULong(handle));
+                    ++failures;
+                }
+                break;
+            }
+
+            if (kernel.Exceptions != 0)
+            {
+                printf("FAIL program %d step %d: exception raised\n", program, step);
+                ++failures;
+                break;
+            }
+        }
+    }
+}
+
+int main()
+{
+    TestClosedOutsideHooks();
+    TestSyscallCounts();
+    TestUnrecordedValues();
+    TestRandomPrograms(false);
+    TestRandomPrograms(true);
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,675 @@
+#include <windows.h>
+#include <cstdio>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <Scylla/HookPlanCache.h>
+#include <Scylla/Win32kSyscalls.h>
+#include "HookPlan.h"
+#include "PeImage.h"
+
+// Builds ntdll, kernelbase, win32u and user32 DLL files with the function layouts of the Windows builds that
+// DetourCreateRemote knows, compiles their hook plans from the mapped files and checks every field of the entries.
+// The files are left in HOOK_PLAN_DLL_DIR for the HookPlanTool test
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what, int line)
+{
+    if (!condition)
+    {
+        printf("FAIL line %d: %s\n", line, what);
+        ++failures;
+    }
+}
+#define CHECK(condition) Check(condition, #condition, __LINE__)
+
+static const DWORD TextRva = 0x1000;
+static const DWORD SectionAlignment = 0x1000;
+static const DWORD FileAlignment = 0x200;
+static const DWORD SizeOfHeaders = 0x400;
+
+static DWORD Align(DWORD value, DWORD alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static void AppendImm32(std::vector<BYTE>& code, ULONG value)
+{
+    for (int shift = 0; shift < 32; shift += 8)
+        code.push_back((BYTE)(value >> shift));
+}
+
+#define IMM32(value) (BYTE)(value), (BYTE)((value) >> 8), (BYTE)((value) >> 16), (BYTE)((value) >> 24)
+
+// A DLL with a code section, exports and (x64) unwind data, written the way the linker lays out a file: the sections
+// are FileAlignment aligned in the file and SectionAlignment aligned in memory
+struct TestDll
+{
+    struct Export
+    {
+        std::string Name;
+        DWORD Rva;
+        std::string Forwarder;
+    };
+
+    bool X64;
+    DWORD TimeDateStamp = 0x5A5A0001;
+    std::vector<BYTE> Text;
+    std::vector<Export> Exports;
+    std::vector<std::pair<DWORD, DWORD>> Functions; // Begin and end RVAs for .pdata
+
+    explicit TestDll(bool x64) : X64(x64) {}
+
+    // Appends a function after fill bytes up to alignment and returns its RVA. name can be nullptr for a function
+    // that is not exported
+    DWORD Add(const char* name, const std::vector<BYTE>& code, DWORD alignment = 1, BYTE fill = 0xCC)
+    {
+        while (Text.size() % alignment != 0)
+            Text.push_back(fill);
+        const DWORD rva = TextRva + (DWORD)Text.size();
+        Text.insert(Text.end(), code.begin(), code.end());
+        if (name != nullptr)
+            Exports.push_back({ name, rva, std::string() });
+        Functions.push_back({ rva, rva + (DWORD)code.size() });
+        return rva;
+    }
+
+    void AddForwarder(const char* name, const char* forwarder)
+    {
+        Exports.push_back({ name, 0, forwarder });
+    }
+
+    std::vector<BYTE> Build() const
+    {
+        std::vector<Export> sorted = Exports;
+        std::sort(sorted.begin(), sorted.end(), [](const Export& a, const Export& b) { return a.Name < b.Name; });
+
+        // .rdata: export directory, its tables and strings, then the unwind data
+        const DWORD rdataRva = TextRva + Align((DWORD)Text.size(), SectionAlignment);
+        const DWORD count = (DWORD)sorted.size();
+        const DWORD functionsRva = rdataRva + sizeof(IMAGE_EXPORT_DIRECTORY);
+        const DWORD namesRva = functionsRva + count * sizeof(DWORD);
+        const DWORD ordinalsRva = namesRva + count * sizeof(DWORD);
+        std::vector<BYTE> rdata(ordinalsRva + count * sizeof(WORD) - rdataRva);
+
+        const auto appendString = [&rdata, rdataRva](const std::string& text)
+        {
+            const DWORD rva = rdataRva + (DWORD)rdata.size();
+            rdata.insert(rdata.end(), text.begin(), text.end());
+            rdata.push_back(0);
+            return rva;
+        };
+
+        IMAGE_EXPORT_DIRECTORY exports = {};
+        exports.Name = appendString(X64 ? "test64.dll" : "test32.dll");
+        exports.Base = 1;
+        exports.NumberOfFunctions = count;
+        exports.NumberOfNames = count;
+        exports.AddressOfFunctions = functionsRva;
+        exports.AddressOfNames = namesRva;
+        exports.AddressOfNameOrdinals = ordinalsRva;
+        for (DWORD i = 0; i < count; i++)
+        {
+            const DWORD nameRva = appendString(sorted[i].Name);
+            const DWORD functionRva = sorted[i].Forwarder.empty() ? sorted[i].Rva : appendString(sorted[i].Forwarder);
+            const WORD ordinal = (WORD)i;
+            memcpy(&rdata[functionsRva - rdataRva + i * sizeof(DWORD)], &functionRva, sizeof(DWORD));
+            memcpy(&rdata[namesRva - rdataRva + i * sizeof(DWORD)], &nameRva, sizeof(DWORD));
+            memcpy(&rdata[ordinalsRva - rdataRva + i * sizeof(WORD)], &ordinal, sizeof(WORD));
+        }
+        memcpy(rdata.data(), &exports, sizeof(exports));
+        const DWORD exportSize = (DWORD)rdata.size();
+
+        while (rdata.size() % sizeof(DWORD) != 0)
+            rdata.push_back(0);
+        const DWORD pdataRva = rdataRva + (DWORD)rdata.size();
+        if (X64)
+        {
+            for (const auto& function : Functions)
+            {
+                AppendImm32(rdata, function.first);
+                AppendImm32(rdata, function.second);
+                AppendImm32(rdata, 0); // UnwindData, not read
+            }
+        }
+        const DWORD pdataSize = X64 ? (DWORD)Functions.size() * 3 * sizeof(DWORD) : 0;
+
+        const DWORD textRaw = Align((DWORD)Text.size(), FileAlignment);
+        const DWORD rdataRaw = Align((DWORD)rdata.size(), FileAlignment);
+        const DWORD sizeOfImage = rdataRva + Align((DWORD)rdata.size(), SectionAlignment);
+        std::vector<BYTE> file(SizeOfHeaders + textRaw + rdataRaw);
+
+        IMAGE_DOS_HEADER dos = {};
+        dos.e_magic = IMAGE_DOS_SIGNATURE;
+        dos.e_lfanew = 0x80;
+        memcpy(file.data(), &dos, sizeof(dos));
+
+        IMAGE_FILE_HEADER fileHeader = {};
+        fileHeader.Machine = X64 ? IMAGE_FILE_MACHINE_AMD64 : IMAGE_FILE_MACHINE_I386;
+        fileHeader.NumberOfSections = 2;
+        fileHeader.TimeDateStamp = TimeDateStamp;
+        fileHeader.Characteristics = 0x2102; // Executable, 32 bit machine, DLL
+        IMAGE_DATA_DIRECTORY* directories;
+        size_t ntSize;
+        IMAGE_NT_HEADERS64 nt64 = {};
+        IMAGE_NT_HEADERS32 nt32 = {};
+        if (X64)
+        {
+            nt64.Signature = IMAGE_NT_SIGNATURE;
+            nt64.FileHeader = fileHeader;
+            nt64.FileHeader.SizeOfOptionalHeader = sizeof(IMAGE_OPTIONAL_HEADER64);
+            nt64.OptionalHeader.Magic = IMAGE_NT_OPTIONAL_HDR64_MAGIC;
+            nt64.OptionalHeader.ImageBase = 0x180000000ULL;
+            nt64.OptionalHeader.SectionAlignment = SectionAlignment;
+            nt64.OptionalHeader.FileAlignment = FileAlignment;
+            nt64.OptionalHeader.SizeOfImage = sizeOfImage;
+            nt64.OptionalHeader.SizeOfHeaders = SizeOfHeaders;
+            nt64.OptionalHeader.NumberOfRvaAndSizes = IMAGE_NUMBEROF_DIRECTORY_ENTRIES;
+            directories = nt64.OptionalHeader.DataDirectory;
+            ntSize = sizeof(nt64);
+        }
+        else
+        {
+            nt32.Signature = IMAGE_NT_SIGNATURE;
+            nt32.FileHeader = fileHeader;
+            nt32.FileHeader.SizeOfOptionalHeader = sizeof(IMAGE_OPTIONAL_HEADER32);
+            nt32.OptionalHeader.Magic = IMAGE_NT_OPTIONAL_HDR32_MAGIC;
+            nt32.OptionalHeader.ImageBase = 0x4B200000;
+            nt32.OptionalHeader.SectionAlignment = SectionAlignment;
+            nt32.OptionalHeader.FileAlignment = FileAlignment;
+            nt32.OptionalHeader.SizeOfImage = sizeOfImage;
+            nt32.OptionalHeader.SizeOfHeaders = SizeOfHeaders;
+            nt32.OptionalHeader.NumberOfRvaAndSizes = IMAGE_NUMBEROF_DIRECTORY_ENTRIES;
+            directories = nt32.OptionalHeader.DataDirectory;
+            ntSize = sizeof(nt32);
+        }
+        directories[IMAGE_DIRECTORY_ENTRY_EXPORT] = { rdataRva, exportSize };
+        directories[IMAGE_DIRECTORY_ENTRY_EXCEPTION] = { X64 ? pdataRva : 0, pdataSize };
+        memcpy(file.data() + dos.e_lfanew, X64 ? (const void*)&nt64 : (const void*)&nt32, ntSize);
+
+        IMAGE_SECTION_HEADER sections[2] = {};
+        memcpy(sections[0].Name, ".text", 5);
+        sections[0].Misc.VirtualSize = (DWORD)Text.size();
+        sections[0].VirtualAddress = TextRva;
+        sections[0].SizeOfRawData = textRaw;
+        sections[0].PointerToRawData = SizeOfHeaders;
+        sections[0].Characteristics = IMAGE_SCN_CNT_CODE | IMAGE_SCN_MEM_EXECUTE | IMAGE_SCN_MEM_READ;
+        memcpy(sections[1].Name, ".rdata", 6);
+        sections[1].Misc.VirtualSize = (DWORD)rdata.size();
+        sections[1].VirtualAddress = rdataRva;
+        sections[1].SizeOfRawData = rdataRaw;
+        sections[1].PointerToRawData = SizeOfHeaders + textRaw;
+        sections[1].Characteristics = IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ;
+        memcpy(file.data() + dos.e_lfanew + ntSize, sections, sizeof(sections));
+
+        memcpy(file.data() + SizeOfHeaders, Text.data(), Text.size());
+        memcpy(file.data() + SizeOfHeaders + textRaw, rdata.data(), rdata.size());
+        return file;
+    }
+};
+
+// Writes the DLL to HOOK_PLAN_DLL_DIR and maps it back from the file
+static bool WriteAndLoad(const TestDll& dll, const char* fileName, PeImage& pe)
+{
+    const std::vector<BYTE> bytes = dll.Build();
+    const std::string path = std::string(HOOK_PLAN_DLL_DIR) + "/" + fileName;
+    FILE* file = fopen(path.c_str(), "wb");
+    const bool written = file != nullptr && fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    if (file != nullptr)
+        fclose(file);
+    if (!written || !pe.Load(path.c_str()))
+    {
+        printf("FAIL cannot write %s\n", path.c_str());
+        ++failures;
+        return false;
+    }
+    return true;
+}
+
+static std::vector<HookPlanRequest> Requests(std::initializer_list<const char*> names)
+{
+    std::vector<HookPlanRequest> requests;
+    for (const char* name : names)
+        requests.push_back({ name, 0, false });
+    return requests;
+}
+
+// Windows 10 x64: mov r10, rcx / mov eax, num / test byte ptr [7FFE0308h], 1 / jnz / syscall / retn / int 2Eh / retn
+static std::vector<BYTE> StubX64(ULONG syscallNum)
+{
+    return { 0x4C, 0x8B, 0xD1, 0xB8, IMM32(syscallNum),
+        0xF6, 0x04, 0x25, 0x08, 0x03, 0xFE, 0x7F, 0x01, 0x75, 0x03, 0x0F, 0x05, 0xC3, 0xCD, 0x2E, 0xC3 };
+}
+
+// Windows 10 Wow64: mov eax, num / mov edx, Wow64SystemServiceCall / call edx / retn 10h
+static std::vector<BYTE> StubWow64Win10(ULONG syscallNum)
+{
+    return { 0xB8, IMM32(syscallNum), 0xBA, 0x40, 0x12, 0x30, 0x4B, 0xFF, 0xD2, 0xC2, 0x10, 0x00 };
+}
+
+// Windows 7 Wow64: mov eax, num / mov ecx, ecxValue / lea edx, [esp+4] / call fs:0C0h / add esp, 4 / retn 14h
+static std::vector<BYTE> StubWow64Win7(ULONG syscallNum, ULONG ecxValue)
+{
+    return { 0xB8, IMM32(syscallNum), 0xB9, IMM32(ecxValue),
+        0x8D, 0x54, 0x24, 0x04, 0x64, 0xFF, 0x15, 0xC0, 0x00, 0x00, 0x00, 0x83, 0xC4, 0x04, 0xC2, 0x14, 0x00 };
+}
+
+static bool SameEntry(const HookPlanEntry& a, const HookPlanEntry& b)
+{
+    return a.Name == b.Name && a.Rva == b.Rva && a.DetourLen == b.DetourLen && a.DetourLenAbsolute == b.DetourLenAbsolute &&
+        a.HotPatch.Type == b.HotPatch.Type && a.HotPatch.PaddingSize == b.HotPatch.PaddingSize &&
+        a.HotPatch.EntrySize == b.HotPatch.EntrySize && a.SyscallIndex == b.SyscallIndex && a.EcxValue == b.EcxValue &&
+        a.FunctionSize == b.FunctionSize && a.CallOffset == b.CallOffset && a.CallSize == b.CallSize && a.Code == b.Code;
+}
+
+static void CheckRoundTrip(const HookPlan& plan)
+{
+    HookPlan parsed;
+    CHECK(ParseHookPlan(FormatHookPlan(plan), parsed));
+    CHECK(parsed.SettingsMask == plan.SettingsMask);
+    CHECK(parsed.X64 == plan.X64);
+    CHECK(parsed.Entries.size() == plan.Entries.size());
+    for (size_t i = 0; i < parsed.Entries.size() && i < plan.Entries.size(); i++)
+        CHECK(SameEntry(parsed.Entries[i], plan.Entries[i]));
+}
+
+static const char* const NtdllStubs[] =
+{
+    "NtSetInformationThread", "NtQuerySystemInformation", "NtQueryInformationProcess", "NtSetInformationProcess",
+    "NtQueryObject", "NtYieldExecution", "NtGetContextThread", "NtSetContextThread", "NtContinue", "NtClose",
+    "NtDuplicateObject", "NtSetInformationObject", "NtSetDebugFilterState", "NtCreateThread", "NtCreateThreadEx",
+    "NtQueryPerformanceCounter", "NtResumeThread", "NtOpenFile", "NtCreateSection", "NtMapViewOfSection",
+};
+
+static void TestNtdllX64()
+{
+    TestDll dll(true);
+
+    // mov rax, [7FFE0014h] / mov [rcx], rax / xor eax, eax / retn
+    const DWORD rtlQuerySystemTime = dll.Add("RtlQuerySystemTime",
+        { 0x48, 0x8B, 0x04, 0x25, 0x14, 0x00, 0xFE, 0x7F, 0x48, 0x89, 0x01, 0x33, 0xC0, 0xC3 });
+
+    std::vector<DWORD> stubRvas;
+    for (ULONG i = 0; i < _countof(NtdllStubs); i++)
+    {
+        const char* name = NtdllStubs[i];
+        if (strcmp(name, "NtCreateThread") == 0)
+        {
+            stubRvas.push_back(dll.Add(nullptr, StubX64(i))); // Not exported
+            continue;
+        }
+        if (strcmp(name, "NtSetDebugFilterState") == 0)
+        {
+            dll.AddForwarder(name, "ntoskrnl.NtSetDebugFilterState");
+            stubRvas.push_back(0);
+            continue;
+        }
+        // NtClose directly behind the retn of the stub in front, without padding to hot patch
+        const bool packed = strcmp(name, "NtClose") == 0;
+        stubRvas.push_back(dll.Add(name, StubX64(i), packed ? 1 : 32));
+    }
+
+    // jmp RtlQuerySystemTime
+    const DWORD ntQuerySystemTime = TextRva + Align((DWORD)dll.Text.size(), 16);
+    const DWORD rel = rtlQuerySystemTime - (ntQuerySystemTime + 5);
+    CHECK(dll.Add("NtQuerySystemTime", { 0xE9, IMM32(rel) }, 16) == ntQuerySystemTime);
+    dll.Add("NtQueryPerformanceFrequency", { 0x33, 0xC0, 0xC3 }, 16);
+
+    PeImage pe;
+    if (!WriteAndLoad(dll, "ntdll_x64.dll", pe))
+        return;
+
+    std::vector<HookPlanRequest> requests;
+    for (const char* name : NtdllStubs)
+        requests.push_back({ name, 0, false });
+    requests.push_back({ "NtQuerySystemTime", 0, true });
+
+    HookPlan plan;
+    CHECK(CompileHookPlan(pe.Mapped.data(), pe.Mapped.size(), requests, plan));
+    CHECK(plan.X64);
+    CHECK(plan.SettingsMask == GetHookPlanMask(requests));
+    CHECK(plan.Entries.size() == requests.size() - 2);
+    CHECK(FindHookPlanEntry(plan, "NtCreateThread") == nullptr);
+    CHECK(FindHookPlanEntry(plan, "NtSetDebugFilterState") == nullptr);
+    CHECK(FindExportRva(pe.Mapped.data(), pe.Mapped.size(), "NtSetDebugFilterState") == 0);
+    CHECK(FindExportRva(pe.Mapped.data(), pe.Mapped.size(), "NtCreateThread") == 0);
+    CHECK(FindExportRva(pe.Mapped.data(), pe.Mapped.size(), "NtQuerySystemTime") == ntQuerySystemTime);
+
+    for (ULONG i = 0; i < _countof(NtdllStubs); i++)
+    {
+        const HookPlanEntry* entry = FindHookPlanEntry(plan, NtdllStubs[i]);
+        if (stubRvas[i] == 0 || entry == nullptr)
+            continue;
+        CHECK(entry->Rva == stubRvas[i]);
+        CHECK(entry->DetourLen == 8);               // mov r10, rcx / mov eax, num
+        CHECK(entry->DetourLenAbsolute == 16);      // and the test
+        CHECK(entry->SyscallIndex == (LONG)i);
+        CHECK(entry->EcxValue == 0 && entry->FunctionSize == 0 && entry->CallOffset == 0 && entry->CallSize == 0);
+        CHECK(entry->Code.size() == 16);
+        CHECK(memcmp(entry->Code.data(), pe.AtRva(entry->Rva, 16), 16) == 0);
+
+        // Every function in front ends with a retn, the int 3 up to the alignment of the stub is the padding
+        DWORD precedingEnd = 0;
+        for (const auto& function : dll.Functions)
+        {
+            if (function.second <= entry->Rva)
+                precedingEnd = std::max(precedingEnd, function.second);
+        }
+        const DWORD padding = entry->Rva - precedingEnd;
+        if (padding < 5)
+            CHECK(entry->HotPatch.Type == HotPatchNone && entry->HotPatch.PaddingSize == 0 && entry->HotPatch.EntrySize == 0);
+        else
+            CHECK(entry->HotPatch.Type == HotPatchPadding && entry->HotPatch.PaddingSize == padding && entry->HotPatch.EntrySize == 3);
+        if (strcmp(NtdllStubs[i], "NtClose") == 0)
+            CHECK(padding == 0);
+        if (strcmp(NtdllStubs[i], "NtQueryObject") == 0)
+            CHECK(padding == 8);
+    }
+
+    // The jmp is followed to RtlQuerySystemTime, which is hooked instead
+    const HookPlanEntry* time = FindHookPlanEntry(plan, "NtQuerySystemTime");
+    CHECK(time != nullptr);
+    if (time != nullptr)
+    {
+        CHECK(time->Rva == rtlQuerySystemTime);
+        CHECK(time->DetourLen == 8);
+        CHECK(time->DetourLenAbsolute == 15);   // Into the padding behind the retn
+        CHECK(time->SyscallIndex == -1);
+        CHECK(time->HotPatch.Type == HotPatchNone);
+    }
+
+    CheckRoundTrip(plan);
+    CHECK(CheckHookPlan(plan, pe.Mapped.data(), pe.Mapped.size()));
+
+    // A hooked or patched function no longer matches its plan
+    std::vector<BYTE> patched = pe.Mapped;
+    patched[stubRvas[4] + 1] ^= 0xFF;
+    CHECK(!CheckHookPlan(plan, patched.data(), patched.size()));
+    const HookPlanEntry* queryObject = FindHookPlanEntry(plan, "NtQueryObject");
+    CHECK(queryObject != nullptr && !MatchHookPlanEntry(*queryObject, patched.data() + stubRvas[4], 60));
+    CHECK(queryObject != nullptr && MatchHookPlanEntry(*queryObject, pe.AtRva(stubRvas[4], 60), 60));
+    CHECK(queryObject != nullptr && !MatchHookPlanEntry(*queryObject, pe.AtRva(stubRvas[4], 60), 8));
+
+    // Nor an image of the other bitness or one that is too small
+    plan.X64 = false;
+    CHECK(!CheckHookPlan(plan, pe.Mapped.data(), pe.Mapped.size()));
+    plan.X64 = true;
+    CHECK(!CheckHookPlan(plan, pe.Mapped.data(), stubRvas.back()));
+
+    // The header hash the cache section is named after ignores the base the image was loaded at, and nothing else
+    const ULONGLONG hash = scl::HookPlanCache::HashImageHeaders(pe.File.data(), pe.File.size());
+    CHECK(hash != 0);
+    std::vector<BYTE> headers(pe.File.begin(), pe.File.begin() + SizeOfHeaders);
+    const size_t imageBase = 0x80 + offsetof(IMAGE_NT_HEADERS64, OptionalHeader.ImageBase);
+    headers[imageBase + 5] ^= 0x7F;
+    CHECK(scl::HookPlanCache::HashImageHeaders(headers.data(), headers.size()) == hash);
+    headers[0x80 + offsetof(IMAGE_NT_HEADERS64, FileHeader.TimeDateStamp)] ^= 1;
+    CHECK(scl::HookPlanCache::HashImageHeaders(headers.data(), headers.size()) != hash);
+    CHECK(scl::HookPlanCache::HashImageHeaders(headers.data(), SizeOfHeaders - 1) == 0);
+}
+
+static void TestNtdllWow64()
+{
+    TestDll dll(false);
+
+    // cld / mov ecx, [esp+4] / mov ebx, [esp] / push ecx / push ebx / call RtlDispatchException
+    const DWORD dispatcher = dll.Add("KiUserExceptionDispatcher",
+        { 0xFC, 0x8B, 0x4C, 0x24, 0x04, 0x8B, 0x1C, 0x24, 0x51, 0x53, 0xE8, 0x00, 0x00, 0x00, 0x00, 0xC3 });
+
+    // The first half in the layout of Windows 10, the second half in the one of Windows 7
+    const ULONG half = _countof(NtdllStubs) / 2;
+    std::vector<DWORD> stubRvas;
+    for (ULONG i = 0; i < _countof(NtdllStubs); i++)
+    {
+        const std::vector<BYTE> stub = i < half ? StubWow64Win10(i) : StubWow64Win7(i, i % 3 == 0 ? 0 : 0x10 + i);
+        stubRvas.push_back(dll.Add(NtdllStubs[i], stub, 16, 0x90));
+    }
+    const DWORD queryTime = dll.Add("NtQuerySystemTime", StubWow64Win10(0x5A), 16, 0x90);
+
+    PeImage pe;
+    if (!WriteAndLoad(dll, "ntdll_x86.dll", pe))
+        return;
+
+    std::vector<HookPlanRequest> requests;
+    for (const char* name : NtdllStubs)
+        requests.push_back({ name, 0, false });
+    requests.push_back({ "KiUserExceptionDispatcher", 0, false });
+    requests.push_back({ "NtQuerySystemTime", 0, false });
+
+    HookPlan plan;
+    CHECK(CompileHookPlan(pe.Mapped.data(), pe.Mapped.size(), requests, plan));
+    CHECK(!plan.X64);
+    CHECK(plan.Entries.size() == requests.size());
+
+    for (ULONG i = 0; i < _countof(NtdllStubs); i++)
+    {
+        const HookPlanEntry* entry = FindHookPlanEntry(plan, NtdllStubs[i]);
+        CHECK(entry != nullptr);
+        if (entry == nullptr)
+            continue;
+        CHECK(entry->Rva == stubRvas[i]);
+        CHECK(entry->DetourLen == 5 && entry->DetourLenAbsolute == 5);
+        CHECK(entry->SyscallIndex == (LONG)i);
+        CHECK(entry->HotPatch.Type == HotPatchNone);
+        if (i < half)
+        {
+            CHECK(entry->EcxValue == 0);
+            CHECK(entry->FunctionSize == 15);
+            CHECK(entry->CallOffset == 10 && entry->CallSize == 2);
+        }
+        else
+        {
+            CHECK(entry->EcxValue == (i % 3 == 0 ? 0 : 0x10 + i));
+            CHECK(entry->FunctionSize == 27);
+            CHECK(entry->CallOffset == 14 && entry->CallSize == 7);
+        }
+        CHECK(entry->Code.size() == entry->FunctionSize);
+    }
+
+    const HookPlanEntry* entry = FindHookPlanEntry(plan, "KiUserExceptionDispatcher");
+    CHECK(entry != nullptr && entry->Rva == dispatcher && entry->SyscallIndex == -1 && entry->DetourLen == 5 && entry->FunctionSize == 0);
+    entry = FindHookPlanEntry(plan, "NtQuerySystemTime");
+    CHECK(entry != nullptr && entry->Rva == queryTime && entry->SyscallIndex == 0x5A);
+
+    CheckRoundTrip(plan);
+    CHECK(CheckHookPlan(plan, pe.Mapped.data(), pe.Mapped.size()));
+}
+
+static void TestKernelbase()
+{
+    TestDll dll(false);
+    dll.Add(nullptr, { 0x33, 0xC0, 0xC3 });
+
+    // /hotpatch: 5 bytes of int 3 or nop padding and mov edi, edi / push ebp / mov ebp, esp
+    const std::vector<BYTE> hotpatch = { 0x8B, 0xFF, 0x55, 0x8B, 0xEC, 0x8B, 0x45, 0x08, 0x5D, 0xC2, 0x04, 0x00 };
+    dll.Text.resize(dll.Text.size() + 5, 0xCC);
+    const DWORD getTickCount = dll.Add("GetTickCount", hotpatch);
+    dll.Text.resize(dll.Text.size() + 5, 0x90);
+    const DWORD getTickCount64 = dll.Add("GetTickCount64", hotpatch);
+    const DWORD getLocalTime = dll.Add("GetLocalTime", hotpatch); // Directly behind the retn
+    dll.AddForwarder("GetSystemTime", "api-ms-win-core-sysinfo-l1-2-0.GetSystemTime");
+    // push ebp / mov ebp, esp / sub esp, 10h
+    const DWORD outputDebugString = dll.Add("OutputDebugStringA", { 0x55, 0x8B, 0xEC, 0x83, 0xEC, 0x10, 0xC9, 0xC3 }, 16);
+
+    PeImage pe;
+    if (!WriteAndLoad(dll, "kernelbase_x86.dll", pe))
+        return;
+
+    const auto requests = Requests({ "GetTickCount", "GetTickCount64", "GetLocalTime", "GetSystemTime", "OutputDebugStringA" });
+    HookPlan plan;
+    CHECK(CompileHookPlan(pe.Mapped.data(), pe.Mapped.size(), requests, plan));
+    CHECK(plan.Entries.size() == 4);
+    CHECK(FindHookPlanEntry(plan, "GetSystemTime") == nullptr);
+
+    const HookPlanEntry* entry = FindHookPlanEntry(plan, "GetTickCount");
+    CHECK(entry != nullptr && entry->Rva == getTickCount && entry->DetourLen == 5 && entry->SyscallIndex == -1);
+    CHECK(entry != nullptr && entry->HotPatch.Type == HotPatchMovEdiEdi && entry->HotPatch.PaddingSize == 5 && entry->HotPatch.EntrySize == 2);
+    entry = FindHookPlanEntry(plan, "GetTickCount64");
+    CHECK(entry != nullptr && entry->Rva == getTickCount64 && entry->HotPatch.Type == HotPatchMovEdiEdi);
+    entry = FindHookPlanEntry(plan, "GetLocalTime");
+    CHECK(entry != nullptr && entry->Rva == getLocalTime && entry->HotPatch.Type == HotPatchNone);
+    entry = FindHookPlanEntry(plan, "OutputDebugStringA");
+    CHECK(entry != nullptr && entry->Rva == outputDebugString && entry->DetourLen == 6 && entry->Code.size() == 6);
+
+    CheckRoundTrip(plan);
+
+    // Functions of another DLL are refused, the mask only has bits for the hooked ones
+    CHECK(!CompileHookPlan(pe.Mapped.data(), pe.Mapped.size(), Requests({ "GetTickCount", "Sleep" }), plan));
+    CHECK(GetHookPlanMask(Requests({ "GetTickCount", "Sleep" })) == GetHookPlanMask(Requests({ "GetTickCount" })));
+    CHECK(!CompileHookPlan(pe.File.data(), 0x40, requests, plan));
+}
+
+static LONG GetWin32kSyscallIndex(const char* name, USHORT build, bool nativeX86)
+{
+    for (const auto& syscall : Win32kSyscalls)
+    {
+        if (strcmp(syscall.Name.Buffer, name) == 0)
+            return syscall.GetSyscallIndex(build, nativeX86);
+    }
+    return -1;
+}
+
+static const char* const UserStubs[] =
+{
+    "NtUserBlockInput", "NtUserFindWindowEx", "NtUserBuildHwndList", "NtUserQueryWindow", "NtUserGetForegroundWindow",
+};
+
+static void TestWin32u()
+{
+    TestDll dll(true);
+    std::vector<DWORD> stubRvas;
+    for (ULONG i = 0; i < _countof(UserStubs); i++)
+    {
+        dll.Add("NtUserGetDC", StubX64(0x1000 + 2 * i), 16);
+        stubRvas.push_back(dll.Add(UserStubs[i], StubX64(0x1001 + 2 * i), 32));
+    }
+
+    PeImage pe;
+    if (!WriteAndLoad(dll, "win32u_x64.dll", pe))
+        return;
+
+    // ApplyUserHook plans the stubs at the addresses User32Loader found, here the exports
+    std::vector<HookPlanRequest> requests;
+    for (const char* name : UserStubs)
+        requests.push_back({ name, FindExportRva(pe.Mapped.data(), pe.Mapped.size(), name), false });
+
+    HookPlan plan;
+    CHECK(CompileHookPlan(pe.Mapped.data(), pe.Mapped.size(), requests, plan));
+    CHECK(plan.Entries.size() == _countof(UserStubs));
+    for (ULONG i = 0; i < _countof(UserStubs); i++)
+    {
+        const HookPlanEntry* entry = FindHookPlanEntry(plan, UserStubs[i]);
+        CHECK(entry != nullptr && entry->Rva == stubRvas[i] && entry->SyscallIndex == (LONG)(0x1001 + 2 * i));
+        CHECK(entry != nullptr && entry->HotPatch.Type == HotPatchPadding);
+    }
+    CheckRoundTrip(plan);
+
+    // The user hooks have their own bits, a plan for ntdll and one for win32u never share a key
+    CHECK((GetHookPlanMask(requests) & GetHookPlanMask(Requests({ "NtClose", "NtContinue" }))) == 0);
+    CHECK(GetHookPlanKey(GetHookPlanMask(Requests({ "NtSetInformationThread", "NtQueryObject" }))) == "Plan_11");
+}
+
+static void TestUser32()
+{
+    // Windows 7 SP1 user32 in a Wow64 process, the stubs are not exported and are found by their syscall index.
+    // BlockInput is the export of the NtUserBlockInput stub
+    const USHORT build = 7601;
+    TestDll dll(false);
+    dll.Add("GetMessageW", { 0x8B, 0xFF, 0x55, 0x8B, 0xEC, 0x5D, 0xC2, 0x10, 0x00 });
+    std::vector<DWORD> stubRvas;
+    for (const char* name : UserStubs)
+    {
+        const LONG index = GetWin32kSyscallIndex(name, build, false);
+        CHECK(index != -1);
+        // A mov eax with the same index that is not a stub
+        dll.Add(nullptr, { 0xB8, IMM32((ULONG)index), 0x5D, 0xC3 }, 4, 0x90);
+        stubRvas.push_back(dll.Add(strcmp(name, "NtUserBlockInput") == 0 ? "BlockInput" : nullptr,
+            StubWow64Win7((ULONG)index, 0), 16, 0x90));
+    }
+
+    PeImage pe;
+    if (!WriteAndLoad(dll, "user32_x86.dll", pe))
+        return;
+
+    std::vector<HookPlanRequest> requests;
+    for (size_t i = 0; i < _countof(UserStubs); i++)
+        requests.push_back({ UserStubs[i], stubRvas[i], false });
+
+    HookPlan plan;
+    CHECK(CompileHookPlan(pe.Mapped.data(), pe.Mapped.size(), requests, plan));
+    CHECK(plan.Entries.size() == _countof(UserStubs));
+    for (size_t i = 0; i < _countof(UserStubs); i++)
+    {
+        const HookPlanEntry* entry = FindHookPlanEntry(plan, UserStubs[i]);
+        CHECK(entry != nullptr && entry->Rva == stubRvas[i]);
+        CHECK(entry != nullptr && entry->SyscallIndex == GetWin32kSyscallIndex(UserStubs[i], build, false));
+        CHECK(entry != nullptr && entry->FunctionSize == 27 && entry->CallOffset == 14 && entry->CallSize == 7);
+    }
+    CHECK(FindExportRva(pe.Mapped.data(), pe.Mapped.size(), "BlockInput") == stubRvas[0]);
+    CHECK(FindExportRva(pe.Mapped.data(), pe.Mapped.size(), "NtUserBlockInput") == 0);
+    CheckRoundTrip(plan);
+}
+
+// Plans read back from scylla_hide_hooks.ini are used to copy code, anything that does not add up is refused
+static void TestParse()
+{
+    const std::string entry = "NtClose,1A40,8,10,2,8,3,F,0,0,0,0,4C8BD1B80F000000F604250803FE7F01";
+    HookPlan plan;
+    CHECK(ParseHookPlan("1;400;1;" + entry, plan));
+    CHECK(plan.SettingsMask == 0x400 && plan.X64 && plan.Entries.size() == 1);
+    CHECK(plan.Entries.size() == 1 && plan.Entries[0].Rva == 0x1A40 && plan.Entries[0].SyscallIndex == 0xF && plan.Entries[0].Code.size() == 16);
+    CHECK(ParseHookPlan("1;400;1", plan) && plan.Entries.empty());
+    CHECK(ParseHookPlan("1;FFFFFFFFFFFFFFFF;0", plan) && plan.SettingsMask == ~0ULL);
+
+    const char* const bad[] =
+    {
+        "",
+        "1;400",
+        "2;400;1;NtClose,1A40,8,10,2,8,3,F,0,0,0,0,4C8BD1B80F000000F604250803FE7F01",  // Version
+        "1;400;2;NtClose,1A40,8,10,2,8,3,F,0,0,0,0,4C8BD1B80F000000F604250803FE7F01",  // Bitness
+        "1;1;1;NtClose,1A40,8,10,2,8,3,F,0,0,0,0,4C8BD1B80F000000F604250803FE7F01",    // Not in the mask
+        "1;400;1;NtClose,1A40,8,10,2,8,3,F,0,0,0,0,4C8BD1B80F000000F604250803FE7F01;NtClose,1A40,8,10,2,8,3,F,0,0,0,0,4C8BD1B80F000000F604250803FE7F01",
+        "1;400;1;NtClose,1A40,8,10,2,8,3,F,0,0,0,0",                                    // Fields
+        "1;400;1;NtClose,1A40,8,10,2,8,3,F,0,0,0,0,4C8BD1B80F000000F604250803FE7F0",   // Odd code
+        "1;400;1;NtClose,1A40,8,10,2,8,3,F,0,0,0,0,4C8BD1B80F000000F604250803FE7FXX",  // Not hex
+        "1;400;1;NtClose,1A40,11,10,2,8,3,F,0,0,0,0,4C8BD1B80F000000F604250803FE7F01", // Past the code
+        "1;400;1;NtClose,1A40,8,11,2,8,3,F,0,0,0,0,4C8BD1B80F000000F604250803FE7F01",
+        "1;400;1;NtClose,1A40,8,10,2,8,11,F,0,0,0,0,4C8BD1B80F000000F604250803FE7F01",
+        "1;400;1;NtClose,1A40,4,10,2,8,3,F,0,0,0,0,4C8BD1B80F000000F604250803FE7F01",  // Shorter than the jmp
+        "1;400;1;NtClose,1A40,8,E,2,8,3,F,0,0,0,0,4C8BD1B80F000000F604250803FE7F01",   // Shorter than the x64 jmp
+        "1;400;1;NtClose,1A40,8,10,1,8,3,F,0,0,0,0,4C8BD1B80F000000F604250803FE7F01",  // mov edi, edi on x64
+        "1;400;1;NtClose,1A40,8,10,2,4,3,F,0,0,0,0,4C8BD1B80F000000F604250803FE7F01",  // Padding too small
+        "1;400;1;NtClose,1A40,8,10,0,8,3,F,0,0,0,0,4C8BD1B80F000000F604250803FE7F01",  // Padding without a hot patch
+        "1;400;1;NtClose,1A40,8,10,3,8,3,F,0,0,0,0,4C8BD1B80F000000F604250803FE7F01",  // Type
+        "1;400;1;NtClose,1A40,8,10,2,8,3,F,0,11,0,0,4C8BD1B80F000000F604250803FE7F01", // Function past the code
+        "1;400;1;NtClose,1A40,8,10,2,8,3,F,0,10,C,5,4C8BD1B80F000000F604250803FE7F01", // Call past the function
+        "1;400;1;NtClose,1A40,8,10,2,8,3,F,0,0,1,0,4C8BD1B80F000000F604250803FE7F01",  // Call without a function
+        "1;400;1;NtClose,100000000,8,10,2,8,3,F,0,0,0,0,4C8BD1B80F000000F604250803FE7F01",
+        "1;400;1;Sleep,1A40,8,10,2,8,3,F,0,0,0,0,4C8BD1B80F000000F604250803FE7F01",
+    };
+    for (const char* text : bad)
+    {
+        if (ParseHookPlan(text, plan))
+        {
+            printf("FAIL parsed %s\n", text);
+            ++failures;
+        }
+    }
+}
+
+int main()
+{
+    mkdir(HOOK_PLAN_DLL_DIR, 0755);
+
+    TestNtdllX64();
+    TestNtdllWow64();
+    TestKernelbase();
+    TestWin32u();
+    TestUser32();
+    TestParse();
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
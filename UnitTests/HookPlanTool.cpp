@@ -0,0 +1,356 @@
+#include <windows.h>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <Scylla/HookPlanCache.h>
+#include <Scylla/SyscallStubScanner.h>
+#include <Scylla/Win32kSyscalls.h>
+#include "HookPlan.h"
+#include "PeImage.h"
+extern "C" {
+#include "distorm.h"
+#include "mnemonics.h"
+}
+
+// Compiles the hook plans of ApplyNtdllHook, ApplyKernel32Hook and ApplyUserHook from DLL files, e.g. copied from a
+// Windows installation, checks them against distorm and prints them the way they are kept in scylla_hide_hooks.ini.
+//
+//   HookPlanTool [--build <OS build>] [--native-x86] <dll>...
+//
+// The DLL is recognized by its file name: ntdll, kernel32/kernelbase, win32u or user32. All hooks of the DLL are
+// planned. win32u stubs are its exports, which are checked against FindSyscallStubs on the code section with the
+// syscall indices read from the stubs, like User32Loader does. user32 (before 10.0.14393) does not export most stubs,
+// they are found with FindSyscallStubs and the Win32kSyscalls indices of --build, and NtUserBlockInput has to be the
+// BlockInput export. --native-x86 selects the stubs of 32 bit Windows instead of Wow64 for x86 DLLs.
+// Exits with 1 if a DLL can not be read or a plan does not check out
+
+static const char* const NtdllHooks[] =
+{
+    "NtSetInformationThread", "NtQuerySystemInformation", "NtQueryInformationProcess", "NtSetInformationProcess",
+    "NtQueryObject", "NtYieldExecution", "NtGetContextThread", "NtSetContextThread", "NtClose", "NtDuplicateObject",
+    "NtSetInformationObject", "NtCreateThread", "NtCreateThreadEx", "NtSetDebugFilterState", "NtContinue",
+    "NtQueryPerformanceCounter", "NtResumeThread", "NtOpenFile", "NtCreateSection", "NtMapViewOfSection",
+};
+
+static const char* const KernelHooks[] =
+{
+    "GetTickCount", "GetTickCount64", "GetLocalTime", "GetSystemTime", "OutputDebugStringA",
+};
+
+static const char* const UserHooks[] =
+{
+    "NtUserBlockInput", "NtUserFindWindowEx", "NtUserBuildHwndList", "NtUserQueryWindow", "NtUserGetForegroundWindow",
+};
+
+// What DetourCreateRemote reads of a function and the jmps it writes, as in HookPlan.cpp
+static const int codeWindow = 60;
+static const int relativeJumpLen = 5;
+static const int absoluteJumpLenX64 = 15;
+
+static int problems = 0;
+
+static void Problem(const char* name, const char* what)
+{
+    printf("; FAIL %s: %s\n", name, what);
+    ++problems;
+}
+
+static std::vector<_DInst> Decompose(const BYTE* code, int codeLen, bool x64)
+{
+    _CodeInfo ci = {};
+    ci.code = code;
+    ci.codeLen = codeLen;
+    ci.dt = x64 ? Decode64Bits : Decode32Bits;
+    std::vector<_DInst> insns(codeLen);
+    unsigned int count = 0;
+    distorm_decompose(&ci, insns.data(), (unsigned int)insns.size(), &count);
+    insns.resize(count);
+    return insns;
+}
+
+// Whole instructions covering at least minSize bytes according to distorm, -1 if one of them does not decode
+static int DistormDetourLen(const std::vector<_DInst>& insns, int minSize)
+{
+    int totalLen = 0;
+    for (const auto& insn : insns)
+    {
+        if (totalLen >= minSize)
+            break;
+        if (insn.flags == FLAG_NOT_DECODABLE)
+            return -1;
+        totalLen += insn.size;
+    }
+    return totalLen >= minSize ? totalLen : -1;
+}
+
+static const _DInst* FindInstructionAt(const std::vector<_DInst>& insns, int offset)
+{
+    for (const auto& insn : insns)
+    {
+        if ((int)insn.addr == offset && insn.flags != FLAG_NOT_DECODABLE)
+            return &insn;
+    }
+    return nullptr;
+}
+
+// Everything the plan says about the function, recomputed from the image with distorm where the compiler used the
+// length decoder
+static void CheckEntry(const PeImage& pe, const HookPlanEntry& entry)
+{
+    const char* name = entry.Name.c_str();
+    const bool x64 = pe.Is64;
+    const int codeLen = entry.Rva + codeWindow <= pe.Mapped.size() ? codeWindow : (int)(pe.Mapped.size() - entry.Rva);
+    const BYTE* code = pe.AtRva(entry.Rva, codeLen);
+    if (code == nullptr || entry.Code.size() > (size_t)codeLen || !MatchHookPlanEntry(entry, code, codeLen))
+    {
+        Problem(name, "planned bytes are not the image's");
+        return;
+    }
+
+    const std::vector<_DInst> insns = Decompose(code, codeLen, x64);
+    if (DistormDetourLen(insns, relativeJumpLen) != entry.DetourLen)
+        Problem(name, "DetourLen does not end on an instruction");
+    if (DistormDetourLen(insns, x64 ? absoluteJumpLenX64 : relativeJumpLen) != entry.DetourLenAbsolute)
+        Problem(name, "DetourLenAbsolute does not end on an instruction");
+
+    // The trampoline has to be buildable somewhere else
+    BYTE trampoline[256];
+    const ULONG_PTR address = (ULONG_PTR)pe.ImageBase + entry.Rva;
+    if (RelocateCode(code, codeLen, entry.DetourLenAbsolute, address, address + 0x10000, trampoline, sizeof(trampoline), x64) < 0)
+        Problem(name, "stolen bytes can not be relocated");
+
+    if (entry.HotPatch.Type != HotPatchNone)
+    {
+        const BYTE* padding = pe.AtRva(entry.Rva - entry.HotPatch.PaddingSize, entry.HotPatch.PaddingSize);
+        bool filled = padding != nullptr && entry.Rva >= entry.HotPatch.PaddingSize && entry.HotPatch.PaddingSize >= relativeJumpLen;
+        for (int i = 0; filled && i < entry.HotPatch.PaddingSize; i++)
+            filled = padding[i] == 0xCC || (!x64 && padding[i] == padding[0] && padding[0] == 0x90);
+        if (!filled)
+            Problem(name, "hot patch padding is not int 3 or nop");
+        if (insns.empty() || insns[0].flags == FLAG_NOT_DECODABLE || insns[0].size != entry.HotPatch.EntrySize)
+            Problem(name, "hot patch entry is not the first instruction");
+        if (!x64 && (code[0] != 0x8B || code[1] != 0xFF))
+            Problem(name, "hot patch entry is not mov edi, edi");
+    }
+
+    if (entry.SyscallIndex != -1)
+    {
+        const _DInst* mov = FindInstructionAt(insns, x64 ? 3 : 0);
+        if (mov == nullptr || mov->opcode != I_MOV || mov->ops[0].type != O_REG || mov->ops[0].index != R_EAX ||
+            mov->imm.dword != (DWORD)entry.SyscallIndex)
+            Problem(name, "SyscallIndex is not the mov eax of the stub");
+    }
+
+    if (entry.FunctionSize != 0)
+    {
+        const _DInst* call = FindInstructionAt(insns, entry.CallOffset);
+        if (call == nullptr || (call->opcode != I_CALL && call->opcode != I_CALL_FAR) || call->size != entry.CallSize)
+            Problem(name, "CallOffset is not the call of the stub");
+        bool ret = false;
+        for (const auto& insn : insns)
+            ret |= insn.flags != FLAG_NOT_DECODABLE && insn.opcode == I_RET && (int)(insn.addr + insn.size) == entry.FunctionSize;
+        if (!ret)
+            Problem(name, "FunctionSize does not end with the ret of the stub");
+    }
+}
+
+static const IMAGE_SECTION_HEADER* FindCodeSection(const PeImage& pe)
+{
+    for (const auto& section : pe.Sections)
+    {
+        if ((section.Characteristics & IMAGE_SCN_CNT_CODE) != 0)
+            return &section;
+    }
+    return pe.Sections.empty() ? nullptr : &pe.Sections[0];
+}
+
+static LONG GetWin32kSyscallIndex(const char* name, USHORT build, bool nativeX86)
+{
+    for (const auto& syscall : Win32kSyscalls)
+    {
+        if (strcmp(syscall.Name.Buffer, name) == 0)
+            return syscall.GetSyscallIndex(build, nativeX86);
+    }
+    return -1;
+}
+
+// The syscall index in a win32u stub, as User32Loader::GetUserSyscallIndex reads it
+static LONG ReadStubSyscallIndex(const PeImage& pe, DWORD rva)
+{
+    const BYTE* stub = pe.AtRva(rva, 16 + sizeof(LONG));
+    for (int i = 0; stub != nullptr && i < 16; i++)
+    {
+        if (stub[i] == 0xB8 && stub[i + 1] != 0xD1)
+            return (LONG)(stub[i + 1] | (stub[i + 2] << 8));
+    }
+    return -1;
+}
+
+// RVAs of the user hooks, from the exports of win32u or the stubs in user32. 0 for those that are not found
+static std::vector<DWORD> FindUserStubs(const PeImage& pe, bool win32u, USHORT build, bool nativeX86, const char* file)
+{
+    std::vector<DWORD> rvas(_countof(UserHooks), 0);
+    const IMAGE_SECTION_HEADER* codeSection = FindCodeSection(pe);
+    const BYTE* code = codeSection != nullptr ? pe.AtRva(codeSection->VirtualAddress, codeSection->SizeOfRawData) : nullptr;
+    if (code == nullptr)
+    {
+        Problem(file, "no code section");
+        return rvas;
+    }
+
+    std::vector<LONG> indices;
+    std::unordered_map<LONG, SIZE_T> indicesAndOffsets;
+    for (size_t i = 0; i < _countof(UserHooks); i++)
+    {
+        const DWORD exportRva = win32u ? FindExportRva(pe.Mapped.data(), pe.Mapped.size(), UserHooks[i]) : 0;
+        const LONG index = win32u ? (exportRva != 0 ? ReadStubSyscallIndex(pe, exportRva) : -1) : GetWin32kSyscallIndex(UserHooks[i], build, nativeX86);
+        indices.push_back(index);
+        if (index == -1)
+            Problem(UserHooks[i], win32u ? "not exported or not a stub" : "no syscall index for this build");
+        else
+            indicesAndOffsets[index] = scl::StubNotFound;
+        rvas[i] = exportRva;
+    }
+
+    const scl::SyscallStubType stubType = pe.Is64 ? scl::SyscallStubType::X64 : (nativeX86 ? scl::SyscallStubType::NativeX86 : scl::SyscallStubType::Wow64);
+    const size_t found = scl::FindSyscallStubs(code, codeSection->SizeOfRawData, stubType, indicesAndOffsets);
+    printf("; FindSyscallStubs found %u of %u stubs in %u bytes of code\n", (ULONG)found, (ULONG)indicesAndOffsets.size(), (ULONG)codeSection->SizeOfRawData);
+
+    for (size_t i = 0; i < _countof(UserHooks); i++)
+    {
+        if (indices[i] == -1)
+            continue;
+        const SIZE_T offset = indicesAndOffsets[indices[i]];
+        const DWORD scanned = offset != scl::StubNotFound ? codeSection->VirtualAddress + (DWORD)offset : 0;
+        if (scanned == 0)
+            Problem(UserHooks[i], "FindSyscallStubs did not find the stub");
+        else if (win32u && scanned != rvas[i])
+            Problem(UserHooks[i], "FindSyscallStubs found another stub than the export");
+        if (!win32u)
+            rvas[i] = scanned;
+    }
+
+    // User32Loader's check of the scan
+    if (!win32u && rvas[0] != FindExportRva(pe.Mapped.data(), pe.Mapped.size(), "BlockInput"))
+        Problem("NtUserBlockInput", "is not the BlockInput export");
+    return rvas;
+}
+
+static std::string ToLower(std::string text)
+{
+    for (auto& c : text)
+        c = (char)tolower((unsigned char)c);
+    return text;
+}
+
+static void CheckDll(const char* path, USHORT build, bool nativeX86)
+{
+    std::string fileName = path;
+    fileName = fileName.substr(fileName.find_last_of("/\\") + 1);
+    const std::string lowerName = ToLower(fileName);
+
+    PeImage pe;
+    if (!pe.Load(path))
+    {
+        Problem(path, "not a PE file");
+        return;
+    }
+
+    // The section HookPlanCache keeps the values of this build of the DLL in
+    IMAGE_DOS_HEADER dos;
+    IMAGE_FILE_HEADER fileHeader;
+    memcpy(&dos, pe.File.data(), sizeof(dos));
+    memcpy(&fileHeader, pe.File.data() + dos.e_lfanew + sizeof(DWORD), sizeof(fileHeader));
+    printf("[%s_%04X_%016llX]\n", fileName.c_str(), fileHeader.Machine,
+        (unsigned long long)scl::HookPlanCache::HashImageHeaders(pe.File.data(), pe.File.size()));
+
+    const bool win32u = lowerName.find("win32u") != std::string::npos;
+    std::vector<HookPlanRequest> requests;
+    if (lowerName.find("ntdll") != std::string::npos)
+    {
+        // Like ApplyNtdllHook: KiUserExceptionDispatcher is patched by hand on x64, and NtQuerySystemTime is a jmp there
+        for (const char* name : NtdllHooks)
+            requests.push_back({ name, 0, false });
+        if (!pe.Is64)
+            requests.push_back({ "KiUserExceptionDispatcher", 0, false });
+        requests.push_back({ "NtQuerySystemTime", 0, pe.Is64 });
+    }
+    else if (lowerName.find("kernel") != std::string::npos)
+    {
+        for (const char* name : KernelHooks)
+            requests.push_back({ name, 0, false });
+    }
+    else if (win32u || lowerName.find("user32") != std::string::npos)
+    {
+        if (!win32u && build == 0)
+        {
+            Problem(path, "user32 needs --build");
+            return;
+        }
+        const std::vector<DWORD> rvas = FindUserStubs(pe, win32u, build, nativeX86, path);
+        for (size_t i = 0; i < _countof(UserHooks); i++)
+        {
+            if (rvas[i] != 0)
+                requests.push_back({ UserHooks[i], rvas[i], false });
+        }
+    }
+    else
+    {
+        Problem(path, "not ntdll, kernel32, kernelbase, win32u or user32");
+        return;
+    }
+
+    HookPlan plan;
+    if (!CompileHookPlan(pe.Mapped.data(), pe.Mapped.size(), requests, plan))
+    {
+        Problem(path, "CompileHookPlan failed");
+        return;
+    }
+
+    for (const auto& request : requests)
+    {
+        if (FindHookPlanEntry(plan, request.Name) == nullptr)
+            printf("; %s is not planned, it is analysed on every injection\n", request.Name);
+    }
+    for (const auto& entry : plan.Entries)
+        CheckEntry(pe, entry);
+
+    const std::string text = FormatHookPlan(plan);
+    HookPlan parsed;
+    if (!ParseHookPlan(text, parsed) || FormatHookPlan(parsed) != text)
+        Problem(path, "plan does not survive the ini");
+    if (!CheckHookPlan(parsed, pe.Mapped.data(), pe.Mapped.size()))
+        Problem(path, "CheckHookPlan rejects the plan");
+
+    printf("%s=%s\n\n", GetHookPlanKey(plan.SettingsMask).c_str(), text.c_str());
+}
+
+int main(int argc, char** argv)
+{
+    USHORT build = 0;
+    bool nativeX86 = false;
+    int numDlls = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--build" && i + 1 < argc)
+            build = (USHORT)strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--native-x86")
+            nativeX86 = true;
+        else
+        {
+            CheckDll(argv[i], build, nativeX86);
+            ++numDlls;
+        }
+    }
+
+    if (numDlls == 0)
+    {
+        printf("Usage: HookPlanTool [--build <OS build>] [--native-x86] <dll>...\n");
+        return 1;
+    }
+    return problems == 0 ? 0 : 1;
+}
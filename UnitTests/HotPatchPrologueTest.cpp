@@ -0,0 +1,221 @@
+#include <windows.h>
+#include <cstdio>
+#include <vector>
+#include "CodeLibraries.h"
+#include "CodeRelocation.h"
+#include "LengthDisasm.h"
+
+extern "C"
+{
+#include "distorm.h"
+#include "mnemonics.h"
+}
+
+// ClassifyHotPatchPrologue on crafted prologues, and on the functions of the MSVC static libraries of the IDA SDK laid
+// out the way the linker does: each code section aligned to its alignment, with int 3 in the gaps. Every entry is
+// compared with a model on top of distorm, which decodes the function in front linearly up to the entry and accepts
+// the int 3 behind its last instruction if that is a ret or an unconditional jmp. On x86 only mov edi, edi with 5
+// bytes of padding is accepted, and none of the library functions start with it, so none of the alignment gaps in
+// front of them may be taken for hot patch padding
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what, int line)
+{
+    if (!condition)
+    {
+        printf("FAIL line %d: %s\n", line, what);
+        ++failures;
+    }
+}
+#define CHECK(condition) Check(condition, #condition, __LINE__)
+
+struct Prologue
+{
+    const char* Name;
+    bool X64;
+    std::vector<BYTE> Preceding;    // The function in front (x64) or the bytes in front (x86)
+    std::vector<BYTE> Entry;
+    int JumpSize;
+    HotPatchType Expected;
+    int PaddingSize;
+};
+
+static void TestPrologues()
+{
+    const BYTE int3 = 0xCC;
+    const std::vector<BYTE> subRsp = { 0x48, 0x83, 0xEC, 0x28 };
+    const std::vector<BYTE> movRbx = { 0x48, 0x89, 0x5C, 0x24, 0x08 };
+    const Prologue prologues[] =
+    {
+        { "x86 mov edi, edi after int 3", false, { int3, int3, int3, int3, int3 }, { 0x8B, 0xFF, 0x55, 0x8B, 0xEC }, 5, HotPatchMovEdiEdi, 5 },
+        { "x86 mov edi, edi after nop", false, { 0x90, 0x90, 0x90, 0x90, 0x90 }, { 0x8B, 0xFF, 0x55 }, 5, HotPatchMovEdiEdi, 5 },
+        { "x86 mov edi, edi, short jmp of 2", false, { 0xC3, int3, int3, int3, int3, int3 }, { 0x8B, 0xFF }, 2, HotPatchMovEdiEdi, 5 },
+        { "x86 mixed padding", false, { int3, int3, 0x90, int3, int3 }, { 0x8B, 0xFF, 0x55 }, 5, HotPatchNone, 0 },
+        { "x86 4 bytes of padding", false, { 0xC3, int3, int3, int3, int3 }, { 0x8B, 0xFF, 0x55 }, 5, HotPatchNone, 0 },
+        { "x86 padding not readable", false, {}, { 0x8B, 0xFF, 0x55 }, 5, HotPatchNone, 0 },
+        { "x86 jmp larger than the padding", false, { int3, int3, int3, int3, int3 }, { 0x8B, 0xFF, 0x55 }, 6, HotPatchNone, 0 },
+        { "x86 push ebp after alignment", false, { 0xC3, int3, int3, int3, int3, int3, int3, int3 }, { 0x55, 0x8B, 0xEC }, 5, HotPatchNone, 0 },
+        { "x86 mov edi, esi", false, { int3, int3, int3, int3, int3 }, { 0x8B, 0xFE, 0x55 }, 5, HotPatchNone, 0 },
+
+        { "x64 ret, 6 int 3", true, { 0x33, 0xC0, 0xC3, int3, int3, int3, int3, int3, int3 }, movRbx, 5, HotPatchPadding, 6 },
+        { "x64 ret, 6 int 3, absolute jmp", true, { 0x33, 0xC0, 0xC3, int3, int3, int3, int3, int3, int3 }, movRbx, 14, HotPatchNone, 0 },
+        { "x64 ret, 14 int 3", true, { 0xC3, int3, int3, int3, int3, int3, int3, int3, int3, int3, int3, int3, int3, int3, int3 }, subRsp, 14, HotPatchPadding, 14 },
+        { "x64 ret, nop padding", true, { 0xC3, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90 }, subRsp, 5, HotPatchNone, 0 },
+        { "x64 call, int 3", true, { 0xE8, 0x00, 0x10, 0x00, 0x00, int3, int3, int3, int3, int3, int3 }, subRsp, 5, HotPatchNone, 0 },
+        { "x64 int 3 in an immediate", true, { 0x48, 0xB8, 0x11, 0x22, 0xC3, int3, int3, int3, int3, int3 }, subRsp, 5, HotPatchNone, 0 },
+        { "x64 jmp ending in int 3", true, { 0xE9, 0x00, 0x10, int3, int3, int3, int3, int3, int3 }, subRsp, 4, HotPatchPadding, 4 },
+        { "x64 jmp ending in int 3, jmp of 5", true, { 0xE9, 0x00, 0x10, int3, int3, int3, int3, int3, int3 }, subRsp, 5, HotPatchNone, 0 },
+        { "x64 jmp [rip]", true, { 0xFF, 0x25, 0x10, 0x00, 0x00, 0x00, int3, int3, int3, int3, int3, int3 }, subRsp, 5, HotPatchPadding, 6 },
+        { "x64 call [rip]", true, { 0xFF, 0x15, 0x10, 0x00, 0x00, 0x00, int3, int3, int3, int3, int3, int3 }, subRsp, 5, HotPatchNone, 0 },
+        { "x64 ret 8", true, { 0xC2, 0x08, 0x00, int3, int3, int3, int3, int3 }, subRsp, 5, HotPatchPadding, 5 },
+        { "x64 jmp short", true, { 0xEB, 0xFE, int3, int3, int3, int3, int3 }, subRsp, 5, HotPatchPadding, 5 },
+        { "x64 int 3 inside the function", true, { 0x85, 0xC9, 0x74, 0x01, int3, 0xC3, int3, int3, int3, int3, int3 }, subRsp, 5, HotPatchPadding, 5 },
+        { "x64 1 byte entry", true, { 0xC3, int3, int3, int3, int3, int3, int3 }, { 0x53, 0x48, 0x83, 0xEC, 0x20 }, 5, HotPatchNone, 0 },
+        { "x64 no function in front", true, {}, subRsp, 5, HotPatchNone, 0 },
+        { "x64 only int 3 in front", true, { int3, int3, int3, int3, int3, int3 }, subRsp, 5, HotPatchNone, 0 },
+    };
+
+    for (const Prologue& prologue : prologues)
+    {
+        std::vector<BYTE> code = prologue.Preceding;
+        code.insert(code.end(), prologue.Entry.begin(), prologue.Entry.end());
+        const int precedingLen = (int)prologue.Preceding.size();
+
+        HOT_PATCH_PROLOGUE info = { 0xFF, 0xFF, 0xFF };
+        const HotPatchType type = ClassifyHotPatchPrologue(code.data() + precedingLen, precedingLen, (int)prologue.Entry.size(), prologue.X64, prologue.JumpSize, &info);
+        if (type != prologue.Expected || (type != HotPatchNone && info.PaddingSize != prologue.PaddingSize))
+        {
+            printf("FAIL %s: type %d padding %d, expected type %d padding %d\n", prologue.Name, type, type != HotPatchNone ? info.PaddingSize : 0,
+                prologue.Expected, prologue.PaddingSize);
+            ++failures;
+        }
+        if (type != HotPatchNone)
+            CHECK(info.Type == type && info.EntrySize == LdeDecode(prologue.Entry.data(), (int)prologue.Entry.size(), prologue.X64, nullptr));
+    }
+}
+
+// The model: the type and padding the classifier must return for the entry at code[entry], with the function in front
+// starting at code[start]
+static HotPatchType ExpectedType(const std::vector<BYTE>& code, size_t start, size_t entry, bool x64, int jumpSize, int& padding)
+{
+    _DInst entryInsn = {};
+    unsigned int count = 0;
+    _CodeInfo ci = {};
+    ci.code = code.data() + entry;
+    ci.codeLen = (int)(code.size() - entry);
+    ci.dt = x64 ? Decode64Bits : Decode32Bits;
+    if (distorm_decompose(&ci, &entryInsn, 1, &count) == DECRES_INPUTERR || count == 0 || entryInsn.flags == FLAG_NOT_DECODABLE ||
+        entryInsn.size < 2 || LdeDecode(ci.code, ci.codeLen, x64, nullptr) < 1)
+        return HotPatchNone;
+
+    if (!x64)
+    {
+        padding = 5;
+        if (entry - start < 5 || code[entry] != 0x8B || code[entry + 1] != 0xFF || jumpSize > 5)
+            return HotPatchNone;
+        for (size_t i = entry - 5; i < entry; ++i)
+        {
+            if (code[i] != code[entry - 1] || (code[i] != 0xCC && code[i] != 0x90))
+                return HotPatchNone;
+        }
+        return HotPatchMovEdiEdi;
+    }
+
+    // The end of the last instruction in front that is not an int 3
+    size_t offset = start;
+    size_t end = start;
+    bool exits = false;
+    while (offset < entry)
+    {
+        _DInst insn = {};
+        ci.code = code.data() + offset;
+        ci.codeLen = (int)(entry - offset);
+        if (distorm_decompose(&ci, &insn, 1, &count) == DECRES_INPUTERR || count == 0 || insn.flags == FLAG_NOT_DECODABLE)
+            return HotPatchNone;
+        offset += insn.size;
+        if (insn.opcode != I_INT_3)
+        {
+            end = offset;
+            exits = META_GET_FC(insn.meta) == FC_RET || META_GET_FC(insn.meta) == FC_UNC_BRANCH;
+        }
+    }
+
+    padding = (int)(entry - end);
+    if (offset != entry || !exits || padding < jumpSize)
+        return HotPatchNone;
+    if (padding > 0x7F)
+        padding = 0x7F;
+    return HotPatchPadding;
+}
+
+static void TestLibraries()
+{
+    size_t numEntries[2] = {};
+    size_t numAccepted[2] = {};
+    size_t numAlignedX86 = 0;
+
+    for (const char* path : CodeLibraries)
+    {
+        std::vector<CodeSection> sections;
+        if (!ReadLibraryCode(path, sections))
+        {
+            printf("FAIL could not read %s\n", path);
+            ++failures;
+            continue;
+        }
+
+        // Link the sections
+        std::vector<BYTE> code;
+        std::vector<size_t> starts;
+        for (const CodeSection& section : sections)
+        {
+            code.resize((code.size() + section.alignment - 1) / section.alignment * section.alignment, 0xCC);
+            starts.push_back(code.size());
+            code.insert(code.end(), section.code.begin(), section.code.end());
+        }
+
+        for (size_t i = 0; i < sections.size(); ++i)
+        {
+            const bool x64 = sections[i].x64;
+            const size_t entry = starts[i];
+            const size_t start = i != 0 ? starts[i - 1] : entry;
+            const int precedingLen = (int)(entry - start);
+            ++numEntries[x64];
+
+            // What the alignment leaves in front, which the classifier used to take for padding on x86 as well
+            if (!x64 && entry >= 5 && code[entry - 1] == 0xCC && code[entry - 5] == 0xCC)
+                ++numAlignedX86;
+
+            for (const int jumpSize : { 5, 14 })
+            {
+                int expectedPadding = 0;
+                const HotPatchType expected = ExpectedType(code, start, entry, x64, jumpSize, expectedPadding);
+                HOT_PATCH_PROLOGUE info = {};
+                const HotPatchType type = ClassifyHotPatchPrologue(code.data() + entry, precedingLen, (int)(code.size() - entry), x64, jumpSize, &info);
+                if (type != expected || (type != HotPatchNone && info.PaddingSize != expectedPadding))
+                {
+                    printf("FAIL %s entry %#zx, jmp of %d: type %d padding %d, expected type %d padding %d\n", path, entry, jumpSize,
+                        type, type != HotPatchNone ? info.PaddingSize : 0, expected, expectedPadding);
+                    ++failures;
+                }
+                if (jumpSize == 5 && type != HotPatchNone)
+                    ++numAccepted[x64];
+            }
+        }
+    }
+
+    printf("x86: %zu entries, %zu hot patchable, %zu behind 5 or more bytes of int 3 alignment\n", numEntries[0], numAccepted[0], numAlignedX86);
+    printf("x64: %zu entries, %zu hot patchable with a jmp of 5\n", numEntries[1], numAccepted[1]);
+    CHECK(numEntries[0] > 100 && numAlignedX86 > 0 && numAccepted[0] == 0);
+    CHECK(numEntries[1] > 100 && numAccepted[1] > 0 && numAccepted[1] < numEntries[1]);
+}
+
+int main()
+{
+    TestPrologues();
+    TestLibraries();
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,276 @@
+#include "IdaServerSession.h"
+#include <atomic>
+#include <cstdio>
+#include <functional>
+
+// The request queue and acknowledgement matching of the IDA plugin's ServerSession against a stub server on the
+// other end of a socketpair: asynchronous and synchronous requests, acknowledgements out of order, servers that
+// fail, hang, close or stop reading, and the settings deltas
+
+static std::atomic<int> failures{ 0 }; // The stub server reports failures too
+
+static void Check(bool condition, const char* what, int line)
+{
+    if (!condition)
+    {
+        printf("FAIL line %d: %s\n", line, what);
+        ++failures;
+    }
+}
+#define CHECK(condition) Check(condition, #condition, __LINE__)
+
+using Clock = std::chrono::steady_clock;
+
+static long long ElapsedMs(Clock::time_point start)
+{
+    return (long long)std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+}
+
+struct Request
+{
+    uint32_t Sequence = 0;
+    uint32_t NotifCode = 0;
+    int NumSettings = 0;
+    scl::Settings::Profile Settings{};
+    std::wstring DllPath;
+};
+
+// Respond returns this to leave a request unanswered
+static const uint32_t NoResponse = 0xFFFFFFFF;
+
+// Reads the requests of the session and answers each with the result of respond. Stops when the session shuts down
+class StubServer
+{
+public:
+    explicit StubServer(std::function<uint32_t(const Request&)> respond) : respond_(respond)
+    {
+        int sockets[2];
+        CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+        ClientSocket = sockets[0];
+        serverSocket_ = sockets[1];
+        thread_ = std::thread(&StubServer::Run, this);
+    }
+
+    ~StubServer()
+    {
+        if (thread_.joinable())
+            thread_.join();
+        closesocket(serverSocket_);
+    }
+
+    // Closes the connection from the server side once the session has shut down its side
+    void Join() { thread_.join(); }
+
+    SOCKET ClientSocket;
+    std::vector<Request> Requests;
+    bool CloseEarly = false; // Close after the first request
+
+private:
+    void Run()
+    {
+        IdaFrameDecoder decoder;
+        IdaServerMessage message;
+        while (IdaRecvFrame(serverSocket_, decoder, message) == IdaFrameComplete)
+        {
+            Request request;
+            request.Sequence = message.Sequence;
+            IdaMessageReader reader(message);
+            uint16_t tag, length;
+            const uint8_t* value;
+            while (reader.Next(tag, value, length))
+            {
+                if (tag == IDA_TAG_NOTIF_CODE)
+                    IdaMessageReader::ReadULong(value, length, request.NotifCode);
+                else if (tag == IDA_TAG_DLL_PATH)
+                    IdaMessageReader::ReadString(value, length, request.DllPath);
+                else if (IdaMessageReader::ApplySetting(request.Settings, tag, value, length))
+                    request.NumSettings++;
+            }
+            Requests.push_back(request);
+
+            if (CloseEarly)
+                break;
+            const uint32_t result = respond_(request);
+            if (result == NoResponse)
+                continue;
+            IdaMessageWriter writer;
+            writer.AddULong(IDA_TAG_RESULT, result);
+            IdaSendFrame(serverSocket_, writer.Encode(IDA_SERVER_MSG_RESPONSE, request.Sequence));
+        }
+        shutdown(serverSocket_, SD_BOTH);
+    }
+
+    std::function<uint32_t(const Request&)> respond_;
+    SOCKET serverSocket_;
+    std::thread thread_;
+};
+
+static void TestAsyncAndSyncRequests()
+{
+    StubServer server([](const Request& request) { return request.NotifCode == dbg_library_unload ? RESULT_FAILED : RESULT_SUCCESS; });
+    ServerSession session;
+    session.Start(server.ClientSocket);
+
+    scl::Settings::Profile settings{};
+    settings.hookNtClose = TRUE;
+    CHECK(session.SendEvent(dbg_process_start, 100, settings, L""));
+    for (int i = 0; i < 50; ++i)
+        CHECK(session.SendEvent(i % 5 == 0 ? dbg_library_unload : dbg_library_load, 100, settings, L""));
+    settings.hookNtClose = FALSE;
+    settings.dllStealth = TRUE;
+    CHECK(session.SendEvent(inject_dll, 100, settings, L"C:\\x.dll"));
+
+    // The inject_dll acknowledgement came after the asynchronous ones
+    CHECK(session.TakeAsyncFailures() == 10);
+    CHECK(session.TakeAsyncFailures() == 0);
+
+    CHECK(session.SendEvent(dbg_process_exit, 100, settings, L""));
+    session.Join(std::chrono::milliseconds(2000));
+    server.Join();
+
+    CHECK(server.Requests.size() == 53);
+    for (size_t i = 0; i < server.Requests.size(); ++i)
+        CHECK(server.Requests[i].Sequence == i + 1);
+
+    // Full settings with the first request, then only the ones that changed
+    CHECK(server.Requests[0].NumSettings == ida_setting_count && server.Requests[0].Settings.hookNtClose);
+    CHECK(server.Requests[1].NumSettings == 0);
+    CHECK(server.Requests[51].NumSettings == 2 && server.Requests[51].Settings.dllStealth);
+    CHECK(server.Requests[51].DllPath == L"C:\\x.dll");
+    CHECK(server.Requests[50].DllPath.empty());
+}
+
+// Synchronous requests from several threads, answered in reverse order
+static void TestAcksOutOfOrder()
+{
+    int sockets[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+    const SOCKET serverSocket = sockets[1];
+    std::thread server([&]
+    {
+        std::vector<uint32_t> held;
+        IdaFrameDecoder decoder;
+        IdaServerMessage message;
+        for (int i = 0; i < 4 && IdaRecvFrame(serverSocket, decoder, message) == IdaFrameComplete; ++i)
+            held.push_back(message.Sequence);
+        for (auto it = held.rbegin(); it != held.rend(); ++it)
+        {
+            IdaMessageWriter writer;
+            writer.AddULong(IDA_TAG_RESULT, *it == 2 ? RESULT_FAILED : RESULT_SUCCESS);
+            IdaSendFrame(serverSocket, writer.Encode(IDA_SERVER_MSG_RESPONSE, *it));
+        }
+        while (IdaRecvFrame(serverSocket, decoder, message) == IdaFrameComplete)
+        {
+        }
+        closesocket(serverSocket);
+    });
+
+    ServerSession session;
+    session.Start(sockets[0]);
+    std::vector<int> results(4);
+    std::vector<std::thread> waiters;
+    for (uint32_t sequence = 1; sequence <= 4; ++sequence)
+    {
+        std::vector<uint8_t> frame = IdaMessageWriter().Encode(IDA_SERVER_MSG_REQUEST, sequence);
+        CHECK(session.Submit(std::move(frame), sequence, true));
+    }
+    for (uint32_t sequence = 1; sequence <= 4; ++sequence)
+        waiters.emplace_back([&, sequence] { results[sequence - 1] = session.WaitForAck(sequence, std::chrono::milliseconds(5000)); });
+    for (auto& waiter : waiters)
+        waiter.join();
+    CHECK(results[0] && !results[1] && results[2] && results[3]);
+    CHECK(!session.WaitForAck(99)); // Nobody submitted it
+    session.Join(std::chrono::milliseconds(2000));
+    server.join();
+}
+
+// A server that never answers: the wait times out and breaks the session
+static void TestAckTimeout()
+{
+    StubServer server([](const Request&) { return NoResponse; });
+    ServerSession session;
+    session.Start(server.ClientSocket);
+
+    const auto start = Clock::now();
+    std::vector<uint8_t> frame = IdaMessageWriter().Encode(IDA_SERVER_MSG_REQUEST, 1);
+    CHECK(session.Submit(std::move(frame), 1, true));
+    CHECK(!session.WaitForAck(1, std::chrono::milliseconds(200)));
+    const long long elapsed = ElapsedMs(start);
+    CHECK(elapsed >= 200 && elapsed < 2000);
+    CHECK(session.IsBroken());
+
+    scl::Settings::Profile settings{};
+    CHECK(!session.SendEvent(dbg_library_load, 1, settings, L""));
+    session.Join(std::chrono::milliseconds(100));
+}
+
+// The server goes away while a request waits for it
+static void TestServerCloses()
+{
+    StubServer server([](const Request&) { return RESULT_SUCCESS; });
+    server.CloseEarly = true;
+    ServerSession session;
+    session.Start(server.ClientSocket);
+
+    scl::Settings::Profile settings{};
+    const auto start = Clock::now();
+    CHECK(!session.SendEvent(dbg_process_start, 1, settings, L""));
+    CHECK(ElapsedMs(start) < 2000);
+    CHECK(session.IsBroken());
+    CHECK(!session.SendEvent(dbg_library_load, 1, settings, L""));
+    session.Join(std::chrono::milliseconds(100));
+}
+
+static void TestVersionMismatch()
+{
+    StubServer server([](const Request&) { return RESULT_VERSION_MISMATCH; });
+    ServerSession session;
+    session.Start(server.ClientSocket);
+    scl::Settings::Profile settings{};
+    CHECK(!session.SendEvent(dbg_process_start, 1, settings, L""));
+    session.Join(std::chrono::milliseconds(2000));
+}
+
+// A server that accepts the connection but never reads: the sender blocks in send once the socket buffers are
+// full. Join must still return after its timeout
+static void TestJoinIsBounded()
+{
+    int sockets[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+    ServerSession session;
+    session.Start(sockets[0]);
+
+    IdaMessageWriter writer;
+    std::vector<uint8_t> path(0x8000, 'x');
+    writer.AddBytes(0x7000, path.data(), path.size());
+    for (uint32_t sequence = 1; sequence <= 200; ++sequence)
+        CHECK(session.Submit(writer.Encode(IDA_SERVER_MSG_REQUEST, sequence), sequence, false));
+
+    const auto start = Clock::now();
+    session.Join(std::chrono::milliseconds(300));
+    const long long elapsed = ElapsedMs(start);
+    CHECK(elapsed >= 300 && elapsed < 3000);
+    closesocket(sockets[1]);
+
+    // A new session can start right away
+    StubServer server([](const Request&) { return RESULT_SUCCESS; });
+    session.Start(server.ClientSocket);
+    scl::Settings::Profile settings{};
+    CHECK(session.SendEvent(dbg_process_start, 1, settings, L""));
+    session.Join(std::chrono::milliseconds(2000));
+    server.Join();
+    CHECK(server.Requests.size() == 1 && server.Requests[0].Sequence == 1 && server.Requests[0].NumSettings == ida_setting_count);
+}
+
+int main()
+{
+    TestAsyncAndSyncRequests();
+    TestAcksOutOfOrder();
+    TestAckTimeout();
+    TestServerCloses();
+    TestVersionMismatch();
+    TestJoinIsBounded();
+
+    printf("%d failures\n", failures.load());
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,303 @@
+#include "IdaServerProtocol.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <thread>
+
+// The framed TLV protocol of the IDA server: encoding and decoding, frames that arrive in pieces, version
+// mismatches and broken streams, settings deltas, and the blocking socket helpers over a socketpair
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what, int line)
+{
+    if (!condition)
+    {
+        printf("FAIL line %d: %s\n", line, what);
+        ++failures;
+    }
+}
+#define CHECK(condition) Check(condition, #condition, __LINE__)
+
+static std::vector<uint8_t> MakeRequest(uint32_t sequence, uint32_t notifCode, const std::wstring& dllPath)
+{
+    IdaMessageWriter writer;
+    writer.AddULong(IDA_TAG_NOTIF_CODE, notifCode);
+    writer.AddULong(IDA_TAG_PROCESS_ID, 0x1234 + sequence);
+    if (!dllPath.empty())
+        writer.AddString(IDA_TAG_DLL_PATH, dllPath);
+    return writer.Encode(IDA_SERVER_MSG_REQUEST, sequence);
+}
+
+static void CheckRequest(const IdaServerMessage& message, uint32_t sequence, uint32_t notifCode, const std::wstring& dllPath)
+{
+    CHECK(message.Version == IDA_SERVER_PROTOCOL_VERSION);
+    CHECK(message.Type == IDA_SERVER_MSG_REQUEST);
+    CHECK(message.Sequence == sequence);
+
+    IdaMessageReader reader(message);
+    uint16_t tag, length;
+    const uint8_t* value;
+    uint32_t number;
+    std::wstring string;
+    int numTags = 0;
+    while (reader.Next(tag, value, length))
+    {
+        ++numTags;
+        if (tag == IDA_TAG_NOTIF_CODE)
+            CHECK(IdaMessageReader::ReadULong(value, length, number) && number == notifCode);
+        else if (tag == IDA_TAG_PROCESS_ID)
+            CHECK(IdaMessageReader::ReadULong(value, length, number) && number == 0x1234 + sequence);
+        else if (tag == IDA_TAG_DLL_PATH)
+            CHECK(IdaMessageReader::ReadString(value, length, string) && string == dllPath);
+        else
+            CHECK(!"unexpected tag");
+    }
+    CHECK(numTags == (dllPath.empty() ? 2 : 3));
+}
+
+static void TestRoundTrip()
+{
+    // Longer than the 300 WCHARs the old fixed struct had room for
+    const std::wstring longPath = L"C:\\Users\\analyst\\" + std::wstring(400, L'x') + L"\\inject.dll";
+    IdaFrameDecoder decoder;
+    const std::vector<uint8_t> first = MakeRequest(1, dbg_process_start, L"");
+    decoder.Append(first.data(), first.size());
+    const std::vector<uint8_t> second = MakeRequest(2, inject_dll, longPath);
+    decoder.Append(second.data(), second.size());
+
+    IdaServerMessage message;
+    CHECK(decoder.Decode(message) == IdaFrameComplete);
+    CheckRequest(message, 1, dbg_process_start, L"");
+    CHECK(decoder.Decode(message) == IdaFrameComplete);
+    CheckRequest(message, 2, inject_dll, longPath);
+    CHECK(decoder.Decode(message) == IdaFrameIncomplete);
+    CHECK(decoder.BufferedSize() == 0);
+}
+
+// Several frames split into random pieces, including single bytes and splits inside the header, must decode
+// to the same messages as when they arrive at once
+static void TestPartialReads()
+{
+    std::vector<uint8_t> stream;
+    for (uint32_t sequence = 1; sequence <= 20; ++sequence)
+    {
+        const std::vector<uint8_t> frame = MakeRequest(sequence, dbg_library_load, sequence % 3 == 0 ? L"a.dll" : L"");
+        stream.insert(stream.end(), frame.begin(), frame.end());
+    }
+
+    std::mt19937 rng(1);
+    for (int round = 0; round < 500; ++round)
+    {
+        IdaFrameDecoder decoder;
+        IdaServerMessage message;
+        uint32_t expected = 1;
+        for (size_t offset = 0; offset < stream.size();)
+        {
+            const size_t piece = std::min<size_t>(stream.size() - offset, round == 0 ? 1 : 1 + rng() % 40);
+            decoder.Append(stream.data() + offset, piece);
+            offset += piece;
+
+            IdaFrameStatus status;
+            while ((status = decoder.Decode(message)) == IdaFrameComplete)
+            {
+                CheckRequest(message, expected, dbg_library_load, expected % 3 == 0 ? L"a.dll" : L"");
+                ++expected;
+            }
+            CHECK(status == IdaFrameIncomplete);
+        }
+        CHECK(expected == 21);
+    }
+}
+
+static void PutU32(std::vector<uint8_t>& frame, size_t offset, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        frame[offset + i] = (uint8_t)(value >> (8 * i));
+}
+
+static void TestBrokenFrames()
+{
+    IdaServerMessage message;
+
+    // A client of another protocol version gets a mismatch with its sequence number, so the server can answer it.
+    // This is reported as soon as the header is in, without waiting for a payload the decoder can't interpret
+    std::vector<uint8_t> frame = MakeRequest(7, dbg_process_start, L"");
+    frame[4] = IDA_SERVER_PROTOCOL_VERSION + 1;
+    for (size_t size = 0; size <= frame.size(); ++size)
+    {
+        IdaFrameDecoder decoder;
+        decoder.Append(frame.data(), size);
+        const IdaFrameStatus status = decoder.Decode(message);
+        CHECK(status == (size < IDA_SERVER_FRAME_HEADER_SIZE ? IdaFrameIncomplete : IdaFrameVersionMismatch));
+        if (status == IdaFrameVersionMismatch)
+            CHECK(message.Sequence == 7 && message.Version == IDA_SERVER_PROTOCOL_VERSION + 1);
+    }
+
+    // The version 1 protocol sent a raw IDA_SERVER_EXCHANGE struct, which starts with the notification code
+    {
+        IdaFrameDecoder decoder;
+        std::vector<uint8_t> oldExchange(1024, 0);
+        oldExchange[0] = dbg_process_start;
+        decoder.Append(oldExchange.data(), oldExchange.size());
+        CHECK(decoder.Decode(message) == IdaFrameBadMagic);
+    }
+
+    // A stream that is out of sync
+    {
+        IdaFrameDecoder decoder;
+        frame = MakeRequest(1, dbg_process_start, L"");
+        decoder.Append(frame.data() + 1, frame.size() - 1);
+        CHECK(decoder.Decode(message) == IdaFrameBadMagic);
+    }
+
+    // Payload length beyond the limit, reported before the payload arrives
+    {
+        IdaFrameDecoder decoder;
+        frame = MakeRequest(1, dbg_process_start, L"");
+        PutU32(frame, 12, IDA_SERVER_MAX_PAYLOAD_SIZE + 1);
+        decoder.Append(frame.data(), IDA_SERVER_FRAME_HEADER_SIZE);
+        CHECK(decoder.Decode(message) == IdaFrameTooLarge);
+    }
+}
+
+static void TestReader()
+{
+    IdaMessageWriter writer;
+    writer.AddULong(0x10, 0xDEADBEEF);
+    writer.AddUChar(0x11, 1);
+    writer.AddBytes(0x12, "abc", 3);
+    writer.AddString(0x13, L"path");
+    const std::vector<uint8_t> frame = writer.Encode(IDA_SERVER_MSG_REQUEST, 1);
+    const std::vector<uint8_t> payload(frame.begin() + IDA_SERVER_FRAME_HEADER_SIZE, frame.end());
+
+    // Every truncation of the payload must stop at the last complete TLV
+    static const size_t tlvEnds[] = { 8, 13, 20, 32 };
+    CHECK(payload.size() == 32);
+    for (size_t size = 0; size <= payload.size(); ++size)
+    {
+        IdaServerMessage message;
+        message.Payload.assign(payload.begin(), payload.begin() + size);
+        IdaMessageReader reader(message);
+        uint16_t tag, length;
+        const uint8_t* value;
+        size_t numTlvs = 0;
+        while (reader.Next(tag, value, length))
+        {
+            CHECK(value + length <= message.Payload.data() + message.Payload.size());
+            ++numTlvs;
+        }
+        size_t expected = 0;
+        while (expected < 4 && tlvEnds[expected] <= size)
+            ++expected;
+        CHECK(numTlvs == expected);
+    }
+
+    uint32_t number;
+    std::wstring string;
+    const uint8_t bytes[4] = { 1, 2, 3, 4 };
+    CHECK(IdaMessageReader::ReadULong(bytes, 4, number) && number == 0x04030201);
+    CHECK(!IdaMessageReader::ReadULong(bytes, 3, number));
+    CHECK(!IdaMessageReader::ReadString(bytes, 3, string));
+    CHECK(IdaMessageReader::ReadString(bytes, 0, string) && string.empty());
+}
+
+static void TestSettings()
+{
+    scl::Settings::Profile current{}, previous{}, received{};
+    current.hookNtClose = TRUE;
+    current.dllStealth = TRUE;
+    current.fixPebBeingDebugged = TRUE;
+
+    // The first request carries every setting
+    IdaMessageWriter full;
+    full.AddSettings(current, nullptr);
+    std::vector<uint8_t> frame = full.Encode(IDA_SERVER_MSG_REQUEST, 1);
+    IdaServerMessage message;
+    message.Payload.assign(frame.begin() + IDA_SERVER_FRAME_HEADER_SIZE, frame.end());
+    IdaMessageReader reader(message);
+    uint16_t tag, length;
+    const uint8_t* value;
+    int numSettings = 0;
+    received.hookNtYieldExecution = TRUE; // Must be cleared by the full set
+    while (reader.Next(tag, value, length))
+        numSettings += IdaMessageReader::ApplySetting(received, tag, value, length) ? 1 : 0;
+    CHECK(numSettings == ida_setting_count);
+    CHECK(received.hookNtClose && received.dllStealth && received.fixPebBeingDebugged && !received.hookNtYieldExecution);
+
+    // Later requests only carry what changed
+    previous = current;
+    current.hookNtClose = FALSE;
+    current.hookGetTickCount = TRUE;
+    IdaMessageWriter delta;
+    delta.AddSettings(current, &previous);
+    frame = delta.Encode(IDA_SERVER_MSG_REQUEST, 2);
+    message.Payload.assign(frame.begin() + IDA_SERVER_FRAME_HEADER_SIZE, frame.end());
+    IdaMessageReader deltaReader(message);
+    numSettings = 0;
+    while (deltaReader.Next(tag, value, length))
+        numSettings += IdaMessageReader::ApplySetting(received, tag, value, length) ? 1 : 0;
+    CHECK(numSettings == 2);
+    CHECK(!received.hookNtClose && received.hookGetTickCount && received.dllStealth);
+
+    // Unknown and malformed setting tags are ignored
+    const uint8_t one = 1;
+    CHECK(!IdaMessageReader::ApplySetting(received, IDA_TAG_SETTING_BASE + ida_setting_count, &one, 1));
+    CHECK(!IdaMessageReader::ApplySetting(received, IDA_TAG_SETTING_BASE, &one, 0));
+    CHECK(!IdaMessageReader::ApplySetting(received, IDA_TAG_NOTIF_CODE, &one, 1));
+}
+
+// The blocking helpers over a real socket, with the sender trickling the frames out a few bytes at a time
+static void TestSocketPair()
+{
+    int sockets[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+
+    std::vector<uint8_t> stream;
+    for (uint32_t sequence = 1; sequence <= 5; ++sequence)
+    {
+        const std::vector<uint8_t> frame = MakeRequest(sequence, dbg_library_load, L"");
+        stream.insert(stream.end(), frame.begin(), frame.end());
+    }
+    std::thread sender([&]
+    {
+        for (size_t offset = 0; offset < stream.size(); offset += 3)
+        {
+            const std::vector<uint8_t> piece(stream.begin() + offset, stream.begin() + std::min(stream.size(), offset + 3));
+            IdaSendFrame(sockets[0], piece);
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        // Half a frame, then the connection goes away
+        const std::vector<uint8_t> frame = MakeRequest(6, dbg_library_load, L"");
+        IdaSendFrame(sockets[0], std::vector<uint8_t>(frame.begin(), frame.begin() + frame.size() / 2));
+        closesocket(sockets[0]);
+    });
+
+    IdaFrameDecoder decoder;
+    IdaServerMessage message;
+    for (uint32_t sequence = 1; sequence <= 5; ++sequence)
+    {
+        CHECK(IdaRecvFrame(sockets[1], decoder, message) == IdaFrameComplete);
+        CheckRequest(message, sequence, dbg_library_load, L"");
+    }
+    CHECK(IdaRecvFrame(sockets[1], decoder, message) == IdaFrameConnectionClosed);
+    sender.join();
+
+    // Sending to a closed peer fails instead of raising SIGPIPE
+    CHECK(!IdaSendFrame(sockets[1], MakeRequest(1, dbg_process_exit, L"")));
+    closesocket(sockets[1]);
+}
+
+int main()
+{
+    TestRoundTrip();
+    TestPartialReads();
+    TestBrokenFrames();
+    TestReader();
+    TestSettings();
+    TestSocketPair();
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
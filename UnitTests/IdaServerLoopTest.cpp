@@ -0,0 +1,365 @@
+#include "IdaServerLoop.h"
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <sys/select.h>
+#include <thread>
+
+// IdaServerLoop over loopback: 100 clients with pipelined requests, some of which the handler completes on a
+// worker thread like the injection requests of idaserver.cpp. Every response must reach the right client in
+// request order, a slow request must not hold up the other clients, and a client that disconnects while its
+// request is pending must not lose its context early
+
+static std::atomic<int> failures{ 0 }; // The client threads report failures too
+
+static void Check(bool condition, const char* what, int line)
+{
+    if (!condition)
+    {
+        printf("FAIL line %d: %s\n", line, what);
+        ++failures;
+    }
+}
+#define CHECK(condition) Check(condition, #condition, __LINE__)
+
+// Requests with this notification code are completed by the worker, after sleeping for slowMs
+static const uint32_t SlowRequest = dbg_process_start;
+static const uint32_t FastRequest = dbg_library_unload;
+
+struct Session
+{
+    unsigned int Magic = 0x5E55;
+    std::atomic<bool> InUse{ false };
+};
+
+class TestHandler : public IdaServerHandler
+{
+public:
+    explicit TestHandler(int slowMs) : slowMs_(slowMs) {}
+
+    void Start(IdaServerLoop& loop)
+    {
+        loop_ = &loop;
+        worker_ = std::thread(&TestHandler::WorkerThread, this);
+    }
+
+    void Shutdown()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            shutdown_ = true;
+        }
+        changed_.notify_one();
+        worker_.join();
+    }
+
+    void OnConnect(IdaServerConnection& connection) override
+    {
+        connection.Context = new Session;
+        ++connects;
+    }
+
+    void OnDisconnect(IdaServerConnection& connection) override
+    {
+        Session* session = (Session*)connection.Context;
+        CHECK(session->Magic == 0x5E55 && !session->InUse && !connection.Pending);
+        session->Magic = 0;
+        delete session;
+        connection.Context = nullptr;
+        ++disconnects;
+    }
+
+    // Answers with the process ID of the request, so the clients can tell the responses apart
+    unsigned long OnRequest(IdaServerConnection& connection, const IdaServerMessage& message) override
+    {
+        Session* session = (Session*)connection.Context;
+        CHECK(session->Magic == 0x5E55 && !session->InUse);
+
+        uint32_t notifCode = 0, processId = 0;
+        IdaMessageReader reader(message);
+        uint16_t tag, length;
+        const uint8_t* value;
+        while (reader.Next(tag, value, length))
+        {
+            if (tag == IDA_TAG_NOTIF_CODE)
+                IdaMessageReader::ReadULong(value, length, notifCode);
+            else if (tag == IDA_TAG_PROCESS_ID)
+                IdaMessageReader::ReadULong(value, length, processId);
+        }
+
+        if (notifCode == dbg_process_exit)
+            connection.Closing = true;
+        if (notifCode != SlowRequest)
+            return processId;
+
+        session->InUse = true;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            jobs_.push_back(Job{ connection.Id, session, processId });
+        }
+        changed_.notify_one();
+        return IDA_SERVER_RESULT_PENDING;
+    }
+
+    std::atomic<int> connects{ 0 };
+    std::atomic<int> disconnects{ 0 };
+
+private:
+    struct Job
+    {
+        unsigned int ConnectionId;
+        Session* Context;
+        uint32_t Result;
+    };
+
+    void WorkerThread()
+    {
+        for (;;)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                changed_.wait(lock, [this] { return shutdown_ || !jobs_.empty(); });
+                if (jobs_.empty())
+                    return;
+                job = jobs_.front();
+                jobs_.pop_front();
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(slowMs_));
+            CHECK(job.Context->Magic == 0x5E55);
+            job.Context->InUse = false;
+            loop_->Complete(job.ConnectionId, job.Result);
+        }
+    }
+
+    int slowMs_;
+    IdaServerLoop* loop_ = nullptr;
+    std::thread worker_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::deque<Job> jobs_;
+    bool shutdown_ = false;
+};
+
+// Runs the loop on its own thread until it is destroyed
+struct TestServer
+{
+    explicit TestServer(int slowMs) : Handler(slowMs), Loop(Handler)
+    {
+        CHECK(Loop.Listen("0"));
+        Port = Loop.LocalPort();
+        Handler.Start(Loop);
+        Thread = std::thread([this]
+        {
+            while (!Stop)
+                CHECK(Loop.RunOnce(20));
+        });
+    }
+
+    ~TestServer()
+    {
+        Stop = true;
+        Thread.join();
+        Handler.Shutdown();
+    }
+
+    // Waits for the loop to notice that the clients went away. The connection list belongs to the loop thread
+    bool WaitForDisconnects(int numDisconnects)
+    {
+        for (int i = 0; i < 500 && Handler.disconnects != numDisconnects; ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        return Handler.disconnects == numDisconnects;
+    }
+
+    TestHandler Handler;
+    IdaServerLoop Loop;
+    unsigned short Port = 0;
+    std::atomic<bool> Stop{ false };
+    std::thread Thread;
+};
+
+static SOCKET Connect(unsigned short port)
+{
+    const SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (s == INVALID_SOCKET || connect(s, (struct sockaddr*)&address, sizeof(address)) != 0)
+    {
+        printf("FAIL connect: %d\n", IdaSocketLastError());
+        ++failures;
+    }
+    return s;
+}
+
+static std::vector<uint8_t> MakeRequest(uint32_t sequence, uint32_t notifCode, uint32_t processId)
+{
+    IdaMessageWriter writer;
+    writer.AddULong(IDA_TAG_NOTIF_CODE, notifCode);
+    writer.AddULong(IDA_TAG_PROCESS_ID, processId);
+    return writer.Encode(IDA_SERVER_MSG_REQUEST, sequence);
+}
+
+static bool ReadResponse(SOCKET s, IdaFrameDecoder& decoder, uint32_t& sequence, uint32_t& result)
+{
+    IdaServerMessage message;
+    if (IdaRecvFrame(s, decoder, message) != IdaFrameComplete || message.Type != IDA_SERVER_MSG_RESPONSE)
+        return false;
+    sequence = message.Sequence;
+    IdaMessageReader reader(message);
+    uint16_t tag, length;
+    const uint8_t* value;
+    return reader.Next(tag, value, length) && tag == IDA_TAG_RESULT && IdaMessageReader::ReadULong(value, length, result);
+}
+
+// Every client sends all of its requests at once, a mix of fast and slow ones, then reads the responses
+static void TestManyClients()
+{
+    const int numClients = 100, numRequests = 20;
+    TestServer server(1);
+
+    std::vector<std::thread> clients;
+    std::atomic<int> numResponses{ 0 };
+    for (int client = 0; client < numClients; ++client)
+    {
+        clients.emplace_back([&, client]
+        {
+            const SOCKET s = Connect(server.Port);
+            std::vector<uint8_t> requests;
+            for (uint32_t i = 0; i < numRequests; ++i)
+            {
+                const std::vector<uint8_t> frame = MakeRequest(i + 1, (client + i) % 4 == 0 ? SlowRequest : FastRequest, client * 1000 + i);
+                requests.insert(requests.end(), frame.begin(), frame.end());
+            }
+            CHECK(IdaSendFrame(s, requests));
+
+            IdaFrameDecoder decoder;
+            for (uint32_t i = 0; i < numRequests; ++i)
+            {
+                uint32_t sequence = 0, result = 0;
+                CHECK(ReadResponse(s, decoder, sequence, result));
+                CHECK(sequence == i + 1 && result == client * 1000 + i);
+                ++numResponses;
+            }
+
+            CHECK(IdaSendFrame(s, MakeRequest(numRequests + 1, dbg_process_exit, 0)));
+            uint32_t sequence, result;
+            CHECK(ReadResponse(s, decoder, sequence, result));
+            IdaServerMessage message;
+            CHECK(IdaRecvFrame(s, decoder, message) == IdaFrameConnectionClosed);
+            closesocket(s);
+        });
+    }
+    for (auto& client : clients)
+        client.join();
+
+    CHECK(numResponses == numClients * numRequests);
+    CHECK(server.WaitForDisconnects(numClients));
+    CHECK(server.Handler.connects == numClients);
+}
+
+// While the worker is busy with a slow request, other clients still get their fast requests answered
+static void TestSlowRequestDoesNotBlock()
+{
+    TestServer server(500);
+
+    const SOCKET slow = Connect(server.Port);
+    CHECK(IdaSendFrame(slow, MakeRequest(1, SlowRequest, 1)));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    const SOCKET fast = Connect(server.Port);
+    IdaFrameDecoder decoder;
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 1; i <= 10; ++i)
+    {
+        uint32_t sequence, result;
+        CHECK(IdaSendFrame(fast, MakeRequest(i, FastRequest, i)));
+        CHECK(ReadResponse(fast, decoder, sequence, result) && sequence == i && result == i);
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    if (elapsed > 250)
+    {
+        printf("FAIL fast requests took %lld ms behind a slow one\n", (long long)elapsed);
+        ++failures;
+    }
+
+    IdaFrameDecoder slowDecoder;
+    uint32_t sequence, result;
+    CHECK(ReadResponse(slow, slowDecoder, sequence, result) && sequence == 1 && result == 1);
+    closesocket(slow);
+    closesocket(fast);
+    CHECK(server.WaitForDisconnects(2));
+}
+
+// Clients that go away while their request is pending, with or without more requests queued behind it
+static void TestDisconnectWhilePending()
+{
+    TestServer server(50);
+    for (int client = 0; client < 10; ++client)
+    {
+        const SOCKET s = Connect(server.Port);
+        CHECK(IdaSendFrame(s, MakeRequest(1, SlowRequest, 1)));
+        if (client % 2 == 0)
+            CHECK(IdaSendFrame(s, MakeRequest(2, FastRequest, 2)));
+        if (client % 3 == 0)
+            shutdown(s, SHUT_WR);
+        else
+            closesocket(s);
+        if (client % 3 == 0)
+        {
+            // Half closed: the requests sent before are still answered
+            IdaFrameDecoder decoder;
+            uint32_t sequence, result;
+            CHECK(ReadResponse(s, decoder, sequence, result) && sequence == 1);
+            if (client % 2 == 0)
+                CHECK(ReadResponse(s, decoder, sequence, result) && sequence == 2);
+            closesocket(s);
+        }
+    }
+    CHECK(server.WaitForDisconnects(10));
+    CHECK(server.Handler.connects == 10);
+}
+
+static void TestVersionMismatch()
+{
+    TestServer server(1);
+    const SOCKET s = Connect(server.Port);
+    std::vector<uint8_t> frame = MakeRequest(5, FastRequest, 1);
+    frame[4] = IDA_SERVER_PROTOCOL_VERSION + 1;
+    CHECK(IdaSendFrame(s, frame));
+
+    IdaFrameDecoder decoder;
+    uint32_t sequence, result;
+    CHECK(ReadResponse(s, decoder, sequence, result) && sequence == 5 && result == RESULT_VERSION_MISMATCH);
+    IdaServerMessage message;
+    CHECK(IdaRecvFrame(s, decoder, message) == IdaFrameConnectionClosed);
+    closesocket(s);
+}
+
+int main()
+{
+    // Push the descriptors of the server and the clients beyond FD_SETSIZE, which select could not handle
+    std::vector<int> placeholders;
+    while (placeholders.size() < FD_SETSIZE)
+    {
+        const int fd = open("/dev/null", O_RDONLY);
+        if (fd < 0)
+            break;
+        placeholders.push_back(fd);
+    }
+
+    TestManyClients();
+    TestSlowRequestDoesNotBlock();
+    TestDisconnectWhilePending();
+    TestVersionMismatch();
+
+    for (const int fd : placeholders)
+        close(fd);
+
+    printf("%d failures\n", failures.load());
+    return failures == 0 ? 0 : 1;
+}
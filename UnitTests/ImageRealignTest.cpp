@@ -0,0 +1,386 @@
+#include <ntdll/ntdll.h>
+#include "ImageRealign.h"
+#include "PeImage.h"
+
+#include <cstdio>
+#include <random>
+#include <vector>
+
+// RealignImageForFile of the malware dumper on the mapped sample images in SCMRevGen/, on a crafted PE32+ image and
+// on broken and randomly mutated headers. Images and outputs are allocated with their exact size so that the
+// sanitizers catch any access past them. Every output is checked against the image it came from: headers copied,
+// sections at aligned, increasing, non-overlapping raw offsets with the mapped bytes of the section, zeroes elsewhere
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what, int line)
+{
+    if (!condition)
+    {
+        printf("FAIL line %d: %s\n", line, what);
+        ++failures;
+    }
+}
+#define CHECK(condition) Check(condition, #condition, __LINE__)
+
+struct RealignResult
+{
+    ULONG Size = 0;
+    std::vector<BYTE> File;
+};
+
+// Sizes the output with the first call, then realigns into a buffer of exactly that size
+static RealignResult Realign(const std::vector<BYTE>& image)
+{
+    RealignResult result;
+    result.Size = RealignImageForFile(image.data(), (DWORD)image.size(), nullptr, 0);
+    if (result.Size == 0)
+        return result;
+    result.File.assign(result.Size, 0xEE);
+    const ULONG written = RealignImageForFile(image.data(), (DWORD)image.size(), result.File.data(), result.Size);
+    CHECK(written == result.Size);
+    return result;
+}
+
+// Checks the invariants of a file RealignImageForFile produced from image. Returns false on the first broken one
+static bool VerifyRealigned(const std::vector<BYTE>& image, const std::vector<BYTE>& file)
+{
+    IMAGE_DOS_HEADER dos;
+    memcpy(&dos, image.data(), sizeof(dos));
+    IMAGE_FILE_HEADER fileHeader;
+    memcpy(&fileHeader, image.data() + dos.e_lfanew + sizeof(DWORD), sizeof(fileHeader));
+    DWORD fileAlignment, sizeOfHeaders;
+    memcpy(&fileAlignment, image.data() + dos.e_lfanew + FIELD_OFFSET(IMAGE_NT_HEADERS32, OptionalHeader.FileAlignment), sizeof(DWORD));
+    memcpy(&sizeOfHeaders, image.data() + dos.e_lfanew + FIELD_OFFSET(IMAGE_NT_HEADERS32, OptionalHeader.SizeOfHeaders), sizeof(DWORD));
+    if (fileAlignment == 0 || (fileAlignment & (fileAlignment - 1)) != 0)
+        fileAlignment = 0x200;
+
+    const size_t sectionTable = dos.e_lfanew + sizeof(DWORD) + sizeof(IMAGE_FILE_HEADER) + fileHeader.SizeOfOptionalHeader;
+    const size_t sectionTableEnd = sectionTable + fileHeader.NumberOfSections * sizeof(IMAGE_SECTION_HEADER);
+    const size_t headersSize = std::min<size_t>(std::max<size_t>(sizeOfHeaders, sectionTableEnd), image.size());
+    if (file.size() < headersSize)
+    {
+        printf("file of %#zx bytes is shorter than the headers\n", file.size());
+        return false;
+    }
+
+    // Which file bytes have been accounted for. 1 = headers, 2 = section data
+    std::vector<BYTE> owner(file.size(), 0);
+    for (size_t i = 0; i < headersSize; ++i)
+    {
+        owner[i] = 1;
+        const bool inSectionTable = i >= sectionTable && i < sectionTableEnd;
+        const size_t field = (i - sectionTable) % sizeof(IMAGE_SECTION_HEADER);
+        const bool rawField = inSectionTable &&
+            ((field >= offsetof(IMAGE_SECTION_HEADER, SizeOfRawData) && field < offsetof(IMAGE_SECTION_HEADER, PointerToRawData) + sizeof(DWORD)));
+        if (!rawField && file[i] != image[i])
+        {
+            printf("header byte %#zx changed\n", i);
+            return false;
+        }
+    }
+
+    size_t previousEnd = headersSize;
+    for (WORD i = 0; i < fileHeader.NumberOfSections; ++i)
+    {
+        IMAGE_SECTION_HEADER original, written;
+        memcpy(&original, image.data() + sectionTable + i * sizeof(IMAGE_SECTION_HEADER), sizeof(original));
+        memcpy(&written, file.data() + sectionTable + i * sizeof(IMAGE_SECTION_HEADER), sizeof(written));
+
+        const size_t expectedRaw = original.VirtualAddress >= image.size() ? 0 :
+            std::min<size_t>(original.SizeOfRawData, image.size() - original.VirtualAddress);
+        if (written.SizeOfRawData != expectedRaw)
+        {
+            printf("section %u: raw size %#x, expected %#zx\n", i, written.SizeOfRawData, expectedRaw);
+            return false;
+        }
+        if (expectedRaw == 0)
+        {
+            if (written.PointerToRawData != 0)
+            {
+                printf("section %u: no raw data at %#x\n", i, written.PointerToRawData);
+                return false;
+            }
+            continue;
+        }
+        const size_t offset = written.PointerToRawData;
+        if (offset % fileAlignment != 0 || offset < previousEnd || offset + expectedRaw > file.size())
+        {
+            printf("section %u: raw data at %#zx, previous section ends at %#zx\n", i, offset, previousEnd);
+            return false;
+        }
+        if (memcmp(file.data() + offset, image.data() + original.VirtualAddress, expectedRaw) != 0)
+        {
+            printf("section %u: data differs from the mapped image\n", i);
+            return false;
+        }
+        memset(owner.data() + offset, 2, expectedRaw);
+        previousEnd = offset + expectedRaw;
+    }
+
+    // The file ends with the last section and the padding between sections is zeroed
+    if (previousEnd != file.size())
+    {
+        printf("file of %#zx bytes, last section ends at %#zx\n", file.size(), previousEnd);
+        return false;
+    }
+    for (size_t i = 0; i < file.size(); ++i)
+    {
+        if (owner[i] == 0 && file[i] != 0)
+        {
+            printf("padding byte %#zx is %#x\n", i, file[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void TestSampleImages()
+{
+    for (const char* path : SampleImages)
+    {
+        PeImage pe;
+        if (!pe.Load(path))
+        {
+            printf("FAIL cannot load %s\n", path);
+            ++failures;
+            continue;
+        }
+
+        const RealignResult result = Realign(pe.Mapped);
+        CHECK(result.Size != 0);
+        CHECK(VerifyRealigned(pe.Mapped, result.File));
+
+        // The dumped file maps back to the same image
+        PeImage dumped;
+        dumped.File = result.File;
+        CHECK(dumped.Parse());
+        CHECK(dumped.Mapped == pe.Mapped);
+
+        // Already file aligned, so realigning the dump of a dump changes nothing
+        const RealignResult again = Realign(dumped.Mapped);
+        CHECK(again.File == result.File);
+
+        // A buffer one byte short is left untouched, and the size is still returned
+        std::vector<BYTE> small(result.Size - 1, 0xEE);
+        CHECK(RealignImageForFile(pe.Mapped.data(), (DWORD)pe.Mapped.size(), small.data(), (ULONG)small.size()) == result.Size);
+        CHECK(std::all_of(small.begin(), small.end(), [](BYTE b) { return b == 0xEE; }));
+    }
+}
+
+// A PE32+ image with a code section, a section without raw data, and a section running past SizeOfImage
+static std::vector<BYTE> MakeImage64(DWORD fileAlignment)
+{
+    std::vector<BYTE> image(0x4400, 0);
+    IMAGE_DOS_HEADER dos = {};
+    dos.e_magic = IMAGE_DOS_SIGNATURE;
+    dos.e_lfanew = 0x80;
+    memcpy(image.data(), &dos, sizeof(dos));
+
+    IMAGE_NT_HEADERS64 nt = {};
+    nt.Signature = IMAGE_NT_SIGNATURE;
+    nt.FileHeader.Machine = IMAGE_FILE_MACHINE_AMD64;
+    nt.FileHeader.NumberOfSections = 3;
+    nt.FileHeader.SizeOfOptionalHeader = sizeof(IMAGE_OPTIONAL_HEADER64);
+    nt.OptionalHeader.Magic = IMAGE_NT_OPTIONAL_HDR64_MAGIC;
+    nt.OptionalHeader.ImageBase = 0x140000000ULL;
+    nt.OptionalHeader.SectionAlignment = 0x1000;
+    nt.OptionalHeader.FileAlignment = fileAlignment;
+    nt.OptionalHeader.SizeOfImage = (DWORD)image.size();
+    nt.OptionalHeader.SizeOfHeaders = 0x400;
+    nt.OptionalHeader.NumberOfRvaAndSizes = IMAGE_NUMBEROF_DIRECTORY_ENTRIES;
+    memcpy(image.data() + dos.e_lfanew, &nt, sizeof(nt));
+
+    IMAGE_SECTION_HEADER sections[3] = {};
+    memcpy(sections[0].Name, ".text", 5);
+    sections[0].Misc.VirtualSize = 0x1234;
+    sections[0].VirtualAddress = 0x1000;
+    sections[0].SizeOfRawData = 0x1400;
+    sections[0].PointerToRawData = 0x400;
+    memcpy(sections[1].Name, ".bss", 4);
+    sections[1].Misc.VirtualSize = 0x800;
+    sections[1].VirtualAddress = 0x3000;
+    memcpy(sections[2].Name, ".rsrc", 5);
+    sections[2].Misc.VirtualSize = 0x800;
+    sections[2].VirtualAddress = 0x4000;
+    sections[2].SizeOfRawData = 0x800;
+    sections[2].PointerToRawData = 0x1800;
+    memcpy(image.data() + dos.e_lfanew + sizeof(nt), sections, sizeof(sections));
+
+    for (DWORD i = 0x1000; i < 0x1234; ++i)
+        image[i] = (BYTE)(i * 7 + 1);
+    for (DWORD i = 0x4000; i < image.size(); ++i)
+        image[i] = (BYTE)(i * 13 + 5);
+    return image;
+}
+
+static void TestImage64()
+{
+    for (const DWORD fileAlignment : { 0x200u, 0x1000u, 0x10u })
+    {
+        const std::vector<BYTE> image = MakeImage64(fileAlignment);
+        const RealignResult result = Realign(image);
+        CHECK(VerifyRealigned(image, result.File));
+
+        IMAGE_SECTION_HEADER sections[3];
+        memcpy(sections, result.File.data() + 0x80 + sizeof(IMAGE_NT_HEADERS64), sizeof(sections));
+        const DWORD textOffset = (0x400 + fileAlignment - 1) & ~(fileAlignment - 1);
+        CHECK(sections[0].PointerToRawData == textOffset && sections[0].SizeOfRawData == 0x1400);
+        CHECK(sections[1].PointerToRawData == 0 && sections[1].SizeOfRawData == 0);
+        CHECK(sections[2].SizeOfRawData == 0x400); // Clamped to SizeOfImage
+        CHECK(sections[2].PointerToRawData == ((textOffset + 0x1400 + fileAlignment - 1) & ~(fileAlignment - 1)));
+        CHECK(result.Size == sections[2].PointerToRawData + 0x400);
+    }
+
+    // An invalid FileAlignment falls back to 0x200
+    for (const DWORD fileAlignment : { 0u, 0x300u, 0x80000001u })
+    {
+        const std::vector<BYTE> image = MakeImage64(fileAlignment);
+        const RealignResult result = Realign(image);
+        CHECK(VerifyRealigned(image, result.File));
+        IMAGE_SECTION_HEADER text;
+        memcpy(&text, result.File.data() + 0x80 + sizeof(IMAGE_NT_HEADERS64), sizeof(text));
+        CHECK(text.PointerToRawData == 0x400);
+    }
+}
+
+static void TestMalformed()
+{
+    const std::vector<BYTE> good = MakeImage64(0x200);
+    const size_t nt = 0x80;
+    CHECK(Realign(good).Size != 0);
+
+    // Cut anywhere inside the headers up to the end of the section table
+    const size_t sectionTableEnd = nt + sizeof(IMAGE_NT_HEADERS64) + 3 * sizeof(IMAGE_SECTION_HEADER);
+    for (size_t size = 0; size < sectionTableEnd; ++size)
+    {
+        const std::vector<BYTE> cut(good.begin(), good.begin() + size);
+        if (Realign(cut).Size != 0)
+        {
+            printf("FAIL image cut to %#zx bytes accepted\n", size);
+            ++failures;
+        }
+    }
+
+    auto withLong = [&](size_t offset, LONG value)
+    {
+        std::vector<BYTE> image = good;
+        memcpy(image.data() + offset, &value, sizeof(value));
+        return image;
+    };
+    auto withWord = [&](size_t offset, WORD value)
+    {
+        std::vector<BYTE> image = good;
+        memcpy(image.data() + offset, &value, sizeof(value));
+        return image;
+    };
+
+    CHECK(Realign(withWord(0, 0x4D5A)).Size == 0);
+    CHECK(Realign(withLong(offsetof(IMAGE_DOS_HEADER, e_lfanew), -4)).Size == 0);
+    CHECK(Realign(withLong(offsetof(IMAGE_DOS_HEADER, e_lfanew), (LONG)good.size() - 4)).Size == 0);
+    CHECK(Realign(withLong(offsetof(IMAGE_DOS_HEADER, e_lfanew), 0x7FFFFFFF)).Size == 0);
+    CHECK(Realign(withLong(nt, 0x4551)).Size == 0);
+    CHECK(Realign(withWord(nt + sizeof(DWORD) + offsetof(IMAGE_FILE_HEADER, NumberOfSections), 0xFFFF)).Size == 0);
+
+    // A section table starting inside the optional header fields that are read
+    CHECK(Realign(withWord(nt + sizeof(DWORD) + offsetof(IMAGE_FILE_HEADER, SizeOfOptionalHeader), 0)).Size == 0);
+    // or past the end of the image
+    CHECK(Realign(withWord(nt + sizeof(DWORD) + offsetof(IMAGE_FILE_HEADER, SizeOfOptionalHeader), 0xFFFF)).Size == 0);
+
+    // A section outside the image has no raw data
+    {
+        std::vector<BYTE> image = good;
+        const size_t text = nt + sizeof(IMAGE_NT_HEADERS64);
+        const DWORD pastEnd = 0xFFFFF000;
+        memcpy(image.data() + text + offsetof(IMAGE_SECTION_HEADER, VirtualAddress), &pastEnd, sizeof(pastEnd));
+        const RealignResult result = Realign(image);
+        CHECK(VerifyRealigned(image, result.File));
+    }
+
+    // A huge SizeOfHeaders is clamped to the image
+    {
+        const std::vector<BYTE> image = withLong(nt + FIELD_OFFSET(IMAGE_NT_HEADERS64, OptionalHeader.SizeOfHeaders), -1);
+        const RealignResult result = Realign(image);
+        CHECK(result.Size != 0 && VerifyRealigned(image, result.File));
+    }
+
+    // Sections whose raw data adds up to more than 4GB. Only the size is asked for
+    {
+        std::vector<BYTE> image(16 << 20, 0);
+        memcpy(image.data(), good.data(), nt + sizeof(IMAGE_NT_HEADERS64));
+        const WORD numSections = 300;
+        memcpy(image.data() + nt + sizeof(DWORD) + offsetof(IMAGE_FILE_HEADER, NumberOfSections), &numSections, sizeof(numSections));
+        for (WORD i = 0; i < numSections; ++i)
+        {
+            IMAGE_SECTION_HEADER section = {};
+            section.VirtualAddress = 0x1000;
+            section.SizeOfRawData = 0xFFFFFFFF;
+            memcpy(image.data() + nt + sizeof(IMAGE_NT_HEADERS64) + i * sizeof(section), &section, sizeof(section));
+        }
+        CHECK(RealignImageForFile(image.data(), (DWORD)image.size(), nullptr, 0) == 0);
+    }
+}
+
+// Random changes to the headers of the sample images and the PE32+ image. Whatever is accepted must be realigned
+// correctly, and nothing may be read or written outside the buffers
+static void TestMutatedHeaders()
+{
+    std::vector<std::vector<BYTE>> seeds;
+    for (const char* path : SampleImages)
+    {
+        PeImage pe;
+        if (pe.Load(path))
+            seeds.push_back(pe.Mapped);
+    }
+    seeds.push_back(MakeImage64(0x200));
+
+    std::mt19937 rng(40);
+    int accepted = 0;
+    const int iterations = 20000;
+    for (int iteration = 0; iteration < iterations; ++iteration)
+    {
+        std::vector<BYTE> image = seeds[rng() % seeds.size()];
+        const size_t headerBytes = std::min<size_t>(image.size(), 0x400);
+        const int numChanges = 1 + rng() % 8;
+        for (int i = 0; i < numChanges; ++i)
+        {
+            const size_t offset = rng() % headerBytes;
+            switch (rng() % 3)
+            {
+            case 0: image[offset] = (BYTE)rng(); break;
+            case 1: image[offset] ^= (BYTE)(1 << (rng() % 8)); break;
+            default:
+                if (offset + sizeof(DWORD) <= headerBytes)
+                {
+                    const DWORD value = rng() % 2 ? rng() : (DWORD)image.size() - rng() % 0x100;
+                    memcpy(image.data() + offset, &value, sizeof(value));
+                }
+            }
+        }
+        if (rng() % 4 == 0)
+            image.resize(rng() % image.size());
+        image.shrink_to_fit();
+
+        const RealignResult result = Realign(image);
+        if (result.Size == 0)
+            continue;
+        ++accepted;
+        if (!VerifyRealigned(image, result.File))
+        {
+            printf("FAIL mutation %d\n", iteration);
+            ++failures;
+        }
+    }
+    printf("%d of %d mutated images realigned\n", accepted, iterations);
+}
+
+int main()
+{
+    TestSampleImages();
+    TestImage64();
+    TestMalformed();
+    TestMutatedHeaders();
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
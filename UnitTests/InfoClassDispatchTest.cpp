@@ -0,0 +1,129 @@
+#include <ntdll/ntdll.h>
+#include "InfoClassDispatch.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <set>
+#include <vector>
+
+// The sparse information class dispatch of HookedFunctions.cpp: every class of a table reaches its own entry, and
+// every other class value, including the ones past the index, reaches none. The tables are copies of the hook tables
+// with the class values of 3rdparty/ntdll/ntdll.h, which the shims do not have
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what, int line)
+{
+    if (!condition)
+    {
+        printf("FAIL line %d: %s\n", line, what);
+        ++failures;
+    }
+}
+#define CHECK(condition) Check(condition, #condition, __LINE__)
+
+struct TestHook
+{
+    ULONG InfoClass;
+};
+
+// SystemProcessInformation 5 to SystemCodeIntegrityUnlockInformation 190, in the order of SystemInfoHooks
+static constexpr TestHook SystemInfoHooks[] = { { 35 }, { 5 }, { 53 }, { 16 }, { 64 }, { 57 }, { 88 }, { 148 }, { 103 }, { 149 }, { 163 }, { 190 } };
+// ProcessDebugObjectHandle, ProcessDebugFlags, ProcessDebugPort, ProcessBasicInformation, ProcessBreakOnTermination, ProcessHandleTracing, ProcessIoCounters
+static constexpr TestHook QueryProcessInfoHooks[] = { { 30 }, { 31 }, { 7 }, { 0 }, { 29 }, { 32 }, { 2 } };
+static constexpr TestHook SetProcessInfoHooks[] = { { 29 }, { 31 }, { 32 } };
+static constexpr TestHook ObjectInfoHooks[] = { { 3 }, { 2 } };
+
+static_assert(InfoClassTableIsValid(SystemInfoHooks), "");
+static_assert(InfoClassTableIsValid(QueryProcessInfoHooks), "");
+static_assert(InfoClassTableIsValid(SetProcessInfoHooks), "");
+static_assert(InfoClassTableIsValid(ObjectInfoHooks), "");
+
+// What the static_asserts of HookedFunctions.cpp reject
+static constexpr TestHook PastIndex[] = { { 5 }, { INFO_CLASS_INDEX_SIZE } };
+static constexpr TestHook ListedTwice[] = { { 5 }, { 16 }, { 5 } };
+static constexpr TestHook LastInIndex[] = { { 0 }, { INFO_CLASS_INDEX_SIZE - 1 } };
+static_assert(!InfoClassTableIsValid(PastIndex), "");
+static_assert(!InfoClassTableIsValid(ListedTwice), "");
+static_assert(InfoClassTableIsValid(LastInIndex), "");
+
+// Looks up every class value up to well past the index, and the extremes, in a fresh index
+template<ULONG NumEntries>
+static void CheckCoverage(const TestHook (&entries)[NumEntries], const char* name)
+{
+    UCHAR index[INFO_CLASS_INDEX_SIZE] = {};
+    volatile LONG indexBuilt = 0;
+
+    std::vector<ULONG> classes;
+    for (ULONG infoClass = 0; infoClass < 0x10000; ++infoClass)
+        classes.push_back(infoClass);
+    for (const ULONG infoClass : { 0x7FFFFFFFUL, 0x80000000UL, 0xFFFFFF00UL, 0xFFFFFFFFUL })
+        classes.push_back(infoClass);
+
+    int found = 0;
+    for (const ULONG infoClass : classes)
+    {
+        const TestHook* expected = nullptr;
+        for (ULONG i = 0; i < NumEntries; ++i)
+        {
+            if (entries[i].InfoClass == infoClass)
+                expected = &entries[i];
+        }
+        const TestHook* hook = LookupInfoClass(entries, index, indexBuilt, infoClass);
+        if (hook != expected)
+        {
+            printf("FAIL %s: class %u dispatched to entry %d\n", name, infoClass, hook != nullptr ? (int)(hook - entries) : -1);
+            ++failures;
+        }
+        found += hook != nullptr;
+    }
+    CHECK(found == (int)NumEntries);
+    CHECK(indexBuilt == 1);
+}
+
+// Random tables of up to 254 distinct classes
+static void TestRandomTables()
+{
+    std::mt19937 rng(1);
+    static TestHook entries[254];
+    for (int round = 0; round < 200; ++round)
+    {
+        const ULONG count = 1 + rng() % _countof(entries);
+        std::set<ULONG> used;
+        while (used.size() < count)
+            used.insert(rng() % INFO_CLASS_INDEX_SIZE);
+        std::vector<ULONG> shuffled(used.begin(), used.end());
+        std::shuffle(shuffled.begin(), shuffled.end(), rng);
+        for (ULONG i = 0; i < _countof(entries); ++i)
+            entries[i].InfoClass = i < count ? shuffled[i] : shuffled[0]; // The unused tail repeats a class
+
+        UCHAR index[INFO_CLASS_INDEX_SIZE] = {};
+        volatile LONG indexBuilt = 0;
+        for (ULONG infoClass = 0; infoClass < 2 * INFO_CLASS_INDEX_SIZE; ++infoClass)
+        {
+            const TestHook* hook = LookupInfoClass(entries, index, indexBuilt, infoClass);
+            const bool listed = used.count(infoClass) != 0;
+            // A repeated class reaches its last entry, which is why the hook tables reject repeats
+            if (listed != (hook != nullptr) || (hook != nullptr && hook->InfoClass != infoClass))
+            {
+                printf("FAIL random table %d: class %u\n", round, infoClass);
+                ++failures;
+                break;
+            }
+        }
+    }
+}
+
+int main()
+{
+    CheckCoverage(SystemInfoHooks, "SystemInfoHooks");
+    CheckCoverage(QueryProcessInfoHooks, "QueryProcessInfoHooks");
+    CheckCoverage(SetProcessInfoHooks, "SetProcessInfoHooks");
+    CheckCoverage(ObjectInfoHooks, "ObjectInfoHooks");
+    CheckCoverage(LastInIndex, "LastInIndex");
+    TestRandomTables();
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
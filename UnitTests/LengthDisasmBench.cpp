@@ -0,0 +1,66 @@
+#include <windows.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "LengthDisasm.h"
+#include "RandomInstructions.h"
+
+extern "C" {
+#include "distorm.h"
+}
+
+// ns per instruction of LdeDecode and of a one instruction distorm_decompose, on the random streams LdeDecode accepts
+int main(int argc, char* argv[])
+{
+    const long count = argc > 1 ? strtol(argv[1], nullptr, 0) : 1000000;
+    const int rounds = 5;
+
+    for (int mode = 0; mode < 2; ++mode)
+    {
+        const bool x64 = mode != 0;
+        std::mt19937_64 rng(1);
+        std::vector<BYTE> streams;
+        streams.reserve(count * 16);
+        while ((long)(streams.size() / 16) < count)
+        {
+            BYTE code[16];
+            RandomInstruction(rng, code);
+            if (LdeDecode(code, sizeof(code), x64, nullptr) >= 0)
+                streams.insert(streams.end(), code, code + sizeof(code));
+        }
+
+        double bestLde = 1e30, bestDistorm = 1e30;
+        long long sum = 0;
+        for (int round = 0; round < rounds; ++round)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (size_t offset = 0; offset < streams.size(); offset += 16)
+                sum += LdeDecode(&streams[offset], 16, x64, nullptr);
+            auto end = std::chrono::steady_clock::now();
+            const double lde = std::chrono::duration<double, std::nano>(end - start).count() / count;
+            if (lde < bestLde)
+                bestLde = lde;
+
+            start = std::chrono::steady_clock::now();
+            for (size_t offset = 0; offset < streams.size(); offset += 16)
+            {
+                _CodeInfo ci = {};
+                ci.code = &streams[offset];
+                ci.codeLen = 16;
+                ci.dt = x64 ? Decode64Bits : Decode32Bits;
+                _DInst inst;
+                unsigned int decoded = 0;
+                distorm_decompose(&ci, &inst, 1, &decoded);
+                sum += inst.size;
+            }
+            end = std::chrono::steady_clock::now();
+            const double distorm = std::chrono::duration<double, std::nano>(end - start).count() / count;
+            if (distorm < bestDistorm)
+                bestDistorm = distorm;
+        }
+
+        printf("%s: LdeDecode %.1f ns/op, distorm_decompose %.1f ns/op (%lld)\n", x64 ? "x64" : "x86", bestLde, bestDistorm, sum);
+    }
+    return 0;
+}
@@ -0,0 +1,220 @@
+#include <windows.h>
+#include <cstdio>
+#include <cstdlib>
+#include "CodeLibraries.h"
+#include "LengthDisasm.h"
+#include "RandomInstructions.h"
+
+extern "C" {
+#include "distorm.h"
+}
+
+// Returns the length distorm decodes, or -1 if it rejects the instruction
+static int DistormLength(const BYTE * code, int codeLen, bool x64)
+{
+    _CodeInfo ci = {};
+    ci.code = code;
+    ci.codeLen = codeLen;
+    ci.dt = x64 ? Decode64Bits : Decode32Bits;
+    _DInst inst;
+    unsigned int count = 0;
+    distorm_decompose(&ci, &inst, 1, &count);
+    if (count == 0 || inst.flags == FLAG_NOT_DECODABLE)
+        return -1;
+    return inst.size;
+}
+
+static void PrintBytes(const BYTE * code, int len)
+{
+    for (int i = 0; i < len; ++i)
+        printf(" %02X", code[i]);
+    printf("\n");
+}
+
+struct KnownInstruction
+{
+    bool x64;
+    int length;
+    BYTE code[16];
+};
+
+// Prologues and stubs that are hooked in practice
+static const KnownInstruction KnownInstructions[] =
+{
+    { false, 2, { 0x8B, 0xFF } },                                           // mov edi, edi
+    { false, 1, { 0x55 } },                                                 // push ebp
+    { false, 5, { 0xB8, 0x19, 0x00, 0x00, 0x00 } },                         // mov eax, 19h
+    { false, 5, { 0xBA, 0x00, 0x03, 0xFE, 0x7F } },                         // mov edx, 7FFE0300h
+    { false, 2, { 0xFF, 0x12 } },                                           // call [edx]
+    { false, 7, { 0x64, 0xFF, 0x15, 0xC0, 0x00, 0x00, 0x00 } },             // call fs:[0C0h]
+    { false, 3, { 0xC2, 0x08, 0x00 } },                                     // retn 8
+    { false, 6, { 0xFF, 0x25, 0x00, 0x10, 0x40, 0x00 } },                   // jmp [401000h]
+    { true, 3, { 0x4C, 0x8B, 0xD1 } },                                      // mov r10, rcx
+    { true, 5, { 0xB8, 0x19, 0x00, 0x00, 0x00 } },                          // mov eax, 19h
+    { true, 8, { 0xF6, 0x04, 0x25, 0x08, 0x03, 0xFE, 0x7F, 0x01 } },        // test byte ptr [7FFE0308h], 1
+    { true, 2, { 0x0F, 0x05 } },                                            // syscall
+    { true, 4, { 0x48, 0x83, 0xEC, 0x28 } },                                // sub rsp, 28h
+    { true, 5, { 0x48, 0x89, 0x5C, 0x24, 0x08 } },                          // mov [rsp+8], rbx
+    { true, 6, { 0xFF, 0x25, 0x12, 0x34, 0x00, 0x00 } },                    // jmp [rip+3412h]
+    { true, 7, { 0x48, 0xFF, 0x25, 0x12, 0x34, 0x00, 0x00 } },              // rex.w jmp [rip+3412h]
+    { true, 10, { 0x48, 0xB8, 1, 2, 3, 4, 5, 6, 7, 8 } },                   // mov rax, imm64
+    { true, 5, { 0xE9, 0x00, 0x10, 0x00, 0x00 } },                          // jmp rel32
+    { true, 2, { 0xEB, 0xF0 } },                                            // jmp short -16
+};
+
+// Walks the code linearly, following distorm, and compares the lengths wherever both decoders accept the instruction.
+// Jump tables and padding inside the code give garbage instructions, which have to agree as well
+static int CompareOnCode(const std::vector<BYTE>& code, bool x64, long& instructions, long& fallback)
+{
+    int failures = 0;
+    size_t pos = 0;
+    while (pos < code.size())
+    {
+        const int remaining = (int)(code.size() - pos < 64 ? code.size() - pos : 64);
+        const int expected = DistormLength(&code[pos], remaining, x64);
+        if (expected < 0)
+        {
+            ++pos;
+            continue;
+        }
+        ++instructions;
+
+        LDE_INSTRUCTION info;
+        const int length = LdeDecode(&code[pos], remaining, x64, &info);
+        if (length < 0)
+            ++fallback;
+        else if (length != expected || info.Length != length)
+        {
+            if (failures < 10)
+            {
+                printf("FAIL x64=%d at %#zx LdeDecode %d distorm %d:", x64, pos, length, expected);
+                PrintBytes(&code[pos], expected);
+            }
+            ++failures;
+        }
+        pos += expected;
+    }
+    return failures;
+}
+
+static int TestRealCode()
+{
+    std::vector<CodeSection> sections;
+    for (const char* path : SampleImages)
+    {
+        PeImage pe;
+        if (!pe.Load(path))
+        {
+            printf("FAIL cannot load %s\n", path);
+            return 1;
+        }
+        for (const auto& section : pe.Sections)
+        {
+            if ((section.Characteristics & IMAGE_SCN_CNT_CODE) == 0)
+                continue;
+            const BYTE* code = pe.Mapped.data() + section.VirtualAddress;
+            const DWORD size = std::min(section.Misc.VirtualSize, section.SizeOfRawData);
+            sections.push_back(CodeSection{ pe.Is64, 0, 1, std::vector<BYTE>(code, code + size) });
+        }
+    }
+    for (const char* path : CodeLibraries)
+    {
+        if (!ReadLibraryCode(path, sections))
+        {
+            printf("FAIL cannot read %s\n", path);
+            return 1;
+        }
+    }
+
+    int failures = 0;
+    for (int mode = 0; mode < 2; ++mode)
+    {
+        const bool x64 = mode != 0;
+        long bytes = 0, instructions = 0, fallback = 0;
+        for (const CodeSection& section : sections)
+        {
+            if (section.x64 != x64)
+                continue;
+            bytes += (long)section.code.size();
+            failures += CompareOnCode(section.code, x64, instructions, fallback);
+        }
+        printf("%s: %ld bytes of real code, %ld instructions, %ld left to distorm\n", x64 ? "x64" : "x86", bytes, instructions, fallback);
+        if (instructions < 10000)
+        {
+            printf("FAIL only %ld real %s instructions\n", instructions, x64 ? "x64" : "x86");
+            ++failures;
+        }
+    }
+    return failures;
+}
+
+int main(int argc, char* argv[])
+{
+    const long iterations = argc > 1 ? strtol(argv[1], nullptr, 0) : 1000000;
+    const unsigned long long seed = argc > 2 ? strtoull(argv[2], nullptr, 0) : 1;
+    int failures = 0;
+
+    for (const auto& known : KnownInstructions)
+    {
+        BYTE code[16];
+        memcpy(code, known.code, sizeof(code));
+        LDE_INSTRUCTION info;
+        const int length = LdeDecode(code, sizeof(code), known.x64, &info);
+        if (length != known.length || info.Length != length)
+        {
+            printf("FAIL x64=%d expected %d, LdeDecode returned %d:", known.x64, known.length, length);
+            PrintBytes(code, known.length);
+            ++failures;
+        }
+    }
+
+    failures += TestRealCode();
+
+    // Lengths must match wherever both decoders accept an instruction. LdeDecode may reject what distorm decodes
+    // (callers fall back to distorm), and distorm rejects some SSE encodings with conflicting mandatory prefixes
+    // that LdeDecode sizes like any other 0F instruction
+    std::mt19937_64 rng(seed);
+    for (int mode = 0; mode < 2; ++mode)
+    {
+        const bool x64 = mode != 0;
+        long decoded = 0, fallback = 0, rejectedByDistorm = 0;
+
+        for (long i = 0; i < iterations; ++i)
+        {
+            BYTE code[16];
+            RandomInstruction(rng, code);
+
+            LDE_INSTRUCTION info;
+            const int length = LdeDecode(code, sizeof(code), x64, &info);
+            if (length < 0)
+            {
+                ++fallback;
+                continue;
+            }
+            ++decoded;
+
+            const int expected = DistormLength(code, sizeof(code), x64);
+            if (expected < 0)
+            {
+                ++rejectedByDistorm;
+                continue;
+            }
+
+            if (length != expected || info.Length != length || length > LDE_MAX_INSTRUCTION_SIZE)
+            {
+                if (failures < 25)
+                {
+                    printf("FAIL x64=%d LdeDecode %d distorm %d:", x64, length, expected);
+                    PrintBytes(code, sizeof(code));
+                }
+                ++failures;
+            }
+        }
+
+        printf("%s: %ld streams, %ld decoded, %ld left to distorm, %ld rejected by distorm\n",
+            x64 ? "x64" : "x86", iterations, decoded, fallback, rejectedByDistorm);
+    }
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,171 @@
+#include "FilterHarness.h"
+
+#include <cstdio>
+#include <random>
+
+// Writes the generated part of corpus/: buffers in the layout x64 Windows 10 returns them, built from a type table,
+// handle mix and process list like those of a desktop system. RecordFilterCorpus.cpp records the real thing on Windows.
+//
+//   MakeFilterCorpus UnitTests/corpus
+
+// Object types of Windows 10 1909 x64, in type index order from 2
+static const wchar_t* const ObjectTypeNames[] =
+{
+    L"Type", L"Directory", L"SymbolicLink", L"Token", L"Job", L"Process", L"Thread", L"Partition", L"UserApcReserve",
+    L"IoCompletionReserve", L"ActivityReference", L"PsSiloContextPaged", L"PsSiloContextNonPaged", L"DebugObject",
+    L"Event", L"Mutant", L"Callback", L"Semaphore", L"Timer", L"IRTimer", L"Profile", L"KeyedEvent", L"WindowStation",
+    L"Desktop", L"Composition", L"RawInputManager", L"CoreMessaging", L"TpWorkerFactory", L"Adapter", L"Controller",
+    L"Device", L"Driver", L"IoCompletion", L"WaitCompletionPacket", L"File", L"TmTm", L"TmTx", L"TmRm", L"TmEn",
+    L"Section", L"Session", L"Key", L"RegistryTransaction", L"ALPC Port", L"EnergyTracker", L"PowerRequest", L"WmiGuid",
+    L"EtwRegistration", L"EtwSessionDemuxEntry", L"EtwConsumer", L"DmaAdapter", L"DmaDomain", L"PcwObject",
+    L"FilterConnectionPort", L"FilterCommunicationPort", L"NdisCmState", L"DxgkSharedResource",
+    L"DxgkSharedKeyedMutexObject", L"DxgkSharedSyncObject", L"DxgkSharedSwapChainObject", L"DxgkDisplayManagerObject",
+    L"DxgkCurrentDxgProcessObject", L"DxgkSharedProtectedSessionObject", L"DxgkSharedBundleObject",
+    L"DxgkCompositionObject", L"VRegConfigurationContext"
+};
+
+// The protected PIDs, System and a few other processes
+static const ULONG HandleOwnerPids[] = { 4, 600, 1234, 4242, 5120, 7788 };
+
+// Mostly the types a process has many handles of
+static const USHORT HandleTypes[] = { 7, 8, 15, 16, 16, 16, 17, 19, 36, 36, 36, 41, 43, 43, 45 };
+
+static bool WriteCorpusFile(const std::string& directory, const char* name, FilterKind kind, const std::vector<UCHAR>& buffer)
+{
+    const std::string path = directory + "/" + name;
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+        return false;
+    const UCHAR kindByte = kind;
+    const bool ok = fwrite(&kindByte, 1, 1, file) == 1 && fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+    return fclose(file) == 0 && ok;
+}
+
+template<typename TInfo, typename TEntry>
+static std::vector<UCHAR> MakeHandleInfo(std::mt19937& rng, ULONG count, ULONG reportedCount)
+{
+    std::vector<UCHAR> buffer(offsetof(TInfo, Handles) + count * sizeof(TEntry));
+    ((TInfo*)buffer.data())->NumberOfHandles = reportedCount;
+
+    // Handles are grouped by process, in increasing handle value
+    ULONG pid = 0, handleValue = 4;
+    for (ULONG i = 0; i < count; ++i)
+    {
+        if (i == 0 || rng() % 16 == 0)
+        {
+            pid = HandleOwnerPids[rng() % _countof(HandleOwnerPids)];
+            handleValue = 4;
+        }
+
+        TEntry entry = TEntry();
+        entry.UniqueProcessId = (decltype(entry.UniqueProcessId))pid;
+        entry.HandleValue = (decltype(entry.HandleValue))handleValue;
+        entry.ObjectTypeIndex = (decltype(entry.ObjectTypeIndex))HandleTypes[rng() % _countof(HandleTypes)];
+        entry.Object = (PVOID)(0xFFFF800000000000ULL + ((ULONGLONG)rng() << 4));
+        entry.GrantedAccess = rng() % 2 ? 0x1FFFFF : 0x100000 | (rng() & 0xFFFF);
+        memcpy(buffer.data() + offsetof(TInfo, Handles) + i * sizeof(TEntry), &entry, sizeof(entry));
+        handleValue += 4;
+    }
+    return buffer;
+}
+
+static std::vector<UCHAR> MakeObjectTypes(std::mt19937& rng)
+{
+    std::vector<UCHAR> buffer(ALIGN_UP(offsetof(OBJECT_TYPES_INFORMATION, TypeInformation), ULONG_PTR));
+    ((OBJECT_TYPES_INFORMATION*)buffer.data())->NumberOfTypes = _countof(ObjectTypeNames);
+    for (size_t i = 0; i < _countof(ObjectTypeNames); ++i)
+        AppendObjectType(buffer, ObjectTypeNames[i], (UCHAR)(i + 2), 1 + rng() % 5000, 1 + rng() % 20000);
+    return buffer;
+}
+
+// Image names of a desktop system. x64dbg.exe and ida64.exe are the bad names of FilterHarness.h
+static const wchar_t* const ProcessNames[] =
+{
+    L"svchost.exe", L"svchost.exe", L"svchost.exe", L"RuntimeBroker.exe", L"conhost.exe", L"explorer.exe",
+    L"chrome.exe", L"chrome.exe", L"SearchIndexer.exe", L"dwm.exe", L"csrss.exe", L"lsass.exe", L"services.exe",
+    L"x64dbg.exe", L"IDA64.EXE", L"target.exe"
+};
+
+// The idle process and System first, like the kernel lists them. The last process is x64dbg, so that hiding it
+// ends the list early
+static std::vector<FilterTestProcess> MakeProcesses(std::mt19937& rng, ULONG count)
+{
+    std::vector<FilterTestProcess> processes = { { 0, L"", 1 }, { 4, L"System", 2 } };
+    for (ULONG i = 2; i + 1 < count; ++i)
+        processes.push_back({ i == count / 2 ? FilterTestHiddenPid : 100 + 4 * i, ProcessNames[rng() % _countof(ProcessNames)], (ULONG)(1 + rng() % 12) });
+    processes.push_back({ 100 + 4 * count, L"x64dbg.exe", 3 });
+    return processes;
+}
+
+// Top-level windows in Z order, the list EnumWindows gets. Window handles are a 16 bit index into the handle table and
+// a uniqueness count. The debugger's windows are the bad ones: its main window is in front, and a few of its tool
+// windows are further down
+static std::vector<ULONGLONG> MakeWindows(std::mt19937& rng, ULONG count, std::vector<ULONGLONG>* badWindows)
+{
+    std::vector<ULONGLONG> windows;
+    for (ULONG i = 0; i < count; ++i)
+    {
+        const ULONGLONG window = ((ULONGLONG)(1 + rng() % 0x7F) << 16) | (0x10 + 2 * i);
+        windows.push_back(window);
+        if (i == 0 || rng() % 64 == 0)
+            badWindows->push_back(window);
+    }
+    return windows;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: %s <corpus directory>\n", argv[0]);
+        return 1;
+    }
+    const std::string directory = argv[1];
+    std::mt19937 rng(1);
+
+    std::vector<UCHAR> objectTypes = MakeObjectTypes(rng);
+    std::vector<UCHAR> debugObject;
+    AppendObjectType(debugObject, L"DebugObject", 15, 3, 3);
+
+    bool ok = WriteCorpusFile(directory, "handles-small.bin", FilterKindHandleInfo, MakeHandleInfo<SYSTEM_HANDLE_INFORMATION, SYSTEM_HANDLE_TABLE_ENTRY_INFO>(rng, 100, 100)) &&
+        WriteCorpusFile(directory, "handles-large.bin", FilterKindHandleInfo, MakeHandleInfo<SYSTEM_HANDLE_INFORMATION, SYSTEM_HANDLE_TABLE_ENTRY_INFO>(rng, 1000, 1000)) &&
+        WriteCorpusFile(directory, "handles-partial.bin", FilterKindHandleInfo, MakeHandleInfo<SYSTEM_HANDLE_INFORMATION, SYSTEM_HANDLE_TABLE_ENTRY_INFO>(rng, 50, 5000)) &&
+        WriteCorpusFile(directory, "handles-ex-small.bin", FilterKindHandleInfoEx, MakeHandleInfo<SYSTEM_HANDLE_INFORMATION_EX, SYSTEM_HANDLE_TABLE_ENTRY_INFO_EX>(rng, 100, 100)) &&
+        WriteCorpusFile(directory, "handles-ex-large.bin", FilterKindHandleInfoEx, MakeHandleInfo<SYSTEM_HANDLE_INFORMATION_EX, SYSTEM_HANDLE_TABLE_ENTRY_INFO_EX>(rng, 1000, 1000)) &&
+        WriteCorpusFile(directory, "handles-ex-partial.bin", FilterKindHandleInfoEx, MakeHandleInfo<SYSTEM_HANDLE_INFORMATION_EX, SYSTEM_HANDLE_TABLE_ENTRY_INFO_EX>(rng, 50, 5000)) &&
+        WriteCorpusFile(directory, "object-types.bin", FilterKindObjectTypes, objectTypes) &&
+        WriteCorpusFile(directory, "object-type-debugobject.bin", FilterKindObjectType, debugObject);
+
+    // Where the process lists were in the recording process, which their names point into
+    const ULONG_PTR processListAddress = 0x000001D4A8F30000ULL;
+    std::vector<UCHAR> processes = MakeProcessList(MakeProcesses(rng, 120), processListAddress);
+    ok = ok && WriteCorpusFile(directory, "processes.bin", FilterKindProcessList, processes);
+    // Hidden processes first and last, the first one can only have its name cleared
+    const std::vector<FilterTestProcess> hiddenFirst = { { FilterTestHiddenPid, L"ida64.exe", 1 }, { 8, L"target.exe", 1 }, { 12, L"x64dbg.exe", 0 } };
+    ok = ok && WriteCorpusFile(directory, "processes-hidden-first.bin", FilterKindProcessList, MakeProcessList(hiddenFirst, processListAddress));
+    // Cut off, the hook leaves it alone
+    processes.resize(processes.size() / 2 + 3);
+    ok = ok && WriteCorpusFile(directory, "processes-partial.bin", FilterKindProcessList, processes);
+
+    std::vector<ULONGLONG> badWindows;
+    const std::vector<ULONGLONG> windows = MakeWindows(rng, 300, &badWindows);
+    ok = ok && WriteCorpusFile(directory, "hwnds.bin", FilterKindHwndList, MakeHwndList(windows, badWindows, (ULONG)windows.size()));
+    // Only the debugger's windows, which the filter used to leave in place when no other window followed
+    const std::vector<ULONGLONG> onlyBad(windows.begin(), windows.begin() + 3);
+    ok = ok && WriteCorpusFile(directory, "hwnds-all-bad.bin", FilterKindHwndList, MakeHwndList(onlyBad, onlyBad, 3));
+    // A count past the end of the buffer, and null windows
+    std::vector<ULONGLONG> withNulls(windows.begin(), windows.begin() + 40);
+    withNulls[5] = withNulls[17] = 0;
+    ok = ok && WriteCorpusFile(directory, "hwnds-count-past-buffer.bin", FilterKindHwndList, MakeHwndList(withNulls, badWindows, 1000));
+
+    // A buffer that was too small for all types, cut off in the middle of a name
+    objectTypes.resize(objectTypes.size() / 3 + 7);
+    ok = ok && WriteCorpusFile(directory, "object-types-partial.bin", FilterKindObjectTypes, objectTypes);
+
+    if (!ok)
+    {
+        fprintf(stderr, "Failed to write to %s\n", directory.c_str());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,198 @@
+#include "FilterHarness.h"
+#include "BufferFilters.h"
+
+#include <cstdio>
+
+// ParseBadObjectTypes, which GetBadObjectTypeBitmap builds the hidden type bitmap of the handle filters with, on
+// ObjectTypesInformation buffers with the type tables of Windows 7 through 11 and on truncated ones.
+//
+// The Windows 7 and 11 buffers are built here from the published type tables of those versions, and object-types.bin
+// of the corpus is generated by MakeFilterCorpus from the Windows 10 one. None of them is a capture: run
+// RecordFilterCorpus on those versions to add real buffers to corpus/, this test parses every ObjectTypes file there
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what, int line)
+{
+    if (!condition)
+    {
+        printf("FAIL line %d: %s\n", line, what);
+        ++failures;
+    }
+}
+#define CHECK(condition) Check(condition, #condition, __LINE__)
+
+static const WCHAR DefaultTypes[] = L"DebugObject;Process;Thread";
+
+// Object types of Windows 7 SP1 x64, in type index order from 2. The entries have no TypeIndex before 8.1
+static const wchar_t* const Windows7Types[] =
+{
+    L"Type", L"Directory", L"SymbolicLink", L"Token", L"Job", L"Process", L"Thread", L"UserApcReserve",
+    L"IoCompletionReserve", L"DebugObject", L"Event", L"EventPair", L"Mutant", L"Callback", L"Semaphore", L"Timer",
+    L"Profile", L"KeyedEvent", L"WindowStation", L"Desktop", L"TpWorkerFactory", L"Adapter", L"Controller", L"Device",
+    L"Driver", L"IoCompletion", L"File", L"TmTm", L"TmTx", L"TmRm", L"TmEn", L"Section", L"Session", L"Key",
+    L"ALPC Port", L"PowerRequest", L"WmiGuid", L"EtwRegistration", L"EtwConsumer", L"FilterConnectionPort",
+    L"FilterCommunicationPort", L"PcwObject"
+};
+
+// The start of the type table of Windows 11 22H2 x64, which moved DebugObject back by three new types
+static const wchar_t* const Windows11Types[] =
+{
+    L"Type", L"Directory", L"SymbolicLink", L"Token", L"Job", L"Process", L"Thread", L"Partition", L"UserApcReserve",
+    L"IoCompletionReserve", L"ActivityReference", L"ProcessStateChange", L"ThreadStateChange", L"CpuPartition",
+    L"PsSiloContextPaged", L"PsSiloContextNonPaged", L"DebugObject", L"Event", L"Mutant", L"Callback", L"Semaphore",
+    L"Timer", L"IRTimer", L"Profile", L"KeyedEvent", L"WindowStation", L"Desktop", L"Composition", L"RawInputManager",
+    L"CoreMessaging", L"ActivationObject", L"TpWorkerFactory", L"Adapter", L"Controller", L"Device", L"Driver"
+};
+
+static std::vector<UCHAR> MakeObjectTypes(const wchar_t* const* names, size_t count, bool typeIndex)
+{
+    std::vector<UCHAR> buffer(ALIGN_UP(offsetof(OBJECT_TYPES_INFORMATION, TypeInformation), ULONG_PTR));
+    ((OBJECT_TYPES_INFORMATION*)buffer.data())->NumberOfTypes = (ULONG)count;
+    for (size_t i = 0; i < count; ++i)
+        AppendObjectType(buffer, names[i], typeIndex ? (UCHAR)(i + 2) : 0, 10, 20);
+    return buffer;
+}
+
+// The bitmap has exactly the bits of types
+static bool BitmapIs(const ULONG* bitmap, std::initializer_list<USHORT> types)
+{
+    ULONG expected[BAD_OBJECT_TYPE_BITMAP_ULONGS] = {};
+    for (const USHORT type : types)
+        expected[type / 32] |= 1UL << (type % 32);
+    return memcmp(bitmap, expected, sizeof(expected)) == 0;
+}
+
+static bool Parse(const std::vector<UCHAR>& buffer, const WCHAR* typeNames, ULONG* bitmap, size_t length = SIZE_MAX)
+{
+    return ParseBadObjectTypes(buffer.data(), (ULONG)MIN(length, buffer.size()), typeNames, bitmap);
+}
+
+static void TestWindowsVersions()
+{
+    ULONG bitmap[BAD_OBJECT_TYPE_BITMAP_ULONGS];
+
+    // Windows 7: the index is the position in the table plus 2
+    const std::vector<UCHAR> windows7 = MakeObjectTypes(Windows7Types, _countof(Windows7Types), false);
+    CHECK(Parse(windows7, DefaultTypes, bitmap));
+    CHECK(BitmapIs(bitmap, { 7, 8, 11 }));
+
+    // Windows 10, generated by MakeFilterCorpus
+    std::vector<UCHAR> windows10;
+    CHECK(ReadFile(std::string(FILTER_CORPUS_DIR) + "/object-types.bin", &windows10) && !windows10.empty());
+    windows10.erase(windows10.begin()); // FilterKind
+    CHECK(Parse(windows10, DefaultTypes, bitmap));
+    CHECK(BitmapIs(bitmap, { FilterTestBadObjectTypes[0], FilterTestBadObjectTypes[1], FilterTestBadObjectTypes[2] }));
+
+    const std::vector<UCHAR> windows11 = MakeObjectTypes(Windows11Types, _countof(Windows11Types), true);
+    CHECK(Parse(windows11, DefaultTypes, bitmap));
+    CHECK(BitmapIs(bitmap, { 7, 8, 18 }));
+
+    // Since 8.1 the reported index counts, not the position
+    std::vector<UCHAR> reordered(ALIGN_UP(offsetof(OBJECT_TYPES_INFORMATION, TypeInformation), ULONG_PTR));
+    ((OBJECT_TYPES_INFORMATION*)reordered.data())->NumberOfTypes = 3;
+    AppendObjectType(reordered, L"DebugObject", 40, 1, 1);
+    AppendObjectType(reordered, L"Event", 2, 1, 1);
+    AppendObjectType(reordered, L"Thread", 255, 1, 1);
+    CHECK(Parse(reordered, DefaultTypes, bitmap));
+    CHECK(BitmapIs(bitmap, { 40, 255 }));
+}
+
+// Every ObjectTypes file of the corpus parses completely, the partial one does not
+static void TestCorpus()
+{
+    int parsed = 0;
+    for (const auto& file : LoadCorpus(FILTER_CORPUS_DIR))
+    {
+        if (file.Data.empty() || file.Data[0] != FilterKindObjectTypes)
+            continue;
+        const std::vector<UCHAR> buffer(file.Data.begin() + 1, file.Data.end());
+        ULONG bitmap[BAD_OBJECT_TYPE_BITMAP_ULONGS];
+        const bool complete = Parse(buffer, DefaultTypes, bitmap);
+        if (complete != (file.Name.find("partial") == std::string::npos))
+        {
+            printf("FAIL %s: parsed %d\n", file.Name.c_str(), complete);
+            ++failures;
+        }
+        parsed++;
+    }
+    CHECK(parsed >= 2);
+}
+
+static void TestTypeNames()
+{
+    ULONG bitmap[BAD_OBJECT_TYPE_BITMAP_ULONGS];
+    const std::vector<UCHAR> windows7 = MakeObjectTypes(Windows7Types, _countof(Windows7Types), false);
+
+    CHECK(Parse(windows7, L"Token;ALPC Port", bitmap));
+    CHECK(BitmapIs(bitmap, { 5, 36 }));
+    CHECK(Parse(windows7, L";;Thread;", bitmap));
+    CHECK(BitmapIs(bitmap, { 8 }));
+    CHECK(Parse(windows7, L"", bitmap));
+    CHECK(BitmapIs(bitmap, {}));
+
+    // Whole names only, compared like the kernel names them
+    CHECK(Parse(windows7, L"Debug;DebugObjectX;debugobject;Process ", bitmap));
+    CHECK(BitmapIs(bitmap, {}));
+}
+
+// A buffer that is cut short, or claims more types than it has, is never reported as complete and leaves no bits
+static void TestIncompleteBuffers()
+{
+    ULONG bitmap[BAD_OBJECT_TYPE_BITMAP_ULONGS];
+    const std::vector<UCHAR> windows11 = MakeObjectTypes(Windows11Types, _countof(Windows11Types), true);
+    for (size_t length = 0; length < windows11.size(); ++length)
+    {
+        // The last name is padded to a ULONG_PTR boundary, which the parser requires up to MaximumLength only
+        const bool complete = Parse(windows11, DefaultTypes, bitmap, length);
+        if (complete && windows11.size() - length >= sizeof(ULONG_PTR))
+        {
+            printf("FAIL complete at length %zu of %zu\n", length, windows11.size());
+            ++failures;
+        }
+        if (!complete && !BitmapIs(bitmap, {}))
+        {
+            printf("FAIL bits left at length %zu\n", length);
+            ++failures;
+        }
+    }
+
+    std::vector<UCHAR> overstated = windows11;
+    ((OBJECT_TYPES_INFORMATION*)overstated.data())->NumberOfTypes++;
+    CHECK(!Parse(overstated, DefaultTypes, bitmap) && BitmapIs(bitmap, {}));
+
+    std::vector<UCHAR> empty(ALIGN_UP(offsetof(OBJECT_TYPES_INFORMATION, TypeInformation), ULONG_PTR));
+    CHECK(!Parse(empty, DefaultTypes, bitmap));
+    CHECK(!ParseBadObjectTypes(nullptr, 0x1000, DefaultTypes, bitmap));
+
+    // A name longer than its maximum length
+    std::vector<UCHAR> badName = windows11;
+    OBJECT_TYPE_INFORMATION* first = (OBJECT_TYPE_INFORMATION*)(badName.data() + ALIGN_UP(offsetof(OBJECT_TYPES_INFORMATION, TypeInformation), ULONG_PTR));
+    first->TypeName.Length = first->TypeName.MaximumLength + 2;
+    CHECK(!Parse(badName, DefaultTypes, bitmap) && BitmapIs(bitmap, {}));
+}
+
+// Before 8.1 the position decides the index, and a table with more than 254 types must not overflow the bitmap
+static void TestDenseIndexOutOfRange()
+{
+    std::vector<UCHAR> buffer(ALIGN_UP(offsetof(OBJECT_TYPES_INFORMATION, TypeInformation), ULONG_PTR));
+    ((OBJECT_TYPES_INFORMATION*)buffer.data())->NumberOfTypes = 300;
+    for (int i = 0; i < 300; ++i)
+        AppendObjectType(buffer, i == 5 || i == 290 ? L"Process" : L"Other", 0, 1, 1);
+
+    ULONG bitmap[BAD_OBJECT_TYPE_BITMAP_ULONGS];
+    CHECK(Parse(buffer, DefaultTypes, bitmap));
+    CHECK(BitmapIs(bitmap, { 7 }));
+}
+
+int main()
+{
+    TestWindowsVersions();
+    TestCorpus();
+    TestTypeNames();
+    TestIncompleteBuffers();
+    TestDenseIndexOutOfRange();
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+// Loads PE files for the tests and maps them the way the Windows loader would, without relocations or imports.
+// The sample images are the PE32 files that ship in SCMRevGen/ (GnuWin32 date.exe, libiconv2.dll and libintl3.dll)
+
+#include <windows.h>
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+static const char* const SampleImages[] =
+{
+    SAMPLE_IMAGE_DIR "/date.exe",
+    SAMPLE_IMAGE_DIR "/libiconv2.dll",
+    SAMPLE_IMAGE_DIR "/libintl3.dll",
+};
+
+inline bool ReadFileBytes(const char* path, std::vector<BYTE>& bytes)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr)
+        return false;
+    fseek(file, 0, SEEK_END);
+    bytes.resize((size_t)ftell(file));
+    fseek(file, 0, SEEK_SET);
+    const bool ok = fread(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    fclose(file);
+    return ok;
+}
+
+struct PeImage
+{
+    std::vector<BYTE> File;
+    std::vector<BYTE> Mapped;   // SizeOfImage bytes with the headers and sections at their RVAs
+    bool Is64 = false;
+    ULONGLONG ImageBase = 0;
+    DWORD SizeOfImage = 0;
+    DWORD SizeOfHeaders = 0;
+    std::vector<IMAGE_SECTION_HEADER> Sections;
+    std::vector<IMAGE_DATA_DIRECTORY> DataDirectories;
+
+    bool Load(const char* path)
+    {
+        return ReadFileBytes(path, File) && Parse();
+    }
+
+    bool Parse()
+    {
+        if (File.size() < sizeof(IMAGE_DOS_HEADER))
+            return false;
+        IMAGE_DOS_HEADER dos;
+        memcpy(&dos, File.data(), sizeof(dos));
+        if (dos.e_magic != IMAGE_DOS_SIGNATURE || dos.e_lfanew < 0 || (size_t)dos.e_lfanew + sizeof(IMAGE_NT_HEADERS64) > File.size())
+            return false;
+
+        const BYTE* nt = File.data() + dos.e_lfanew;
+        IMAGE_FILE_HEADER fileHeader;
+        memcpy(&fileHeader, nt + sizeof(DWORD), sizeof(fileHeader));
+        WORD magic;
+        memcpy(&magic, nt + sizeof(DWORD) + sizeof(IMAGE_FILE_HEADER), sizeof(magic));
+        Is64 = magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC;
+        if (Is64)
+        {
+            IMAGE_NT_HEADERS64 headers;
+            memcpy(&headers, nt, sizeof(headers));
+            ImageBase = headers.OptionalHeader.ImageBase;
+            SizeOfImage = headers.OptionalHeader.SizeOfImage;
+            SizeOfHeaders = headers.OptionalHeader.SizeOfHeaders;
+            DataDirectories.assign(headers.OptionalHeader.DataDirectory, headers.OptionalHeader.DataDirectory + IMAGE_NUMBEROF_DIRECTORY_ENTRIES);
+        }
+        else if (magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC)
+        {
+            IMAGE_NT_HEADERS32 headers;
+            memcpy(&headers, nt, sizeof(headers));
+            ImageBase = headers.OptionalHeader.ImageBase;
+            SizeOfImage = headers.OptionalHeader.SizeOfImage;
+            SizeOfHeaders = headers.OptionalHeader.SizeOfHeaders;
+            DataDirectories.assign(headers.OptionalHeader.DataDirectory, headers.OptionalHeader.DataDirectory + IMAGE_NUMBEROF_DIRECTORY_ENTRIES);
+        }
+        else
+            return false;
+
+        const size_t sectionsOffset = dos.e_lfanew + sizeof(DWORD) + sizeof(IMAGE_FILE_HEADER) + fileHeader.SizeOfOptionalHeader;
+        if (sectionsOffset + fileHeader.NumberOfSections * sizeof(IMAGE_SECTION_HEADER) > File.size())
+            return false;
+        Sections.resize(fileHeader.NumberOfSections);
+        memcpy(Sections.data(), File.data() + sectionsOffset, Sections.size() * sizeof(IMAGE_SECTION_HEADER));
+
+        Mapped.assign(SizeOfImage, 0);
+        memcpy(Mapped.data(), File.data(), std::min<size_t>({ SizeOfHeaders, File.size(), Mapped.size() }));
+        for (const auto& section : Sections)
+        {
+            const size_t rawSize = std::min<size_t>(section.SizeOfRawData, section.Misc.VirtualSize != 0 ? section.Misc.VirtualSize : section.SizeOfRawData);
+            if (section.PointerToRawData + rawSize > File.size() || section.VirtualAddress + rawSize > Mapped.size())
+                return false;
+            memcpy(Mapped.data() + section.VirtualAddress, File.data() + section.PointerToRawData, rawSize);
+        }
+        return true;
+    }
+
+    // Returns the mapped bytes at the RVA, or nullptr if [rva, rva + size) is not inside the image
+    const BYTE* AtRva(DWORD rva, DWORD size) const
+    {
+        if ((ULONGLONG)rva + size > Mapped.size())
+            return nullptr;
+        return Mapped.data() + rva;
+    }
+
+    // Returns the first resource with the given type ID, e.g. 16 for RT_VERSION
+    bool FindResource(WORD type, std::vector<BYTE>& data) const
+    {
+        if (DataDirectories.size() <= IMAGE_DIRECTORY_ENTRY_RESOURCE)
+            return false;
+        const IMAGE_DATA_DIRECTORY& directory = DataDirectories[IMAGE_DIRECTORY_ENTRY_RESOURCE];
+        DWORD offset = 0; // Of the current directory in the resource section
+        for (int level = 0; level < 3; ++level)
+        {
+            IMAGE_RESOURCE_DIRECTORY header;
+            const BYTE* p = AtRva(directory.VirtualAddress + offset, sizeof(header));
+            if (p == nullptr)
+                return false;
+            memcpy(&header, p, sizeof(header));
+            const DWORD numEntries = header.NumberOfNamedEntries + header.NumberOfIdEntries;
+            const BYTE* entries = AtRva(directory.VirtualAddress + offset + sizeof(header), numEntries * sizeof(IMAGE_RESOURCE_DIRECTORY_ENTRY));
+            if (entries == nullptr || numEntries == 0)
+                return false;
+
+            // Type by ID at the first level, any name and language below that
+            IMAGE_RESOURCE_DIRECTORY_ENTRY entry;
+            DWORD i = 0;
+            for (; i < numEntries; ++i)
+            {
+                memcpy(&entry, entries + i * sizeof(entry), sizeof(entry));
+                if (level != 0 || ((entry.Name & IMAGE_RESOURCE_NAME_IS_STRING) == 0 && entry.Name == type))
+                    break;
+            }
+            if (i == numEntries)
+                return false;
+
+            const bool isDirectory = (entry.OffsetToData & IMAGE_RESOURCE_DATA_IS_DIRECTORY) != 0;
+            offset = entry.OffsetToData & ~IMAGE_RESOURCE_DATA_IS_DIRECTORY;
+            if (level < 2 && !isDirectory)
+                return false;
+        }
+
+        IMAGE_RESOURCE_DATA_ENTRY dataEntry;
+        const BYTE* p = AtRva(directory.VirtualAddress + offset, sizeof(dataEntry));
+        if (p == nullptr)
+            return false;
+        memcpy(&dataEntry, p, sizeof(dataEntry));
+        p = AtRva(dataEntry.OffsetToData, dataEntry.Size);
+        if (p == nullptr)
+            return false;
+        data.assign(p, p + dataEntry.Size);
+        return true;
+    }
+};
@@ -0,0 +1,328 @@
+#include <ntdll/ntdll.h>
+#include "ProcessHookState.h"
+
+#include <cstdio>
+#include <map>
+#include <random>
+#include <vector>
+
+// Replays scripted debug event sequences through the process hook state machine the Generic and TitanEngine plugins
+// share: launch and attach, the PEB fix around the ntdll load, the first breakpoint, DLLs loaded after hooking,
+// exits with a PEB fix still pending, several processes interleaved and the TitanEngine plugin without an ntdll base.
+// Then random event streams, checked against the rules the plugins rely on
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what, int line)
+{
+    if (!condition)
+    {
+        printf("FAIL line %d: %s\n", line, what);
+        ++failures;
+    }
+}
+#define CHECK(condition) Check(condition, #condition, __LINE__)
+
+// Stands in for HOOK_DLL_DATA, which the tracker only zeroes
+struct FakeHookData
+{
+    DWORD Values[4];
+};
+
+typedef BasicProcessHookStatus<FakeHookData> FakeStatus;
+typedef BasicProcessHookTracker<FakeHookData> FakeTracker;
+
+static BYTE NtdllImage[16];
+static BYTE OtherDll[16];
+static BYTE StartAddress[16];
+static const void* const Ntdll = NtdllImage;
+
+static DEBUG_EVENT CreateProcessEvent(DWORD pid, bool attach)
+{
+    DEBUG_EVENT event = {};
+    event.dwDebugEventCode = CREATE_PROCESS_DEBUG_EVENT;
+    event.dwProcessId = pid;
+    event.u.CreateProcessInfo.lpStartAddress = attach ? nullptr : StartAddress;
+    return event;
+}
+
+static DEBUG_EVENT LoadDllEvent(DWORD pid, const void* base)
+{
+    DEBUG_EVENT event = {};
+    event.dwDebugEventCode = LOAD_DLL_DEBUG_EVENT;
+    event.dwProcessId = pid;
+    event.u.LoadDll.lpBaseOfDll = (PVOID)base;
+    return event;
+}
+
+static DEBUG_EVENT ExceptionEvent(DWORD pid, DWORD code)
+{
+    DEBUG_EVENT event = {};
+    event.dwDebugEventCode = EXCEPTION_DEBUG_EVENT;
+    event.dwProcessId = pid;
+    event.u.Exception.ExceptionRecord.ExceptionCode = code;
+    return event;
+}
+
+static DEBUG_EVENT Event(DWORD pid, DWORD code)
+{
+    DEBUG_EVENT event = {};
+    event.dwDebugEventCode = code;
+    event.dwProcessId = pid;
+    return event;
+}
+
+static const DWORD Breakpoint = (DWORD)STATUS_BREAKPOINT;
+
+// Delivers an event the way the plugins do: OnDebugEvent, carry out the actions, OnActionsDone
+static unsigned int Deliver(FakeTracker& tracker, const DEBUG_EVENT& event, const void* ntdllBase = Ntdll, bool fixPeb = true)
+{
+    const unsigned int actions = tracker.OnDebugEvent(event, ntdllBase, fixPeb);
+    tracker.OnActionsDone(event.dwProcessId);
+    return actions;
+}
+
+static ProcessHookState StateOf(FakeTracker& tracker, DWORD pid)
+{
+    const FakeStatus* status = tracker.Find(pid);
+    return status != nullptr ? status->State : ProcessHookState::Exited;
+}
+
+static void TestLaunch()
+{
+    FakeTracker tracker;
+    CHECK(Deliver(tracker, CreateProcessEvent(100, false)) == ProcessHookActionNone);
+    CHECK(StateOf(tracker, 100) == ProcessHookState::Created);
+
+    // The PEB fix is applied for the ntdll load event and undone on the next event
+    CHECK(Deliver(tracker, LoadDllEvent(100, Ntdll)) == ProcessHookActionApplyPebFix);
+    CHECK(StateOf(tracker, 100) == ProcessHookState::NtdllLoaded);
+    CHECK(tracker.Find(100)->specialPebFix);
+    CHECK(Deliver(tracker, Event(100, CREATE_THREAD_DEBUG_EVENT)) == ProcessHookActionUndoPebFix);
+    CHECK(!tracker.Find(100)->specialPebFix);
+
+    // Only the first breakpoint injects, other exceptions never do
+    CHECK(Deliver(tracker, ExceptionEvent(100, (DWORD)STATUS_ACCESS_VIOLATION)) == ProcessHookActionNone);
+    CHECK(Deliver(tracker, ExceptionEvent(100, Breakpoint)) == ProcessHookActionInject);
+    CHECK(StateOf(tracker, 100) == ProcessHookState::Hooked);
+    CHECK(Deliver(tracker, ExceptionEvent(100, Breakpoint)) == ProcessHookActionNone);
+
+    // A DLL loaded after hooking is hooked too, and the state is back to Hooked once that is done
+    CHECK(tracker.OnDebugEvent(LoadDllEvent(100, OtherDll), Ntdll, true) == ProcessHookActionReinject);
+    CHECK(StateOf(tracker, 100) == ProcessHookState::RehookPending);
+    CHECK(tracker.OnDebugEvent(LoadDllEvent(100, OtherDll), Ntdll, true) == ProcessHookActionReinject);
+    tracker.OnActionsDone(100);
+    CHECK(StateOf(tracker, 100) == ProcessHookState::Hooked);
+
+    // The entry stays for the exit event and is removed afterwards
+    CHECK(tracker.OnDebugEvent(Event(100, EXIT_PROCESS_DEBUG_EVENT), Ntdll, true) == ProcessHookActionNone);
+    CHECK(StateOf(tracker, 100) == ProcessHookState::Exited);
+    CHECK(tracker.Find(100) != nullptr);
+    tracker.OnActionsDone(100);
+    CHECK(tracker.Find(100) == nullptr);
+    tracker.OnActionsDone(100);
+}
+
+static void TestAttach()
+{
+    FakeTracker tracker;
+    CHECK(Deliver(tracker, CreateProcessEvent(200, true)) == ProcessHookActionAntiAntiAttach);
+    // ntdll is already loaded in a process that is attached to, its load event comes before the attach breakpoint
+    CHECK(Deliver(tracker, LoadDllEvent(200, OtherDll)) == ProcessHookActionNone);
+    CHECK(Deliver(tracker, LoadDllEvent(200, Ntdll)) == ProcessHookActionApplyPebFix);
+    CHECK(Deliver(tracker, ExceptionEvent(200, Breakpoint)) == (ProcessHookActionUndoPebFix | ProcessHookActionInject));
+    CHECK(StateOf(tracker, 200) == ProcessHookState::Hooked);
+}
+
+static void TestWithoutPebFix()
+{
+    FakeTracker tracker;
+    CHECK(Deliver(tracker, CreateProcessEvent(300, false), Ntdll, false) == ProcessHookActionNone);
+    CHECK(Deliver(tracker, LoadDllEvent(300, Ntdll), Ntdll, false) == ProcessHookActionNone);
+    CHECK(StateOf(tracker, 300) == ProcessHookState::NtdllLoaded);
+    CHECK(!tracker.Find(300)->specialPebFix);
+    CHECK(Deliver(tracker, ExceptionEvent(300, Breakpoint), Ntdll, false) == ProcessHookActionInject);
+}
+
+static void TestExitWithPendingPebFix()
+{
+    FakeTracker tracker;
+    Deliver(tracker, CreateProcessEvent(400, false));
+    CHECK(Deliver(tracker, LoadDllEvent(400, Ntdll)) == ProcessHookActionApplyPebFix);
+    // There is nothing to undo in a process that is gone
+    CHECK(Deliver(tracker, Event(400, EXIT_PROCESS_DEBUG_EVENT)) == ProcessHookActionNone);
+    CHECK(tracker.Find(400) == nullptr);
+
+    // The process id is reused by a new process, which starts over
+    CHECK(Deliver(tracker, CreateProcessEvent(400, false)) == ProcessHookActionNone);
+    CHECK(StateOf(tracker, 400) == ProcessHookState::Created);
+    CHECK(!tracker.Find(400)->specialPebFix);
+}
+
+static void TestInterleavedProcesses()
+{
+    FakeTracker tracker;
+    Deliver(tracker, CreateProcessEvent(1, false));
+    CHECK(Deliver(tracker, LoadDllEvent(1, Ntdll)) == ProcessHookActionApplyPebFix);
+    // The PEB fix of process 1 is still pending while process 2 is created
+    CHECK(Deliver(tracker, CreateProcessEvent(2, false)) == ProcessHookActionNone);
+    CHECK(Deliver(tracker, LoadDllEvent(2, Ntdll)) == ProcessHookActionApplyPebFix);
+    CHECK(Deliver(tracker, ExceptionEvent(1, Breakpoint)) == (ProcessHookActionUndoPebFix | ProcessHookActionInject));
+    CHECK(StateOf(tracker, 1) == ProcessHookState::Hooked);
+    CHECK(StateOf(tracker, 2) == ProcessHookState::NtdllLoaded);
+    CHECK(Deliver(tracker, LoadDllEvent(1, OtherDll)) == ProcessHookActionReinject);
+    CHECK(Deliver(tracker, LoadDllEvent(2, OtherDll)) == ProcessHookActionUndoPebFix);
+    CHECK(Deliver(tracker, Event(1, EXIT_PROCESS_DEBUG_EVENT)) == ProcessHookActionNone);
+    CHECK(tracker.Find(1) == nullptr);
+    CHECK(Deliver(tracker, ExceptionEvent(2, Breakpoint)) == ProcessHookActionInject);
+
+    // Each process has its own injection data
+    tracker.Find(2)->hdd.Values[0] = 0x1234;
+    Deliver(tracker, CreateProcessEvent(3, false));
+    CHECK(tracker.Find(3)->hdd.Values[0] == 0);
+    CHECK(tracker.Find(2)->hdd.Values[0] == 0x1234);
+
+    tracker.Clear();
+    CHECK(tracker.Find(2) == nullptr && tracker.Find(3) == nullptr);
+}
+
+static void TestTitanEngine()
+{
+    // TitanEngine loads ntdll itself, so the plugin passes no ntdll base and every DLL is an ordinary one
+    FakeTracker tracker;
+    CHECK(Deliver(tracker, CreateProcessEvent(500, false), nullptr, false) == ProcessHookActionNone);
+    CHECK(Deliver(tracker, LoadDllEvent(500, Ntdll), nullptr, false) == ProcessHookActionNone);
+    CHECK(StateOf(tracker, 500) == ProcessHookState::Created);
+    CHECK(Deliver(tracker, ExceptionEvent(500, Breakpoint), nullptr, false) == ProcessHookActionInject);
+    CHECK(Deliver(tracker, LoadDllEvent(500, Ntdll), nullptr, false) == ProcessHookActionReinject);
+}
+
+static void TestEventBeforeCreate()
+{
+    // Events of a process the tracker has not seen created, e.g. after a plugin reset, start from Created
+    FakeTracker tracker;
+    CHECK(Deliver(tracker, ExceptionEvent(600, Breakpoint)) == ProcessHookActionInject);
+    CHECK(StateOf(tracker, 600) == ProcessHookState::Hooked);
+
+    // A CREATE_PROCESS event always starts over
+    CHECK(Deliver(tracker, CreateProcessEvent(600, false)) == ProcessHookActionNone);
+    CHECK(StateOf(tracker, 600) == ProcessHookState::Created);
+}
+
+// What the plugin would have done to a process, to check the action stream against
+struct ProcessModel
+{
+    bool Alive = false;
+    bool PebFixApplied = false;
+    bool Injected = false;
+    int Injections = 0;
+};
+
+static void TestRandomStreams()
+{
+    std::mt19937 rng(43);
+    const void* const dlls[] = { Ntdll, OtherDll, StartAddress };
+    int injections = 0, reinjections = 0;
+
+    for (int stream = 0; stream < 2000; ++stream)
+    {
+        FakeTracker tracker;
+        std::map<DWORD, ProcessModel> model;
+        const bool fixPeb = rng() % 2 != 0;
+        const void* ntdllBase = rng() % 8 != 0 ? Ntdll : nullptr;
+        const bool strict = ntdllBase != nullptr;
+
+        for (int i = 0; i < 200; ++i)
+        {
+            const DWORD pid = 1 + rng() % 3;
+            ProcessModel& process = model[pid];
+            DEBUG_EVENT event;
+            const unsigned kind = rng() % 100;
+            if (!process.Alive || kind < 3)
+                event = CreateProcessEvent(pid, rng() % 2 != 0);
+            else if (kind < 40)
+                event = LoadDllEvent(pid, dlls[rng() % _countof(dlls)]);
+            else if (kind < 60)
+                event = ExceptionEvent(pid, rng() % 2 != 0 ? Breakpoint : (DWORD)STATUS_SINGLE_STEP);
+            else if (kind < 65)
+                event = Event(pid, EXIT_PROCESS_DEBUG_EVENT);
+            else
+                event = Event(pid, rng() % 2 != 0 ? CREATE_THREAD_DEBUG_EVENT : OUTPUT_DEBUG_STRING_EVENT);
+
+            const unsigned int actions = tracker.OnDebugEvent(event, ntdllBase, fixPeb);
+            const DWORD code = event.dwDebugEventCode;
+
+            // A PEB fix is undone on the next event of the same process, unless that is the exit
+            if ((actions & ProcessHookActionUndoPebFix) != 0)
+            {
+                CHECK(process.PebFixApplied);
+                CHECK(code != EXIT_PROCESS_DEBUG_EVENT);
+                process.PebFixApplied = false;
+            }
+            CHECK(!process.PebFixApplied || code == EXIT_PROCESS_DEBUG_EVENT);
+
+            if (code == CREATE_PROCESS_DEBUG_EVENT)
+            {
+                process = ProcessModel();
+                process.Alive = true;
+                CHECK(((actions & ProcessHookActionAntiAntiAttach) != 0) == (event.u.CreateProcessInfo.lpStartAddress == nullptr));
+            }
+            else
+                CHECK((actions & ProcessHookActionAntiAntiAttach) == 0);
+            const bool isBreakpoint = code == EXCEPTION_DEBUG_EVENT && event.u.Exception.ExceptionRecord.ExceptionCode == Breakpoint;
+            const bool isNtdllLoad = code == LOAD_DLL_DEBUG_EVENT && event.u.LoadDll.lpBaseOfDll == ntdllBase;
+            const bool isOtherLoad = code == LOAD_DLL_DEBUG_EVENT && !isNtdllLoad;
+
+            // The PEB fix covers every ntdll load event when it is enabled, and only those
+            CHECK(((actions & ProcessHookActionApplyPebFix) != 0) == (fixPeb && strict && isNtdllLoad));
+            if ((actions & ProcessHookActionApplyPebFix) != 0)
+                process.PebFixApplied = true;
+
+            // Injected once per process lifetime, on its first breakpoint
+            CHECK(((actions & ProcessHookActionInject) != 0) == (isBreakpoint && !process.Injected));
+            if ((actions & ProcessHookActionInject) != 0)
+            {
+                process.Injected = true;
+                ++process.Injections;
+                ++injections;
+            }
+            CHECK(process.Injections <= 1);
+
+            // Reinjected into a hooked process for every DLL but ntdll
+            CHECK(((actions & ProcessHookActionReinject) != 0) == (process.Injected && isOtherLoad));
+            reinjections += (actions & ProcessHookActionReinject) != 0;
+
+            if (code == EXIT_PROCESS_DEBUG_EVENT)
+            {
+                CHECK(actions == ProcessHookActionNone);
+                process = ProcessModel();
+            }
+
+            tracker.OnActionsDone(pid);
+            const FakeStatus* status = tracker.Find(pid);
+            CHECK((status != nullptr) == process.Alive);
+            if (status != nullptr)
+            {
+                CHECK(status->State != ProcessHookState::Exited && status->State != ProcessHookState::RehookPending);
+                CHECK((status->State == ProcessHookState::Hooked) == process.Injected);
+                CHECK(status->specialPebFix == process.PebFixApplied);
+            }
+        }
+    }
+    printf("%d injections, %d reinjections\n", injections, reinjections);
+}
+
+int main()
+{
+    TestLaunch();
+    TestAttach();
+    TestWithoutPebFix();
+    TestExitWithPendingPebFix();
+    TestInterleavedProcesses();
+    TestTitanEngine();
+    TestEventBeforeCreate();
+    TestRandomStreams();
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
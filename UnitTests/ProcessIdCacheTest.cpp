@@ -0,0 +1,415 @@
+#include <ntdll/ntdll.h>
+#include "ProcessIdCache.h"
+
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+// The explorer PID cache of GetExplorerProcessId on a fake process table. PIDs are reused lowest free first, but only
+// once the process has exited and its last handle is closed, like the kernel does. Explorer is restarted, PIDs are
+// reused between the snapshot and the open, and lookups run while another thread holds the snapshot. The cache must
+// never report a PID that belongs to another process once it has validated it, never leak a handle, and take a
+// snapshot only when explorer exits or the negative cache interval is over
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what, int line)
+{
+    if (!condition)
+    {
+        printf("FAIL line %d: %s\n", line, what);
+        ++failures;
+    }
+}
+#define CHECK(condition) Check(condition, #condition, __LINE__)
+
+static const char* const ExplorerName = "explorer.exe";
+
+class FakeProcessTable
+{
+public:
+    struct Process
+    {
+        std::string Name;
+        LONGLONG CreateTime;
+        LONGLONG ExitTime;
+        int Handles;
+        bool Openable;
+    };
+
+    DWORD Start(const std::string& name, bool openable = true)
+    {
+        DWORD pid = 4;
+        while (processes_.count(pid) != 0)
+            pid += 4;
+        processes_[pid] = { name, ++now_, 0, 0, openable };
+        return pid;
+    }
+
+    // The PID stays in use until the last handle to the process is closed
+    void Exit(DWORD pid)
+    {
+        Process& process = processes_.at(pid);
+        if (process.ExitTime == 0)
+            process.ExitTime = ++now_;
+        Release(pid);
+    }
+
+    // The live explorer, 0 if none
+    DWORD Explorer() const
+    {
+        for (const auto& entry : processes_)
+        {
+            if (entry.second.Name == ExplorerName && entry.second.ExitTime == 0)
+                return entry.first;
+        }
+        return 0;
+    }
+
+    bool IsLive(DWORD pid, const char* name) const
+    {
+        const auto it = processes_.find(pid);
+        return it != processes_.end() && it->second.ExitTime == 0 && it->second.Name == name;
+    }
+
+    size_t OpenHandles() const { return handles_.size(); }
+
+    DWORD FindByName(PLARGE_INTEGER createTime)
+    {
+        Snapshots++;
+        const DWORD pid = Explorer();
+        if (pid != 0)
+            createTime->QuadPart = processes_[pid].CreateTime;
+        if (AfterSnapshot)
+        {
+            // Run once, like a race that happens once
+            const std::function<void(DWORD)> afterSnapshot = AfterSnapshot;
+            AfterSnapshot = nullptr;
+            afterSnapshot(pid);
+        }
+        return pid;
+    }
+
+    NTSTATUS Open(DWORD pid, PHANDLE handle)
+    {
+        const auto it = processes_.find(pid);
+        if (it == processes_.end())
+            return STATUS_INVALID_CID;
+        if (!it->second.Openable)
+            return STATUS_ACCESS_DENIED;
+        it->second.Handles++;
+        const ULONG value = nextHandle_ += 4;
+        handles_[value] = pid;
+        *handle = ULongToHandle(value);
+        return STATUS_SUCCESS;
+    }
+
+    NTSTATUS QueryTimes(HANDLE handle, PKERNEL_USER_TIMES times)
+    {
+        Queries++;
+        const auto it = handles_.find(HandleToULong(handle));
+        if (it == handles_.end())
+        {
+            BadHandles++;
+            return STATUS_INVALID_HANDLE;
+        }
+        const Process& process = processes_.at(it->second);
+        times->CreateTime.QuadPart = process.CreateTime;
+        times->ExitTime.QuadPart = process.ExitTime;
+        times->KernelTime.QuadPart = times->UserTime.QuadPart = 0;
+        return STATUS_SUCCESS;
+    }
+
+    void Close(HANDLE handle)
+    {
+        const auto it = handles_.find(HandleToULong(handle));
+        if (it == handles_.end())
+        {
+            BadHandles++;
+            return;
+        }
+        const DWORD pid = it->second;
+        handles_.erase(it);
+        processes_.at(pid).Handles--;
+        Release(pid);
+    }
+
+    ULONG Tick = 1;
+    int Snapshots = 0;
+    int Queries = 0;
+    int BadHandles = 0;
+    std::function<void(DWORD)> AfterSnapshot; // Runs between the snapshot and the open
+
+private:
+    void Release(DWORD pid)
+    {
+        const Process& process = processes_.at(pid);
+        if (process.ExitTime != 0 && process.Handles == 0)
+            processes_.erase(pid);
+    }
+
+    std::map<DWORD, Process> processes_;
+    std::map<ULONG, DWORD> handles_;
+    LONGLONG now_ = 1000;
+    ULONG nextHandle_ = 0x100;
+};
+
+static DWORD FakeFindByName(void* context, PLARGE_INTEGER createTime) { return static_cast<FakeProcessTable*>(context)->FindByName(createTime); }
+static NTSTATUS FakeOpen(void* context, DWORD pid, PHANDLE handle) { return static_cast<FakeProcessTable*>(context)->Open(pid, handle); }
+static NTSTATUS FakeQueryTimes(void* context, HANDLE handle, PKERNEL_USER_TIMES times) { return static_cast<FakeProcessTable*>(context)->QueryTimes(handle, times); }
+static void FakeClose(void* context, HANDLE handle) { static_cast<FakeProcessTable*>(context)->Close(handle); }
+static ULONG FakeTickCount(void* context) { return static_cast<FakeProcessTable*>(context)->Tick; }
+
+static const PROCESS_ID_CACHE_OPS FakeOps = { FakeFindByName, FakeOpen, FakeQueryTimes, FakeClose, FakeTickCount };
+
+static DWORD Lookup(PROCESS_ID_CACHE* cache, FakeProcessTable* table)
+{
+    const DWORD pid = ProcessIdCacheLookup(cache, &FakeOps, table);
+    CHECK(table->OpenHandles() <= 1);
+    CHECK(table->BadHandles == 0);
+    CHECK(cache->Busy == 0);
+    return pid;
+}
+
+// Explorer runs all along: one snapshot, then one ProcessTimes query per call
+static void TestRunning()
+{
+    FakeProcessTable table;
+    table.Start("System");
+    const DWORD explorer = table.Start(ExplorerName);
+    PROCESS_ID_CACHE cache = {};
+
+    for (int i = 0; i < 1000; ++i)
+    {
+        CHECK(Lookup(&cache, &table) == explorer);
+        table.Tick += 7;
+    }
+    CHECK(table.Snapshots == 1);
+    CHECK(table.Queries == 1 + 999); // The open validates with a query too
+    CHECK(table.OpenHandles() == 1);
+}
+
+// Our handle keeps the old PID from being reused, so the new explorer has a new PID, and the old one is released
+// when the exit is noticed
+static void TestRestart()
+{
+    FakeProcessTable table;
+    const DWORD first = table.Start(ExplorerName);
+    PROCESS_ID_CACHE cache = {};
+    CHECK(Lookup(&cache, &table) == first);
+
+    table.Exit(first);
+    const DWORD second = table.Start(ExplorerName);
+    CHECK(second != first);
+    CHECK(Lookup(&cache, &table) == second);
+    CHECK(table.Snapshots == 2);
+    CHECK(table.Start("notepad.exe") == first); // The old PID is free again
+    CHECK(Lookup(&cache, &table) == second);
+    CHECK(table.Snapshots == 2);
+}
+
+// Explorer exits after the snapshot and another process gets its PID before the open: the creation time does not
+// match, so the PID is not reported, and the result is cached for the interval
+static void TestReusedBeforeOpen()
+{
+    FakeProcessTable table;
+    const DWORD explorer = table.Start(ExplorerName);
+    table.AfterSnapshot = [&table](DWORD pid)
+    {
+        table.Exit(pid);
+        table.Start("notepad.exe");
+    };
+    PROCESS_ID_CACHE cache = {};
+    CHECK(Lookup(&cache, &table) == 0);
+    CHECK(table.IsLive(explorer, "notepad.exe"));
+    CHECK(table.OpenHandles() == 0);
+
+    const DWORD restarted = table.Start(ExplorerName);
+    table.Tick += PROCESS_ID_CACHE_INTERVAL - 1;
+    CHECK(Lookup(&cache, &table) == 0);
+    CHECK(table.Snapshots == 1);
+    table.Tick += 1;
+    CHECK(Lookup(&cache, &table) == restarted);
+    CHECK(table.Snapshots == 2);
+}
+
+// Explorer exits after the snapshot and its PID is free when we open it
+static void TestExitedBeforeOpen()
+{
+    FakeProcessTable table;
+    table.Start(ExplorerName);
+    table.AfterSnapshot = [&table](DWORD pid) { table.Exit(pid); };
+    PROCESS_ID_CACHE cache = {};
+    CHECK(Lookup(&cache, &table) == 0);
+    CHECK(table.OpenHandles() == 0);
+}
+
+// Explorer exits after the snapshot but someone else still has a handle to it, so the open succeeds on the exited process
+static void TestExitedButOpen()
+{
+    FakeProcessTable table;
+    const DWORD explorer = table.Start(ExplorerName);
+    HANDLE other;
+    CHECK(table.Open(explorer, &other) == STATUS_SUCCESS);
+    table.AfterSnapshot = [&table](DWORD pid) { table.Exit(pid); };
+    PROCESS_ID_CACHE cache = {};
+    CHECK(ProcessIdCacheLookup(&cache, &FakeOps, &table) == 0);
+    CHECK(table.OpenHandles() == 1); // Only the other handle
+    table.Close(other);
+}
+
+// No explorer: a snapshot per interval, not per call
+static void TestNotRunning()
+{
+    FakeProcessTable table;
+    table.Start("System");
+    PROCESS_ID_CACHE cache = {};
+    for (int i = 0; i < 5000; ++i)
+    {
+        CHECK(Lookup(&cache, &table) == 0);
+        table.Tick += 1;
+    }
+    CHECK(table.Snapshots == 5);
+
+    const DWORD explorer = table.Start(ExplorerName);
+    int calls = 0;
+    while (Lookup(&cache, &table) != explorer && calls < 2 * PROCESS_ID_CACHE_INTERVAL)
+    {
+        table.Tick += 1;
+        ++calls;
+    }
+    CHECK(calls < PROCESS_ID_CACHE_INTERVAL);
+    CHECK(table.Snapshots == 6);
+}
+
+// An explorer we cannot open (another session) is reported without validation, with a snapshot per interval
+static void TestNotOpenable()
+{
+    FakeProcessTable table;
+    const DWORD explorer = table.Start(ExplorerName, false);
+    PROCESS_ID_CACHE cache = {};
+    for (int i = 0; i < 3000; ++i)
+    {
+        CHECK(Lookup(&cache, &table) == explorer);
+        table.Tick += 1;
+    }
+    CHECK(table.Snapshots == 3);
+    CHECK(table.OpenHandles() == 0);
+}
+
+// The negative cache across the 49.7 day wraparound of the tick count, including a lookup at tick 0
+static void TestTickWraparound()
+{
+    for (const ULONG start : { 0xFFFFFFFFUL - 300, 0xFFFFFFFFUL, 0UL })
+    {
+        FakeProcessTable table;
+        table.Tick = start;
+        PROCESS_ID_CACHE cache = {};
+        CHECK(Lookup(&cache, &table) == 0);
+        for (ULONG i = 1; i < PROCESS_ID_CACHE_INTERVAL - 1; ++i)
+        {
+            table.Tick = start + i;
+            Lookup(&cache, &table);
+        }
+        CHECK(table.Snapshots == 1);
+        table.Tick = start + PROCESS_ID_CACHE_INTERVAL + 1;
+        Lookup(&cache, &table);
+        CHECK(table.Snapshots == 2);
+    }
+}
+
+// Lookups on other threads while one thread takes the snapshot return the previous result and take no snapshot
+static void TestConcurrentLookup()
+{
+    FakeProcessTable table;
+    const DWORD first = table.Start(ExplorerName);
+    PROCESS_ID_CACHE cache = {};
+    CHECK(Lookup(&cache, &table) == first);
+    table.Exit(first);
+    const DWORD second = table.Start(ExplorerName);
+
+    DWORD concurrent = 1;
+    table.AfterSnapshot = [&](DWORD) { concurrent = ProcessIdCacheLookup(&cache, &FakeOps, &table); };
+    CHECK(Lookup(&cache, &table) == second);
+    CHECK(concurrent == first);
+    CHECK(table.Snapshots == 2);
+}
+
+// Random process table histories with explorer openable: every PID reported is a live explorer, or 0
+static void TestRandomHistories()
+{
+    std::mt19937 rng(1);
+    for (int round = 0; round < 300; ++round)
+    {
+        FakeProcessTable table;
+        table.Tick = rng();
+        PROCESS_ID_CACHE cache = {};
+        std::vector<DWORD> others;
+        for (int step = 0; step < 400; ++step)
+        {
+            switch (rng() % 8)
+            {
+            case 0:
+                if (table.Explorer() == 0)
+                    table.Start(ExplorerName);
+                break;
+            case 1:
+                if (table.Explorer() != 0)
+                    table.Exit(table.Explorer());
+                break;
+            case 2:
+                others.push_back(table.Start("notepad.exe"));
+                break;
+            case 3:
+                if (!others.empty())
+                {
+                    table.Exit(others.back());
+                    others.pop_back();
+                }
+                break;
+            case 4:
+                table.AfterSnapshot = [&table, &others](DWORD pid)
+                {
+                    if (pid != 0)
+                        table.Exit(pid);
+                    others.push_back(table.Start("notepad.exe"));
+                };
+                break;
+            default:
+                table.Tick += rng() % (2 * PROCESS_ID_CACHE_INTERVAL);
+                const DWORD pid = Lookup(&cache, &table);
+                if (pid != 0 && !table.IsLive(pid, ExplorerName))
+                {
+                    printf("FAIL random history %d step %d: reported PID %u is not explorer\n", round, step, pid);
+                    ++failures;
+                    return;
+                }
+                break;
+            }
+            table.AfterSnapshot = step % 50 == 0 ? nullptr : table.AfterSnapshot;
+        }
+        if (cache.Process != nullptr)
+            FakeClose(&table, cache.Process);
+        CHECK(table.OpenHandles() == 0);
+    }
+}
+
+int main()
+{
+    TestRunning();
+    TestRestart();
+    TestReusedBeforeOpen();
+    TestExitedBeforeOpen();
+    TestExitedButOpen();
+    TestNotRunning();
+    TestNotOpenable();
+    TestTickWraparound();
+    TestConcurrentLookup();
+    TestRandomHistories();
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,252 @@
+#include "FilterHarness.h"
+#include "BufferFilters.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <set>
+
+// The protected PID set of the handle filters: CollectProtectedProcessIds on SystemProcessInformation snapshots
+// against a reference implementation, on truncated and corrupted snapshots, and IsProcessIdInSet against
+// std::binary_search
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what, int line)
+{
+    if (!condition)
+    {
+        printf("FAIL line %d: %s\n", line, what);
+        ++failures;
+    }
+}
+#define CHECK(condition) Check(condition, #condition, __LINE__)
+
+struct TestProcess
+{
+    ULONG Pid;
+    const wchar_t* Name;
+};
+
+// No wcslen or std::wstring, WCHAR is not the wchar_t of the C library with -fshort-wchar
+static size_t NameLength(const wchar_t* name)
+{
+    size_t length = 0;
+    while (name[length] != L'\0')
+        length++;
+    return length;
+}
+
+static bool NamesEqualCaseInsensitive(const wchar_t* a, const wchar_t* b)
+{
+    for (;; ++a, ++b)
+    {
+        const wchar_t ca = *a >= L'A' && *a <= L'Z' ? *a + (L'a' - L'A') : *a;
+        const wchar_t cb = *b >= L'A' && *b <= L'Z' ? *b + (L'a' - L'A') : *b;
+        if (ca != cb)
+            return false;
+        if (ca == L'\0')
+            return true;
+    }
+}
+
+// The snapshot layout of NtQuerySystemInformation: an entry with its threads, then the image name, the next entry
+// aligned after it. ImageName.Buffer points into the buffer
+static std::vector<UCHAR> MakeSnapshot(const std::vector<TestProcess>& processes)
+{
+    std::vector<UCHAR> buffer;
+    std::vector<size_t> offsets;
+    for (const auto& process : processes)
+    {
+        offsets.push_back(buffer.size());
+        const size_t nameOffset = buffer.size() + sizeof(SYSTEM_PROCESS_INFORMATION);
+        const size_t nameBytes = NameLength(process.Name) * sizeof(WCHAR);
+        buffer.resize(ALIGN_UP(nameOffset + nameBytes + sizeof(WCHAR), ULONG_PTR));
+        memcpy(buffer.data() + nameOffset, process.Name, nameBytes);
+    }
+    for (size_t i = 0; i < processes.size(); ++i)
+    {
+        SYSTEM_PROCESS_INFORMATION entry = SYSTEM_PROCESS_INFORMATION();
+        entry.NextEntryOffset = i + 1 < processes.size() ? (ULONG)(offsets[i + 1] - offsets[i]) : 0;
+        entry.NumberOfThreads = 1;
+        entry.UniqueProcessId = ULongToHandle(processes[i].Pid);
+        entry.ImageName.Length = (USHORT)(NameLength(processes[i].Name) * sizeof(WCHAR));
+        entry.ImageName.MaximumLength = entry.ImageName.Length + sizeof(WCHAR);
+        entry.ImageName.Buffer = entry.ImageName.Length != 0 ? (PWSTR)(buffer.data() + offsets[i] + sizeof(entry)) : nullptr;
+        memcpy(buffer.data() + offsets[i], &entry, sizeof(entry));
+    }
+    return buffer;
+}
+
+static std::vector<ULONG> Collect(const std::vector<UCHAR>& snapshot, size_t length, ULONG protectedPid, const WCHAR* names, ULONG maxPids = MAX_PROTECTED_PROCESS_IDS)
+{
+    std::vector<ULONG> pids(maxPids + 1, 0xCCCCCCCC);
+    const ULONG count = CollectProtectedProcessIds((const SYSTEM_PROCESS_INFORMATION*)snapshot.data(), (ULONG)length, protectedPid, names, pids.data(), maxPids);
+    CHECK(count <= maxPids && pids[maxPids] == 0xCCCCCCCC);
+    pids.resize(MIN(count, maxPids));
+    return pids;
+}
+
+// What CollectProtectedProcessIds should return: the protected PID and every PID with a listed name, sorted
+static std::vector<ULONG> Expected(const std::vector<TestProcess>& processes, ULONG protectedPid, std::initializer_list<const wchar_t*> names)
+{
+    std::set<ULONG> pids;
+    if (protectedPid != 0)
+        pids.insert(protectedPid);
+    for (const auto& process : processes)
+    {
+        for (const auto& name : names)
+        {
+            if (name[0] != L'\0' && NamesEqualCaseInsensitive(name, process.Name))
+                pids.insert(process.Pid);
+        }
+    }
+    return std::vector<ULONG>(pids.begin(), pids.end());
+}
+
+static const std::vector<TestProcess> Desktop =
+{
+    { 0, L"" }, { 4, L"System" }, { 600, L"csrss.exe" }, { 1234, L"x64dbg.exe" }, { 4242, L"x96dbg.exe" },
+    { 5120, L"explorer.exe" }, { 7788, L"WIN64_REMOTE64.EXE" }, { 8000, L"win32_remote.exe.bak" }, { 9000, L"target.exe" }
+};
+
+static void TestNames()
+{
+    const std::vector<UCHAR> snapshot = MakeSnapshot(Desktop);
+    const WCHAR names[] = L"x96dbg.exe;win32_remote.exe;win64_remote64.exe";
+
+    CHECK(Collect(snapshot, snapshot.size(), 1234, names) == (std::vector<ULONG>{ 1234, 4242, 7788 }));
+    CHECK(Collect(snapshot, snapshot.size(), 0, names) == (std::vector<ULONG>{ 4242, 7788 }));
+
+    // The protected PID is sorted in like the others, and is there once even if its name is listed too
+    CHECK(Collect(snapshot, snapshot.size(), 4242, names) == (std::vector<ULONG>{ 4242, 7788 }));
+    CHECK(Collect(snapshot, snapshot.size(), 9999, names) == (std::vector<ULONG>{ 4242, 7788, 9999 }));
+
+    // No names, no snapshot matches. The idle process has no name and never matches
+    CHECK(Collect(snapshot, snapshot.size(), 1234, L"") == (std::vector<ULONG>{ 1234 }));
+    CHECK(Collect(snapshot, snapshot.size(), 0, L";;") == (std::vector<ULONG>{}));
+    CHECK(Collect(snapshot, snapshot.size(), 0, L"x96dbg;.exe;x96dbg.exe ") == (std::vector<ULONG>{}));
+    CHECK(Collect(snapshot, snapshot.size(), 0, L";target.exe;") == (std::vector<ULONG>{ 9000 }));
+
+    CHECK(Collect(snapshot, snapshot.size(), 1234, names, 1) == (std::vector<ULONG>{ 1234 }));
+    CHECK(Collect(snapshot, snapshot.size(), 1234, names, 0).empty());
+}
+
+// A set that is full keeps the PIDs found first, sorted
+static void TestFullSet()
+{
+    std::vector<TestProcess> processes;
+    for (ULONG i = 0; i < 200; ++i)
+        processes.push_back({ 100000 - i * 4, L"helper.exe" });
+    const std::vector<UCHAR> snapshot = MakeSnapshot(processes);
+
+    const std::vector<ULONG> pids = Collect(snapshot, snapshot.size(), 7, L"helper.exe");
+    CHECK(pids.size() == MAX_PROTECTED_PROCESS_IDS);
+    CHECK(pids[0] == 7 && std::is_sorted(pids.begin(), pids.end()));
+    CHECK(pids.back() == 100000 && pids[1] == 100000 - (MAX_PROTECTED_PROCESS_IDS - 2) * 4);
+}
+
+// Every truncation of the snapshot, and entries that point outside of it. The snapshot is copied to a buffer of
+// exactly the truncated size each time, so AddressSanitizer builds catch reads past the end
+static void TestTruncatedAndCorrupted()
+{
+    const std::vector<UCHAR> snapshot = MakeSnapshot(Desktop);
+    const std::vector<ULONG> full = Expected(Desktop, 1, { L"x96dbg.exe", L"win64_remote64.exe", L"target.exe" });
+    const WCHAR names[] = L"x96dbg.exe;win64_remote64.exe;target.exe";
+    for (size_t length = 0; length <= snapshot.size(); ++length)
+    {
+        std::vector<UCHAR> truncated(snapshot.begin(), snapshot.begin() + length);
+        // The names still point into the original snapshot: rebase them like the kernel would have written them
+        for (size_t offset = 0; offset + sizeof(SYSTEM_PROCESS_INFORMATION) <= length;)
+        {
+            SYSTEM_PROCESS_INFORMATION* entry = (SYSTEM_PROCESS_INFORMATION*)(truncated.data() + offset);
+            if (entry->ImageName.Buffer != nullptr)
+                entry->ImageName.Buffer = (PWSTR)(truncated.data() + ((const UCHAR*)entry->ImageName.Buffer - snapshot.data()));
+            if (entry->NextEntryOffset == 0)
+                break;
+            offset += entry->NextEntryOffset;
+        }
+
+        const std::vector<ULONG> pids = Collect(truncated, length, 1, names);
+        if (!std::includes(full.begin(), full.end(), pids.begin(), pids.end()) || pids.empty() || pids[0] != 1)
+        {
+            printf("FAIL truncated to %zu bytes: %zu PIDs\n", length, pids.size());
+            ++failures;
+        }
+    }
+
+    // A next entry offset past the end, and a name that points outside the snapshot
+    std::vector<UCHAR> corrupted = snapshot;
+    SYSTEM_PROCESS_INFORMATION* first = (SYSTEM_PROCESS_INFORMATION*)corrupted.data();
+    SYSTEM_PROCESS_INFORMATION* second = (SYSTEM_PROCESS_INFORMATION*)(corrupted.data() + first->NextEntryOffset);
+    static const WCHAR outside[] = L"x96dbg.exe";
+    second->ImageName.Buffer = (PWSTR)outside;
+    second->ImageName.Length = sizeof(outside) - sizeof(WCHAR);
+    second->NextEntryOffset = 0x7FFFFFF0;
+    CHECK(Collect(corrupted, corrupted.size(), 0, names).empty());
+
+    CHECK(Collect(corrupted, 0, 1, names) == (std::vector<ULONG>{ 1 }));
+}
+
+// Random snapshots with duplicate and differently cased names against the reference
+static void TestRandomSnapshots()
+{
+    static const wchar_t* const Names[] = { L"a.exe", L"B.exe", L"b.EXE", L"helper.exe", L"ida64.exe", L"svchost.exe", L"" };
+    std::mt19937 rng(1);
+    for (int round = 0; round < 2000; ++round)
+    {
+        std::vector<TestProcess> processes;
+        std::set<ULONG> used;
+        const size_t count = rng() % 40;
+        while (processes.size() < count)
+        {
+            const ULONG pid = 4 * (1 + rng() % 5000);
+            if (used.insert(pid).second)
+                processes.push_back({ pid, Names[rng() % _countof(Names)] });
+        }
+        const ULONG protectedPid = rng() % 3 == 0 ? 0 : 4 * (1 + rng() % 5000);
+        const std::vector<UCHAR> snapshot = MakeSnapshot(processes);
+
+        const std::vector<ULONG> pids = Collect(snapshot, snapshot.size(), protectedPid, L"b.exe;HELPER.EXE");
+        if (pids != Expected(processes, protectedPid, { L"b.exe", L"HELPER.EXE" }))
+        {
+            printf("FAIL random snapshot %d\n", round);
+            ++failures;
+        }
+    }
+}
+
+static void TestIsProcessIdInSet()
+{
+    std::mt19937 rng(2);
+    for (ULONG count = 0; count <= MAX_PROTECTED_PROCESS_IDS; ++count)
+    {
+        std::set<ULONG> unique;
+        while (unique.size() < count)
+            unique.insert(rng() % 512);
+        const std::vector<ULONG> pids(unique.begin(), unique.end());
+        for (ULONG pid = 0; pid < 520; ++pid)
+        {
+            if (IsProcessIdInSet(pids.data(), count, pid) != std::binary_search(pids.begin(), pids.end(), pid))
+            {
+                printf("FAIL IsProcessIdInSet(%u PIDs, %u)\n", count, pid);
+                ++failures;
+            }
+        }
+    }
+    CHECK(!IsProcessIdInSet(nullptr, 0, 0));
+    const ULONG extremes[] = { 0, 0xFFFFFFFF };
+    CHECK(IsProcessIdInSet(extremes, 2, 0) && IsProcessIdInSet(extremes, 2, 0xFFFFFFFF) && !IsProcessIdInSet(extremes, 2, 1));
+}
+
+int main()
+{
+    TestNames();
+    TestFullSet();
+    TestTruncatedAndCorrupted();
+    TestRandomSnapshots();
+    TestIsProcessIdInSet();
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <windows.h>
+#include <random>
+
+// Fills buf with 16 random bytes. A third of the streams start with a prefix or the 0F escape, which
+// purely random bytes would rarely produce in the combinations that matter
+inline void RandomInstruction(std::mt19937_64& rng, BYTE buf[16])
+{
+    static const BYTE prefixes[] = { 0x0F, 0x26, 0x2E, 0x36, 0x3E, 0x41, 0x48, 0x4C, 0x64, 0x65, 0x66, 0x67, 0xF2, 0xF3 };
+
+    for (int i = 0; i < 16; ++i)
+        buf[i] = (BYTE)rng();
+    if (rng() % 3 == 0)
+        buf[0] = prefixes[rng() % sizeof(prefixes)];
+    if (rng() % 4 == 0)
+        buf[1] = 0x0F;
+}
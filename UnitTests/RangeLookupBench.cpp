@@ -0,0 +1,156 @@
+#include <ntdll/ntdll.h>
+#include "PeImage.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+// The return address filter of the instrumentation callback, on a stream of syscall return addresses of which one in
+// a hundred is inside the exe (SCMRevGen/date.exe, mapped). Compares the filter before InstrumentationCallbackAsm
+// did it (recursion guard, RtlImageNtHeader and range check in C++ on every return), the stored range the assembly
+// stub compares against now, and a sorted table of module ranges searched with a binary search, for when the
+// callback would need to act on more than one module
+//
+//   RangeLookupBench [returns]
+
+using Clock = std::chrono::steady_clock;
+
+template<typename TFunction>
+static double BestNs(TFunction function, int rounds)
+{
+    double best = 1e30;
+    for (int round = 0; round < rounds; ++round)
+    {
+        const auto start = Clock::now();
+        function();
+        const double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        if (ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+// What RtlImageNtHeader checks before returning the NT headers
+static const IMAGE_NT_HEADERS32* ImageNtHeader(const void* base)
+{
+    const IMAGE_DOS_HEADER* dos = static_cast<const IMAGE_DOS_HEADER*>(base);
+    if (dos->e_magic != IMAGE_DOS_SIGNATURE || dos->e_lfanew < 0 || dos->e_lfanew >= 256 * 1024 * 1024)
+        return nullptr;
+    const IMAGE_NT_HEADERS32* nt = reinterpret_cast<const IMAGE_NT_HEADERS32*>(static_cast<const UCHAR*>(base) + dos->e_lfanew);
+    return nt->Signature == IMAGE_NT_SIGNATURE ? nt : nullptr;
+}
+
+struct Range
+{
+    ULONG_PTR Start;
+    ULONG_PTR End;
+};
+
+static bool InSortedRanges(const std::vector<Range>& ranges, ULONG_PTR address)
+{
+    size_t low = 0, high = ranges.size();
+    while (low < high)
+    {
+        const size_t middle = (low + high) / 2;
+        if (address < ranges[middle].Start)
+            high = middle;
+        else if (address >= ranges[middle].End)
+            low = middle + 1;
+        else
+            return true;
+    }
+    return false;
+}
+
+static volatile LONG CallbackDisabled = 0; // Stands in for the TEB recursion guard
+
+int main(int argc, char* argv[])
+{
+    const size_t numReturns = argc > 1 ? strtoul(argv[1], nullptr, 0) : 1000000;
+
+    PeImage exe;
+    if (!exe.Load(SampleImages[0]))
+    {
+        printf("Cannot load %s\n", SampleImages[0]);
+        return 1;
+    }
+    const ULONG_PTR imageBase = (ULONG_PTR)exe.Mapped.data();
+    const ULONG_PTR imageEnd = imageBase + exe.SizeOfImage;
+
+    // The other modules syscalls return into (ntdll, win32u, ...), at made up addresses above the exe
+    std::mt19937_64 rng(1);
+    std::vector<Range> modules;
+    ULONG_PTR next = (imageEnd + 0xFFFFF) & ~(ULONG_PTR)0xFFFFF;
+    for (int i = 0; i < 64; ++i)
+    {
+        const ULONG_PTR size = 0x10000 + (rng() % 64) * 0x10000;
+        modules.push_back({ next, next + size });
+        next += size + 0x100000;
+    }
+
+    std::vector<ULONG_PTR> returns(numReturns);
+    for (ULONG_PTR& address : returns)
+    {
+        if (rng() % 100 == 0)
+            address = imageBase + rng() % exe.SizeOfImage;
+        else
+        {
+            const Range& module = modules[rng() % 8]; // Most syscalls return into a handful of modules
+            address = module.Start + rng() % (module.End - module.Start);
+        }
+    }
+
+    ULONG_PTR rangeStart = imageBase, rangeEnd = imageEnd;
+    volatile size_t sink = 0;
+
+    const double before = BestNs([&]
+    {
+        size_t hits = 0;
+        for (const ULONG_PTR address : returns)
+        {
+            if (__sync_fetch_and_or(&CallbackDisabled, 1) == 1)
+                continue;
+            const IMAGE_NT_HEADERS32* nt = ImageNtHeader(exe.Mapped.data());
+            if (nt != nullptr && address >= imageBase && address < imageBase + nt->OptionalHeader.SizeOfImage)
+                hits++;
+            __sync_fetch_and_and(&CallbackDisabled, 0);
+        }
+        sink = sink + hits;
+    }, 20);
+
+    const double stored = BestNs([&]
+    {
+        size_t hits = 0;
+        for (const ULONG_PTR address : returns)
+        {
+            // Reloaded on every return like the assembly stub does
+            if (address >= *(volatile ULONG_PTR*)&rangeStart && address < *(volatile ULONG_PTR*)&rangeEnd)
+                hits++;
+        }
+        sink = sink + hits;
+    }, 20);
+
+    printf("%zu returns, %.0f%% into the exe\n", numReturns, 100.0 * std::count_if(returns.begin(), returns.end(),
+        [&](ULONG_PTR address) { return address >= imageBase && address < imageEnd; }) / numReturns);
+    printf("Guard + RtlImageNtHeader + range: %6.2f ns/return\n", before / numReturns);
+    printf("Stored range:                     %6.2f ns/return\n", stored / numReturns);
+
+    for (const size_t numRanges : { 1, 8, 64 })
+    {
+        std::vector<Range> table(modules.begin(), modules.begin() + numRanges - 1);
+        table.push_back({ imageBase, imageEnd });
+        std::sort(table.begin(), table.end(), [](const Range& a, const Range& b) { return a.Start < b.Start; });
+        const double sorted = BestNs([&]
+        {
+            size_t hits = 0;
+            for (const ULONG_PTR address : returns)
+                hits += InSortedRanges(table, address);
+            sink = sink + hits;
+        }, 20);
+        printf("Sorted table of %2zu ranges:        %6.2f ns/return\n", numRanges, sorted / numReturns);
+    }
+    return 0;
+}
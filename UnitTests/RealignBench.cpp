@@ -0,0 +1,140 @@
+#include <ntdll/ntdll.h>
+#include "ImageRealign.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// RealignImageForFile on a synthetic mapped image of 50MB (by default) with a few dozen sections, against a plain
+// memcpy of the same bytes. Then the two ways of writing the dump: the realigned file with one write, as
+// WriteMemoryToFile does, and the headers and each section with a write of their own, as it did before
+//
+//   RealignBench [megabytes] [sections]
+
+using Clock = std::chrono::steady_clock;
+
+template<typename TFunction>
+static double BestNs(TFunction function, int rounds)
+{
+    double best = 1e30;
+    for (int round = 0; round < rounds; ++round)
+    {
+        const auto start = Clock::now();
+        function();
+        const double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        if (ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+static const DWORD SectionAlignment = 0x1000;
+static const DWORD FileAlignment = 0x200;
+static const LONG NtOffset = 0x80;
+
+// Sections of random sizes filling the image, each with a raw size a bit short of its virtual size
+static std::vector<BYTE> MakeImage(size_t imageSize, WORD numSections)
+{
+    std::vector<BYTE> image(imageSize, 0);
+    IMAGE_DOS_HEADER dos = {};
+    dos.e_magic = IMAGE_DOS_SIGNATURE;
+    dos.e_lfanew = NtOffset;
+    memcpy(image.data(), &dos, sizeof(dos));
+
+    IMAGE_NT_HEADERS64 nt = {};
+    nt.Signature = IMAGE_NT_SIGNATURE;
+    nt.FileHeader.Machine = IMAGE_FILE_MACHINE_AMD64;
+    nt.FileHeader.NumberOfSections = numSections;
+    nt.FileHeader.SizeOfOptionalHeader = sizeof(IMAGE_OPTIONAL_HEADER64);
+    nt.OptionalHeader.Magic = IMAGE_NT_OPTIONAL_HDR64_MAGIC;
+    nt.OptionalHeader.SectionAlignment = SectionAlignment;
+    nt.OptionalHeader.FileAlignment = FileAlignment;
+    nt.OptionalHeader.SizeOfImage = (DWORD)imageSize;
+    nt.OptionalHeader.SizeOfHeaders = SectionAlignment;
+    memcpy(image.data() + NtOffset, &nt, sizeof(nt));
+
+    std::mt19937 rng(50);
+    const DWORD pages = (DWORD)(imageSize / SectionAlignment) - 1;
+    DWORD virtualAddress = SectionAlignment;
+    for (WORD i = 0; i < numSections; ++i)
+    {
+        const DWORD remaining = (DWORD)imageSize - virtualAddress;
+        const DWORD size = i + 1 == numSections ? remaining :
+            std::min<DWORD>(remaining, (1 + rng() % std::max<DWORD>(1, 2 * pages / numSections)) * SectionAlignment);
+        IMAGE_SECTION_HEADER section = {};
+        section.Misc.VirtualSize = size;
+        section.VirtualAddress = virtualAddress;
+        section.SizeOfRawData = size < SectionAlignment ? size : size - (rng() % (SectionAlignment / FileAlignment)) * FileAlignment;
+        memcpy(image.data() + NtOffset + sizeof(nt) + i * sizeof(section), &section, sizeof(section));
+        for (DWORD offset = 0; offset < section.SizeOfRawData; offset += 64)
+            image[virtualAddress + offset] = (BYTE)rng();
+        virtualAddress += size;
+    }
+    return image;
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t megabytes = argc > 1 ? strtoul(argv[1], nullptr, 0) : 50;
+    const WORD numSections = argc > 2 ? (WORD)strtoul(argv[2], nullptr, 0) : 32;
+    const std::vector<BYTE> image = MakeImage(megabytes << 20, numSections);
+
+    const ULONG fileSize = RealignImageForFile(image.data(), (DWORD)image.size(), nullptr, 0);
+    if (fileSize == 0)
+    {
+        printf("Invalid image\n");
+        return 1;
+    }
+    std::vector<BYTE> file(fileSize);
+    std::vector<BYTE> copy(image.size());
+    volatile ULONG sink = 0;
+
+    const double sizePass = BestNs([&] { sink = sink + RealignImageForFile(image.data(), (DWORD)image.size(), nullptr, 0); }, 50);
+    const double realign = BestNs([&] { sink = sink + RealignImageForFile(image.data(), (DWORD)image.size(), file.data(), fileSize); }, 10);
+    const double memcpyNs = BestNs([&] { memcpy(copy.data(), image.data(), image.size()); sink = sink + copy[fileSize / 2]; }, 10);
+
+    printf("%zu MB image, %u sections, %u byte file\n", megabytes, numSections, fileSize);
+    printf("Size pass:        %10.3f ms\n", sizePass / 1e6);
+    printf("Realign:          %10.3f ms (%.2f GB/s)\n", realign / 1e6, fileSize / realign);
+    printf("memcpy of image:  %10.3f ms (%.2f GB/s)\n", memcpyNs / 1e6, image.size() / memcpyNs);
+
+    char path[] = "/tmp/RealignBench.XXXXXX";
+    const int fd = mkstemp(path);
+    if (fd < 0)
+    {
+        printf("Cannot create %s\n", path);
+        return 1;
+    }
+
+    const double single = BestNs([&]
+    {
+        ftruncate(fd, 0);
+        sink = sink + (ULONG)pwrite(fd, file.data(), fileSize, 0);
+    }, 10);
+
+    // The headers, then every section at its realigned offset, straight from the mapped image
+    IMAGE_SECTION_HEADER sections[0x100];
+    const WORD numWritten = std::min<WORD>(numSections, 0x100);
+    memcpy(sections, file.data() + NtOffset + sizeof(IMAGE_NT_HEADERS64), numWritten * sizeof(IMAGE_SECTION_HEADER));
+    IMAGE_SECTION_HEADER originalSections[0x100];
+    memcpy(originalSections, image.data() + NtOffset + sizeof(IMAGE_NT_HEADERS64), numWritten * sizeof(IMAGE_SECTION_HEADER));
+    const double perSection = BestNs([&]
+    {
+        ftruncate(fd, 0);
+        sink = sink + (ULONG)pwrite(fd, file.data(), SectionAlignment, 0);
+        for (WORD i = 0; i < numWritten; ++i)
+            sink = sink + (ULONG)pwrite(fd, image.data() + originalSections[i].VirtualAddress, sections[i].SizeOfRawData, sections[i].PointerToRawData);
+    }, 10);
+
+    close(fd);
+    unlink(path);
+
+    printf("One write:        %10.3f ms\n", single / 1e6);
+    printf("Write per section:%10.3f ms (%u writes)\n", perSection / 1e6, numWritten + 1);
+    return 0;
+}
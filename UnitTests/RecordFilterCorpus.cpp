@@ -0,0 +1,136 @@
+// Records the buffers the filter tests replay on a real system. Windows only and not part of the CMake project,
+// build it as 64 bit with the Visual Studio command prompt and run it from UnitTests:
+//
+//   cl /EHsc RecordFilterCorpus.cpp && RecordFilterCorpus.exe corpus
+//
+// Recorded handle tables and process lists contain the PIDs and processes of that system rather than those of
+// FilterHarness.h, so they check bounds and compaction but hide nothing unless x64dbg.exe or ida64.exe were running.
+// The recorded window list marks the windows of those two as bad. The files are named after the Windows build, so
+// recordings of several versions can sit side by side. None have been checked in yet: corpus/ only has the files
+// MakeFilterCorpus generates
+
+#include <windows.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <wchar.h>
+
+static_assert(sizeof(void*) == 8, "The corpus is in the x64 layout");
+
+typedef LONG (NTAPI *t_NtQuerySystemInformation)(ULONG, PVOID, ULONG, PULONG);
+typedef LONG (NTAPI *t_NtQueryObject)(HANDLE, ULONG, PVOID, ULONG, PULONG);
+typedef LONG (NTAPI *t_RtlGetVersion)(PRTL_OSVERSIONINFOW);
+
+// Same values as FilterKind in FilterHarness.h
+enum { FilterKindHandleInfo, FilterKindHandleInfoEx, FilterKindObjectTypes, FilterKindObjectType, FilterKindProcessList, FilterKindHwndList };
+
+const ULONG SystemProcessInformation = 5;
+const ULONG SystemHandleInformation = 16;
+const ULONG SystemExtendedHandleInformation = 64;
+const ULONG ObjectTypeInformation = 2;
+const ULONG ObjectTypesInformation = 3;
+const LONG StatusInfoLengthMismatch = (LONG)0xC0000004;
+
+template<typename TQuery>
+static std::vector<BYTE> Query(TQuery query)
+{
+    std::vector<BYTE> buffer(0x10000);
+    for (;;)
+    {
+        ULONG returnLength = 0;
+        const LONG status = query(buffer.data(), (ULONG)buffer.size(), &returnLength);
+        if (status == StatusInfoLengthMismatch)
+        {
+            buffer.resize(returnLength > buffer.size() * 2 ? returnLength + 0x1000 : buffer.size() * 2);
+            continue;
+        }
+        buffer.resize(status >= 0 ? returnLength : 0);
+        return buffer;
+    }
+}
+
+// The top-level windows in Z order, which is what EnumWindows gets from NtUserBuildHwndList, in the FilterKindHwndList
+// layout of FilterHarness.h. The windows of x64dbg.exe and ida64.exe are the bad ones
+static std::vector<BYTE> RecordWindows()
+{
+    std::vector<ULONGLONG> windows, badWindows;
+    EnumWindows([](HWND hwnd, LPARAM lParam) -> BOOL
+    {
+        ((std::vector<ULONGLONG>*)lParam)->push_back((ULONG_PTR)hwnd);
+        return TRUE;
+    }, (LPARAM)&windows);
+
+    for (const ULONGLONG window : windows)
+    {
+        DWORD pid = 0;
+        GetWindowThreadProcessId((HWND)(ULONG_PTR)window, &pid);
+        const HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+        if (process == nullptr)
+            continue;
+        wchar_t path[MAX_PATH];
+        DWORD size = MAX_PATH;
+        if (QueryFullProcessImageNameW(process, 0, path, &size))
+        {
+            const wchar_t* name = wcsrchr(path, L'\\') != nullptr ? wcsrchr(path, L'\\') + 1 : path;
+            if (_wcsicmp(name, L"x64dbg.exe") == 0 || _wcsicmp(name, L"ida64.exe") == 0)
+                badWindows.push_back(window);
+        }
+        CloseHandle(process);
+    }
+
+    std::vector<BYTE> buffer(2 * sizeof(ULONG) + (badWindows.size() + windows.size()) * sizeof(ULONGLONG));
+    const ULONG header[2] = { (ULONG)windows.size(), (ULONG)badWindows.size() };
+    memcpy(buffer.data(), header, sizeof(header));
+    if (!badWindows.empty())
+        memcpy(buffer.data() + sizeof(header), badWindows.data(), badWindows.size() * sizeof(ULONGLONG));
+    if (!windows.empty())
+        memcpy(buffer.data() + sizeof(header) + badWindows.size() * sizeof(ULONGLONG), windows.data(), windows.size() * sizeof(ULONGLONG));
+    return buffer;
+}
+
+// Process lists are written with the address they were recorded at, which their image names point into
+static bool Write(const std::string& directory, const char* name, ULONG build, BYTE kind, const std::vector<BYTE>& buffer)
+{
+    if (buffer.empty())
+        return false;
+    FILE* file = nullptr;
+    if (fopen_s(&file, (directory + "\\" + name + "-" + std::to_string(build) + ".bin").c_str(), "wb") != 0)
+        return false;
+    const ULONGLONG address = (ULONG_PTR)buffer.data();
+    const bool ok = fwrite(&kind, 1, 1, file) == 1 &&
+        (kind != FilterKindProcessList || fwrite(&address, sizeof(address), 1, file) == 1) &&
+        fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+    return fclose(file) == 0 && ok;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: %s <corpus directory>\n", argv[0]);
+        return 1;
+    }
+    const std::string directory = argv[1];
+
+    const HMODULE ntdll = GetModuleHandleW(L"ntdll.dll");
+    const auto NtQuerySystemInformation = (t_NtQuerySystemInformation)GetProcAddress(ntdll, "NtQuerySystemInformation");
+    const auto NtQueryObject = (t_NtQueryObject)GetProcAddress(ntdll, "NtQueryObject");
+    const auto RtlGetVersion = (t_RtlGetVersion)GetProcAddress(ntdll, "RtlGetVersion");
+    RTL_OSVERSIONINFOW version = { sizeof(version) };
+    RtlGetVersion(&version); // GetVersionEx reports 8.1 to programs without a manifest
+    const ULONG build = version.dwBuildNumber;
+
+    const bool ok =
+        Write(directory, "recorded-handles", build, FilterKindHandleInfo, Query([&](PVOID b, ULONG l, PULONG r) { return NtQuerySystemInformation(SystemHandleInformation, b, l, r); })) &&
+        Write(directory, "recorded-handles-ex", build, FilterKindHandleInfoEx, Query([&](PVOID b, ULONG l, PULONG r) { return NtQuerySystemInformation(SystemExtendedHandleInformation, b, l, r); })) &&
+        Write(directory, "recorded-object-types", build, FilterKindObjectTypes, Query([&](PVOID b, ULONG l, PULONG r) { return NtQueryObject(nullptr, ObjectTypesInformation, b, l, r); })) &&
+        Write(directory, "recorded-object-type", build, FilterKindObjectType, Query([&](PVOID b, ULONG l, PULONG r) { return NtQueryObject(GetCurrentProcess(), ObjectTypeInformation, b, l, r); })) &&
+        Write(directory, "recorded-processes", build, FilterKindProcessList, Query([&](PVOID b, ULONG l, PULONG r) { return NtQuerySystemInformation(SystemProcessInformation, b, l, r); })) &&
+        Write(directory, "recorded-hwnds", build, FilterKindHwndList, RecordWindows());
+    if (!ok)
+    {
+        fprintf(stderr, "Failed to record the corpus\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,130 @@
+#include <windows.h>
+#include "RemoteFill.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// Throughput of RemoteFillMemory into a fake debuggee whose reads and writes are a memcpy plus a fixed cost per call,
+// standing in for the process switch of _Writememory/WriteProcessMemory (1 us by default). Compared with what
+// memsetRemoteMemory did before: allocate a buffer the size of the range, memset it and write it with one call.
+// The fill is timed without a reader, and with a reader over memory that does and does not already hold the value
+//
+//   RemoteFillBench [ns per call]
+
+using Clock = std::chrono::steady_clock;
+
+template<typename TFunction>
+static double BestNs(TFunction function, int rounds)
+{
+    double best = 1e30;
+    for (int round = 0; round < rounds; ++round)
+    {
+        const auto start = Clock::now();
+        function();
+        const double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        if (ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+struct FakeDebuggee
+{
+    ULONG_PTR Base;
+    std::vector<BYTE> Memory;
+    double CallNs;
+    size_t NumCalls = 0;
+
+    void Spin() const
+    {
+        if (CallNs <= 0)
+            return;
+        const auto start = Clock::now();
+        while (std::chrono::duration<double, std::nano>(Clock::now() - start).count() < CallNs)
+        {
+        }
+    }
+
+    static SIZE_T Write(void* context, ULONG_PTR address, const void* buffer, SIZE_T size)
+    {
+        FakeDebuggee* debuggee = (FakeDebuggee*)context;
+        debuggee->Spin();
+        ++debuggee->NumCalls;
+        memcpy(debuggee->Memory.data() + (address - debuggee->Base), buffer, size);
+        return size;
+    }
+
+    static SIZE_T Read(void* context, ULONG_PTR address, void* buffer, SIZE_T size)
+    {
+        FakeDebuggee* debuggee = (FakeDebuggee*)context;
+        debuggee->Spin();
+        ++debuggee->NumCalls;
+        memcpy(buffer, debuggee->Memory.data() + (address - debuggee->Base), size);
+        return size;
+    }
+};
+
+// memsetRemoteMemory before RemoteFillMemory
+static bool OldFill(ULONG_PTR startAddress, SIZE_T size, BYTE value, FakeDebuggee& debuggee)
+{
+    BYTE* buffer = (BYTE*)malloc(size);
+    if (buffer == nullptr)
+        return false;
+    memset(buffer, value, size);
+    const bool ok = FakeDebuggee::Write(&debuggee, startAddress, buffer, size) == size;
+    free(buffer);
+    return ok;
+}
+
+int main(int argc, char* argv[])
+{
+    const double callNs = argc > 1 ? strtod(argv[1], nullptr) : 1000;
+    const SIZE_T sizes[] = { 0x1000, 0x10000, 0x100000, 0x1000000, 0x4000000 };
+
+    printf("%.0f ns per call, MB/s (calls)\n", callNs);
+    printf("%10s %18s %18s %18s %18s\n", "Bytes", "Old alloc+write", "Chunked", "Reader, filled", "Reader, unfilled");
+    for (const SIZE_T size : sizes)
+    {
+        FakeDebuggee debuggee;
+        debuggee.Base = 0x10000000;
+        debuggee.Memory.assign(size, 0x11);
+        debuggee.CallNs = callNs;
+        const int rounds = size >= 0x1000000 ? 5 : 20;
+        volatile bool sink = true;
+
+        double times[4];
+        size_t calls[4];
+
+        debuggee.NumCalls = 0;
+        times[0] = BestNs([&] { sink = sink & OldFill(debuggee.Base, size, 0xCC, debuggee); }, rounds);
+        calls[0] = debuggee.NumCalls / rounds;
+
+        debuggee.NumCalls = 0;
+        times[1] = BestNs([&] { sink = sink & RemoteFillMemory(debuggee.Base, size, 0xCC, FakeDebuggee::Write, nullptr, &debuggee); }, rounds);
+        calls[1] = debuggee.NumCalls / rounds;
+
+        debuggee.NumCalls = 0;
+        times[2] = BestNs([&] { sink = sink & RemoteFillMemory(debuggee.Base, size, 0xCC, FakeDebuggee::Write, FakeDebuggee::Read, &debuggee); }, rounds);
+        calls[2] = debuggee.NumCalls / rounds;
+
+        // Alternate the value, so that no chunk holds it yet
+        debuggee.NumCalls = 0;
+        BYTE value = 0;
+        times[3] = BestNs([&] { sink = sink & RemoteFillMemory(debuggee.Base, size, value++, FakeDebuggee::Write, FakeDebuggee::Read, &debuggee); }, rounds);
+        calls[3] = debuggee.NumCalls / rounds;
+
+        if (!sink)
+        {
+            printf("Fill failed\n");
+            return 1;
+        }
+
+        printf("%10zu", (size_t)size);
+        for (int i = 0; i < 4; ++i)
+            printf(" %9.0f (%6zu)", size / times[i] * 1e9 / (1 << 20), calls[i]);
+        printf("\n");
+    }
+    return 0;
+}
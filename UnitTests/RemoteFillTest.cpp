@@ -0,0 +1,238 @@
+#include <windows.h>
+#include "RemoteFill.h"
+
+#include <cstdio>
+#include <random>
+#include <vector>
+
+// RemoteFillMemory against a fake debuggee that records every read and write: ranges starting and ending on and off
+// page boundaries, no write crossing a page, every byte of the range written once and nothing outside it, chunks that
+// already hold the value skipped only when a reader is given, and the fill stopping at the first failed or short
+// write. Then random ranges over random memory, compared with a plain memset
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what, int line)
+{
+    if (!condition)
+    {
+        printf("FAIL line %d: %s\n", line, what);
+        ++failures;
+    }
+}
+#define CHECK(condition) Check(condition, #condition, __LINE__)
+
+struct Access
+{
+    ULONG_PTR Address;
+    SIZE_T Size;
+};
+
+struct FakeDebuggee
+{
+    ULONG_PTR Base = 0;
+    std::vector<BYTE> Memory;
+    std::vector<Access> Writes;
+    std::vector<Access> Reads;
+    size_t FailWrite = (size_t)-1;      // Index of the write that fails
+    SIZE_T ShortBy = 0;                 // Bytes missing from the failing write, 0 for a write of nothing
+    bool ReadsFail = false;
+
+    FakeDebuggee(ULONG_PTR base, size_t size, BYTE fill)
+        : Base(base), Memory(size, fill)
+    {
+    }
+
+    static SIZE_T Write(void* context, ULONG_PTR address, const void* buffer, SIZE_T size)
+    {
+        FakeDebuggee* debuggee = (FakeDebuggee*)context;
+        const size_t index = debuggee->Writes.size();
+        debuggee->Writes.push_back(Access{ address, size });
+        if (address < debuggee->Base || address - debuggee->Base + size > debuggee->Memory.size())
+            return 0;
+        SIZE_T written = size;
+        if (index == debuggee->FailWrite)
+            written = debuggee->ShortBy != 0 ? size - debuggee->ShortBy : 0;
+        memcpy(debuggee->Memory.data() + (address - debuggee->Base), buffer, written);
+        return written;
+    }
+
+    static SIZE_T Read(void* context, ULONG_PTR address, void* buffer, SIZE_T size)
+    {
+        FakeDebuggee* debuggee = (FakeDebuggee*)context;
+        debuggee->Reads.push_back(Access{ address, size });
+        if (debuggee->ReadsFail || address < debuggee->Base || address - debuggee->Base + size > debuggee->Memory.size())
+            return 0;
+        memcpy(buffer, debuggee->Memory.data() + (address - debuggee->Base), size);
+        return size;
+    }
+};
+
+static const ULONG_PTR Base = 0x10000000;
+static const SIZE_T Page = REMOTE_FILL_CHUNK_SIZE;
+
+static bool IsFilled(const FakeDebuggee& debuggee, ULONG_PTR start, SIZE_T size, BYTE value)
+{
+    for (SIZE_T i = 0; i < size; ++i)
+    {
+        if (debuggee.Memory[start - debuggee.Base + i] != value)
+            return false;
+    }
+    return true;
+}
+
+// The writes are in order, back to back, within one page each, and cover exactly [start, start + size)
+static bool WritesCover(const std::vector<Access>& writes, ULONG_PTR start, SIZE_T size)
+{
+    ULONG_PTR next = start;
+    for (const Access& write : writes)
+    {
+        if (write.Address != next || write.Size == 0 || write.Size > Page ||
+            write.Address / Page != (write.Address + write.Size - 1) / Page)
+            return false;
+        next += write.Size;
+    }
+    return next == start + size;
+}
+
+static void TestRanges()
+{
+    struct Range
+    {
+        SIZE_T Offset;
+        SIZE_T Size;
+        size_t NumWrites;
+    };
+    const Range ranges[] =
+    {
+        { 0, Page, 1 },
+        { 0, 3 * Page, 3 },
+        { 0, 1, 1 },
+        { Page - 1, 2, 2 },
+        { 0x10, Page - 0x10, 1 },
+        { 0x10, Page, 2 },
+        { 0x123, 5 * Page + 0x456, 6 },
+        { 2 * Page, Page + 1, 2 },
+        { Page - 1, 1, 1 },
+    };
+
+    for (const Range& range : ranges)
+    {
+        FakeDebuggee debuggee(Base, 8 * Page, 0x11);
+        const ULONG_PTR start = Base + Page + range.Offset;
+        CHECK(RemoteFillMemory(start, range.Size, 0xCC, FakeDebuggee::Write, nullptr, &debuggee));
+        CHECK(debuggee.Writes.size() == range.NumWrites);
+        CHECK(WritesCover(debuggee.Writes, start, range.Size));
+        CHECK(debuggee.Reads.empty());
+        CHECK(IsFilled(debuggee, start, range.Size, 0xCC));
+        CHECK(IsFilled(debuggee, Base, start - Base, 0x11));
+        CHECK(IsFilled(debuggee, start + range.Size, Base + debuggee.Memory.size() - start - range.Size, 0x11));
+    }
+
+    // Nothing to fill
+    FakeDebuggee debuggee(Base, Page, 0x11);
+    CHECK(RemoteFillMemory(Base + 0x10, 0, 0xCC, FakeDebuggee::Write, FakeDebuggee::Read, &debuggee));
+    CHECK(debuggee.Writes.empty() && debuggee.Reads.empty());
+}
+
+static void TestSkipFilled()
+{
+    // Pages 1 and 3 already hold the value, page 2 differs in its last byte
+    FakeDebuggee debuggee(Base, 6 * Page, 0x11);
+    memset(debuggee.Memory.data() + Page, 0xCC, 3 * Page);
+    debuggee.Memory[3 * Page - 1] = 0x12;
+
+    CHECK(RemoteFillMemory(Base + Page, 3 * Page, 0xCC, FakeDebuggee::Write, FakeDebuggee::Read, &debuggee));
+    CHECK(debuggee.Reads.size() == 3);
+    CHECK(debuggee.Writes.size() == 1 && debuggee.Writes[0].Address == Base + 2 * Page && debuggee.Writes[0].Size == Page);
+    CHECK(IsFilled(debuggee, Base + Page, 3 * Page, 0xCC));
+
+    // Filling it again writes nothing
+    debuggee.Writes.clear();
+    debuggee.Reads.clear();
+    CHECK(RemoteFillMemory(Base + Page + 5, 3 * Page - 10, 0xCC, FakeDebuggee::Write, FakeDebuggee::Read, &debuggee));
+    CHECK(debuggee.Writes.empty());
+    CHECK(WritesCover(debuggee.Reads, Base + Page + 5, 3 * Page - 10));
+
+    // Without a reader every chunk is written
+    debuggee.Writes.clear();
+    debuggee.Reads.clear();
+    CHECK(RemoteFillMemory(Base + Page, 3 * Page, 0xCC, FakeDebuggee::Write, nullptr, &debuggee));
+    CHECK(debuggee.Writes.size() == 3 && debuggee.Reads.empty());
+
+    // A chunk that cannot be read is written
+    debuggee.Writes.clear();
+    debuggee.ReadsFail = true;
+    CHECK(RemoteFillMemory(Base + Page, 2 * Page, 0xCC, FakeDebuggee::Write, FakeDebuggee::Read, &debuggee));
+    CHECK(debuggee.Writes.size() == 2);
+    CHECK(WritesCover(debuggee.Writes, Base + Page, 2 * Page));
+}
+
+static void TestFailedWrites()
+{
+    for (const SIZE_T shortBy : { (SIZE_T)0, (SIZE_T)1 })
+    {
+        FakeDebuggee debuggee(Base, 6 * Page, 0x11);
+        debuggee.FailWrite = 2;
+        debuggee.ShortBy = shortBy;
+        CHECK(!RemoteFillMemory(Base + 0x100, 5 * Page, 0xCC, FakeDebuggee::Write, nullptr, &debuggee));
+        // Nothing is written after the failed chunk
+        CHECK(debuggee.Writes.size() == 3);
+        CHECK(IsFilled(debuggee, Base + 0x100, 2 * Page - 0x100, 0xCC));
+        CHECK(IsFilled(debuggee, Base + 3 * Page, 3 * Page, 0x11));
+    }
+
+    // A range running past the debuggee's memory fails at the first chunk outside it
+    FakeDebuggee debuggee(Base, 2 * Page, 0x11);
+    CHECK(!RemoteFillMemory(Base + Page, 3 * Page, 0xCC, FakeDebuggee::Write, FakeDebuggee::Read, &debuggee));
+    CHECK(debuggee.Writes.size() == 2);
+    CHECK(IsFilled(debuggee, Base + Page, Page, 0xCC));
+}
+
+static void TestRandom()
+{
+    std::mt19937 rng(46);
+    for (int round = 0; round < 2000; ++round)
+    {
+        FakeDebuggee debuggee(Base, 16 * Page, 0);
+        for (BYTE& byte : debuggee.Memory)
+            byte = (BYTE)(rng() % 3 == 0 ? 0x90 : rng());
+        // Some pages already filled, so that the reader has something to skip
+        for (SIZE_T page = 0; page < 16; ++page)
+        {
+            if (rng() % 4 == 0)
+                memset(debuggee.Memory.data() + page * Page, 0x90, Page);
+        }
+        std::vector<BYTE> expected = debuggee.Memory;
+
+        const SIZE_T offset = rng() % (12 * Page);
+        const SIZE_T size = rng() % (debuggee.Memory.size() - offset + 1);
+        const bool withReader = rng() % 2 != 0;
+        memset(expected.data() + offset, 0x90, size);
+
+        const bool ok = RemoteFillMemory(Base + offset, size, 0x90, FakeDebuggee::Write, withReader ? FakeDebuggee::Read : nullptr, &debuggee);
+        if (!ok || debuggee.Memory != expected)
+        {
+            printf("FAIL fill of %#zx bytes at %#zx %s a reader\n", (size_t)size, (size_t)offset, withReader ? "with" : "without");
+            ++failures;
+            continue;
+        }
+        if (withReader)
+            CHECK(WritesCover(debuggee.Reads, Base + offset, size));
+        else
+            CHECK(WritesCover(debuggee.Writes, Base + offset, size));
+        for (const Access& write : debuggee.Writes)
+            CHECK(write.Size <= Page && write.Address / Page == (write.Address + write.Size - 1) / Page);
+    }
+}
+
+int main()
+{
+    TestRanges();
+    TestSkipFilled();
+    TestFailedWrites();
+    TestRandom();
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
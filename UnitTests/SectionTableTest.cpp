@@ -0,0 +1,338 @@
+#include <windows.h>
+#include "SectionTable.h"
+#include "PeImage.h"
+
+#include <cstdio>
+#include <vector>
+
+// The offset, RVA and VA conversions of the Olly1 advanced Ctrl+G dialog over the sample images, checked byte by byte
+// against the images mapped by PeImage, then over a crafted PE32+ image with an overlay, file alignment padding, a zero
+// filled section and a truncated section, and over malformed headers. Then the per file cache of section tables
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what, int line)
+{
+    if (!condition)
+    {
+        printf("FAIL line %d: %s\n", line, what);
+        ++failures;
+    }
+}
+#define CHECK(condition) Check(condition, #condition, __LINE__)
+
+static const DWORD Invalid = SectionTable::Invalid;
+static const DWORD_PTR InvalidVa = SectionTable::InvalidVa;
+
+// The dialog reads the first page of the file
+static const size_t HeaderBytes = 0x1000;
+
+static bool ParseFile(SectionTable& table, const std::vector<BYTE>& file, ULONGLONG fileSize)
+{
+    return table.Parse(file.data(), file.size() < HeaderBytes ? file.size() : HeaderBytes, fileSize);
+}
+
+static void TestSampleImages()
+{
+    for (const char* path : SampleImages)
+    {
+        PeImage pe;
+        if (!pe.Load(path))
+        {
+            printf("FAIL cannot load %s\n", path);
+            ++failures;
+            continue;
+        }
+
+        // An overlay after the last section, as installers and signed files have
+        const size_t imageFileSize = pe.File.size();
+        pe.File.resize(imageFileSize + 0x300, 0xAB);
+
+        SectionTable table;
+        CHECK(ParseFile(table, pe.File, pe.File.size()));
+        CHECK(table.NumSections() == pe.Sections.size());
+
+        // Every offset that converts holds the byte the loader maps at the RVA, and converts back
+        size_t mappedOffsets = 0;
+        for (DWORD offset = 0; offset < pe.File.size(); ++offset)
+        {
+            const DWORD rva = table.OffsetToRva(offset);
+            if (rva == Invalid)
+            {
+                CHECK(offset >= pe.SizeOfHeaders);
+                continue;
+            }
+            ++mappedOffsets;
+            if (rva >= pe.SizeOfImage || pe.Mapped[rva] != pe.File[offset] || table.RvaToOffset(rva) != offset)
+            {
+                printf("FAIL %s: offset %#x converts to RVA %#x\n", path, offset, rva);
+                ++failures;
+                break;
+            }
+        }
+        CHECK(mappedOffsets > imageFileSize / 2);
+        for (DWORD offset = (DWORD)imageFileSize; offset < pe.File.size(); ++offset)
+            CHECK(table.OffsetToRva(offset) == Invalid);
+
+        // Every RVA with file data converts back, zero filled ones have no offset
+        size_t filledRvas = 0;
+        for (DWORD rva = 0; rva < pe.SizeOfImage; ++rva)
+        {
+            const DWORD offset = table.RvaToOffset(rva);
+            if (offset == Invalid)
+            {
+                ++filledRvas;
+                if (pe.Mapped[rva] != 0)
+                {
+                    printf("FAIL %s: RVA %#x holds file data but has no offset\n", path, rva);
+                    ++failures;
+                    break;
+                }
+                continue;
+            }
+            if (offset >= imageFileSize || table.OffsetToRva(offset) != rva)
+            {
+                printf("FAIL %s: RVA %#x converts to offset %#x\n", path, rva, offset);
+                ++failures;
+                break;
+            }
+        }
+        CHECK(table.RvaToOffset(pe.SizeOfImage) == Invalid);
+        CHECK(table.RvaToOffset(Invalid) == Invalid);
+
+        // VAs are relative to the module base Olly reports, not to the preferred ImageBase
+        const DWORD_PTR base = 0x10000000;
+        const IMAGE_SECTION_HEADER& code = pe.Sections[0];
+        CHECK(table.OffsetToVa(code.PointerToRawData + 5, base) == base + code.VirtualAddress + 5);
+        CHECK(table.VaToOffset(base + code.VirtualAddress + 5, base) == code.PointerToRawData + 5);
+        CHECK(table.RvaToVa(0, base) == base);
+        CHECK(table.RvaToVa(pe.SizeOfImage - 1, base) == base + pe.SizeOfImage - 1);
+        CHECK(table.RvaToVa(pe.SizeOfImage, base) == InvalidVa);
+        CHECK(table.VaToRva(base, base) == 0);
+        CHECK(table.VaToRva(base - 1, base) == Invalid);
+        CHECK(table.VaToRva(base + pe.SizeOfImage, base) == Invalid);
+        CHECK(table.OffsetToVa((DWORD)imageFileSize, base) == InvalidVa);
+        CHECK(table.VaToOffset(base + pe.SizeOfImage, base) == Invalid);
+
+        printf("%s: %zu of %zu offsets mapped, %zu of %u RVAs zero filled\n", path, mappedOffsets, pe.File.size(),
+            filledRvas, pe.SizeOfImage);
+    }
+}
+
+static void AddSection(std::vector<IMAGE_SECTION_HEADER>& sections, DWORD virtualAddress, DWORD virtualSize, DWORD pointerToRawData, DWORD sizeOfRawData)
+{
+    IMAGE_SECTION_HEADER section = {};
+    section.VirtualAddress = virtualAddress;
+    section.Misc.VirtualSize = virtualSize;
+    section.PointerToRawData = pointerToRawData;
+    section.SizeOfRawData = sizeOfRawData;
+    sections.push_back(section);
+}
+
+// PE32+ with headers up to 0x400 and these sections:
+//   .text  RVA 0x1000, 0x180 bytes used of 0x200 raw bytes at 0x400
+//   .bss   RVA 0x2000, 0x800 bytes, no raw data
+//   .data  RVA 0x3000, 0x400 raw bytes at 0x600, of which the file only has 0x100
+static std::vector<BYTE> MakeImage64(DWORD& fileSize)
+{
+    std::vector<BYTE> image(0x700, 0);
+    IMAGE_DOS_HEADER dos = {};
+    dos.e_magic = IMAGE_DOS_SIGNATURE;
+    dos.e_lfanew = 0x80;
+    memcpy(image.data(), &dos, sizeof(dos));
+
+    std::vector<IMAGE_SECTION_HEADER> sections;
+    AddSection(sections, 0x1000, 0x180, 0x400, 0x200);
+    AddSection(sections, 0x2000, 0x800, 0, 0);
+    AddSection(sections, 0x3000, 0x400, 0x600, 0x400);
+
+    IMAGE_NT_HEADERS64 nt = {};
+    nt.Signature = IMAGE_NT_SIGNATURE;
+    nt.FileHeader.Machine = IMAGE_FILE_MACHINE_AMD64;
+    nt.FileHeader.NumberOfSections = (WORD)sections.size();
+    nt.FileHeader.SizeOfOptionalHeader = sizeof(IMAGE_OPTIONAL_HEADER64);
+    nt.OptionalHeader.Magic = IMAGE_NT_OPTIONAL_HDR64_MAGIC;
+    nt.OptionalHeader.SizeOfImage = 0x4000;
+    nt.OptionalHeader.SizeOfHeaders = 0x400;
+    memcpy(image.data() + 0x80, &nt, sizeof(nt));
+    memcpy(image.data() + 0x80 + sizeof(nt), sections.data(), sections.size() * sizeof(IMAGE_SECTION_HEADER));
+
+    fileSize = 0x700;
+    return image;
+}
+
+static void TestCraftedImage()
+{
+    DWORD fileSize;
+    const std::vector<BYTE> image = MakeImage64(fileSize);
+    SectionTable table;
+    CHECK(table.Parse(image.data(), image.size(), fileSize));
+    CHECK(table.NumSections() == 3);
+
+    // Headers map 1:1, offset 0 is a valid conversion
+    CHECK(table.OffsetToRva(0) == 0);
+    CHECK(table.OffsetToRva(0x3FF) == 0x3FF);
+    CHECK(table.RvaToOffset(0) == 0);
+    CHECK(table.RvaToOffset(0x3FF) == 0x3FF);
+    CHECK(table.RvaToOffset(0x400) == Invalid);
+
+    // .text, without the file alignment padding after its VirtualSize
+    CHECK(table.OffsetToRva(0x400) == 0x1000);
+    CHECK(table.OffsetToRva(0x57F) == 0x117F);
+    CHECK(table.OffsetToRva(0x580) == Invalid);
+    CHECK(table.OffsetToRva(0x5FF) == Invalid);
+    CHECK(table.RvaToOffset(0x117F) == 0x57F);
+    CHECK(table.RvaToOffset(0x1180) == Invalid);
+
+    // .bss has no file data
+    CHECK(table.RvaToOffset(0x2000) == Invalid);
+    CHECK(table.RvaToOffset(0x27FF) == Invalid);
+
+    // .data is cut off by the end of the file, and the image ends at 0x4000
+    CHECK(table.OffsetToRva(0x600) == 0x3000);
+    CHECK(table.OffsetToRva(0x6FF) == 0x30FF);
+    CHECK(table.OffsetToRva(0x700) == Invalid);
+    CHECK(table.RvaToOffset(0x30FF) == 0x6FF);
+    CHECK(table.RvaToOffset(0x3100) == Invalid);
+    CHECK(table.RvaToOffset(0x3FFF) == Invalid);
+    CHECK(table.RvaToOffset(0x4000) == Invalid);
+
+    CHECK(table.OffsetToVa(0x401, 0x140000000ull) == (DWORD_PTR)0x140001001ull);
+    CHECK(table.VaToOffset((DWORD_PTR)0x140001001ull, 0x140000000ull) == 0x401);
+
+    // A section table that runs past the bytes read keeps the sections that were read
+    const size_t twoSections = 0x80 + sizeof(IMAGE_NT_HEADERS64) + 2 * sizeof(IMAGE_SECTION_HEADER);
+    CHECK(table.Parse(image.data(), twoSections + 10, fileSize));
+    CHECK(table.NumSections() == 2);
+    CHECK(table.OffsetToRva(0x400) == 0x1000);
+    CHECK(table.OffsetToRva(0x600) == Invalid);
+
+    // Without any raw section data everything in the file is header, up to SizeOfImage
+    std::vector<BYTE> headersOnly = image;
+    IMAGE_NT_HEADERS64 nt;
+    memcpy(&nt, headersOnly.data() + 0x80, sizeof(nt));
+    nt.FileHeader.NumberOfSections = 0;
+    memcpy(headersOnly.data() + 0x80, &nt, sizeof(nt));
+    CHECK(table.Parse(headersOnly.data(), headersOnly.size(), 0x5000));
+    CHECK(table.NumSections() == 0);
+    CHECK(table.OffsetToRva(0x3FFF) == 0x3FFF);
+    CHECK(table.OffsetToRva(0x4000) == Invalid);
+}
+
+static void TestMalformed()
+{
+    DWORD fileSize;
+    const std::vector<BYTE> image = MakeImage64(fileSize);
+    SectionTable table;
+
+    CHECK(!table.Parse(image.data(), 0, fileSize));
+    CHECK(!table.Parse(image.data(), sizeof(IMAGE_DOS_HEADER) - 1, fileSize));
+    CHECK(!table.Parse(image.data(), 0x80 + sizeof(IMAGE_NT_HEADERS32) - 1, fileSize));
+    CHECK(!table.Parse(image.data(), image.size(), image.size() - 1));
+
+    // A failed parse leaves nothing to convert
+    CHECK(table.NumSections() == 0);
+    CHECK(table.OffsetToRva(0) == Invalid);
+    CHECK(table.RvaToOffset(0) == Invalid);
+    CHECK(table.RvaToVa(0, 0x400000) == InvalidVa);
+
+    std::vector<BYTE> bad = image;
+    bad[0] = 'X';
+    CHECK(!table.Parse(bad.data(), bad.size(), fileSize));
+
+    bad = image;
+    bad[0x80] = 'X';
+    CHECK(!table.Parse(bad.data(), bad.size(), fileSize));
+
+    // The optional header magic of neither PE32 nor PE32+
+    bad = image;
+    bad[0x80 + sizeof(DWORD) + sizeof(IMAGE_FILE_HEADER)] = 0;
+    CHECK(!table.Parse(bad.data(), bad.size(), fileSize));
+
+    const LONG lfanews[] = { -1, -0x80, 0x7FFFFFFF, (LONG)image.size(), (LONG)image.size() - 8 };
+    for (const LONG lfanew : lfanews)
+    {
+        bad = image;
+        memcpy(bad.data() + offsetof(IMAGE_DOS_HEADER, e_lfanew), &lfanew, sizeof(lfanew));
+        CHECK(!table.Parse(bad.data(), bad.size(), fileSize));
+    }
+
+    // SizeOfOptionalHeader pointing the section table past the bytes read
+    bad = image;
+    const WORD hugeOptionalHeader = 0xFFFF;
+    memcpy(bad.data() + 0x80 + sizeof(DWORD) + offsetof(IMAGE_FILE_HEADER, SizeOfOptionalHeader), &hugeOptionalHeader, sizeof(WORD));
+    CHECK(!table.Parse(bad.data(), bad.size(), fileSize));
+
+    // Sections past 4GB of file or image wrap around nowhere
+    bad = image;
+    std::vector<IMAGE_SECTION_HEADER> sections;
+    AddSection(sections, 0xFFFFF000, 0x2000, 0xFFFFFF00, 0x1000);
+    memcpy(bad.data() + 0x80 + sizeof(IMAGE_NT_HEADERS64), sections.data(), sizeof(IMAGE_SECTION_HEADER));
+    CHECK(table.Parse(bad.data(), bad.size(), 0x100000000ull + 0x100));
+    CHECK(table.OffsetToRva(0xFFFFFF10) == Invalid);
+    CHECK(table.RvaToOffset(0xFFFFF010) == Invalid);
+    CHECK(table.OffsetToRva(0x600) == 0x3000);
+}
+
+static void TestCache()
+{
+    DWORD fileSize;
+    const std::vector<BYTE> image = MakeImage64(fileSize);
+    SectionTable table;
+    CHECK(table.Parse(image.data(), image.size(), fileSize));
+
+    const WCHAR exe[] = L"C:\\target\\app.exe";
+    const WCHAR dll[] = L"C:\\target\\app.dll";
+    const WCHAR exePrefix[] = L"C:\\target\\app.ex";
+
+    SectionTableCache cache(3);
+    CHECK(cache.Find(exe, fileSize, 100) == nullptr);
+    const SectionTable* cached = cache.Insert(exe, fileSize, 100, table);
+    CHECK(cached != nullptr && cached->OffsetToRva(0x400) == 0x1000);
+    CHECK(cache.Find(exe, fileSize, 100) == cached);
+
+    // The file is only known by its path, size and last write time
+    CHECK(cache.Find(exe, fileSize, 101) == nullptr);
+    CHECK(cache.Find(exe, fileSize + 1, 100) == nullptr);
+    CHECK(cache.Find(dll, fileSize, 100) == nullptr);
+    CHECK(cache.Find(exePrefix, fileSize, 100) == nullptr);
+
+    // A rebuilt file replaces its old entry
+    cache.Insert(exe, fileSize, 200, table);
+    CHECK(cache.Size() == 1);
+    CHECK(cache.Find(exe, fileSize, 100) == nullptr);
+    CHECK(cache.Find(exe, fileSize, 200) != nullptr);
+
+    // Entries of other paths are kept, up to the capacity, and the least recently used goes first
+    cache.Insert(dll, fileSize, 100, table);
+    cache.Insert(exePrefix, fileSize, 100, table);
+    CHECK(cache.Size() == 3);
+    CHECK(cache.Find(exe, fileSize, 200) != nullptr);
+    const WCHAR other[] = L"D:\\other.dll";
+    cache.Insert(other, fileSize, 1, table);
+    CHECK(cache.Size() == 3);
+    CHECK(cache.Find(dll, fileSize, 100) == nullptr);
+    CHECK(cache.Find(exe, fileSize, 200) != nullptr);
+    CHECK(cache.Find(exePrefix, fileSize, 100) != nullptr);
+    CHECK(cache.Find(other, fileSize, 1) != nullptr);
+
+    // Cached tables do not move when other files are added
+    const SectionTable* stable = cache.Find(other, fileSize, 1);
+    cache.Insert(dll, fileSize, 100, table);
+    CHECK(cache.Find(other, fileSize, 1) == stable);
+
+    cache.Clear();
+    CHECK(cache.Size() == 0);
+    CHECK(cache.Find(other, fileSize, 1) == nullptr);
+}
+
+int main()
+{
+    TestSampleImages();
+    TestCraftedImage();
+    TestMalformed();
+    TestCache();
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,213 @@
+#include <windows.h>
+#include <cstdio>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "SyscallStubScanner.h"
+
+using scl::SyscallStubType;
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what, int line)
+{
+    if (!condition)
+    {
+        printf("FAIL line %d: %s\n", line, what);
+        ++failures;
+    }
+}
+#define CHECK(condition) Check(condition, #condition, __LINE__)
+
+static void Append(std::vector<BYTE>& code, std::initializer_list<BYTE> bytes)
+{
+    code.insert(code.end(), bytes);
+}
+
+static void AppendImm32(std::vector<BYTE>& code, ULONG value)
+{
+    Append(code, { (BYTE)value, (BYTE)(value >> 8), (BYTE)(value >> 16), (BYTE)(value >> 24) });
+}
+
+// Appends a stub in the style of the given user32/win32u build and returns the offset of its first instruction.
+// variant selects between the stub layouts that the scanner knows for the stub type
+static SIZE_T AppendStub(std::vector<BYTE>& code, SyscallStubType type, int variant, ULONG syscallNum)
+{
+    const SIZE_T start = code.size();
+    switch (type)
+    {
+    case SyscallStubType::X64:
+        Append(code, { 0x4C, 0x8B, 0xD1, 0xB8 });                                  // mov r10, rcx / mov eax, num
+        AppendImm32(code, syscallNum);
+        if (variant == 0)
+            Append(code, { 0x0F, 0x05, 0xC3 });                                    // syscall / retn
+        else
+            Append(code, { 0xF6, 0x04, 0x25, 0x08, 0x03, 0xFE, 0x7F, 0x01,         // test byte ptr [7FFE0308h], 1
+                0x75, 0x03, 0x0F, 0x05, 0xC3, 0xCD, 0x2E, 0xC3 });                 // jnz / syscall / retn / int 2Eh / retn
+        break;
+
+    case SyscallStubType::NativeX86:
+        Append(code, { 0xB8 });
+        AppendImm32(code, syscallNum);
+        if (variant == 0)
+            Append(code, { 0xBA, 0x00, 0x03, 0xFE, 0x7F, 0xFF, 0x12, 0xC2, 0x10, 0x00 }); // mov edx, 7FFE0300h / call [edx] / retn 10h
+        else
+            Append(code, { 0xE8, 0x03, 0x00, 0x00, 0x00, 0xC2, 0x10, 0x00,         // call leaf_sub / retn 10h
+                0x8B, 0xD4, 0x0F, 0x34, 0xC3 });                                   // leaf_sub: mov edx, esp / sysenter / retn
+        break;
+
+    case SyscallStubType::Wow64:
+        Append(code, { 0xB8 });
+        AppendImm32(code, syscallNum);
+        if (variant == 0)
+            Append(code, { 0xB9, 0x00, 0x00, 0x00, 0x00, 0x8D, 0x54, 0x24, 0x04,   // mov ecx, 0 / lea edx, [esp+4]
+                0x64, 0xFF, 0x15, 0xC0, 0x00, 0x00, 0x00, 0xC2, 0x10, 0x00 });     // call fs:0C0h / retn 10h
+        else if (variant == 1)
+            Append(code, { 0x64, 0xFF, 0x15, 0xC0, 0x00, 0x00, 0x00, 0xC2, 0x10, 0x00 }); // call fs:0C0h / retn 10h
+        else
+            Append(code, { 0xBA, 0x40, 0x12, 0x30, 0x6B, 0xFF, 0xD2, 0xC2, 0x10, 0x00 }); // mov edx, Wow64SystemServiceCall / call edx / retn 10h
+        break;
+    }
+    return start;
+}
+
+static int NumVariants(SyscallStubType type)
+{
+    return type == SyscallStubType::Wow64 ? 3 : 2;
+}
+
+// Non-stub code that contains 'mov eax, imm32' with the same immediates as the stubs
+static void AppendDecoys(std::vector<BYTE>& code, std::mt19937& rng, ULONG syscallNum)
+{
+    Append(code, { 0x8B, 0xFF, 0x55, 0x8B, 0xEC, 0xB8 });                          // mov edi, edi / push ebp / mov ebp, esp / mov eax, num
+    AppendImm32(code, syscallNum);
+    Append(code, { 0x5D, 0xC2, 0x04, 0x00 });                                      // pop ebp / retn 4
+    Append(code, { 0x48, 0x8B, 0xD1, 0xB8 });                                      // mov rdx, rcx / mov eax, num: not 'mov r10, rcx'
+    AppendImm32(code, syscallNum);
+    Append(code, { 0xC3 });
+    for (int i = (int)(rng() % 48); i > 0; --i)
+        code.push_back(rng() % 4 == 0 ? 0xB8 : (BYTE)rng());
+    for (int i = (int)(rng() % 16); i > 0; --i)
+        code.push_back(0xCC);
+}
+
+static void TestStubTypes()
+{
+    static const SyscallStubType types[] = { SyscallStubType::X64, SyscallStubType::NativeX86, SyscallStubType::Wow64 };
+    for (const auto type : types)
+    {
+        for (int variant = 0; variant < NumVariants(type); ++variant)
+        {
+            std::vector<BYTE> code;
+            const SIZE_T expected = AppendStub(code, type, variant, 0x1234);
+
+            std::unordered_map<LONG, SIZE_T> indices = { { 0x1234, scl::StubNotFound } };
+            CHECK(scl::FindSyscallStubs(code.data(), code.size(), type, indices) == 1);
+            CHECK(indices[0x1234] == expected);
+
+            // The high bits of the immediate are not part of the index on any OS
+            code.clear();
+            AppendStub(code, type, variant, 0x00051234);
+            indices[0x1234] = scl::StubNotFound;
+            CHECK(scl::FindSyscallStubs(code.data(), code.size(), type, indices) == 1);
+            CHECK(indices[0x1234] == 0);
+
+            // Stubs of the other types must not match
+            for (const auto otherType : types)
+            {
+                if (otherType == type)
+                    continue;
+                indices[0x1234] = scl::StubNotFound;
+                scl::FindSyscallStubs(code.data(), code.size(), otherType, indices);
+                CHECK(indices[0x1234] == scl::StubNotFound);
+            }
+        }
+    }
+}
+
+// A stub that is cut off by the end of the code must not be matched or read past the end
+static void TestTruncatedStubs()
+{
+    static const SyscallStubType types[] = { SyscallStubType::X64, SyscallStubType::NativeX86, SyscallStubType::Wow64 };
+    for (const auto type : types)
+    {
+        for (int variant = 0; variant < NumVariants(type); ++variant)
+        {
+            std::vector<BYTE> stub;
+            AppendStub(stub, type, variant, 0x77);
+            const SIZE_T movOffset = type == SyscallStubType::X64 ? 3 : 0;
+            for (SIZE_T size = 0; size < stub.size(); ++size)
+            {
+                // Copy to a buffer of exactly this size so that ASan catches overreads
+                std::vector<BYTE> code(stub.begin(), stub.begin() + size);
+                std::unordered_map<LONG, SIZE_T> indices = { { 0x77, scl::StubNotFound } };
+                const size_t found = scl::FindSyscallStubs(code.data(), code.size(), type, indices);
+                if (size < movOffset + 5)
+                    CHECK(found == 0);
+                CHECK(found == 0 || indices[0x77] == 0);
+            }
+        }
+    }
+}
+
+// Many stubs in random order between decoy code, as in a user32.dll code section. Each index must resolve
+// to its own stub, including when the same index has a second stub further on (the first one wins)
+static void TestCodeSection(SyscallStubType type, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector<BYTE> code;
+    std::unordered_map<LONG, SIZE_T> expected;
+    std::unordered_map<LONG, SIZE_T> indices;
+
+    std::vector<ULONG> order(1200);
+    for (ULONG i = 0; i < order.size(); ++i)
+        order[i] = 0x1000 + i;
+    std::shuffle(order.begin(), order.end(), rng);
+
+    for (const ULONG syscallNum : order)
+    {
+        AppendDecoys(code, rng, syscallNum);
+        const SIZE_T offset = AppendStub(code, type, (int)(rng() % NumVariants(type)), syscallNum);
+        if (expected.count(syscallNum) == 0)
+            expected[syscallNum] = offset;
+        if (rng() % 8 == 0) // Requested subset
+            indices[syscallNum] = scl::StubNotFound;
+    }
+    for (const ULONG syscallNum : order)
+    {
+        if (rng() % 32 == 0)
+            AppendStub(code, type, 0, syscallNum);
+    }
+
+    // An index without a stub stays unresolved
+    indices[0x7FFF] = scl::StubNotFound;
+
+    const size_t found = scl::FindSyscallStubs(code.data(), code.size(), type, indices);
+    CHECK(found == indices.size() - 1);
+    for (const auto& entry : indices)
+    {
+        if (entry.first == 0x7FFF)
+            CHECK(entry.second == scl::StubNotFound);
+        else if (entry.second != expected[entry.first])
+        {
+            printf("FAIL type %d index %X at %zX, expected %zX\n", (int)type, (ULONG)entry.first,
+                (size_t)entry.second, (size_t)expected[entry.first]);
+            ++failures;
+        }
+    }
+}
+
+int main()
+{
+    TestStubTypes();
+    TestTruncatedStubs();
+    for (unsigned int seed = 1; seed <= 10; ++seed)
+    {
+        TestCodeSection(SyscallStubType::X64, seed);
+        TestCodeSection(SyscallStubType::NativeX86, seed);
+        TestCodeSection(SyscallStubType::Wow64, seed);
+    }
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,351 @@
+#include <windows.h>
+#include "TlsCallbacks.h"
+#include "PeImage.h"
+
+#include <cstdio>
+#include <vector>
+
+// The TLS callback scan of the Olly1 plugin on crafted PE32 and PE32+ images in a fake debuggee address space made of
+// separately readable regions: arrays shorter and longer than a read chunk, arrays that run into unreadable memory,
+// unterminated arrays, PE32+ callbacks above 4GB, and headers and directories that are missing, truncated or point
+// outside the image. The sample images have no TLS directory
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what, int line)
+{
+    if (!condition)
+    {
+        printf("FAIL line %d: %s\n", line, what);
+        ++failures;
+    }
+}
+#define CHECK(condition) Check(condition, #condition, __LINE__)
+
+// Reads stop at the end of a region, like ReadProcessMemory stops at an unreadable page
+struct FakeMemory
+{
+    struct Region
+    {
+        ULONG_PTR Base;
+        std::vector<BYTE> Bytes;
+    };
+    std::vector<Region> Regions;
+    size_t NumReads = 0;
+
+    // Map() returns pointers into the regions, which must not move
+    FakeMemory()
+    {
+        Regions.reserve(8);
+    }
+
+    BYTE* Map(ULONG_PTR base, size_t size)
+    {
+        Regions.push_back(Region{ base, std::vector<BYTE>(size, 0) });
+        return Regions.back().Bytes.data();
+    }
+
+    static SIZE_T Read(void* context, ULONG_PTR address, void* buffer, SIZE_T size)
+    {
+        FakeMemory* memory = (FakeMemory*)context;
+        ++memory->NumReads;
+        for (const Region& region : memory->Regions)
+        {
+            if (address >= region.Base && address - region.Base < region.Bytes.size())
+            {
+                const size_t available = region.Bytes.size() - (address - region.Base);
+                const size_t count = size < available ? size : available;
+                memcpy(buffer, region.Bytes.data() + (address - region.Base), count);
+                return count;
+            }
+        }
+        return 0;
+    }
+};
+
+static const DWORD TlsRva = 0x2000;
+static const DWORD ArrayRva = 0x2100;
+static const DWORD SizeOfImage = 0x4000;
+
+// Maps the headers and the TLS directory of an image at base, with the callback array at ArrayRva. The array itself
+// is written by the caller into the returned image
+static BYTE* MapImage(FakeMemory& memory, ULONG_PTR base, bool is64)
+{
+    BYTE* image = memory.Map(base, SizeOfImage);
+    IMAGE_DOS_HEADER dos = {};
+    dos.e_magic = IMAGE_DOS_SIGNATURE;
+    dos.e_lfanew = 0x80;
+    memcpy(image, &dos, sizeof(dos));
+
+    if (is64)
+    {
+        IMAGE_NT_HEADERS64 nt = {};
+        nt.Signature = IMAGE_NT_SIGNATURE;
+        nt.FileHeader.Machine = IMAGE_FILE_MACHINE_AMD64;
+        nt.OptionalHeader.Magic = IMAGE_NT_OPTIONAL_HDR64_MAGIC;
+        nt.OptionalHeader.SizeOfImage = SizeOfImage;
+        nt.OptionalHeader.NumberOfRvaAndSizes = IMAGE_NUMBEROF_DIRECTORY_ENTRIES;
+        nt.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_TLS].VirtualAddress = TlsRva;
+        nt.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_TLS].Size = sizeof(IMAGE_TLS_DIRECTORY64);
+        memcpy(image + 0x80, &nt, sizeof(nt));
+
+        IMAGE_TLS_DIRECTORY64 tls = {};
+        tls.AddressOfCallBacks = (ULONGLONG)base + ArrayRva;
+        memcpy(image + TlsRva, &tls, sizeof(tls));
+    }
+    else
+    {
+        IMAGE_NT_HEADERS32 nt = {};
+        nt.Signature = IMAGE_NT_SIGNATURE;
+        nt.FileHeader.Machine = IMAGE_FILE_MACHINE_I386;
+        nt.OptionalHeader.Magic = IMAGE_NT_OPTIONAL_HDR32_MAGIC;
+        nt.OptionalHeader.SizeOfImage = SizeOfImage;
+        nt.OptionalHeader.NumberOfRvaAndSizes = IMAGE_NUMBEROF_DIRECTORY_ENTRIES;
+        nt.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_TLS].VirtualAddress = TlsRva;
+        nt.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_TLS].Size = sizeof(IMAGE_TLS_DIRECTORY32);
+        memcpy(image + 0x80, &nt, sizeof(nt));
+
+        IMAGE_TLS_DIRECTORY32 tls = {};
+        tls.AddressOfCallBacks = (DWORD)(base + ArrayRva);
+        memcpy(image + TlsRva, &tls, sizeof(tls));
+    }
+    return image;
+}
+
+static void WriteEntries(BYTE* at, bool is64, const std::vector<ULONGLONG>& entries)
+{
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        if (is64)
+            memcpy(at + i * sizeof(ULONGLONG), &entries[i], sizeof(ULONGLONG));
+        else
+        {
+            const DWORD entry = (DWORD)entries[i];
+            memcpy(at + i * sizeof(DWORD), &entry, sizeof(DWORD));
+        }
+    }
+}
+
+static std::vector<ULONGLONG> Scan(FakeMemory& memory, ULONG_PTR base)
+{
+    std::vector<ULONGLONG> callbacks = { 0xDEAD };
+    ReadTlsCallbacks(base, FakeMemory::Read, &memory, callbacks);
+    return callbacks;
+}
+
+static void TestArrays(bool is64)
+{
+    const ULONG_PTR base = is64 ? (ULONG_PTR)0x140000000ull : 0x400000;
+    const ULONGLONG high = is64 ? 0x100000000ull : 0;
+
+    // A few callbacks, then the terminator
+    {
+        FakeMemory memory;
+        BYTE* image = MapImage(memory, base, is64);
+        const std::vector<ULONGLONG> expected = { base + 0x1010, base + 0x1020 + high, base + 0x1030 };
+        WriteEntries(image + ArrayRva, is64, expected);
+        SIZE_T entrySize = 0;
+        CHECK(ReadTlsCallbackArrayAddress(base, FakeMemory::Read, &memory, &entrySize) == base + ArrayRva);
+        CHECK(entrySize == (is64 ? 8u : 4u));
+        CHECK(Scan(memory, base) == expected);
+    }
+
+    // No callbacks at all
+    {
+        FakeMemory memory;
+        MapImage(memory, base, is64);
+        CHECK(Scan(memory, base).empty());
+    }
+
+    // More callbacks than a read chunk holds, with the terminator right after a chunk boundary
+    for (const size_t count : { (size_t)TLS_CALLBACK_CHUNK - 1, (size_t)TLS_CALLBACK_CHUNK, (size_t)TLS_CALLBACK_CHUNK + 1, (size_t)200 })
+    {
+        FakeMemory memory;
+        BYTE* image = MapImage(memory, base, is64);
+        std::vector<ULONGLONG> expected;
+        for (size_t i = 0; i < count; ++i)
+            expected.push_back(base + 0x1000 + i + (i % 2 != 0 ? high : 0));
+        WriteEntries(image + ArrayRva, is64, expected);
+        CHECK(Scan(memory, base) == expected);
+    }
+
+    // The array runs into unreadable memory: every entry before it is found, read one at a time after the last chunk
+    {
+        FakeMemory memory;
+        BYTE* image = MapImage(memory, base, is64);
+        const size_t entrySize = is64 ? 8 : 4;
+        const size_t fit = (SizeOfImage - ArrayRva) / entrySize;
+        std::vector<ULONGLONG> expected;
+        for (size_t i = 0; i < fit; ++i)
+            expected.push_back(base + 0x1000 + i);
+        WriteEntries(image + ArrayRva, is64, expected);
+        CHECK(Scan(memory, base) == expected);
+    }
+
+    // The array continues in the next region, past the image: chunks that cross over fall back to single entries
+    {
+        FakeMemory memory;
+        BYTE* image = MapImage(memory, base, is64);
+        BYTE* next = memory.Map(base + SizeOfImage, 0x1000);
+        const size_t entrySize = is64 ? 8 : 4;
+        const size_t fit = (SizeOfImage - ArrayRva) / entrySize;
+        std::vector<ULONGLONG> expected;
+        for (size_t i = 0; i < fit + 10; ++i)
+            expected.push_back(base + 0x1000 + i);
+        WriteEntries(image + ArrayRva, is64, std::vector<ULONGLONG>(expected.begin(), expected.begin() + fit));
+        WriteEntries(next, is64, std::vector<ULONGLONG>(expected.begin() + fit, expected.end()));
+        CHECK(Scan(memory, base) == expected);
+    }
+
+    // An array that is never terminated is cut off
+    {
+        FakeMemory memory;
+        MapImage(memory, base, is64);
+        const ULONG_PTR array = base + 0x100000;
+        BYTE* entries = memory.Map(array, (TLS_MAX_CALLBACKS + 100) * 8);
+        std::vector<ULONGLONG> all(TLS_MAX_CALLBACKS + 100, base + 0x1000);
+        WriteEntries(entries, is64, all);
+
+        BYTE* image = memory.Regions[0].Bytes.data();
+        if (is64)
+            memcpy(image + TlsRva + offsetof(IMAGE_TLS_DIRECTORY64, AddressOfCallBacks), &array, sizeof(ULONGLONG));
+        else
+        {
+            const DWORD array32 = (DWORD)array;
+            memcpy(image + TlsRva + offsetof(IMAGE_TLS_DIRECTORY32, AddressOfCallBacks), &array32, sizeof(DWORD));
+        }
+        const std::vector<ULONGLONG> callbacks = Scan(memory, base);
+        CHECK(callbacks.size() == TLS_MAX_CALLBACKS);
+        CHECK(memory.NumReads < 100);
+    }
+
+    // An array address that is not mapped
+    {
+        FakeMemory memory;
+        BYTE* image = MapImage(memory, base, is64);
+        const ULONG_PTR nowhere = base + 0x800000;
+        if (is64)
+            memcpy(image + TlsRva + offsetof(IMAGE_TLS_DIRECTORY64, AddressOfCallBacks), &nowhere, sizeof(ULONGLONG));
+        else
+        {
+            const DWORD nowhere32 = (DWORD)nowhere;
+            memcpy(image + TlsRva + offsetof(IMAGE_TLS_DIRECTORY32, AddressOfCallBacks), &nowhere32, sizeof(DWORD));
+        }
+        CHECK(Scan(memory, base).empty());
+    }
+}
+
+static void TestBadHeaders(bool is64)
+{
+    const ULONG_PTR base = is64 ? (ULONG_PTR)0x140000000ull : 0x400000;
+    const size_t optionalHeader = 0x80 + sizeof(DWORD) + sizeof(IMAGE_FILE_HEADER);
+    const size_t numberOfRvaAndSizes = optionalHeader +
+        (is64 ? offsetof(IMAGE_OPTIONAL_HEADER64, NumberOfRvaAndSizes) : offsetof(IMAGE_OPTIONAL_HEADER32, NumberOfRvaAndSizes));
+    const size_t tlsDirectory = optionalHeader + (is64 ? offsetof(IMAGE_OPTIONAL_HEADER64, DataDirectory) : offsetof(IMAGE_OPTIONAL_HEADER32, DataDirectory)) +
+        IMAGE_DIRECTORY_ENTRY_TLS * sizeof(IMAGE_DATA_DIRECTORY);
+
+    struct Mutation
+    {
+        size_t Offset;
+        DWORD Value;
+        size_t Size;
+        const char* What;
+    };
+    const Mutation mutations[] =
+    {
+        { 0, 0x5A4E, sizeof(WORD), "DOS signature" },
+        { offsetof(IMAGE_DOS_HEADER, e_lfanew), 0, sizeof(LONG), "e_lfanew of 0" },
+        { offsetof(IMAGE_DOS_HEADER, e_lfanew), 0x80000000, sizeof(LONG), "negative e_lfanew" },
+        { offsetof(IMAGE_DOS_HEADER, e_lfanew), SizeOfImage - 0x10, sizeof(LONG), "NT headers past the image" },
+        { 0x80, 0x4551, sizeof(DWORD), "NT signature" },
+        { optionalHeader, 0x107, sizeof(WORD), "optional header magic" },
+        { numberOfRvaAndSizes, IMAGE_DIRECTORY_ENTRY_TLS, sizeof(DWORD), "no TLS data directory" },
+        { tlsDirectory, 0, sizeof(DWORD), "TLS directory RVA of 0" },
+        { tlsDirectory, SizeOfImage, sizeof(DWORD), "TLS directory past SizeOfImage" },
+        { tlsDirectory, SizeOfImage - 4, sizeof(DWORD), "TLS directory cut off by the image end" },
+        { TlsRva + (is64 ? offsetof(IMAGE_TLS_DIRECTORY64, AddressOfCallBacks) : offsetof(IMAGE_TLS_DIRECTORY32, AddressOfCallBacks)), 0,
+            is64 ? sizeof(ULONGLONG) : sizeof(DWORD), "no callback array" },
+    };
+
+    for (const Mutation& mutation : mutations)
+    {
+        FakeMemory memory;
+        BYTE* image = MapImage(memory, base, is64);
+        WriteEntries(image + ArrayRva, is64, { base + 0x1010 });
+        // The memory after the image holds a copy of the TLS directory, which must not be followed either
+        memcpy(memory.Map(base + SizeOfImage, 0x1000), image + TlsRva, sizeof(IMAGE_TLS_DIRECTORY64));
+        memset(image + mutation.Offset, 0, mutation.Size);
+        memcpy(image + mutation.Offset, &mutation.Value, mutation.Size < sizeof(DWORD) ? mutation.Size : sizeof(DWORD));
+        const std::vector<ULONGLONG> callbacks = Scan(memory, base);
+        if (!callbacks.empty())
+        {
+            printf("FAIL %s image with a bad %s has %zu callbacks\n", is64 ? "PE32+" : "PE32", mutation.What, callbacks.size());
+            ++failures;
+        }
+    }
+
+    // The TLS entry of a PE32+ header is within the size of a PE32 one, but the whole header must be readable
+    if (is64)
+    {
+        FakeMemory memory;
+        BYTE* image = MapImage(memory, base, true);
+        WriteEntries(image + ArrayRva, true, { base + 0x1010 });
+        const std::vector<BYTE> rest(image + TlsRva, image + SizeOfImage);
+        memory.Regions[0].Bytes.resize(0x80 + sizeof(IMAGE_NT_HEADERS32));
+        memcpy(memory.Map(base + TlsRva, rest.size()), rest.data(), rest.size());
+        CHECK(Scan(memory, base).empty());
+    }
+
+    // Nothing mapped at all
+    FakeMemory empty;
+    CHECK(Scan(empty, base).empty());
+}
+
+// A PE32+ image whose callbacks are above what a 32-bit reader can address, the caller gets no addresses it cannot use
+static void TestAddressRange()
+{
+    FakeMemory memory;
+    const ULONG_PTR base = (ULONG_PTR)-1 - SizeOfImage + 1;
+    BYTE* image = MapImage(memory, base, true);
+    WriteEntries(image + SizeOfImage - 8, true, { 0x1234 });
+    const ULONGLONG array = (ULONGLONG)base + SizeOfImage - 8;
+    memcpy(image + TlsRva + offsetof(IMAGE_TLS_DIRECTORY64, AddressOfCallBacks), &array, sizeof(array));
+    // The array's second entry would wrap around the address space
+    CHECK(Scan(memory, base) == std::vector<ULONGLONG>{ 0x1234 });
+
+    void* buffer[2];
+    CHECK(!ReadRemoteExact(FakeMemory::Read, &memory, (ULONGLONG)(ULONG_PTR)-1, buffer, 2));
+    CHECK(ReadRemoteExact(FakeMemory::Read, &memory, (ULONGLONG)(ULONG_PTR)-1, buffer, 1));
+}
+
+static void TestSampleImages()
+{
+    for (const char* path : SampleImages)
+    {
+        PeImage pe;
+        if (!pe.Load(path))
+        {
+            printf("FAIL cannot load %s\n", path);
+            ++failures;
+            continue;
+        }
+        FakeMemory memory;
+        memcpy(memory.Map(0x10000000, pe.Mapped.size()), pe.Mapped.data(), pe.Mapped.size());
+        SIZE_T entrySize = 0;
+        CHECK(ReadTlsCallbackArrayAddress(0x10000000, FakeMemory::Read, &memory, &entrySize) == 0);
+        CHECK(Scan(memory, 0x10000000).empty());
+    }
+}
+
+int main()
+{
+    TestArrays(false);
+    TestArrays(true);
+    TestBadHeaders(false);
+    TestBadHeaders(true);
+    TestAddressRange();
+    TestSampleImages();
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,228 @@
+#include <ntdll/ntdll.h>
+#include "Tls.h"
+
+#include <cstdio>
+#include <vector>
+
+// The TEB TLS variables of Tls.h on fake x64 TEBs, allocated with the exact size of the TEB allocation so that the
+// sanitizers catch writes past it. The TEB itself is filled with a pattern, like the OS data in a real one. Variables
+// must not overlap each other, the TEB or the rest of the allocation, threads must not see each other's variables,
+// and TlsCheckRegion must refuse a region the OS has written to. The x86 layout is pinned by the static_assert in Tls.h
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what, int line)
+{
+    if (!condition)
+    {
+        printf("FAIL line %d: %s\n", line, what);
+        ++failures;
+    }
+}
+#define CHECK(condition) Check(condition, #condition, __LINE__)
+
+static const UCHAR TebPattern = 0xA5;
+
+static PTEB CurrentTeb = nullptr;
+
+PTEB NtCurrentTeb()
+{
+    return CurrentTeb;
+}
+
+class FakeTeb
+{
+public:
+    FakeTeb() : memory_(TebAllocationSize, 0)
+    {
+        memset(memory_.data(), TebPattern, sizeof(TEB));
+    }
+
+    PTEB Teb() { return reinterpret_cast<PTEB>(memory_.data()); }
+    UCHAR* Bytes() { return memory_.data(); }
+
+private:
+    std::vector<UCHAR> memory_;
+};
+
+struct VariableRange
+{
+    ULONG_PTR Offset;
+    ULONG_PTR Size;
+};
+
+// The offsets and sizes of all declared variables, in declaration order
+template<ULONG_PTR Index>
+struct CollectVariables
+{
+    static void Add(std::vector<VariableRange>& ranges)
+    {
+        CollectVariables<Index - 1>::Add(ranges);
+        const TlsVariable Variable = static_cast<TlsVariable>(Index - 1);
+        ranges.push_back({ TebOffset<Variable>::Value, TlsVariableTraits<Variable>::Size });
+    }
+};
+
+template<>
+struct CollectVariables<0>
+{
+    static void Add(std::vector<VariableRange>&) {}
+};
+
+static std::vector<VariableRange> Variables()
+{
+    std::vector<VariableRange> ranges;
+    CollectVariables<static_cast<ULONG_PTR>(TlsVariable::MaxTlsVariable)>::Add(ranges);
+    return ranges;
+}
+
+// Every variable is aligned, inside the region, past the TEB and clear of the others
+static void TestLayout()
+{
+    CHECK(TlsRegionOffset >= sizeof(TEB));
+    CHECK(TlsRegionOffset + TlsRegionSize <= TebAllocationSize);
+
+    ULONG_PTR used = 0;
+    const std::vector<VariableRange> ranges = Variables();
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        const VariableRange& range = ranges[i];
+        CHECK(range.Offset % alignof(PVOID) == 0);
+        CHECK(range.Size != 0 && range.Size % sizeof(PVOID) == 0);
+        CHECK(range.Offset >= TlsRegionOffset);
+        CHECK(range.Offset + range.Size <= TlsRegionOffset + TlsRegionSize);
+        for (size_t j = 0; j < i; ++j)
+            CHECK(range.Offset >= ranges[j].Offset + ranges[j].Size || ranges[j].Offset >= range.Offset + range.Size);
+        used += range.Size;
+    }
+    CHECK(used == TlsRegionUsed);
+    CHECK(TlsRegionUsed <= TlsRegionSize);
+}
+
+// A write through one variable changes its own bytes and nothing else
+template<TlsVariable Variable>
+static void CheckWriteIsolated(FakeTeb& teb)
+{
+    typedef typename TlsVariableTraits<Variable>::Type Type;
+    std::vector<UCHAR> before(teb.Bytes(), teb.Bytes() + TebAllocationSize);
+
+    Type value;
+    memset(&value, 0xFF, sizeof(value));
+    *TlsGet<Variable>() = value;
+
+    const ULONG_PTR begin = TebOffset<Variable>::Value;
+    for (ULONG_PTR i = 0; i < TebAllocationSize; ++i)
+    {
+        const bool inside = i >= begin && i < begin + sizeof(Type);
+        if (inside != (teb.Bytes()[i] != before[i]))
+        {
+            printf("FAIL variable %u: byte %#zx %s\n", (unsigned)Variable, (size_t)i, inside ? "not written" : "overwritten");
+            ++failures;
+            return;
+        }
+    }
+}
+
+static void TestWritesIsolated()
+{
+    FakeTeb teb;
+    CurrentTeb = teb.Teb();
+    CheckWriteIsolated<TlsVariable::InstrumentationCallbackDisabled>(teb);
+    CheckWriteIsolated<TlsVariable::DebugRegisters>(teb);
+
+    // Clearing one variable leaves the other alone
+    *TlsGetInstrumentationCallbackDisabled() = 0;
+    CHECK(*TlsGet<TlsVariable::DebugRegisters>() == reinterpret_cast<_SAVE_DEBUG_REGISTERS*>(~(ULONG_PTR)0));
+    *TlsGet<TlsVariable::DebugRegisters>() = nullptr;
+    CHECK(*TlsGetInstrumentationCallbackDisabled() == 0);
+
+    for (ULONG_PTR i = 0; i < sizeof(TEB); ++i)
+        CHECK(teb.Bytes()[i] == TebPattern);
+    CurrentTeb = nullptr;
+}
+
+// Each thread has its own variables
+static void TestThreadsSeparate()
+{
+    FakeTeb first, second;
+    int entry;
+    CurrentTeb = first.Teb();
+    *TlsGet<TlsVariable::DebugRegisters>() = reinterpret_cast<_SAVE_DEBUG_REGISTERS*>(&entry);
+    *TlsGetInstrumentationCallbackDisabled() = 1;
+
+    CurrentTeb = second.Teb();
+    CHECK(*TlsGet<TlsVariable::DebugRegisters>() == nullptr);
+    CHECK(*TlsGetInstrumentationCallbackDisabled() == 0);
+    *TlsGetInstrumentationCallbackDisabled() = 1;
+    *TlsGetInstrumentationCallbackDisabled() = 0;
+
+    CurrentTeb = first.Teb();
+    CHECK(*TlsGet<TlsVariable::DebugRegisters>() == reinterpret_cast<_SAVE_DEBUG_REGISTERS*>(&entry));
+    CHECK(*TlsGetInstrumentationCallbackDisabled() == 1);
+    CurrentTeb = nullptr;
+}
+
+// The whole region, not just the part the variables use, fits the allocation: the headroom left for new variables
+static void TestRegionExhaustion()
+{
+    FakeTeb teb;
+    memset(teb.Bytes() + TlsRegionOffset, 0x5A, TlsRegionSize);
+    for (ULONG_PTR i = 0; i < sizeof(TEB); ++i)
+        CHECK(teb.Bytes()[i] == TebPattern);
+    printf("TLS region: %zu of %zu bytes used\n", (size_t)TlsRegionUsed, (size_t)TlsRegionSize);
+}
+
+static void TestRegionCheck()
+{
+    // A clean region is usable, and the result is kept: later writes by our own variables do not change it
+    {
+        FakeTeb teb;
+        volatile LONG state = 0;
+        CHECK(TlsCheckRegion(&state, teb.Teb(), 19045));
+        CHECK(state == 2);
+        teb.Bytes()[TlsRegionOffset] = 1;
+        CHECK(TlsCheckRegion(&state, teb.Teb(), 19045));
+    }
+
+    // Windows 2000 is refused whatever the region holds
+    {
+        FakeTeb teb;
+        volatile LONG state = 0;
+        CHECK(!TlsCheckRegion(&state, teb.Teb(), 2195));
+        CHECK(state == 3);
+    }
+
+    // Any nonzero byte in the used part means the OS uses it. Bytes outside that part do not matter
+    for (ULONG_PTR i = TlsRegionOffset - 8; i < TlsRegionOffset + TlsRegionUsed + 8; ++i)
+    {
+        FakeTeb teb;
+        teb.Bytes()[i] = 0x80;
+        volatile LONG state = 0;
+        const bool expected = i < TlsRegionOffset || i >= TlsRegionOffset + TlsRegionUsed;
+        if (TlsCheckRegion(&state, teb.Teb(), 19045) != expected || state != (expected ? 2 : 3))
+        {
+            printf("FAIL region check with byte %#zx set\n", (size_t)i);
+            ++failures;
+        }
+    }
+
+    // While another thread checks, TLS is left alone and the state is not touched
+    {
+        FakeTeb teb;
+        volatile LONG state = 1;
+        CHECK(!TlsCheckRegion(&state, teb.Teb(), 19045));
+        CHECK(state == 1);
+    }
+}
+
+int main()
+{
+    TestLayout();
+    TestWritesIsolated();
+    TestThreadsSeparate();
+    TestRegionExhaustion();
+    TestRegionCheck();
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
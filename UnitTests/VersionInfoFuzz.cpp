@@ -0,0 +1,64 @@
+#include <windows.h>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "VersionInfo.h"
+#include "PeImage.h"
+
+// Fuzzer entry point for the VS_VERSIONINFO walker, built like FilterFuzz. The inputs are raw version resources.
+// A patched resource must come out of a second patch unchanged
+//
+//   VersionInfoFuzz -max_len=4096 fuzz-corpus
+
+static const WCHAR* const Properties[] = { L"FileVersion", L"ProductVersion" };
+
+extern "C" int LLVMFuzzerTestOneInput(const UCHAR* data, size_t size)
+{
+    std::vector<BYTE> patched(data, data + size);
+    PatchVersionInfoBuildNumber(patched.data(), (ULONG)patched.size(), 1337, Properties, ARRAYSIZE(Properties));
+    std::vector<BYTE> again(patched);
+    PatchVersionInfoBuildNumber(again.data(), (ULONG)again.size(), 1337, Properties, ARRAYSIZE(Properties));
+    if (again != patched)
+    {
+        fprintf(stderr, "Second patch changed the resource\n");
+        abort();
+    }
+    return 0;
+}
+
+#ifndef SCYLLAHIDE_LIBFUZZER
+// Runs the files named on the command line. PE files are replaced by their version resource, so that the
+// sample images can seed a corpus:  VersionInfoFuzz -extract fuzz-corpus/ ../SCMRevGen/*.dll
+int main(int argc, char* argv[])
+{
+    const bool extract = argc > 2 && strcmp(argv[1], "-extract") == 0;
+    for (int i = extract ? 3 : 1; i < argc; ++i)
+    {
+        std::vector<BYTE> data;
+        PeImage image;
+        if (image.Load(argv[i]))
+            image.FindResource(16 /* RT_VERSION */, data);
+        else if (!ReadFileBytes(argv[i], data))
+        {
+            fprintf(stderr, "Can't read %s\n", argv[i]);
+            return 1;
+        }
+
+        if (extract)
+        {
+            const char* name = strrchr(argv[i], '/');
+            const std::string path = std::string(argv[2]) + "/" + (name != nullptr ? name + 1 : argv[i]) + ".version";
+            FILE* file = fopen(path.c_str(), "wb");
+            if (file == nullptr || fwrite(data.data(), 1, data.size(), file) != data.size())
+            {
+                fprintf(stderr, "Can't write %s\n", path.c_str());
+                return 1;
+            }
+            fclose(file);
+        }
+        else
+            LLVMFuzzerTestOneInput(data.data(), data.size());
+    }
+    return 0;
+}
+#endif
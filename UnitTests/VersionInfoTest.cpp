@@ -0,0 +1,378 @@
+#include <windows.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include "VersionInfo.h"
+#include "PeImage.h"
+
+// Round trip and mutation tests for the VS_VERSIONINFO walker of the ntdll version patch. The walker is checked
+// against a separate reader and rewrite model written from the format description, on the version resources of the
+// sample images and on generated ones
+//
+//   VersionInfoTest [mutations] [seed]
+
+static_assert(sizeof(WCHAR) == 2, "Build with -fshort-wchar");
+
+static const WORD FakeBuild = 1337;
+static const WCHAR* const Properties[] = { L"FileVersion", L"ProductVersion" };
+
+static int failures = 0;
+
+static void Fail(const std::string& name, const char* what)
+{
+    if (failures < 25)
+        printf("FAIL %s: %s\n", name.c_str(), what);
+    ++failures;
+}
+
+typedef std::u16string String;
+
+static String Utf16(const char* s)
+{
+    return String(s, s + strlen(s));
+}
+
+static size_t Align4(size_t offset)
+{
+    return (offset + 3) & ~(size_t)3;
+}
+
+struct Node
+{
+    String Key;
+    WORD Type = 0;
+    WORD ValueLength = 0;
+    std::vector<BYTE> Value;
+    std::vector<BYTE> Rest;     // Of a String: the bytes from the value to the end of the block
+    std::vector<Node> Children;
+};
+
+static void PutWord(std::vector<BYTE>& data, size_t offset, WORD value)
+{
+    memcpy(data.data() + offset, &value, sizeof(value));
+}
+
+// Writes a block the way rc.exe does: value lengths of strings in WCHARs including the terminator
+static void WriteNode(std::vector<BYTE>& data, const Node& node)
+{
+    const size_t start = data.size();
+    data.resize(start + 6);
+    for (const char16_t c : node.Key)
+    {
+        data.push_back((BYTE)c);
+        data.push_back((BYTE)(c >> 8));
+    }
+    data.insert(data.end(), 2, 0);
+    data.resize(Align4(data.size()));
+    data.insert(data.end(), node.Value.begin(), node.Value.end());
+    for (const auto& child : node.Children)
+    {
+        data.resize(Align4(data.size()));
+        WriteNode(data, child);
+    }
+    PutWord(data, start, (WORD)(data.size() - start));
+    PutWord(data, start + 2, node.ValueLength);
+    PutWord(data, start + 4, node.Type);
+}
+
+static Node TextNode(const char* key, const String& value)
+{
+    Node node;
+    node.Key = Utf16(key);
+    node.Type = 1;
+    node.ValueLength = (WORD)(value.size() + 1);
+    for (const char16_t c : value)
+    {
+        node.Value.push_back((BYTE)c);
+        node.Value.push_back((BYTE)(c >> 8));
+    }
+    node.Value.insert(node.Value.end(), 2, 0);
+    return node;
+}
+
+static Node MakeVersionInfo(const String& fileVersion, const String& productVersion, std::mt19937& rng)
+{
+    Node root;
+    root.Key = Utf16("VS_VERSION_INFO");
+    VS_FIXEDFILEINFO fixed = { 0xFEEF04BD, 0x10000, MAKELONG(1, 6), MAKELONG(17514, 7601), MAKELONG(1, 6), MAKELONG(17514, 7601) };
+    root.Value.resize(sizeof(fixed));
+    memcpy(root.Value.data(), &fixed, sizeof(fixed));
+    root.ValueLength = sizeof(fixed);
+
+    Node stringFileInfo;
+    stringFileInfo.Key = Utf16("StringFileInfo");
+    stringFileInfo.Type = 1;
+    Node table;
+    table.Key = Utf16("040904B0");
+    table.Type = 1;
+    table.Children.push_back(TextNode("CompanyName", Utf16("Microsoft Corporation")));
+    table.Children.push_back(TextNode("FileDescription", Utf16("NT Layer DLL")));
+    table.Children.push_back(TextNode("FileVersion", fileVersion));
+    // Looks like the values we patch, but has a different key
+    table.Children.push_back(TextNode("FileVersionEx", Utf16("6.1.7601.17514")));
+    table.Children.push_back(TextNode("InternalName", Utf16("ntdll.dll")));
+    table.Children.push_back(TextNode("ProductVersion", productVersion));
+    if (rng() % 2 == 0)
+        std::swap(table.Children[0], table.Children[3]);
+    stringFileInfo.Children.push_back(table);
+
+    // A VarFileInfo with what the old memcmp scan took for a fixed file info signature
+    Node varFileInfo;
+    varFileInfo.Key = Utf16("VarFileInfo");
+    varFileInfo.Type = 1;
+    Node translation;
+    translation.Key = Utf16("Translation");
+    translation.Value = { 0xBD, 0x04, 0xEF, 0xFE, 0x09, 0x04, 0xB0, 0x04 };
+    translation.ValueLength = (WORD)translation.Value.size();
+    varFileInfo.Children.push_back(translation);
+
+    if (rng() % 2 == 0)
+    {
+        root.Children.push_back(stringFileInfo);
+        root.Children.push_back(varFileInfo);
+    }
+    else
+    {
+        root.Children.push_back(varFileInfo);
+        root.Children.push_back(stringFileInfo);
+    }
+    return root;
+}
+
+// Reads the block at offset the way the format describes it. Returns false if the block is malformed
+static bool ReadNode(const std::vector<BYTE>& data, size_t offset, size_t end, int depth, Node& node)
+{
+    if (offset + 6 > end)
+        return false;
+    WORD length;
+    memcpy(&length, data.data() + offset, 2);
+    memcpy(&node.ValueLength, data.data() + offset + 2, 2);
+    memcpy(&node.Type, data.data() + offset + 4, 2);
+    if (length < 8 || offset + length > end)
+        return false;
+    end = offset + length;
+
+    size_t p = offset + 6;
+    for (;; p += 2)
+    {
+        if (p + 2 > end)
+            return false;
+        const char16_t c = (char16_t)(data[p] | (data[p + 1] << 8));
+        if (c == 0)
+            break;
+        node.Key.push_back(c);
+    }
+    p = Align4(p + 2);
+    const size_t valueSize = std::min<size_t>(node.Type == 1 ? node.ValueLength * 2 : node.ValueLength, end > p ? end - p : 0);
+    if (p > end)
+        return false;
+    node.Value.assign(data.begin() + p, data.begin() + p + valueSize);
+    if (depth == 3)
+    {
+        node.Rest.assign(data.begin() + p, data.begin() + end);
+        return true;
+    }
+
+    for (p = Align4(p + valueSize); p + 2 <= end;)
+    {
+        WORD childLength;
+        memcpy(&childLength, data.data() + p, 2);
+        if (childLength == 0)
+            break;
+        Node child;
+        if (!ReadNode(data, p, end, depth + 1, child))
+            return false;
+        node.Children.push_back(child);
+        p = Align4(p + childLength);
+    }
+    return true;
+}
+
+// What the patch should make of a version string value, or an empty value if it must be left alone
+static std::vector<BYTE> ExpectedString(const std::vector<BYTE>& value, WORD& newValueLength)
+{
+    String s;
+    for (size_t i = 0; i + 1 < value.size(); i += 2)
+        s.push_back((char16_t)(value[i] | (value[i + 1] << 8)));
+    const size_t valueLength = s.size();
+    const size_t terminator = s.find(u'\0');
+    if (terminator != String::npos)
+        s.resize(terminator);
+
+    const size_t firstDot = s.find(u'.');
+    const size_t secondDot = firstDot == String::npos ? String::npos : s.find(u'.', firstDot + 1);
+    if (secondDot == String::npos)
+        return {};
+    size_t buildEnd = secondDot + 1;
+    while (buildEnd < s.size() && s[buildEnd] >= u'0' && s[buildEnd] <= u'9')
+        ++buildEnd;
+    if (buildEnd == secondDot + 1)
+        return {};
+
+    const String patched = s.substr(0, secondDot + 1) + Utf16(std::to_string(FakeBuild).c_str()) + s.substr(buildEnd);
+    if (patched.size() + 1 > valueLength || valueLength > 128)
+        return {};
+    newValueLength = (WORD)(patched.size() + 1);
+    std::vector<BYTE> result(value.size(), 0);
+    memcpy(result.data(), patched.data(), patched.size() * 2);
+    return result;
+}
+
+static bool IsProperty(const String& key)
+{
+    return key == u"FileVersion" || key == u"ProductVersion";
+}
+
+// Compares the tree before and after the patch. Everything must be unchanged except the fields the patch is
+// supposed to rewrite. Returns the number of fields that were rewritten
+static ULONG CompareTrees(const std::string& name, const Node& before, const Node& after, int depth)
+{
+    ULONG patched = 0;
+    if (before.Key != after.Key || before.Type != after.Type || before.Children.size() != after.Children.size() ||
+        before.Rest.size() != after.Rest.size())
+    {
+        Fail(name, "tree structure changed");
+        return 0;
+    }
+
+    if (depth == 0 && before.Value.size() >= sizeof(VS_FIXEDFILEINFO) && before.Key == u"VS_VERSION_INFO")
+    {
+        VS_FIXEDFILEINFO expected, actual;
+        memcpy(&expected, before.Value.data(), sizeof(expected));
+        memcpy(&actual, after.Value.data(), sizeof(actual));
+        if (expected.dwSignature == 0xFEEF04BD)
+        {
+            expected.dwFileVersionLS = MAKELONG(LOWORD(expected.dwFileVersionLS), FakeBuild);
+            expected.dwProductVersionLS = MAKELONG(LOWORD(expected.dwProductVersionLS), FakeBuild);
+            ++patched;
+        }
+        if (memcmp(&expected, &actual, sizeof(expected)) != 0 ||
+            memcmp(before.Value.data() + sizeof(expected), after.Value.data() + sizeof(expected), before.Value.size() - sizeof(expected)) != 0)
+            Fail(name, "fixed file info");
+    }
+    else if (depth == 3 && IsProperty(before.Key) && before.Type == 1)
+    {
+        // The value length shrinks if the fake build number is shorter, but the bytes of the old value are still there
+        WORD newValueLength = before.ValueLength;
+        const std::vector<BYTE> expected = ExpectedString(before.Value, newValueLength);
+        std::vector<BYTE> expectedRest = before.Rest;
+        if (!expected.empty())
+        {
+            std::copy(expected.begin(), expected.end(), expectedRest.begin());
+            ++patched;
+        }
+        if (expectedRest != after.Rest || after.ValueLength != newValueLength)
+            Fail(name, "version string");
+    }
+    else if (before.Value != after.Value || before.Rest != after.Rest || before.ValueLength != after.ValueLength)
+        Fail(name, "value that must not be patched changed");
+
+    for (size_t i = 0; i < before.Children.size(); ++i)
+        patched += CompareTrees(name, before.Children[i], after.Children[i], depth + 1);
+    return patched;
+}
+
+static void RoundTrip(const std::string& name, const std::vector<BYTE>& resource, ULONG minPatched)
+{
+    Node before;
+    if (!ReadNode(resource, 0, resource.size(), 0, before))
+    {
+        Fail(name, "unreadable resource");
+        return;
+    }
+
+    std::vector<BYTE> patched = resource;
+    const ULONG numPatched = PatchVersionInfoBuildNumber(patched.data(), (ULONG)patched.size(), FakeBuild, Properties, ARRAYSIZE(Properties));
+
+    Node after;
+    if (!ReadNode(patched, 0, patched.size(), 0, after))
+    {
+        Fail(name, "patched resource is unreadable");
+        return;
+    }
+    const ULONG expectedPatched = CompareTrees(name, before, after, 0);
+    if (numPatched != expectedPatched || numPatched < minPatched)
+        Fail(name, "wrong number of patched fields");
+
+    // Patching again must not change anything
+    std::vector<BYTE> again = patched;
+    PatchVersionInfoBuildNumber(again.data(), (ULONG)again.size(), FakeBuild, Properties, ARRAYSIZE(Properties));
+    if (again != patched)
+        Fail(name, "second patch changed the resource");
+
+    printf("%s: %zu bytes, %u of %u fields patched\n", name.c_str(), resource.size(), numPatched, (ULONG)(1 + ARRAYSIZE(Properties)));
+}
+
+int main(int argc, char* argv[])
+{
+    const long mutations = argc > 1 ? strtol(argv[1], nullptr, 0) : 200000;
+    const unsigned long seed = argc > 2 ? strtoul(argv[2], nullptr, 0) : 1;
+    std::mt19937 rng(seed);
+    std::vector<std::vector<BYTE>> seeds;
+
+    for (const char* path : SampleImages)
+    {
+        PeImage image;
+        std::vector<BYTE> resource;
+        if (!image.Load(path) || !image.FindResource(16 /* RT_VERSION */, resource))
+        {
+            Fail(path, "no version resource");
+            continue;
+        }
+        RoundTrip(path, resource, 1);
+        seeds.push_back(resource);
+    }
+
+    static const char* const versions[] =
+    {
+        "6.1.7601.17514 (win7sp1_rtm.101119-1850)",
+        "10.0.19041.1 (WinBuild.160101.0800)",
+        "10.0.22621.2506",
+        "6.3.9600.16384",
+        "6.2.9200",
+        "6.1",          // No build number
+        "6.1.x.1",      // No digits after the second dot
+        "1.2.3",        // Grows to 1.2.1337, which does not fit
+    };
+    for (const char* fileVersion : versions)
+    {
+        for (const char* productVersion : versions)
+        {
+            std::vector<BYTE> resource;
+            WriteNode(resource, MakeVersionInfo(Utf16(fileVersion), Utf16(productVersion), rng));
+            RoundTrip(std::string("generated ") + fileVersion + " / " + productVersion, resource, 1);
+            seeds.push_back(resource);
+        }
+    }
+
+    // Mutated resources only need to be handled without reading or writing out of bounds, which the exact size
+    // copies let ASan catch. They must still come out of a second patch unchanged
+    for (long i = 0; i < mutations; ++i)
+    {
+        std::vector<BYTE> resource = seeds[rng() % seeds.size()];
+        const int numMutations = 1 + rng() % 4;
+        for (int m = 0; m < numMutations; ++m)
+        {
+            const size_t offset = rng() % resource.size();
+            switch (rng() % 4)
+            {
+            case 0: resource[offset] ^= (BYTE)(1 << (rng() % 8)); break;
+            case 1: resource[offset] = (BYTE)rng(); break;
+            case 2: resource[offset & ~(size_t)3] = (BYTE)(rng() % 64); break; // Small lengths
+            case 3: resource.resize(offset + 1); break;
+            }
+        }
+        std::vector<BYTE> patched(resource);
+        PatchVersionInfoBuildNumber(patched.data(), (ULONG)patched.size(), FakeBuild, Properties, ARRAYSIZE(Properties));
+        std::vector<BYTE> again(patched);
+        PatchVersionInfoBuildNumber(again.data(), (ULONG)again.size(), FakeBuild, Properties, ARRAYSIZE(Properties));
+        if (again != patched)
+            Fail("mutation " + std::to_string(i), "second patch changed the resource");
+    }
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+// Some sources include <Windows.h>, which is a different file on a case sensitive file system
+#include "windows.h"